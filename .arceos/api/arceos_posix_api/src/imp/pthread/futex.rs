@@ -0,0 +1,45 @@
+//! Wait queues keyed by the address of a 32-bit word, like Linux futexes, on
+//! which C code builds the blocking paths of its synchronization primitives.
+//! The fast paths are atomic operations on the words, which never get here.
+
+use core::ffi::c_int;
+use core::sync::atomic::{AtomicI32, Ordering};
+
+use axtask::WaitQueue;
+
+use crate::utils::check_null_ptr;
+
+/// The number of wait queues that the words are hashed to.
+const FUTEX_QUEUES: usize = 64;
+
+static QUEUES: [WaitQueue; FUTEX_QUEUES] = [const { WaitQueue::new() }; FUTEX_QUEUES];
+
+fn queue_of(addr: *const c_int) -> &'static WaitQueue {
+    // The low bits are always zero for aligned words.
+    &QUEUES[(addr as usize >> 2) % FUTEX_QUEUES]
+}
+
+/// Blocks the current task while the word at `addr` holds `val`, until it is
+/// woken by [`sys_futex_wake`] after the word changed.
+pub fn sys_futex_wait(addr: *const c_int, val: c_int) -> c_int {
+    debug!("sys_futex_wait <= {:#x} {}", addr as usize, val);
+    syscall_body!(sys_futex_wait, {
+        check_null_ptr(addr)?;
+        let word = unsafe { &*addr.cast::<AtomicI32>() };
+        queue_of(addr).wait_until(|| word.load(Ordering::Acquire) != val);
+        Ok(0)
+    })
+}
+
+/// Wakes the tasks blocked on the word at `addr`.
+///
+/// Tasks blocked on other words hashed to the same queue wake up too, and go
+/// back to sleep as their words have not changed.
+pub fn sys_futex_wake(addr: *const c_int) -> c_int {
+    debug!("sys_futex_wake <= {:#x}", addr as usize);
+    syscall_body!(sys_futex_wake, {
+        check_null_ptr(addr)?;
+        queue_of(addr).notify_all(true);
+        Ok(0)
+    })
+}
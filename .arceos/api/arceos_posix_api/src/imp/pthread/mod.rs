@@ -8,6 +8,7 @@ use spin::RwLock;
 
 use crate::ctypes;
 
+pub mod futex;
 pub mod mutex;
 
 lazy_static::lazy_static! {
@@ -1,6 +1,6 @@
 use crate::{ctypes, utils::check_null_mut_ptr};
 
-use axerrno::LinuxResult;
+use axerrno::{LinuxError, LinuxResult};
 use axsync::Mutex;
 
 use core::ffi::c_int;
@@ -24,6 +24,12 @@ impl PthreadMutex {
         Ok(())
     }
 
+    fn try_lock(&self) -> LinuxResult {
+        let guard = self.0.try_lock().ok_or(LinuxError::EBUSY)?;
+        core::mem::forget(guard);
+        Ok(())
+    }
+
     fn unlock(&self) -> LinuxResult {
         unsafe { self.0.force_unlock() };
         Ok(())
@@ -57,6 +63,18 @@ pub fn sys_pthread_mutex_lock(mutex: *mut ctypes::pthread_mutex_t) -> c_int {
     })
 }
 
+/// Lock the given mutex if it is not locked, or fail with `EBUSY`.
+pub fn sys_pthread_mutex_trylock(mutex: *mut ctypes::pthread_mutex_t) -> c_int {
+    debug!("sys_pthread_mutex_trylock <= {:#x}", mutex as usize);
+    syscall_body!(sys_pthread_mutex_trylock, {
+        check_null_mut_ptr(mutex)?;
+        unsafe {
+            (*mutex.cast::<PthreadMutex>()).try_lock()?;
+        }
+        Ok(0)
+    })
+}
+
 /// Unlock the given mutex.
 pub fn sys_pthread_mutex_unlock(mutex: *mut ctypes::pthread_mutex_t) -> c_int {
     debug!("sys_pthread_mutex_unlock <= {:#x}", mutex as usize);
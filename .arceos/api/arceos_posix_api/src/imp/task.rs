@@ -33,6 +33,7 @@ pub fn sys_getpid() -> c_int {
 /// Exit current task
 pub fn sys_exit(exit_code: c_int) -> ! {
     debug!("sys_exit <= {}", exit_code);
+    axruntime::call_dtors();
     #[cfg(feature = "multitask")]
     axtask::exit(exit_code);
     #[cfg(not(feature = "multitask"))]
@@ -61,8 +61,11 @@ pub use imp::net::{
 #[cfg(feature = "pipe")]
 pub use imp::pipe::sys_pipe;
 #[cfg(feature = "multitask")]
+pub use imp::pthread::futex::{sys_futex_wait, sys_futex_wake};
+#[cfg(feature = "multitask")]
 pub use imp::pthread::mutex::{
-    sys_pthread_mutex_init, sys_pthread_mutex_lock, sys_pthread_mutex_unlock,
+    sys_pthread_mutex_init, sys_pthread_mutex_lock, sys_pthread_mutex_trylock,
+    sys_pthread_mutex_unlock,
 };
 #[cfg(feature = "multitask")]
 pub use imp::pthread::{sys_pthread_create, sys_pthread_exit, sys_pthread_join, sys_pthread_self};
@@ -22,6 +22,8 @@
 //! - Upperlayer stacks (fs, net, display)
 //!     - `fs`: Enable file system support.
 //!     - `myfs`: Allow users to define their custom filesystems to override the default.
+//!     - `initramfs`: Mount the cpio archive at `AX_INITRAMFS`, linked into the kernel,
+//!       on `/` instead of a block device.
 //!     - `net`: Enable networking support.
 //!     - `display`: Enable graphics support.
 //! - Device drivers
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Times `qsort` of ints and of 24-byte records over random, sorted and reversed inputs.
+
+#define NEL 100000
+
+struct record {
+    long key;
+    long payload[2];
+};
+
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_record(const void *a, const void *b)
+{
+    long x = ((const struct record *)a)->key, y = ((const struct record *)b)->key;
+    return (x > y) - (x < y);
+}
+
+static long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static int key_of(const char *order, int i)
+{
+    if (strcmp(order, "sorted") == 0)
+        return i;
+    if (strcmp(order, "reversed") == 0)
+        return NEL - i;
+    return rand();
+}
+
+int main()
+{
+    static const char *orders[] = {"random", "sorted", "reversed"};
+    int *ints = malloc(NEL * sizeof(int));
+    struct record *records = malloc(NEL * sizeof(struct record));
+    if (!ints || !records) {
+        puts("out of memory");
+        return 1;
+    }
+
+    for (int o = 0; o < 3; o++) {
+        long start;
+
+        for (int i = 0; i < NEL; i++) ints[i] = key_of(orders[o], i);
+        start = now_us();
+        qsort(ints, NEL, sizeof(int), cmp_int);
+        printf("qsort %d ints (%s): %ld us\n", NEL, orders[o], now_us() - start);
+
+        for (int i = 0; i < NEL; i++) records[i].key = key_of(orders[o], i);
+        start = now_us();
+        qsort(records, NEL, sizeof(struct record), cmp_record);
+        printf("qsort %d records (%s): %ld us\n", NEL, orders[o], now_us() - start);
+
+        for (int i = 1; i < NEL; i++) {
+            if (ints[i - 1] > ints[i] || records[i - 1].key > records[i].key) {
+                puts("qsort failed!");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -11,12 +11,15 @@
 extern crate log;
 extern crate alloc;
 
+mod magazine;
 mod page;
 
 use allocator::{AllocResult, BaseAllocator, BitmapPageAllocator, ByteAllocator, PageAllocator};
 use core::alloc::{GlobalAlloc, Layout};
 use core::ptr::NonNull;
-use kspin::SpinNoIrq;
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use kspin::{SpinNoIrq, SpinNoIrqGuard};
+use magazine::Magazine;
 
 const PAGE_SIZE: usize = 0x1000;
 const MIN_HEAP_SIZE: usize = 0x8000; // 32 K
@@ -36,6 +39,63 @@ cfg_if::cfg_if! {
     }
 }
 
+/// How often a lock of the allocator was acquired, only counted with the
+/// `lockstat` feature.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct AllocLockStats {
+    /// The number of times the lock was acquired.
+    pub acquisitions: u64,
+    /// The number of those that found it locked.
+    pub contended: u64,
+}
+
+struct LockCounts {
+    acquisitions: AtomicU64,
+    contended: AtomicU64,
+}
+
+impl LockCounts {
+    const fn new() -> Self {
+        Self {
+            acquisitions: AtomicU64::new(0),
+            contended: AtomicU64::new(0),
+        }
+    }
+
+    #[inline(always)]
+    fn lock<'a, T>(&self, lock: &'a SpinNoIrq<T>) -> SpinNoIrqGuard<'a, T> {
+        #[cfg(feature = "lockstat")]
+        {
+            self.acquisitions.fetch_add(1, Ordering::Relaxed);
+            if let Some(guard) = lock.try_lock() {
+                return guard;
+            }
+            self.contended.fetch_add(1, Ordering::Relaxed);
+        }
+        lock.lock()
+    }
+
+    fn stats(&self) -> AllocLockStats {
+        AllocLockStats {
+            acquisitions: self.acquisitions.load(Ordering::Relaxed),
+            contended: self.contended.load(Ordering::Relaxed),
+        }
+    }
+}
+
+static BALLOC_LOCK: LockCounts = LockCounts::new();
+static PALLOC_LOCK: LockCounts = LockCounts::new();
+
+/// Returns how often the locks of the byte allocator and the page allocator
+/// were acquired, by name. The allocator sits below the clock, so unlike the
+/// lock classes of `axsync`, the waiting and holding times are not measured.
+pub fn lock_stats() -> [(&'static str, AllocLockStats); 2] {
+    [
+        ("alloc_bytes", BALLOC_LOCK.stats()),
+        ("alloc_pages", PALLOC_LOCK.stats()),
+    ]
+}
+
 /// The global allocator used by ArceOS.
 ///
 /// It combines a [`ByteAllocator`] and a [`PageAllocator`] into a simple
@@ -46,6 +106,10 @@ cfg_if::cfg_if! {
 /// Currently, [`TlsfByteAllocator`] is used as the byte allocator, while
 /// [`BitmapPageAllocator`] is used as the page allocator.
 ///
+/// Small allocations are served from per-CPU caches of free blocks in front
+/// of the byte allocator, which is only locked to move a batch of blocks in
+/// or out of a cache.
+///
 /// [`TlsfByteAllocator`]: allocator::TlsfByteAllocator
 pub struct GlobalAllocator {
     balloc: SpinNoIrq<DefaultByteAllocator>,
@@ -61,6 +125,14 @@ impl GlobalAllocator {
         }
     }
 
+    fn lock_balloc(&self) -> SpinNoIrqGuard<'_, DefaultByteAllocator> {
+        BALLOC_LOCK.lock(&self.balloc)
+    }
+
+    fn lock_palloc(&self) -> SpinNoIrqGuard<'_, BitmapPageAllocator<PAGE_SIZE>> {
+        PALLOC_LOCK.lock(&self.palloc)
+    }
+
     /// Returns the name of the allocator.
     pub const fn name(&self) -> &'static str {
         cfg_if::cfg_if! {
@@ -82,45 +154,96 @@ impl GlobalAllocator {
     pub fn init(&self, start_vaddr: usize, size: usize) {
         assert!(size > MIN_HEAP_SIZE);
         let init_heap_size = MIN_HEAP_SIZE;
-        self.palloc.lock().init(start_vaddr, size);
+        self.lock_palloc().init(start_vaddr, size);
         let heap_ptr = self
             .alloc_pages(init_heap_size / PAGE_SIZE, PAGE_SIZE)
             .unwrap();
-        self.balloc.lock().init(heap_ptr, init_heap_size);
+        self.lock_balloc().init(heap_ptr, init_heap_size);
     }
 
     /// Add the given region to the allocator.
     ///
     /// It will add the whole region to the byte allocator.
     pub fn add_memory(&self, start_vaddr: usize, size: usize) -> AllocResult {
-        self.balloc.lock().add_memory(start_vaddr, size)
+        self.lock_balloc().add_memory(start_vaddr, size)
     }
 
     /// Allocate arbitrary number of bytes. Returns the left bound of the
     /// allocated region.
     ///
+    /// Small allocations are taken from the cache of the current CPU, which
+    /// is refilled with a batch of blocks from the byte allocator when empty.
+    /// Others are allocated from the byte allocator directly.
+    pub fn alloc(&self, layout: Layout) -> AllocResult<NonNull<u8>> {
+        let Some(class) = magazine::size_class(layout) else {
+            return self.alloc_bytes(layout);
+        };
+        if let Some(ptr) = magazine::with_magazine(class, Magazine::pop) {
+            return Ok(NonNull::new(ptr as *mut u8).unwrap());
+        }
+
+        let layout = magazine::class_layout(class);
+        let ptr = self.alloc_bytes(layout)?;
+        let mut blocks = [0; magazine::BATCH_SIZE];
+        let mut len = 0;
+        {
+            let mut balloc = self.lock_balloc();
+            while len < blocks.len() {
+                let Ok(block) = balloc.alloc(layout) else {
+                    break;
+                };
+                blocks[len] = block.as_ptr() as usize;
+                len += 1;
+            }
+        }
+        // The cache may have been refilled meanwhile by a free on this CPU.
+        let extra = magazine::with_magazine(class, |mag| mag.refill(&blocks[..len]));
+        if !extra.is_empty() {
+            self.dealloc_blocks(extra, layout);
+        }
+        Ok(ptr)
+    }
+
+    /// Allocates from the byte allocator.
+    ///
     /// It firstly tries to allocate from the byte allocator. If there is no
     /// memory, it asks the page allocator for more memory and adds it to the
     /// byte allocator.
-    pub fn alloc(&self, layout: Layout) -> AllocResult<NonNull<u8>> {
+    fn alloc_bytes(&self, layout: Layout) -> AllocResult<NonNull<u8>> {
         // simple two-level allocator: if no heap memory, allocate from the page allocator.
-        let mut balloc = self.balloc.lock();
+        let mut reclaimed = false;
         loop {
+            let mut balloc = self.lock_balloc();
             if let Ok(ptr) = balloc.alloc(layout) {
                 return Ok(ptr);
-            } else {
-                let old_size = balloc.total_bytes();
-                let expand_size = old_size
-                    .max(layout.size())
-                    .next_power_of_two()
-                    .max(PAGE_SIZE);
-                let heap_ptr = self.alloc_pages(expand_size / PAGE_SIZE, PAGE_SIZE)?;
-                debug!(
-                    "expand heap memory: [{:#x}, {:#x})",
-                    heap_ptr,
-                    heap_ptr + expand_size
-                );
-                balloc.add_memory(heap_ptr, expand_size)?;
+            }
+            let old_size = balloc.total_bytes();
+            let expand_size = old_size
+                .max(layout.size())
+                .next_power_of_two()
+                .max(PAGE_SIZE);
+            let res = self
+                .palloc
+                .lock()
+                .alloc_pages(expand_size / PAGE_SIZE, PAGE_SIZE);
+            match res {
+                Ok(heap_ptr) => {
+                    debug!(
+                        "expand heap memory: [{:#x}, {:#x})",
+                        heap_ptr,
+                        heap_ptr + expand_size
+                    );
+                    balloc.add_memory(heap_ptr, expand_size)?;
+                }
+                // The hook frees memory through this allocator, so it must
+                // run without the lock.
+                Err(e) => {
+                    drop(balloc);
+                    if reclaimed || reclaim(expand_size / PAGE_SIZE) == 0 {
+                        return Err(e);
+                    }
+                    reclaimed = true;
+                }
             }
         }
     }
@@ -131,9 +254,27 @@ impl GlobalAllocator {
     /// the same as the one used in [`alloc`]. Otherwise, the behavior is
     /// undefined.
     ///
+    /// Small regions are kept in the cache of the current CPU, which gives
+    /// half of its blocks back to the byte allocator when full.
+    ///
     /// [`alloc`]: GlobalAllocator::alloc
     pub fn dealloc(&self, pos: NonNull<u8>, layout: Layout) {
-        self.balloc.lock().dealloc(pos, layout)
+        let Some(class) = magazine::size_class(layout) else {
+            return self.lock_balloc().dealloc(pos, layout);
+        };
+        let mut drained = [0; magazine::BATCH_SIZE];
+        let block = pos.as_ptr() as usize;
+        if magazine::with_magazine(class, |mag| mag.push(block, &mut drained)) {
+            self.dealloc_blocks(&drained, magazine::class_layout(class));
+        }
+    }
+
+    /// Gives back cached blocks to the byte allocator, under one lock.
+    fn dealloc_blocks(&self, blocks: &[usize], layout: Layout) {
+        let mut balloc = self.lock_balloc();
+        for &block in blocks {
+            balloc.dealloc(NonNull::new(block as *mut u8).unwrap(), layout);
+        }
     }
 
     /// Allocates contiguous pages.
@@ -142,8 +283,46 @@ impl GlobalAllocator {
     ///
     /// `align_pow2` must be a power of 2, and the returned region bound will be
     /// aligned to it.
+    ///
+    /// Single pages are taken from the cache of the current CPU, which is
+    /// refilled with a batch of pages when empty.
+    ///
+    /// If there is not enough memory, the [reclaim hook](set_reclaim_hook) is
+    /// asked to free some before retrying once.
     pub fn alloc_pages(&self, num_pages: usize, align_pow2: usize) -> AllocResult<usize> {
-        self.palloc.lock().alloc_pages(num_pages, align_pow2)
+        if num_pages == 1 && align_pow2 <= PAGE_SIZE {
+            if let Some(page) = magazine::with_page_magazine(Magazine::pop) {
+                return Ok(page);
+            }
+            let mut pages = [0; magazine::BATCH_SIZE];
+            let mut len = 0;
+            {
+                let mut palloc = self.lock_palloc();
+                while len < pages.len() {
+                    let Ok(page) = palloc.alloc_pages(1, PAGE_SIZE) else {
+                        break;
+                    };
+                    pages[len] = page;
+                    len += 1;
+                }
+            }
+            if len > 0 {
+                len -= 1;
+                let extra = magazine::with_page_magazine(|mag| mag.refill(&pages[..len]));
+                if !extra.is_empty() {
+                    self.dealloc_page_batch(extra);
+                }
+                return Ok(pages[len]);
+            }
+        }
+
+        let res = self.lock_palloc().alloc_pages(num_pages, align_pow2);
+        match res {
+            Err(_) if reclaim(num_pages) > 0 => {
+                self.lock_palloc().alloc_pages(num_pages, align_pow2)
+            }
+            res => res,
+        }
     }
 
     /// Gives back the allocated pages starts from `pos` to the page allocator.
@@ -152,29 +331,48 @@ impl GlobalAllocator {
     /// should be the same as the one used in [`alloc_pages`]. Otherwise, the
     /// behavior is undefined.
     ///
+    /// Single pages are kept in the cache of the current CPU, which gives the
+    /// coldest half of its pages back to the page allocator when full.
+    ///
     /// [`alloc_pages`]: GlobalAllocator::alloc_pages
     pub fn dealloc_pages(&self, pos: usize, num_pages: usize) {
-        self.palloc.lock().dealloc_pages(pos, num_pages)
+        if num_pages != 1 {
+            return self.lock_palloc().dealloc_pages(pos, num_pages);
+        }
+        let mut drained = [0; magazine::BATCH_SIZE];
+        if magazine::with_page_magazine(|mag| mag.push(pos, &mut drained)) {
+            self.dealloc_page_batch(&drained);
+        }
+    }
+
+    /// Gives back cached single pages to the page allocator, under one lock.
+    fn dealloc_page_batch(&self, pages: &[usize]) {
+        let mut palloc = self.lock_palloc();
+        for &page in pages {
+            palloc.dealloc_pages(page, 1);
+        }
     }
 
-    /// Returns the number of allocated bytes in the byte allocator.
+    /// Returns the number of allocated bytes in the byte allocator, which
+    /// includes the blocks kept in the per-CPU caches.
     pub fn used_bytes(&self) -> usize {
-        self.balloc.lock().used_bytes()
+        self.lock_balloc().used_bytes()
     }
 
     /// Returns the number of available bytes in the byte allocator.
     pub fn available_bytes(&self) -> usize {
-        self.balloc.lock().available_bytes()
+        self.lock_balloc().available_bytes()
     }
 
-    /// Returns the number of allocated pages in the page allocator.
+    /// Returns the number of allocated pages in the page allocator, which
+    /// includes the pages kept in the per-CPU caches.
     pub fn used_pages(&self) -> usize {
-        self.palloc.lock().used_pages()
+        self.lock_palloc().used_pages()
     }
 
     /// Returns the number of available pages in the page allocator.
     pub fn available_pages(&self) -> usize {
-        self.palloc.lock().available_pages()
+        self.lock_palloc().available_pages()
     }
 }
 
@@ -192,6 +390,32 @@ unsafe impl GlobalAlloc for GlobalAllocator {
     }
 }
 
+static RECLAIM_HOOK: SpinNoIrq<Option<fn(usize) -> usize>> = SpinNoIrq::new(None);
+static RECLAIMING: AtomicBool = AtomicBool::new(false);
+
+/// Sets the function called when the allocator runs out of memory, which
+/// should free about the given number of pages (e.g. by dropping caches) and
+/// return the number of pages it has freed.
+///
+/// The hook may be called from any allocation, so it must not block on locks
+/// that may be held while allocating. It is not called recursively.
+pub fn set_reclaim_hook(hook: fn(usize) -> usize) {
+    *RECLAIM_HOOK.lock() = Some(hook);
+}
+
+fn reclaim(num_pages: usize) -> usize {
+    let Some(hook) = *RECLAIM_HOOK.lock() else {
+        return 0;
+    };
+    if RECLAIMING.swap(true, Ordering::Acquire) {
+        return 0;
+    }
+    let freed = hook(num_pages);
+    RECLAIMING.store(false, Ordering::Release);
+    debug!("reclaimed {} pages for {} pages", freed, num_pages);
+    freed
+}
+
 #[cfg_attr(all(target_os = "none", not(test)), global_allocator)]
 static GLOBAL_ALLOCATOR: GlobalAllocator = GlobalAllocator::new();
 
@@ -0,0 +1,115 @@
+//! Per-CPU caches of small blocks in front of the byte allocator.
+//!
+//! Small allocations are rounded up to a power-of-two size class, and each
+//! CPU keeps a magazine of free blocks per class. Allocating and freeing a
+//! block only touches the magazine of the current CPU. The byte allocator is
+//! only locked to refill an empty magazine or drain a full one, a batch of
+//! blocks at a time.
+//!
+//! Single pages are cached the same way in front of the page allocator.
+
+use core::alloc::Layout;
+
+/// The smallest size class, as a power of two.
+const MIN_CLASS_SHIFT: usize = 4; // 16 B
+/// The largest size class, as a power of two. Larger blocks go to the byte
+/// allocator directly.
+const MAX_CLASS_SHIFT: usize = 11; // 2 KB
+const NUM_CLASSES: usize = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+/// The number of free blocks a magazine holds.
+const MAGAZINE_SIZE: usize = 32;
+/// The number of blocks moved at once between a magazine and the byte
+/// allocator.
+pub(crate) const BATCH_SIZE: usize = MAGAZINE_SIZE / 2;
+
+/// Returns the size class of `layout`, if it is small enough to be cached.
+pub(crate) fn size_class(layout: Layout) -> Option<usize> {
+    let size = layout.size().max(layout.align()).max(1 << MIN_CLASS_SHIFT);
+    let shift = size.next_power_of_two().trailing_zeros() as usize;
+    (shift <= MAX_CLASS_SHIFT).then(|| shift - MIN_CLASS_SHIFT)
+}
+
+/// Returns the layout the blocks of `class` are allocated with from the byte
+/// allocator. Blocks are aligned to their size, so that they fit any layout
+/// of the class.
+pub(crate) fn class_layout(class: usize) -> Layout {
+    let size = 1 << (class + MIN_CLASS_SHIFT);
+    Layout::from_size_align(size, size).unwrap()
+}
+
+/// The free blocks of one size class on a CPU.
+#[derive(Clone, Copy)]
+pub(crate) struct Magazine {
+    blocks: [usize; MAGAZINE_SIZE],
+    len: usize,
+}
+
+/// The magazines of a CPU, one per size class.
+struct Magazines([Magazine; NUM_CLASSES]);
+
+#[percpu::def_percpu]
+static MAGAZINES: Magazines = Magazines(
+    [Magazine {
+        blocks: [0; MAGAZINE_SIZE],
+        len: 0,
+    }; NUM_CLASSES],
+);
+
+/// Free single pages of a CPU. Recently freed pages are handed out first, as
+/// they are more likely to be in the cache of the CPU, and the coldest ones
+/// are given back to the page allocator when it is full.
+#[percpu::def_percpu]
+static PAGE_MAGAZINE: Magazine = Magazine {
+    blocks: [0; MAGAZINE_SIZE],
+    len: 0,
+};
+
+/// Runs `f` on the magazine of `class` of the current CPU.
+///
+/// `f` must not allocate, as the allocator may be called again from it.
+pub(crate) fn with_magazine<R>(class: usize, f: impl FnOnce(&mut Magazine) -> R) -> R {
+    let _guard = kernel_guard::NoPreemptIrqSave::new();
+    f(&mut unsafe { MAGAZINES.current_ref_mut_raw() }.0[class])
+}
+
+/// Runs `f` on the magazine of single pages of the current CPU.
+pub(crate) fn with_page_magazine<R>(f: impl FnOnce(&mut Magazine) -> R) -> R {
+    let _guard = kernel_guard::NoPreemptIrqSave::new();
+    f(unsafe { PAGE_MAGAZINE.current_ref_mut_raw() })
+}
+
+impl Magazine {
+    /// Takes the most recently freed block.
+    pub(crate) fn pop(&mut self) -> Option<usize> {
+        if self.len == 0 {
+            return None;
+        }
+        self.len -= 1;
+        Some(self.blocks[self.len])
+    }
+
+    /// Keeps a freed block.
+    ///
+    /// If the magazine is full, the oldest [`BATCH_SIZE`] blocks are moved to
+    /// `drained` to be given back, and `true` is returned.
+    pub(crate) fn push(&mut self, block: usize, drained: &mut [usize; BATCH_SIZE]) -> bool {
+        let full = self.len == MAGAZINE_SIZE;
+        if full {
+            drained.copy_from_slice(&self.blocks[..BATCH_SIZE]);
+            self.blocks.copy_within(BATCH_SIZE.., 0);
+            self.len -= BATCH_SIZE;
+        }
+        self.blocks[self.len] = block;
+        self.len += 1;
+        full
+    }
+
+    /// Puts blocks allocated in a batch, and returns those that do not fit.
+    pub(crate) fn refill<'a>(&mut self, blocks: &'a [usize]) -> &'a [usize] {
+        let n = blocks.len().min(MAGAZINE_SIZE - self.len);
+        self.blocks[self.len..self.len + n].copy_from_slice(&blocks[..n]);
+        self.len += n;
+        &blocks[n..]
+    }
+}
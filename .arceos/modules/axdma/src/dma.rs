@@ -69,7 +69,7 @@ impl DmaAllocator {
         }
     }
 
-    fn alloc_coherent_pages(&mut self, layout: Layout) -> AllocResult<DMAInfo> {
+    pub(crate) fn alloc_coherent_pages(&mut self, layout: Layout) -> AllocResult<DMAInfo> {
         let num_pages = layout_pages(&layout);
         let vaddr_raw =
             global_allocator().alloc_pages(num_pages, PAGE_SIZE_4K.max(layout.align()))?;
@@ -118,7 +118,7 @@ impl DmaAllocator {
     }
 }
 
-const fn virt_to_bus(addr: VirtAddr) -> BusAddr {
+pub(crate) const fn virt_to_bus(addr: VirtAddr) -> BusAddr {
     let paddr = virt_to_phys(addr);
     phys_to_bus(paddr)
 }
@@ -5,6 +5,7 @@
 extern crate alloc;
 
 mod dma;
+mod pool;
 
 use core::{alloc::Layout, ptr::NonNull};
 
@@ -13,6 +14,23 @@ use memory_addr::PhysAddr;
 
 use self::dma::ALLOCATOR;
 
+pub use self::pool::DmaPool;
+
+/// The pools of the small coherent allocations, by increasing size.
+static POOLS: [DmaPool; 6] = [
+    DmaPool::new(64, 64),
+    DmaPool::new(128, 128),
+    DmaPool::new(256, 256),
+    DmaPool::new(512, 512),
+    DmaPool::new(1024, 1024),
+    DmaPool::new(2048, 2048),
+];
+
+/// Returns the smallest pool whose buffers can hold `layout`.
+fn pool_for(layout: &Layout) -> Option<&'static DmaPool> {
+    POOLS.iter().find(|pool| pool.fits(layout))
+}
+
 /// Converts a physical address to a bus address.
 ///
 /// It assumes that there is a linear mapping with the offset
@@ -29,7 +47,8 @@ pub const fn phys_to_bus(paddr: PhysAddr) -> BusAddr {
 ///
 /// This function allocates a block of memory through the global allocator. The
 /// memory pages must be contiguous, undivided, and have consistent read and
-/// write access.
+/// write access. Blocks of up to 2 KiB are taken from pools of fixed-size
+/// buffers instead, see [`DmaPool`].
 ///
 /// - `layout`: The memory layout, which describes the size and alignment
 ///   requirements of the requested memory.
@@ -44,7 +63,10 @@ pub const fn phys_to_bus(paddr: PhysAddr) -> BusAddr {
 /// allocator, which can potentially cause memory leaks or other issues if not
 /// used correctly.
 pub unsafe fn alloc_coherent(layout: Layout) -> AllocResult<DMAInfo> {
-    ALLOCATOR.lock().alloc_coherent(layout)
+    match pool_for(&layout) {
+        Some(pool) => pool.alloc(),
+        None => unsafe { ALLOCATOR.lock().alloc_coherent(layout) },
+    }
 }
 
 /// Frees coherent memory previously allocated.
@@ -61,7 +83,10 @@ pub unsafe fn alloc_coherent(layout: Layout) -> AllocResult<DMAInfo> {
 /// This function is unsafe because it directly interacts with the global allocator,
 /// which can potentially cause memory leaks or other issues if not used correctly.
 pub unsafe fn dealloc_coherent(dma: DMAInfo, layout: Layout) {
-    ALLOCATOR.lock().dealloc_coherent(dma, layout)
+    match pool_for(&layout) {
+        Some(pool) => unsafe { pool.dealloc(dma) },
+        None => unsafe { ALLOCATOR.lock().dealloc_coherent(dma, layout) },
+    }
 }
 
 /// A bus memory address.
@@ -0,0 +1,92 @@
+use alloc::vec::Vec;
+use core::{alloc::Layout, ptr::NonNull};
+
+use allocator::{AllocError, AllocResult};
+use kspin::SpinNoIrq;
+use log::debug;
+use memory_addr::{PAGE_SIZE_4K, align_up};
+
+use crate::{DMAInfo, dma::ALLOCATOR};
+
+/// The size of the coherent memory a pool takes at once, to be split into
+/// buffers.
+const CHUNK_SIZE: usize = 4 * PAGE_SIZE_4K;
+
+/// A pool of **coherent** DMA buffers of a fixed size, such as the packet
+/// buffers or the descriptors of a device queue.
+///
+/// The buffers are carved from chunks of coherent pages, which are mapped
+/// uncached only once, and freed buffers are kept to be handed out again
+/// first, while they are likely still in the caches of the device. The memory
+/// of a pool is never given back, so a pool takes as much as its peak usage.
+pub struct DmaPool {
+    size: usize,
+    align: usize,
+    /// The CPU addresses of the free buffers, the last freed at the end.
+    free: SpinNoIrq<Vec<usize>>,
+}
+
+impl DmaPool {
+    /// Creates an empty pool of buffers of `size` bytes aligned to `align`,
+    /// which must be a power of two.
+    pub const fn new(size: usize, align: usize) -> Self {
+        assert!(align.is_power_of_two());
+        Self {
+            size: align_up(if size == 0 { 1 } else { size }, align),
+            align,
+            free: SpinNoIrq::new(Vec::new()),
+        }
+    }
+
+    /// Returns the size of the buffers.
+    pub const fn buf_size(&self) -> usize {
+        self.size
+    }
+
+    /// Returns whether a buffer of the pool can hold `layout`.
+    pub const fn fits(&self, layout: &Layout) -> bool {
+        layout.size() <= self.size && layout.align() <= self.align
+    }
+
+    /// Allocates a buffer, taking another chunk of coherent memory if there
+    /// is no free one.
+    pub fn alloc(&self) -> AllocResult<DMAInfo> {
+        let mut free = self.free.lock();
+        if free.is_empty() {
+            self.refill(&mut free)?;
+        }
+        let cpu_addr = free.pop().ok_or(AllocError::NoMemory)?;
+        Ok(DMAInfo {
+            // SAFETY: the buffers are carved from allocated memory.
+            cpu_addr: unsafe { NonNull::new_unchecked(cpu_addr as *mut u8) },
+            bus_addr: crate::dma::virt_to_bus(cpu_addr.into()),
+        })
+    }
+
+    /// Gives a buffer back to the pool.
+    ///
+    /// # Safety
+    ///
+    /// `dma` must have been allocated from this pool, and not be used
+    /// anymore by the CPU or the device.
+    pub unsafe fn dealloc(&self, dma: DMAInfo) {
+        self.free.lock().push(dma.cpu_addr.as_ptr() as usize);
+    }
+
+    fn refill(&self, free: &mut Vec<usize>) -> AllocResult<()> {
+        let layout =
+            Layout::from_size_align(CHUNK_SIZE.max(self.size), PAGE_SIZE_4K.max(self.align))
+                .map_err(|_| AllocError::InvalidParam)?;
+        let chunk = ALLOCATOR.lock().alloc_coherent_pages(layout)?;
+        let start = chunk.cpu_addr.as_ptr() as usize;
+        let count = layout.size() / self.size;
+        free.reserve(count);
+        // The buffers at the start of the chunk are handed out first.
+        free.extend((0..count).rev().map(|i| start + i * self.size));
+        debug!(
+            "DMA pool of {:#x}-byte buffers: add {} buffers @{:#x}",
+            self.size, count, start
+        );
+        Ok(())
+    }
+}
@@ -7,4 +7,7 @@ pub use {crate::structs::AxBlockDevice, axdriver_block::BlockDriverOps};
 #[cfg(feature = "display")]
 pub use {crate::structs::AxDisplayDevice, axdriver_display::DisplayDriverOps};
 #[cfg(feature = "net")]
-pub use {crate::structs::AxNetDevice, axdriver_net::NetDriverOps};
+pub use {
+    crate::structs::{AxNetDevice, NetOffloadCaps},
+    axdriver_net::NetDriverOps,
+};
@@ -49,3 +49,21 @@ impl BaseDriverOps for AxDeviceEnum {
         }
     }
 }
+
+/// The offloads of a NIC that [`NetDriverOps`](axdriver_net::NetDriverOps)
+/// does not describe.
+#[cfg(feature = "net")]
+pub trait NetOffloadCaps {
+    /// Whether the NIC validates the checksums of every packet it delivers,
+    /// so that they need not be verified again in software.
+    ///
+    /// A virtio NIC only does with `VIRTIO_NET_F_GUEST_CSUM` negotiated, and
+    /// `VIRTIO_NET_HDR_F_DATA_VALID` set in the header of each packet, which
+    /// the driver must check. None of the drivers report it yet.
+    fn rx_checksums_validated(&self) -> bool {
+        false
+    }
+}
+
+#[cfg(feature = "net")]
+impl NetOffloadCaps for AxNetDevice {}
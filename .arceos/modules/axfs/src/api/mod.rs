@@ -15,11 +15,20 @@ pub fn read_dir(path: &str) -> io::Result<ReadDir> {
 }
 
 /// Returns the canonical, absolute form of a path with all intermediate
-/// components normalized.
+/// components normalized and the symbolic links in them followed.
+///
+/// The last component is kept as it is, so that the path names a symbolic
+/// link rather than its target, see [`real_path`].
 pub fn canonicalize(path: &str) -> io::Result<String> {
     crate::root::absolute_path(path)
 }
 
+/// Returns the canonical, absolute form of a path with the symbolic links in
+/// all its components followed.
+pub fn real_path(path: &str) -> io::Result<String> {
+    crate::root::real_path(path)
+}
+
 /// Returns the current working directory as a [`String`].
 pub fn current_dir() -> io::Result<String> {
     crate::root::current_dir()
@@ -56,7 +65,17 @@ pub fn write<C: AsRef<[u8]>>(path: &str, contents: C) -> io::Result<()> {
 /// Given a path, query the file system to get information about a file,
 /// directory, etc.
 pub fn metadata(path: &str) -> io::Result<Metadata> {
-    crate::root::lookup(None, path)?.get_attr().map(Metadata)
+    let path = &crate::root::real_path(path)?;
+    let attr = crate::root::lookup(None, path)?.get_attr()?;
+    // The size of a cached file includes the writes not written back yet.
+    let cached_size =
+        crate::root::cache_path(None, path).and_then(|path| crate::page_cache::size(&path));
+    Ok(Metadata(match cached_size {
+        Some(size) => {
+            crate::fops::FileAttr::new(attr.perm(), attr.file_type(), size, attr.blocks())
+        }
+        None => attr,
+    }))
 }
 
 /// Creates a new, empty directory at the provided path.
@@ -88,6 +107,47 @@ pub fn rename(old: &str, new: &str) -> io::Result<()> {
     crate::root::rename(old, new)
 }
 
+/// Creates a new hard link on the filesystem.
+///
+/// The `link` path will be a link pointing to the `original` path. Note that
+/// only the ext4 filesystem supports hard links.
+pub fn hard_link(original: &str, link: &str) -> io::Result<()> {
+    crate::root::hard_link(original, link)
+}
+
+/// Creates a new symbolic link on the filesystem.
+///
+/// The `link` path will be a symbolic link pointing to the `original` path,
+/// which need not exist. The links are kept by the kernel rather than in the
+/// filesystems, so they do not survive a reboot and are not listed in their
+/// directories.
+pub fn symlink(original: &str, link: &str) -> io::Result<()> {
+    crate::root::symlink(original, link)
+}
+
+/// Reads a symbolic link, returning the path it points to.
+pub fn read_link(path: &str) -> io::Result<String> {
+    crate::root::read_link(path)
+}
+
+/// Returns the attributes of the file at `path` that [`Metadata`] does not
+/// carry: its inode number, link count, owner and times.
+pub fn file_info(path: &str) -> io::Result<crate::fops::FileInfo> {
+    crate::root::file_info(path)
+}
+
+/// Mounts a tmpfs at the directory `path`, whose files are kept in memory and
+/// take up to `size` bytes, or half of the memory if `None`.
+#[cfg(feature = "tmpfs")]
+pub fn mount_tmpfs(path: &str, size: Option<u64>) -> io::Result<()> {
+    crate::root::mount_tmpfs(path, size)
+}
+
+/// Unmounts the filesystem mounted at `path`, e.g. by [`mount_tmpfs`].
+pub fn umount(path: &str) -> io::Result<()> {
+    crate::root::umount(path)
+}
+
 /// check whether absolute path exists.
 pub fn absolute_path_exists(path: &str) -> bool {
     crate::root::lookup(None, path).is_ok()
@@ -0,0 +1,164 @@
+//! Cache of the directory entries looked up.
+//!
+//! Entries are keyed by their parent entry and their name, and map to the
+//! node found, or to nothing if the name does not exist (negative entries).
+//! Looking up a cached path is thus a map lookup per component, instead of a
+//! walk through the filesystems, which also create a new node on every
+//! lookup. Entries are invalidated when their path is created, removed or
+//! renamed, and all of them when a filesystem is mounted.
+
+use alloc::{collections::BTreeMap, string::String, vec::Vec};
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use axerrno::{AxError, AxResult};
+use axfs_vfs::VfsNodeRef;
+use axsync::spin::SpinNoIrq;
+
+/// The maximum number of entries, above which the cache is emptied.
+const MAX_ENTRIES: usize = 8192;
+/// The identifier of the root directory, which is not cached.
+const ROOT_ID: u64 = 0;
+
+struct Dentry {
+    id: u64,
+    /// The node of the entry, or `None` if it does not exist.
+    node: Option<VfsNodeRef>,
+}
+
+struct DentryCache {
+    entries: BTreeMap<(u64, String), Dentry>,
+    /// Incremented on every invalidation, so that lookups that raced with
+    /// one do not insert stale entries.
+    generation: u64,
+}
+
+static DCACHE: SpinNoIrq<DentryCache> = SpinNoIrq::new(DentryCache {
+    entries: BTreeMap::new(),
+    generation: 0,
+});
+static NEXT_ID: AtomicU64 = AtomicU64::new(ROOT_ID + 1);
+
+impl DentryCache {
+    /// Removes the entry `(parent, name)` and the entries under it.
+    fn remove(&mut self, parent: u64, name: &str) {
+        let Some(dentry) = self.entries.remove(&(parent, name.into())) else {
+            return;
+        };
+        let mut ids = Vec::from([dentry.id]);
+        while let Some(id) = ids.pop() {
+            let children = self
+                .entries
+                .range((id, String::new())..(id + 1, String::new()))
+                .map(|(key, _)| key.clone())
+                .collect::<Vec<_>>();
+            for key in children {
+                if let Some(child) = self.entries.remove(&key) {
+                    ids.push(child.id);
+                }
+            }
+        }
+    }
+
+    /// Inserts the entry `(parent, name)` if the cache has not been
+    /// invalidated since `generation`, returning its identifier.
+    fn insert(
+        &mut self,
+        generation: u64,
+        parent: u64,
+        name: &str,
+        node: Option<VfsNodeRef>,
+    ) -> Option<u64> {
+        if self.generation != generation {
+            return None;
+        }
+        if self.entries.len() >= MAX_ENTRIES {
+            self.entries.clear();
+            self.generation += 1;
+            return None;
+        }
+        let id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
+        self.entries
+            .insert((parent, name.into()), Dentry { id, node });
+        Some(id)
+    }
+}
+
+fn components(path: &str) -> impl Iterator<Item = &str> {
+    path.split('/').filter(|name| !name.is_empty())
+}
+
+/// Looks up the node at the canonical absolute `path` from the `root`
+/// directory. The path must not cross a mount point.
+pub(crate) fn lookup(root: VfsNodeRef, path: &str) -> AxResult<VfsNodeRef> {
+    let mut node = root;
+    // The identifier of the entry of `node`, or `None` if it could not be
+    // cached, in which case the rest of the path is not cached either.
+    let mut id = Some(ROOT_ID);
+    for name in components(path) {
+        let (cached, generation) = match id {
+            Some(id) => {
+                let dcache = DCACHE.lock();
+                let cached = dcache
+                    .entries
+                    .get(&(id, name.into()))
+                    .map(|dentry| (dentry.id, dentry.node.clone()));
+                (cached, dcache.generation)
+            }
+            None => (None, 0),
+        };
+        match cached {
+            Some((child_id, Some(child))) => {
+                id = Some(child_id);
+                node = child;
+                continue;
+            }
+            Some((_, None)) => return Err(AxError::NotFound),
+            None => {}
+        }
+
+        let child = node.clone().lookup(name);
+        let parent = id;
+        let insert = |node| parent.and_then(|id| DCACHE.lock().insert(generation, id, name, node));
+        match child {
+            Ok(child) => {
+                id = insert(Some(child.clone()));
+                node = child;
+            }
+            Err(AxError::NotFound) => {
+                insert(None);
+                return Err(AxError::NotFound);
+            }
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(node)
+}
+
+/// Invalidates the entry at the canonical absolute `path` and the entries
+/// under it, after the path has been created, removed or renamed.
+pub(crate) fn invalidate(path: &str) {
+    let mut dcache = DCACHE.lock();
+    dcache.generation += 1;
+    let mut names = components(path).peekable();
+    let mut id = ROOT_ID;
+    while let Some(name) = names.next() {
+        if names.peek().is_none() {
+            dcache.remove(id, name);
+            return;
+        }
+        match dcache.entries.get(&(id, name.into())) {
+            Some(dentry) => id = dentry.id,
+            // Nothing under the path is cached.
+            None => return,
+        }
+    }
+    // The root directory itself, which is only invalidated with everything.
+    dcache.entries.clear();
+}
+
+/// Invalidates all the entries, e.g. after a filesystem has been mounted.
+pub(crate) fn clear() {
+    let mut dcache = DCACHE.lock();
+    dcache.generation += 1;
+    dcache.entries.clear();
+}
@@ -1,12 +1,79 @@
+use alloc::{boxed::Box, vec, vec::Vec};
 use axdriver::prelude::*;
 
 const BLOCK_SIZE: usize = 512;
+/// The maximum number of adjacent blocks read or written in one request to
+/// the device.
+const MAX_MERGED_BLOCKS: usize = 128;
+
+/// A direct-mapped, write-through cache of disk blocks.
+struct BlockCache {
+    /// The block held by each slot, or `u64::MAX` if none.
+    tags: Vec<u64>,
+    blocks: Vec<[u8; BLOCK_SIZE]>,
+    /// Whole-block transfers of up to this many blocks go through the cache,
+    /// longer ones bypass it so that bulk data doesn't evict the rest.
+    max_transfer_blocks: usize,
+}
+
+impl BlockCache {
+    fn new(nr_blocks: usize, max_transfer_blocks: usize) -> Self {
+        Self {
+            tags: vec![u64::MAX; nr_blocks],
+            blocks: vec![[0; BLOCK_SIZE]; nr_blocks],
+            max_transfer_blocks,
+        }
+    }
+
+    fn slot(&self, block_id: u64) -> usize {
+        (block_id % self.tags.len() as u64) as usize
+    }
+
+    fn get(&self, block_id: u64) -> Option<&[u8; BLOCK_SIZE]> {
+        let slot = self.slot(block_id);
+        (self.tags[slot] == block_id).then(|| &self.blocks[slot])
+    }
+
+    fn insert(&mut self, block_id: u64, data: &[u8]) {
+        let slot = self.slot(block_id);
+        self.tags[slot] = block_id;
+        self.blocks[slot].copy_from_slice(data);
+    }
+
+    /// Copies the blocks from `block_id` into `buf` if they are all cached.
+    fn get_all(&self, block_id: u64, buf: &mut [u8]) -> bool {
+        let nr_blocks = buf.len() / BLOCK_SIZE;
+        if (0..nr_blocks as u64).any(|i| self.get(block_id + i).is_none()) {
+            return false;
+        }
+        for (i, block) in buf.chunks_exact_mut(BLOCK_SIZE).enumerate() {
+            block.copy_from_slice(&self.blocks[self.slot(block_id + i as u64)]);
+        }
+        true
+    }
+
+    /// Caches the blocks written from `block_id`, or if there are too many
+    /// of them, updates the ones already cached.
+    fn update(&mut self, block_id: u64, data: &[u8]) {
+        let cache_all = data.len() / BLOCK_SIZE <= self.max_transfer_blocks;
+        for (i, block) in data.chunks_exact(BLOCK_SIZE).enumerate() {
+            let id = block_id + i as u64;
+            if cache_all || self.get(id).is_some() {
+                self.insert(id, block);
+            }
+        }
+    }
+}
 
 /// A disk device with a cursor.
 pub struct Disk {
     block_id: u64,
     offset: usize,
     dev: AxBlockDevice,
+    /// The buffer of the requests of several blocks, which are not done in
+    /// the buffer of the caller as it may not be contiguous in memory.
+    bounce: Vec<u8>,
+    cache: Option<Box<BlockCache>>,
 }
 
 impl Disk {
@@ -17,9 +84,72 @@ impl Disk {
             block_id: 0,
             offset: 0,
             dev,
+            bounce: Vec::new(),
+            cache: None,
         }
     }
 
+    /// Keeps up to `nr_blocks` blocks in memory: those read or written
+    /// partially, and those of whole-block transfers of up to
+    /// `max_transfer_blocks` blocks. That is mostly the metadata of the file
+    /// system, read again and again, e.g. FAT entries or ext4 inode tables.
+    ///
+    /// The cache is write-through, the device is always up to date.
+    pub fn enable_cache(&mut self, nr_blocks: usize, max_transfer_blocks: usize) {
+        self.cache = Some(Box::new(BlockCache::new(nr_blocks, max_transfer_blocks)));
+    }
+
+    /// Reads the block `block_id` into `data`, from the cache if enabled.
+    fn read_cached_block(&mut self, block_id: u64, data: &mut [u8; BLOCK_SIZE]) -> DevResult {
+        let Some(cache) = &mut self.cache else {
+            return self.dev.read_block(block_id, data);
+        };
+        match cache.get(block_id) {
+            Some(block) => data.copy_from_slice(block),
+            None => {
+                self.dev.read_block(block_id, data)?;
+                cache.insert(block_id, data);
+            }
+        }
+        Ok(())
+    }
+
+    /// Reads the whole blocks from the cursor into `buf` through the cache, if
+    /// they are few enough, returns whether it did.
+    fn read_cached_blocks(&mut self, buf: &mut [u8]) -> DevResult<bool> {
+        let Some(cache) = &mut self.cache else {
+            return Ok(false);
+        };
+        if buf.len() / BLOCK_SIZE > cache.max_transfer_blocks {
+            return Ok(false);
+        }
+        if !cache.get_all(self.block_id, buf) {
+            self.bounce.resize(buf.len(), 0);
+            self.dev.read_block(self.block_id, &mut self.bounce)?;
+            buf.copy_from_slice(&self.bounce);
+            for (i, block) in buf.chunks_exact(BLOCK_SIZE).enumerate() {
+                cache.insert(self.block_id + i as u64, block);
+            }
+        }
+        Ok(true)
+    }
+
+    /// Writes `data` from the block `block_id`, keeping the cache up to date.
+    fn write_blocks(&mut self, block_id: u64, data: &[u8]) -> DevResult {
+        self.dev.write_block(block_id, data)?;
+        if let Some(cache) = &mut self.cache {
+            cache.update(block_id, data);
+        }
+        Ok(())
+    }
+
+    /// Returns the number of whole blocks of `len` bytes that can be
+    /// transferred in one request from the cursor.
+    fn merged_blocks(&self, len: usize) -> usize {
+        let left = self.dev.num_blocks().saturating_sub(self.block_id) as usize;
+        (len / BLOCK_SIZE).min(MAX_MERGED_BLOCKS).min(left).max(1)
+    }
+
     /// Get the size of the disk.
     pub fn size(&self) -> u64 {
         self.dev.num_blocks() * BLOCK_SIZE as u64
@@ -39,21 +169,31 @@ impl Disk {
     /// Read within one block, returns the number of bytes read.
     pub fn read_one(&mut self, buf: &mut [u8]) -> DevResult<usize> {
         let read_size = if self.offset == 0 && buf.len() >= BLOCK_SIZE {
-            // whole block
-            let mut data = [0u8; BLOCK_SIZE];
-            self.dev.read_block(self.block_id, &mut data)?;
-            buf[0..BLOCK_SIZE].copy_from_slice(&data);
-            // self.dev
-            //     .read_block(self.block_id, &mut buf[0..BLOCK_SIZE])?;
-            self.block_id += 1;
-            BLOCK_SIZE
+            let len = self.merged_blocks(buf.len()) * BLOCK_SIZE;
+            // Few enough whole blocks are read through the cache.
+            if !self.read_cached_blocks(&mut buf[..len])? {
+                if len > BLOCK_SIZE {
+                    // adjacent whole blocks, merged into one request
+                    self.bounce.resize(len, 0);
+                    self.dev
+                        .read_block(self.block_id, &mut self.bounce[..len])?;
+                    buf[..len].copy_from_slice(&self.bounce[..len]);
+                } else {
+                    // whole block
+                    let mut data = [0u8; BLOCK_SIZE];
+                    self.dev.read_block(self.block_id, &mut data)?;
+                    buf[0..BLOCK_SIZE].copy_from_slice(&data);
+                }
+            }
+            self.block_id += (len / BLOCK_SIZE) as u64;
+            len
         } else {
             // partial block
             let mut data = [0u8; BLOCK_SIZE];
             let start = self.offset;
             let count = buf.len().min(BLOCK_SIZE - self.offset);
 
-            self.dev.read_block(self.block_id, &mut data)?;
+            self.read_cached_block(self.block_id, &mut data)?;
             buf[..count].copy_from_slice(&data[start..start + count]);
 
             self.offset += count;
@@ -68,9 +208,20 @@ impl Disk {
 
     /// Write within one block, returns the number of bytes written.
     pub fn write_one(&mut self, buf: &[u8]) -> DevResult<usize> {
-        let write_size = if self.offset == 0 && buf.len() >= BLOCK_SIZE {
+        let write_size = if self.offset == 0 && buf.len() >= 2 * BLOCK_SIZE {
+            // adjacent whole blocks, merged into one request
+            let len = self.merged_blocks(buf.len()) * BLOCK_SIZE;
+            let mut bounce = core::mem::take(&mut self.bounce);
+            bounce.clear();
+            bounce.extend_from_slice(&buf[..len]);
+            let res = self.write_blocks(self.block_id, &bounce);
+            self.bounce = bounce;
+            res?;
+            self.block_id += (len / BLOCK_SIZE) as u64;
+            len
+        } else if self.offset == 0 && buf.len() >= BLOCK_SIZE {
             // whole block
-            self.dev.write_block(self.block_id, &buf[0..BLOCK_SIZE])?;
+            self.write_blocks(self.block_id, &buf[0..BLOCK_SIZE])?;
             self.block_id += 1;
             BLOCK_SIZE
         } else {
@@ -79,9 +230,12 @@ impl Disk {
             let start = self.offset;
             let count = buf.len().min(BLOCK_SIZE - self.offset);
 
-            self.dev.read_block(self.block_id, &mut data)?;
+            self.read_cached_block(self.block_id, &mut data)?;
             data[start..start + count].copy_from_slice(&buf[..count]);
             self.dev.write_block(self.block_id, &data)?;
+            if let Some(cache) = &mut self.cache {
+                cache.insert(self.block_id, &data);
+            }
 
             self.offset += count;
             if self.offset >= BLOCK_SIZE {
@@ -113,7 +267,7 @@ impl Disk {
         );
         assert!(offset % BLOCK_SIZE == 0);
         let block_id = offset / BLOCK_SIZE;
-        self.dev.write_block(block_id as u64, buf).unwrap();
+        self.write_blocks(block_id as u64, buf).unwrap();
         Ok(buf.len())
     }
 }
@@ -1,10 +1,21 @@
 //! Low-level filesystem operations.
 
+use alloc::{string::String, sync::Arc, vec::Vec};
 use axerrno::{AxError, AxResult, ax_err, ax_err_type};
 use axfs_vfs::{VfsError, VfsNodeRef};
 use axio::SeekFrom;
 use cap_access::{Cap, WithCap};
-use core::fmt;
+use core::{fmt, time::Duration};
+
+use axsync::spin::SpinNoIrq;
+
+use crate::page_cache::{CachedFile, PAGE_SIZE, PinnedPage};
+use crate::readahead::{self, ReadAhead};
+
+pub use crate::readahead::Advice;
+
+/// The most data [`File::copy_range`] and [`File::allocate`] move at a time.
+const COPY_CHUNK: u64 = 0x20000;
 
 #[cfg(feature = "myfs")]
 pub use crate::dev::Disk;
@@ -20,11 +31,41 @@ pub type FileAttr = axfs_vfs::VfsNodeAttr;
 /// Alias of [`axfs_vfs::VfsNodePerm`].
 pub type FilePerm = axfs_vfs::VfsNodePerm;
 
+/// The attributes of a file that [`FileAttr`] does not carry.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct FileInfo {
+    /// The inode number.
+    pub ino: u64,
+    /// The identifier of the filesystem of the file.
+    pub dev: u64,
+    /// The number of hard links.
+    pub nlink: u64,
+    /// The owner.
+    pub uid: u32,
+    /// The group.
+    pub gid: u32,
+    /// The last access, since the epoch.
+    pub atime: Duration,
+    /// The last modification of the contents, since the epoch.
+    pub mtime: Duration,
+    /// The last change of the contents or the attributes, since the epoch.
+    pub ctime: Duration,
+}
+
+/// The alignment of the offsets, lengths and buffers of direct I/O.
+pub const DIRECT_IO_ALIGN: usize = 512;
+
 /// An opened file object, with open permissions and a cursor.
 pub struct File {
     node: WithCap<VfsNodeRef>,
     is_append: bool,
+    /// Whether reads and writes bypass the page cache.
+    is_direct: bool,
     offset: u64,
+    /// The cached pages of the file, if it is in the main filesystem.
+    cache: Option<Arc<CachedFile>>,
+    /// The readahead state, shared by the duplicated handles.
+    readahead: Arc<SpinNoIrq<ReadAhead>>,
 }
 
 /// An opened directory object, with open permissions and a cursor for
@@ -32,6 +73,8 @@ pub struct File {
 pub struct Directory {
     node: WithCap<VfsNodeRef>,
     entry_idx: usize,
+    /// The absolute path of the directory.
+    path: String,
 }
 
 /// Options and flags which can be used to configure how a file is opened.
@@ -46,6 +89,7 @@ pub struct OpenOptions {
     create: bool,
     create_new: bool,
     directory: bool,
+    direct: bool,
     // system-specific
     _custom_flags: i32,
     _mode: u32,
@@ -64,6 +108,7 @@ impl OpenOptions {
             create: false,
             create_new: false,
             directory: false,
+            direct: false,
             // system-specific
             _custom_flags: 0,
             _mode: 0o666,
@@ -101,6 +146,12 @@ impl OpenOptions {
     pub fn directory(&mut self, directory: bool) {
         self.directory = directory;
     }
+    /// Sets the option to bypass the page cache, which requires the offsets,
+    /// lengths and buffers of reads and writes to be aligned to
+    /// [`DIRECT_IO_ALIGN`].
+    pub fn direct(&mut self, direct: bool) {
+        self.direct = direct;
+    }
     /// check whether contains directory.
     pub fn has_directory(&self) -> bool {
         self.directory
@@ -151,13 +202,20 @@ impl File {
         self.node.access_or_err(cap, AxError::PermissionDenied)
     }
 
-    fn _open_at(dir: Option<&VfsNodeRef>, path: &str, opts: &OpenOptions) -> AxResult<Self> {
+    /// Returns whether the file is opened for writing.
+    pub fn is_writable(&self) -> bool {
+        self.access_node(Cap::WRITE).is_ok()
+    }
+
+    fn _open_at(path: &str, opts: &OpenOptions) -> AxResult<Self> {
         debug!("open file: {} {:?}", path, opts);
         if !opts.is_valid() {
             return ax_err!(InvalidInput);
         }
+        // The file is cached under the path of its target.
+        let path = &crate::root::real_path(path)?;
 
-        let node_option = crate::root::lookup(dir, path);
+        let node_option = crate::root::lookup(None, path);
         let node = if opts.create || opts.create_new {
             match node_option {
                 Ok(node) => {
@@ -168,7 +226,7 @@ impl File {
                     node
                 }
                 // not exists, create new
-                Err(VfsError::NotFound) => crate::root::create_file(dir, path)?,
+                Err(VfsError::NotFound) => crate::root::create_file(None, path)?,
                 Err(e) => return Err(e),
             }
         } else {
@@ -186,25 +244,59 @@ impl File {
         }
 
         node.open()?;
+        let cache = match crate::root::cache_path(None, path) {
+            // Files with several hard links are not cached, as their pages
+            // would be cached under each of the paths.
+            Some(path) if crate::root::link_count(None, &path)? == 1 => {
+                Some(crate::page_cache::open(&path, &node)?)
+            }
+            _ => None,
+        };
         if opts.truncate {
-            node.truncate(0)?;
+            match &cache {
+                Some(cache) => cache.truncate(0)?,
+                None => node.truncate(0)?,
+            }
         }
         Ok(Self {
             node: WithCap::new(node, access_cap),
             is_append: opts.append,
+            is_direct: opts.direct,
             offset: 0,
+            cache,
+            readahead: Arc::new(SpinNoIrq::new(ReadAhead::new())),
         })
     }
 
     /// Opens a file at the path relative to the current directory. Returns a
     /// [`File`] object.
     pub fn open(path: &str, opts: &OpenOptions) -> AxResult<Self> {
-        Self::_open_at(None, path, opts)
+        Self::_open_at(path, opts)
+    }
+
+    /// Creates another handle to the same opened file, with the same access
+    /// permissions and its own cursor at the same position.
+    pub fn duplicate(&self) -> Self {
+        // SAFETY: the node is only accessed through the new handle, which
+        // checks the same capabilities.
+        let node = unsafe { self.node.access_unchecked() }.clone();
+        Self {
+            node: WithCap::new(node, self.node.cap()),
+            is_append: self.is_append,
+            is_direct: self.is_direct,
+            offset: self.offset,
+            cache: self.cache.clone(),
+            readahead: self.readahead.clone(),
+        }
     }
 
     /// Truncates the file to the specified size.
     pub fn truncate(&self, size: u64) -> AxResult {
-        self.access_node(Cap::WRITE)?.truncate(size)?;
+        let node = self.access_node(Cap::WRITE)?;
+        match &self.cache {
+            Some(cache) => cache.truncate(size)?,
+            None => node.truncate(size)?,
+        }
         Ok(())
     }
 
@@ -213,8 +305,7 @@ impl File {
     ///
     /// After the read, the cursor will be advanced by the number of bytes read.
     pub fn read(&mut self, buf: &mut [u8]) -> AxResult<usize> {
-        let node = self.access_node(Cap::READ)?;
-        let read_len = node.read_at(self.offset, buf)?;
+        let read_len = self.read_at(self.offset, buf)?;
         self.offset += read_len as u64;
         Ok(read_len)
     }
@@ -224,10 +315,49 @@ impl File {
     /// It does not update the file cursor.
     pub fn read_at(&self, offset: u64, buf: &mut [u8]) -> AxResult<usize> {
         let node = self.access_node(Cap::READ)?;
-        let read_len = node.read_at(offset, buf)?;
+        if self.is_direct {
+            check_direct_io(offset, buf)?;
+        }
+        let Some(cache) = &self.cache else {
+            return Ok(node.read_at(offset, buf)?);
+        };
+        if self.is_direct {
+            return Ok(cache.read_direct(offset, buf)?);
+        }
+        let read_len = cache.read_at(offset, buf)?;
+        let prefetch = self
+            .readahead
+            .lock()
+            .on_read(cache.size(), offset, read_len);
+        if let Some((start, count)) = prefetch {
+            readahead::prefetch(cache, start, count);
+        }
         Ok(read_len)
     }
 
+    /// Pins the cached data of the file at `offset`, up to the end of its page,
+    /// so that it can be copied elsewhere without holding any lock of the
+    /// file. Returns `None` at the end of the file.
+    ///
+    /// Fails with [`AxError::Unsupported`] if the file is not cached, or is
+    /// opened for direct I/O.
+    pub fn pin_page(&self, offset: u64) -> AxResult<Option<PinnedPage>> {
+        self.access_node(Cap::READ)?;
+        let Some(cache) = self.cache.as_ref().filter(|_| !self.is_direct) else {
+            return Err(AxError::Unsupported);
+        };
+        let pinned = cache.pin(offset)?;
+        let read_len = pinned.as_ref().map_or(0, |page| page.len());
+        let prefetch = self
+            .readahead
+            .lock()
+            .on_read(cache.size(), offset, read_len);
+        if let Some((start, count)) = prefetch {
+            readahead::prefetch(cache, start, count);
+        }
+        Ok(pinned)
+    }
+
     /// Writes the file at the current position. Returns the number of bytes
     /// written.
     ///
@@ -239,8 +369,7 @@ impl File {
         } else {
             self.offset
         };
-        let node = self.access_node(Cap::WRITE)?;
-        let write_len = node.write_at(offset, buf)?;
+        let write_len = self.write_at(offset, buf)?;
         self.offset = offset + write_len as u64;
         Ok(write_len)
     }
@@ -251,13 +380,159 @@ impl File {
     /// It does not update the file cursor.
     pub fn write_at(&self, offset: u64, buf: &[u8]) -> AxResult<usize> {
         let node = self.access_node(Cap::WRITE)?;
-        let write_len = node.write_at(offset, buf)?;
+        if self.is_direct {
+            check_direct_io(offset, buf)?;
+        }
+        let write_len = match &self.cache {
+            Some(cache) if self.is_direct => cache.write_direct(offset, buf)?,
+            Some(cache) => cache.write_at(offset, buf)?,
+            None => node.write_at(offset, buf)?,
+        };
         Ok(write_len)
     }
 
+    /// Copies `len` bytes of the file at `offset` to `dst` at `dst_offset`,
+    /// without going through user space. Returns the number of bytes copied,
+    /// which is less than `len` if the end of the file is reached first.
+    ///
+    /// Cached files are copied from page cache to page cache in large
+    /// pieces, the pages of `dst` being written back later like any others.
+    pub fn copy_range(&self, offset: u64, dst: &File, dst_offset: u64, len: u64) -> AxResult<u64> {
+        self.access_node(Cap::READ)?;
+        dst.access_node(Cap::WRITE)?;
+        let mut buf = zeroed_chunk(len)?;
+        let mut copied = 0;
+        while copied < len {
+            let n = (len - copied).min(buf.len() as u64) as usize;
+            let read = match self.read_at(offset + copied, &mut buf[..n]) {
+                Ok(0) => break,
+                Ok(read) => read,
+                Err(_) if copied > 0 => break,
+                Err(e) => return Err(e),
+            };
+            let written = match dst.write_at(dst_offset + copied, &buf[..read]) {
+                Ok(written) => written,
+                Err(_) if copied > 0 => break,
+                Err(e) => return Err(e),
+            };
+            copied += written as u64;
+            if read < n || written < read {
+                break;
+            }
+        }
+        Ok(copied)
+    }
+
+    /// Allocates the space of `len` bytes at `offset`, extending the file if
+    /// the range ends past it, so that writing the range later does not run
+    /// out of space.
+    ///
+    /// The filesystems cannot reserve space without writing it, so the part
+    /// past the end of the file is written with zeros, straight to the
+    /// filesystem in large pieces, for which it allocates adjacent blocks.
+    /// If the space runs out midway, the file is cut back to its size.
+    pub fn allocate(&self, offset: u64, len: u64) -> AxResult {
+        let node = self.access_node(Cap::WRITE)?;
+        let end = offset.checked_add(len).ok_or(AxError::InvalidInput)?;
+        let size = self.get_attr()?.size();
+        if end <= size {
+            return Ok(());
+        }
+        let zeros = zeroed_chunk(end - size)?;
+        let mut pos = size;
+        while pos < end {
+            let n = (end - pos).min(zeros.len() as u64) as usize;
+            let result = match &self.cache {
+                Some(cache) => cache.write_direct(pos, &zeros[..n]),
+                None => node.write_at(pos, &zeros[..n]),
+            };
+            match result {
+                Ok(written) if written > 0 => pos += written as u64,
+                result => {
+                    let _ = self.truncate(size);
+                    return Err(result.err().unwrap_or(AxError::StorageFull));
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// Makes `len` bytes at `offset` read as zeros, up to the end of the
+    /// file, which keeps its size.
+    pub fn zero_range(&self, offset: u64, len: u64) -> AxResult {
+        let node = self.access_node(Cap::WRITE)?;
+        let end = offset.saturating_add(len).min(self.get_attr()?.size());
+        if offset >= end {
+            return Ok(());
+        }
+        let zeros = zeroed_chunk(end - offset)?;
+        let mut pos = offset;
+        while pos < end {
+            let n = (end - pos).min(zeros.len() as u64) as usize;
+            // The range need not be aligned, even for direct I/O.
+            pos += match &self.cache {
+                Some(cache) => cache.write_at(pos, &zeros[..n])?,
+                None => node.write_at(pos, &zeros[..n])?,
+            } as u64;
+        }
+        Ok(())
+    }
+
+    /// Declares the expected access pattern of `len` bytes at `offset` (to
+    /// the end of the file if `len` is 0), which tunes the readahead.
+    pub fn advise(&self, offset: u64, len: u64, advice: Advice) -> AxResult {
+        self.access_node(Cap::empty())?;
+        let Some(cache) = &self.cache else {
+            return Ok(());
+        };
+        if self.readahead.lock().advise(advice) {
+            return Ok(());
+        }
+        let end = match len {
+            0 => cache.size(),
+            len => offset.saturating_add(len).min(cache.size()),
+        };
+        let start = offset / PAGE_SIZE as u64;
+        let end = end.div_ceil(PAGE_SIZE as u64);
+        match advice {
+            Advice::WillNeed if end > start => readahead::prefetch(cache, start, end - start),
+            Advice::DontNeed if end > start => cache.drop_clean(start, end),
+            _ => {}
+        }
+        Ok(())
+    }
+
     /// Flushes the file, writes all buffered data to the underlying device.
     pub fn flush(&self) -> AxResult {
-        self.access_node(Cap::WRITE)?.fsync()?;
+        self.access_node(Cap::WRITE)?;
+        self.sync()
+    }
+
+    /// Writes all the cached data of the file to the underlying device.
+    ///
+    /// Unlike [`flush`](Self::flush), it does not require write access, as
+    /// the cached data may have been written through another handle.
+    pub fn sync(&self) -> AxResult {
+        let node = self.access_node(Cap::empty())?;
+        if let Some(cache) = &self.cache {
+            cache.sync()?;
+        }
+        node.fsync()?;
+        Ok(())
+    }
+
+    /// Writes the cached data of `len` bytes at `offset` (to the end of the
+    /// file if `len` is 0) back to the filesystem, without flushing the
+    /// filesystem itself.
+    pub fn sync_range(&self, offset: u64, len: u64) -> AxResult {
+        self.access_node(Cap::empty())?;
+        if let Some(cache) = &self.cache {
+            let end = match len {
+                0 => u64::MAX,
+                len => offset.saturating_add(len).div_ceil(PAGE_SIZE as u64),
+            };
+            cache.sync_range(offset / PAGE_SIZE as u64, end)?;
+        }
         Ok(())
     }
 
@@ -277,7 +552,18 @@ impl File {
 
     /// Gets the file attributes.
     pub fn get_attr(&self) -> AxResult<FileAttr> {
-        self.access_node(Cap::empty())?.get_attr()
+        let node = self.access_node(Cap::empty())?;
+        match &self.cache {
+            // The attributes of cached files are kept with their pages.
+            Some(cache) => Ok(cache.attr()),
+            None => node.get_attr(),
+        }
+    }
+
+    /// Gets the attributes of the file that [`FileAttr`] does not carry, if
+    /// they are cached.
+    pub fn info(&self) -> Option<FileInfo> {
+        self.cache.as_ref().map(|cache| cache.info())
     }
 }
 
@@ -286,7 +572,7 @@ impl Directory {
         self.node.access_or_err(cap, AxError::PermissionDenied)
     }
 
-    fn _open_dir_at(dir: Option<&VfsNodeRef>, path: &str, opts: &OpenOptions) -> AxResult<Self> {
+    fn _open_dir_at(path: &str, opts: &OpenOptions) -> AxResult<Self> {
         debug!("open dir: {}", path);
         if !opts.read {
             return ax_err!(InvalidInput);
@@ -295,7 +581,8 @@ impl Directory {
             return ax_err!(InvalidInput);
         }
 
-        let node = crate::root::lookup(dir, path)?;
+        let path = crate::root::real_path(path)?;
+        let node = crate::root::lookup(None, &path)?;
         let attr = node.get_attr()?;
         if !attr.is_dir() {
             return ax_err!(NotADirectory);
@@ -313,53 +600,57 @@ impl Directory {
             // directories that don't have this permission.
             node: WithCap::new(node, cap),
             entry_idx: 0,
+            path,
         })
     }
 
-    fn access_at(&self, path: &str) -> AxResult<Option<&VfsNodeRef>> {
+    /// Returns the absolute path of the path relative to this directory, so
+    /// that it is looked up through the dentry cache.
+    fn resolve_at(&self, path: &str) -> AxResult<String> {
         if path.starts_with('/') {
-            Ok(None)
+            Ok(path.into())
         } else {
-            Ok(Some(self.access_node(Cap::EXECUTE)?))
+            self.access_node(Cap::EXECUTE)?;
+            Ok(alloc::format!("{}/{}", self.path, path))
         }
     }
 
     /// Opens a directory at the path relative to the current directory.
     /// Returns a [`Directory`] object.
     pub fn open_dir(path: &str, opts: &OpenOptions) -> AxResult<Self> {
-        Self::_open_dir_at(None, path, opts)
+        Self::_open_dir_at(path, opts)
     }
 
     /// Opens a directory at the path relative to this directory. Returns a
     /// [`Directory`] object.
     pub fn open_dir_at(&self, path: &str, opts: &OpenOptions) -> AxResult<Self> {
-        Self::_open_dir_at(self.access_at(path)?, path, opts)
+        Self::_open_dir_at(&self.resolve_at(path)?, opts)
     }
 
     /// Opens a file at the path relative to this directory. Returns a [`File`]
     /// object.
     pub fn open_file_at(&self, path: &str, opts: &OpenOptions) -> AxResult<File> {
-        File::_open_at(self.access_at(path)?, path, opts)
+        File::_open_at(&self.resolve_at(path)?, opts)
     }
 
     /// Creates an empty file at the path relative to this directory.
     pub fn create_file(&self, path: &str) -> AxResult<VfsNodeRef> {
-        crate::root::create_file(self.access_at(path)?, path)
+        crate::root::create_file(None, &self.resolve_at(path)?)
     }
 
     /// Creates an empty directory at the path relative to this directory.
     pub fn create_dir(&self, path: &str) -> AxResult {
-        crate::root::create_dir(self.access_at(path)?, path)
+        crate::root::create_dir(None, &self.resolve_at(path)?)
     }
 
     /// Removes a file at the path relative to this directory.
     pub fn remove_file(&self, path: &str) -> AxResult {
-        crate::root::remove_file(self.access_at(path)?, path)
+        crate::root::remove_file(None, &self.resolve_at(path)?)
     }
 
     /// Removes a directory at the path relative to this directory.
     pub fn remove_dir(&self, path: &str) -> AxResult {
-        crate::root::remove_dir(self.access_at(path)?, path)
+        crate::root::remove_dir(None, &self.resolve_at(path)?)
     }
 
     /// Reads directory entries starts from the current position into the
@@ -375,6 +666,27 @@ impl Directory {
         Ok(n)
     }
 
+    /// Reads directory entries like [`Self::read_dir`], and their inode
+    /// numbers into `inos`, which must be as long as `dirents`.
+    pub fn read_dir_ino(&mut self, dirents: &mut [DirEntry], inos: &mut [u64]) -> AxResult<usize> {
+        let node = self.access_node(Cap::READ)?;
+        let n = crate::root::read_dir_ino(node, &self.path, self.entry_idx, dirents, inos)?;
+        self.entry_idx += n;
+        Ok(n)
+    }
+
+    /// Returns the position of the cursor, which is the index of the next
+    /// entry to read.
+    pub fn position(&self) -> usize {
+        self.entry_idx
+    }
+
+    /// Moves the cursor to the entry at index `idx`, e.g. to rewind the
+    /// directory.
+    pub fn seek(&mut self, idx: usize) {
+        self.entry_idx = idx;
+    }
+
     /// Rename a file or directory to a new name.
     /// Delete the original file if `old` already exists.
     ///
@@ -417,6 +729,7 @@ impl fmt::Debug for OpenOptions {
         fmt_opt!(truncate, "TRUNC");
         fmt_opt!(create, "CREATE");
         fmt_opt!(create_new, "CREATE_NEW");
+        fmt_opt!(direct, "DIRECT");
         Ok(())
     }
 }
@@ -437,6 +750,23 @@ impl From<&OpenOptions> for Cap {
     }
 }
 
+/// Allocates a zeroed buffer for moving `len` bytes, up to [`COPY_CHUNK`].
+fn zeroed_chunk(len: u64) -> AxResult<Vec<u8>> {
+    let len = len.clamp(1, COPY_CHUNK) as usize;
+    let mut buf = Vec::new();
+    buf.try_reserve_exact(len).map_err(|_| AxError::NoMemory)?;
+    buf.resize(len, 0);
+    Ok(buf)
+}
+
+fn check_direct_io(offset: u64, buf: &[u8]) -> AxResult {
+    let align = DIRECT_IO_ALIGN as u64;
+    if offset % align != 0 || buf.len() as u64 % align != 0 || buf.as_ptr() as u64 % align != 0 {
+        return ax_err!(InvalidInput, "unaligned direct I/O");
+    }
+    Ok(())
+}
+
 fn perm_to_cap(perm: FilePerm) -> Cap {
     let mut cap = Cap::empty();
     if perm.owner_readable() {
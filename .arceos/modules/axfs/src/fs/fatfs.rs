@@ -1,5 +1,6 @@
 use alloc::sync::Arc;
 use core::cell::UnsafeCell;
+use core::time::Duration;
 
 use axfs_vfs::{VfsDirEntry, VfsError, VfsNodePerm, VfsResult};
 use axfs_vfs::{VfsNodeAttr, VfsNodeOps, VfsNodeRef, VfsNodeType, VfsOps};
@@ -7,8 +8,11 @@ use axsync::Mutex;
 use fatfs::{Dir, File, LossyOemCpConverter, NullTimeProvider, Read, Seek, SeekFrom, Write};
 
 use crate::dev::Disk;
+use crate::fops::FileInfo;
 
 const BLOCK_SIZE: usize = 512;
+/// The number of disk blocks cached for the FAT and the directory entries.
+const FAT_CACHE_BLOCKS: usize = 256;
 
 pub struct FatFileSystem {
     inner: fatfs::FileSystem<Disk, NullTimeProvider, LossyOemCpConverter>,
@@ -30,6 +34,7 @@ unsafe impl<'a, IO: IoTrait> Sync for DirWrapper<'a, IO> {}
 impl FatFileSystem {
     #[cfg(feature = "use-ramdisk")]
     pub fn new(mut disk: Disk) -> Self {
+        disk.enable_cache(FAT_CACHE_BLOCKS, 0);
         let opts = fatfs::FormatVolumeOptions::new();
         fatfs::format_volume(&mut disk, opts).expect("failed to format volume");
         let inner = fatfs::FileSystem::new(disk, fatfs::FsOptions::new())
@@ -41,7 +46,10 @@ impl FatFileSystem {
     }
 
     #[cfg(not(feature = "use-ramdisk"))]
-    pub fn new(disk: Disk) -> Self {
+    pub fn new(mut disk: Disk) -> Self {
+        // The FAT is read one entry at a time, e.g. for every cluster skipped
+        // when seeking.
+        disk.enable_cache(FAT_CACHE_BLOCKS, 0);
         let inner = fatfs::FileSystem::new(disk, fatfs::FsOptions::new())
             .expect("failed to initialize FAT filesystem");
         Self {
@@ -96,11 +104,19 @@ impl<IO: IoTrait> VfsNodeOps for FileWrapper<'static, IO> {
         file.seek(SeekFrom::Start(size)).map_err(as_vfs_err)?; // TODO: more efficient
         file.truncate().map_err(as_vfs_err)
     }
+
+    fn fsync(&self) -> VfsResult {
+        self.0.lock().flush().map_err(as_vfs_err)
+    }
 }
 
-impl<IO: IoTrait> VfsNodeOps for DirWrapper<'static, IO> {
+impl<IO: IoTrait + 'static> VfsNodeOps for DirWrapper<'static, IO> {
     axfs_vfs::impl_vfs_dir_default! {}
 
+    fn as_any(&self) -> &dyn core::any::Any {
+        self
+    }
+
     fn get_attr(&self) -> VfsResult<VfsNodeAttr> {
         // FAT fs doesn't support permissions, we just set everything to 755
         Ok(VfsNodeAttr::new(
@@ -204,6 +220,43 @@ impl<IO: IoTrait> VfsNodeOps for DirWrapper<'static, IO> {
     }
 }
 
+/// Returns the time since the epoch of a FAT date and time, which are taken
+/// as UTC.
+fn fat_time(date: fatfs::Date, hour: u16, min: u16, sec: u16) -> Duration {
+    // The days since the epoch of the civil date, as in
+    // http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+    let (month, day) = (date.month as i64, date.day as i64);
+    let year = date.year as i64 - (month <= 2) as i64;
+    let era = year.div_euclid(400);
+    let year_of_era = year - era * 400;
+    let day_of_year = (153 * ((month + 9) % 12) + 2) / 5 + day - 1;
+    let day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    let days = (era * 146097 + day_of_era - 719468).max(0) as u64;
+    Duration::from_secs(days * 86400 + hour as u64 * 3600 + min as u64 * 60 + sec as u64)
+}
+
+/// Fills `info` with the times of the entry `name` of the directory `parent`.
+///
+/// FAT has no inode numbers, owners or change times, so those are left as
+/// they are, and the change time is the modification time.
+pub(crate) fn file_info(parent: &VfsNodeRef, name: &str, info: &mut FileInfo) {
+    let Some(dir) = parent.as_any().downcast_ref::<DirWrapper<'static, Disk>>() else {
+        return;
+    };
+    let entry = dir
+        .0
+        .iter()
+        .filter_map(Result::ok)
+        .find(|entry| entry.file_name().eq_ignore_ascii_case(name));
+    if let Some(entry) = entry {
+        let modified = entry.modified();
+        let time = modified.time;
+        info.atime = fat_time(entry.accessed(), 0, 0, 0);
+        info.mtime = fat_time(modified.date, time.hour, time.min, time.sec);
+        info.ctime = info.mtime;
+    }
+}
+
 impl VfsOps for FatFileSystem {
     fn root_dir(&self) -> VfsNodeRef {
         let root_dir = unsafe { (*self.root_dir.get()).as_ref().unwrap() };
@@ -1,16 +1,25 @@
 use crate::alloc::string::String;
+use alloc::ffi::CString;
 use alloc::sync::Arc;
 use axerrno::AxError;
 use axfs_vfs::{VfsDirEntry, VfsError, VfsNodePerm, VfsResult};
 use axfs_vfs::{VfsNodeAttr, VfsNodeOps, VfsNodeRef, VfsNodeType, VfsOps};
 use axsync::Mutex;
+use core::{ffi::CStr, time::Duration};
 use lwext4_rust::bindings::{
-    O_CREAT, O_RDONLY, O_RDWR, O_TRUNC, O_WRONLY, SEEK_CUR, SEEK_END, SEEK_SET,
+    O_CREAT, O_RDONLY, O_RDWR, O_TRUNC, O_WRONLY, SEEK_CUR, SEEK_END, SEEK_SET, ext4_ctime_set,
+    ext4_dir, ext4_dir_close, ext4_dir_entry_next, ext4_dir_open, ext4_flink, ext4_inode,
+    ext4_mtime_set, ext4_raw_inode_fill,
 };
 use lwext4_rust::{Ext4BlockWrapper, Ext4File, InodeTypes, KernelDevOp};
 
 use crate::dev::Disk;
+use crate::fops::FileInfo;
 pub const BLOCK_SIZE: usize = 512;
+/// The number of disk blocks cached below lwext4, 1 MiB.
+const EXT4_CACHE_BLOCKS: usize = 2048;
+/// The longest transfers cached below lwext4, of one 4 KiB file system block.
+const EXT4_CACHED_TRANSFER_BLOCKS: usize = 8;
 
 #[allow(dead_code)]
 pub struct Ext4FileSystem {
@@ -28,12 +37,16 @@ impl Ext4FileSystem {
     }
 
     #[cfg(not(feature = "use-ramdisk"))]
-    pub fn new(disk: Disk) -> Self {
+    pub fn new(mut disk: Disk) -> Self {
         info!(
             "Got Disk size:{}, position:{}",
             disk.size(),
             disk.position()
         );
+        // lwext4 keeps only a few blocks in its own cache, the inode tables,
+        // extent tree nodes and directories are kept here, as they are read
+        // one file system block at a time, unlike bulk file data.
+        disk.enable_cache(EXT4_CACHE_BLOCKS, EXT4_CACHED_TRANSFER_BLOCKS);
         let inner =
             Ext4BlockWrapper::<Disk>::new(disk).expect("failed to initialize EXT4 filesystem");
         let root = Arc::new(FileWrapper::new("/", InodeTypes::EXT4_DE_DIR));
@@ -41,6 +54,64 @@ impl Ext4FileSystem {
     }
 }
 
+fn c_path(path: &str) -> VfsResult<CString> {
+    CString::new(path).map_err(|_| VfsError::InvalidInput)
+}
+
+/// Creates a hard link at the absolute path `new` to the file at `old`,
+/// which increments the link count of its inode.
+pub(crate) fn hard_link(old: &str, new: &str) -> VfsResult {
+    let (old, new) = (c_path(old)?, c_path(new)?);
+    match unsafe { ext4_flink(old.as_ptr(), new.as_ptr()) } {
+        0 => Ok(()),
+        e => Err(e.try_into().unwrap()),
+    }
+}
+
+/// Returns the number and the contents of the inode at the absolute `path`.
+fn raw_inode(path: &str) -> VfsResult<(u32, ext4_inode)> {
+    let path = c_path(path)?;
+    let mut ino = 0;
+    let mut inode: ext4_inode = unsafe { core::mem::zeroed() };
+    match unsafe { ext4_raw_inode_fill(path.as_ptr(), &mut ino, &mut inode) } {
+        0 => Ok((ino, inode)),
+        e => Err(e.try_into().unwrap()),
+    }
+}
+
+/// Returns the number of hard links to the inode at the absolute `path`.
+pub(crate) fn link_count(path: &str) -> VfsResult<u64> {
+    Ok(u16::from_le(raw_inode(path)?.1.links_count) as u64)
+}
+
+/// Fills `info` with the attributes of the inode at the absolute `path`.
+pub(crate) fn file_info(path: &str, info: &mut FileInfo) -> VfsResult {
+    let (ino, inode) = raw_inode(path)?;
+    let time = |time: u32| Duration::from_secs(u32::from_le(time) as u64);
+    info.ino = ino as u64;
+    info.nlink = u16::from_le(inode.links_count) as u64;
+    info.uid = u16::from_le(inode.uid) as u32;
+    info.gid = u16::from_le(inode.gid) as u32;
+    info.atime = time(inode.access_time);
+    info.mtime = time(inode.modification_time);
+    info.ctime = time(inode.change_inode_time);
+    Ok(())
+}
+
+/// Sets the modification and change times of the inode at the absolute
+/// `path`, which lwext4 does not update on writes.
+pub(crate) fn set_mtime(path: &str, mtime: Duration) -> VfsResult {
+    let path = c_path(path)?;
+    let secs = mtime.as_secs() as u32;
+    for set in [ext4_mtime_set, ext4_ctime_set] {
+        match unsafe { set(path.as_ptr(), secs) } {
+            0 => {}
+            e => return Err(e.try_into().unwrap()),
+        }
+    }
+    Ok(())
+}
+
 /// The [`VfsOps`] trait provides operations on a filesystem.
 impl VfsOps for Ext4FileSystem {
     // mount()
@@ -52,7 +123,50 @@ impl VfsOps for Ext4FileSystem {
     }
 }
 
-pub struct FileWrapper(Mutex<Ext4File>);
+pub struct FileWrapper(Mutex<Ext4File>, Mutex<Option<DirCursor>>);
+
+/// An iteration over the entries of a directory, kept open between calls to
+/// `read_dir` so that reading a directory sequentially does not rescan it.
+struct DirCursor {
+    dir: ext4_dir,
+    /// The index of the next entry.
+    index: usize,
+}
+
+impl DirCursor {
+    fn open(path: &CStr) -> VfsResult<Self> {
+        let mut dir: ext4_dir = unsafe { core::mem::zeroed() };
+        match unsafe { ext4_dir_open(&mut dir, path.as_ptr()) } {
+            0 => Ok(Self { dir, index: 0 }),
+            e => Err(e.try_into().unwrap()),
+        }
+    }
+}
+
+impl Drop for DirCursor {
+    fn drop(&mut self) {
+        unsafe { ext4_dir_close(&mut self.dir) };
+    }
+}
+
+/// Returns the node type of a directory entry of type `ty`.
+fn dirent_type(ty: u8) -> VfsNodeType {
+    const DIR: u8 = InodeTypes::EXT4_DE_DIR as u8;
+    const CHRDEV: u8 = InodeTypes::EXT4_DE_CHRDEV as u8;
+    const BLKDEV: u8 = InodeTypes::EXT4_DE_BLKDEV as u8;
+    const FIFO: u8 = InodeTypes::EXT4_DE_FIFO as u8;
+    const SOCK: u8 = InodeTypes::EXT4_DE_SOCK as u8;
+    const SYMLINK: u8 = InodeTypes::EXT4_DE_SYMLINK as u8;
+    match ty {
+        DIR => VfsNodeType::Dir,
+        CHRDEV => VfsNodeType::CharDevice,
+        BLKDEV => VfsNodeType::BlockDevice,
+        FIFO => VfsNodeType::Fifo,
+        SOCK => VfsNodeType::Socket,
+        SYMLINK => VfsNodeType::SymLink,
+        _ => VfsNodeType::File,
+    }
+}
 
 unsafe impl Send for FileWrapper {}
 unsafe impl Sync for FileWrapper {}
@@ -62,7 +176,60 @@ impl FileWrapper {
         info!("FileWrapper new {:?} {}", types, path);
         //file.file_read_test("/test/test.txt", &mut buf);
 
-        Self(Mutex::new(Ext4File::new(path, types)))
+        Self(Mutex::new(Ext4File::new(path, types)), Mutex::new(None))
+    }
+
+    /// Reads the entries of the directory from `start_idx` into `dirents`,
+    /// and their inode numbers into `inos`.
+    pub(crate) fn read_dir_ino(
+        &self,
+        start_idx: usize,
+        dirents: &mut [VfsDirEntry],
+        inos: &mut [u64],
+    ) -> VfsResult<usize> {
+        self.read_entries(start_idx, dirents, Some(inos))
+    }
+
+    fn read_entries(
+        &self,
+        start_idx: usize,
+        dirents: &mut [VfsDirEntry],
+        mut inos: Option<&mut [u64]>,
+    ) -> VfsResult<usize> {
+        let mut cursor = self.1.lock();
+        // The entries are only iterated forwards.
+        if cursor
+            .as_ref()
+            .is_none_or(|cursor| cursor.index > start_idx)
+        {
+            *cursor = None;
+            *cursor = Some(DirCursor::open(&self.0.lock().get_path())?);
+        }
+        let cursor = cursor.as_mut().unwrap();
+
+        let mut count = 0;
+        while count < dirents.len() {
+            let entry = unsafe { ext4_dir_entry_next(&mut cursor.dir) };
+            if entry.is_null() {
+                break;
+            }
+            cursor.index += 1;
+            if cursor.index <= start_idx {
+                continue;
+            }
+            let entry = unsafe { &*entry };
+            let name = &entry.name[..entry.name_length as usize];
+            let Ok(name) = core::str::from_utf8(name) else {
+                warn!("skip non UTF-8 directory entry: {:?}", name);
+                continue;
+            };
+            dirents[count] = VfsDirEntry::new(name, dirent_type(entry.inode_type));
+            if let Some(inos) = inos.as_deref_mut() {
+                inos[count] = u32::from_le(entry.inode) as u64;
+            }
+            count += 1;
+        }
+        Ok(count)
     }
 
     fn path_deal_with(&self, path: &str) -> String {
@@ -214,37 +381,7 @@ impl VfsNodeOps for FileWrapper {
 
     /// Read directory entries into `dirents`, starting from `start_idx`.
     fn read_dir(&self, start_idx: usize, dirents: &mut [VfsDirEntry]) -> VfsResult<usize> {
-        let file = self.0.lock();
-        let (name, inode_type) = file.lwext4_dir_entries().unwrap();
-
-        let mut name_iter = name.iter().skip(start_idx);
-        let mut inode_type_iter = inode_type.iter().skip(start_idx);
-
-        for (i, out_entry) in dirents.iter_mut().enumerate() {
-            let iname = name_iter.next();
-            let itypes = inode_type_iter.next();
-
-            match itypes {
-                Some(t) => {
-                    let ty = if *t == InodeTypes::EXT4_DE_DIR {
-                        VfsNodeType::Dir
-                    } else if *t == InodeTypes::EXT4_DE_REG_FILE {
-                        VfsNodeType::File
-                    } else if *t == InodeTypes::EXT4_DE_SYMLINK {
-                        VfsNodeType::SymLink
-                    } else {
-                        error!("unknown file type: {:?}", itypes);
-                        unreachable!()
-                    };
-
-                    *out_entry =
-                        VfsDirEntry::new(core::str::from_utf8(iname.unwrap()).unwrap(), ty);
-                }
-                _ => return Ok(i),
-            }
-        }
-
-        Ok(dirents.len())
+        self.read_entries(start_idx, dirents, None)
     }
 
     /// Lookup the node with given `path` in the directory.
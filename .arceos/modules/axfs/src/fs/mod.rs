@@ -14,3 +14,6 @@ pub use axfs_devfs as devfs;
 
 #[cfg(feature = "ramfs")]
 pub use axfs_ramfs as ramfs;
+
+#[cfg(feature = "tmpfs")]
+pub mod tmpfs;
@@ -0,0 +1,406 @@
+//! A filesystem kept in memory, mounted on `/tmp` and by `mount -t tmpfs`.
+//!
+//! Unlike the ramfs, the content of a file is kept in pages allocated like
+//! those of the page cache, which are only allocated when written (holes read
+//! as zeros) and freed when the file is truncated or its last reference is
+//! gone. The pages of all the files of a mount are limited, writes past the
+//! limit fail with [`VfsError::StorageFull`].
+
+use alloc::{
+    boxed::Box,
+    collections::BTreeMap,
+    string::String,
+    sync::{Arc, Weak},
+};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use axfs_vfs::{VfsDirEntry, VfsError, VfsNodeAttr, VfsNodeOps, VfsNodeRef, VfsNodeType};
+use axfs_vfs::{VfsOps, VfsResult};
+use axsync::Mutex;
+use spin::RwLock;
+
+use crate::page_cache::{PAGE_SIZE, PageBuf, alloc_page_or_evict};
+
+/// The state shared by all the nodes of a mount.
+struct TmpShared {
+    /// The most pages the files may take.
+    max_pages: usize,
+    /// The pages the files take.
+    pages: AtomicUsize,
+    /// The absolute path the filesystem is mounted on.
+    mount_path: RwLock<String>,
+    /// Serializes renames, which lock two directories one after the other.
+    rename_lock: Mutex<()>,
+}
+
+impl TmpShared {
+    /// Reserves a page for a file, if it does not exceed the limit.
+    fn charge(&self) -> VfsResult {
+        self.pages
+            .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |pages| {
+                (pages < self.max_pages).then_some(pages + 1)
+            })
+            .map(|_| ())
+            .map_err(|_| VfsError::StorageFull)
+    }
+
+    fn uncharge(&self, pages: usize) {
+        self.pages.fetch_sub(pages, Ordering::Relaxed);
+    }
+}
+
+/// A filesystem whose files are kept in memory, up to a size limit.
+pub struct TmpFileSystem {
+    shared: Arc<TmpShared>,
+    root: Arc<TmpDir>,
+}
+
+impl TmpFileSystem {
+    /// Creates an empty filesystem whose files take up to `max_size` bytes.
+    pub fn new(max_size: u64) -> Self {
+        let shared = Arc::new(TmpShared {
+            max_pages: (max_size / PAGE_SIZE as u64) as usize,
+            pages: AtomicUsize::new(0),
+            mount_path: RwLock::new(String::new()),
+            rename_lock: Mutex::new(()),
+        });
+        Self {
+            root: TmpDir::new(Weak::new(), shared.clone()),
+            shared,
+        }
+    }
+}
+
+impl VfsOps for TmpFileSystem {
+    fn mount(&self, path: &str, _mount_point: VfsNodeRef) -> VfsResult {
+        *self.shared.mount_path.write() = String::from(path);
+        Ok(())
+    }
+
+    fn root_dir(&self) -> VfsNodeRef {
+        self.root.clone()
+    }
+}
+
+#[derive(Clone)]
+enum TmpNode {
+    Dir(Arc<TmpDir>),
+    File(Arc<TmpFile>),
+}
+
+impl TmpNode {
+    fn into_vfs(self) -> VfsNodeRef {
+        match self {
+            Self::Dir(dir) => dir,
+            Self::File(file) => file,
+        }
+    }
+}
+
+/// A directory of a [`TmpFileSystem`].
+struct TmpDir {
+    this: Weak<TmpDir>,
+    /// The parent directory, or none for the root.
+    parent: RwLock<Weak<TmpDir>>,
+    entries: RwLock<BTreeMap<String, TmpNode>>,
+    shared: Arc<TmpShared>,
+}
+
+impl TmpDir {
+    fn new(parent: Weak<TmpDir>, shared: Arc<TmpShared>) -> Arc<Self> {
+        Arc::new_cyclic(|this| Self {
+            this: this.clone(),
+            parent: RwLock::new(parent),
+            entries: RwLock::new(BTreeMap::new()),
+            shared,
+        })
+    }
+
+    fn this(&self) -> Arc<Self> {
+        self.this.upgrade().unwrap()
+    }
+
+    /// Returns the node at `path`, relative to this directory.
+    fn resolve(self: Arc<Self>, path: &str) -> VfsResult<TmpNode> {
+        let mut node = TmpNode::Dir(self);
+        for name in path.split('/') {
+            let TmpNode::Dir(dir) = node else {
+                return Err(VfsError::NotADirectory);
+            };
+            node = match name {
+                "" | "." => TmpNode::Dir(dir),
+                ".." => TmpNode::Dir(dir.parent.read().upgrade().unwrap_or(dir)),
+                name => dir
+                    .entries
+                    .read()
+                    .get(name)
+                    .cloned()
+                    .ok_or(VfsError::NotFound)?,
+            };
+        }
+        Ok(node)
+    }
+
+    /// Returns the directory containing the last component of `path`, and
+    /// that component.
+    fn parent_of<'a>(&self, path: &'a str) -> VfsResult<(Arc<TmpDir>, &'a str)> {
+        let path = path.trim_end_matches('/');
+        let (dir, name) = match path.rsplit_once('/') {
+            Some((dir, name)) => (self.this().resolve(dir)?, name),
+            None => (TmpNode::Dir(self.this()), path),
+        };
+        match dir {
+            TmpNode::Dir(dir) => Ok((dir, name)),
+            TmpNode::File(_) => Err(VfsError::NotADirectory),
+        }
+    }
+
+    /// Returns the directory containing the last component of the
+    /// destination of a rename, which is relative to this directory or an
+    /// absolute path under the mount point.
+    fn rename_target<'a>(&self, path: &'a str) -> VfsResult<(Arc<TmpDir>, &'a str)> {
+        if !path.starts_with('/') {
+            return self.parent_of(path);
+        }
+        let mount_path = self.shared.mount_path.read().clone();
+        match path.strip_prefix(mount_path.as_str()) {
+            Some(rest) if rest.starts_with('/') => {
+                let mut root = self.this();
+                while let Some(parent) = root.parent.read().upgrade() {
+                    root = parent;
+                }
+                root.parent_of(rest.trim_start_matches('/'))
+            }
+            _ => Err(VfsError::Unsupported),
+        }
+    }
+
+    /// Returns whether this directory is `dir` or one of its descendants.
+    fn is_within(&self, dir: &Arc<TmpDir>) -> bool {
+        let mut current = self.this();
+        loop {
+            if Arc::ptr_eq(&current, dir) {
+                return true;
+            }
+            match current.parent.read().upgrade() {
+                Some(parent) => current = parent,
+                None => return false,
+            }
+        }
+    }
+}
+
+impl VfsNodeOps for TmpDir {
+    axfs_vfs::impl_vfs_dir_default! {}
+
+    fn get_attr(&self) -> VfsResult<VfsNodeAttr> {
+        Ok(VfsNodeAttr::new_dir(4096, 0))
+    }
+
+    fn parent(&self) -> Option<VfsNodeRef> {
+        self.parent.read().upgrade().map(|dir| dir as VfsNodeRef)
+    }
+
+    fn lookup(self: Arc<Self>, path: &str) -> VfsResult<VfsNodeRef> {
+        self.resolve(path).map(TmpNode::into_vfs)
+    }
+
+    fn create(&self, path: &str, ty: VfsNodeType) -> VfsResult {
+        let (dir, name) = self.parent_of(path)?;
+        if matches!(name, "" | "." | "..") {
+            return Err(VfsError::AlreadyExists);
+        }
+        let node = match ty {
+            VfsNodeType::Dir => TmpNode::Dir(TmpDir::new(dir.this.clone(), self.shared.clone())),
+            VfsNodeType::File => TmpNode::File(Arc::new(TmpFile::new(self.shared.clone()))),
+            _ => return Err(VfsError::Unsupported),
+        };
+        let mut entries = dir.entries.write();
+        if entries.contains_key(name) {
+            return Err(VfsError::AlreadyExists);
+        }
+        entries.insert(String::from(name), node);
+        Ok(())
+    }
+
+    fn remove(&self, path: &str) -> VfsResult {
+        let (dir, name) = self.parent_of(path)?;
+        if matches!(name, "" | "." | "..") {
+            return Err(VfsError::InvalidInput);
+        }
+        let mut entries = dir.entries.write();
+        match entries.get(name) {
+            None => return Err(VfsError::NotFound),
+            Some(TmpNode::Dir(child)) if !child.entries.read().is_empty() => {
+                return Err(VfsError::DirectoryNotEmpty);
+            }
+            Some(_) => {}
+        }
+        // The pages of a file are freed once it is closed.
+        entries.remove(name);
+        Ok(())
+    }
+
+    fn read_dir(&self, start_idx: usize, dirents: &mut [VfsDirEntry]) -> VfsResult<usize> {
+        let entries = self.entries.read();
+        let mut children = entries.iter().skip(start_idx.saturating_sub(2));
+        for (i, out) in dirents.iter_mut().enumerate() {
+            *out = match i + start_idx {
+                0 => VfsDirEntry::new(".", VfsNodeType::Dir),
+                1 => VfsDirEntry::new("..", VfsNodeType::Dir),
+                _ => match children.next() {
+                    Some((name, TmpNode::Dir(_))) => VfsDirEntry::new(name, VfsNodeType::Dir),
+                    Some((name, TmpNode::File(_))) => VfsDirEntry::new(name, VfsNodeType::File),
+                    None => return Ok(i),
+                },
+            };
+        }
+        Ok(dirents.len())
+    }
+
+    fn rename(&self, src_path: &str, dst_path: &str) -> VfsResult {
+        let _guard = self.shared.rename_lock.lock();
+        let (src_dir, src_name) = self.parent_of(src_path)?;
+        let (dst_dir, dst_name) = self.rename_target(dst_path)?;
+        if matches!(src_name, "" | "." | "..") || matches!(dst_name, "" | "." | "..") {
+            return Err(VfsError::InvalidInput);
+        }
+        let node = src_dir
+            .entries
+            .read()
+            .get(src_name)
+            .cloned()
+            .ok_or(VfsError::NotFound)?;
+        if Arc::ptr_eq(&src_dir, &dst_dir) && src_name == dst_name {
+            return Ok(());
+        }
+        if let TmpNode::Dir(dir) = &node {
+            if dst_dir.is_within(dir) {
+                return Err(VfsError::InvalidInput);
+            }
+        }
+        match (&node, dst_dir.entries.read().get(dst_name)) {
+            (_, None) => {}
+            (TmpNode::File(_), Some(TmpNode::File(_))) => {}
+            (TmpNode::Dir(_), Some(TmpNode::Dir(dir))) => {
+                if !dir.entries.read().is_empty() {
+                    return Err(VfsError::DirectoryNotEmpty);
+                }
+            }
+            (TmpNode::File(_), Some(TmpNode::Dir(_))) => return Err(VfsError::IsADirectory),
+            (TmpNode::Dir(_), Some(TmpNode::File(_))) => return Err(VfsError::NotADirectory),
+        }
+        src_dir.entries.write().remove(src_name);
+        if let TmpNode::Dir(dir) = &node {
+            *dir.parent.write() = dst_dir.this.clone();
+        }
+        dst_dir.entries.write().insert(String::from(dst_name), node);
+        Ok(())
+    }
+}
+
+/// The pages and size of a [`TmpFile`].
+struct FileData {
+    /// The pages that have been written, by index.
+    pages: BTreeMap<u64, Box<PageBuf>>,
+    size: u64,
+}
+
+/// A regular file of a [`TmpFileSystem`].
+struct TmpFile {
+    data: Mutex<FileData>,
+    shared: Arc<TmpShared>,
+}
+
+impl TmpFile {
+    fn new(shared: Arc<TmpShared>) -> Self {
+        Self {
+            data: Mutex::new(FileData {
+                pages: BTreeMap::new(),
+                size: 0,
+            }),
+            shared,
+        }
+    }
+}
+
+impl VfsNodeOps for TmpFile {
+    axfs_vfs::impl_vfs_non_dir_default! {}
+
+    fn get_attr(&self) -> VfsResult<VfsNodeAttr> {
+        let data = self.data.lock();
+        let blocks = (data.pages.len() * PAGE_SIZE / 512) as u64;
+        Ok(VfsNodeAttr::new_file(data.size, blocks))
+    }
+
+    fn read_at(&self, offset: u64, buf: &mut [u8]) -> VfsResult<usize> {
+        let data = self.data.lock();
+        let end = data.size.min(offset.saturating_add(buf.len() as u64));
+        let mut pos = offset;
+        while pos < end {
+            let (index, start) = (pos / PAGE_SIZE as u64, pos as usize % PAGE_SIZE);
+            let len = (PAGE_SIZE - start).min((end - pos) as usize);
+            let out = &mut buf[(pos - offset) as usize..][..len];
+            match data.pages.get(&index) {
+                Some(page) => out.copy_from_slice(&page.0[start..start + len]),
+                None => out.fill(0),
+            }
+            pos += len as u64;
+        }
+        Ok(pos.saturating_sub(offset) as usize)
+    }
+
+    fn write_at(&self, offset: u64, buf: &[u8]) -> VfsResult<usize> {
+        let mut data = self.data.lock();
+        let mut written = 0;
+        while written < buf.len() {
+            let pos = offset + written as u64;
+            let (index, start) = (pos / PAGE_SIZE as u64, pos as usize % PAGE_SIZE);
+            let len = (PAGE_SIZE - start).min(buf.len() - written);
+            if !data.pages.contains_key(&index) {
+                let page = self
+                    .shared
+                    .charge()
+                    .and_then(|_| alloc_page_or_evict().inspect_err(|_| self.shared.uncharge(1)));
+                match page {
+                    Ok(page) => data.pages.insert(index, page),
+                    Err(_) if written > 0 => break,
+                    Err(e) => return Err(e),
+                };
+            }
+            let page = data.pages.get_mut(&index).unwrap();
+            page.0[start..start + len].copy_from_slice(&buf[written..written + len]);
+            written += len;
+        }
+        data.size = data.size.max(offset + written as u64);
+        Ok(written)
+    }
+
+    fn truncate(&self, size: u64) -> VfsResult {
+        let mut data = self.data.lock();
+        if size < data.size {
+            let removed = data.pages.split_off(&size.div_ceil(PAGE_SIZE as u64));
+            self.shared.uncharge(removed.len());
+            // The tail of the last page is read as zeros if the file grows
+            // again.
+            let start = size as usize % PAGE_SIZE;
+            if start != 0 {
+                if let Some(page) = data.pages.get_mut(&(size / PAGE_SIZE as u64)) {
+                    page.0[start..].fill(0);
+                }
+            }
+        }
+        data.size = size;
+        Ok(())
+    }
+
+    fn fsync(&self) -> VfsResult {
+        Ok(())
+    }
+}
+
+impl Drop for TmpFile {
+    fn drop(&mut self) {
+        self.shared.uncharge(self.data.get_mut().pages.len());
+    }
+}
@@ -0,0 +1,88 @@
+//! The initramfs, a cpio archive linked into the kernel and unpacked into a
+//! tmpfs mounted on `/`, so that no block device is needed.
+//!
+//! The archive is taken from the path in the `AX_INITRAMFS` environment
+//! variable at build time, in the "newc" format of `cpio -H newc`.
+
+use axfs_vfs::{VfsError, VfsNodeRef, VfsNodeType, VfsResult};
+
+static ARCHIVE: &[u8] = include_bytes!(env!("AX_INITRAMFS"));
+
+const MAGIC: &[u8] = b"070701";
+const HEADER_LEN: usize = 110;
+const TRAILER: &str = "TRAILER!!!";
+
+const S_IFMT: u32 = 0o170000;
+const S_IFDIR: u32 = 0o040000;
+const S_IFREG: u32 = 0o100000;
+const S_IFLNK: u32 = 0o120000;
+
+/// Parses the field `index` of the header at the start of `header`, which
+/// are 8 hexadecimal digits each after the magic.
+fn field(header: &[u8], index: usize) -> VfsResult<u32> {
+    let start = MAGIC.len() + index * 8;
+    let digits =
+        core::str::from_utf8(&header[start..start + 8]).map_err(|_| VfsError::InvalidData)?;
+    u32::from_str_radix(digits, 16).map_err(|_| VfsError::InvalidData)
+}
+
+/// Returns `bytes[start..start + len]`, or an error if it is out of bounds.
+fn slice(bytes: &[u8], start: usize, len: usize) -> VfsResult<&[u8]> {
+    bytes
+        .get(start..start.checked_add(len).ok_or(VfsError::InvalidData)?)
+        .ok_or(VfsError::InvalidData)
+}
+
+/// Unpacks the initramfs into the directory `root`.
+///
+/// Only directories, regular files and symbolic links are created, other
+/// entries are skipped with a warning. The parents of each entry must come before it, as with
+/// `find . | cpio -o -H newc`.
+pub(crate) fn unpack(root: &VfsNodeRef) -> VfsResult {
+    let mut offset = 0;
+    let (mut files, mut bytes) = (0, 0);
+    loop {
+        let header = slice(ARCHIVE, offset, HEADER_LEN)?;
+        if &header[..MAGIC.len()] != MAGIC {
+            return Err(VfsError::InvalidData);
+        }
+        let mode = field(header, 1)?;
+        let file_size = field(header, 6)? as usize;
+        let name_size = field(header, 11)? as usize;
+        // The name ends with a NUL, and is padded with the header to 4 bytes,
+        // as is the data.
+        let name = slice(ARCHIVE, offset + HEADER_LEN, name_size.saturating_sub(1))?;
+        let name = core::str::from_utf8(name).map_err(|_| VfsError::InvalidData)?;
+        let data_start = (offset + HEADER_LEN + name_size).next_multiple_of(4);
+        let data = slice(ARCHIVE, data_start, file_size)?;
+        offset = (data_start + file_size).next_multiple_of(4);
+
+        if name == TRAILER {
+            break;
+        }
+        let path = name.trim_start_matches("./").trim_start_matches('/');
+        if path.is_empty() || path == "." {
+            continue;
+        }
+        match mode & S_IFMT {
+            S_IFDIR => match root.create(path, VfsNodeType::Dir) {
+                Ok(()) | Err(VfsError::AlreadyExists) => {}
+                Err(e) => return Err(e),
+            },
+            S_IFREG => {
+                root.create(path, VfsNodeType::File)?;
+                let file = root.clone().lookup(path)?;
+                file.write_at(0, data)?;
+                files += 1;
+                bytes += data.len();
+            }
+            S_IFLNK => {
+                let target = core::str::from_utf8(data).map_err(|_| VfsError::InvalidData)?;
+                crate::symlink::create(&alloc::format!("/{}", path), target)?;
+            }
+            _ => warn!("initramfs: skipping {:?} of mode {:#o}", path, mode),
+        }
+    }
+    info!("initramfs: unpacked {} files of {} bytes", files, bytes);
+    Ok(())
+}
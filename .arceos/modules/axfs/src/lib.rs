@@ -8,8 +8,20 @@
 //!    is **enabled** by default.
 //! - `devfs`: Mount [`axfs_devfs::DeviceFileSystem`] on `/dev`. This feature is
 //!    **enabled** by default.
-//! - `ramfs`: Mount [`axfs_ramfs::RamFileSystem`] on `/tmp`. This feature is
-//!    **enabled** by default.
+//! - `ramfs`: Mount [`axfs_ramfs::RamFileSystem`] on `/tmp` if `tmpfs` is
+//!    disabled. This feature is **enabled** by default.
+//! - `tmpfs`: Mount a filesystem whose files are kept in pages on `/tmp`,
+//!    limited to half of the memory, and allow mounting more with
+//!    [`api::mount_tmpfs`]. This feature is **enabled** by default.
+//! - `procfs`: Mount [`procfs::ProcFileSystem`] on `/proc`, whose entries are
+//!    mostly generated by the kernel. This feature is **enabled** by default.
+//! - `initramfs`: Mount a tmpfs on `/` instead of the filesystem of the block
+//!    device, and unpack into it the cpio archive at the path in the
+//!    `AX_INITRAMFS` environment variable at build time, which is linked into
+//!    the kernel. This feature is **disabled** by default.
+//! - `multitask`: Read ahead and write back dirty pages in background tasks.
+//!    This feature is **disabled** by default, in which case this is done
+//!    synchronously.
 //! - `myfs`: Allow users to define their custom filesystems to override the
 //!    default. In this case, [`MyFileSystemIf`] is required to be implemented
 //!    to create and initialize other filesystems. This feature is **disabled** by
@@ -26,22 +38,39 @@
 extern crate log;
 extern crate alloc;
 
+mod dcache;
 mod dev;
 mod fs;
+#[cfg(feature = "initramfs")]
+mod initramfs;
 mod mounts;
 mod root;
+mod symlink;
 
 pub mod api;
 pub mod fops;
+pub mod page_cache;
+#[cfg(feature = "procfs")]
+pub mod procfs;
+mod readahead;
+mod writeback;
 pub use root::{CURRENT_DIR, CURRENT_DIR_PATH};
 
 use axdriver::{AxDeviceContainer, prelude::*};
 
-/// Initializes filesystems by block devices.
+/// Initializes filesystems by block devices, or by the initramfs with the
+/// `initramfs` feature, in which case the block devices are not used.
+#[cfg_attr(feature = "initramfs", allow(unused_mut, unused_variables))]
 pub fn init_filesystems(mut blk_devs: AxDeviceContainer<AxBlockDevice>) {
     info!("Initialize filesystems...");
 
-    let dev = blk_devs.take_one().expect("No block device found!");
-    info!("  use block device 0: {:?}", dev.device_name());
-    self::root::init_rootfs(self::dev::Disk::new(dev));
+    #[cfg(feature = "initramfs")]
+    self::root::init_rootfs_initramfs();
+    #[cfg(not(feature = "initramfs"))]
+    {
+        let dev = blk_devs.take_one().expect("No block device found!");
+        info!("  use block device 0: {:?}", dev.device_name());
+        self::root::init_rootfs(self::dev::Disk::new(dev));
+    }
+    axalloc::set_reclaim_hook(page_cache::reclaim);
 }
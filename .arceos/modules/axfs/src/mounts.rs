@@ -16,14 +16,26 @@ pub(crate) fn devfs() -> Arc<fs::devfs::DeviceFileSystem> {
     Arc::new(devfs)
 }
 
-#[cfg(feature = "ramfs")]
+#[cfg(all(feature = "ramfs", not(feature = "tmpfs")))]
 pub(crate) fn ramfs() -> Arc<fs::ramfs::RamFileSystem> {
     Arc::new(fs::ramfs::RamFileSystem::new())
 }
 
+/// Creates a tmpfs whose files take up to `size` bytes, or half of the
+/// memory.
+#[cfg(feature = "tmpfs")]
+pub(crate) fn tmpfs(size: Option<u64>) -> Arc<fs::tmpfs::TmpFileSystem> {
+    let size = size.unwrap_or_else(|| {
+        let allocator = axalloc::global_allocator();
+        let pages = allocator.used_pages() + allocator.available_pages();
+        (pages * crate::page_cache::PAGE_SIZE / 2) as u64
+    });
+    Arc::new(fs::tmpfs::TmpFileSystem::new(size))
+}
+
 #[cfg(feature = "procfs")]
-pub(crate) fn procfs() -> VfsResult<Arc<fs::ramfs::RamFileSystem>> {
-    let procfs = fs::ramfs::RamFileSystem::new();
+pub(crate) fn procfs() -> VfsResult<Arc<crate::procfs::ProcFileSystem>> {
+    let procfs = axfs_ramfs::RamFileSystem::new();
     let proc_root = procfs.root_dir();
 
     // Create /proc/sys/net/core/somaxconn
@@ -40,11 +52,8 @@ pub(crate) fn procfs() -> VfsResult<Arc<fs::ramfs::RamFileSystem>> {
     let file_over = proc_root.clone().lookup("./sys/vm/overcommit_memory")?;
     file_over.write_at(0, b"0\n")?;
 
-    // Create /proc/self/stat
-    proc_root.create("self", VfsNodeType::Dir)?;
-    proc_root.create("self/stat", VfsNodeType::File)?;
-
-    Ok(Arc::new(procfs))
+    // The other entries are generated.
+    Ok(Arc::new(crate::procfs::ProcFileSystem::new(procfs)))
 }
 
 #[cfg(feature = "sysfs")]
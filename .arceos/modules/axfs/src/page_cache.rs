@@ -0,0 +1,797 @@
+//! Page cache of the regular files of the main filesystem.
+//!
+//! Files are indexed by their absolute path, which is the only identity of a
+//! file that is stable across lookups, as filesystems create a new node on
+//! every lookup. Writes only dirty the cached pages, which are written back
+//! when evicted, on [`fops::File::flush`], by [`sync_all`] and in the
+//! background once too many pages are dirty. Pages are evicted in
+//! least-recently-used order when the cache is full, and the clean ones when
+//! the global allocator runs out of memory (see [`reclaim`]).
+//!
+//! Mappings of files (including executables) are filled from their file
+//! through this cache too.
+//!
+//! [`fops::File::flush`]: crate::fops::File::flush
+
+use alloc::{
+    alloc::alloc_zeroed,
+    boxed::Box,
+    collections::BTreeMap,
+    string::String,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use core::{
+    alloc::Layout,
+    ops::Deref,
+    sync::atomic::{AtomicU64, AtomicUsize, Ordering},
+};
+
+use axerrno::AxError;
+use axfs_vfs::{VfsNodeRef, VfsResult};
+use axsync::{Mutex, MutexGuard, spin::SpinNoIrq};
+
+use crate::fops::{FileAttr, FileInfo, FilePerm, FileType};
+
+/// The size of a cached page.
+pub const PAGE_SIZE: usize = 0x1000;
+
+/// The default capacity of the cache, in pages.
+const DEFAULT_CAPACITY: usize = 0x4000;
+/// The maximum number of adjacent pages read or written back in one request
+/// to the filesystem, which lets it issue large requests to the device.
+const MAX_RUN: u64 = 16;
+
+#[repr(C, align(4096))]
+pub(crate) struct PageBuf(pub(crate) [u8; PAGE_SIZE]);
+
+struct Page {
+    /// The data, which may also be pinned by [`PinnedPage`]s.
+    buf: Arc<PageBuf>,
+    dirty: bool,
+    /// The last access, which is the key of the page in [`LRU`].
+    stamp: u64,
+}
+
+impl Page {
+    /// Returns the data of the page to be changed, which is copied first if
+    /// it is pinned, so that the pins keep seeing the old data.
+    fn buf_mut(&mut self) -> VfsResult<&mut PageBuf> {
+        if Arc::get_mut(&mut self.buf).is_none() {
+            let mut buf = alloc_page_or_evict()?;
+            buf.0.copy_from_slice(&self.buf.0);
+            self.buf = Arc::from(buf);
+        }
+        Ok(Arc::get_mut(&mut self.buf).unwrap())
+    }
+}
+
+/// A part of a cached page, which can be read without locking its file, e.g.
+/// to copy it straight into the send buffer of a socket.
+///
+/// The page stays allocated while it is pinned, even if it is evicted, and
+/// later writes to the file change a copy of it.
+pub struct PinnedPage {
+    buf: Arc<PageBuf>,
+    start: usize,
+    end: usize,
+}
+
+impl Deref for PinnedPage {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        &self.buf.0[self.start..self.end]
+    }
+}
+
+struct CacheInner {
+    pages: BTreeMap<u64, Page>,
+    /// The size of the file, including the cached writes.
+    size: u64,
+    /// The size of the file in the filesystem.
+    disk_size: u64,
+    /// The attributes of the file, with the times of the cached writes.
+    info: FileInfo,
+    /// Whether the times have changed since they were written back.
+    times_dirty: bool,
+}
+
+impl CacheInner {
+    /// Updates the times of the file after its contents changed.
+    fn touch(&mut self) {
+        let now = axhal::time::wall_time();
+        self.info.mtime = now;
+        self.info.ctime = now;
+        self.times_dirty = true;
+    }
+}
+
+/// The cached pages of a file.
+pub(crate) struct CachedFile {
+    path: String,
+    node: VfsNodeRef,
+    perm: FilePerm,
+    inner: Mutex<CacheInner>,
+}
+
+/// Statistics of the page cache.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct PageCacheStats {
+    /// The number of page lookups found in the cache.
+    pub hits: u64,
+    /// The number of page lookups that missed the cache.
+    pub misses: u64,
+    /// The number of pages evicted.
+    pub evictions: u64,
+    /// The number of dirty pages written back.
+    pub writebacks: u64,
+    /// The number of pages read ahead.
+    pub readahead: u64,
+    /// The number of cached pages.
+    pub pages: usize,
+    /// The number of dirty pages.
+    pub dirty: usize,
+}
+
+/// All the cached files, by absolute path.
+static FILES: SpinNoIrq<BTreeMap<String, Arc<CachedFile>>> = SpinNoIrq::new(BTreeMap::new());
+/// The cached pages, by last access.
+static LRU: SpinNoIrq<BTreeMap<u64, (Weak<CachedFile>, u64)>> = SpinNoIrq::new(BTreeMap::new());
+static NEXT_STAMP: AtomicU64 = AtomicU64::new(1);
+static CAPACITY: AtomicUsize = AtomicUsize::new(DEFAULT_CAPACITY);
+
+static PAGES: AtomicUsize = AtomicUsize::new(0);
+static DIRTY: AtomicUsize = AtomicUsize::new(0);
+static HITS: AtomicU64 = AtomicU64::new(0);
+static MISSES: AtomicU64 = AtomicU64::new(0);
+static EVICTIONS: AtomicU64 = AtomicU64::new(0);
+static WRITEBACKS: AtomicU64 = AtomicU64::new(0);
+static READAHEAD: AtomicU64 = AtomicU64::new(0);
+
+/// Allocates a page, making room with the clean pages of files that are not
+/// in use if memory is short (the caller holds the lock of its file).
+pub(crate) fn alloc_page_or_evict() -> VfsResult<Box<PageBuf>> {
+    match alloc_page() {
+        Some(buf) => Ok(buf),
+        None if evict(1, false, false) > 0 => alloc_page().ok_or(AxError::NoMemory),
+        None => Err(AxError::NoMemory),
+    }
+}
+
+fn alloc_page() -> Option<Box<PageBuf>> {
+    let layout = Layout::new::<PageBuf>();
+    // SAFETY: the layout has a non-zero size, and zeroed memory is a valid
+    // `PageBuf`.
+    unsafe {
+        let ptr = alloc_zeroed(layout) as *mut PageBuf;
+        (!ptr.is_null()).then(|| Box::from_raw(ptr))
+    }
+}
+
+impl CachedFile {
+    /// Moves the page `index` to the most recently used end of the LRU list.
+    fn touch(self: &Arc<Self>, index: u64, page: &mut Page) {
+        let stamp = NEXT_STAMP.fetch_add(1, Ordering::Relaxed);
+        let mut lru = LRU.lock();
+        lru.remove(&page.stamp);
+        lru.insert(stamp, (Arc::downgrade(self), index));
+        page.stamp = stamp;
+    }
+
+    /// Returns the page `index`, reading it from the filesystem if it is not
+    /// cached and `fill` is set.
+    fn page<'a>(
+        self: &Arc<Self>,
+        inner: &'a mut CacheInner,
+        index: u64,
+        fill: bool,
+    ) -> VfsResult<&'a mut Page> {
+        if inner.pages.contains_key(&index) {
+            HITS.fetch_add(1, Ordering::Relaxed);
+        } else {
+            MISSES.fetch_add(1, Ordering::Relaxed);
+            self.insert_page(inner, index, fill)?;
+        }
+        let page = inner.pages.get_mut(&index).unwrap();
+        self.touch(index, page);
+        Ok(page)
+    }
+
+    /// Adds the page `index`, which is not cached, reading it from the
+    /// filesystem if `fill` is set.
+    fn insert_page(&self, inner: &mut CacheInner, index: u64, fill: bool) -> VfsResult {
+        let mut buf = alloc_page_or_evict()?;
+        let offset = index * PAGE_SIZE as u64;
+        if fill && offset < inner.disk_size {
+            let len = (inner.disk_size - offset).min(PAGE_SIZE as u64) as usize;
+            self.read_fully(offset, &mut buf.0[..len])?;
+        }
+        inner.pages.insert(
+            index,
+            Page {
+                buf: Arc::from(buf),
+                dirty: false,
+                stamp: 0,
+            },
+        );
+        PAGES.fetch_add(1, Ordering::Relaxed);
+        Ok(())
+    }
+
+    /// Reads `buf.len()` bytes at `offset` from the filesystem, or up to the
+    /// end of the file.
+    fn read_fully(&self, offset: u64, buf: &mut [u8]) -> VfsResult {
+        let mut read = 0;
+        while read < buf.len() {
+            match self.node.read_at(offset + read as u64, &mut buf[read..])? {
+                0 => break,
+                n => read += n,
+            }
+        }
+        Ok(())
+    }
+
+    /// Reads the `count` adjacent pages from the page `start`, which are not
+    /// cached, in one request to the filesystem.
+    fn insert_run(self: &Arc<Self>, inner: &mut CacheInner, start: u64, count: u64) -> VfsResult {
+        let offset = start * PAGE_SIZE as u64;
+        let len = (inner.disk_size.saturating_sub(offset)).min(count * PAGE_SIZE as u64);
+        let mut data = Vec::new();
+        data.try_reserve_exact(len as usize)
+            .map_err(|_| AxError::NoMemory)?;
+        data.resize(len as usize, 0);
+        self.read_fully(offset, &mut data)?;
+        for (index, chunk) in (start..).zip(data.chunks(PAGE_SIZE)) {
+            let mut buf = alloc_page_or_evict()?;
+            buf.0[..chunk.len()].copy_from_slice(chunk);
+            let mut page = Page {
+                buf: Arc::from(buf),
+                dirty: false,
+                stamp: 0,
+            };
+            self.touch(index, &mut page);
+            inner.pages.insert(index, page);
+            PAGES.fetch_add(1, Ordering::Relaxed);
+            READAHEAD.fetch_add(1, Ordering::Relaxed);
+        }
+        Ok(())
+    }
+
+    /// Reads `count` pages from the page `start` into the cache, if they are
+    /// not cached yet.
+    ///
+    /// Adjacent missing pages are read in one request. The lock of the file
+    /// is released between requests, so that readers can use the pages
+    /// already read.
+    pub fn prefetch(self: &Arc<Self>, start: u64, count: u64) {
+        let end = start + count;
+        let mut index = start;
+        while index < end {
+            let mut inner = self.inner.lock();
+            let end = end.min(inner.disk_size.div_ceil(PAGE_SIZE as u64));
+            while index < end && inner.pages.contains_key(&index) {
+                index += 1;
+            }
+            let mut run_end = index;
+            while run_end < end && run_end - index < MAX_RUN && !inner.pages.contains_key(&run_end)
+            {
+                run_end += 1;
+            }
+            if index == run_end {
+                break;
+            }
+            if let Err(e) = self.insert_run(&mut inner, index, run_end - index) {
+                debug!("page cache: failed to prefetch {}: {:?}", self.path, e);
+                return;
+            }
+            index = run_end;
+        }
+        shrink();
+    }
+
+    /// Drops the clean cached pages in `[start, end)`, which are not expected
+    /// to be used soon.
+    pub fn drop_clean(&self, start: u64, end: u64) {
+        let mut inner = self.inner.lock();
+        let clean = inner
+            .pages
+            .range(start..end)
+            .filter(|(_, page)| !page.dirty)
+            .map(|(index, _)| *index)
+            .collect::<Vec<_>>();
+        let pages = clean.iter().filter_map(|index| inner.pages.remove(index));
+        remove_pages(pages.collect::<Vec<_>>().into_iter());
+    }
+
+    /// Writes the page `index` back to the filesystem.
+    fn write_back(&self, inner: &mut CacheInner, index: u64) -> VfsResult {
+        self.write_back_run(inner, index, 1)
+    }
+
+    /// Writes the `count` adjacent pages from the page `start` back to the
+    /// filesystem, in one request if they are all dirty.
+    fn write_back_run(&self, inner: &mut CacheInner, start: u64, count: u64) -> VfsResult {
+        let offset = start * PAGE_SIZE as u64;
+        let size = inner.size;
+        // Holes before the page are filled first, as filesystems may not
+        // support writing beyond the end of a file.
+        while inner.disk_size < offset {
+            let zeros = [0; 512];
+            let len = (offset - inner.disk_size).min(zeros.len() as u64) as usize;
+            let written = self.node.write_at(inner.disk_size, &zeros[..len])?;
+            if written == 0 {
+                return Err(AxError::WriteZero);
+            }
+            inner.disk_size += written as u64;
+        }
+
+        let run = inner.pages.range(start..start + count);
+        if run.clone().count() as u64 != count || run.clone().any(|(_, page)| !page.dirty) {
+            // Not a run of dirty pages, so write back the dirty ones alone.
+            if count == 1 {
+                return Ok(());
+            }
+            let dirty = run
+                .filter(|(_, page)| page.dirty)
+                .map(|(index, _)| *index)
+                .collect::<Vec<_>>();
+            for index in dirty {
+                self.write_back_run(inner, index, 1)?;
+            }
+            return Ok(());
+        }
+
+        let len = (size.saturating_sub(offset)).min(count * PAGE_SIZE as u64) as usize;
+        let merged;
+        let data = if count == 1 {
+            &inner.pages[&start].buf.0[..len]
+        } else {
+            let mut data = Vec::new();
+            data.try_reserve_exact(len).map_err(|_| AxError::NoMemory)?;
+            for (_, page) in run {
+                data.extend_from_slice(&page.buf.0);
+            }
+            data.truncate(len);
+            merged = data;
+            &merged[..]
+        };
+        let mut written = 0;
+        while written < len {
+            match self
+                .node
+                .write_at(offset + written as u64, &data[written..])?
+            {
+                0 => return Err(AxError::WriteZero),
+                n => written += n,
+            }
+        }
+        for (_, page) in inner.pages.range_mut(start..start + count) {
+            page.dirty = false;
+        }
+        DIRTY.fetch_sub(count as usize, Ordering::Relaxed);
+        WRITEBACKS.fetch_add(count, Ordering::Relaxed);
+        inner.disk_size = inner.disk_size.max(offset + len as u64);
+        Ok(())
+    }
+
+    /// Returns the size of the file, including the cached writes.
+    pub fn size(&self) -> u64 {
+        self.inner.lock().size
+    }
+
+    /// Returns the attributes of the file, including the cached writes.
+    pub fn attr(&self) -> FileAttr {
+        let size = self.size();
+        FileAttr::new(self.perm, FileType::File, size, size.div_ceil(512))
+    }
+
+    /// Returns the attributes of the file that [`FileAttr`] does not carry.
+    pub fn info(&self) -> FileInfo {
+        self.inner.lock().info
+    }
+
+    /// Reads the file at `offset` through the cache.
+    pub fn read_at(self: &Arc<Self>, offset: u64, buf: &mut [u8]) -> VfsResult<usize> {
+        let read = {
+            let mut inner = self.inner.lock();
+            let end = (offset + buf.len() as u64).min(inner.size);
+            let mut pos = offset;
+            while pos < end {
+                let index = pos / PAGE_SIZE as u64;
+                let page_offset = (pos % PAGE_SIZE as u64) as usize;
+                let len = (end - pos).min((PAGE_SIZE - page_offset) as u64) as usize;
+                let page = self.page(&mut inner, index, true)?;
+                let start = (pos - offset) as usize;
+                buf[start..start + len]
+                    .copy_from_slice(&page.buf.0[page_offset..page_offset + len]);
+                pos += len as u64;
+            }
+            pos.saturating_sub(offset) as usize
+        };
+        shrink();
+        Ok(read)
+    }
+
+    /// Pins the part of the cached page at `offset` up to the end of the page
+    /// or of the file, reading it first if needed. Returns `None` at the end
+    /// of the file.
+    pub fn pin(self: &Arc<Self>, offset: u64) -> VfsResult<Option<PinnedPage>> {
+        let pinned = {
+            let mut inner = self.inner.lock();
+            if offset >= inner.size {
+                return Ok(None);
+            }
+            let index = offset / PAGE_SIZE as u64;
+            let page_start = index * PAGE_SIZE as u64;
+            let end = (page_start + PAGE_SIZE as u64).min(inner.size);
+            let page = self.page(&mut inner, index, true)?;
+            PinnedPage {
+                buf: page.buf.clone(),
+                start: (offset - page_start) as usize,
+                end: (end - page_start) as usize,
+            }
+        };
+        shrink();
+        Ok(Some(pinned))
+    }
+
+    /// Writes the file at `offset` through the cache, which only dirties the
+    /// cached pages.
+    pub fn write_at(self: &Arc<Self>, offset: u64, buf: &[u8]) -> VfsResult<usize> {
+        {
+            let mut inner = self.inner.lock();
+            let end = offset + buf.len() as u64;
+            let mut pos = offset;
+            while pos < end {
+                let index = pos / PAGE_SIZE as u64;
+                let page_offset = (pos % PAGE_SIZE as u64) as usize;
+                let len = (end - pos).min((PAGE_SIZE - page_offset) as u64) as usize;
+                // Pages that are written entirely are not read first.
+                let page = self.page(&mut inner, index, len < PAGE_SIZE)?;
+                let start = (pos - offset) as usize;
+                page.buf_mut()?.0[page_offset..page_offset + len]
+                    .copy_from_slice(&buf[start..start + len]);
+                if !page.dirty {
+                    page.dirty = true;
+                    DIRTY.fetch_add(1, Ordering::Relaxed);
+                }
+                pos += len as u64;
+            }
+            inner.size = inner.size.max(end);
+            inner.touch();
+        }
+        shrink();
+        crate::writeback::balance_dirty(self);
+        Ok(buf.len())
+    }
+
+    /// Truncates (or extends) the file to `size`.
+    pub fn truncate(&self, size: u64) -> VfsResult {
+        let mut inner = self.inner.lock();
+        self.node.truncate(size)?;
+        let first_dropped = size.div_ceil(PAGE_SIZE as u64);
+        let dropped = inner.pages.split_off(&first_dropped);
+        remove_pages(dropped.into_values());
+        // The tail of the last page must read as zeros if the file grows
+        // again.
+        let tail = (size % PAGE_SIZE as u64) as usize;
+        if tail != 0 {
+            if let Some(page) = inner.pages.get_mut(&(size / PAGE_SIZE as u64)) {
+                page.buf_mut()?.0[tail..].fill(0);
+            }
+        }
+        inner.size = size;
+        inner.disk_size = size;
+        inner.touch();
+        Ok(())
+    }
+
+    /// Writes all the dirty pages back to the filesystem.
+    pub fn sync(&self) -> VfsResult {
+        self.sync_range(0, u64::MAX)
+    }
+
+    /// Writes the dirty pages in `[start, end)` back to the filesystem.
+    pub fn sync_range(&self, start: u64, end: u64) -> VfsResult {
+        self.sync_locked(&mut self.inner.lock(), start, end)
+    }
+
+    fn sync_locked(&self, inner: &mut CacheInner, start: u64, end: u64) -> VfsResult {
+        let dirty = inner
+            .pages
+            .range(start..end)
+            .filter(|(_, page)| page.dirty)
+            .map(|(index, _)| *index)
+            .collect::<Vec<_>>();
+        // Adjacent dirty pages are written back together.
+        let mut i = 0;
+        while i < dirty.len() {
+            let mut count = 1;
+            while i + count < dirty.len()
+                && count < MAX_RUN as usize
+                && dirty[i + count] == dirty[i] + count as u64
+            {
+                count += 1;
+            }
+            self.write_back_run(inner, dirty[i], count as u64)?;
+            i += count;
+        }
+        // Writes beyond the cached pages may have extended the file.
+        if end >= inner.size.div_ceil(PAGE_SIZE as u64) && inner.disk_size < inner.size {
+            let size = inner.size;
+            self.node.truncate(size)?;
+            inner.disk_size = size;
+        }
+        if inner.times_dirty {
+            crate::root::set_mtime(&self.path, inner.info.mtime)?;
+            inner.times_dirty = false;
+        }
+        Ok(())
+    }
+
+    /// Writes the pages overlapping `[offset, end)` back, so that the
+    /// filesystem has the latest data of the range, including the size of the
+    /// file if the range extends past it.
+    fn sync_for_direct(&self, inner: &mut CacheInner, offset: u64, end: u64) -> VfsResult {
+        let end_index = if end > inner.disk_size {
+            u64::MAX
+        } else {
+            end.div_ceil(PAGE_SIZE as u64)
+        };
+        self.sync_locked(inner, offset / PAGE_SIZE as u64, end_index)
+    }
+
+    /// Reads the file at `offset` directly from the filesystem, bypassing the
+    /// cache.
+    pub fn read_direct(&self, offset: u64, buf: &mut [u8]) -> VfsResult<usize> {
+        let mut inner = self.inner.lock();
+        let end = (offset + buf.len() as u64).min(inner.size);
+        if offset >= end {
+            return Ok(0);
+        }
+        self.sync_for_direct(&mut inner, offset, end)?;
+        self.node
+            .read_at(offset, &mut buf[..(end - offset) as usize])
+    }
+
+    /// Writes the file at `offset` directly to the filesystem, bypassing the
+    /// cache. The cached pages of the range are dropped.
+    pub fn write_direct(&self, offset: u64, buf: &[u8]) -> VfsResult<usize> {
+        let mut inner = self.inner.lock();
+        let end = offset + buf.len() as u64;
+        self.sync_for_direct(&mut inner, offset, end)?;
+        if inner.disk_size < offset {
+            self.node.truncate(offset)?;
+            inner.disk_size = offset;
+            inner.size = inner.size.max(offset);
+        }
+        let dropped = inner
+            .pages
+            .range(offset / PAGE_SIZE as u64..end.div_ceil(PAGE_SIZE as u64))
+            .map(|(index, _)| *index)
+            .collect::<Vec<_>>();
+        let dropped = dropped.iter().filter_map(|index| inner.pages.remove(index));
+        remove_pages(dropped.collect::<Vec<_>>().into_iter());
+
+        let written = self.node.write_at(offset, buf)?;
+        let end = offset + written as u64;
+        inner.disk_size = inner.disk_size.max(end);
+        inner.size = inner.size.max(end);
+        inner.touch();
+        Ok(written)
+    }
+}
+
+impl Drop for CachedFile {
+    fn drop(&mut self) {
+        let pages = core::mem::take(&mut self.inner.get_mut().pages);
+        remove_pages(pages.into_values());
+    }
+}
+
+/// Accounts for pages that are dropped without being written back.
+fn remove_pages(pages: impl Iterator<Item = Page>) {
+    let mut lru = LRU.lock();
+    for page in pages {
+        lru.remove(&page.stamp);
+        PAGES.fetch_sub(1, Ordering::Relaxed);
+        if page.dirty {
+            DIRTY.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Returns the cache of the file at the absolute path `path`, whose node is
+/// `node`.
+pub(crate) fn open(path: &str, node: &VfsNodeRef) -> VfsResult<Arc<CachedFile>> {
+    if let Some(file) = FILES.lock().get(path) {
+        return Ok(file.clone());
+    }
+    let attr = node.get_attr()?;
+    let size = attr.size();
+    let file = Arc::new(CachedFile {
+        path: path.into(),
+        node: node.clone(),
+        perm: attr.perm(),
+        inner: Mutex::new(CacheInner {
+            pages: BTreeMap::new(),
+            size,
+            disk_size: size,
+            info: crate::root::fs_file_info(path)?,
+            times_dirty: false,
+        }),
+    });
+    // Another thread may have opened the file meanwhile.
+    Ok(FILES.lock().entry(path.into()).or_insert(file).clone())
+}
+
+/// Returns the attributes of the file at `path`, including the cached
+/// writes, if the file is cached.
+pub(crate) fn info(path: &str) -> Option<FileInfo> {
+    let file = FILES.lock().get(path).cloned();
+    file.map(|file| file.info())
+}
+
+/// Returns the size of the file at `path`, including the cached writes, if
+/// the file is cached.
+pub(crate) fn size(path: &str) -> Option<u64> {
+    let file = FILES.lock().get(path).cloned();
+    file.map(|file| file.size())
+}
+
+/// Drops the cache of the file at `path` without writing it back, e.g. when
+/// the file is removed.
+///
+/// Files that are still open keep their pages until they are closed.
+pub(crate) fn discard(path: &str) {
+    FILES.lock().remove(path);
+}
+
+/// Writes back and drops the cache of the file at `path`, or of the files
+/// under it if it is a directory, e.g. before it is renamed.
+pub(crate) fn forget(path: &str) -> VfsResult {
+    let files = {
+        let mut files = FILES.lock();
+        let paths = files
+            .keys()
+            .filter(|p| {
+                p.strip_prefix(path)
+                    .is_some_and(|rest| rest.is_empty() || rest.starts_with('/'))
+            })
+            .cloned()
+            .collect::<Vec<_>>();
+        paths
+            .iter()
+            .filter_map(|p| files.remove(p))
+            .collect::<Vec<_>>()
+    };
+    for file in files {
+        file.sync()?;
+    }
+    Ok(())
+}
+
+/// Evicts up to `count` pages in least-recently-used order, returning the
+/// number of pages evicted.
+///
+/// If `blocking` is not set, pages of files that are in use are skipped, and
+/// so are the dirty pages if `dirty` is not set.
+fn evict(count: usize, blocking: bool, dirty: bool) -> usize {
+    let mut evicted = 0;
+    let mut skipped = Vec::new();
+    while evicted < count {
+        let Some((stamp, (file, index))) = LRU.lock().pop_first() else {
+            break;
+        };
+        let Some(file) = file.upgrade() else {
+            continue;
+        };
+        let mut inner: MutexGuard<CacheInner> = if blocking {
+            file.inner.lock()
+        } else {
+            match file.inner.try_lock() {
+                Some(inner) => inner,
+                None => {
+                    skipped.push((stamp, (Arc::downgrade(&file), index)));
+                    continue;
+                }
+            }
+        };
+        let Some(page) = inner.pages.get(&index) else {
+            continue;
+        };
+        // The page has been used again since it was popped from the list.
+        if page.stamp != stamp {
+            continue;
+        }
+        if page.dirty {
+            if !dirty {
+                skipped.push((stamp, (Arc::downgrade(&file), index)));
+                continue;
+            }
+            if let Err(e) = file.write_back(&mut inner, index) {
+                warn!("page cache: failed to write back {}: {:?}", file.path, e);
+                skipped.push((stamp, (Arc::downgrade(&file), index)));
+                continue;
+            }
+        }
+        inner.pages.remove(&index);
+        PAGES.fetch_sub(1, Ordering::Relaxed);
+        EVICTIONS.fetch_add(1, Ordering::Relaxed);
+        evicted += 1;
+
+        // Forget files that are neither cached nor open anymore.
+        let unused = inner.pages.is_empty();
+        drop(inner);
+        if unused && Arc::strong_count(&file) == 2 {
+            let mut files = FILES.lock();
+            if files
+                .get(&file.path)
+                .is_some_and(|f| Arc::ptr_eq(f, &file) && Arc::strong_count(&file) == 2)
+            {
+                files.remove(&file.path);
+            }
+        }
+    }
+    LRU.lock().extend(skipped);
+    evicted
+}
+
+/// Evicts pages until the cache fits in its capacity.
+fn shrink() {
+    let capacity = CAPACITY.load(Ordering::Relaxed);
+    let pages = PAGES.load(Ordering::Relaxed);
+    if pages > capacity {
+        evict(pages - capacity, true, true);
+    }
+}
+
+/// Frees up to `pages` clean pages of the cache, returning the number of
+/// pages freed.
+///
+/// This is the memory pressure hook of the global allocator, so it does not
+/// wait for locks or write pages back.
+pub fn reclaim(pages: usize) -> usize {
+    evict(pages, false, false)
+}
+
+/// Sets the maximum number of cached pages.
+pub fn set_capacity(pages: usize) {
+    CAPACITY.store(pages.max(1), Ordering::Relaxed);
+    shrink();
+}
+
+/// Writes all the dirty pages back to the filesystems.
+pub fn sync_all() -> VfsResult {
+    let files = FILES.lock().values().cloned().collect::<Vec<_>>();
+    for file in files {
+        file.sync()?;
+        // Nodes stay open in the dentry cache, so their metadata is flushed
+        // here rather than when they are closed. Not all filesystems
+        // implement it.
+        file.node.fsync().ok();
+    }
+    Ok(())
+}
+
+/// Returns the number of dirty pages and the capacity of the cache.
+pub(crate) fn dirty_pages() -> (usize, usize) {
+    (
+        DIRTY.load(Ordering::Relaxed),
+        CAPACITY.load(Ordering::Relaxed),
+    )
+}
+
+/// Returns the statistics of the page cache.
+pub fn stats() -> PageCacheStats {
+    PageCacheStats {
+        hits: HITS.load(Ordering::Relaxed),
+        misses: MISSES.load(Ordering::Relaxed),
+        evictions: EVICTIONS.load(Ordering::Relaxed),
+        writebacks: WRITEBACKS.load(Ordering::Relaxed),
+        readahead: READAHEAD.load(Ordering::Relaxed),
+        pages: PAGES.load(Ordering::Relaxed),
+        dirty: DIRTY.load(Ordering::Relaxed),
+    }
+}
@@ -0,0 +1,241 @@
+//! The filesystem mounted on `/proc`.
+//!
+//! Most of its entries are generated by the kernel from its state, through
+//! the [`ProcSource`] set by [`set_source`], each time they are looked up.
+//! The content of a generated file is only generated when it is first read
+//! from an opened file, and kept until the file is closed, so that reads at
+//! different offsets see the same snapshot and files that are not read cost
+//! nothing. The other entries, e.g. the tunables under `/proc/sys`, are kept
+//! in a [`RamFileSystem`] and can be written.
+
+use alloc::{format, string::String, sync::Arc, vec::Vec};
+use axfs_ramfs::RamFileSystem;
+use axfs_vfs::{VfsDirEntry, VfsError, VfsNodeAttr, VfsNodeOps, VfsNodePerm, VfsNodeRef};
+use axfs_vfs::{VfsNodeType, VfsOps, VfsResult};
+use axsync::Mutex;
+use spin::Once;
+
+/// The generator of the entries of `/proc` that reflect the state of the
+/// kernel.
+///
+/// Paths are relative to `/proc`, without leading or trailing slashes, e.g.
+/// `self/stat`, and the empty path is `/proc` itself.
+pub trait ProcSource: Send + Sync {
+    /// Returns the type of the generated entry at `path`, or `None` if there
+    /// is no such entry.
+    fn lookup(&self, path: &str) -> Option<VfsNodeType>;
+
+    /// Returns the names and types of the generated entries in the directory
+    /// at `path`.
+    fn read_dir(&self, path: &str) -> Vec<(String, VfsNodeType)>;
+
+    /// Generates the content of the file at `path`, or the target of the
+    /// symbolic link at `path`.
+    fn read(&self, path: &str) -> Option<Vec<u8>>;
+}
+
+static SOURCE: Once<&'static dyn ProcSource> = Once::new();
+
+/// Sets the generator of the entries of `/proc`. Only the first call has an
+/// effect.
+pub fn set_source(source: &'static dyn ProcSource) {
+    SOURCE.call_once(|| source);
+}
+
+fn source() -> Option<&'static dyn ProcSource> {
+    SOURCE.get().copied()
+}
+
+/// The filesystem mounted on `/proc`.
+pub struct ProcFileSystem {
+    /// The entries that are not generated.
+    ram: RamFileSystem,
+}
+
+impl ProcFileSystem {
+    /// Creates the filesystem, with the entries of `ram` besides the
+    /// generated ones.
+    pub(crate) fn new(ram: RamFileSystem) -> Self {
+        Self { ram }
+    }
+}
+
+impl VfsOps for ProcFileSystem {
+    fn mount(&self, path: &str, mount_point: VfsNodeRef) -> VfsResult {
+        self.ram.mount(path, mount_point)
+    }
+
+    fn root_dir(&self) -> VfsNodeRef {
+        Arc::new(ProcDir {
+            path: String::new(),
+            ram: Some(self.ram.root_dir()),
+        })
+    }
+}
+
+/// A generated directory, which may also have entries in the ramfs.
+struct ProcDir {
+    path: String,
+    /// The directory at the same path in the ramfs, if any.
+    ram: Option<VfsNodeRef>,
+}
+
+impl ProcDir {
+    fn child_path(&self, name: &str) -> String {
+        if self.path.is_empty() {
+            String::from(name)
+        } else {
+            format!("{}/{}", self.path, name)
+        }
+    }
+
+    fn ram_child(&self, name: &str) -> Option<VfsNodeRef> {
+        self.ram.clone()?.lookup(name).ok()
+    }
+
+    fn child(&self, name: &str) -> VfsResult<VfsNodeRef> {
+        let path = self.child_path(name);
+        match source().and_then(|source| source.lookup(&path)) {
+            Some(VfsNodeType::Dir) => Ok(Arc::new(ProcDir {
+                ram: self.ram_child(name),
+                path,
+            })),
+            Some(ty) => Ok(Arc::new(ProcFile {
+                path,
+                ty,
+                content: Mutex::new(None),
+            })),
+            None => self.ram_child(name).ok_or(VfsError::NotFound),
+        }
+    }
+
+    /// Returns the ramfs directory to modify at `path`, which must not be
+    /// under a generated entry.
+    fn ram_for(&self, path: &str) -> VfsResult<&VfsNodeRef> {
+        let name = path.split('/').next().unwrap_or_default();
+        let generated = source().and_then(|source| source.lookup(&self.child_path(name)));
+        match &self.ram {
+            Some(ram) if generated.is_none() => Ok(ram),
+            _ => Err(VfsError::PermissionDenied),
+        }
+    }
+}
+
+impl VfsNodeOps for ProcDir {
+    axfs_vfs::impl_vfs_dir_default! {}
+
+    fn get_attr(&self) -> VfsResult<VfsNodeAttr> {
+        Ok(VfsNodeAttr::new(
+            VfsNodePerm::from_bits_truncate(0o555),
+            VfsNodeType::Dir,
+            0,
+            0,
+        ))
+    }
+
+    fn lookup(self: Arc<Self>, path: &str) -> VfsResult<VfsNodeRef> {
+        let path = path.trim_matches('/');
+        if path.is_empty() || path == "." {
+            return Ok(self);
+        }
+        if let Some(rest) = path.strip_prefix("./") {
+            return self.lookup(rest);
+        }
+        match path.split_once('/') {
+            Some((name, rest)) => self.child(name)?.lookup(rest),
+            None => self.child(path),
+        }
+    }
+
+    fn create(&self, path: &str, ty: VfsNodeType) -> VfsResult {
+        let path = path.trim_matches('/');
+        self.ram_for(path)?.create(path, ty)
+    }
+
+    fn remove(&self, path: &str) -> VfsResult {
+        let path = path.trim_matches('/');
+        self.ram_for(path)?.remove(path)
+    }
+
+    fn read_dir(&self, start_idx: usize, dirents: &mut [VfsDirEntry]) -> VfsResult<usize> {
+        let mut entries = Vec::from([
+            (String::from("."), VfsNodeType::Dir),
+            (String::from(".."), VfsNodeType::Dir),
+        ]);
+        if let Some(source) = source() {
+            entries.extend(source.read_dir(&self.path));
+        }
+        if let Some(ram) = &self.ram {
+            const EMPTY: VfsDirEntry = VfsDirEntry::default();
+            let mut buf = [EMPTY; 16];
+            let mut idx = 0;
+            loop {
+                let n = ram.read_dir(idx, &mut buf)?;
+                if n == 0 {
+                    break;
+                }
+                idx += n;
+                for entry in &buf[..n] {
+                    let name = core::str::from_utf8(entry.name_as_bytes()).unwrap_or_default();
+                    if !entries.iter().any(|(other, _)| other == name) {
+                        entries.push((String::from(name), entry.entry_type()));
+                    }
+                }
+            }
+        }
+
+        let mut count = 0;
+        for (out, (name, ty)) in dirents.iter_mut().zip(entries.iter().skip(start_idx)) {
+            *out = VfsDirEntry::new(name, *ty);
+            count += 1;
+        }
+        Ok(count)
+    }
+}
+
+/// A generated file or symbolic link.
+struct ProcFile {
+    path: String,
+    ty: VfsNodeType,
+    /// The content, generated on the first read.
+    content: Mutex<Option<Vec<u8>>>,
+}
+
+impl VfsNodeOps for ProcFile {
+    axfs_vfs::impl_vfs_non_dir_default! {}
+
+    fn get_attr(&self) -> VfsResult<VfsNodeAttr> {
+        // The size is unknown until the content is generated, as in Linux.
+        let perm = match self.ty {
+            VfsNodeType::SymLink => 0o777,
+            _ => 0o444,
+        };
+        Ok(VfsNodeAttr::new(
+            VfsNodePerm::from_bits_truncate(perm),
+            self.ty,
+            0,
+            0,
+        ))
+    }
+
+    fn read_at(&self, offset: u64, buf: &mut [u8]) -> VfsResult<usize> {
+        let mut content = self.content.lock();
+        let content = content.get_or_insert_with(|| {
+            source()
+                .and_then(|source| source.read(&self.path))
+                .unwrap_or_default()
+        });
+        let start = (offset as usize).min(content.len());
+        let len = buf.len().min(content.len() - start);
+        buf[..len].copy_from_slice(&content[start..start + len]);
+        Ok(len)
+    }
+
+    fn write_at(&self, _offset: u64, _buf: &[u8]) -> VfsResult<usize> {
+        Err(VfsError::PermissionDenied)
+    }
+
+    fn truncate(&self, _size: u64) -> VfsResult {
+        Err(VfsError::PermissionDenied)
+    }
+}
@@ -0,0 +1,166 @@
+//! Readahead of sequentially read files into the page cache.
+//!
+//! Each opened file tracks where its last read ended. Reads that continue
+//! from there double the readahead window, up to a maximum that depends on
+//! the [`Advice`] given for the file, and the pages of the next window are
+//! prefetched in the background (synchronously without the `multitask`
+//! feature). Other reads reset the window.
+
+use alloc::sync::Arc;
+
+use crate::page_cache::{CachedFile, PAGE_SIZE};
+
+/// The initial readahead window, in pages.
+const MIN_WINDOW: u64 = 4;
+/// The maximum readahead window of files with the normal access pattern.
+const MAX_WINDOW: u64 = 32;
+/// The maximum readahead window of files advised as sequential.
+const MAX_SEQUENTIAL_WINDOW: u64 = 128;
+
+/// The expected access pattern of a file, as given by `posix_fadvise`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Advice {
+    /// No specific pattern, which enables the adaptive readahead.
+    Normal,
+    /// Random accesses, which disables the readahead.
+    Random,
+    /// Sequential accesses, which allows a larger readahead window.
+    Sequential,
+    /// The range will be accessed soon, and is prefetched.
+    WillNeed,
+    /// The range will not be accessed soon, and its clean pages are dropped.
+    DontNeed,
+    /// The range will be accessed only once.
+    NoReuse,
+}
+
+/// The readahead state of an opened file.
+pub(crate) struct ReadAhead {
+    /// The maximum window, or 0 if the readahead is disabled.
+    max_window: u64,
+    /// The current window, in pages.
+    window: u64,
+    /// The offset where the last read ended.
+    next_offset: u64,
+    /// The first page that has not been prefetched.
+    next_index: u64,
+}
+
+impl ReadAhead {
+    pub const fn new() -> Self {
+        Self {
+            max_window: MAX_WINDOW,
+            window: 0,
+            next_offset: 0,
+            next_index: 0,
+        }
+    }
+
+    /// Applies the access pattern `advice`, returning whether it affects the
+    /// whole file.
+    pub fn advise(&mut self, advice: Advice) -> bool {
+        self.max_window = match advice {
+            Advice::Normal => MAX_WINDOW,
+            Advice::Random => 0,
+            Advice::Sequential => MAX_SEQUENTIAL_WINDOW,
+            _ => return false,
+        };
+        self.window = self.window.min(self.max_window);
+        true
+    }
+
+    /// Records a read of `len` bytes at `offset` of a file of `size` bytes.
+    ///
+    /// Returns the first page and the number of pages to prefetch if the file
+    /// is read sequentially.
+    pub fn on_read(&mut self, size: u64, offset: u64, len: usize) -> Option<(u64, u64)> {
+        if self.max_window == 0 || len == 0 {
+            return None;
+        }
+        let end = offset + len as u64;
+        let end_index = end.div_ceil(PAGE_SIZE as u64);
+        let sequential = offset == self.next_offset;
+        self.next_offset = end;
+        if !sequential {
+            self.window = 0;
+            self.next_index = end_index;
+            return None;
+        }
+        self.window = match self.window {
+            0 => MIN_WINDOW.min(self.max_window),
+            window => (window * 2).min(self.max_window),
+        };
+
+        // Prefetch the next window once half of the current one is read, so
+        // that the pages are ready before they are needed.
+        let start = self.next_index.max(end_index);
+        if start - end_index > self.window / 2 {
+            return None;
+        }
+        let last = end_index + self.window;
+        self.next_index = last;
+        let count = last
+            .min(size.div_ceil(PAGE_SIZE as u64))
+            .saturating_sub(start);
+        (count > 0).then_some((start, count))
+    }
+}
+
+/// Prefetches `count` pages of `file` from the page `start`.
+pub(crate) fn prefetch(file: &Arc<CachedFile>, start: u64, count: u64) {
+    #[cfg(feature = "multitask")]
+    worker::submit(file, start, count);
+    #[cfg(not(feature = "multitask"))]
+    file.prefetch(start, count);
+}
+
+#[cfg(feature = "multitask")]
+mod worker {
+    use alloc::{
+        collections::VecDeque,
+        sync::{Arc, Weak},
+    };
+    use core::sync::atomic::{AtomicBool, Ordering};
+
+    use axsync::spin::SpinNoIrq;
+    use axtask::WaitQueue;
+
+    use crate::page_cache::CachedFile;
+
+    /// The maximum number of pending requests. The oldest ones are dropped
+    /// when readers submit faster than the device reads.
+    const MAX_PENDING: usize = 64;
+    const STACK_SIZE: usize = 0x10000;
+
+    static PENDING: SpinNoIrq<VecDeque<(Weak<CachedFile>, u64, u64)>> =
+        SpinNoIrq::new(VecDeque::new());
+    static WAIT_QUEUE: WaitQueue = WaitQueue::new();
+    static STARTED: AtomicBool = AtomicBool::new(false);
+
+    pub fn submit(file: &Arc<CachedFile>, start: u64, count: u64) {
+        {
+            let mut pending = PENDING.lock();
+            if pending.len() >= MAX_PENDING {
+                pending.pop_front();
+            }
+            pending.push_back((Arc::downgrade(file), start, count));
+        }
+        if !STARTED.swap(true, Ordering::AcqRel) {
+            axtask::spawn_raw(run, "readahead".into(), STACK_SIZE);
+        }
+        WAIT_QUEUE.notify_one(false);
+    }
+
+    fn run() {
+        loop {
+            WAIT_QUEUE.wait_until(|| !PENDING.lock().is_empty());
+            let Some((file, start, count)) = PENDING.lock().pop_front() else {
+                continue;
+            };
+            // The file may have been closed meanwhile.
+            if let Some(file) = file.upgrade() {
+                file.prefetch(start, count);
+            }
+        }
+    }
+}
@@ -12,18 +12,22 @@ use spin::RwLock;
 
 use crate::{
     api::FileType,
+    dcache,
+    fops::{DirEntry, FileInfo},
     fs::{self},
     mounts,
 };
 
 def_resource! {
-    pub static CURRENT_DIR_PATH: ResArc<Mutex<String>> = ResArc::new();
+    /// The absolute path of the current directory, which is shared by the
+    /// namespaces copied from one another until it is changed.
+    pub static CURRENT_DIR_PATH: ResArc<Mutex<Arc<str>>> = ResArc::new();
     pub static CURRENT_DIR: ResArc<Mutex<VfsNodeRef>> = ResArc::new();
 }
 
 impl CURRENT_DIR_PATH {
-    /// Return a copy of the inner path.
-    pub fn copy_inner(&self) -> Mutex<String> {
+    /// Return a copy of the inner path, which shares the string.
+    pub fn copy_inner(&self) -> Mutex<Arc<str>> {
         Mutex::new(self.lock().clone())
     }
 }
@@ -36,7 +40,7 @@ impl CURRENT_DIR {
 }
 
 struct MountPoint {
-    path: &'static str,
+    path: String,
     fs: Arc<dyn VfsOps>,
 }
 
@@ -48,8 +52,11 @@ struct RootDirectory {
 static ROOT_DIR: LazyInit<Arc<RootDirectory>> = LazyInit::new();
 
 impl MountPoint {
-    pub fn new(path: &'static str, fs: Arc<dyn VfsOps>) -> Self {
-        Self { path, fs }
+    pub fn new(path: &str, fs: Arc<dyn VfsOps>) -> Self {
+        Self {
+            path: String::from(path),
+            fs,
+        }
     }
 }
 
@@ -67,7 +74,7 @@ impl RootDirectory {
         }
     }
 
-    pub fn mount(&self, path: &'static str, fs: Arc<dyn VfsOps>) -> AxResult {
+    pub fn mount(&self, path: &str, fs: Arc<dyn VfsOps>) -> AxResult {
         if path == "/" {
             return ax_err!(InvalidInput, "cannot mount root filesystem");
         }
@@ -78,20 +85,55 @@ impl RootDirectory {
             return ax_err!(InvalidInput, "mount point already exists");
         }
         // create the mount point in the main filesystem if it does not exist
-        self.main_fs.root_dir().create(path, FileType::Dir)?;
+        match self.main_fs.root_dir().create(path, FileType::Dir) {
+            Ok(()) | Err(AxError::AlreadyExists) => {}
+            Err(e) => return Err(e),
+        }
         fs.mount(path, self.main_fs.root_dir().lookup(path)?)?;
         self.mounts.write().push(MountPoint::new(path, fs));
+        dcache::clear();
         Ok(())
     }
 
-    pub fn _umount(&self, path: &str) {
-        self.mounts.write().retain(|mp| mp.path != path);
+    pub fn umount(&self, path: &str) -> AxResult {
+        let mut mounts = self.mounts.write();
+        let len = mounts.len();
+        mounts.retain(|mp| mp.path != path);
+        if mounts.len() == len {
+            return ax_err!(InvalidInput, "not a mount point");
+        }
+        drop(mounts);
+        dcache::clear();
+        Ok(())
     }
 
     pub fn contains(&self, path: &str) -> bool {
         self.mounts.read().iter().any(|mp| mp.path == path)
     }
 
+    /// Returns whether the absolute `path` is in the main filesystem.
+    fn in_main_fs(&self, path: &str) -> bool {
+        !self.mounts.read().iter().any(|mp| {
+            path.strip_prefix(mp.path.as_str())
+                .is_some_and(|rest| rest.is_empty() || rest.starts_with('/'))
+        })
+    }
+
+    /// Returns the identifier of the filesystem of the absolute `path`: 1 for
+    /// the main filesystem, and then in mount order.
+    fn device_of(&self, path: &str) -> u64 {
+        let mounts = self.mounts.read();
+        let mount = mounts
+            .iter()
+            .enumerate()
+            .filter(|(_, mp)| {
+                path.strip_prefix(mp.path.as_str())
+                    .is_some_and(|rest| rest.is_empty() || rest.starts_with('/'))
+            })
+            .max_by_key(|(_, mp)| mp.path.len());
+        mount.map_or(1, |(i, _)| i as u64 + 2)
+    }
+
     fn lookup_mounted_fs<F, T>(&self, path: &str, f: F) -> AxResult<T>
     where
         F: FnOnce(Arc<dyn VfsOps>, &str) -> AxResult<T>,
@@ -165,6 +207,8 @@ impl VfsNodeOps for RootDirectory {
     }
 }
 
+/// Initializes the root directory with the filesystem on `disk` as `/`.
+#[cfg(not(feature = "initramfs"))]
 pub(crate) fn init_rootfs(disk: crate::dev::Disk) {
     cfg_if::cfg_if! {
         if #[cfg(feature = "myfs")] { // override the default filesystem
@@ -180,7 +224,19 @@ pub(crate) fn init_rootfs(disk: crate::dev::Disk) {
             let main_fs = FAT_FS.clone();
         }
     }
+    mount_rootfs(main_fs);
+}
 
+/// Initializes the root directory with a tmpfs as `/`, into which the
+/// initramfs is unpacked.
+#[cfg(feature = "initramfs")]
+pub(crate) fn init_rootfs_initramfs() {
+    let main_fs = mounts::tmpfs(None);
+    crate::initramfs::unpack(&main_fs.root_dir()).expect("failed to unpack the initramfs");
+    mount_rootfs(main_fs);
+}
+
+fn mount_rootfs(main_fs: Arc<dyn VfsOps>) {
     let root_dir = RootDirectory::new(main_fs);
 
     #[cfg(feature = "devfs")]
@@ -188,11 +244,22 @@ pub(crate) fn init_rootfs(disk: crate::dev::Disk) {
         .mount("/dev", mounts::devfs())
         .expect("failed to mount devfs at /dev");
 
-    #[cfg(feature = "ramfs")]
+    #[cfg(feature = "tmpfs")]
+    root_dir
+        .mount("/tmp", mounts::tmpfs(None))
+        .expect("failed to mount tmpfs at /tmp");
+
+    #[cfg(all(feature = "ramfs", not(feature = "tmpfs")))]
     root_dir
         .mount("/tmp", mounts::ramfs())
         .expect("failed to mount ramfs at /tmp");
 
+    // The POSIX shared memory objects of `shm_open`, which libc creates there.
+    #[cfg(feature = "tmpfs")]
+    if let Err(e) = root_dir.mount("/dev/shm", mounts::tmpfs(None)) {
+        warn!("failed to mount tmpfs at /dev/shm: {:?}", e);
+    }
+
     // Mount another ramfs as procfs
     #[cfg(feature = "procfs")]
     root_dir // should not fail
@@ -220,12 +287,57 @@ fn parent_node_of(dir: Option<&VfsNodeRef>, path: &str) -> VfsNodeRef {
     }
 }
 
+/// Returns the canonical absolute path of `path`, with the symbolic links in
+/// its directories followed.
 pub(crate) fn absolute_path(path: &str) -> AxResult<String> {
-    if path.starts_with('/') {
-        Ok(axfs_vfs::path::canonicalize(path))
+    follow_links(None, path, false)
+}
+
+/// Returns the canonical absolute path of `path`, with the symbolic links in
+/// all its components followed.
+pub(crate) fn real_path(path: &str) -> AxResult<String> {
+    follow_links(None, path, true)
+}
+
+/// Returns `path` relative to `dir` (or the current directory) with the
+/// symbolic links in its directories followed, and in its last component
+/// too if `follow_last`, as a canonical absolute path.
+///
+/// Paths relative to a directory node are returned as they are, as their
+/// absolute path is not known.
+fn follow_links(dir: Option<&VfsNodeRef>, path: &str, follow_last: bool) -> AxResult<String> {
+    let path = if path.starts_with('/') {
+        axfs_vfs::path::canonicalize(path)
+    } else if dir.is_some() {
+        return Ok(path.into());
     } else {
-        let path = CURRENT_DIR_PATH.lock().clone() + path;
-        Ok(axfs_vfs::path::canonicalize(&path))
+        let path = String::from(&**CURRENT_DIR_PATH.lock()) + path;
+        axfs_vfs::path::canonicalize(&path)
+    };
+    crate::symlink::resolve(&path, follow_last)
+}
+
+/// Returns the canonical absolute path of `path` relative to `dir` (or the
+/// current directory) if it is in the main filesystem, which is the key of
+/// the file in the page cache and in the dentry cache.
+///
+/// Paths relative to a directory node have no known absolute path.
+pub(crate) fn cache_path(dir: Option<&VfsNodeRef>, path: &str) -> Option<String> {
+    if dir.is_some() && !path.starts_with('/') {
+        return None;
+    }
+    let path = absolute_path(path).ok()?;
+    ROOT_DIR.in_main_fs(&path).then_some(path)
+}
+
+/// Invalidates the cached entries of `path` relative to `dir`, after it has
+/// been created, removed or renamed.
+fn invalidate(dir: Option<&VfsNodeRef>, path: &str) {
+    match cache_path(dir, path) {
+        Some(path) => dcache::invalidate(&path),
+        // The path may be cached under another name.
+        None if dir.is_some() && !path.starts_with('/') => dcache::clear(),
+        None => {}
     }
 }
 
@@ -233,7 +345,13 @@ pub(crate) fn lookup(dir: Option<&VfsNodeRef>, path: &str) -> AxResult<VfsNodeRe
     if path.is_empty() {
         return ax_err!(NotFound);
     }
-    let node = parent_node_of(dir, path).lookup(path)?;
+    let path = &follow_links(dir, path, true)?;
+    let node = match cache_path(dir, path) {
+        // Paths in the main filesystem do not cross mount points, and the
+        // root of the main filesystem is the node of `/`.
+        Some(abs_path) => dcache::lookup(ROOT_DIR.main_fs.root_dir(), &abs_path)?,
+        None => parent_node_of(dir, path).lookup(path)?,
+    };
     if path.ends_with('/') && !node.get_attr()?.is_dir() {
         ax_err!(NotADirectory)
     } else {
@@ -247,20 +365,34 @@ pub(crate) fn create_file(dir: Option<&VfsNodeRef>, path: &str) -> AxResult<VfsN
     } else if path.ends_with('/') {
         return ax_err!(NotADirectory);
     }
-    let parent = parent_node_of(dir, path);
-    parent.create(path, VfsNodeType::File)?;
-    parent.lookup(path)
+    // A dangling link is created as its target.
+    let path = &follow_links(dir, path, true)?;
+    parent_node_of(dir, path).create(path, VfsNodeType::File)?;
+    invalidate(dir, path);
+    lookup(dir, path)
 }
 
 pub(crate) fn create_dir(dir: Option<&VfsNodeRef>, path: &str) -> AxResult {
+    let path = &follow_links(dir, path, false)?;
+    if crate::symlink::target(path).is_some() {
+        return ax_err!(AlreadyExists);
+    }
     match lookup(dir, path) {
         Ok(_) => ax_err!(AlreadyExists),
-        Err(AxError::NotFound) => parent_node_of(dir, path).create(path, VfsNodeType::Dir),
+        Err(AxError::NotFound) => {
+            parent_node_of(dir, path).create(path, VfsNodeType::Dir)?;
+            invalidate(dir, path);
+            Ok(())
+        }
         Err(e) => Err(e),
     }
 }
 
 pub(crate) fn remove_file(dir: Option<&VfsNodeRef>, path: &str) -> AxResult {
+    let path = &follow_links(dir, path, false)?;
+    if crate::symlink::remove(path) {
+        return Ok(());
+    }
     let node = lookup(dir, path)?;
     let attr = node.get_attr()?;
     if attr.is_dir() {
@@ -268,7 +400,12 @@ pub(crate) fn remove_file(dir: Option<&VfsNodeRef>, path: &str) -> AxResult {
     } else if !attr.perm().owner_writable() {
         ax_err!(PermissionDenied)
     } else {
-        parent_node_of(dir, path).remove(path)
+        parent_node_of(dir, path).remove(path)?;
+        invalidate(dir, path);
+        if let Some(path) = cache_path(dir, path) {
+            crate::page_cache::discard(&path);
+        }
+        Ok(())
     }
 }
 
@@ -289,6 +426,10 @@ pub(crate) fn remove_dir(dir: Option<&VfsNodeRef>, path: &str) -> AxResult {
     if ROOT_DIR.contains(&absolute_path(path)?) {
         return ax_err!(PermissionDenied);
     }
+    let path = &follow_links(dir, path, false)?;
+    if crate::symlink::target(path).is_some() {
+        return ax_err!(NotADirectory);
+    }
 
     let node = lookup(dir, path)?;
     let attr = node.get_attr()?;
@@ -297,16 +438,196 @@ pub(crate) fn remove_dir(dir: Option<&VfsNodeRef>, path: &str) -> AxResult {
     } else if !attr.perm().owner_writable() {
         ax_err!(PermissionDenied)
     } else {
-        parent_node_of(dir, path).remove(path)
+        parent_node_of(dir, path).remove(path)?;
+        invalidate(dir, path);
+        Ok(())
+    }
+}
+
+/// Creates a hard link at `new` to the file at `old`, in the main filesystem
+/// if it supports them.
+pub(crate) fn hard_link(old: &str, new: &str) -> AxResult {
+    let (old, new) = (absolute_path(old)?, absolute_path(new)?);
+    if !ROOT_DIR.in_main_fs(&old) || !ROOT_DIR.in_main_fs(&new) {
+        return ax_err!(Unsupported, "hard links across filesystems");
+    }
+    if lookup(None, &old)?.get_attr()?.is_dir() {
+        return ax_err!(PermissionDenied, "hard links to directories");
+    }
+    if lookup(None, &new).is_ok() {
+        return ax_err!(AlreadyExists);
+    }
+    // Both paths share the inode, which the page cache does not know, so
+    // the file is written back and then accessed uncached.
+    crate::page_cache::forget(&old)?;
+    cfg_if::cfg_if! {
+        if #[cfg(all(feature = "lwext4_rs", not(feature = "myfs")))] {
+            fs::lwext4_rust::hard_link(&old, &new)?;
+        } else {
+            return ax_err!(Unsupported, "hard links in the main filesystem");
+        }
+    }
+    invalidate(None, &new);
+    Ok(())
+}
+
+/// Creates a symbolic link at `path` to `target`, which may not exist.
+pub(crate) fn symlink(target: &str, path: &str) -> AxResult {
+    let path = absolute_path(path)?;
+    if target.is_empty() {
+        return ax_err!(NotFound);
+    }
+    // The last component of `path` is not followed if it is not a link.
+    if crate::symlink::target(&path).is_some() || lookup(None, &path).is_ok() {
+        return ax_err!(AlreadyExists);
+    }
+    crate::symlink::create(path.trim_end_matches('/'), target)
+}
+
+/// Returns the target of the symbolic link at `path`.
+pub(crate) fn read_link(path: &str) -> AxResult<String> {
+    let path = absolute_path(path)?;
+    match crate::symlink::target(&path) {
+        Some(target) => Ok(target),
+        None => {
+            lookup(None, &path)?;
+            ax_err!(InvalidInput, "not a symbolic link")
+        }
+    }
+}
+
+/// Returns the number of hard links to the file at `path`.
+pub(crate) fn link_count(dir: Option<&VfsNodeRef>, path: &str) -> AxResult<u64> {
+    #[cfg(all(feature = "lwext4_rs", not(feature = "myfs")))]
+    if let Some(path) = cache_path(dir, path) {
+        return fs::lwext4_rust::link_count(&path);
+    }
+    lookup(dir, path).map(|_| 1)
+}
+
+/// Returns the inode number of the entry `name` of the directory at the
+/// canonical absolute path `dir`, for filesystems without inode numbers.
+///
+/// It is derived from the path of the entry, which keeps it distinct between
+/// files and stable as long as the path.
+fn path_inode(dir: &str, name: &str) -> u64 {
+    let dir = dir.trim_end_matches('/');
+    let (dir, name) = match name {
+        "." => (dir, ""),
+        ".." => (dir.rsplit_once('/').map_or("", |(parent, _)| parent), ""),
+        name => (dir, name),
+    };
+    // FNV-1a over the components, so that trailing slashes do not matter.
+    let mut hash = 0xcbf2_9ce4_8422_2325u64;
+    let components = dir.split('/').chain([name]);
+    for component in components.filter(|c| !c.is_empty()) {
+        for &byte in b"/".iter().chain(component.as_bytes()) {
+            hash = (hash ^ byte as u64).wrapping_mul(0x100_0000_01b3);
+        }
+    }
+    // Some programs skip the entries of inode 0.
+    hash.max(1)
+}
+
+/// Returns the attributes of the file at the canonical absolute `path` from
+/// its filesystem, ignoring the page cache.
+pub(crate) fn fs_file_info(path: &str) -> AxResult<FileInfo> {
+    let mut info = FileInfo {
+        ino: path_inode(path, ""),
+        dev: ROOT_DIR.device_of(path),
+        nlink: 1,
+        ..Default::default()
+    };
+    if ROOT_DIR.in_main_fs(path) {
+        cfg_if::cfg_if! {
+            if #[cfg(all(feature = "lwext4_rs", not(feature = "myfs")))] {
+                fs::lwext4_rust::file_info(path, &mut info)?;
+            } else if #[cfg(all(feature = "fatfs", not(feature = "myfs")))] {
+                // The times are in the entry of the parent directory.
+                if let Some((parent, name)) = path.rsplit_once('/') {
+                    let parent = lookup(None, if parent.is_empty() { "/" } else { parent })?;
+                    fs::fatfs::file_info(&parent, name, &mut info);
+                }
+            }
+        }
+    }
+    Ok(info)
+}
+
+/// Returns the attributes of the file at `path` that [`FileAttr`] does not
+/// carry.
+///
+/// [`FileAttr`]: crate::fops::FileAttr
+pub(crate) fn file_info(path: &str) -> AxResult<FileInfo> {
+    let path = real_path(path)?;
+    if let Some(info) = crate::page_cache::info(&path) {
+        return Ok(info);
     }
+    lookup(None, &path)?;
+    fs_file_info(&path)
+}
+
+/// Sets the modification time of the file at the canonical absolute `path`,
+/// if its filesystem records it.
+pub(crate) fn set_mtime(path: &str, mtime: core::time::Duration) -> AxResult {
+    cfg_if::cfg_if! {
+        if #[cfg(all(feature = "lwext4_rs", not(feature = "myfs")))] {
+            if ROOT_DIR.in_main_fs(path) {
+                fs::lwext4_rust::set_mtime(path, mtime)?;
+            }
+        } else {
+            let _ = (path, mtime);
+        }
+    }
+    Ok(())
+}
+
+/// Reads the entries of the directory `node` at the canonical absolute
+/// `path` from `start_idx`, with their inode numbers.
+pub(crate) fn read_dir_ino(
+    node: &VfsNodeRef,
+    path: &str,
+    start_idx: usize,
+    dirents: &mut [DirEntry],
+    inos: &mut [u64],
+) -> AxResult<usize> {
+    #[cfg(all(feature = "lwext4_rs", not(feature = "myfs")))]
+    if ROOT_DIR.in_main_fs(path) {
+        if let Some(dir) = node.as_any().downcast_ref::<fs::lwext4_rust::FileWrapper>() {
+            return dir.read_dir_ino(start_idx, dirents, inos);
+        }
+    }
+    let n = node.read_dir(start_idx, dirents)?;
+    for (ino, entry) in inos.iter_mut().zip(&dirents[..n]) {
+        let name = core::str::from_utf8(entry.name_as_bytes()).unwrap_or_default();
+        *ino = path_inode(path, name);
+    }
+    Ok(n)
+}
+
+/// Mounts a tmpfs whose files take up to `size` bytes (or half of the memory)
+/// at `path`, which must exist and not be a mount point yet.
+#[cfg(feature = "tmpfs")]
+pub(crate) fn mount_tmpfs(path: &str, size: Option<u64>) -> AxResult {
+    let path = real_path(path)?;
+    if !lookup(None, &path)?.get_attr()?.is_dir() {
+        return ax_err!(NotADirectory);
+    }
+    ROOT_DIR.mount(path.trim_end_matches('/'), mounts::tmpfs(size))
+}
+
+/// Unmounts the filesystem mounted at `path`.
+pub(crate) fn umount(path: &str) -> AxResult {
+    let path = real_path(path)?;
+    ROOT_DIR.umount(path.trim_end_matches('/'))
 }
 
 pub(crate) fn current_dir() -> AxResult<String> {
-    Ok(CURRENT_DIR_PATH.lock().clone())
+    Ok(String::from(&**CURRENT_DIR_PATH.lock()))
 }
 
 pub(crate) fn set_current_dir(path: &str) -> AxResult {
-    let mut abs_path = absolute_path(path)?;
+    let mut abs_path = real_path(path)?;
     if !abs_path.ends_with('/') {
         abs_path += "/";
     }
@@ -324,15 +645,38 @@ pub(crate) fn set_current_dir(path: &str) -> AxResult {
         ax_err!(PermissionDenied)
     } else {
         *CURRENT_DIR.lock() = node;
-        *CURRENT_DIR_PATH.lock() = abs_path;
+        *CURRENT_DIR_PATH.lock() = abs_path.into();
         Ok(())
     }
 }
 
 pub(crate) fn rename(old: &str, new: &str) -> AxResult {
+    let (old, new) = (&absolute_path(old)?, &absolute_path(new)?);
+    if crate::symlink::target(old).is_some() {
+        // The link replaces what is at `new`.
+        match remove_file(None, new) {
+            Ok(()) | Err(AxError::NotFound) => {}
+            Err(e) => return Err(e),
+        }
+        crate::symlink::rename(old, new);
+        return Ok(());
+    }
+    crate::symlink::remove(new);
     if parent_node_of(None, new).lookup(new).is_ok() {
         warn!("dst file already exist, now remove it");
         remove_file(None, new)?;
     }
-    parent_node_of(None, old).rename(old, new)
+    // The cached pages are written back under the old path.
+    if let Some(path) = cache_path(None, old) {
+        crate::page_cache::forget(&path)?;
+    }
+    if let Some(path) = cache_path(None, new) {
+        crate::page_cache::forget(&path)?;
+    }
+    parent_node_of(None, old).rename(old, new)?;
+    invalidate(None, old);
+    invalidate(None, new);
+    // The links in a directory move with it.
+    crate::symlink::rename(old, new);
+    Ok(())
 }
@@ -0,0 +1,168 @@
+//! Symbolic links.
+//!
+//! Links are kept in a table of the kernel, keyed by their canonical absolute
+//! paths, instead of in the filesystems, most of which (FAT, tmpfs) cannot
+//! store them. They are thus lost on reboot, and are not listed in their
+//! directories.
+//!
+//! Paths are resolved component by component against the table, and the
+//! results are cached until a link is created, removed or renamed, so that
+//! resolving a path already seen is a single map lookup.
+
+use alloc::{
+    collections::BTreeMap,
+    string::{String, ToString},
+    vec::Vec,
+};
+
+use axerrno::{AxResult, ax_err};
+use axsync::spin::SpinNoIrq;
+
+/// The maximum number of links followed to resolve a path, as on Linux.
+const MAX_FOLLOWED: usize = 40;
+/// The maximum number of resolved paths, above which the cache is emptied.
+const MAX_RESOLVED: usize = 1024;
+
+struct Symlinks {
+    /// The targets of the links, as they were given.
+    links: BTreeMap<String, String>,
+    /// The paths resolved, with all their components followed.
+    resolved: BTreeMap<String, String>,
+}
+
+static SYMLINKS: SpinNoIrq<Symlinks> = SpinNoIrq::new(Symlinks {
+    links: BTreeMap::new(),
+    resolved: BTreeMap::new(),
+});
+
+impl Symlinks {
+    /// Resolves the canonical absolute `path`, following the links in all
+    /// its components.
+    fn resolve(&mut self, path: &str) -> AxResult<String> {
+        if self.links.is_empty() {
+            return Ok(path.into());
+        }
+        if let Some(resolved) = self.resolved.get(path) {
+            return Ok(resolved.clone());
+        }
+
+        let mut resolved = String::from("/");
+        // The components left, in reverse order.
+        let mut left: Vec<String> = path.rsplit('/').map(ToString::to_string).collect();
+        let mut followed = 0;
+        while let Some(name) = left.pop() {
+            match name.as_str() {
+                "" | "." => continue,
+                ".." => {
+                    let parent = resolved.trim_end_matches('/').rfind('/').unwrap_or(0);
+                    resolved.truncate(parent + 1);
+                    continue;
+                }
+                _ => {}
+            }
+            let len = resolved.len();
+            if !resolved.ends_with('/') {
+                resolved.push('/');
+            }
+            resolved.push_str(&name);
+            let Some(target) = self.links.get(&resolved) else {
+                continue;
+            };
+            followed += 1;
+            if followed > MAX_FOLLOWED {
+                return ax_err!(NotFound, "too many levels of symbolic links");
+            }
+            resolved.truncate(len.max(1));
+            if target.starts_with('/') {
+                resolved.truncate(1);
+            }
+            left.extend(target.rsplit('/').map(ToString::to_string));
+        }
+        if resolved.len() > 1 && resolved.ends_with('/') {
+            resolved.pop();
+        }
+
+        if self.resolved.len() >= MAX_RESOLVED {
+            self.resolved.clear();
+        }
+        self.resolved.insert(path.into(), resolved.clone());
+        Ok(resolved)
+    }
+}
+
+/// Resolves the canonical absolute `path`, following the links in all its
+/// components, or in all but the last one if not `follow_last`.
+///
+/// The last component is always followed if the path ends with a slash,
+/// which is kept.
+pub(crate) fn resolve(path: &str, follow_last: bool) -> AxResult<String> {
+    let mut symlinks = SYMLINKS.lock();
+    let dir = path.len() > 1 && path.ends_with('/');
+    let mut resolved = if follow_last || dir || path == "/" {
+        symlinks.resolve(path)?
+    } else {
+        let (parent, name) = path.rsplit_once('/').unwrap_or(("", path));
+        let mut resolved = symlinks.resolve(if parent.is_empty() { "/" } else { parent })?;
+        if !resolved.ends_with('/') {
+            resolved.push('/');
+        }
+        resolved.push_str(name);
+        resolved
+    };
+    if dir && !resolved.ends_with('/') {
+        resolved.push('/');
+    }
+    Ok(resolved)
+}
+
+/// Creates a link at the canonical absolute `path` to `target`.
+pub(crate) fn create(path: &str, target: &str) -> AxResult {
+    let mut symlinks = SYMLINKS.lock();
+    if symlinks.links.contains_key(path) {
+        return ax_err!(AlreadyExists);
+    }
+    symlinks.links.insert(path.into(), target.into());
+    symlinks.resolved.clear();
+    Ok(())
+}
+
+/// Returns the target of the link at the canonical absolute `path`.
+pub(crate) fn target(path: &str) -> Option<String> {
+    SYMLINKS.lock().links.get(path).cloned()
+}
+
+/// Removes the link at the canonical absolute `path`, and returns whether
+/// there was one.
+pub(crate) fn remove(path: &str) -> bool {
+    let mut symlinks = SYMLINKS.lock();
+    let removed = symlinks.links.remove(path).is_some();
+    if removed {
+        symlinks.resolved.clear();
+    }
+    removed
+}
+
+/// Moves the link at the canonical absolute path `old`, or the links under
+/// it if it is a directory, to `new`.
+pub(crate) fn rename(old: &str, new: &str) {
+    let mut symlinks = SYMLINKS.lock();
+    let moved: Vec<String> = symlinks
+        .links
+        .keys()
+        .filter(|path| {
+            path.strip_prefix(old)
+                .is_some_and(|rest| rest.is_empty() || rest.starts_with('/'))
+        })
+        .cloned()
+        .collect();
+    if moved.is_empty() {
+        return;
+    }
+    for path in moved {
+        let target = symlinks.links.remove(&path).unwrap();
+        symlinks
+            .links
+            .insert(alloc::format!("{}{}", new, &path[old.len()..]), target);
+    }
+    symlinks.resolved.clear();
+}
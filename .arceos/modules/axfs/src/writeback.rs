@@ -0,0 +1,82 @@
+//! Writeback of the dirty pages of the page cache.
+//!
+//! Once the dirty pages exceed a tenth of the cache, a background flusher
+//! writes all of them back, so that writers rarely wait for the device. The
+//! flusher also runs periodically, which bounds how long written data stays
+//! only in memory. Writers that dirty pages faster than the flusher writes
+//! them are throttled past a quarter of the cache, by writing back their own
+//! file.
+//!
+//! Without the `multitask` feature there is no flusher, and writers write
+//! back their file once past the background threshold.
+
+use crate::page_cache::{self, CachedFile};
+
+/// Returns the number of dirty pages above which they are written back in
+/// the background, and the one above which writers are throttled.
+fn thresholds(capacity: usize) -> (usize, usize) {
+    ((capacity / 10).max(1), (capacity / 4).max(1))
+}
+
+/// Starts the writeback of dirty pages if there are too many, after `file`
+/// has been written.
+pub(crate) fn balance_dirty(file: &CachedFile) {
+    let (dirty, capacity) = page_cache::dirty_pages();
+    let (background, limit) = thresholds(capacity);
+    #[cfg(feature = "multitask")]
+    flusher::wake(dirty > background);
+    let limit = if cfg!(feature = "multitask") {
+        limit
+    } else {
+        background
+    };
+    if dirty > limit {
+        if let Err(e) = file.sync() {
+            warn!("page cache: failed to write back dirty pages: {:?}", e);
+        }
+    }
+}
+
+#[cfg(feature = "multitask")]
+mod flusher {
+    use core::{
+        sync::atomic::{AtomicBool, Ordering},
+        time::Duration,
+    };
+
+    use axtask::WaitQueue;
+
+    use crate::page_cache;
+
+    /// The interval of the periodic writeback.
+    const INTERVAL: Duration = Duration::from_secs(5);
+    const STACK_SIZE: usize = 0x10000;
+
+    static WAIT_QUEUE: WaitQueue = WaitQueue::new();
+    static STARTED: AtomicBool = AtomicBool::new(false);
+    static PENDING: AtomicBool = AtomicBool::new(false);
+
+    /// Starts the flusher if it is not running yet, and makes it write back
+    /// the dirty pages now if `now` is set.
+    pub fn wake(now: bool) {
+        if !STARTED.load(Ordering::Relaxed) && !STARTED.swap(true, Ordering::AcqRel) {
+            axtask::spawn_raw(run, "flusher".into(), STACK_SIZE);
+        }
+        if now && !PENDING.swap(true, Ordering::AcqRel) {
+            WAIT_QUEUE.notify_one(false);
+        }
+    }
+
+    fn run() {
+        loop {
+            WAIT_QUEUE.wait_timeout_until(INTERVAL, || PENDING.load(Ordering::Acquire));
+            PENDING.store(false, Ordering::Release);
+            if page_cache::dirty_pages().0 == 0 {
+                continue;
+            }
+            if let Err(e) = page_cache::sync_all() {
+                warn!("page cache: background writeback failed: {:?}", e);
+            }
+        }
+    }
+}
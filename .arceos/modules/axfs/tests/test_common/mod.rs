@@ -250,6 +250,218 @@ fn test_devfs_ramfs() -> Result<()> {
     Ok(())
 }
 
+fn test_page_cache() -> Result<()> {
+    let fname = "/page_cache.txt";
+    println!("test page cache with {:?}:", fname);
+
+    let data = (0..3 * 4096 + 100)
+        .map(|i| (i % 251) as u8)
+        .collect::<Vec<_>>();
+    fs::write(fname, &data)?;
+    assert_eq!(fs::metadata(fname)?.len(), data.len() as u64);
+
+    // the pages written are read from the cache
+    let hits = axfs::page_cache::stats().hits;
+    assert_eq!(fs::read(fname)?, data);
+    assert!(axfs::page_cache::stats().hits > hits);
+
+    // overwrite across a page boundary, then shrink and grow again
+    let mut file = File::options().read(true).write(true).open(fname)?;
+    file.seek(io::SeekFrom::Start(4090))?;
+    assert_eq!(file.write(b"boundary")?, 8);
+    file.set_len(4095)?;
+    file.set_len(4100)?;
+    drop(file);
+    let contents = fs::read(fname)?;
+    assert_eq!(contents.len(), 4100);
+    assert_eq!(&contents[..4090], &data[..4090]);
+    assert_eq!(&contents[4090..4095], b"bound");
+    assert!(contents[4095..].iter().all(|&b| b == 0));
+
+    // written back under the new name
+    axfs::page_cache::sync_all()?;
+    assert_eq!(axfs::page_cache::stats().dirty, 0);
+    fs::rename(fname, "/page_cache2.txt")?;
+    assert_eq!(fs::read("/page_cache2.txt")?, contents);
+    fs::remove_file("/page_cache2.txt")?;
+    assert_err!(fs::metadata("/page_cache2.txt"), NotFound);
+
+    println!("test_page_cache() OK!");
+    Ok(())
+}
+
+fn test_readahead() -> Result<()> {
+    use axfs::fops::{Advice, File, OpenOptions};
+
+    let fname = "/readahead.txt";
+    println!("test readahead with {:?}:", fname);
+
+    let data = (0..64 * 4096).map(|i| (i % 249) as u8).collect::<Vec<_>>();
+    fs::write(fname, &data)?;
+    axfs::page_cache::sync_all()?;
+
+    let mut file = File::open(fname, &OpenOptions::new().set_read(true))?;
+    file.advise(0, 0, Advice::DontNeed)?;
+    let readahead = axfs::page_cache::stats().readahead;
+    let mut contents = Vec::new();
+    let mut buf = [0; 1000];
+    loop {
+        match file.read(&mut buf)? {
+            0 => break,
+            n => contents.extend_from_slice(&buf[..n]),
+        }
+    }
+    assert_eq!(contents, data);
+    assert!(axfs::page_cache::stats().readahead > readahead);
+
+    // no readahead for random accesses
+    file.advise(0, 0, Advice::DontNeed)?;
+    file.advise(0, 0, Advice::Random)?;
+    let readahead = axfs::page_cache::stats().readahead;
+    assert_eq!(file.read_at(8 * 4096, &mut buf)?, buf.len());
+    assert_eq!(&buf[..], &data[8 * 4096..8 * 4096 + buf.len()]);
+    assert_eq!(axfs::page_cache::stats().readahead, readahead);
+    drop(file);
+    fs::remove_file(fname)?;
+
+    println!("test_readahead() OK!");
+    Ok(())
+}
+
+fn test_writeback() -> Result<()> {
+    use axfs::fops::{File, OpenOptions};
+
+    let fname = "/writeback.txt";
+    println!("test writeback with {:?}:", fname);
+
+    let opts = OpenOptions::new().set_create(true, false).set_write(true);
+    let mut file = File::open(fname, &opts)?;
+    let data = [0x5a; 3 * 4096];
+    assert_eq!(file.write(&data)?, data.len());
+    let dirty = axfs::page_cache::stats().dirty;
+    assert!(dirty >= 3);
+
+    // only the first page is written back
+    file.sync_range(0, 4096)?;
+    assert_eq!(axfs::page_cache::stats().dirty, dirty - 1);
+    file.sync()?;
+    assert_eq!(axfs::page_cache::stats().dirty, dirty - 3);
+    drop(file);
+    assert_eq!(fs::read(fname)?, data);
+    fs::remove_file(fname)?;
+
+    println!("test_writeback() OK!");
+    Ok(())
+}
+
+fn test_direct_io() -> Result<()> {
+    use axfs::fops::{DIRECT_IO_ALIGN, File, OpenOptions};
+
+    #[repr(align(512))]
+    struct Aligned([u8; 2 * DIRECT_IO_ALIGN]);
+
+    let fname = "/direct.txt";
+    println!("test direct I/O with {:?}:", fname);
+
+    // cached writes are visible to direct reads
+    fs::write(fname, [1; 2 * DIRECT_IO_ALIGN])?;
+    let mut opts = OpenOptions::new().set_read(true).set_write(true);
+    opts.direct(true);
+    let file = File::open(fname, &opts)?;
+    let mut buf = Aligned([0; 2 * DIRECT_IO_ALIGN]);
+    assert_eq!(file.read_at(0, &mut buf.0)?, buf.0.len());
+    assert!(buf.0.iter().all(|&b| b == 1));
+
+    // direct writes are visible to cached reads
+    buf.0.fill(2);
+    assert_eq!(file.write_at(DIRECT_IO_ALIGN as u64, &buf.0)?, buf.0.len());
+    let contents = fs::read(fname)?;
+    assert_eq!(contents.len(), 3 * DIRECT_IO_ALIGN);
+    assert!(contents[..DIRECT_IO_ALIGN].iter().all(|&b| b == 1));
+    assert!(contents[DIRECT_IO_ALIGN..].iter().all(|&b| b == 2));
+
+    assert_err!(file.write_at(1, &buf.0), InvalidInput);
+    assert_err!(file.read_at(0, &mut buf.0[1..]), InvalidInput);
+    drop(file);
+    fs::remove_file(fname)?;
+
+    println!("test_direct_io() OK!");
+    Ok(())
+}
+
+fn test_dentry_cache() -> Result<()> {
+    let dname = "/dcache";
+    let fname = "/dcache/file.txt";
+    println!("test dentry cache with {:?}:", fname);
+
+    // a missing entry is found once created
+    assert_err!(fs::metadata(dname), NotFound);
+    fs::create_dir(dname)?;
+    assert_err!(fs::metadata(fname), NotFound);
+    fs::write(fname, "dentry")?;
+    assert_eq!(fs::read_to_string(fname)?, "dentry");
+
+    // the entries under a renamed directory follow it
+    fs::rename(dname, "/dcache2")?;
+    assert_err!(fs::metadata(fname), NotFound);
+    assert_eq!(fs::read_to_string("/dcache2/file.txt")?, "dentry");
+
+    // and removed entries are not found anymore
+    fs::remove_file("/dcache2/file.txt")?;
+    assert_err!(fs::metadata("/dcache2/file.txt"), NotFound);
+    fs::remove_dir("/dcache2")?;
+    assert_err!(fs::metadata("/dcache2"), NotFound);
+
+    println!("test_dentry_cache() OK!");
+    Ok(())
+}
+
+fn test_symlink() -> Result<()> {
+    let dname = "/symlink";
+    let fname = "/symlink/file.txt";
+    println!("test symbolic links to {:?}:", fname);
+
+    fs::create_dir(dname)?;
+    fs::write(fname, "target")?;
+
+    // links to files and directories are followed, relative to their parent
+    fs::symlink("file.txt", "/symlink/link")?;
+    fs::symlink(dname, "/dirlink")?;
+    assert_eq!(fs::read_link("/symlink/link")?, "file.txt");
+    assert_eq!(fs::read_to_string("/symlink/link")?, "target");
+    assert_eq!(fs::read_to_string("/dirlink/link")?, "target");
+    assert_eq!(fs::real_path("/dirlink/link")?, fname);
+    assert_eq!(fs::canonicalize("/dirlink/link")?, "/symlink/link");
+    assert_err!(fs::read_link(fname), InvalidInput);
+    assert_err!(fs::symlink(fname, "/symlink/link"), AlreadyExists);
+
+    // writes through a link reach the target
+    fs::write("/dirlink/link", "written")?;
+    assert_eq!(fs::read_to_string(fname)?, "written");
+
+    // dangling links are not found, and removing a link keeps its target
+    fs::symlink("/missing", "/dangling")?;
+    assert_err!(fs::metadata("/dangling"), NotFound);
+    fs::remove_file("/dangling")?;
+    fs::remove_file("/symlink/link")?;
+    assert_err!(fs::read_link("/symlink/link"), NotFound);
+    assert_eq!(fs::read_to_string(fname)?, "written");
+
+    // links loop until the resolution gives up
+    fs::symlink("/loop2", "/loop1")?;
+    fs::symlink("/loop1", "/loop2")?;
+    assert_err!(fs::metadata("/loop1"));
+    fs::remove_file("/loop1")?;
+    fs::remove_file("/loop2")?;
+
+    fs::remove_file("/dirlink")?;
+    fs::remove_file(fname)?;
+    fs::remove_dir(dname)?;
+
+    println!("test_symlink() OK!");
+    Ok(())
+}
+
 pub fn test_all() {
     test_read_write_file().expect("test_read_write_file() failed");
     test_read_dir().expect("test_read_dir() failed");
@@ -257,4 +469,10 @@ pub fn test_all() {
     test_create_file_dir().expect("test_create_file_dir() failed");
     test_remove_file_dir().expect("test_remove_file_dir() failed");
     test_devfs_ramfs().expect("test_devfs_ramfs() failed");
+    test_page_cache().expect("test_page_cache() failed");
+    test_readahead().expect("test_readahead() failed");
+    test_writeback().expect("test_writeback() failed");
+    test_direct_io().expect("test_direct_io() failed");
+    test_dentry_cache().expect("test_dentry_cache() failed");
+    test_symlink().expect("test_symlink() failed");
 }
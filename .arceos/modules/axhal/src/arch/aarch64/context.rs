@@ -98,6 +98,11 @@ impl TrapFrame {
         self.usp = sp as _;
     }
 
+    /// Gets the frame pointer.
+    pub const fn fp(&self) -> usize {
+        self.r[29] as _
+    }
+
     /// Gets the return value register.
     pub const fn retval(&self) -> usize {
         self.r[0] as _
@@ -334,6 +339,7 @@ impl TaskContext {
         #[cfg(feature = "uspace")]
         {
             if self.ttbr0_el1 != next_ctx.ttbr0_el1 {
+                crate::paging::set_user_root(next_ctx.ttbr0_el1);
                 unsafe { super::write_page_table_root0(next_ctx.ttbr0_el1) };
             }
         }
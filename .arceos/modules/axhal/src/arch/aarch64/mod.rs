@@ -1,4 +1,5 @@
 mod context;
+pub(crate) mod pmu;
 
 #[cfg(target_os = "none")]
 mod trap;
@@ -0,0 +1,83 @@
+//! PMUv3 event counters.
+//!
+//! The event counters are 32 bits wide before PMUv3p5, so one may wrap
+//! around if a task runs for seconds without being switched out.
+
+use core::arch::asm;
+
+use crate::pmu::{PmuConfig, PmuEvent};
+
+/// PMCR_EL0.E, enabling all the counters.
+const PMCR_E: u64 = 1 << 0;
+/// PMEVTYPER<n>_EL0.P and .U, not counting at EL1 and at EL0.
+const PMEVTYPER_P: u64 = 1 << 31;
+const PMEVTYPER_U: u64 = 1 << 30;
+
+pub fn num_counters() -> usize {
+    let dfr0: u64;
+    unsafe { asm!("mrs {}, id_aa64dfr0_el1", out(reg) dfr0) };
+    // ID_AA64DFR0_EL1.PMUVer: not implemented, or not PMUv3.
+    let version = (dfr0 >> 8) & 0xf;
+    if version == 0 || version == 0xf {
+        return 0;
+    }
+    let pmcr: u64;
+    unsafe { asm!("mrs {}, pmcr_el0", out(reg) pmcr) };
+    ((pmcr >> 11) & 0x1f) as usize
+}
+
+/// Returns the number of the common architectural event.
+const fn event_number(event: PmuEvent) -> u64 {
+    match event {
+        PmuEvent::Cycles => 0x11,             // CPU_CYCLES
+        PmuEvent::Instructions => 0x08,       // INST_RETIRED
+        PmuEvent::CacheReferences => 0x04,    // L1D_CACHE
+        PmuEvent::CacheMisses => 0x03,        // L1D_CACHE_REFILL
+        PmuEvent::BranchInstructions => 0x21, // BR_RETIRED
+        PmuEvent::BranchMisses => 0x10,       // BR_MIS_PRED
+    }
+}
+
+/// Selects the event counter `idx` for `PMXEVTYPER_EL0` and `PMXEVCNTR_EL0`.
+fn select(idx: usize) {
+    unsafe { asm!("msr pmselr_el0, {}", "isb", in(reg) idx) };
+}
+
+pub fn start(idx: usize, config: &PmuConfig) -> bool {
+    let mut evtype = event_number(config.event);
+    if config.exclude_user {
+        evtype |= PMEVTYPER_U;
+    }
+    if config.exclude_kernel {
+        evtype |= PMEVTYPER_P;
+    }
+    select(idx);
+    unsafe {
+        asm!(
+            "msr pmxevtyper_el0, {evtype}",
+            "msr pmxevcntr_el0, xzr",
+            "msr pmcntenset_el0, {mask}",
+            "mrs {pmcr}, pmcr_el0",
+            "orr {pmcr}, {pmcr}, {e}",
+            "msr pmcr_el0, {pmcr}",
+            "isb",
+            evtype = in(reg) evtype,
+            mask = in(reg) 1u64 << idx,
+            pmcr = out(reg) _,
+            e = const PMCR_E,
+        )
+    };
+    true
+}
+
+pub fn read(idx: usize) -> u64 {
+    let value: u64;
+    select(idx);
+    unsafe { asm!("mrs {}, pmxevcntr_el0", out(reg) value) };
+    value
+}
+
+pub fn stop(idx: usize) -> u64 {
+    unsafe { asm!("msr pmcntenclr_el0, {}", "isb", in(reg) 1u64 << idx) };
+    read(idx)
+}
@@ -47,7 +47,7 @@ fn invalid_exception(tf: &TrapFrame, kind: TrapKind, source: TrapSource) {
 
 #[unsafe(no_mangle)]
 fn handle_irq_exception(tf: &mut TrapFrame, source: TrapSource) {
-    handle_trap!(IRQ, 0);
+    crate::trap::handle_irq(0, tf, source.is_from_user());
     crate::trap::post_trap_callback(tf, source.is_from_user());
 }
 
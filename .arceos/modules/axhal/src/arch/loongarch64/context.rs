@@ -133,6 +133,11 @@ impl TrapFrame {
         self.regs.sp = sp;
     }
 
+    /// Gets the frame pointer.
+    pub const fn fp(&self) -> usize {
+        self.regs.fp
+    }
+
     /// Gets the return value register.
     pub const fn retval(&self) -> usize {
         self.regs.a0
@@ -309,6 +314,7 @@ impl TaskContext {
         #[cfg(feature = "uspace")]
         {
             if self.pgdl != next_ctx.pgdl {
+                crate::paging::set_user_root(pa!(next_ctx.pgdl));
                 unsafe { super::write_page_table_root0(pa!(next_ctx.pgdl)) };
             }
         }
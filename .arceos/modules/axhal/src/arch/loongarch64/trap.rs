@@ -58,7 +58,7 @@ fn loongarch64_trap_handler(tf: &mut TrapFrame, from_user: bool) {
         Trap::Exception(Exception::Breakpoint) => handle_breakpoint(&mut tf.era),
         Trap::Interrupt(_) => {
             let irq_num: usize = estat.is().trailing_zeros() as usize;
-            handle_trap!(IRQ, irq_num);
+            crate::trap::handle_irq(irq_num, tf, from_user);
         }
         _ => {
             panic!(
@@ -156,6 +156,11 @@ impl TrapFrame {
         self.regs.sp = sp;
     }
 
+    /// Gets the frame pointer.
+    pub const fn fp(&self) -> usize {
+        self.regs.s0
+    }
+
     /// Gets the return value register.
     pub const fn retval(&self) -> usize {
         self.regs.a0
@@ -379,6 +384,7 @@ impl TaskContext {
         #[cfg(feature = "uspace")]
         unsafe {
             if self.satp != next_ctx.satp {
+                crate::paging::set_user_root(next_ctx.satp);
                 super::write_page_table_root(next_ctx.satp);
             }
         }
@@ -2,6 +2,7 @@
 mod macros;
 
 mod context;
+pub(crate) mod pmu;
 mod trap;
 
 use memory_addr::{PhysAddr, VirtAddr};
@@ -0,0 +1,129 @@
+//! Performance counters through the SBI PMU extension.
+//!
+//! The firmware picks a hardware counter that can count the event, so the
+//! counters of the current task are mapped to the ones the firmware picked
+//! on the current CPU.
+
+use core::arch::asm;
+
+use crate::pmu::{MAX_COUNTERS, PmuConfig, PmuEvent};
+
+const EID_PMU: usize = 0x504d55;
+const FID_NUM_COUNTERS: usize = 0;
+const FID_COUNTER_GET_INFO: usize = 1;
+const FID_COUNTER_CONFIG_MATCHING: usize = 2;
+const FID_COUNTER_STOP: usize = 4;
+const FID_COUNTER_FW_READ: usize = 5;
+
+const CFG_FLAG_CLEAR_VALUE: usize = 1 << 1;
+const CFG_FLAG_AUTO_START: usize = 1 << 2;
+const CFG_FLAG_SET_UINH: usize = 1 << 5;
+const CFG_FLAG_SET_SINH: usize = 1 << 6;
+const CFG_FLAG_SET_MINH: usize = 1 << 7;
+/// Releases the counter when stopping it.
+const STOP_FLAG_RESET: usize = 1 << 0;
+
+/// The firmware counter used for each counter of the current task.
+#[percpu::def_percpu]
+static COUNTER_IDX: [usize; MAX_COUNTERS] = [0; MAX_COUNTERS];
+
+fn sbi_pmu_call(fid: usize, args: [usize; 5]) -> Result<usize, isize> {
+    let (error, value): (isize, usize);
+    unsafe {
+        asm!(
+            "ecall",
+            inlateout("a0") args[0] => error,
+            inlateout("a1") args[1] => value,
+            in("a2") args[2],
+            in("a3") args[3],
+            in("a4") args[4],
+            in("a6") fid,
+            in("a7") EID_PMU,
+        )
+    };
+    if error == 0 { Ok(value) } else { Err(error) }
+}
+
+pub fn num_counters() -> usize {
+    // Fails if the firmware has no PMU extension.
+    sbi_pmu_call(FID_NUM_COUNTERS, [0; 5]).unwrap_or(0)
+}
+
+/// Returns the code of the SBI hardware general event.
+const fn event_idx(event: PmuEvent) -> usize {
+    match event {
+        PmuEvent::Cycles => 1,
+        PmuEvent::Instructions => 2,
+        PmuEvent::CacheReferences => 3,
+        PmuEvent::CacheMisses => 4,
+        PmuEvent::BranchInstructions => 5,
+        PmuEvent::BranchMisses => 6,
+    }
+}
+
+pub fn start(idx: usize, config: &PmuConfig) -> bool {
+    let num = num_counters();
+    let mut flags = CFG_FLAG_CLEAR_VALUE | CFG_FLAG_AUTO_START | CFG_FLAG_SET_MINH;
+    if config.exclude_user {
+        flags |= CFG_FLAG_SET_UINH;
+    }
+    if config.exclude_kernel {
+        flags |= CFG_FLAG_SET_SINH;
+    }
+    let mask = if num >= usize::BITS as usize {
+        usize::MAX
+    } else {
+        (1 << num) - 1
+    };
+    let args = [0, mask, flags, event_idx(config.event), 0];
+    match sbi_pmu_call(FID_COUNTER_CONFIG_MATCHING, args) {
+        Ok(counter) => {
+            unsafe { COUNTER_IDX.current_ref_mut_raw()[idx] = counter };
+            true
+        }
+        Err(_) => false,
+    }
+}
+
+/// Reads the hardware performance-monitoring counter CSR `csr`, one of
+/// `cycle`, `time`, `instret` and `hpmcounter3`..`hpmcounter31`.
+fn read_counter_csr(csr: usize) -> u64 {
+    macro_rules! read_csr {
+        ($($n:literal)*) => {
+            match csr {
+                $($n => {
+                    let value: u64;
+                    unsafe { asm!(concat!("csrr {}, ", $n), out(reg) value) };
+                    value
+                })*
+                _ => 0,
+            }
+        };
+    }
+    read_csr!(
+        0xc00 0xc01 0xc02 0xc03 0xc04 0xc05 0xc06 0xc07
+        0xc08 0xc09 0xc0a 0xc0b 0xc0c 0xc0d 0xc0e 0xc0f
+        0xc10 0xc11 0xc12 0xc13 0xc14 0xc15 0xc16 0xc17
+        0xc18 0xc19 0xc1a 0xc1b 0xc1c 0xc1d 0xc1e 0xc1f
+    )
+}
+
+pub fn read(idx: usize) -> u64 {
+    let counter = unsafe { COUNTER_IDX.current_ref_raw()[idx] };
+    let Ok(info) = sbi_pmu_call(FID_COUNTER_GET_INFO, [counter, 0, 0, 0, 0]) else {
+        return 0;
+    };
+    // Firmware counters are read through SBI, hardware ones from their CSR.
+    if info >> (usize::BITS - 1) != 0 {
+        sbi_pmu_call(FID_COUNTER_FW_READ, [counter, 0, 0, 0, 0]).unwrap_or(0) as u64
+    } else {
+        read_counter_csr(info & 0xfff)
+    }
+}
+
+pub fn stop(idx: usize) -> u64 {
+    let counter = unsafe { COUNTER_IDX.current_ref_raw()[idx] };
+    let value = read(idx);
+    let _ = sbi_pmu_call(FID_COUNTER_STOP, [counter, 1, STOP_FLAG_RESET, 0, 0]);
+    value
+}
@@ -54,7 +54,7 @@ fn riscv_trap_handler(tf: &mut TrapFrame, from_user: bool) {
             }
             Trap::Exception(E::Breakpoint) => handle_breakpoint(&mut tf.sepc),
             Trap::Interrupt(_) => {
-                handle_trap!(IRQ, scause.bits());
+                crate::trap::handle_irq(scause.bits(), tf, from_user);
             }
             _ => {
                 panic!("Unhandled trap {:?} @ {:#x}:\n{:#x?}", cause, tf.sepc, tf);
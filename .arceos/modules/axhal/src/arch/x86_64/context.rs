@@ -123,6 +123,11 @@ impl TrapFrame {
         self.rsp = rsp as _;
     }
 
+    /// Gets the frame pointer.
+    pub const fn fp(&self) -> usize {
+        self.rbp as _
+    }
+
     /// Gets the return value register.
     pub const fn retval(&self) -> usize {
         self.rax as _
@@ -293,8 +298,23 @@ static_assertions::const_assert_eq!(core::mem::size_of::<FxsaveArea>(), 512);
 pub struct ExtendedState {
     /// Memory region for the FXSAVE/FXRSTOR instruction.
     pub fxsave_area: FxsaveArea,
+    /// The number of consecutive times the task used the FP/SIMD registers
+    /// before being switched out.
+    #[cfg(feature = "fp_simd")]
+    uses: u8,
 }
 
+/// The number of consecutive switches with FP/SIMD use after which a task's
+/// state is restored on switch-in, instead of on its first use.
+#[cfg(feature = "fp_simd")]
+const EAGER_FPU_THRESHOLD: u8 = 5;
+
+/// The extended state of the task running on the CPU, restored by
+/// [`handle_fpu_trap`] when the task first uses the FP/SIMD registers.
+#[cfg(feature = "fp_simd")]
+#[percpu::def_percpu]
+static CURRENT_EXT_STATE: usize = 0;
+
 #[cfg(feature = "fp_simd")]
 impl ExtendedState {
     #[inline]
@@ -307,15 +327,76 @@ impl ExtendedState {
         unsafe { core::arch::x86_64::_fxrstor64(&self.fxsave_area as *const _ as *const u8) }
     }
 
+    /// Saves the state if the task used the FP/SIMD registers since it was
+    /// switched in, i.e. `CR0.TS` is clear.
+    #[inline]
+    fn switch_out(&mut self) {
+        if fpu_trapping() {
+            self.uses = 0;
+        } else {
+            self.save();
+            self.uses = self.uses.wrapping_add(1);
+        }
+    }
+
+    /// Restores the state at once if the task used the FP/SIMD registers on
+    /// each of its last few runs, otherwise sets `CR0.TS` so that its first
+    /// use traps to [`handle_fpu_trap`].
+    #[inline]
+    fn switch_in(&self) {
+        if self.uses >= EAGER_FPU_THRESHOLD {
+            set_fpu_trapping(false);
+            self.restore();
+        } else {
+            set_fpu_trapping(true);
+        }
+        unsafe { CURRENT_EXT_STATE.write_current_raw(self as *const _ as usize) };
+    }
+
     const fn default() -> Self {
         let mut area: FxsaveArea = unsafe { core::mem::MaybeUninit::zeroed().assume_init() };
         area.fcw = 0x37f;
         area.ftw = 0xffff;
         area.mxcsr = 0x1f80;
-        Self { fxsave_area: area }
+        Self {
+            fxsave_area: area,
+            uses: 0,
+        }
     }
 }
 
+/// Whether the FP/SIMD instructions trap with `#NM`, i.e. `CR0.TS` is set.
+#[cfg(feature = "fp_simd")]
+#[inline]
+fn fpu_trapping() -> bool {
+    unsafe { x86::controlregs::cr0() }.contains(x86::controlregs::Cr0::CR0_TASK_SWITCHED)
+}
+
+#[cfg(feature = "fp_simd")]
+#[inline]
+fn set_fpu_trapping(trapping: bool) {
+    use x86::controlregs::{Cr0, cr0, cr0_write};
+    let cr0 = unsafe { cr0() };
+    // Writing `CR0` is slow, skip it if `TS` doesn't change.
+    if cr0.contains(Cr0::CR0_TASK_SWITCHED) != trapping {
+        let mut cr0 = cr0;
+        cr0.set(Cr0::CR0_TASK_SWITCHED, trapping);
+        unsafe { cr0_write(cr0) };
+    }
+}
+
+/// Handles the `#NM` trap of the first FP/SIMD instruction of a task since it
+/// was switched in, by restoring its state.
+#[cfg(feature = "fp_simd")]
+pub(super) fn handle_fpu_trap() {
+    unsafe { core::arch::asm!("clts") };
+    let state = unsafe { CURRENT_EXT_STATE.read_current_raw() } as *const ExtendedState;
+    // It's the state of the running task, see `ExtendedState::switch_in`.
+    unsafe { state.as_ref() }
+        .expect("#NM before the first task switch")
+        .restore();
+}
+
 impl fmt::Debug for ExtendedState {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("ExtendedState")
@@ -423,8 +504,8 @@ impl TaskContext {
     pub fn switch_to(&mut self, next_ctx: &Self) {
         #[cfg(feature = "fp_simd")]
         {
-            self.ext_state.save();
-            next_ctx.ext_state.restore();
+            self.ext_state.switch_out();
+            next_ctx.ext_state.switch_in();
         }
         #[cfg(any(feature = "tls"))]
         unsafe {
@@ -438,6 +519,7 @@ impl TaskContext {
             x86::msr::wrmsr(x86::msr::IA32_KERNEL_GSBASE, next_ctx.gs_base as u64);
             super::tss_set_rsp0(next_ctx.kstack_top);
             if next_ctx.cr3 != self.cr3 {
+                crate::paging::set_user_root(next_ctx.cr3);
                 super::write_page_table_root(next_ctx.cr3);
             }
         }
@@ -1,6 +1,7 @@
 mod context;
 mod gdt;
 mod idt;
+pub(crate) mod pmu;
 
 #[cfg(feature = "uspace")]
 mod syscall;
@@ -0,0 +1,90 @@
+//! Architectural performance monitoring counters.
+
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use raw_cpuid::CpuId;
+use x86::msr::{rdmsr, wrmsr};
+
+use crate::pmu::{PmuConfig, PmuEvent};
+
+const IA32_PMC0: u32 = 0xc1;
+const IA32_PERFEVTSEL0: u32 = 0x186;
+const IA32_PERF_GLOBAL_CTRL: u32 = 0x38f;
+
+const EVTSEL_USR: u64 = 1 << 16;
+const EVTSEL_OS: u64 = 1 << 17;
+const EVTSEL_EN: u64 = 1 << 22;
+
+/// The version of architectural performance monitoring in bits 8..16 and the
+/// number of general-purpose counters in bits 0..8, with bit 16 set once
+/// known, as `cpuid` is slow under virtualization.
+static PERFMON_INFO: AtomicU32 = AtomicU32::new(0);
+
+/// Returns the version of architectural performance monitoring and the
+/// number of general-purpose counters.
+fn perfmon_info() -> (u8, usize) {
+    let mut info = PERFMON_INFO.load(Ordering::Relaxed);
+    if info == 0 {
+        let (version, counters) = CpuId::new()
+            .get_performance_monitoring_info()
+            .map_or((0, 0), |info| {
+                (info.version_id(), info.number_of_counters())
+            });
+        info = 1 << 16 | (version as u32) << 8 | counters as u32;
+        PERFMON_INFO.store(info, Ordering::Relaxed);
+    }
+    ((info >> 8) as u8, (info & 0xff) as usize)
+}
+
+pub fn num_counters() -> usize {
+    match perfmon_info() {
+        (0, _) => 0,
+        (_, counters) => counters,
+    }
+}
+
+/// Returns the event select and unit mask of the architectural event.
+const fn event_select(event: PmuEvent) -> (u64, u64) {
+    match event {
+        PmuEvent::Cycles => (0x3c, 0x00),
+        PmuEvent::Instructions => (0xc0, 0x00),
+        PmuEvent::CacheReferences => (0x2e, 0x4f),
+        PmuEvent::CacheMisses => (0x2e, 0x41),
+        PmuEvent::BranchInstructions => (0xc4, 0x00),
+        PmuEvent::BranchMisses => (0xc5, 0x00),
+    }
+}
+
+pub fn start(idx: usize, config: &PmuConfig) -> bool {
+    let (event, umask) = event_select(config.event);
+    let mut evtsel = event | umask << 8 | EVTSEL_EN;
+    if !config.exclude_user {
+        evtsel |= EVTSEL_USR;
+    }
+    if !config.exclude_kernel {
+        evtsel |= EVTSEL_OS;
+    }
+    let idx = idx as u32;
+    unsafe {
+        wrmsr(IA32_PERFEVTSEL0 + idx, 0);
+        wrmsr(IA32_PMC0 + idx, 0);
+        wrmsr(IA32_PERFEVTSEL0 + idx, evtsel);
+        // Since version 2, counters are also enabled globally.
+        if perfmon_info().0 >= 2 {
+            let ctrl = rdmsr(IA32_PERF_GLOBAL_CTRL);
+            wrmsr(IA32_PERF_GLOBAL_CTRL, ctrl | 1 << idx);
+        }
+    }
+    true
+}
+
+pub fn read(idx: usize) -> u64 {
+    unsafe { rdmsr(IA32_PMC0 + idx as u32) }
+}
+
+pub fn stop(idx: usize) -> u64 {
+    unsafe {
+        wrmsr(IA32_PERFEVTSEL0 + idx as u32, 0);
+    }
+    read(idx)
+}
@@ -42,10 +42,12 @@ fn x86_trap_handler(tf: &mut TrapFrame) {
                 tf.rip, tf.error_code, tf
             );
         }
+        #[cfg(feature = "fp_simd")]
+        DEVICE_NOT_AVAILABLE_VECTOR => super::context::handle_fpu_trap(),
         #[cfg(feature = "uspace")]
         LEGACY_SYSCALL_VECTOR => super::syscall::handle_syscall(tf),
         IRQ_VECTOR_START..=IRQ_VECTOR_END => {
-            handle_trap!(IRQ, tf.vector as _);
+            crate::trap::handle_irq(tf.vector as _, tf, tf.is_user());
         }
         _ => {
             panic!(
@@ -5,7 +5,7 @@ use handler_table::HandlerTable;
 use crate::platform::irq::{MAX_IRQ_COUNT, dispatch_irq};
 use crate::trap::{IRQ, register_trap_handler};
 
-pub use crate::platform::irq::{register_handler, set_enable};
+pub use crate::platform::irq::{IPI_IRQ_NUM, register_handler, send_ipi, set_enable};
 
 /// The type if an IRQ handler.
 pub type IrqHandler = handler_table::Handler;
@@ -20,6 +20,7 @@
 //! - `fp_simd`: Enable floating-point and SIMD support.
 //! - `paging`: Enable page table manipulation.
 //! - `irq`: Enable interrupt handling support.
+//! - `trace`: Record the events of tracepoints, see [`trace`].
 //!
 //! [ArceOS]: https://github.com/arceos-org/arceos
 //! [cargo test]: https://doc.rust-lang.org/cargo/guide/tests.html
@@ -45,6 +46,7 @@ pub mod trap;
 pub mod arch;
 pub mod cpu;
 pub mod mem;
+pub mod pmu;
 pub mod time;
 
 #[cfg(feature = "tls")]
@@ -56,6 +58,37 @@ pub mod irq;
 #[cfg(feature = "paging")]
 pub mod paging;
 
+#[cfg(feature = "trace")]
+pub mod trace;
+
+/// Records an event of a tracepoint, with two arguments that are converted
+/// to `u64`. See [`trace`].
+///
+/// Without the `trace` feature, it compiles to nothing and the arguments are
+/// not evaluated.
+#[cfg(feature = "trace")]
+#[macro_export]
+macro_rules! trace_event {
+    ($event:ident, $arg0:expr, $arg1:expr $(,)?) => {
+        $crate::trace::record($crate::trace::Event::$event, [$arg0 as u64, $arg1 as u64])
+    };
+}
+
+/// Records an event of a tracepoint, with two arguments that are converted
+/// to `u64`.
+///
+/// Without the `trace` feature, it compiles to nothing and the arguments are
+/// not evaluated.
+#[cfg(not(feature = "trace"))]
+#[macro_export]
+macro_rules! trace_event {
+    ($event:ident, $arg0:expr, $arg1:expr $(,)?) => {
+        if false {
+            let _ = (&$arg0, &$arg1);
+        }
+    };
+}
+
 /// Console input and output.
 pub mod console {
     pub use super::platform::console::*;
@@ -1,11 +1,15 @@
 //! Page table manipulation.
 
+use core::sync::atomic::{AtomicUsize, Ordering, fence};
+
 use axalloc::global_allocator;
 use lazyinit::LazyInit;
 use page_table_multiarch::PagingHandler;
 
 use crate::mem::{MemRegionFlags, PAGE_SIZE_4K, PhysAddr, VirtAddr, phys_to_virt, virt_to_phys};
 
+#[doc(no_inline)]
+pub use page_table_entry::GenericPTE;
 #[doc(no_inline)]
 pub use page_table_multiarch::{MappingFlags, PageSize, PagingError, PagingResult};
 
@@ -57,15 +61,23 @@ cfg_if::cfg_if! {
     if #[cfg(target_arch = "x86_64")] {
         /// The architecture-specific page table.
         pub type PageTable = page_table_multiarch::x86_64::X64PageTable<PagingHandlerImpl>;
+        /// The entry of the architecture-specific page table.
+        pub type PageTableEntry = page_table_entry::x86_64::X64PTE;
     } else if #[cfg(any(target_arch = "riscv32", target_arch = "riscv64"))] {
         /// The architecture-specific page table.
         pub type PageTable = page_table_multiarch::riscv::Sv39PageTable<PagingHandlerImpl>;
+        /// The entry of the architecture-specific page table.
+        pub type PageTableEntry = page_table_entry::riscv::Rv64PTE;
     } else if #[cfg(target_arch = "aarch64")]{
         /// The architecture-specific page table.
         pub type PageTable = page_table_multiarch::aarch64::A64PageTable<PagingHandlerImpl>;
+        /// The entry of the architecture-specific page table.
+        pub type PageTableEntry = page_table_entry::aarch64::A64PTE;
     } else if #[cfg(target_arch = "loongarch64")] {
         /// The architecture-specific page table.
         pub type PageTable = page_table_multiarch::loongarch64::LA64PageTable<PagingHandlerImpl>;
+        /// The entry of the architecture-specific page table.
+        pub type PageTableEntry = page_table_entry::loongarch64::LA64PTE;
     }
 }
 
@@ -88,3 +100,24 @@ pub fn kernel_page_table_root() -> PhysAddr {
         .get()
         .expect("kernel page table not initialized")
 }
+
+/// The user page table root loaded on each CPU, so that the CPUs that may
+/// cache the TLB entries of an address space can be found.
+static USER_ROOTS: [AtomicUsize; axconfig::SMP] = [const { AtomicUsize::new(0) }; axconfig::SMP];
+
+/// Records that the current CPU loads the user page table `root`, which must
+/// be called before loading it.
+pub fn set_user_root(root: PhysAddr) {
+    USER_ROOTS[crate::cpu::this_cpu_id()].store(root.as_usize(), Ordering::Relaxed);
+    // Either a CPU changing the page table sees the new root, or this CPU
+    // walks the changed page table after loading it.
+    fence(Ordering::SeqCst);
+}
+
+/// Returns the CPUs that have the user page table `root` loaded, which must
+/// be called after changing the page table.
+pub fn cpus_with_user_root(root: PhysAddr) -> impl Iterator<Item = usize> {
+    fence(Ordering::SeqCst);
+    (0..axconfig::SMP)
+        .filter(move |&cpu| USER_ROOTS[cpu].load(Ordering::Relaxed) == root.as_usize())
+}
@@ -77,6 +77,13 @@ pub(crate) fn init_early() {
 }
 
 pub(crate) fn init_percpu() {
+    // Let EL0 read the physical and virtual counters (CNTKCTL_EL1.EL0PCTEN
+    // and EL0VCTEN), which the vDSO relies on.
+    unsafe {
+        let cntkctl: u64;
+        core::arch::asm!("mrs {}, cntkctl_el1", out(reg) cntkctl);
+        core::arch::asm!("msr cntkctl_el1, {}", in(reg) cntkctl | 0b11);
+    }
     #[cfg(feature = "irq")]
     {
         CNTP_CTL_EL0.write(CNTP_CTL_EL0::ENABLE::SET);
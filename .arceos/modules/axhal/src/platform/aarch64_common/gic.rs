@@ -10,6 +10,13 @@ pub const MAX_IRQ_COUNT: usize = 1024;
 /// The timer IRQ number.
 pub const TIMER_IRQ_NUM: usize = translate_irq(14, InterruptType::PPI).unwrap();
 
+/// The IRQ number of the inter-processor interrupts sent by [`send_ipi`],
+/// software generated interrupt 1.
+pub const IPI_IRQ_NUM: Option<usize> = Some(1);
+
+/// The offset of the software generated interrupt register `GICD_SGIR`.
+const GICD_SGIR: usize = 0xf00;
+
 /// The UART IRQ number.
 pub const UART_IRQ_NUM: usize = translate_irq(UART_IRQ, InterruptType::SPI).unwrap();
 
@@ -46,6 +53,15 @@ pub fn dispatch_irq(_unused: usize) {
     GICC.handle_irq(|irq_num| crate::irq::dispatch_irq_common(irq_num as _));
 }
 
+/// Sends an inter-processor interrupt to the CPU `cpu_id`, whose GIC CPU
+/// interface is assumed to be numbered `cpu_id` too.
+pub fn send_ipi(cpu_id: usize) {
+    let sgir = phys_to_virt(GICD_BASE + GICD_SGIR).as_mut_ptr() as *mut u32;
+    // `CPUTargetList` is bits [23:16], `SGIINTID` bits [3:0].
+    let value = (1u32 << (16 + cpu_id)) | IPI_IRQ_NUM.unwrap() as u32;
+    unsafe { sgir.write_volatile(value) };
+}
+
 /// Initializes GICD, GICC on the primary CPU.
 pub(crate) fn init_primary() {
     info!("Initialize GICv2...");
@@ -69,6 +69,12 @@ pub mod irq {
     /// The timer IRQ number.
     pub const TIMER_IRQ_NUM: usize = 0;
 
+    /// The IRQ number of the inter-processor interrupts, if supported.
+    pub const IPI_IRQ_NUM: Option<usize> = None;
+
+    /// Sends an inter-processor interrupt to the CPU `cpu_id`.
+    pub fn send_ipi(cpu_id: usize) {}
+
     /// Enables or disables the given IRQ.
     pub fn set_enable(irq_num: usize, enabled: bool) {}
 
@@ -9,6 +9,10 @@ pub const MAX_IRQ_COUNT: usize = 12;
 /// The timer IRQ number.
 pub const TIMER_IRQ_NUM: usize = estat::Interrupt::Timer as usize;
 
+/// Inter-processor interrupts are not supported yet, the IPI line is only used
+/// to boot the secondary CPUs.
+pub const IPI_IRQ_NUM: Option<usize> = None;
+
 /// Enables or disables the given IRQ.
 pub fn set_enable(irq_num: usize, enabled: bool) {
     if irq_num == TIMER_IRQ_NUM {
@@ -21,6 +25,10 @@ pub fn set_enable(irq_num: usize, enabled: bool) {
     }
 }
 
+/// Does nothing, as inter-processor interrupts are not supported yet, see
+/// [`IPI_IRQ_NUM`].
+pub fn send_ipi(_cpu_id: usize) {}
+
 /// Registers an IRQ handler for the given IRQ.
 pub fn register_handler(irq_num: usize, handler: crate::irq::IrqHandler) -> bool {
     crate::irq::register_handler_common(irq_num, handler)
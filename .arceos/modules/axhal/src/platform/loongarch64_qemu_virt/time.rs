@@ -41,7 +41,8 @@ pub fn set_oneshot_timer(deadline_ns: u64) {
 
     let ticks_now = current_ticks();
     let ticks_deadline = nanos_to_ticks(deadline_ns);
-    let init_value = ticks_deadline - ticks_now;
+    // Fire as soon as possible if the deadline is already past.
+    let init_value = ticks_deadline.saturating_sub(ticks_now).max(1);
     tcfg::set_init_val(init_value as _);
     tcfg::set_en(true);
 }
@@ -8,7 +8,6 @@ use riscv::register::sie;
 pub(super) const INTC_IRQ_BASE: usize = 1 << (usize::BITS - 1);
 
 /// Supervisor software interrupt in `scause`
-#[allow(unused)]
 pub(super) const S_SOFT: usize = INTC_IRQ_BASE + 1;
 
 /// Supervisor timer interrupt in `scause`
@@ -19,16 +18,28 @@ pub(super) const S_EXT: usize = INTC_IRQ_BASE + 9;
 
 static TIMER_HANDLER: LazyInit<IrqHandler> = LazyInit::new();
 
+static IPI_HANDLER: LazyInit<IrqHandler> = LazyInit::new();
+
 /// The maximum number of IRQs.
 pub const MAX_IRQ_COUNT: usize = 1024;
 
 /// The timer IRQ number (supervisor timer interrupt in `scause`).
 pub const TIMER_IRQ_NUM: usize = S_TIMER;
 
+/// The IRQ number of the inter-processor interrupts sent by [`send_ipi`]
+/// (supervisor software interrupt in `scause`).
+pub const IPI_IRQ_NUM: Option<usize> = Some(S_SOFT);
+
 macro_rules! with_cause {
-    ($cause: expr, @TIMER => $timer_op: expr, @EXT => $ext_op: expr $(,)?) => {
+    (
+        $cause: expr,
+        @TIMER => $timer_op: expr,
+        @SOFT => $soft_op: expr,
+        @EXT => $ext_op: expr $(,)?
+    ) => {
         match $cause {
             S_TIMER => $timer_op,
+            S_SOFT => $soft_op,
             S_EXT => $ext_op,
             _ => panic!("invalid trap cause: {:#x}", $cause),
         }
@@ -55,6 +66,12 @@ pub fn register_handler(scause: usize, handler: IrqHandler) -> bool {
         } else {
             false
         },
+        @SOFT => if !IPI_HANDLER.is_inited() {
+            IPI_HANDLER.init_once(handler);
+            true
+        } else {
+            false
+        },
         @EXT => crate::irq::register_handler_common(scause & !INTC_IRQ_BASE, handler),
     )
 }
@@ -71,10 +88,23 @@ pub fn dispatch_irq(scause: usize) {
             trace!("IRQ: timer");
             TIMER_HANDLER();
         },
+        @SOFT => {
+            trace!("IRQ: IPI");
+            // Clear `sip.SSIP` before handling, not to miss the next IPI.
+            unsafe { core::arch::asm!("csrc sip, {}", in(reg) 1 << (S_SOFT & !INTC_IRQ_BASE)) };
+            if let Some(handler) = IPI_HANDLER.get() {
+                handler();
+            }
+        },
         @EXT => crate::irq::dispatch_irq_common(0), // TODO: get IRQ number from PLIC
     );
 }
 
+/// Sends an inter-processor interrupt to the CPU `cpu_id`.
+pub fn send_ipi(cpu_id: usize) {
+    sbi_rt::send_ipi(sbi_rt::HartMask::from_mask_base(1, cpu_id));
+}
+
 pub(super) fn init_percpu() {
     // enable soft interrupts, timer interrupts, and external interrupts
     unsafe {
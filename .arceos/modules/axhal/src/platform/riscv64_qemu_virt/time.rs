@@ -55,6 +55,8 @@ pub(super) fn init_early() {
 }
 
 pub(super) fn init_percpu() {
+    // Let user mode read the `time` CSR, which the vDSO relies on.
+    unsafe { core::arch::asm!("csrs scounteren, {}", in(reg) 1 << 1) };
     #[cfg(feature = "irq")]
     sbi_rt::set_timer(0);
 }
@@ -16,6 +16,7 @@ pub(super) mod vectors {
     pub const APIC_TIMER_VECTOR: u8 = 0xf0;
     pub const APIC_SPURIOUS_VECTOR: u8 = 0xf1;
     pub const APIC_ERROR_VECTOR: u8 = 0xf2;
+    pub const APIC_IPI_VECTOR: u8 = 0xf3;
 }
 
 /// The maximum number of IRQs.
@@ -24,6 +25,9 @@ pub const MAX_IRQ_COUNT: usize = 256;
 /// The timer IRQ number.
 pub const TIMER_IRQ_NUM: usize = APIC_TIMER_VECTOR as usize;
 
+/// The IRQ number of the inter-processor interrupts sent by [`send_ipi`].
+pub const IPI_IRQ_NUM: Option<usize> = Some(APIC_IPI_VECTOR as usize);
+
 const IO_APIC_BASE: PhysAddr = pa!(0xFEC0_0000);
 
 static LOCAL_APIC: SyncUnsafeCell<MaybeUninit<LocalApic>> =
@@ -66,6 +70,12 @@ pub fn dispatch_irq(vector: usize) {
     unsafe { local_apic().end_of_interrupt() };
 }
 
+/// Sends an inter-processor interrupt to the CPU `cpu_id`.
+#[cfg(feature = "irq")]
+pub fn send_ipi(cpu_id: usize) {
+    unsafe { local_apic().send_ipi(APIC_IPI_VECTOR, raw_apic_id(cpu_id as u8)) };
+}
+
 pub(super) fn local_apic<'a>() -> &'a mut LocalApic {
     // It's safe as `LOCAL_APIC` is initialized in `init_primary`.
     unsafe { LOCAL_APIC.get().as_mut().unwrap().assume_init_mut() }
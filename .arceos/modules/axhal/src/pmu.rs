@@ -0,0 +1,209 @@
+//! Hardware performance counters, counted per task.
+//!
+//! Each task has a [`PmuContext`] with the counters it has opened. Its
+//! enabled counters are programmed into the hardware counters of the CPU
+//! while it runs, and saved when it is switched out, by [`PmuContext::save`]
+//! and [`PmuContext::restore`] on context switches. Hardware counters always
+//! start from 0 and their values are added to the saved counts, so that the
+//! counts do not depend on the width of the hardware counters.
+//!
+//! The counter `i` of a task uses the hardware counter `i`, so there are at
+//! most [`MAX_COUNTERS`] of them, and no more than the CPU has.
+
+use crate::arch::pmu as arch;
+use crate::cpu::this_cpu_id;
+
+/// The number of counters a task can have at the same time.
+pub const MAX_COUNTERS: usize = 4;
+
+/// The events that can be counted, on any architecture that has counters.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PmuEvent {
+    /// CPU cycles.
+    Cycles,
+    /// Retired instructions.
+    Instructions,
+    /// Cache accesses, usually of the last level cache.
+    CacheReferences,
+    /// Cache misses, usually of the last level cache.
+    CacheMisses,
+    /// Retired branch instructions.
+    BranchInstructions,
+    /// Mispredicted branch instructions.
+    BranchMisses,
+}
+
+/// What a counter counts.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct PmuConfig {
+    pub event: PmuEvent,
+    /// Whether not to count in user mode.
+    pub exclude_user: bool,
+    /// Whether not to count in kernel mode.
+    pub exclude_kernel: bool,
+}
+
+/// Returns the number of counters a task can have on the current CPU, or 0
+/// if it has no performance counters that are supported.
+pub fn num_counters() -> usize {
+    arch::num_counters().min(MAX_COUNTERS)
+}
+
+#[derive(Clone, Copy)]
+struct Counter {
+    config: PmuConfig,
+    enabled: bool,
+    /// The count up to when the hardware counter was last started.
+    count: u64,
+}
+
+/// The performance counters of a task.
+///
+/// It is meant to be locked with IRQs disabled, so that the task cannot be
+/// switched out while its counters are being changed.
+pub struct PmuContext {
+    counters: [Option<Counter>; MAX_COUNTERS],
+    /// The CPU the task runs on, whose hardware counters are in use.
+    cpu: Option<usize>,
+    /// The hardware counters in use, as a bitmask.
+    running: u32,
+}
+
+impl PmuContext {
+    /// Creates a context with no counters.
+    pub const fn new() -> Self {
+        Self {
+            counters: [None; MAX_COUNTERS],
+            cpu: None,
+            running: 0,
+        }
+    }
+
+    /// Whether the hardware counters of the current CPU are the ones of the
+    /// task.
+    fn is_live(&self) -> bool {
+        self.cpu == Some(this_cpu_id())
+    }
+
+    fn start(&mut self, i: usize) {
+        if let Some(counter) = &self.counters[i] {
+            if arch::start(i, &counter.config) {
+                self.running |= 1 << i;
+            }
+        }
+    }
+
+    /// Stops the hardware counter `i` and adds its value to the count.
+    fn stop(&mut self, i: usize) {
+        if self.running & (1 << i) == 0 {
+            return;
+        }
+        self.running &= !(1 << i);
+        let value = arch::stop(i);
+        if let Some(counter) = &mut self.counters[i] {
+            counter.count += value;
+        }
+    }
+
+    /// Adds a disabled counter of `config`, and returns its index, or `None`
+    /// if all the counters are in use.
+    pub fn open(&mut self, config: PmuConfig) -> Option<usize> {
+        let i = (0..num_counters()).find(|&i| self.counters[i].is_none())?;
+        self.counters[i] = Some(Counter {
+            config,
+            enabled: false,
+            count: 0,
+        });
+        Some(i)
+    }
+
+    /// Removes the counter `i`.
+    pub fn close(&mut self, i: usize) {
+        if self.is_live() {
+            self.stop(i);
+        }
+        self.counters[i] = None;
+    }
+
+    /// Starts counting on counter `i`.
+    ///
+    /// The hardware counter is only started if the task runs on the current
+    /// CPU, otherwise the next time it runs.
+    pub fn enable(&mut self, i: usize) {
+        let Some(counter) = &mut self.counters[i] else {
+            return;
+        };
+        if counter.enabled {
+            return;
+        }
+        counter.enabled = true;
+        if self.is_live() {
+            self.start(i);
+        }
+    }
+
+    /// Stops counting on counter `i`.
+    pub fn disable(&mut self, i: usize) {
+        if self.is_live() {
+            self.stop(i);
+        }
+        if let Some(counter) = &mut self.counters[i] {
+            counter.enabled = false;
+        }
+    }
+
+    /// Sets the count of counter `i` to 0.
+    pub fn reset(&mut self, i: usize) {
+        let restart = self.is_live() && self.running & (1 << i) != 0;
+        if restart {
+            self.stop(i);
+        }
+        if let Some(counter) = &mut self.counters[i] {
+            counter.count = 0;
+        }
+        if restart {
+            self.start(i);
+        }
+    }
+
+    /// Returns the count of counter `i`, including what the hardware counter
+    /// has counted if the task runs on the current CPU. If it runs on another
+    /// one, the count is the one saved when it was last switched out.
+    pub fn read(&self, i: usize) -> u64 {
+        let Some(counter) = &self.counters[i] else {
+            return 0;
+        };
+        let mut count = counter.count;
+        if self.is_live() && self.running & (1 << i) != 0 {
+            count += arch::read(i);
+        }
+        count
+    }
+
+    /// Saves the counters of the task when it is switched out.
+    pub fn save(&mut self) {
+        if self.running != 0 {
+            for i in 0..MAX_COUNTERS {
+                self.stop(i);
+            }
+        }
+        self.cpu = None;
+    }
+
+    /// Programs the enabled counters of the task into the current CPU when
+    /// it is switched in.
+    pub fn restore(&mut self) {
+        self.cpu = Some(this_cpu_id());
+        for i in 0..MAX_COUNTERS {
+            if self.counters[i].is_some_and(|counter| counter.enabled) {
+                self.start(i);
+            }
+        }
+    }
+}
+
+impl Default for PmuContext {
+    fn default() -> Self {
+        Self::new()
+    }
+}
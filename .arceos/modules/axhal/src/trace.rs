@@ -0,0 +1,112 @@
+//! Static tracepoints, recorded into per-CPU ring buffers.
+//!
+//! [`trace_event!`](crate::trace_event) records an event with a timestamp and
+//! two arguments into the ring of the current CPU. The rings keep the latest
+//! [`RING_LEN`] events of each CPU, overwriting the oldest ones. Recording
+//! only disables IRQs and writes to the ring of the current CPU, with no
+//! lock.
+//!
+//! Without the `trace` feature, tracepoints compile to nothing.
+
+use core::cell::SyncUnsafeCell;
+use core::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
+use crate::cpu::this_cpu_id;
+use crate::time::monotonic_time_nanos;
+
+/// The number of events kept for each CPU.
+pub const RING_LEN: usize = 2048;
+
+/// The events of the tracepoints, each with two arguments.
+#[repr(u16)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Event {
+    /// A context switch from task `args[0]` to task `args[1]`.
+    ContextSwitch,
+    /// Task `args[0]` blocked on a wait queue.
+    Block,
+    /// Task `args[0]` resumed after blocking.
+    Unblock,
+    /// Task `args[1]` entered syscall `args[0]`.
+    SyscallEnter,
+    /// Syscall `args[0]` returned `args[1]`.
+    SyscallExit,
+    /// A page fault at `args[0]` with the access flags `args[1]`.
+    PageFault,
+    /// The page fault at `args[0]` was handled if `args[1]` is 1.
+    PageFaultDone,
+    /// Task `args[0]` waited `args[1]` nanoseconds for a CPU before running.
+    RunDelay,
+}
+
+/// An event recorded by a tracepoint.
+#[derive(Debug, Clone, Copy)]
+pub struct Record {
+    pub time_nanos: u64,
+    pub event: Event,
+    pub args: [u64; 2],
+}
+
+struct Ring {
+    records: SyncUnsafeCell<[Record; RING_LEN]>,
+    /// The number of events recorded so far.
+    count: AtomicUsize,
+}
+
+impl Ring {
+    const fn new() -> Self {
+        const EMPTY: Record = Record {
+            time_nanos: 0,
+            event: Event::ContextSwitch,
+            args: [0; 2],
+        };
+        Self {
+            records: SyncUnsafeCell::new([EMPTY; RING_LEN]),
+            count: AtomicUsize::new(0),
+        }
+    }
+}
+
+static RINGS: [Ring; axconfig::SMP] = [const { Ring::new() }; axconfig::SMP];
+static ENABLED: AtomicBool = AtomicBool::new(true);
+
+/// Starts or stops recording events. Recording is on from boot.
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Release);
+}
+
+/// Records `event` on the current CPU. Use [`trace_event!`](crate::trace_event)
+/// instead, which compiles to nothing without the `trace` feature.
+pub fn record(event: Event, args: [u64; 2]) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    // The ring is only written by its CPU, with IRQs disabled.
+    let _guard = kernel_guard::IrqSave::new();
+    let ring = &RINGS[this_cpu_id()];
+    let count = ring.count.load(Ordering::Relaxed);
+    let record = Record {
+        time_nanos: monotonic_time_nanos(),
+        event,
+        args,
+    };
+    // SAFETY: no one else writes to the ring of the current CPU.
+    unsafe { (*ring.records.get())[count % RING_LEN] = record };
+    ring.count.store(count + 1, Ordering::Release);
+}
+
+/// Calls `f` with the ID of each CPU and each of the events kept for it,
+/// oldest first.
+///
+/// Events recorded meanwhile may be torn, so recording should be stopped
+/// with [`set_enabled`] first.
+pub fn for_each_record(mut f: impl FnMut(usize, &Record)) {
+    for (cpu_id, ring) in RINGS.iter().enumerate() {
+        let count = ring.count.load(Ordering::Acquire);
+        for i in count.saturating_sub(RING_LEN)..count {
+            // SAFETY: the slot has been written, see above for tearing.
+            let record = unsafe { (*ring.records.get())[i % RING_LEN] };
+            f(cpu_id, &record);
+        }
+    }
+}
@@ -41,6 +41,45 @@ macro_rules! handle_trap {
     }}
 }
 
+/// Whether the IRQ being handled on this CPU interrupted user mode.
+#[percpu::def_percpu]
+static IRQ_FROM_USER: bool = false;
+
+/// Returns whether the IRQ being handled on the current CPU interrupted user
+/// mode, e.g. to charge a timer tick to the user time of the current task.
+///
+/// The result is meaningless outside of IRQ handlers.
+pub fn irq_from_user() -> bool {
+    IRQ_FROM_USER.read_current()
+}
+
+/// Where the IRQ being handled on this CPU interrupted it.
+#[percpu::def_percpu]
+static IRQ_PC: usize = 0;
+#[percpu::def_percpu]
+static IRQ_FP: usize = 0;
+
+/// Returns the instruction pointer and the frame pointer at which the IRQ
+/// being handled on the current CPU interrupted it, e.g. to sample where the
+/// CPU spends its time.
+///
+/// The result is meaningless outside of IRQ handlers.
+pub fn irq_interrupted_at() -> (usize, usize) {
+    (IRQ_PC.read_current(), IRQ_FP.read_current())
+}
+
+/// Calls the external IRQ handler.
+#[allow(dead_code)]
+pub(crate) fn handle_irq(irq_num: usize, tf: &TrapFrame, from_user: bool) -> bool {
+    // Safety: IRQs are disabled while handling them.
+    unsafe {
+        IRQ_FROM_USER.write_current_raw(from_user);
+        IRQ_PC.write_current_raw(tf.ip());
+        IRQ_FP.write_current_raw(tf.fp());
+    }
+    handle_trap!(IRQ, irq_num)
+}
+
 #[unsafe(no_mangle)]
 pub(crate) fn post_trap_callback(tf: &mut TrapFrame, from_user: bool) {
     for cb in crate::trap::POST_TRAP.iter() {
@@ -0,0 +1,279 @@
+//! Deferred logging.
+//!
+//! Printing a record means waiting for the console, which is far slower than
+//! anything that logs. Once enabled by [`set_deferred`], records are copied
+//! to a ring of the logging CPU instead: a binary header with the time, CPU,
+//! task, level and line, followed by the path and the formatted message.
+//! They are printed later by [`drain_deferred`], which the kernel calls from
+//! a background task, in the order they were logged across all CPUs.
+//!
+//! Each ring is only locked by its own CPU and by the drainer, so logging
+//! does not contend with other CPUs. A CPU logging faster than
+//! [`RATE_PER_SEC`] on average, or filling its ring, has records dropped, and
+//! the number dropped is reported in their place.
+//!
+//! Errors are still printed at once, after the records before them.
+
+use core::fmt::{self, Write};
+use core::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use core::time::Duration;
+
+use kspin::SpinNoIrq;
+use log::{Level, Record};
+
+/// CPUs with an ID above this share rings with others.
+const MAX_CPUS: usize = 16;
+const RING_SIZE: usize = 0x4000;
+/// Longer paths and messages are truncated.
+const MAX_PATH_LEN: usize = 64;
+const MAX_MESSAGE_LEN: usize = 512;
+/// How many records a CPU may log per second on average.
+const RATE_PER_SEC: u64 = 4000;
+/// How many records a CPU may log at once after being quiet.
+const BURST: u64 = 512;
+
+const NONE: u64 = u64::MAX;
+
+static DEFERRED: AtomicBool = AtomicBool::new(false);
+/// The number of records waiting to be printed.
+static PENDING: AtomicUsize = AtomicUsize::new(0);
+static RINGS: [SpinNoIrq<Ring>; MAX_CPUS] = [const { SpinNoIrq::new(Ring::new()) }; MAX_CPUS];
+
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct Header {
+    time_nanos: u64,
+    cpu_id: u64,
+    tid: u64,
+    line: u32,
+    level: u32,
+    path_len: u32,
+    msg_len: u32,
+}
+
+const HEADER_LEN: usize = size_of::<Header>();
+
+impl Header {
+    fn to_bytes(self) -> [u8; HEADER_LEN] {
+        // SAFETY: `Header` is plain data with no padding.
+        unsafe { core::mem::transmute(self) }
+    }
+
+    fn from_bytes(bytes: [u8; HEADER_LEN]) -> Self {
+        // SAFETY: any bytes make a valid `Header`.
+        unsafe { core::mem::transmute(bytes) }
+    }
+
+    fn record_len(&self) -> usize {
+        HEADER_LEN + self.path_len as usize + self.msg_len as usize
+    }
+}
+
+/// The records logged by a CPU, as a byte queue.
+struct Ring {
+    buf: [u8; RING_SIZE],
+    head: usize,
+    len: usize,
+    /// Records that may be logged before the rate limit applies.
+    tokens: u64,
+    last_refill_nanos: u64,
+    dropped: u64,
+}
+
+impl Ring {
+    const fn new() -> Self {
+        Self {
+            buf: [0; RING_SIZE],
+            head: 0,
+            len: 0,
+            tokens: BURST,
+            last_refill_nanos: 0,
+            dropped: 0,
+        }
+    }
+
+    /// Takes a token for a record logged at `now_nanos`, if any is left.
+    fn take_token(&mut self, now_nanos: u64) -> bool {
+        let elapsed = now_nanos.saturating_sub(self.last_refill_nanos);
+        let refill = elapsed * RATE_PER_SEC / 1_000_000_000;
+        if refill > 0 {
+            self.tokens = (self.tokens + refill).min(BURST);
+            self.last_refill_nanos = now_nanos;
+        }
+        if self.tokens == 0 {
+            return false;
+        }
+        self.tokens -= 1;
+        true
+    }
+
+    fn push(&mut self, data: &[u8]) {
+        debug_assert!(self.len + data.len() <= RING_SIZE);
+        for (i, &byte) in data.iter().enumerate() {
+            self.buf[(self.head + self.len + i) % RING_SIZE] = byte;
+        }
+        self.len += data.len();
+    }
+
+    fn peek(&self, offset: usize, out: &mut [u8]) {
+        for (i, byte) in out.iter_mut().enumerate() {
+            *byte = self.buf[(self.head + offset + i) % RING_SIZE];
+        }
+    }
+
+    fn skip(&mut self, len: usize) {
+        self.head = (self.head + len) % RING_SIZE;
+        self.len -= len;
+    }
+
+    fn peek_header(&self) -> Option<Header> {
+        if self.len == 0 {
+            return None;
+        }
+        let mut bytes = [0; HEADER_LEN];
+        self.peek(0, &mut bytes);
+        Some(Header::from_bytes(bytes))
+    }
+}
+
+/// Formats into a fixed buffer, dropping what does not fit.
+struct Truncating<'a> {
+    buf: &'a mut [u8],
+    len: usize,
+}
+
+impl Write for Truncating<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        let s = truncate(s, self.buf.len() - self.len);
+        self.buf[self.len..self.len + s.len()].copy_from_slice(s.as_bytes());
+        self.len += s.len();
+        Ok(())
+    }
+}
+
+/// Truncates `s` to at most `max` bytes, on a character boundary.
+fn truncate(s: &str, max: usize) -> &str {
+    let mut len = s.len().min(max);
+    while !s.is_char_boundary(len) {
+        len -= 1;
+    }
+    &s[..len]
+}
+
+/// Makes records of all levels but errors be printed later by
+/// [`drain_deferred`], or at once again.
+///
+/// Whoever enables it must call [`drain_deferred`] regularly, e.g. whenever
+/// [`has_deferred`] returns true.
+pub fn set_deferred(deferred: bool) {
+    DEFERRED.store(deferred, Ordering::Release);
+    if !deferred {
+        drain_deferred();
+    }
+}
+
+/// Whether records are deferred. See [`set_deferred`].
+pub(crate) fn is_deferred() -> bool {
+    DEFERRED.load(Ordering::Acquire)
+}
+
+/// Whether there are records waiting to be printed.
+pub fn has_deferred() -> bool {
+    PENDING.load(Ordering::Acquire) > 0
+}
+
+/// Copies `record` to the ring of the current CPU.
+pub(crate) fn push(record: &Record, now: Duration, cpu_id: Option<usize>, tid: Option<u64>) {
+    let mut msg = [0; MAX_MESSAGE_LEN];
+    let mut writer = Truncating {
+        buf: &mut msg,
+        len: 0,
+    };
+    let _ = write!(writer, "{}", record.args());
+    let msg_len = writer.len;
+    let msg = &msg[..msg_len];
+    let path = truncate(record.target(), MAX_PATH_LEN).as_bytes();
+    let header = Header {
+        time_nanos: now.as_nanos() as u64,
+        cpu_id: cpu_id.map_or(NONE, |id| id as u64),
+        tid: tid.unwrap_or(NONE),
+        line: record.line().unwrap_or(0),
+        level: record.level() as u32,
+        path_len: path.len() as u32,
+        msg_len: msg.len() as u32,
+    };
+
+    let mut ring = RINGS[cpu_id.unwrap_or(0) % MAX_CPUS].lock();
+    if !ring.take_token(header.time_nanos) || ring.len + header.record_len() > RING_SIZE {
+        ring.dropped += 1;
+        return;
+    }
+    ring.push(&header.to_bytes());
+    ring.push(path);
+    ring.push(msg);
+    PENDING.fetch_add(1, Ordering::Release);
+}
+
+/// Prints the records of all the rings, oldest first.
+///
+/// Rings that are locked, e.g. by a CPU that panicked while logging, are
+/// skipped.
+pub fn drain_deferred() {
+    let mut path = [0; MAX_PATH_LEN];
+    let mut msg = [0; MAX_MESSAGE_LEN];
+    loop {
+        // Find the ring with the oldest record.
+        let oldest = RINGS
+            .iter()
+            .enumerate()
+            .filter_map(|(i, ring)| Some((i, ring.try_lock()?.peek_header()?)))
+            .min_by_key(|(_, header)| header.time_nanos);
+        let Some((i, _)) = oldest else {
+            break;
+        };
+        let header = {
+            let Some(mut ring) = RINGS[i].try_lock() else {
+                continue;
+            };
+            // Read the header again, as another drainer may have taken it.
+            let Some(header) = ring.peek_header() else {
+                continue;
+            };
+            let path_len = header.path_len as usize;
+            ring.peek(HEADER_LEN, &mut path[..path_len]);
+            ring.peek(HEADER_LEN + path_len, &mut msg[..header.msg_len as usize]);
+            ring.skip(header.record_len());
+            header
+        };
+        PENDING.fetch_sub(1, Ordering::Release);
+        let level = match header.level {
+            1 => Level::Error,
+            2 => Level::Warn,
+            3 => Level::Info,
+            4 => Level::Debug,
+            _ => Level::Trace,
+        };
+        let path = core::str::from_utf8(&path[..header.path_len as usize]).unwrap_or("?");
+        let msg = core::str::from_utf8(&msg[..header.msg_len as usize]).unwrap_or("?");
+        crate::print_record(
+            level,
+            path,
+            header.line,
+            format_args!("{}", msg),
+            Duration::from_nanos(header.time_nanos),
+            (header.cpu_id != NONE).then_some(header.cpu_id as usize),
+            (header.tid != NONE).then_some(header.tid),
+        );
+    }
+
+    for (i, ring) in RINGS.iter().enumerate() {
+        let Some(mut ring) = ring.try_lock() else {
+            continue;
+        };
+        let dropped = core::mem::take(&mut ring.dropped);
+        drop(ring);
+        if dropped > 0 {
+            crate::ax_println!("[log: {} records of CPU {} dropped]", dropped, i);
+        }
+    }
+}
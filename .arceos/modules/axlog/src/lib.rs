@@ -60,6 +60,12 @@ use crate_interface::call_interface;
 
 pub use log::{debug, error, info, trace, warn};
 
+#[cfg(not(feature = "std"))]
+mod deferred;
+
+#[cfg(not(feature = "std"))]
+pub use self::deferred::{drain_deferred, has_deferred, set_deferred};
+
 /// Prints to the console.
 ///
 /// Equivalent to the [`ax_println!`] macro except that a newline is not printed at
@@ -129,6 +135,69 @@ pub trait LogIf {
 
 struct Logger;
 
+fn args_color(level: Level) -> ColorCode {
+    match level {
+        Level::Error => ColorCode::Red,
+        Level::Warn => ColorCode::Yellow,
+        Level::Info => ColorCode::Green,
+        Level::Debug => ColorCode::Cyan,
+        Level::Trace => ColorCode::BrightBlack,
+    }
+}
+
+/// Prints a record logged at `now`, on CPU `cpu_id` by task `tid`.
+#[cfg(not(feature = "std"))]
+fn print_record(
+    level: Level,
+    path: &str,
+    line: u32,
+    args: fmt::Arguments,
+    now: core::time::Duration,
+    cpu_id: Option<usize>,
+    tid: Option<u64>,
+) {
+    let args_color = args_color(level);
+    if let Some(cpu_id) = cpu_id {
+        if let Some(tid) = tid {
+            // show CPU ID and task ID
+            __print_impl(with_color!(
+                ColorCode::White,
+                "[{:>3}.{:06} {cpu_id}:{tid} {path}:{line}] {args}\n",
+                now.as_secs(),
+                now.subsec_micros(),
+                cpu_id = cpu_id,
+                tid = tid,
+                path = path,
+                line = line,
+                args = with_color!(args_color, "{}", args),
+            ));
+        } else {
+            // show CPU ID only
+            __print_impl(with_color!(
+                ColorCode::White,
+                "[{:>3}.{:06} {cpu_id} {path}:{line}] {args}\n",
+                now.as_secs(),
+                now.subsec_micros(),
+                cpu_id = cpu_id,
+                path = path,
+                line = line,
+                args = with_color!(args_color, "{}", args),
+            ));
+        }
+    } else {
+        // neither CPU ID nor task ID is shown
+        __print_impl(with_color!(
+            ColorCode::White,
+            "[{:>3}.{:06} {path}:{line}] {args}\n",
+            now.as_secs(),
+            now.subsec_micros(),
+            path = path,
+            line = line,
+            args = with_color!(args_color, "{}", args),
+        ));
+    }
+}
+
 impl Write for Logger {
     fn write_str(&mut self, s: &str) -> fmt::Result {
         cfg_if::cfg_if! {
@@ -156,13 +225,6 @@ impl Log for Logger {
         let level = record.level();
         let line = record.line().unwrap_or(0);
         let path = record.target();
-        let args_color = match level {
-            Level::Error => ColorCode::Red,
-            Level::Warn => ColorCode::Yellow,
-            Level::Info => ColorCode::Green,
-            Level::Debug => ColorCode::Cyan,
-            Level::Trace => ColorCode::BrightBlack,
-        };
 
         cfg_if::cfg_if! {
             if #[cfg(feature = "std")] {
@@ -172,51 +234,21 @@ impl Log for Logger {
                     time = chrono::Local::now().format("%Y-%m-%d %H:%M:%S%.6f"),
                     path = path,
                     line = line,
-                    args = with_color!(args_color, "{}", record.args()),
+                    args = with_color!(args_color(level), "{}", record.args()),
                 ));
             } else {
                 let cpu_id = call_interface!(LogIf::current_cpu_id);
                 let tid = call_interface!(LogIf::current_task_id);
                 let now = call_interface!(LogIf::current_time);
-                if let Some(cpu_id) = cpu_id {
-                    if let Some(tid) = tid {
-                        // show CPU ID and task ID
-                        __print_impl(with_color!(
-                            ColorCode::White,
-                            "[{:>3}.{:06} {cpu_id}:{tid} {path}:{line}] {args}\n",
-                            now.as_secs(),
-                            now.subsec_micros(),
-                            cpu_id = cpu_id,
-                            tid = tid,
-                            path = path,
-                            line = line,
-                            args = with_color!(args_color, "{}", record.args()),
-                        ));
-                    } else {
-                        // show CPU ID only
-                        __print_impl(with_color!(
-                            ColorCode::White,
-                            "[{:>3}.{:06} {cpu_id} {path}:{line}] {args}\n",
-                            now.as_secs(),
-                            now.subsec_micros(),
-                            cpu_id = cpu_id,
-                            path = path,
-                            line = line,
-                            args = with_color!(args_color, "{}", record.args()),
-                        ));
+                if deferred::is_deferred() {
+                    if level != Level::Error {
+                        deferred::push(record, now, cpu_id, tid);
+                        return;
                     }
-                } else {
-                    // neither CPU ID nor task ID is shown
-                    __print_impl(with_color!(
-                        ColorCode::White,
-                        "[{:>3}.{:06} {path}:{line}] {args}\n",
-                        now.as_secs(),
-                        now.subsec_micros(),
-                        path = path,
-                        line = line,
-                        args = with_color!(args_color, "{}", record.args()),
-                    ));
+                    // Keep the records before the error ahead of it.
+                    deferred::drain_deferred();
                 }
+                print_record(level, path, line, *record.args(), now, cpu_id, tid);
             }
         }
     }
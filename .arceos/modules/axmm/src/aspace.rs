@@ -1,21 +1,65 @@
 use core::fmt;
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use alloc::{collections::BTreeSet, sync::Arc, vec::Vec};
 
 use axerrno::{AxError, AxResult, ax_err};
 use axhal::mem::phys_to_virt;
-use axhal::paging::{MappingFlags, PageTable, PagingError};
+use axhal::paging::{MappingFlags, PageSize, PageTable, PagingError};
+use kspin::{SpinNoIrq, SpinNoIrqGuard};
 use memory_addr::{
     MemoryAddr, PAGE_SIZE_4K, PageIter4K, PhysAddr, VirtAddr, VirtAddrRange, is_aligned_4k,
 };
 use memory_set::{MemoryArea, MemorySet};
 
-use crate::backend::Backend;
+use crate::backend::{Backend, PAGE_SIZE_2M, SharedPages, is_zero_frame, share_frame};
 use crate::mapping_err_to_ax_err;
+use crate::tlb::TlbBatch;
+
+/// Whether lazy allocation mappings are backed by huge pages when possible.
+const HUGE_PAGES: bool = cfg!(any(
+    target_arch = "x86_64",
+    target_arch = "aarch64",
+    target_arch = "riscv64"
+));
+
+/// The number of pages mapped by a page fault, see [`set_fault_around_pages`].
+static FAULT_AROUND_PAGES: AtomicUsize = AtomicUsize::new(16);
+
+/// Sets the number of pages mapped by a page fault that maps the pages around
+/// the faulting one ("fault-around"), rounded up to a power of two.
+///
+/// It applies to file mappings, where the pages of the aligned window of that
+/// size are mapped, and to sequential faults in allocation mappings, where the
+/// pages following the faulting one are mapped. `1` disables fault-around.
+pub fn set_fault_around_pages(pages: usize) {
+    FAULT_AROUND_PAGES.store(pages.max(1).next_power_of_two(), Ordering::Relaxed);
+}
 
 /// The virtual memory address space.
+///
+/// Page faults are handled through a shared reference (see
+/// [`AddrSpace::handle_page_fault`]), so that the threads of a process can
+/// take them concurrently while changes to the areas need a unique one. The
+/// page table has its own lock, which is only held around the page table
+/// updates of faults.
 pub struct AddrSpace {
     va_range: VirtAddrRange,
     areas: MemorySet<Backend>,
-    pt: PageTable,
+    /// The page table, which the shared pages written through it also refer
+    /// to, see [`SharedPages::sync`].
+    pt: Arc<SpinNoIrq<PageTable>>,
+    /// The [`PAGE_SIZE_2M`] blocks that can't be mapped with huge pages,
+    /// because they have been mapped with 4K pages before, or huge pages are
+    /// disabled there by [`AddrSpace::set_huge_pages`].
+    small_blocks: SpinNoIrq<BTreeSet<VirtAddr>>,
+    /// The page after the last pages mapped by a fault in an allocation
+    /// mapping, where a sequential access faults next.
+    next_fault: AtomicUsize,
+    /// Whether the root entries of the kernel range point to the tables of
+    /// the kernel page table, see [`AddrSpace::share_kernel_mappings`].
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    kernel_shared: bool,
 }
 
 impl AddrSpace {
@@ -34,14 +78,56 @@ impl AddrSpace {
         self.va_range.size()
     }
 
-    /// Returns the reference to the inner page table.
-    pub const fn page_table(&self) -> &PageTable {
-        &self.pt
+    /// Returns the total size of the mapped areas, which `RLIMIT_AS` limits.
+    pub fn mapped_size(&self) -> usize {
+        self.areas.iter().map(|area| area.size()).sum()
+    }
+
+    /// Returns the range, flags and backend of each area, in address order.
+    pub fn areas(&self) -> impl Iterator<Item = (VirtAddrRange, MappingFlags, &Backend)> {
+        self.areas
+            .iter()
+            .map(|area| (area.va_range(), area.flags(), area.backend()))
+    }
+
+    /// Returns the number of pages backed by frames in the areas that are not
+    /// linear mappings, i.e. the resident set size in pages.
+    ///
+    /// Frames shared with other address spaces are counted by each of them,
+    /// while the zero frame mapped by read faults is not counted. It walks the
+    /// page table, so it is only meant for statistics.
+    pub fn resident_pages(&self) -> usize {
+        let mut pages = 0;
+        for area in self.areas.iter() {
+            if matches!(area.backend(), Backend::Linear { .. }) {
+                continue;
+            }
+            let mut addr = area.start();
+            while addr < area.end() {
+                let res = self.pt.lock().query(addr);
+                match res {
+                    Ok((_, _, PageSize::Size2M)) => {
+                        pages += PAGE_SIZE_2M / PAGE_SIZE_4K;
+                        addr = addr.align_down(PAGE_SIZE_2M) + PAGE_SIZE_2M;
+                        continue;
+                    }
+                    Ok((frame, ..)) if !is_zero_frame(frame) => pages += 1,
+                    _ => {}
+                }
+                addr += PAGE_SIZE_4K;
+            }
+        }
+        pages
+    }
+
+    /// Locks the inner page table and returns the guard.
+    pub fn page_table(&self) -> SpinNoIrqGuard<'_, PageTable> {
+        self.pt.lock()
     }
 
     /// Returns the root physical address of the inner page table.
-    pub const fn page_table_root(&self) -> PhysAddr {
-        self.pt.root_paddr()
+    pub fn page_table_root(&self) -> PhysAddr {
+        self.pt.lock().root_paddr()
     }
 
     /// Checks if the address space contains the given address range.
@@ -55,7 +141,13 @@ impl AddrSpace {
         Ok(Self {
             va_range: VirtAddrRange::from_start_size(base, size),
             areas: MemorySet::new(),
-            pt: PageTable::try_new().map_err(|_| AxError::NoMemory)?,
+            small_blocks: SpinNoIrq::new(BTreeSet::new()),
+            next_fault: AtomicUsize::new(0),
+            #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+            kernel_shared: false,
+            pt: Arc::new(SpinNoIrq::new(
+                PageTable::try_new().map_err(|_| AxError::NoMemory)?,
+            )),
         })
     }
 
@@ -74,7 +166,9 @@ impl AddrSpace {
         if self.va_range.overlaps(other.va_range) {
             return ax_err!(InvalidInput, "address space overlap");
         }
-        self.pt.copy_from(&other.pt, other.base(), other.size());
+        self.pt
+            .lock()
+            .copy_from(&other.pt.lock(), other.base(), other.size());
         Ok(())
     }
 
@@ -82,7 +176,46 @@ impl AddrSpace {
     ///
     /// This should be used in pair with [`AddrSpace::copy_mappings_from`].
     pub fn clear_mappings(&mut self, range: VirtAddrRange) {
-        self.pt.clear_copy_range(range.start, range.size());
+        self.pt.lock().clear_copy_range(range.start, range.size());
+    }
+
+    /// Makes the page table share the kernel mappings, by pointing its root
+    /// entries of the kernel range to the tables of the kernel page table.
+    ///
+    /// Unlike [`AddrSpace::copy_mappings_from`], it does not lock the kernel
+    /// address space, as the entries are taken once at boot. The entries are
+    /// cleared again when the address space is dropped, by whichever owner
+    /// drops it last.
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    pub fn share_kernel_mappings(&mut self) {
+        let root = self.root_entries();
+        for &(index, entry) in crate::kernel_root_entries() {
+            // SAFETY: the index is within the root table.
+            unsafe { root.add(index).write(entry) };
+        }
+        self.kernel_shared = true;
+    }
+
+    /// Clears the root entries set by [`AddrSpace::share_kernel_mappings`],
+    /// so that dropping the page table does not free the tables of the
+    /// kernel.
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    fn unshare_kernel_mappings(&mut self) {
+        if !core::mem::take(&mut self.kernel_shared) {
+            return;
+        }
+        let root = self.root_entries();
+        for &(index, _) in crate::kernel_root_entries() {
+            // SAFETY: the index is within the root table.
+            unsafe { root.add(index).write(0) };
+        }
+    }
+
+    /// Returns the entries of the root page table, which is only accessed
+    /// through `&mut self`.
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    fn root_entries(&mut self) -> *mut u64 {
+        phys_to_virt(self.pt.lock().root_paddr()).as_mut_ptr() as *mut u64
     }
 
     fn validate_region(&self, start: VirtAddr, size: usize) -> AxResult {
@@ -132,7 +265,7 @@ impl AddrSpace {
         let offset = start_vaddr.as_usize() - start_paddr.as_usize();
         let area = MemoryArea::new(start_vaddr, size, flags, Backend::new_linear(offset));
         self.areas
-            .map(area, &mut self.pt, false)
+            .map(area, &mut self.pt.lock(), false)
             .map_err(mapping_err_to_ax_err)?;
         Ok(())
     }
@@ -156,32 +289,157 @@ impl AddrSpace {
 
         let area = MemoryArea::new(start, size, flags, Backend::new_alloc(populate));
         self.areas
-            .map(area, &mut self.pt, false)
+            .map(area, &mut self.pt.lock(), false)
+            .map_err(mapping_err_to_ax_err)?;
+        Ok(())
+    }
+
+    /// Add a new private file mapping, which maps the `offset` of the file
+    /// with the given `pages` to `start`.
+    ///
+    /// See [`Backend`] for more details about the mapping backends.
+    ///
+    /// The `flags` parameter indicates the mapping permissions and attributes.
+    ///
+    /// Returns an error if the address range is out of the address space or not
+    /// aligned.
+    pub fn map_file(
+        &mut self,
+        start: VirtAddr,
+        size: usize,
+        flags: MappingFlags,
+        pages: Arc<SharedPages>,
+        offset: usize,
+    ) -> AxResult {
+        self.validate_region(start, size)?;
+        if !is_aligned_4k(offset) {
+            return ax_err!(InvalidInput, "offset not aligned");
+        }
+
+        let area = MemoryArea::new(start, size, flags, Backend::new_file(start, pages, offset));
+        self.areas
+            .map(area, &mut self.pt.lock(), false)
             .map_err(mapping_err_to_ax_err)?;
         Ok(())
     }
 
+    /// Add a new shared mapping, which maps the `offset` of `pages` to `start`.
+    ///
+    /// See [`Backend`] for more details about the mapping backends.
+    ///
+    /// The `flags` parameter indicates the mapping permissions and attributes.
+    ///
+    /// Returns an error if the address range is out of the address space or not
+    /// aligned.
+    pub fn map_shared(
+        &mut self,
+        start: VirtAddr,
+        size: usize,
+        flags: MappingFlags,
+        pages: Arc<SharedPages>,
+        offset: usize,
+    ) -> AxResult {
+        self.validate_region(start, size)?;
+        if !is_aligned_4k(offset) {
+            return ax_err!(InvalidInput, "offset not aligned");
+        }
+
+        let area = MemoryArea::new(
+            start,
+            size,
+            flags,
+            Backend::new_shared(start, pages, offset),
+        );
+        self.areas
+            .map(area, &mut self.pt.lock(), false)
+            .map_err(mapping_err_to_ax_err)?;
+        Ok(())
+    }
+
+    /// Writes the dirty pages of the shared mappings in the specified virtual
+    /// address range back to their files.
+    ///
+    /// Returns an error if the range contains unmapped pages.
+    pub fn sync(&self, start: VirtAddr, size: usize) -> AxResult {
+        self.validate_region(start, size)?;
+        let end = start + size;
+        let mut mapped = 0;
+        for area in self.areas.iter() {
+            let (sync_start, sync_end) = (start.max(area.start()), end.min(area.end()));
+            if sync_start >= sync_end {
+                continue;
+            }
+            mapped += sync_end - sync_start;
+            if let Backend::Shared {
+                start: map_start,
+                pages,
+                offset,
+            } = area.backend()
+            {
+                pages.sync(
+                    offset + (sync_start - *map_start),
+                    offset + (sync_end - *map_start),
+                )?;
+            }
+        }
+        if mapped < size {
+            return ax_err!(NoMemory);
+        }
+        Ok(())
+    }
+
     /// Populates the area with physical frames, returning false if the area
     /// contains unmapped area.
-    pub fn populate_area(&mut self, mut start: VirtAddr, size: usize) -> AxResult {
+    ///
+    /// If `access_flags` contains [`MappingFlags::WRITE`], pages in writable
+    /// areas are also made writable (e.g. copy-on-write frames are made
+    /// private), so that the memory can be written through the kernel without
+    /// faulting.
+    pub fn populate_area(
+        &self,
+        mut start: VirtAddr,
+        size: usize,
+        access_flags: MappingFlags,
+    ) -> AxResult {
         self.validate_region(start, size)?;
         let end = start + size;
+        let write = access_flags.contains(MappingFlags::WRITE);
 
         while let Some(area) = self.areas.find(start) {
             let backend = area.backend();
-            if let Backend::Alloc { populate } = backend {
-                if !*populate {
-                    for addr in PageIter4K::new(start, area.end().min(end)).unwrap() {
-                        match self.pt.query(addr) {
-                            Ok(_) => {}
-                            // If the page is not mapped, try map it.
-                            Err(PagingError::NotMapped) => {
-                                if !backend.handle_page_fault(addr, area.flags(), &mut self.pt) {
-                                    return Err(AxError::NoMemory);
-                                }
+            // Linear mappings are always mapped. Any other page may be mapped
+            // lazily, including discarded pages of populated mappings.
+            if !matches!(backend, Backend::Linear { .. }) {
+                for addr in PageIter4K::new(start, area.end().min(end)).unwrap() {
+                    let entry = self.pt.lock().query(addr);
+                    let flags = match entry {
+                        Ok((_, flags, _)) => flags,
+                        // If the page is not mapped, try map it.
+                        Err(PagingError::NotMapped) => {
+                            if !backend.handle_page_fault(
+                                addr,
+                                area.flags(),
+                                access_flags,
+                                &self.pt,
+                            ) {
+                                return Err(AxError::NoMemory);
+                            }
+                            let entry = self.pt.lock().query(addr);
+                            match entry {
+                                Ok((_, flags, _)) => flags,
+                                Err(_) => return Err(AxError::BadAddress),
                             }
-                            Err(_) => return Err(AxError::BadAddress),
-                        };
+                        }
+                        Err(_) => return Err(AxError::BadAddress),
+                    };
+                    // Copy-on-write and shared pages are mapped read-only
+                    // until the first write.
+                    if write
+                        && area.flags().contains(MappingFlags::WRITE)
+                        && !flags.contains(MappingFlags::WRITE)
+                        && !backend.handle_page_fault(addr, area.flags(), access_flags, &self.pt)
+                    {
+                        return Err(AxError::NoMemory);
                     }
                 }
             }
@@ -200,6 +458,225 @@ impl AddrSpace {
         Ok(())
     }
 
+    /// Returns the flags of the area containing `vaddr`, if any.
+    pub fn area_flags(&self, vaddr: VirtAddr) -> Option<MappingFlags> {
+        self.areas.find(vaddr).map(|area| area.flags())
+    }
+
+    /// Returns the flags and the backend of the area containing the whole range.
+    fn area_of(&self, start: VirtAddr, size: usize) -> AxResult<(MappingFlags, Backend)> {
+        match self.areas.find(start) {
+            Some(area) if start + size <= area.end() => Ok((area.flags(), area.backend().clone())),
+            _ => ax_err!(BadAddress, "range not in one area"),
+        }
+    }
+
+    /// Resizes the mapping at `[start, start + old_size)` in place, e.g. for
+    /// `mremap`.
+    ///
+    /// The range must be within one area. Shrinking unmaps the tail, and
+    /// growing extends the mapping lazily, failing with
+    /// [`AxError::AlreadyExists`] if the following range is not free.
+    pub fn resize(&mut self, start: VirtAddr, old_size: usize, new_size: usize) -> AxResult {
+        self.validate_region(start, old_size)?;
+        let (flags, backend) = self.area_of(start, old_size)?;
+        if new_size <= old_size {
+            return self.unmap(start + new_size, old_size - new_size);
+        }
+
+        let old_end = start + old_size;
+        self.validate_region(old_end, new_size - old_size)?;
+        let backend = backend
+            .moved(old_end, old_end)
+            .ok_or(AxError::InvalidInput)?;
+        let area = MemoryArea::new(old_end, new_size - old_size, flags, backend);
+        self.areas
+            .map(area, &mut self.pt.lock(), false)
+            .map_err(mapping_err_to_ax_err)
+    }
+
+    /// Checks that the mapping at `[start, start + size)` can be moved by
+    /// [`move_area`](Self::move_area).
+    pub fn check_movable(&self, start: VirtAddr, size: usize) -> AxResult {
+        self.validate_region(start, size)?;
+        let (_, backend) = self.area_of(start, size)?;
+        backend
+            .moved(start, start)
+            .map(|_| ())
+            .ok_or(AxError::InvalidInput)
+    }
+
+    /// Moves the mapping at `[old_start, old_start + old_size)` to the free
+    /// range at `new_start`, resizing it to `new_size`, e.g. for `mremap`.
+    ///
+    /// The range must be within one area. The mapped pages are moved to the
+    /// new range in the page table, without copying their data.
+    pub fn move_area(
+        &mut self,
+        old_start: VirtAddr,
+        old_size: usize,
+        new_start: VirtAddr,
+        new_size: usize,
+    ) -> AxResult {
+        self.validate_region(old_start, old_size)?;
+        self.validate_region(new_start, new_size)?;
+        let (flags, backend) = self.area_of(old_start, old_size)?;
+        let backend = backend
+            .moved(old_start, new_start)
+            .ok_or(AxError::InvalidInput)?;
+        let shared = matches!(backend, Backend::Shared { .. });
+        let area = MemoryArea::new(new_start, new_size, flags, backend);
+        self.areas
+            .map(area, &mut self.pt.lock(), false)
+            .map_err(mapping_err_to_ax_err)?;
+
+        let mut tlb_batch = TlbBatch::new(self.pt.lock().root_paddr());
+        let end = old_start + old_size.min(new_size);
+        let mut addr = old_start;
+        while addr < end {
+            let new_addr = new_start + (addr - old_start);
+            let (frame, mut flags, page_size) = match self.pt.lock().query(addr) {
+                Ok(entry) => entry,
+                Err(PagingError::NotMapped) => {
+                    addr += PAGE_SIZE_4K;
+                    continue;
+                }
+                Err(_) => return ax_err!(BadState),
+            };
+            if page_size.is_huge() {
+                if addr.is_aligned(PAGE_SIZE_2M)
+                    && new_addr.is_aligned(PAGE_SIZE_2M)
+                    && addr + PAGE_SIZE_2M <= end
+                {
+                    let (_, _, tlb) = self.pt.lock().unmap(addr).map_err(|_| AxError::BadState)?;
+                    tlb.ignore();
+                    tlb_batch.add(addr);
+                    self.pt
+                        .lock()
+                        .map(new_addr, frame, PageSize::Size2M, flags)
+                        .map_err(|_| AxError::NoMemory)?
+                        .ignore();
+                    addr += PAGE_SIZE_2M;
+                    continue;
+                }
+                if !Backend::split_huge_page(addr, &mut self.pt.lock()) {
+                    return ax_err!(NoMemory);
+                }
+                self.small_blocks
+                    .get_mut()
+                    .insert(addr.align_down(PAGE_SIZE_2M));
+                continue;
+            }
+            if shared {
+                // The writes at the new address must mark the page dirty.
+                flags.remove(MappingFlags::WRITE);
+            }
+            let mut pt = self.pt.lock();
+            let (_, _, tlb) = pt.unmap(addr).map_err(|_| AxError::BadState)?;
+            tlb.ignore();
+            tlb_batch.add(addr);
+            pt.map(new_addr, frame, PageSize::Size4K, flags)
+                .map_err(|_| AxError::NoMemory)?
+                .ignore();
+            self.small_blocks
+                .get_mut()
+                .insert(new_addr.align_down(PAGE_SIZE_2M));
+            addr += PAGE_SIZE_4K;
+        }
+
+        // Only the pages beyond the new size are left to be freed.
+        self.unmap(old_start, old_size)
+    }
+
+    /// Enables or disables huge pages for the lazy allocation mappings in the
+    /// given range, e.g. for `madvise(MADV_HUGEPAGE)`. They are enabled by
+    /// default.
+    ///
+    /// Disabling them only affects pages mapped later, and applies to every
+    /// [`PAGE_SIZE_2M`] block overlapping the range.
+    pub fn set_huge_pages(&mut self, start: VirtAddr, size: usize, enabled: bool) -> AxResult {
+        self.validate_region(start, size)?;
+        let mut block = start.align_down(PAGE_SIZE_2M);
+        while block < start + size {
+            if enabled {
+                // Blocks that already have 4K pages fall back to them again
+                // on the next fault.
+                self.small_blocks.get_mut().remove(&block);
+            } else {
+                self.small_blocks.get_mut().insert(block);
+            }
+            block += PAGE_SIZE_2M;
+        }
+        Ok(())
+    }
+
+    /// Releases the pages in the given range, while keeping the mappings, e.g.
+    /// for `madvise(MADV_DONTNEED)`.
+    ///
+    /// The next access maps a zeroed page for allocation mappings, a page read
+    /// from the file for private file mappings, and the same shared page for
+    /// shared mappings.
+    ///
+    /// Returns an error if the range contains unmapped or linear areas.
+    pub fn discard(&mut self, start: VirtAddr, size: usize) -> AxResult {
+        self.validate_region(start, size)?;
+        let end = start + size;
+        let mut discarded = 0;
+        for area in self.areas.iter() {
+            if area.end() <= start || area.start() >= end {
+                continue;
+            }
+            let area_start = area.start().max(start);
+            let area_size = area.end().min(end) - area_start;
+            let ok = match area.backend() {
+                Backend::Linear { .. } => return ax_err!(InvalidInput, "linear mapping"),
+                Backend::Alloc { .. } | Backend::File { .. } => {
+                    Backend::unmap_alloc(area_start, area_size, &mut self.pt.lock(), false)
+                }
+                Backend::Shared { .. } => {
+                    Backend::unmap_shared(area_start, area_size, &mut self.pt.lock())
+                }
+            };
+            if !ok {
+                return ax_err!(BadState);
+            }
+            discarded += area_size;
+        }
+        if discarded < size {
+            return ax_err!(NoMemory);
+        }
+        Ok(())
+    }
+
+    /// Reads the file pages of the mappings in the given range into the page
+    /// cache in advance, e.g. for `madvise(MADV_WILLNEED)`. The pages are
+    /// mapped on their first access as usual.
+    pub fn prefetch(&self, start: VirtAddr, size: usize) -> AxResult {
+        self.validate_region(start, size)?;
+        let end = start + size;
+        for area in self.areas.iter() {
+            if area.end() <= start || area.start() >= end {
+                continue;
+            }
+            let area_start = area.start().max(start);
+            let area_size = area.end().min(end) - area_start;
+            match area.backend() {
+                Backend::File {
+                    start,
+                    pages,
+                    offset,
+                }
+                | Backend::Shared {
+                    start,
+                    pages,
+                    offset,
+                } => pages.prefetch(offset + (area_start - *start), area_size),
+                _ => {}
+            }
+        }
+        Ok(())
+    }
+
     /// Removes mappings within the specified virtual address range.
     ///
     /// Returns an error if the address range is out of the address space or not
@@ -207,12 +684,31 @@ impl AddrSpace {
     pub fn unmap(&mut self, start: VirtAddr, size: usize) -> AxResult {
         self.validate_region(start, size)?;
 
+        let _pages = self.file_pages_in(start, size);
         self.areas
-            .unmap(start, size, &mut self.pt)
+            .unmap(start, size, &mut self.pt.lock())
             .map_err(mapping_err_to_ax_err)?;
         Ok(())
     }
 
+    /// Returns the cached file pages of the mappings overlapping the given
+    /// range.
+    ///
+    /// They are kept while the mappings are removed, since the last mapping of
+    /// the pages writes them back to the file, which must not be done with the
+    /// page table locked.
+    fn file_pages_in(&self, start: VirtAddr, size: usize) -> Vec<Arc<SharedPages>> {
+        let end = start + size;
+        self.areas
+            .iter()
+            .filter(|area| area.start() < end && area.end() > start)
+            .filter_map(|area| match area.backend() {
+                Backend::File { pages, .. } | Backend::Shared { pages, .. } => Some(pages.clone()),
+                _ => None,
+            })
+            .collect()
+    }
+
     /// To remove user area mappings from address space.
     pub fn unmap_user_areas(&mut self) -> AxResult {
         for area in self.areas.iter() {
@@ -225,7 +721,8 @@ impl AddrSpace {
                 "MemorySet contains out-of-va-range area"
             );
         }
-        self.areas.clear(&mut self.pt).unwrap();
+        let _pages = self.file_pages_in(self.base(), self.size());
+        self.areas.clear(&mut self.pt.lock()).unwrap();
         Ok(())
     }
 
@@ -245,7 +742,7 @@ impl AddrSpace {
     where
         F: FnMut(VirtAddr, usize, usize),
     {
-        Self::process_area_data_with_page_table(&self.pt, &self.va_range, start, size, f)
+        Self::process_area_data_with_page_table(&self.pt.lock(), &self.va_range, start, size, f)
     }
 
     fn process_area_data_with_page_table<F>(
@@ -299,6 +796,10 @@ impl AddrSpace {
 
     /// To write data to the address space.
     ///
+    /// The pages are written through their frames, so they must have been
+    /// populated with [`MappingFlags::WRITE`] (see [`AddrSpace::populate_area`])
+    /// rather than map the zero frame or a copy-on-write one.
+    ///
     /// # Arguments
     ///
     /// * `start_vaddr` - The start virtual address to write.
@@ -315,10 +816,10 @@ impl AddrSpace {
     /// aligned.
     pub fn protect(&mut self, start: VirtAddr, size: usize, flags: MappingFlags) -> AxResult {
         // Populate the area first, which also checks the address range for us.
-        self.populate_area(start, size)?;
+        self.populate_area(start, size, MappingFlags::empty())?;
 
         self.areas
-            .protect(start, size, |_| Some(flags), &mut self.pt)
+            .protect(start, size, |_| Some(flags), &mut self.pt.lock())
             .map_err(mapping_err_to_ax_err)?;
 
         Ok(())
@@ -326,7 +827,8 @@ impl AddrSpace {
 
     /// Removes all mappings in the address space.
     pub fn clear(&mut self) {
-        self.areas.clear(&mut self.pt).unwrap();
+        let _pages = self.file_pages_in(self.base(), self.size());
+        self.areas.clear(&mut self.pt.lock()).unwrap();
     }
 
     /// Checks whether an access to the specified memory region is valid.
@@ -366,71 +868,200 @@ impl AddrSpace {
     ///
     /// Returns `true` if the page fault is handled successfully (not a real
     /// fault).
-    pub fn handle_page_fault(&mut self, vaddr: VirtAddr, access_flags: MappingFlags) -> bool {
+    ///
+    /// Faults can be handled concurrently. The page table is only locked to
+    /// look up and update the faulting page, while frames are zeroed or read
+    /// from files without the lock. If another thread maps the page first,
+    /// the fault is handled by its mapping.
+    pub fn handle_page_fault(&self, vaddr: VirtAddr, access_flags: MappingFlags) -> bool {
         if !self.va_range.contains(vaddr) {
             return false;
         }
         if let Some(area) = self.areas.find(vaddr) {
             let orig_flags = area.flags();
             if orig_flags.contains(access_flags) {
-                return area
+                let block = vaddr.align_down(PAGE_SIZE_2M);
+                if HUGE_PAGES
+                    && matches!(area.backend(), Backend::Alloc { populate: false })
+                    && block >= area.start()
+                    && block + PAGE_SIZE_2M <= area.end()
+                    && !self.small_blocks.lock().contains(&block)
+                {
+                    let mapped = self.pt.lock().query(vaddr).is_ok();
+                    if !mapped {
+                        if Backend::handle_huge_page_fault_alloc(block, orig_flags, &self.pt) {
+                            return true;
+                        }
+                        self.small_blocks.lock().insert(block);
+                    }
+                }
+                let mapped = self.pt.lock().query(vaddr).is_ok();
+                if !area
                     .backend()
-                    .handle_page_fault(vaddr, orig_flags, &mut self.pt);
+                    .handle_page_fault(vaddr, orig_flags, access_flags, &self.pt)
+                {
+                    return false;
+                }
+                if !mapped {
+                    self.fault_around(area, vaddr.align_down_4k(), access_flags);
+                }
+                return true;
             }
         }
         false
     }
 
-    /// Clone a [`AddrSpace`] by re-mapping all [`MemoryArea`]s in a new page table and copying data in user space.
+    /// Maps the unmapped pages around `vaddr` after a fault has mapped it, so
+    /// that accesses to them don't fault as well.
+    ///
+    /// Nothing is mapped around the pages of allocation mappings that are not
+    /// accessed sequentially, since the frames would be wasted if they are
+    /// never accessed.
+    fn fault_around(
+        &self,
+        area: &MemoryArea<Backend>,
+        vaddr: VirtAddr,
+        access_flags: MappingFlags,
+    ) {
+        let window = FAULT_AROUND_PAGES.load(Ordering::Relaxed) * PAGE_SIZE_4K;
+        let (start, end) = match area.backend() {
+            Backend::Linear { .. } => return,
+            Backend::Alloc { .. } => {
+                let sequential = self.next_fault.load(Ordering::Relaxed) == vaddr.as_usize();
+                let end = if sequential {
+                    (vaddr + window).min(area.end())
+                } else {
+                    vaddr + PAGE_SIZE_4K
+                };
+                self.next_fault.store(end.as_usize(), Ordering::Relaxed);
+                (vaddr + PAGE_SIZE_4K, end)
+            }
+            Backend::File { .. } | Backend::Shared { .. } => {
+                let start = vaddr.align_down(window).max(area.start());
+                (start, (start + window).min(area.end()))
+            }
+        };
+        if window <= PAGE_SIZE_4K || start >= end {
+            return;
+        }
+        for addr in PageIter4K::new(start, end).unwrap() {
+            let mapped = addr == vaddr || self.pt.lock().query(addr).is_ok();
+            if !mapped
+                && !area
+                    .backend()
+                    .handle_page_fault(addr, area.flags(), access_flags, &self.pt)
+            {
+                break;
+            }
+        }
+    }
+
+    /// Clone a [`AddrSpace`] by re-mapping all [`MemoryArea`]s in a new page table.
+    ///
+    /// The populated frames of allocation and file mappings are shared with the
+    /// new address space instead of being copied. Writable ones are mapped
+    /// read-only in both address spaces and copied on the first write fault,
+    /// so the cost is proportional to the size of the page table rather than
+    /// the memory in use.
     pub fn clone_or_err(&mut self) -> AxResult<Self> {
         let mut new_aspace = Self::new_empty(self.base(), self.size())?;
+        // The stale writable entries of the pages protected below are dropped
+        // on all the CPUs running the parent before it returns, even if it
+        // fails half way.
+        let mut tlb_batch = TlbBatch::new(self.pt.lock().root_paddr());
 
         for area in self.areas.iter() {
-            let backend = area.backend();
+            let backend = match area.backend() {
+                // The frames are shared below, so nothing should be allocated
+                // when mapping the new area.
+                Backend::Alloc { .. } => Backend::new_alloc(false),
+                backend => backend.clone(),
+            };
             // Remap the memory area in the new address space.
             let new_area =
                 MemoryArea::new(area.start(), area.size(), area.flags(), backend.clone());
             new_aspace
                 .areas
-                .map(new_area, &mut new_aspace.pt, false)
+                .map(new_area, &mut new_aspace.pt.lock(), false)
                 .map_err(mapping_err_to_ax_err)?;
 
             if matches!(backend, Backend::Linear { .. }) {
                 continue;
             }
-            // Copy data from old memory area to new memory area.
+            if matches!(backend, Backend::Alloc { .. }) {
+                // Huge pages are not shared, split them so that each part can
+                // be copied on write.
+                let mut block = area.start().align_down(PAGE_SIZE_2M);
+                while block < area.end() {
+                    let huge = matches!(self.pt.lock().query(block), Ok((_, _, PageSize::Size2M)));
+                    if huge {
+                        if !Backend::split_huge_page(block, &mut self.pt.lock()) {
+                            return Err(AxError::NoMemory);
+                        }
+                        self.small_blocks.get_mut().insert(block);
+                    }
+                    block += PAGE_SIZE_2M;
+                }
+            }
+            if matches!(backend, Backend::Shared { .. }) {
+                // Shared mappings keep using the same frames, read-only until
+                // the child writes them, so that its writes mark them dirty.
+                for vaddr in PageIter4K::new(area.start(), area.end())
+                    .expect("Failed to create page iterator")
+                {
+                    let (frame, mut flags) = match self.pt.lock().query(vaddr) {
+                        Ok((paddr, flags, _)) => (paddr, flags),
+                        Err(PagingError::NotMapped) => continue,
+                        Err(_) => return Err(AxError::BadAddress),
+                    };
+                    flags.remove(MappingFlags::WRITE);
+                    new_aspace
+                        .pt
+                        .lock()
+                        .map(vaddr, frame, PageSize::Size4K, flags)
+                        .map_err(|_| AxError::NoMemory)?
+                        .ignore();
+                }
+                continue;
+            }
+            let mut cow_flags = area.flags();
+            cow_flags.remove(MappingFlags::WRITE);
+            // Share the frames from old memory area with the new memory area.
             for vaddr in
                 PageIter4K::new(area.start(), area.end()).expect("Failed to create page iterator")
             {
-                let addr = match self.pt.query(vaddr) {
-                    Ok((paddr, _, _)) => paddr,
+                let (frame, flags) = match self.pt.lock().query(vaddr) {
+                    Ok((paddr, flags, _)) => (paddr, flags),
                     // If the page is not mapped, skip it.
                     Err(PagingError::NotMapped) => continue,
                     Err(_) => return Err(AxError::BadAddress),
                 };
-                let new_addr = match new_aspace.pt.query(vaddr) {
-                    Ok((paddr, _, _)) => paddr,
-                    // If the page is not mapped, try map it.
-                    Err(PagingError::NotMapped) => {
-                        if !backend.handle_page_fault(vaddr, area.flags(), &mut new_aspace.pt) {
-                            return Err(AxError::NoMemory);
-                        }
-                        match new_aspace.pt.query(vaddr) {
-                            Ok((paddr, _, _)) => paddr,
-                            Err(_) => return Err(AxError::BadAddress),
-                        }
-                    }
-                    Err(_) => return Err(AxError::BadAddress),
-                };
-                unsafe {
-                    core::ptr::copy_nonoverlapping(
-                        phys_to_virt(addr).as_ptr(),
-                        phys_to_virt(new_addr).as_mut_ptr(),
-                        PAGE_SIZE_4K,
-                    )
-                };
+                if flags.contains(MappingFlags::WRITE) {
+                    self.pt
+                        .lock()
+                        .protect_region(vaddr, PAGE_SIZE_4K, cow_flags, false)
+                        .map_err(|_| AxError::BadAddress)?
+                        .ignore();
+                    tlb_batch.add(vaddr);
+                }
+                new_aspace
+                    .pt
+                    .lock()
+                    .map(vaddr, frame, PageSize::Size4K, cow_flags)
+                    .map_err(|_| AxError::NoMemory)?
+                    .ignore();
+                share_frame(frame);
+                new_aspace
+                    .small_blocks
+                    .get_mut()
+                    .insert(vaddr.align_down(PAGE_SIZE_2M));
             }
         }
+        tlb_batch.flush();
+        new_aspace
+            .small_blocks
+            .get_mut()
+            .extend(self.small_blocks.get_mut().iter().copied());
         Ok(new_aspace)
     }
 }
@@ -439,7 +1070,7 @@ impl fmt::Debug for AddrSpace {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         f.debug_struct("AddrSpace")
             .field("va_range", &self.va_range)
-            .field("page_table_root", &self.pt.root_paddr())
+            .field("page_table_root", &self.pt.lock().root_paddr())
             .field("areas", &self.areas)
             .finish()
     }
@@ -447,6 +1078,8 @@ impl fmt::Debug for AddrSpace {
 
 impl Drop for AddrSpace {
     fn drop(&mut self) {
+        #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+        self.unshare_kernel_mappings();
         self.clear();
     }
 }
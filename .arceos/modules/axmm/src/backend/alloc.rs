@@ -1,11 +1,74 @@
+use alloc::vec::Vec;
+use core::sync::atomic::{AtomicU32, AtomicUsize, Ordering};
+
 use axalloc::global_allocator;
+use axconfig::plat::{PHYS_MEMORY_BASE, PHYS_MEMORY_SIZE};
+use axhal::cpu::this_cpu_id;
 use axhal::mem::{phys_to_virt, virt_to_phys};
-use axhal::paging::{MappingFlags, PageSize, PageTable};
-use memory_addr::{PAGE_SIZE_4K, PageIter4K, PhysAddr, VirtAddr};
+use axhal::paging::{MappingFlags, PageSize, PageTable, PagingError};
+use kspin::SpinNoIrq;
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, PageIter4K, PhysAddr, VirtAddr};
 
 use super::Backend;
+use crate::tlb::TlbBatch;
+
+const FRAME_COUNT: usize = PHYS_MEMORY_SIZE / PAGE_SIZE_4K;
+
+/// Reference counts of the frames mapped by more than one address space
+/// (e.g. shared between parent and child after fork), indexed by frame number.
+/// Frames with a single owner count 0, so that freeing them takes no lock.
+static FRAME_REFS: [AtomicU32; FRAME_COUNT] = [const { AtomicU32::new(0) }; FRAME_COUNT];
+
+fn frame_refs(frame: PhysAddr) -> &'static AtomicU32 {
+    &FRAME_REFS[(frame.as_usize() - PHYS_MEMORY_BASE) / PAGE_SIZE_4K]
+}
+
+/// The frame mapped read-only by read faults on allocation mappings, until
+/// the first write copies it. It is allocated on first use and never freed.
+static ZERO_FRAME: AtomicUsize = AtomicUsize::new(0);
+
+/// The size of the huge pages used for large allocation mappings.
+pub const PAGE_SIZE_2M: usize = 0x20_0000;
+
+const HUGE_PAGE_FRAMES: usize = PAGE_SIZE_2M / PAGE_SIZE_4K;
+
+/// The number of zeroed frames kept in advance for each CPU.
+const ZEROED_POOL_SIZE: usize = 64;
+
+/// The number of frames zeroed by each call to [`refill_zeroed_frames`].
+const ZEROED_REFILL_BATCH: usize = 16;
+
+/// Frames zeroed in advance by [`refill_zeroed_frames`] for each CPU, taken by
+/// [`alloc_frame`] instead of zeroing a frame on the spot.
+static ZEROED_FRAMES: [SpinNoIrq<Vec<PhysAddr>>; axconfig::SMP] =
+    [const { SpinNoIrq::new(Vec::new()) }; axconfig::SMP];
+
+/// Zeroes some frames in advance for the current CPU, until its pool of
+/// zeroed frames is full.
+///
+/// It is meant to run in the idle task, which takes the zeroing off the page
+/// fault path. At most a small batch of frames is zeroed per call, so that
+/// tasks woken up meanwhile are not delayed for long.
+pub fn refill_zeroed_frames() {
+    let pool = &ZEROED_FRAMES[this_cpu_id()];
+    for _ in 0..ZEROED_REFILL_BATCH {
+        if pool.lock().len() >= ZEROED_POOL_SIZE {
+            break;
+        }
+        let Some(frame) = alloc_frame(false) else {
+            break;
+        };
+        unsafe { core::ptr::write_bytes(phys_to_virt(frame).as_mut_ptr(), 0, PAGE_SIZE_4K) };
+        pool.lock().push(frame);
+    }
+}
 
-fn alloc_frame(zeroed: bool) -> Option<PhysAddr> {
+pub(super) fn alloc_frame(zeroed: bool) -> Option<PhysAddr> {
+    if zeroed {
+        if let Some(frame) = ZEROED_FRAMES[this_cpu_id()].lock().pop() {
+            return Some(frame);
+        }
+    }
     let vaddr = VirtAddr::from(global_allocator().alloc_pages(1, PAGE_SIZE_4K).ok()?);
     if zeroed {
         unsafe { core::ptr::write_bytes(vaddr.as_mut_ptr(), 0, PAGE_SIZE_4K) };
@@ -14,11 +77,100 @@ fn alloc_frame(zeroed: bool) -> Option<PhysAddr> {
     Some(paddr)
 }
 
-fn dealloc_frame(frame: PhysAddr) {
+fn zero_frame() -> Option<PhysAddr> {
+    let frame = ZERO_FRAME.load(Ordering::Acquire);
+    if frame != 0 {
+        return Some(PhysAddr::from(frame));
+    }
+    let new_frame = alloc_frame(true)?;
+    match ZERO_FRAME.compare_exchange(0, new_frame.as_usize(), Ordering::AcqRel, Ordering::Acquire)
+    {
+        Ok(_) => Some(new_frame),
+        Err(frame) => {
+            dealloc_frame(new_frame);
+            Some(PhysAddr::from(frame))
+        }
+    }
+}
+
+pub(crate) fn is_zero_frame(frame: PhysAddr) -> bool {
+    frame.as_usize() == ZERO_FRAME.load(Ordering::Relaxed)
+}
+
+/// Allocates the zeroed, contiguous frames of a huge page.
+///
+/// Huge pages are never shared. They are split into 4K pages before that, and
+/// the frames are then deallocated one by one as usual.
+fn alloc_huge_frame() -> Option<PhysAddr> {
+    let vaddr = VirtAddr::from(
+        global_allocator()
+            .alloc_pages(HUGE_PAGE_FRAMES, PAGE_SIZE_2M)
+            .ok()?,
+    );
+    unsafe { core::ptr::write_bytes(vaddr.as_mut_ptr(), 0, PAGE_SIZE_2M) };
+    Some(virt_to_phys(vaddr))
+}
+
+fn dealloc_huge_frame(frame: PhysAddr) {
+    global_allocator().dealloc_pages(phys_to_virt(frame).as_usize(), HUGE_PAGE_FRAMES);
+}
+
+/// Adds a reference to a frame that is going to be mapped copy-on-write by
+/// another address space.
+pub(crate) fn share_frame(frame: PhysAddr) {
+    if is_zero_frame(frame) {
+        return;
+    }
+    let _ = frame_refs(frame).fetch_update(Ordering::AcqRel, Ordering::Acquire, |count| {
+        Some(count.max(1) + 1)
+    });
+}
+
+fn is_frame_shared(frame: PhysAddr) -> bool {
+    is_zero_frame(frame) || frame_refs(frame).load(Ordering::Acquire) != 0
+}
+
+/// Drops a reference to the frame, deallocating it if it was the last one.
+pub(super) fn dealloc_frame(frame: PhysAddr) {
+    if is_zero_frame(frame) {
+        return;
+    }
+    let refs = frame_refs(frame);
+    let mut count = refs.load(Ordering::Acquire);
+    while count != 0 {
+        // The last two owners go back to a single one.
+        let new = if count == 2 { 0 } else { count - 1 };
+        match refs.compare_exchange_weak(count, new, Ordering::AcqRel, Ordering::Acquire) {
+            Ok(_) => return,
+            Err(current) => count = current,
+        }
+    }
     let vaddr = phys_to_virt(frame);
     global_allocator().dealloc_pages(vaddr.as_usize(), 1);
 }
 
+/// Maps `frame` at the page `vaddr` for a page fault, unless another thread
+/// has mapped the page since the fault was taken.
+///
+/// Returns whether `frame` has been mapped. Either way the fault is handled,
+/// and the frame is left to the caller if not mapped.
+pub(super) fn map_fault_page(
+    vaddr: VirtAddr,
+    frame: PhysAddr,
+    flags: MappingFlags,
+    pt: &SpinNoIrq<PageTable>,
+) -> Result<bool, PagingError> {
+    let mut pt = pt.lock();
+    match pt.query(vaddr) {
+        Ok(_) => Ok(false),
+        Err(PagingError::NotMapped) => {
+            pt.map(vaddr, frame, PageSize::Size4K, flags)?.flush();
+            Ok(true)
+        }
+        Err(e) => Err(e),
+    }
+}
+
 impl Backend {
     /// Creates a new allocation mapping backend.
     pub const fn new_alloc(populate: bool) -> Self {
@@ -63,18 +215,104 @@ impl Backend {
         _populate: bool,
     ) -> bool {
         debug!("unmap_alloc: [{:#x}, {:#x})", start, start + size);
-        for addr in PageIter4K::new(start, start + size).unwrap() {
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        // The frames are freed once no CPU can access them through stale TLB
+        // entries anymore.
+        let mut freed = Vec::new();
+        let end = start + size;
+        let mut addr = start;
+        let unmapped = loop {
+            if addr >= end {
+                break true;
+            }
+            if let Ok((_, _, PageSize::Size2M)) = pt.query(addr) {
+                if addr.is_aligned(PAGE_SIZE_2M) && addr + PAGE_SIZE_2M <= end {
+                    match pt.unmap(addr) {
+                        Ok((frame, _, tlb)) => {
+                            tlb.ignore();
+                            tlb_batch.add(addr);
+                            freed.push((frame, true));
+                        }
+                        Err(_) => break false,
+                    }
+                    addr += PAGE_SIZE_2M;
+                    continue;
+                }
+                // Only part of the huge page is unmapped.
+                if !Self::split_huge_page(addr, pt) {
+                    break false;
+                }
+            }
             if let Ok((frame, page_size, tlb)) = pt.unmap(addr) {
                 // Deallocate the physical frame if there is a mapping in the
                 // page table.
                 if page_size.is_huge() {
-                    return false;
+                    break false;
                 }
-                tlb.flush();
-                dealloc_frame(frame);
+                tlb.ignore();
+                tlb_batch.add(addr);
+                freed.push((frame, false));
             } else {
                 // Deallocation is needn't if the page is not mapped.
             }
+            addr += PAGE_SIZE_4K;
+        };
+        tlb_batch.flush();
+        for (frame, huge) in freed {
+            if huge {
+                dealloc_huge_frame(frame);
+            } else {
+                dealloc_frame(frame);
+            }
+        }
+        unmapped
+    }
+
+    pub(crate) fn protect_alloc(
+        start: VirtAddr,
+        size: usize,
+        new_flags: MappingFlags,
+        pt: &mut PageTable,
+    ) -> bool {
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        let end = start + size;
+        let mut addr = start;
+        while addr < end {
+            if let Ok((_, _, PageSize::Size2M)) = pt.query(addr) {
+                if addr.is_aligned(PAGE_SIZE_2M) && addr + PAGE_SIZE_2M <= end {
+                    match pt.protect_region(addr, PAGE_SIZE_2M, new_flags, true) {
+                        Ok(tlb) => {
+                            tlb.ignore();
+                            tlb_batch.add(addr);
+                        }
+                        Err(_) => return false,
+                    }
+                    addr += PAGE_SIZE_2M;
+                    continue;
+                }
+                if !Self::split_huge_page(addr, pt) {
+                    return false;
+                }
+            }
+            let mut flags = new_flags;
+            match pt.query(addr) {
+                // Shared frames stay read-only until the copy-on-write fault.
+                Ok((frame, _, _)) if is_frame_shared(frame) => flags.remove(MappingFlags::WRITE),
+                Ok(_) => {}
+                Err(PagingError::NotMapped) => {
+                    addr += PAGE_SIZE_4K;
+                    continue;
+                }
+                Err(_) => return false,
+            }
+            match pt.protect_region(addr, PAGE_SIZE_4K, flags, false) {
+                Ok(tlb) => {
+                    tlb.ignore();
+                    tlb_batch.add(addr);
+                }
+                Err(_) => return false,
+            }
+            addr += PAGE_SIZE_4K;
         }
         true
     }
@@ -82,20 +320,179 @@ impl Backend {
     pub(crate) fn handle_page_fault_alloc(
         vaddr: VirtAddr,
         orig_flags: MappingFlags,
-        pt: &mut PageTable,
-        populate: bool,
+        write: bool,
+        pt: &SpinNoIrq<PageTable>,
     ) -> bool {
-        if populate {
-            false // Populated mappings should not trigger page faults.
-        } else if let Some(frame) = alloc_frame(true) {
-            // Allocate a physical frame lazily and map it to the fault address.
-            // `vaddr` does not need to be aligned. It will be automatically
-            // aligned during `pt.map` regardless of the page size.
-            pt.map(vaddr, frame, PageSize::Size4K, orig_flags)
-                .map(|tlb| tlb.flush())
-                .is_ok()
+        let vaddr = vaddr.align_down_4k();
+        {
+            let mut pt = pt.lock();
+            match pt.query(vaddr) {
+                // A present page only faults if it is copy-on-write, or if
+                // another thread has just mapped it.
+                Ok((frame, flags, _)) => {
+                    return if write
+                        && orig_flags.contains(MappingFlags::WRITE)
+                        && !flags.contains(MappingFlags::WRITE)
+                    {
+                        Self::break_cow(vaddr, frame, orig_flags, &mut pt)
+                    } else {
+                        Self::spurious_fault(vaddr, &pt)
+                    };
+                }
+                // Populated mappings only fault after their pages are
+                // discarded, e.g. by `madvise(MADV_DONTNEED)`.
+                Err(PagingError::NotMapped) => {}
+                Err(_) => return false,
+            }
+        }
+
+        // Allocate a physical frame lazily and map it to the fault address.
+        // It is zeroed without holding the page table lock, so that faults
+        // of other threads are not held up. Reads map the zero frame until
+        // the first write instead.
+        let (frame, flags) = if write {
+            (alloc_frame(true), orig_flags)
         } else {
-            false
+            let mut flags = orig_flags;
+            flags.remove(MappingFlags::WRITE);
+            (zero_frame(), flags)
+        };
+        let Some(frame) = frame else {
+            return false;
+        };
+        match map_fault_page(vaddr, frame, flags, pt) {
+            Ok(true) => true,
+            Ok(false) => {
+                dealloc_frame(frame);
+                true
+            }
+            Err(_) => {
+                dealloc_frame(frame);
+                false
+            }
         }
     }
+
+    /// Maps a zeroed huge page at `vaddr`, which must be aligned to
+    /// [`PAGE_SIZE_2M`], for a fault in a lazy allocation mapping.
+    ///
+    /// Fails if any page in the range has been mapped before, in which case the
+    /// fault should be handled with 4K pages.
+    pub(crate) fn handle_huge_page_fault_alloc(
+        vaddr: VirtAddr,
+        orig_flags: MappingFlags,
+        pt: &SpinNoIrq<PageTable>,
+    ) -> bool {
+        let Some(frame) = alloc_huge_frame() else {
+            return false;
+        };
+        let mut pt = pt.lock();
+        match pt.map(vaddr, frame, PageSize::Size2M, orig_flags) {
+            Ok(tlb) => {
+                tlb.flush();
+                true
+            }
+            Err(_) => {
+                dealloc_huge_frame(frame);
+                // Another thread may have mapped the same huge page.
+                matches!(pt.query(vaddr), Ok((_, _, PageSize::Size2M)))
+            }
+        }
+    }
+
+    /// Handles a fault on a page that is already mapped as required, which
+    /// happens when another thread maps it first. The stale TLB entries, if
+    /// any, are dropped on all the CPUs using the page table, e.g. that of the
+    /// read-only zero frame a write has just replaced, and the access retried.
+    pub(super) fn spurious_fault(vaddr: VirtAddr, pt: &PageTable) -> bool {
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        tlb_batch.add(vaddr);
+        true
+    }
+
+    /// Splits the huge page containing `vaddr`, if any, into 4K pages mapping
+    /// the same frames with the same flags.
+    ///
+    /// The huge page is flushed from the TLBs of all the CPUs using the page
+    /// table before the 4K pages are mapped.
+    pub(crate) fn split_huge_page(vaddr: VirtAddr, pt: &mut PageTable) -> bool {
+        let start = vaddr.align_down(PAGE_SIZE_2M);
+        let (frame, flags) = match pt.query(start) {
+            Ok((frame, flags, PageSize::Size2M)) => (frame, flags),
+            _ => return true,
+        };
+        match pt.unmap(start) {
+            Ok((_, _, tlb)) => {
+                tlb.ignore();
+                let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+                tlb_batch.add(start);
+                tlb_batch.flush();
+            }
+            Err(_) => return false,
+        }
+        for offset in (0..PAGE_SIZE_2M).step_by(PAGE_SIZE_4K) {
+            match pt.map(start + offset, frame + offset, PageSize::Size4K, flags) {
+                Ok(tlb) => tlb.ignore(),
+                Err(_) => return false,
+            }
+        }
+        true
+    }
+
+    /// Gives the faulting address space a private, writable copy of a
+    /// copy-on-write frame.
+    ///
+    /// The other threads of the address space may run on other CPUs with the
+    /// read-only page in their TLBs, which are flushed before the frame can be
+    /// freed.
+    pub(super) fn break_cow(
+        vaddr: VirtAddr,
+        frame: PhysAddr,
+        flags: MappingFlags,
+        pt: &mut PageTable,
+    ) -> bool {
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        if !is_frame_shared(frame) {
+            // All other sharers are gone, so the frame can be reused as is.
+            return match pt.protect_region(vaddr, PAGE_SIZE_4K, flags, false) {
+                Ok(tlb) => {
+                    tlb.ignore();
+                    tlb_batch.add(vaddr);
+                    true
+                }
+                Err(_) => false,
+            };
+        }
+
+        let zero = is_zero_frame(frame);
+        let Some(new_frame) = alloc_frame(zero) else {
+            return false;
+        };
+        if !zero {
+            unsafe {
+                core::ptr::copy_nonoverlapping(
+                    phys_to_virt(frame).as_ptr(),
+                    phys_to_virt(new_frame).as_mut_ptr(),
+                    PAGE_SIZE_4K,
+                )
+            };
+        }
+        match pt.unmap(vaddr) {
+            Ok((_, _, tlb)) => {
+                tlb.ignore();
+                tlb_batch.add(vaddr);
+                tlb_batch.flush();
+            }
+            Err(_) => {
+                dealloc_frame(new_frame);
+                return false;
+            }
+        }
+        if pt.map(vaddr, new_frame, PageSize::Size4K, flags).is_err() {
+            dealloc_frame(new_frame);
+            return false;
+        }
+        dealloc_frame(frame);
+        true
+    }
 }
@@ -0,0 +1,88 @@
+use alloc::sync::Arc;
+
+use axerrno::AxResult;
+use axhal::paging::{MappingFlags, PageTable, PagingError};
+use kspin::SpinNoIrq;
+use memory_addr::{MemoryAddr, VirtAddr};
+
+use super::alloc::{dealloc_frame, map_fault_page, share_frame};
+use super::{Backend, SharedPages};
+
+/// A file whose content can be mapped with [`Backend::File`].
+pub trait MappedFile: Send + Sync {
+    /// Reads the file content at `offset` into `buf`.
+    ///
+    /// Returns the number of bytes read, which may be less than the size of
+    /// `buf` at the end of the file.
+    fn read_at(&self, offset: u64, buf: &mut [u8]) -> AxResult<usize>;
+
+    /// Writes `buf` to the file at `offset`, returning the number of bytes
+    /// written.
+    fn write_at(&self, offset: u64, buf: &[u8]) -> AxResult<usize>;
+
+    /// Returns the size of the file in bytes.
+    fn size(&self) -> AxResult<u64>;
+}
+
+impl Backend {
+    /// Creates a new private file mapping backend, which maps the `offset` of
+    /// `pages` to `start`.
+    pub fn new_file(start: VirtAddr, pages: Arc<SharedPages>, offset: usize) -> Self {
+        Self::File {
+            start,
+            pages,
+            offset,
+        }
+    }
+
+    pub(crate) fn handle_page_fault_file(
+        vaddr: VirtAddr,
+        orig_flags: MappingFlags,
+        write: bool,
+        pt: &SpinNoIrq<PageTable>,
+        offset: usize,
+        pages: &SharedPages,
+    ) -> bool {
+        let vaddr = vaddr.align_down_4k();
+        {
+            let mut pt = pt.lock();
+            match pt.query(vaddr) {
+                // A present page only faults if it is copy-on-write, or if
+                // another thread has just mapped it.
+                Ok((frame, flags, _)) => {
+                    return if write
+                        && orig_flags.contains(MappingFlags::WRITE)
+                        && !flags.contains(MappingFlags::WRITE)
+                    {
+                        Self::break_cow(vaddr, frame, orig_flags, &mut pt)
+                    } else {
+                        Self::spurious_fault(vaddr, &pt)
+                    };
+                }
+                Err(PagingError::NotMapped) => {}
+                Err(_) => return false,
+            }
+        }
+
+        // Map the cached page read-only, which is copied on the first write
+        // like any other shared frame. The file is read without holding the
+        // page table lock.
+        let Some(frame) = pages.frame(offset) else {
+            return false;
+        };
+        share_frame(frame);
+        let mut flags = orig_flags;
+        flags.remove(MappingFlags::WRITE);
+        match map_fault_page(vaddr, frame, flags, pt) {
+            Ok(true) => true,
+            Ok(false) => {
+                dealloc_frame(frame);
+                true
+            }
+            Err(_) => {
+                dealloc_frame(frame);
+                false
+            }
+        }
+    }
+}
@@ -1,7 +1,57 @@
-use axhal::paging::{MappingFlags, PageTable};
-use memory_addr::{PhysAddr, VirtAddr};
+use core::sync::atomic::{Ordering, fence};
+
+use axalloc::global_allocator;
+use axhal::arch::flush_tlb;
+use axhal::mem::{phys_to_virt, virt_to_phys};
+use axhal::paging::{GenericPTE, MappingFlags, PageSize, PageTable, PageTableEntry};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, PhysAddr, VirtAddr};
 
 use super::Backend;
+use crate::tlb::TlbBatch;
+
+/// The page sizes of the linear mappings, from the largest.
+///
+/// On RISC-V, 1G pages are entries of the root table, which the user page
+/// tables copy instead of sharing the tables below, so they could not be
+/// split later.
+#[cfg(not(target_arch = "riscv64"))]
+const PAGE_SIZES: &[PageSize] = &[PageSize::Size1G, PageSize::Size2M, PageSize::Size4K];
+#[cfg(target_arch = "riscv64")]
+const PAGE_SIZES: &[PageSize] = &[PageSize::Size2M, PageSize::Size4K];
+
+/// The number of levels of the page table.
+#[cfg(not(target_arch = "riscv64"))]
+const LEVELS: usize = 4;
+#[cfg(target_arch = "riscv64")]
+const LEVELS: usize = 3;
+
+const ENTRIES_PER_TABLE: usize = PAGE_SIZE_4K / size_of::<PageTableEntry>();
+
+/// Returns the entry of `pt` mapping the huge page of `page_size` containing
+/// `vaddr`.
+fn huge_entry(
+    pt: &mut PageTable,
+    vaddr: VirtAddr,
+    page_size: PageSize,
+) -> Option<&mut PageTableEntry> {
+    let mut table = pt.root_paddr();
+    for level in (0..LEVELS).rev() {
+        let shift = 12 + 9 * level;
+        let index = (vaddr.as_usize() >> shift) % ENTRIES_PER_TABLE;
+        // SAFETY: the tables of `pt` are whole frames, only accessed through
+        // `&mut pt`.
+        let entry =
+            unsafe { &mut *(phys_to_virt(table).as_mut_ptr() as *mut PageTableEntry).add(index) };
+        if 1 << shift == page_size as usize {
+            return entry.is_huge().then_some(entry);
+        }
+        if !entry.is_present() || entry.is_huge() {
+            return None;
+        }
+        table = entry.paddr();
+    }
+    None
+}
 
 impl Backend {
     /// Creates a new linear mapping backend.
@@ -9,6 +59,8 @@ impl Backend {
         Self::Linear { pa_va_offset }
     }
 
+    /// Maps the region with the largest pages its alignment allows, so that
+    /// the linear mapping of the physical memory takes few TLB entries.
     pub(crate) fn map_linear(
         start: VirtAddr,
         size: usize,
@@ -25,9 +77,28 @@ impl Backend {
             va_to_pa(start + size),
             flags
         );
-        pt.map_region(start, va_to_pa, size, flags, false, false)
-            .map(|tlb| tlb.ignore()) // TLB flush on map is unnecessary, as there are no outdated mappings.
-            .is_ok()
+        let end = start + size;
+        let mut vaddr = start;
+        while vaddr < end {
+            let paddr = va_to_pa(vaddr);
+            let page_size = PAGE_SIZES
+                .iter()
+                .copied()
+                .find(|&page_size| {
+                    let page_size = page_size as usize;
+                    vaddr.is_aligned(page_size)
+                        && paddr.is_aligned(page_size)
+                        && end - vaddr >= page_size
+                })
+                .unwrap_or(PageSize::Size4K);
+            match pt.map(vaddr, paddr, page_size, flags) {
+                // TLB flush on map is unnecessary, as there are no outdated mappings.
+                Ok(tlb) => tlb.ignore(),
+                Err(_) => return false,
+            }
+            vaddr += page_size as usize;
+        }
+        true
     }
 
     pub(crate) fn unmap_linear(
@@ -37,8 +108,99 @@ impl Backend {
         _pa_va_offset: usize,
     ) -> bool {
         debug!("unmap_linear: [{:#x}, {:#x})", start, start + size);
-        pt.unmap_region(start, size, true)
-            .map(|tlb| tlb.ignore()) // flush each page on unmap, do not flush the entire TLB.
-            .is_ok()
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        let end = start + size;
+        let mut vaddr = start;
+        while vaddr < end {
+            let page_size = match Self::linear_page(vaddr, end, pt) {
+                Some(page_size) => page_size,
+                None => return false,
+            };
+            match pt.unmap(vaddr) {
+                Ok((_, _, tlb)) => {
+                    tlb.ignore();
+                    tlb_batch.add(vaddr);
+                }
+                Err(_) => return false,
+            }
+            vaddr += page_size as usize;
+        }
+        true
+    }
+
+    pub(crate) fn protect_linear(
+        start: VirtAddr,
+        size: usize,
+        new_flags: MappingFlags,
+        pt: &mut PageTable,
+    ) -> bool {
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        let end = start + size;
+        let mut vaddr = start;
+        while vaddr < end {
+            let page_size = match Self::linear_page(vaddr, end, pt) {
+                Some(page_size) => page_size,
+                None => return false,
+            };
+            match pt.protect_region(vaddr, page_size as usize, new_flags, false) {
+                Ok(tlb) => {
+                    tlb.ignore();
+                    tlb_batch.add(vaddr);
+                }
+                Err(_) => return false,
+            }
+            vaddr += page_size as usize;
+        }
+        true
+    }
+
+    /// Returns the size of the page mapped at `vaddr`, after splitting it
+    /// until it ends before `end`.
+    fn linear_page(vaddr: VirtAddr, end: VirtAddr, pt: &mut PageTable) -> Option<PageSize> {
+        loop {
+            let (_, _, page_size) = pt.query(vaddr).ok()?;
+            if !page_size.is_huge()
+                || (vaddr.is_aligned(page_size as usize) && end - vaddr >= page_size as usize)
+            {
+                return Some(page_size);
+            }
+            if !Self::split_linear_page(vaddr, page_size, pt) {
+                return None;
+            }
+        }
+    }
+
+    /// Splits the huge page of `page_size` containing `vaddr` into pages of
+    /// the next smaller size, mapping the same frames with the same flags.
+    ///
+    /// Unlike [`Backend::split_huge_page`], the page stays mapped all along,
+    /// as the kernel may be running on it, e.g. on a stack in the linear
+    /// mapping: the huge entry is replaced by one of a table filled in
+    /// advance.
+    fn split_linear_page(vaddr: VirtAddr, page_size: PageSize, pt: &mut PageTable) -> bool {
+        let (small_size, small_huge) = match page_size {
+            PageSize::Size1G => (PageSize::Size2M, true),
+            PageSize::Size2M => (PageSize::Size4K, false),
+            _ => return true,
+        };
+        let Some(entry) = huge_entry(pt, vaddr, page_size) else {
+            return false;
+        };
+        let Ok(table) = global_allocator().alloc_pages(1, PAGE_SIZE_4K) else {
+            return false;
+        };
+        let (frame, flags) = (entry.paddr(), entry.flags());
+        // SAFETY: the table is a newly allocated frame.
+        let entries = unsafe {
+            core::slice::from_raw_parts_mut(table as *mut PageTableEntry, ENTRIES_PER_TABLE)
+        };
+        for (i, small) in entries.iter_mut().enumerate() {
+            *small = PageTableEntry::new_page(frame + i * small_size as usize, flags, small_huge);
+        }
+        // The table must be written before the page walker can reach it.
+        fence(Ordering::SeqCst);
+        *entry = PageTableEntry::new_table(virt_to_phys(table.into()));
+        flush_tlb(None);
+        true
     }
 }
@@ -1,20 +1,34 @@
 //! Memory mapping backends.
 
+use ::alloc::sync::Arc;
 use axhal::paging::{MappingFlags, PageTable};
-use memory_addr::VirtAddr;
+use kspin::SpinNoIrq;
+use memory_addr::{MemoryAddr, VirtAddr};
 use memory_set::MappingBackend;
 
 mod alloc;
+mod file;
 mod linear;
+mod shared;
+
+pub(crate) use self::alloc::{is_zero_frame, share_frame};
+pub use self::alloc::{PAGE_SIZE_2M, refill_zeroed_frames};
+pub use self::file::MappedFile;
+pub use self::shared::SharedPages;
 
 /// A unified enum type for different memory mapping backends.
 ///
-/// Currently, two backends are implemented:
+/// Currently, four backends are implemented:
 ///
 /// - **Linear**: used for linear mappings. The target physical frames are
 ///   contiguous and their addresses should be known when creating the mapping.
+///   They are mapped with huge pages wherever the alignment allows.
 /// - **Allocation**: used in general, or for lazy mappings. The target physical
-///   frames are obtained from the global allocator.
+///   frames are obtained from the global allocator, as huge pages if possible.
+/// - **File**: used for private file mappings. The target physical frames are
+///   taken from the page cache of the file on demand, and copied on write.
+/// - **Shared**: used for shared mappings. The target physical frames are
+///   shared by all the mappings of the same file (see [`SharedPages`]).
 #[derive(Clone)]
 pub enum Backend {
     /// Linear mapping backend.
@@ -32,10 +46,44 @@ pub enum Backend {
     /// mapping is created, and no page faults are triggered during the memory
     /// access. Otherwise, the physical frames are allocated on demand (by
     /// handling page faults).
+    ///
+    /// Frames may be shared copy-on-write with other address spaces after
+    /// [`AddrSpace::clone_or_err`](crate::AddrSpace::clone_or_err). They are
+    /// mapped read-only and copied on the first write fault.
     Alloc {
         /// Whether to populate the physical frames when creating the mapping.
         populate: bool,
     },
+    /// Private file mapping backend.
+    ///
+    /// Each page is mapped read-only from the [`SharedPages`] of the file on
+    /// its first access, so unmodified pages are shared by all mappings. The
+    /// first write copies the page, which never reaches the file. The frames
+    /// can be shared copy-on-write as with [`Backend::Alloc`].
+    File {
+        /// The virtual address mapped to `offset` of the file.
+        ///
+        /// The area may be split or shrunk later, so the file offset of a page
+        /// is always computed relative to this address.
+        start: VirtAddr,
+        /// The pages of the mapped file.
+        pages: Arc<SharedPages>,
+        /// The file offset of `start`.
+        offset: usize,
+    },
+    /// Shared mapping backend.
+    ///
+    /// The frames are taken from [`SharedPages`] on the first access, so
+    /// writes are visible to all mappings and written back to the file. They
+    /// are kept shared across [`AddrSpace::clone_or_err`](crate::AddrSpace::clone_or_err).
+    Shared {
+        /// The virtual address mapped to `offset` of the pages.
+        start: VirtAddr,
+        /// The shared pages.
+        pages: Arc<SharedPages>,
+        /// The file offset of `start`.
+        offset: usize,
+    },
 }
 
 impl MappingBackend for Backend {
@@ -46,6 +94,8 @@ impl MappingBackend for Backend {
         match *self {
             Self::Linear { pa_va_offset } => Self::map_linear(start, size, flags, pt, pa_va_offset),
             Self::Alloc { populate } => Self::map_alloc(start, size, flags, pt, populate),
+            // Pages are read from the file on demand.
+            Self::File { .. } | Self::Shared { .. } => true,
         }
     }
 
@@ -53,6 +103,8 @@ impl MappingBackend for Backend {
         match *self {
             Self::Linear { pa_va_offset } => Self::unmap_linear(start, size, pt, pa_va_offset),
             Self::Alloc { populate } => Self::unmap_alloc(start, size, pt, populate),
+            Self::File { .. } => Self::unmap_alloc(start, size, pt, false),
+            Self::Shared { .. } => Self::unmap_shared(start, size, pt),
         }
     }
 
@@ -63,24 +115,69 @@ impl MappingBackend for Backend {
         new_flags: Self::Flags,
         page_table: &mut Self::PageTable,
     ) -> bool {
-        page_table
-            .protect_region(start, size, new_flags, true)
-            .map(|tlb| tlb.ignore())
-            .is_ok()
+        match *self {
+            Self::Alloc { .. } | Self::File { .. } => {
+                Self::protect_alloc(start, size, new_flags, page_table)
+            }
+            Self::Shared { .. } => Self::protect_shared(start, size, new_flags, page_table),
+            Self::Linear { .. } => Self::protect_linear(start, size, new_flags, page_table),
+        }
     }
 }
 
 impl Backend {
+    /// Returns the backend of a new area at `to`, which maps what is mapped at
+    /// `from` by this backend, or `None` if the mapping can't be moved.
+    ///
+    /// Used to move or extend areas. Allocation mappings are always lazy in the
+    /// new area, which is populated by moving the existing pages.
+    pub(crate) fn moved(&self, from: VirtAddr, to: VirtAddr) -> Option<Self> {
+        match *self {
+            Self::Linear { .. } => None,
+            Self::Alloc { .. } => Some(Self::new_alloc(false)),
+            Self::File {
+                start,
+                ref pages,
+                offset,
+            } => Some(Self::new_file(to, pages.clone(), offset + (from - start))),
+            Self::Shared {
+                start,
+                ref pages,
+                offset,
+            } => Some(Self::new_shared(to, pages.clone(), offset + (from - start))),
+        }
+    }
+
+    /// Handles a page fault at `vaddr` in an area with `orig_flags`, caused by
+    /// an access with `access_flags`.
     pub(crate) fn handle_page_fault(
         &self,
         vaddr: VirtAddr,
         orig_flags: MappingFlags,
-        page_table: &mut PageTable,
+        access_flags: MappingFlags,
+        page_table: &Arc<SpinNoIrq<PageTable>>,
     ) -> bool {
+        let write = access_flags.contains(MappingFlags::WRITE);
         match *self {
             Self::Linear { .. } => false, // Linear mappings should not trigger page faults.
-            Self::Alloc { populate } => {
-                Self::handle_page_fault_alloc(vaddr, orig_flags, page_table, populate)
+            Self::Alloc { .. } => {
+                Self::handle_page_fault_alloc(vaddr, orig_flags, write, page_table)
+            }
+            Self::File {
+                start,
+                ref pages,
+                offset,
+            } => {
+                let offset = offset + (vaddr.align_down_4k() - start);
+                Self::handle_page_fault_file(vaddr, orig_flags, write, page_table, offset, pages)
+            }
+            Self::Shared {
+                start,
+                ref pages,
+                offset,
+            } => {
+                let offset = offset + (vaddr.align_down_4k() - start);
+                Self::handle_page_fault_shared(vaddr, orig_flags, write, page_table, offset, pages)
             }
         }
     }
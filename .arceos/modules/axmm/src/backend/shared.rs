@@ -0,0 +1,426 @@
+use alloc::{
+    collections::BTreeMap,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use axerrno::{AxError, AxResult};
+use axhal::arch::flush_tlb;
+use axhal::mem::phys_to_virt;
+use axhal::paging::{MappingFlags, PageTable, PagingError};
+use kspin::SpinNoIrq;
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, PageIter4K, PhysAddr, VirtAddr};
+
+use super::alloc::{alloc_frame, dealloc_frame, map_fault_page};
+use super::{Backend, MappedFile};
+use crate::tlb::TlbBatch;
+
+struct SharedPage {
+    frame: PhysAddr,
+    /// Whether the page has been mapped writable since it was last written
+    /// back.
+    dirty: bool,
+    /// The page tables and addresses where the page has been mapped writable,
+    /// which are made read-only again when it is written back.
+    writers: Vec<(Weak<SpinNoIrq<PageTable>>, VirtAddr)>,
+}
+
+/// The pages shared by all the `MAP_SHARED` mappings of a file, or of an
+/// anonymous shared mapping.
+///
+/// Pages of a file are read on the first access, and the dirty ones are
+/// written back by [`SharedPages::sync`] and when the last mapping is gone,
+/// through the file of a writable mapping (see [`SharedPages::set_writer`]).
+/// The pages are also mapped read-only by private mappings of the file
+/// ([`Backend::File`]), e.g. the code of executables, until they are written.
+pub struct SharedPages {
+    file: Option<Arc<dyn MappedFile>>,
+    /// The file through which the dirty pages are written back, which is
+    /// opened for writing unlike `file` may be.
+    writer: SpinNoIrq<Option<Arc<dyn MappedFile>>>,
+    /// Cached pages, indexed by their file offset.
+    pages: SpinNoIrq<BTreeMap<usize, SharedPage>>,
+}
+
+impl SharedPages {
+    /// Creates the shared pages of a file, or of an anonymous mapping if `file`
+    /// is `None`.
+    pub fn new(file: Option<Arc<dyn MappedFile>>) -> Self {
+        Self {
+            file,
+            writer: SpinNoIrq::new(None),
+            pages: SpinNoIrq::new(BTreeMap::new()),
+        }
+    }
+
+    /// Sets the file, opened for writing, through which the dirty pages are
+    /// written back, unless one is set already. It must be called before the
+    /// pages are mapped writable.
+    pub fn set_writer(&self, file: Arc<dyn MappedFile>) {
+        let mut writer = self.writer.lock();
+        if writer.is_none() {
+            *writer = Some(file);
+        }
+    }
+
+    /// Returns the frame of the page at `offset`, reading it if not cached.
+    ///
+    /// The frame is owned by the cache. Private mappings hold extra references
+    /// to it with `share_frame`, so that it is copied on write and outlives
+    /// the cache if needed. Other users of the frame (e.g. rings shared with
+    /// the kernel) must keep the cache alive while they use it.
+    pub fn frame(&self, offset: usize) -> Option<PhysAddr> {
+        if let Some(page) = self.pages.lock().get(&offset) {
+            return Some(page.frame);
+        }
+
+        // The file is read without holding the lock, so another mapping may
+        // fill the page in the meantime.
+        let frame = alloc_frame(true)?;
+        if let Some(file) = &self.file {
+            let buf = unsafe {
+                core::slice::from_raw_parts_mut(phys_to_virt(frame).as_mut_ptr(), PAGE_SIZE_4K)
+            };
+            let mut read = 0;
+            while read < PAGE_SIZE_4K {
+                match file.read_at((offset + read) as u64, &mut buf[read..]) {
+                    Ok(0) => break,
+                    Ok(n) => read += n,
+                    Err(e) => {
+                        warn!("failed to read mapped file at {:#x}: {:?}", offset, e);
+                        dealloc_frame(frame);
+                        return None;
+                    }
+                }
+            }
+        }
+
+        let mut pages = self.pages.lock();
+        if let Some(page) = pages.get(&offset) {
+            dealloc_frame(frame);
+            return Some(page.frame);
+        }
+        pages.insert(
+            offset,
+            SharedPage {
+                frame,
+                dirty: false,
+                writers: Vec::new(),
+            },
+        );
+        Some(frame)
+    }
+
+    /// Reads the pages in the file range `[offset, offset + len)` into the
+    /// cache without mapping them, stopping at the first failure.
+    pub fn prefetch(&self, offset: usize, len: usize) {
+        let start = memory_addr::align_down_4k(offset);
+        for offset in (start..offset + len).step_by(PAGE_SIZE_4K) {
+            if self.frame(offset).is_none() {
+                break;
+            }
+        }
+    }
+
+    /// Zeroes the cached content from the file offset `offset` on, e.g. when
+    /// an anonymous file shrinks, so that it reads as zeros if it grows again.
+    ///
+    /// The frames are kept, as they may still be mapped.
+    pub fn zero_from(&self, offset: usize) {
+        let start = memory_addr::align_down_4k(offset);
+        for (&page_offset, page) in self.pages.lock().range(start..) {
+            let from = offset.saturating_sub(page_offset);
+            let buf = unsafe {
+                core::slice::from_raw_parts_mut(phys_to_virt(page.frame).as_mut_ptr(), PAGE_SIZE_4K)
+            };
+            buf[from..].fill(0);
+        }
+    }
+
+    /// Returns the cached frames in the file range `[start, end)`, with their
+    /// offsets, keeping only the dirty ones if `dirty` is set.
+    ///
+    /// The frames stay valid while the cache is alive, so they can be accessed
+    /// without holding the lock.
+    fn cached_frames(&self, start: usize, end: usize, dirty: bool) -> Vec<(usize, PhysAddr)> {
+        self.pages
+            .lock()
+            .range(memory_addr::align_down_4k(start)..end)
+            .filter(|(_, page)| page.dirty || !dirty)
+            .map(|(offset, page)| (*offset, page.frame))
+            .collect()
+    }
+
+    /// Reads the cached pages in the file range `[start, end)` from the file
+    /// again, after it has been written or truncated other than through the
+    /// mappings.
+    ///
+    /// The changes made through the mappings must have been written back by
+    /// [`SharedPages::sync`] first, or they are lost.
+    pub fn reload(&self, start: usize, end: usize) {
+        let Some(file) = &self.file else {
+            return;
+        };
+        for (offset, frame) in self.cached_frames(start, end, false) {
+            let buf = unsafe {
+                core::slice::from_raw_parts_mut(phys_to_virt(frame).as_mut_ptr(), PAGE_SIZE_4K)
+            };
+            let mut read = 0;
+            while read < PAGE_SIZE_4K {
+                match file.read_at((offset + read) as u64, &mut buf[read..]) {
+                    Ok(0) => break,
+                    Ok(n) => read += n,
+                    Err(e) => {
+                        warn!("failed to reload mapped file at {:#x}: {:?}", offset, e);
+                        break;
+                    }
+                }
+            }
+            buf[read..].fill(0);
+        }
+    }
+
+    /// Copies the dirty pages that overlap the file range at `offset` over
+    /// `buf`, which has been read from the file, as they are newer until they
+    /// are written back.
+    pub fn read_dirty(&self, offset: usize, buf: &mut [u8]) {
+        let end = offset + buf.len();
+        for (page_offset, frame) in self.cached_frames(offset, end, true) {
+            let from = page_offset.max(offset);
+            let to = (page_offset + PAGE_SIZE_4K).min(end);
+            let page =
+                unsafe { core::slice::from_raw_parts(phys_to_virt(frame).as_ptr(), PAGE_SIZE_4K) };
+            buf[from - offset..to - offset]
+                .copy_from_slice(&page[from - page_offset..to - page_offset]);
+        }
+    }
+
+    /// Marks the page at `offset` dirty, as it is mapped writable at `vaddr`
+    /// in the page table `pt`.
+    fn set_dirty(&self, offset: usize, pt: &Arc<SpinNoIrq<PageTable>>, vaddr: VirtAddr) {
+        if let Some(page) = self.pages.lock().get_mut(&offset) {
+            page.dirty = true;
+            // Anonymous pages are never written back.
+            if self.file.is_none() {
+                return;
+            }
+            let pt = Arc::downgrade(pt);
+            page.writers.retain(|writer| writer.0.strong_count() > 0);
+            if !page
+                .writers
+                .iter()
+                .any(|writer| writer.0.ptr_eq(&pt) && writer.1 == vaddr)
+            {
+                page.writers.push((pt, vaddr));
+            }
+        }
+    }
+
+    /// Marks the dirty pages in the file range `[start, end)` clean, and
+    /// returns them with their offsets.
+    ///
+    /// If `protect` is set, the pages are also made read-only in all the page
+    /// tables where they are mapped writable, and flushed from the TLBs of the
+    /// CPUs using them, so that the next write marks them dirty again. The
+    /// data written until then is in the frames when this returns.
+    fn clean(&self, start: usize, end: usize, protect: bool) -> Vec<(usize, PhysAddr)> {
+        let mut dirty = Vec::new();
+        let mut writers = Vec::new();
+        for (&offset, page) in self
+            .pages
+            .lock()
+            .range_mut(memory_addr::align_down_4k(start)..end)
+            .filter(|(_, page)| page.dirty)
+        {
+            let frame = page.frame;
+            page.dirty = false;
+            dirty.push((offset, frame));
+            writers.extend(page.writers.drain(..).map(|(pt, vaddr)| (pt, vaddr, frame)));
+        }
+        if !protect {
+            return dirty;
+        }
+        // One shootdown for all the pages of each page table.
+        writers.sort_by_key(|(pt, ..)| pt.as_ptr() as usize);
+        for group in writers.chunk_by(|a, b| a.0.ptr_eq(&b.0)) {
+            let Some(pt) = group[0].0.upgrade() else {
+                continue;
+            };
+            let mut pt = pt.lock();
+            let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+            for &(_, vaddr, frame) in group {
+                // The page may have been unmapped from there since.
+                let mut flags = match pt.query(vaddr) {
+                    Ok((paddr, flags, _)) if paddr == frame => flags,
+                    _ => continue,
+                };
+                flags.remove(MappingFlags::WRITE);
+                if let Ok(tlb) = pt.protect_region(vaddr, PAGE_SIZE_4K, flags, false) {
+                    tlb.ignore();
+                    tlb_batch.add(vaddr);
+                }
+            }
+        }
+        dirty
+    }
+
+    /// Writes the dirty pages in the file range `[start, end)` back to the
+    /// file, and marks them clean.
+    ///
+    /// Fails with [`AxError::PermissionDenied`] if there are dirty pages but
+    /// no file to write them to, see [`SharedPages::set_writer`].
+    ///
+    /// The page tables mapping the pages are locked to write-protect them, so
+    /// the caller must not hold any of their locks.
+    pub fn sync(&self, start: usize, end: usize) -> AxResult {
+        self.write_back(start, end, true)
+    }
+
+    fn write_back(&self, start: usize, end: usize, protect: bool) -> AxResult {
+        if self.file.is_none() {
+            return Ok(());
+        }
+        let Some(file) = self.writer.lock().clone() else {
+            return if self.cached_frames(start, end, true).is_empty() {
+                Ok(())
+            } else {
+                Err(AxError::PermissionDenied)
+            };
+        };
+        let dirty = self.clean(start, end, protect);
+        let size = file.size()? as usize;
+        for (i, &(offset, frame)) in dirty.iter().enumerate() {
+            // The page may extend beyond the end of the file, which must not
+            // grow because of it.
+            let len = PAGE_SIZE_4K.min(size.saturating_sub(offset));
+            let buf = unsafe { core::slice::from_raw_parts(phys_to_virt(frame).as_ptr(), len) };
+            let mut written = 0;
+            while written < len {
+                match file.write_at((offset + written) as u64, &buf[written..]) {
+                    Ok(0) => break,
+                    Ok(n) => written += n,
+                    Err(e) => {
+                        // The pages left are still to be written back.
+                        let mut pages = self.pages.lock();
+                        for (offset, _) in &dirty[i..] {
+                            if let Some(page) = pages.get_mut(offset) {
+                                page.dirty = true;
+                            }
+                        }
+                        return Err(e);
+                    }
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+impl Drop for SharedPages {
+    fn drop(&mut self) {
+        // There are no mappings left to write-protect.
+        if let Err(e) = self.write_back(0, usize::MAX, false) {
+            warn!("failed to write back shared mapping: {:?}", e);
+        }
+        for page in self.pages.get_mut().values() {
+            dealloc_frame(page.frame);
+        }
+    }
+}
+
+impl Backend {
+    /// Creates a new shared mapping backend, which maps the `offset` of
+    /// `pages` to `start`.
+    pub fn new_shared(start: VirtAddr, pages: Arc<SharedPages>, offset: usize) -> Self {
+        Self::Shared {
+            start,
+            pages,
+            offset,
+        }
+    }
+
+    pub(crate) fn unmap_shared(start: VirtAddr, size: usize, pt: &mut PageTable) -> bool {
+        debug!("unmap_shared: [{:#x}, {:#x})", start, start + size);
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        for addr in PageIter4K::new(start, start + size).unwrap() {
+            // The frames are owned by `SharedPages`.
+            if let Ok((_, page_size, tlb)) = pt.unmap(addr) {
+                if page_size.is_huge() {
+                    return false;
+                }
+                tlb.ignore();
+                tlb_batch.add(addr);
+            }
+        }
+        true
+    }
+
+    pub(crate) fn protect_shared(
+        start: VirtAddr,
+        size: usize,
+        new_flags: MappingFlags,
+        pt: &mut PageTable,
+    ) -> bool {
+        // Keep the pages read-only, so that the next write marks them dirty.
+        let mut flags = new_flags;
+        flags.remove(MappingFlags::WRITE);
+        let mut tlb_batch = TlbBatch::new(pt.root_paddr());
+        for addr in PageIter4K::new(start, start + size).unwrap() {
+            match pt.protect_region(addr, PAGE_SIZE_4K, flags, false) {
+                Ok(tlb) => {
+                    tlb.ignore();
+                    tlb_batch.add(addr);
+                }
+                Err(PagingError::NotMapped) => {}
+                Err(_) => return false,
+            }
+        }
+        true
+    }
+
+    pub(crate) fn handle_page_fault_shared(
+        vaddr: VirtAddr,
+        orig_flags: MappingFlags,
+        write: bool,
+        page_table: &Arc<SpinNoIrq<PageTable>>,
+        offset: usize,
+        pages: &SharedPages,
+    ) -> bool {
+        let vaddr = vaddr.align_down_4k();
+        {
+            let mut pt = page_table.lock();
+            match pt.query(vaddr) {
+                // The first write to a page, which is mapped read-only until
+                // then.
+                Ok((_, flags, _)) => {
+                    if !write
+                        || !orig_flags.contains(MappingFlags::WRITE)
+                        || flags.contains(MappingFlags::WRITE)
+                    {
+                        return Self::spurious_fault(vaddr, &pt);
+                    }
+                    pages.set_dirty(offset, page_table, vaddr);
+                    return match pt.protect_region(vaddr, PAGE_SIZE_4K, orig_flags, false) {
+                        Ok(tlb) => {
+                            tlb.ignore();
+                            flush_tlb(Some(vaddr));
+                            true
+                        }
+                        Err(_) => false,
+                    };
+                }
+                Err(PagingError::NotMapped) => {}
+                Err(_) => return false,
+            }
+        }
+
+        // The page is read without holding the page table lock, and stays
+        // in the cache if another thread maps it first.
+        let Some(frame) = pages.frame(offset) else {
+            return false;
+        };
+        let mut flags = orig_flags;
+        flags.remove(MappingFlags::WRITE);
+        map_fault_page(vaddr, frame, flags, page_table).is_ok()
+    }
+}
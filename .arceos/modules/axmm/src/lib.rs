@@ -8,9 +8,12 @@ extern crate alloc;
 
 mod aspace;
 mod backend;
+mod tlb;
 
-pub use self::aspace::AddrSpace;
-pub use self::backend::Backend;
+pub use self::aspace::{AddrSpace, set_fault_around_pages};
+pub use self::backend::{Backend, MappedFile, PAGE_SIZE_2M, SharedPages, refill_zeroed_frames};
+#[cfg(all(feature = "smp", feature = "irq"))]
+pub use self::tlb::handle_tlb_shootdown;
 
 use axerrno::{AxError, AxResult};
 use axhal::mem::phys_to_virt;
@@ -21,6 +24,15 @@ use memory_set::MappingError;
 
 static KERNEL_ASPACE: LazyInit<SpinNoIrq<AddrSpace>> = LazyInit::new();
 
+/// The non-empty entries of the root page table of the kernel, with their
+/// indices, which all the user page tables share.
+///
+/// They are taken once the kernel address space is set up. The kernel
+/// mappings made later fall within the same entries, e.g. in the linear
+/// mapping of the physical memory.
+#[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+static KERNEL_ROOT_ENTRIES: LazyInit<alloc::vec::Vec<(usize, u64)>> = LazyInit::new();
+
 fn mapping_err_to_ax_err(err: MappingError) -> AxError {
     warn!("Mapping error: {:?}", err);
     match err {
@@ -52,16 +64,34 @@ pub fn kernel_page_table_root() -> PhysAddr {
     KERNEL_ASPACE.lock().page_table_root()
 }
 
+/// Returns the entries of the root page table of the kernel that the user
+/// page tables share, see [`AddrSpace::share_kernel_mappings`].
+#[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+fn kernel_root_entries() -> &'static [(usize, u64)] {
+    &KERNEL_ROOT_ENTRIES
+}
+
 /// Initializes virtual memory management.
 ///
 /// It mainly sets up the kernel virtual memory address space and recreate a
-/// fine-grained kernel page table.
+/// fine-grained kernel page table, which maps the physical memory with huge
+/// pages wherever the alignment allows.
 pub fn init_memory_management() {
     info!("Initialize virtual memory management...");
 
     let kernel_aspace = new_kernel_aspace().expect("failed to initialize kernel address space");
     debug!("kernel address space init OK: {:#x?}", kernel_aspace);
     KERNEL_ASPACE.init_once(SpinNoIrq::new(kernel_aspace));
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    {
+        let root = phys_to_virt(kernel_page_table_root()).as_ptr() as *const u64;
+        let entries = (0..memory_addr::PAGE_SIZE_4K / size_of::<u64>())
+            // SAFETY: the root table is one page.
+            .map(|index| (index, unsafe { root.add(index).read() }))
+            .filter(|&(_, entry)| entry != 0)
+            .collect();
+        KERNEL_ROOT_ENTRIES.init_once(entries);
+    }
     axhal::paging::set_kernel_page_table_root(kernel_page_table_root());
 }
 
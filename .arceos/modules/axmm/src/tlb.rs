@@ -0,0 +1,215 @@
+//! Batched TLB invalidation, on the current CPU and on the other CPUs that
+//! have the page table loaded (TLB shootdowns).
+
+use axhal::arch::flush_tlb;
+use memory_addr::{PAGE_SIZE_4K, PhysAddr, VirtAddr};
+
+/// The maximum number of pages flushed one by one, beyond which the whole TLB
+/// is flushed instead.
+const MAX_PAGE_FLUSHES: usize = 32;
+
+/// A set of pages whose TLB entries must be flushed.
+struct Pages {
+    pages: [VirtAddr; MAX_PAGE_FLUSHES],
+    len: usize,
+    full: bool,
+}
+
+impl Pages {
+    const fn new() -> Self {
+        Self {
+            pages: [VirtAddr::from_usize(0); MAX_PAGE_FLUSHES],
+            len: 0,
+            full: false,
+        }
+    }
+
+    fn is_empty(&self) -> bool {
+        self.len == 0 && !self.full
+    }
+
+    fn add(&mut self, vaddr: VirtAddr) {
+        if self.full {
+            return;
+        }
+        if self.len < MAX_PAGE_FLUSHES {
+            self.pages[self.len] = vaddr;
+            self.len += 1;
+        } else {
+            self.full = true;
+        }
+    }
+
+    /// Adds the pages of `other`.
+    fn merge(&mut self, other: &Self) {
+        if other.full {
+            self.full = true;
+        }
+        for &vaddr in &other.pages[..other.len] {
+            self.add(vaddr);
+        }
+    }
+
+    /// Flushes the pages on the current CPU, and empties the set.
+    fn flush(&mut self) {
+        if self.full {
+            flush_tlb(None);
+        } else {
+            for &vaddr in &self.pages[..self.len] {
+                flush_tlb(Some(vaddr));
+            }
+        }
+        *self = Self::new();
+    }
+}
+
+/// Collects the pages whose stale TLB entries must be invalidated after
+/// changing the page table, and flushes them together when dropped.
+///
+/// Small batches are flushed page by page. Large ones are turned into a single
+/// full flush, which is cheaper than flushing many pages and refilling the
+/// whole TLB anyway.
+///
+/// The other CPUs that have the page table loaded are sent one shootdown for
+/// the whole batch, and the flush only returns once they have all served it.
+pub(crate) struct TlbBatch {
+    pages: Pages,
+    /// The root of the changed page table.
+    #[cfg_attr(not(all(feature = "smp", feature = "irq")), allow(dead_code))]
+    root: PhysAddr,
+}
+
+impl TlbBatch {
+    /// Creates an empty batch for the page table whose root is `root`.
+    pub fn new(root: PhysAddr) -> Self {
+        Self {
+            pages: Pages::new(),
+            root,
+        }
+    }
+
+    /// Adds the page (of any size) containing `vaddr` to the batch.
+    pub fn add(&mut self, vaddr: VirtAddr) {
+        self.pages.add(vaddr);
+    }
+
+    /// Adds the pages in `[start, start + size)` to the batch.
+    pub fn add_range(&mut self, start: VirtAddr, size: usize) {
+        if self.pages.full {
+            return;
+        }
+        if size > (MAX_PAGE_FLUSHES - self.pages.len) * PAGE_SIZE_4K {
+            self.pages.full = true;
+            return;
+        }
+        for offset in (0..size).step_by(PAGE_SIZE_4K) {
+            self.add(start + offset);
+        }
+    }
+
+    /// Adds all the pages to the batch, which is then a full flush.
+    pub fn add_all(&mut self) {
+        self.pages.full = true;
+    }
+
+    /// Flushes the collected pages, and empties the batch.
+    pub fn flush(&mut self) {
+        if self.pages.is_empty() {
+            return;
+        }
+        // The task must not migrate between the local flush and the search
+        // for the other CPUs.
+        let _guard = kernel_guard::NoPreempt::new();
+        #[cfg(all(feature = "smp", feature = "irq"))]
+        let tickets = shootdown::request(self.root, &self.pages);
+        self.pages.flush();
+        #[cfg(all(feature = "smp", feature = "irq"))]
+        shootdown::wait(&tickets);
+    }
+}
+
+impl Drop for TlbBatch {
+    fn drop(&mut self) {
+        self.flush();
+    }
+}
+
+/// Serves the TLB shootdowns requested from the current CPU by the others,
+/// see [`axhal::irq::send_ipi`].
+#[cfg(all(feature = "smp", feature = "irq"))]
+pub fn handle_tlb_shootdown() {
+    shootdown::serve();
+}
+
+#[cfg(all(feature = "smp", feature = "irq"))]
+mod shootdown {
+    use core::sync::atomic::{AtomicU64, Ordering};
+
+    use axhal::cpu::this_cpu_id;
+    use kspin::SpinNoIrq;
+    use memory_addr::PhysAddr;
+
+    use super::Pages;
+
+    /// The shootdowns requested from a CPU, merged from all the requests.
+    struct Shootdown {
+        pages: SpinNoIrq<Pages>,
+        /// The number of requests made to the CPU.
+        requested: AtomicU64,
+        /// The number of requests the CPU has served.
+        served: AtomicU64,
+    }
+
+    static SHOOTDOWNS: [Shootdown; axconfig::SMP] = [const {
+        Shootdown {
+            pages: SpinNoIrq::new(Pages::new()),
+            requested: AtomicU64::new(0),
+            served: AtomicU64::new(0),
+        }
+    }; axconfig::SMP];
+
+    /// Asks the other CPUs that have the page table `root` loaded to flush
+    /// `pages`, returning the tickets to wait for with [`wait`].
+    pub fn request(root: PhysAddr, pages: &Pages) -> [u64; axconfig::SMP] {
+        let mut tickets = [0; axconfig::SMP];
+        if axhal::irq::IPI_IRQ_NUM.is_none() {
+            return tickets;
+        }
+        let this_cpu = this_cpu_id();
+        for cpu in axhal::paging::cpus_with_user_root(root).filter(|&cpu| cpu != this_cpu) {
+            let shootdown = &SHOOTDOWNS[cpu];
+            shootdown.pages.lock().merge(pages);
+            tickets[cpu] = shootdown.requested.fetch_add(1, Ordering::SeqCst) + 1;
+            axhal::irq::send_ipi(cpu);
+        }
+        tickets
+    }
+
+    /// Waits until the other CPUs have served the shootdowns of `tickets`.
+    ///
+    /// IRQs may be disabled, so the requests made meanwhile to this CPU are
+    /// served here, not to deadlock with a CPU waiting for this one.
+    pub fn wait(tickets: &[u64; axconfig::SMP]) {
+        for (cpu, &ticket) in tickets.iter().enumerate() {
+            while SHOOTDOWNS[cpu].served.load(Ordering::Acquire) < ticket {
+                serve();
+                core::hint::spin_loop();
+            }
+        }
+    }
+
+    /// Flushes the pages requested from the current CPU.
+    pub fn serve() {
+        // An IPI must not mark the requests served while they are flushed.
+        let _guard = kernel_guard::IrqSave::new();
+        let shootdown = &SHOOTDOWNS[this_cpu_id()];
+        let requested = shootdown.requested.load(Ordering::Acquire);
+        if shootdown.served.load(Ordering::Relaxed) >= requested {
+            return;
+        }
+        // The pages of all the requests counted so far have been merged.
+        let mut pages = core::mem::replace(&mut *shootdown.pages.lock(), Pages::new());
+        pages.flush();
+        shootdown.served.fetch_max(requested, Ordering::Release);
+    }
+}
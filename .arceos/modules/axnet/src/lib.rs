@@ -14,6 +14,9 @@
 //!
 //! - `smoltcp`: Use [smoltcp] as the underlying network stack. This is enabled
 //!   by default.
+//! - `irq` and `multitask`: With both, the interface is polled by a background
+//!   task, and blocking socket operations sleep until it makes progress
+//!   instead of polling and yielding.
 //!
 //! [smoltcp]: https://github.com/smoltcp-rs/smoltcp
 
@@ -33,11 +36,14 @@ cfg_if::cfg_if! {
 pub use self::net_impl::TcpSocket;
 pub use self::net_impl::UdpSocket;
 pub use self::net_impl::{bench_receive, bench_transmit};
-pub use self::net_impl::{dns_query, poll_interfaces};
+pub use self::net_impl::{dns_query, poll_interfaces, set_buffer_limits, set_event_hook};
 
 use axdriver::{AxDeviceContainer, prelude::*};
 
 /// Initializes the network subsystem by NIC devices.
+///
+/// The network stack is only set up on the NIC when it is first used, e.g. by
+/// a socket.
 pub fn init_network(mut net_devs: AxDeviceContainer<AxNetDevice>) {
     info!("Initialize network subsystem...");
 
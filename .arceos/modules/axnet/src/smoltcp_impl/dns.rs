@@ -7,7 +7,7 @@ use smoltcp::socket::dns::{self, GetQueryResultError, StartQueryError};
 use smoltcp::wire::DnsQueryType;
 
 use super::addr::into_core_ipaddr;
-use super::{ETH0, SOCKET_SET, SocketSetWrapper};
+use super::{ETH0, SOCKET_SET, SocketSetWrapper, poller};
 
 /// A DNS socket.
 struct DnsSocket {
@@ -35,10 +35,11 @@ impl DnsSocket {
     pub fn query(&self, name: &str, query_type: DnsQueryType) -> AxResult<Vec<IpAddr>> {
         // let local_addr = self.local_addr.unwrap_or_else(f);
         let handle = self.handle.ok_or_else(|| ax_err_type!(InvalidInput))?;
-        let iface = &ETH0.iface;
+        // The interface is locked before the sockets, as when polling.
+        let mut iface = ETH0.iface.lock();
         let query_handle = SOCKET_SET
             .with_socket_mut::<dns::Socket, _, _>(handle, |socket| {
-                socket.start_query(iface.lock().context(), name, query_type)
+                socket.start_query(iface.context(), name, query_type)
             })
             .map_err(|e| match e {
                 StartQueryError::NoFreeSlot => {
@@ -51,27 +52,18 @@ impl DnsSocket {
                     ax_err_type!(InvalidInput, "socket query() failed: too long name")
                 }
             })?;
-        loop {
-            SOCKET_SET.poll_interfaces();
-            match SOCKET_SET.with_socket_mut::<dns::Socket, _, _>(handle, |socket| {
+        drop(iface);
+        let res = poller::block_on(|| {
+            SOCKET_SET.with_socket_mut::<dns::Socket, _, _>(handle, |socket| {
                 socket.get_query_result(query_handle).map_err(|e| match e {
                     GetQueryResultError::Pending => AxError::WouldBlock,
                     GetQueryResultError::Failed => {
                         ax_err_type!(ConnectionRefused, "socket query() failed")
                     }
                 })
-            }) {
-                Ok(n) => {
-                    let mut res = Vec::with_capacity(n.capacity());
-                    for ip in n {
-                        res.push(into_core_ipaddr(ip))
-                    }
-                    return Ok(res);
-                }
-                Err(AxError::WouldBlock) => axtask::yield_now(),
-                Err(e) => return Err(e),
-            }
-        }
+            })
+        })?;
+        Ok(res.into_iter().map(into_core_ipaddr).collect())
     }
 }
 
@@ -1,5 +1,4 @@
-use alloc::{boxed::Box, collections::VecDeque};
-use core::ops::{Deref, DerefMut};
+use alloc::{boxed::Box, collections::VecDeque, sync::Arc, vec::Vec};
 
 use axerrno::{AxError, AxResult, ax_err};
 use axsync::Mutex;
@@ -7,23 +6,39 @@ use smoltcp::iface::{SocketHandle, SocketSet};
 use smoltcp::socket::tcp::{self, State};
 use smoltcp::wire::{IpAddress, IpEndpoint, IpListenEndpoint};
 
-use super::{LISTEN_QUEUE_SIZE, SOCKET_SET, SocketSetWrapper};
+use super::loopback::LocalConnection;
+use super::{BufferSizes, LISTEN_QUEUE_SIZE, SOCKET_SET, SocketSetWrapper, poller};
 
 const PORT_NUM: usize = 65536;
 
-struct ListenTableEntry {
-    listen_endpoint: IpListenEndpoint,
+/// The connections waiting to be accepted by a listening socket.
+struct AcceptQueues {
     syn_queue: VecDeque<SocketHandle>,
+    /// Connections from local sockets, which are established at once.
+    local_queue: VecDeque<(LocalConnection, (IpEndpoint, IpEndpoint))>,
 }
 
-impl ListenTableEntry {
-    pub fn new(listen_endpoint: IpListenEndpoint) -> Self {
-        Self {
-            listen_endpoint,
-            syn_queue: VecDeque::with_capacity(LISTEN_QUEUE_SIZE),
-        }
+impl AcceptQueues {
+    fn len(&self) -> usize {
+        self.syn_queue.len() + self.local_queue.len()
     }
+}
 
+/// A listening socket in the listen table.
+///
+/// Sockets with `SO_REUSEPORT` can listen on the same port, each with its own
+/// queues, and incoming connections are spread across them. Accepting only
+/// locks the queues of the socket, so workers with a listener each do not
+/// contend with each other.
+pub struct Listener {
+    listen_endpoint: IpListenEndpoint,
+    reuse_port: bool,
+    /// The buffer sizes of incoming connections.
+    buf_sizes: BufferSizes,
+    queues: Mutex<AcceptQueues>,
+}
+
+impl Listener {
     #[inline]
     fn can_accept(&self, dst: IpAddress) -> bool {
         match self.listen_endpoint.addr {
@@ -31,18 +46,61 @@ impl ListenTableEntry {
             None => true,
         }
     }
+
+    /// Whether there is a connection ready to be accepted.
+    pub fn is_ready(&self) -> bool {
+        // Lock order: sockets, then queues.
+        let sockets = SOCKET_SET.0.read();
+        let queues = self.queues.lock();
+        !queues.local_queue.is_empty()
+            || queues
+                .syn_queue
+                .iter()
+                .any(|&handle| is_connected(&sockets, handle))
+    }
+
+    pub fn accept(&self) -> AxResult<(Accepted, (IpEndpoint, IpEndpoint))> {
+        let sockets = SOCKET_SET.0.read();
+        let mut queues = self.queues.lock();
+        if let Some((conn, addr_tuple)) = queues.local_queue.pop_front() {
+            return Ok((Accepted::Local(conn), addr_tuple));
+        }
+        let syn_queue = &mut queues.syn_queue;
+        let (idx, addr_tuple) = syn_queue
+            .iter()
+            .enumerate()
+            .find_map(|(idx, &handle)| {
+                is_connected(&sockets, handle).then(|| (idx, get_addr_tuple(&sockets, handle)))
+            })
+            .ok_or(AxError::WouldBlock)?; // wait for connection
+        if idx > 0 {
+            warn!(
+                "slow SYN queue enumeration: index = {}, len = {}!",
+                idx,
+                syn_queue.len()
+            );
+        }
+        let handle = syn_queue.swap_remove_front(idx).unwrap();
+        Ok((Accepted::Smoltcp(handle), addr_tuple))
+    }
 }
 
-impl Drop for ListenTableEntry {
+impl Drop for Listener {
     fn drop(&mut self) {
-        for &handle in &self.syn_queue {
+        for &handle in &self.queues.get_mut().syn_queue {
             SOCKET_SET.remove(handle);
         }
     }
 }
 
+/// A connection taken from the queue of a listening socket.
+pub enum Accepted {
+    Smoltcp(SocketHandle),
+    Local(LocalConnection),
+}
+
 pub struct ListenTable {
-    tcp: Box<[Mutex<Option<Box<ListenTableEntry>>>]>,
+    tcp: Box<[Mutex<Vec<Arc<Listener>>>]>,
 }
 
 impl ListenTable {
@@ -50,7 +108,7 @@ impl ListenTable {
         let tcp = unsafe {
             let mut buf = Box::new_uninit_slice(PORT_NUM);
             for i in 0..PORT_NUM {
-                buf[i].write(Mutex::new(None));
+                buf[i].write(Mutex::new(Vec::new()));
             }
             buf.assume_init()
         };
@@ -58,56 +116,96 @@ impl ListenTable {
     }
 
     pub fn can_listen(&self, port: u16) -> bool {
-        self.tcp[port as usize].lock().is_none()
+        self.tcp[port as usize].lock().is_empty()
     }
 
-    pub fn listen(&self, listen_endpoint: IpListenEndpoint) -> AxResult {
+    /// Adds a listening socket on `listen_endpoint`. A port can only have
+    /// several listeners if all of them set `reuse_port`.
+    pub fn listen(
+        &self,
+        listen_endpoint: IpListenEndpoint,
+        buf_sizes: BufferSizes,
+        reuse_port: bool,
+    ) -> AxResult<Arc<Listener>> {
         let port = listen_endpoint.port;
         assert_ne!(port, 0);
-        let mut entry = self.tcp[port as usize].lock();
-        if entry.is_none() {
-            *entry = Some(Box::new(ListenTableEntry::new(listen_endpoint)));
-            Ok(())
-        } else {
-            ax_err!(AddrInUse, "socket listen() failed")
+        let mut listeners = self.tcp[port as usize].lock();
+        if !listeners
+            .iter()
+            .all(|listener| reuse_port && listener.reuse_port)
+        {
+            return ax_err!(AddrInUse, "socket listen() failed");
         }
+        let listener = Arc::new(Listener {
+            listen_endpoint,
+            reuse_port,
+            buf_sizes,
+            queues: Mutex::new(AcceptQueues {
+                syn_queue: VecDeque::with_capacity(LISTEN_QUEUE_SIZE),
+                local_queue: VecDeque::new(),
+            }),
+        });
+        listeners.push(listener.clone());
+        Ok(listener)
     }
 
-    pub fn unlisten(&self, port: u16) {
+    pub fn unlisten(&self, listener: &Arc<Listener>) {
+        let port = listener.listen_endpoint.port;
         debug!("TCP socket unlisten on {}", port);
-        *self.tcp[port as usize].lock() = None;
+        let mut listeners = self.tcp[port as usize].lock();
+        listeners.retain(|l| !Arc::ptr_eq(l, listener));
     }
 
-    pub fn can_accept(&self, port: u16) -> AxResult<bool> {
-        if let Some(entry) = self.tcp[port as usize].lock().deref() {
-            Ok(entry.syn_queue.iter().any(|&handle| is_connected(handle)))
-        } else {
-            ax_err!(InvalidInput, "socket accept() failed: not listen")
+    /// Picks the listener on `dst` for a connection from `src`.
+    ///
+    /// Connections are spread across the listeners of a port by a hash of
+    /// their source, so that all packets of a connection go to the same one.
+    fn select<'a>(
+        listeners: &'a [Arc<Listener>],
+        src: IpEndpoint,
+        dst: IpEndpoint,
+    ) -> Option<&'a Arc<Listener>> {
+        let mut candidates = listeners.iter().filter(|l| l.can_accept(dst.addr));
+        if listeners.len() == 1 {
+            return candidates.next();
+        }
+        let count = candidates.clone().count();
+        if count == 0 {
+            return None;
         }
+        let mut hash = src.port as u64;
+        for &byte in src.addr.as_bytes() {
+            hash = (hash << 8) | byte as u64;
+        }
+        // Fibonacci hashing, as the source ports of a client are sequential.
+        let hash = hash.wrapping_mul(0x9E37_79B9_7F4A_7C15) >> 32;
+        candidates.nth(hash as usize % count)
     }
 
-    pub fn accept(&self, port: u16) -> AxResult<(SocketHandle, (IpEndpoint, IpEndpoint))> {
-        if let Some(entry) = self.tcp[port as usize].lock().deref_mut() {
-            let syn_queue = &mut entry.syn_queue;
-            let (idx, addr_tuple) = syn_queue
-                .iter()
-                .enumerate()
-                .find_map(|(idx, &handle)| {
-                    is_connected(handle).then(|| (idx, get_addr_tuple(handle)))
-                })
-                .ok_or(AxError::WouldBlock)?; // wait for connection
-            if idx > 0 {
-                warn!(
-                    "slow SYN queue enumeration: index = {}, len = {}!",
-                    idx,
-                    syn_queue.len()
-                );
-            }
-            let handle = syn_queue.swap_remove_front(idx).unwrap();
-            Ok((handle, addr_tuple))
-        } else {
-            ax_err!(InvalidInput, "socket accept() failed: not listen")
+    /// Connects a local socket at `src` to the socket listening on `dst`,
+    /// which is a local address, and returns the end of the client.
+    pub fn connect_local(
+        &self,
+        src: IpEndpoint,
+        dst: IpEndpoint,
+        buf_sizes: BufferSizes,
+    ) -> AxResult<LocalConnection> {
+        let listeners = self.tcp[dst.port as usize].lock();
+        let Some(listener) = Self::select(&listeners, src, dst) else {
+            return ax_err!(ConnectionRefused, "socket connect() failed");
+        };
+        let mut queues = listener.queues.lock();
+        if queues.len() >= LISTEN_QUEUE_SIZE {
+            return ax_err!(ConnectionRefused, "socket connect() failed: queue full");
         }
+        let (client, server) = LocalConnection::pair(buf_sizes, listener.buf_sizes);
+        debug!("TCP socket: local connection {} -> {}", src, dst);
+        queues.local_queue.push_back((server, (dst, src)));
+        drop(queues);
+        drop(listeners);
+        // Wake up the listener.
+        poller::notify_events();
+        Ok(client)
     }
 
     pub fn incoming_tcp_packet(
@@ -116,40 +214,38 @@ impl ListenTable {
         dst: IpEndpoint,
         sockets: &mut SocketSet<'_>,
     ) {
-        if let Some(entry) = self.tcp[dst.port as usize].lock().deref_mut() {
-            if !entry.can_accept(dst.addr) {
-                // not listening on this address
-                return;
-            }
-            if entry.syn_queue.len() >= LISTEN_QUEUE_SIZE {
-                // SYN queue is full, drop the packet
-                warn!("SYN queue overflow!");
-                return;
-            }
-            let mut socket = SocketSetWrapper::new_tcp_socket();
-            if socket.listen(entry.listen_endpoint).is_ok() {
-                let handle = sockets.add(socket);
-                debug!(
-                    "TCP socket {}: prepare for connection {} -> {}",
-                    handle, src, entry.listen_endpoint
-                );
-                entry.syn_queue.push_back(handle);
-            }
+        let listeners = self.tcp[dst.port as usize].lock();
+        let Some(listener) = Self::select(&listeners, src, dst) else {
+            // not listening on this address
+            return;
+        };
+        let mut queues = listener.queues.lock();
+        if queues.syn_queue.len() >= LISTEN_QUEUE_SIZE {
+            // SYN queue is full, drop the packet
+            warn!("SYN queue overflow!");
+            return;
+        }
+        let mut socket = SocketSetWrapper::new_tcp_socket(listener.buf_sizes);
+        if socket.listen(listener.listen_endpoint).is_ok() {
+            let handle = sockets.add(socket);
+            debug!(
+                "TCP socket {}: prepare for connection {} -> {}",
+                handle, src, listener.listen_endpoint
+            );
+            queues.syn_queue.push_back(handle);
         }
     }
 }
 
-fn is_connected(handle: SocketHandle) -> bool {
-    SOCKET_SET.with_socket::<tcp::Socket, _, _>(handle, |socket| {
-        !matches!(socket.state(), State::Listen | State::SynReceived)
-    })
+fn is_connected(sockets: &SocketSet<'_>, handle: SocketHandle) -> bool {
+    let socket = sockets.get::<tcp::Socket>(handle);
+    !matches!(socket.state(), State::Listen | State::SynReceived)
 }
 
-fn get_addr_tuple(handle: SocketHandle) -> (IpEndpoint, IpEndpoint) {
-    SOCKET_SET.with_socket::<tcp::Socket, _, _>(handle, |socket| {
-        (
-            socket.local_endpoint().unwrap(),
-            socket.remote_endpoint().unwrap(),
-        )
-    })
+fn get_addr_tuple(sockets: &SocketSet<'_>, handle: SocketHandle) -> (IpEndpoint, IpEndpoint) {
+    let socket = sockets.get::<tcp::Socket>(handle);
+    (
+        socket.local_endpoint().unwrap(),
+        socket.remote_endpoint().unwrap(),
+    )
 }
@@ -0,0 +1,216 @@
+//! TCP connections between local sockets, without going through smoltcp.
+//!
+//! The interface has no loopback device, and a connection to the host itself
+//! would otherwise take the full Ethernet/IP/TCP path. Instead, a connection
+//! to a local address with a listening socket is made at the socket level:
+//! the two ends share a byte queue in each direction, and data is copied
+//! straight from the sender to the queue of the receiver, with no headers,
+//! segmentation or acknowledgements.
+
+use alloc::{boxed::Box, sync::Arc, vec};
+use core::sync::atomic::{AtomicBool, Ordering};
+
+use axerrno::{AxError, AxResult, ax_err};
+use axio::PollState;
+use axsync::Mutex;
+use smoltcp::wire::IpAddress;
+
+use super::{BufferSizes, ETH0, poller};
+
+/// Whether `addr` is an address of the host itself.
+pub(super) fn is_local_addr(addr: IpAddress) -> bool {
+    addr.is_loopback()
+        || ETH0
+            .iface
+            .lock()
+            .ip_addrs()
+            .iter()
+            .any(|cidr| cidr.address() == addr)
+}
+
+/// A byte queue backed by a ring buffer.
+struct RingBuffer {
+    buf: Box<[u8]>,
+    head: usize,
+    len: usize,
+}
+
+impl RingBuffer {
+    fn new(capacity: usize) -> Self {
+        Self {
+            buf: vec![0; capacity].into_boxed_slice(),
+            head: 0,
+            len: 0,
+        }
+    }
+
+    fn capacity(&self) -> usize {
+        self.buf.len()
+    }
+
+    fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    fn is_full(&self) -> bool {
+        self.len == self.capacity()
+    }
+
+    /// Returns the free space following the queued data, up to the end of
+    /// the ring.
+    fn free_span(&mut self) -> &mut [u8] {
+        let cap = self.capacity();
+        let tail = (self.head + self.len) % cap;
+        let end = if tail < self.head || self.is_full() {
+            self.head
+        } else {
+            cap
+        };
+        &mut self.buf[tail..end]
+    }
+
+    /// Appends `size` bytes that have been filled into the free space.
+    fn commit(&mut self, size: usize) {
+        debug_assert!(self.len + size <= self.capacity());
+        self.len += size;
+    }
+
+    fn write(&mut self, mut data: &[u8]) -> usize {
+        let mut written = 0;
+        while !data.is_empty() && !self.is_full() {
+            let span = self.free_span();
+            let n = span.len().min(data.len());
+            span[..n].copy_from_slice(&data[..n]);
+            self.commit(n);
+            data = &data[n..];
+            written += n;
+        }
+        written
+    }
+
+    fn read(&mut self, buf: &mut [u8]) -> usize {
+        let mut read = 0;
+        while read < buf.len() && !self.is_empty() {
+            let n = (self.capacity() - self.head)
+                .min(self.len)
+                .min(buf.len() - read);
+            buf[read..read + n].copy_from_slice(&self.buf[self.head..self.head + n]);
+            self.head = (self.head + n) % self.capacity();
+            self.len -= n;
+            read += n;
+        }
+        if self.is_empty() {
+            // Rewind so that the next write is a single contiguous copy.
+            self.head = 0;
+        }
+        read
+    }
+}
+
+/// The data sent in one direction of a connection.
+struct Channel {
+    buf: Mutex<RingBuffer>,
+    /// Whether the receiving end has been closed, so that sending fails.
+    rx_closed: AtomicBool,
+    /// Whether the sending end has been closed, so that receiving returns
+    /// end-of-file once the queue is drained.
+    tx_closed: AtomicBool,
+}
+
+impl Channel {
+    fn new(capacity: usize) -> Arc<Self> {
+        Arc::new(Self {
+            buf: Mutex::new(RingBuffer::new(capacity)),
+            rx_closed: AtomicBool::new(false),
+            tx_closed: AtomicBool::new(false),
+        })
+    }
+}
+
+/// One end of a TCP connection between local sockets.
+pub(super) struct LocalConnection {
+    /// Data sent to this end.
+    rx: Arc<Channel>,
+    /// Data sent by this end.
+    tx: Arc<Channel>,
+}
+
+impl LocalConnection {
+    /// Creates the two ends of a connection, each receiving into a queue of
+    /// the receive buffer size of its socket.
+    pub fn pair(client: BufferSizes, server: BufferSizes) -> (Self, Self) {
+        let to_server = Channel::new(server.rx);
+        let to_client = Channel::new(client.rx);
+        (
+            Self {
+                rx: to_client.clone(),
+                tx: to_server.clone(),
+            },
+            Self {
+                rx: to_server,
+                tx: to_client,
+            },
+        )
+    }
+
+    pub fn recv_buffer_size(&self) -> usize {
+        self.rx.buf.lock().capacity()
+    }
+
+    pub fn send_buffer_size(&self) -> usize {
+        self.tx.buf.lock().capacity()
+    }
+
+    /// Receives data into `buf`, returning 0 once the peer has closed the
+    /// connection and all data has been received.
+    pub fn recv(&self, buf: &mut [u8]) -> AxResult<usize> {
+        let mut queue = self.rx.buf.lock();
+        if queue.is_empty() {
+            return if self.rx.tx_closed.load(Ordering::Acquire) {
+                Ok(0)
+            } else {
+                Err(AxError::WouldBlock)
+            };
+        }
+        let len = queue.read(buf);
+        drop(queue);
+        poller::notify_events();
+        Ok(len)
+    }
+
+    pub fn send(&self, buf: &[u8]) -> AxResult<usize> {
+        if self.tx.rx_closed.load(Ordering::Acquire) {
+            return ax_err!(ConnectionReset, "socket send() failed");
+        }
+        let mut queue = self.tx.buf.lock();
+        if queue.is_full() {
+            return Err(AxError::WouldBlock);
+        }
+        let len = queue.write(buf);
+        drop(queue);
+        poller::notify_events();
+        Ok(len)
+    }
+
+    pub fn poll(&self) -> PollState {
+        // A closed peer makes the operation return immediately, so it counts
+        // as ready too.
+        PollState {
+            readable: !self.rx.buf.lock().is_empty() || self.rx.tx_closed.load(Ordering::Acquire),
+            writable: !self.tx.buf.lock().is_full() || self.tx.rx_closed.load(Ordering::Acquire),
+        }
+    }
+
+    /// Closes both directions of the connection.
+    pub fn close(&self) {
+        self.tx.tx_closed.store(true, Ordering::Release);
+        self.rx.rx_closed.store(true, Ordering::Release);
+        poller::notify_events();
+    }
+}
+
+impl Drop for LocalConnection {
+    fn drop(&mut self) {
+        self.close();
+    }
+}
@@ -2,27 +2,36 @@ mod addr;
 mod bench;
 mod dns;
 mod listen_table;
+mod loopback;
+mod poller;
 mod tcp;
 mod udp;
 
 use alloc::vec;
 use core::cell::RefCell;
-use core::ops::DerefMut;
+use core::ops::{Deref, DerefMut};
+use core::sync::atomic::{AtomicUsize, Ordering};
+use core::time::Duration;
 
 use axdriver::prelude::*;
 use axdriver_net::{DevError, NetBufPtr};
 use axhal::time::{NANOS_PER_MICROS, wall_time_nanos};
 use axsync::Mutex;
+#[cfg(feature = "multitask")]
+use axsync::{LockClass, RawRwLock, RwLock};
 use lazyinit::LazyInit;
 use smoltcp::iface::{Config, Interface, SocketHandle, SocketSet};
-use smoltcp::phy::{Device, DeviceCapabilities, Medium, RxToken, TxToken};
+use smoltcp::phy::{Checksum, Device, DeviceCapabilities, Medium, RxToken, TxToken};
 use smoltcp::socket::{self, AnySocket};
 use smoltcp::time::Instant;
 use smoltcp::wire::{EthernetAddress, HardwareAddress, IpAddress, IpCidr};
+#[cfg(not(feature = "multitask"))]
+use spin::RwLock;
 
 use self::listen_table::ListenTable;
 
 pub use self::dns::dns_query;
+pub use self::poller::set_event_hook;
 pub use self::tcp::TcpSocket;
 pub use self::udp::UdpSocket;
 
@@ -44,20 +53,121 @@ const STANDARD_MTU: usize = 1500;
 
 const RANDOM_SEED: u64 = 0xA2CE_05A2_CE05_A2CE;
 
-const TCP_RX_BUF_LEN: usize = 64 * 1024;
-const TCP_TX_BUF_LEN: usize = 64 * 1024;
-const UDP_RX_BUF_LEN: usize = 64 * 1024;
-const UDP_TX_BUF_LEN: usize = 64 * 1024;
+const TCP_BUF_SIZES: BufferSizes = BufferSizes {
+    rx: 64 * 1024,
+    tx: 64 * 1024,
+};
+const UDP_BUF_SIZES: BufferSizes = BufferSizes {
+    rx: 64 * 1024,
+    tx: 64 * 1024,
+};
 const LISTEN_QUEUE_SIZE: usize = 512;
 
-static LISTEN_TABLE: LazyInit<ListenTable> = LazyInit::new();
-static SOCKET_SET: LazyInit<SocketSetWrapper> = LazyInit::new();
-static ETH0: LazyInit<InterfaceWrapper> = LazyInit::new();
+/// The smallest size of a socket buffer.
+const MIN_BUF_LEN: usize = 2048;
+/// The largest sizes of the receive and send buffers that can be set on a
+/// socket, as `net.core.rmem_max` and `net.core.wmem_max` on Linux.
+static RMEM_MAX: AtomicUsize = AtomicUsize::new(4 * 1024 * 1024);
+static WMEM_MAX: AtomicUsize = AtomicUsize::new(4 * 1024 * 1024);
+
+/// Sets the largest sizes of the receive and send buffers that can be set on
+/// a socket. Existing sockets keep their buffers.
+pub fn set_buffer_limits(rmem_max: usize, wmem_max: usize) {
+    RMEM_MAX.store(rmem_max.max(MIN_BUF_LEN), Ordering::Relaxed);
+    WMEM_MAX.store(wmem_max.max(MIN_BUF_LEN), Ordering::Relaxed);
+}
+
+/// The sizes of the receive and send buffers of a socket.
+#[derive(Clone, Copy)]
+struct BufferSizes {
+    rx: usize,
+    tx: usize,
+}
+
+/// The buffer sizes requested for a socket, applied when its buffers are
+/// allocated.
+struct BufferSizesCell {
+    rx: AtomicUsize,
+    tx: AtomicUsize,
+}
+
+impl BufferSizesCell {
+    const fn new(sizes: BufferSizes) -> Self {
+        Self {
+            rx: AtomicUsize::new(sizes.rx),
+            tx: AtomicUsize::new(sizes.tx),
+        }
+    }
+
+    fn get(&self) -> BufferSizes {
+        BufferSizes {
+            rx: self.rx.load(Ordering::Relaxed),
+            tx: self.tx.load(Ordering::Relaxed),
+        }
+    }
 
-struct SocketSetWrapper<'a>(Mutex<SocketSet<'a>>);
+    /// Requests a receive buffer of `size` bytes, within the limits.
+    fn set_rx(&self, size: usize) {
+        let size = size.clamp(MIN_BUF_LEN, RMEM_MAX.load(Ordering::Relaxed));
+        self.rx.store(size, Ordering::Relaxed);
+    }
+
+    /// Requests a send buffer of `size` bytes, within the limits.
+    fn set_tx(&self, size: usize) {
+        let size = size.clamp(MIN_BUF_LEN, WMEM_MAX.load(Ordering::Relaxed));
+        self.tx.store(size, Ordering::Relaxed);
+    }
+}
+
+static LISTEN_TABLE: OnFirstUse<ListenTable> = OnFirstUse::new();
+static SOCKET_SET: OnFirstUse<SocketSetWrapper> = OnFirstUse::new();
+static ETH0: OnFirstUse<InterfaceWrapper> = OnFirstUse::new();
+
+/// The NIC given to [`init`], until the network stack is set up on it.
+static PENDING_NIC: spin::Mutex<Option<AxNetDevice>> = spin::Mutex::new(None);
+static SETUP: spin::Once = spin::Once::new();
+
+/// A part of the network stack, which is set up when the network is first
+/// used, so that systems that never use it boot faster.
+struct OnFirstUse<T> {
+    lazy: LazyInit<T>,
+}
+
+impl<T> OnFirstUse<T> {
+    const fn new() -> Self {
+        Self {
+            lazy: LazyInit::new(),
+        }
+    }
+}
+
+impl<T> Deref for OnFirstUse<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        if !self.lazy.is_inited() {
+            SETUP.call_once(setup);
+        }
+        &self.lazy
+    }
+}
+
+/// All sockets of the interface.
+///
+/// smoltcp needs all of them at once to poll the interface, so they cannot be
+/// locked separately. Operations that only look at a socket, such as checking
+/// its state, take the lock shared and run in parallel. Lock order: device,
+/// interface, then sockets.
+struct SocketSetWrapper<'a>(RwLock<SocketSet<'a>>);
+
+/// The class of the lock of the socket set, see [`axsync::lock_classes`].
+#[cfg(feature = "multitask")]
+static SOCKET_SET_LOCKS: LockClass = LockClass::new("socket_set");
 
 struct DeviceWrapper {
     inner: RefCell<AxNetDevice>, // use `RefCell` is enough since it's wrapped in `Mutex` in `InterfaceWrapper`.
+    /// Whether received packets are known to have valid checksums.
+    rx_checksums_valid: bool,
 }
 
 struct InterfaceWrapper {
@@ -69,23 +179,28 @@ struct InterfaceWrapper {
 
 impl<'a> SocketSetWrapper<'a> {
     fn new() -> Self {
-        Self(Mutex::new(SocketSet::new(vec![])))
+        let set = SocketSet::new(vec![]);
+        #[cfg(feature = "multitask")]
+        let lock = RwLock::const_new(RawRwLock::with_class(&SOCKET_SET_LOCKS), set);
+        #[cfg(not(feature = "multitask"))]
+        let lock = RwLock::new(set);
+        Self(lock)
     }
 
-    pub fn new_tcp_socket() -> socket::tcp::Socket<'a> {
-        let tcp_rx_buffer = socket::tcp::SocketBuffer::new(vec![0; TCP_RX_BUF_LEN]);
-        let tcp_tx_buffer = socket::tcp::SocketBuffer::new(vec![0; TCP_TX_BUF_LEN]);
+    pub fn new_tcp_socket(sizes: BufferSizes) -> socket::tcp::Socket<'a> {
+        let tcp_rx_buffer = socket::tcp::SocketBuffer::new(vec![0; sizes.rx]);
+        let tcp_tx_buffer = socket::tcp::SocketBuffer::new(vec![0; sizes.tx]);
         socket::tcp::Socket::new(tcp_rx_buffer, tcp_tx_buffer)
     }
 
-    pub fn new_udp_socket() -> socket::udp::Socket<'a> {
+    pub fn new_udp_socket(sizes: BufferSizes) -> socket::udp::Socket<'a> {
         let udp_rx_buffer = socket::udp::PacketBuffer::new(
             vec![socket::udp::PacketMetadata::EMPTY; 8],
-            vec![0; UDP_RX_BUF_LEN],
+            vec![0; sizes.rx],
         );
         let udp_tx_buffer = socket::udp::PacketBuffer::new(
             vec![socket::udp::PacketMetadata::EMPTY; 8],
-            vec![0; UDP_TX_BUF_LEN],
+            vec![0; sizes.tx],
         );
         socket::udp::Socket::new(udp_rx_buffer, udp_tx_buffer)
     }
@@ -96,8 +211,10 @@ impl<'a> SocketSetWrapper<'a> {
     }
 
     pub fn add<T: AnySocket<'a>>(&self, socket: T) -> SocketHandle {
-        let handle = self.0.lock().add(socket);
+        let handle = self.0.write().add(socket);
         debug!("socket {}: created", handle);
+        #[cfg(all(feature = "irq", feature = "multitask"))]
+        poller::kick();
         handle
     }
 
@@ -105,7 +222,7 @@ impl<'a> SocketSetWrapper<'a> {
     where
         F: FnOnce(&T) -> R,
     {
-        let set = self.0.lock();
+        let set = self.0.read();
         let socket = set.get(handle);
         f(socket)
     }
@@ -114,17 +231,35 @@ impl<'a> SocketSetWrapper<'a> {
     where
         F: FnOnce(&mut T) -> R,
     {
-        let mut set = self.0.lock();
+        let mut set = self.0.write();
         let socket = set.get_mut(handle);
-        f(socket)
+        let ret = f(socket);
+        drop(set);
+        // Anything queued to send goes out on the next poll.
+        #[cfg(all(feature = "irq", feature = "multitask"))]
+        poller::kick();
+        ret
     }
 
+    /// Makes the interface be polled, by the poller task if there is one.
     pub fn poll_interfaces(&self) {
-        ETH0.poll(&self.0);
+        #[cfg(all(feature = "irq", feature = "multitask"))]
+        poller::kick();
+        #[cfg(not(all(feature = "irq", feature = "multitask")))]
+        self.poll_now();
+    }
+
+    /// Polls the interface, and returns whether any packet was processed.
+    fn poll_now(&self) -> bool {
+        let progress = ETH0.poll(&self.0);
+        if progress {
+            poller::notify_events();
+        }
+        progress
     }
 
     pub fn remove(&self, handle: SocketHandle) {
-        self.0.lock().remove(handle);
+        self.0.write().remove(handle);
         debug!("socket {}: destroyed", handle);
     }
 }
@@ -170,19 +305,35 @@ impl InterfaceWrapper {
         };
     }
 
-    pub fn poll(&self, sockets: &Mutex<SocketSet>) {
+    /// Polls the interface, and returns whether any packet was processed.
+    pub fn poll(&self, sockets: &RwLock<SocketSet>) -> bool {
         let mut dev = self.dev.lock();
         let mut iface = self.iface.lock();
-        let mut sockets = sockets.lock();
+        let mut sockets = sockets.write();
         let timestamp = Self::current_time();
-        iface.poll(timestamp, dev.deref_mut(), &mut sockets);
+        iface.poll(timestamp, dev.deref_mut(), &mut sockets)
+    }
+
+    /// Returns how long the interface can go without being polled, or `None`
+    /// if there is no socket to poll it for.
+    #[allow(dead_code)]
+    pub fn poll_delay(&self, sockets: &RwLock<SocketSet>) -> Option<Duration> {
+        let mut iface = self.iface.lock();
+        let sockets = sockets.read();
+        if sockets.iter().next().is_none() {
+            return None;
+        }
+        let delay = iface.poll_delay(Self::current_time(), &sockets);
+        Some(delay.map_or(Duration::MAX, |d| Duration::from_micros(d.total_micros())))
     }
 }
 
 impl DeviceWrapper {
     fn new(inner: AxNetDevice) -> Self {
+        let rx_checksums_valid = inner.rx_checksums_validated();
         Self {
             inner: RefCell::new(inner),
+            rx_checksums_valid,
         }
     }
 }
@@ -237,6 +388,13 @@ impl Device for DeviceWrapper {
         caps.max_transmission_unit = 1514;
         caps.max_burst_size = None;
         caps.medium = Medium::Ethernet;
+        if self.rx_checksums_valid {
+            // Only compute checksums on transmit.
+            caps.checksum.ipv4 = Checksum::Tx;
+            caps.checksum.tcp = Checksum::Tx;
+            caps.checksum.udp = Checksum::Tx;
+            caps.checksum.icmpv4 = Checksum::Tx;
+        }
         caps
     }
 }
@@ -301,9 +459,13 @@ fn snoop_tcp_packet(buf: &[u8], sockets: &mut SocketSet<'_>) -> Result<(), smolt
 /// Poll the network stack.
 ///
 /// It may receive packets from the NIC and process them, and transmit queued
-/// packets to the NIC.
+/// packets to the NIC. With the poller task, it only wakes the task up, which
+/// is cheap enough for the interrupt handler of the NIC.
 pub fn poll_interfaces() {
-    SOCKET_SET.poll_interfaces();
+    // There is nothing to poll before the network is used.
+    if SETUP.is_completed() {
+        SOCKET_SET.poll_interfaces();
+    }
 }
 
 /// Benchmark raw socket transmit bandwidth.
@@ -316,7 +478,13 @@ pub fn bench_receive() {
     ETH0.dev.lock().bench_receive_bandwidth();
 }
 
+/// Keeps `net_dev` to set the network stack up on when it is first used.
 pub(crate) fn init(net_dev: AxNetDevice) {
+    *PENDING_NIC.lock() = Some(net_dev);
+}
+
+fn setup() {
+    let net_dev = PENDING_NIC.lock().take().expect("no NIC to set up");
     let ether_addr = EthernetAddress(net_dev.mac_address().0);
     let eth0 = InterfaceWrapper::new("eth0", net_dev, ether_addr);
 
@@ -325,12 +493,15 @@ pub(crate) fn init(net_dev: AxNetDevice) {
     eth0.setup_ip_addr(ip, IP_PREFIX);
     eth0.setup_gateway(gateway);
 
-    ETH0.init_once(eth0);
-    SOCKET_SET.init_once(SocketSetWrapper::new());
-    LISTEN_TABLE.init_once(ListenTable::new());
+    // Through the inner `LazyInit`s, as the setup is not complete yet.
+    ETH0.lazy.init_once(eth0);
+    SOCKET_SET.lazy.init_once(SocketSetWrapper::new());
+    LISTEN_TABLE.lazy.init_once(ListenTable::new());
+    #[cfg(all(feature = "irq", feature = "multitask"))]
+    poller::start();
 
-    info!("created net interface {:?}:", ETH0.name());
-    info!("  ether:    {}", ETH0.ethernet_address());
+    info!("created net interface {:?}:", ETH0.lazy.name());
+    info!("  ether:    {}", ETH0.lazy.ethernet_address());
     info!("  ip:       {}/{}", ip, IP_PREFIX);
     info!("  gateway:  {}", gateway);
 }
@@ -0,0 +1,122 @@
+//! Waiting on sockets, and polling the interface in the background.
+//!
+//! With interrupts and multitasking, the interface is polled by a dedicated
+//! task instead of by everyone who waits on a socket. The task sleeps until it
+//! is kicked, e.g. by the interrupt of the NIC or by a socket with something
+//! to send, or until the next timer of the interface expires. Tasks blocked on
+//! sockets sleep in a wait queue, and are woken up whenever a poll processed
+//! packets, as the states of sockets may have changed then.
+//!
+//! Otherwise, blocked tasks poll the interface themselves and yield in between.
+
+use core::sync::atomic::{AtomicU64, Ordering};
+
+use axerrno::{AxError, AxResult};
+
+/// The number of polls of the interface that processed packets.
+static EVENTS: AtomicU64 = AtomicU64::new(0);
+static EVENT_HOOK: spin::Once<fn()> = spin::Once::new();
+
+/// Sets a function to be called whenever the states of sockets may have
+/// changed, e.g. to wake up tasks that poll socket files.
+///
+/// It may be called from the poller task with no lock held, and can only be
+/// set once.
+pub fn set_event_hook(hook: fn()) {
+    EVENT_HOOK.call_once(|| hook);
+}
+
+/// Wakes up everyone waiting on sockets, after a poll that processed packets.
+pub(super) fn notify_events() {
+    EVENTS.fetch_add(1, Ordering::Release);
+    #[cfg(all(feature = "irq", feature = "multitask"))]
+    background::SOCKET_WQ.notify_all(false);
+    if let Some(hook) = EVENT_HOOK.get() {
+        hook();
+    }
+}
+
+/// Calls `f` until it completes or fails with an error other than
+/// [`WouldBlock`](AxError::WouldBlock), waiting for the interface to make
+/// progress in between.
+pub(super) fn block_on<F, T>(mut f: F) -> AxResult<T>
+where
+    F: FnMut() -> AxResult<T>,
+{
+    loop {
+        #[cfg(not(all(feature = "irq", feature = "multitask")))]
+        super::SOCKET_SET.poll_interfaces();
+        let seen = EVENTS.load(Ordering::Acquire);
+        match f() {
+            Ok(t) => return Ok(t),
+            Err(AxError::WouldBlock) => wait_events(seen),
+            Err(e) => return Err(e),
+        }
+    }
+}
+
+#[cfg(all(feature = "irq", feature = "multitask"))]
+fn wait_events(seen: u64) {
+    background::SOCKET_WQ.wait_until(|| EVENTS.load(Ordering::Acquire) != seen);
+}
+
+#[cfg(not(all(feature = "irq", feature = "multitask")))]
+fn wait_events(_seen: u64) {
+    axtask::yield_now();
+}
+
+#[cfg(all(feature = "irq", feature = "multitask"))]
+pub(super) use self::background::{kick, start};
+
+#[cfg(all(feature = "irq", feature = "multitask"))]
+mod background {
+    use alloc::string::String;
+    use core::sync::atomic::{AtomicBool, Ordering};
+    use core::time::Duration;
+
+    use axtask::WaitQueue;
+
+    use super::super::{ETH0, SOCKET_SET};
+
+    /// The longest the poller sleeps while there are sockets, as not all NICs
+    /// raise interrupts on receiving.
+    const RX_POLL_INTERVAL: Duration = Duration::from_millis(1);
+    const POLLER_STACK_SIZE: usize = 0x40000;
+
+    /// Tasks blocked on sockets.
+    pub(super) static SOCKET_WQ: WaitQueue = WaitQueue::new();
+    static POLLER_WQ: WaitQueue = WaitQueue::new();
+    static KICKED: AtomicBool = AtomicBool::new(false);
+
+    /// Makes the poller task poll the interface soon.
+    ///
+    /// It is cheap enough to be called from interrupt handlers, and on every
+    /// change to sockets.
+    pub fn kick() {
+        if !KICKED.swap(true, Ordering::AcqRel) {
+            POLLER_WQ.notify_one(false);
+        }
+    }
+
+    /// Starts the poller task.
+    pub fn start() {
+        axtask::spawn_raw(poller_main, String::from("net-poller"), POLLER_STACK_SIZE);
+    }
+
+    fn poller_main() {
+        loop {
+            KICKED.store(false, Ordering::Release);
+            if SOCKET_SET.poll_now() {
+                // More packets may be waiting.
+                continue;
+            }
+            let kicked = || KICKED.load(Ordering::Acquire);
+            match ETH0.poll_delay(&SOCKET_SET.0) {
+                Some(delay) => {
+                    POLLER_WQ.wait_timeout_until(delay.min(RX_POLL_INTERVAL), kicked);
+                }
+                None => POLLER_WQ.wait_until(kicked),
+            }
+        }
+    }
+}
@@ -1,3 +1,4 @@
+use alloc::sync::Arc;
 use core::cell::UnsafeCell;
 use core::net::SocketAddr;
 use core::sync::atomic::{AtomicBool, AtomicU8, Ordering};
@@ -8,10 +9,15 @@ use axsync::Mutex;
 
 use smoltcp::iface::SocketHandle;
 use smoltcp::socket::tcp::{self, ConnectError, State};
+use smoltcp::time::Duration;
 use smoltcp::wire::{IpEndpoint, IpListenEndpoint};
 
 use super::addr::{UNSPECIFIED_ENDPOINT, from_core_sockaddr, into_core_sockaddr, is_unspecified};
-use super::{ETH0, LISTEN_TABLE, SOCKET_SET, SocketSetWrapper};
+use super::listen_table::{Accepted, Listener};
+use super::loopback::{LocalConnection, is_local_addr};
+use super::{
+    BufferSizesCell, ETH0, LISTEN_TABLE, SOCKET_SET, SocketSetWrapper, TCP_BUF_SIZES, poller,
+};
 
 // State transitions:
 // CLOSED -(connect)-> BUSY -> CONNECTING -> CONNECTED -(shutdown)-> BUSY -> CLOSED
@@ -25,6 +31,10 @@ const STATE_CONNECTING: u8 = 2;
 const STATE_CONNECTED: u8 = 3;
 const STATE_LISTENING: u8 = 4;
 
+/// How long acknowledgements are delayed unless `TCP_QUICKACK` is set, the
+/// default of smoltcp.
+const ACK_DELAY: Duration = Duration::from_millis(10);
+
 /// A TCP socket that provides POSIX-like APIs.
 ///
 /// - [`connect`] is for TCP clients.
@@ -41,6 +51,17 @@ pub struct TcpSocket {
     local_addr: UnsafeCell<IpEndpoint>,
     peer_addr: UnsafeCell<IpEndpoint>,
     nonblock: AtomicBool,
+    buf_sizes: BufferSizesCell,
+    /// The connection to a local socket, which bypasses smoltcp.
+    local: UnsafeCell<Option<LocalConnection>>,
+    reuse_port: AtomicBool,
+    /// The entry in the listen table, once listening.
+    listener: UnsafeCell<Option<Arc<Listener>>>,
+    nodelay: AtomicBool,
+    cork: AtomicBool,
+    /// Whether the last send had `MSG_MORE`, which corks until the next one.
+    more: AtomicBool,
+    quickack: AtomicBool,
 }
 
 unsafe impl Sync for TcpSocket {}
@@ -54,21 +75,43 @@ impl TcpSocket {
             local_addr: UnsafeCell::new(UNSPECIFIED_ENDPOINT),
             peer_addr: UnsafeCell::new(UNSPECIFIED_ENDPOINT),
             nonblock: AtomicBool::new(false),
+            buf_sizes: BufferSizesCell::new(TCP_BUF_SIZES),
+            local: UnsafeCell::new(None),
+            reuse_port: AtomicBool::new(false),
+            listener: UnsafeCell::new(None),
+            nodelay: AtomicBool::new(false),
+            cork: AtomicBool::new(false),
+            more: AtomicBool::new(false),
+            quickack: AtomicBool::new(false),
         }
     }
 
-    /// Creates a new TCP socket that is already connected.
-    const fn new_connected(
-        handle: SocketHandle,
+    /// Creates a new TCP socket that is already connected, with the buffer
+    /// sizes of the listening socket.
+    fn new_connected(
+        conn: Accepted,
         local_addr: IpEndpoint,
         peer_addr: IpEndpoint,
+        buf_sizes: &BufferSizesCell,
     ) -> Self {
+        let (handle, local) = match conn {
+            Accepted::Smoltcp(handle) => (Some(handle), None),
+            Accepted::Local(conn) => (None, Some(conn)),
+        };
         Self {
             state: AtomicU8::new(STATE_CONNECTED),
-            handle: UnsafeCell::new(Some(handle)),
+            handle: UnsafeCell::new(handle),
             local_addr: UnsafeCell::new(local_addr),
             peer_addr: UnsafeCell::new(peer_addr),
             nonblock: AtomicBool::new(false),
+            buf_sizes: BufferSizesCell::new(buf_sizes.get()),
+            local: UnsafeCell::new(local),
+            reuse_port: AtomicBool::new(false),
+            listener: UnsafeCell::new(None),
+            nodelay: AtomicBool::new(false),
+            cork: AtomicBool::new(false),
+            more: AtomicBool::new(false),
+            quickack: AtomicBool::new(false),
         }
     }
 
@@ -115,21 +158,126 @@ impl TcpSocket {
         self.nonblock.store(nonblocking, Ordering::Release);
     }
 
+    /// Returns whether the port can be shared with other listening sockets
+    /// (`SO_REUSEPORT`).
+    pub fn reuse_port(&self) -> bool {
+        self.reuse_port.load(Ordering::Relaxed)
+    }
+
+    /// Allows other sockets that set it too to listen on the same port
+    /// (`SO_REUSEPORT`), for example one per worker of a server. Incoming
+    /// connections are spread across their accept queues.
+    ///
+    /// It must be set before [`listen`](Self::listen).
+    pub fn set_reuse_port(&self, reuse_port: bool) {
+        self.reuse_port.store(reuse_port, Ordering::Relaxed);
+    }
+
+    /// Returns whether Nagle's algorithm is disabled (`TCP_NODELAY`).
+    pub fn nodelay(&self) -> bool {
+        self.nodelay.load(Ordering::Relaxed)
+    }
+
+    /// Disables Nagle's algorithm (`TCP_NODELAY`), so that small writes are
+    /// sent at once instead of waiting for the data in flight to be
+    /// acknowledged.
+    pub fn set_nodelay(&self, nodelay: bool) {
+        self.nodelay.store(nodelay, Ordering::Relaxed);
+        self.update_options();
+    }
+
+    /// Returns whether small writes are held back (`TCP_CORK`).
+    pub fn cork(&self) -> bool {
+        self.cork.load(Ordering::Relaxed)
+    }
+
+    /// Holds back small writes to send them together (`TCP_CORK`), and sends
+    /// what is left once uncorked.
+    ///
+    /// smoltcp cannot hold back data while nothing is in flight, so it only
+    /// forces Nagle's algorithm on, even with [`set_nodelay`](Self::set_nodelay).
+    pub fn set_cork(&self, cork: bool) {
+        self.cork.store(cork, Ordering::Relaxed);
+        self.update_options();
+    }
+
+    /// Returns whether received data is acknowledged at once (`TCP_QUICKACK`).
+    pub fn quickack(&self) -> bool {
+        self.quickack.load(Ordering::Relaxed)
+    }
+
+    /// Acknowledges received data at once instead of delaying the ACK
+    /// (`TCP_QUICKACK`). Unlike on Linux, it stays in effect until cleared.
+    pub fn set_quickack(&self, quickack: bool) {
+        self.quickack.store(quickack, Ordering::Relaxed);
+        self.update_options();
+    }
+
+    /// Returns the size of the receive buffer.
+    pub fn recv_buffer_size(&self) -> usize {
+        if let Some(conn) = self.local_connection() {
+            return conn.recv_buffer_size();
+        }
+        match self.connection() {
+            Some(handle) => {
+                SOCKET_SET.with_socket::<tcp::Socket, _, _>(handle, |socket| socket.recv_capacity())
+            }
+            None => self.buf_sizes.get().rx,
+        }
+    }
+
+    /// Returns the size of the send buffer.
+    pub fn send_buffer_size(&self) -> usize {
+        if let Some(conn) = self.local_connection() {
+            return conn.send_buffer_size();
+        }
+        match self.connection() {
+            Some(handle) => {
+                SOCKET_SET.with_socket::<tcp::Socket, _, _>(handle, |socket| socket.send_capacity())
+            }
+            None => self.buf_sizes.get().tx,
+        }
+    }
+
+    /// Sets the size of the receive buffer, within the system-wide limits.
+    ///
+    /// The buffers of a connection cannot be resized, so it only applies to
+    /// connections made afterwards, including those accepted by a listening
+    /// socket.
+    pub fn set_recv_buffer_size(&self, size: usize) {
+        self.buf_sizes.set_rx(size);
+    }
+
+    /// Sets the size of the send buffer, within the system-wide limits.
+    ///
+    /// Like [`set_recv_buffer_size`](Self::set_recv_buffer_size), it only
+    /// applies to connections made afterwards.
+    pub fn set_send_buffer_size(&self, size: usize) {
+        self.buf_sizes.set_tx(size);
+    }
+
     /// Connects to the given address and port.
     ///
-    /// The local port is generated automatically.
+    /// The local port is generated automatically. A connection to a local
+    /// address is made directly to the listening socket, without smoltcp.
     pub fn connect(&self, remote_addr: SocketAddr) -> AxResult {
         self.update_state(STATE_CLOSED, STATE_CONNECTING, || {
+            let remote_endpoint = from_core_sockaddr(remote_addr);
+            if is_local_addr(remote_endpoint.addr) {
+                return self.connect_local(remote_endpoint);
+            }
+
             // SAFETY: no other threads can read or write these fields.
-            let handle = unsafe { self.handle.get().read() }
-                .unwrap_or_else(|| SOCKET_SET.add(SocketSetWrapper::new_tcp_socket()));
+            let handle = unsafe { self.handle.get().read() }.unwrap_or_else(|| {
+                SOCKET_SET.add(SocketSetWrapper::new_tcp_socket(self.buf_sizes.get()))
+            });
 
             // TODO: check remote addr unreachable
-            let remote_endpoint = from_core_sockaddr(remote_addr);
             let bound_endpoint = self.bound_endpoint()?;
             let iface = &ETH0.iface;
             let (local_endpoint, remote_endpoint) = SOCKET_SET
                 .with_socket_mut::<tcp::Socket, _, _>(handle, |socket| {
+                    self.apply_options(socket);
                     socket
                         .connect(iface.lock().context(), remote_endpoint, bound_endpoint)
                         .or_else(|e| match e {
@@ -157,6 +305,11 @@ impl TcpSocket {
         .unwrap_or_else(|_| ax_err!(AlreadyExists, "socket connect() failed: already connected"))?; // EISCONN
 
         // Here our state must be `CONNECTING`, and only one thread can run here.
+        // SAFETY: `self.local` is only written above.
+        if unsafe { (*self.local.get()).is_some() } {
+            self.set_state(STATE_CONNECTED);
+            return Ok(());
+        }
         if self.is_nonblocking() {
             Err(AxError::WouldBlock)
         } else {
@@ -209,7 +362,11 @@ impl TcpSocket {
             unsafe {
                 (*self.local_addr.get()).port = bound_endpoint.port;
             }
-            LISTEN_TABLE.listen(bound_endpoint)?;
+            let listener =
+                LISTEN_TABLE.listen(bound_endpoint, self.buf_sizes.get(), self.reuse_port())?;
+            // SAFETY: no other threads can read or write `self.listener` as we
+            // have changed the state to `BUSY`.
+            unsafe { *self.listener.get() = Some(listener) };
             debug!("TCP socket listening on {}", bound_endpoint);
             Ok(())
         })
@@ -227,12 +384,24 @@ impl TcpSocket {
             return ax_err!(InvalidInput, "socket accept() failed: not listen");
         }
 
-        // SAFETY: `self.local_addr` should be initialized after `bind()`.
-        let local_port = unsafe { self.local_addr.get().read().port };
+        let listener = self.listener().clone();
         self.block_on(|| {
-            let (handle, (local_addr, peer_addr)) = LISTEN_TABLE.accept(local_port)?;
+            if !self.is_listening() {
+                return ax_err!(InvalidInput, "socket accept() failed: not listen");
+            }
+            let (conn, (local_addr, peer_addr)) = listener.accept()?;
             debug!("TCP socket accepted a new connection {}", peer_addr);
-            Ok(TcpSocket::new_connected(handle, local_addr, peer_addr))
+            let socket = TcpSocket::new_connected(conn, local_addr, peer_addr, &self.buf_sizes);
+            // Accepted sockets inherit the TCP options of the listening one.
+            for (option, value) in [
+                (&socket.nodelay, &self.nodelay),
+                (&socket.cork, &self.cork),
+                (&socket.quickack, &self.quickack),
+            ] {
+                option.store(value.load(Ordering::Relaxed), Ordering::Relaxed);
+            }
+            socket.update_options();
+            Ok(socket)
         })
     }
 
@@ -240,6 +409,12 @@ impl TcpSocket {
     pub fn shutdown(&self) -> AxResult {
         // stream
         self.update_state(STATE_CONNECTED, STATE_CLOSED, || {
+            // SAFETY: no other threads can read or write `self.local`.
+            if let Some(conn) = unsafe { (*self.local.get()).as_ref() } {
+                conn.close();
+                unsafe { self.local_addr.get().write(UNSPECIFIED_ENDPOINT) }; // clear bound address
+                return Ok(());
+            }
             // SAFETY: `self.handle` should be initialized in a connected socket, and
             // no other threads can read or write it.
             let handle = unsafe { self.handle.get().read().unwrap() };
@@ -255,11 +430,9 @@ impl TcpSocket {
 
         // listener
         self.update_state(STATE_LISTENING, STATE_CLOSED, || {
-            // SAFETY: `self.local_addr` should be initialized in a listening socket,
-            // and no other threads can read or write it.
-            let local_port = unsafe { self.local_addr.get().read().port };
+            // The queued connections are dropped along with the listener.
+            LISTEN_TABLE.unlisten(self.listener());
             unsafe { self.local_addr.get().write(UNSPECIFIED_ENDPOINT) }; // clear bound address
-            LISTEN_TABLE.unlisten(local_port);
             SOCKET_SET.poll_interfaces();
             Ok(())
         })
@@ -276,6 +449,9 @@ impl TcpSocket {
         } else if !self.is_connected() {
             return ax_err!(NotConnected, "socket recv() failed");
         }
+        if let Some(conn) = self.local_connection() {
+            return self.block_on(|| conn.recv(buf));
+        }
 
         // SAFETY: `self.handle` should be initialized in a connected socket.
         let handle = unsafe { self.handle.get().read().unwrap() };
@@ -304,11 +480,27 @@ impl TcpSocket {
 
     /// Transmits data in the given buffer.
     pub fn send(&self, buf: &[u8]) -> AxResult<usize> {
+        self.send_impl(buf, false)
+    }
+
+    /// Transmits data in the given buffer, with more to follow (`MSG_MORE`).
+    ///
+    /// The data is held back like with [`set_cork`](Self::set_cork), until
+    /// the next send without more.
+    pub fn send_more(&self, buf: &[u8]) -> AxResult<usize> {
+        self.send_impl(buf, true)
+    }
+
+    fn send_impl(&self, buf: &[u8], more: bool) -> AxResult<usize> {
         if self.is_connecting() {
             return Err(AxError::WouldBlock);
         } else if !self.is_connected() {
             return ax_err!(NotConnected, "socket send() failed");
         }
+        self.set_more(more);
+        if let Some(conn) = self.local_connection() {
+            return self.block_on(|| conn.send(buf));
+        }
 
         // SAFETY: `self.handle` should be initialized in a connected socket.
         let handle = unsafe { self.handle.get().read().unwrap() };
@@ -402,6 +594,76 @@ impl TcpSocket {
         self.get_state() == STATE_LISTENING
     }
 
+    /// Applies the TCP options to the smoltcp socket of the connection.
+    fn apply_options(&self, socket: &mut tcp::Socket) {
+        let corked = self.cork.load(Ordering::Relaxed) || self.more.load(Ordering::Relaxed);
+        socket.set_nagle_enabled(corked || !self.nodelay.load(Ordering::Relaxed));
+        let quickack = self.quickack.load(Ordering::Relaxed);
+        socket.set_ack_delay((!quickack).then_some(ACK_DELAY));
+    }
+
+    /// Applies the TCP options to the connection, if there is one. Options
+    /// are irrelevant to connections between local sockets.
+    fn update_options(&self) {
+        if let Some(handle) = self.connection() {
+            SOCKET_SET
+                .with_socket_mut::<tcp::Socket, _, _>(handle, |socket| self.apply_options(socket));
+        }
+    }
+
+    /// Starts or ends holding back data for `MSG_MORE`.
+    fn set_more(&self, more: bool) {
+        if self.more.swap(more, Ordering::Relaxed) != more {
+            self.update_options();
+        }
+    }
+
+    /// Returns the handle of the connection, if the buffers of the socket
+    /// have been allocated.
+    fn connection(&self) -> Option<SocketHandle> {
+        match self.get_state() {
+            // SAFETY: `self.handle` is only written before these states.
+            STATE_CONNECTING | STATE_CONNECTED => unsafe { self.handle.get().read() },
+            _ => None,
+        }
+    }
+
+    /// Returns the entry of a listening socket in the listen table.
+    fn listener(&self) -> &Arc<Listener> {
+        // SAFETY: `self.listener` is only written before the `LISTENING`
+        // state, and is never cleared afterwards.
+        unsafe { (*self.listener.get()).as_ref().unwrap() }
+    }
+
+    /// Returns the connection to a local socket, if connected to one.
+    fn local_connection(&self) -> Option<&LocalConnection> {
+        match self.get_state() {
+            // SAFETY: `self.local` is only written before this state.
+            STATE_CONNECTED => unsafe { (*self.local.get()).as_ref() },
+            _ => None,
+        }
+    }
+
+    /// Connects to the socket listening on the local address
+    /// `remote_endpoint`.
+    fn connect_local(&self, remote_endpoint: IpEndpoint) -> AxResult {
+        let bound_endpoint = self.bound_endpoint()?;
+        let local_endpoint = IpEndpoint::new(
+            bound_endpoint.addr.unwrap_or(remote_endpoint.addr),
+            bound_endpoint.port,
+        );
+        let conn =
+            LISTEN_TABLE.connect_local(local_endpoint, remote_endpoint, self.buf_sizes.get())?;
+        unsafe {
+            // SAFETY: no other threads can read or write these fields as we
+            // have changed the state to `BUSY`.
+            self.local_addr.get().write(local_endpoint);
+            self.peer_addr.get().write(remote_endpoint);
+            *self.local.get() = Some(conn);
+        }
+        Ok(())
+    }
+
     fn bound_endpoint(&self) -> AxResult<IpListenEndpoint> {
         // SAFETY: no other threads can read or write `self.local_addr`.
         let local_addr = unsafe { self.local_addr.get().read() };
@@ -420,6 +682,14 @@ impl TcpSocket {
     }
 
     fn poll_connect(&self) -> AxResult<PollState> {
+        // A local connection is established as soon as it is made.
+        if unsafe { (*self.local.get()).is_some() } {
+            self.set_state(STATE_CONNECTED);
+            return Ok(PollState {
+                readable: false,
+                writable: true,
+            });
+        }
         // SAFETY: `self.handle` should be initialized above.
         let handle = unsafe { self.handle.get().read().unwrap() };
         let writable =
@@ -450,6 +720,9 @@ impl TcpSocket {
     }
 
     fn poll_stream(&self) -> AxResult<PollState> {
+        if let Some(conn) = self.local_connection() {
+            return Ok(conn.poll());
+        }
         // SAFETY: `self.handle` should be initialized in a connected socket.
         let handle = unsafe { self.handle.get().read().unwrap() };
         SOCKET_SET.with_socket::<tcp::Socket, _, _>(handle, |socket| {
@@ -461,10 +734,8 @@ impl TcpSocket {
     }
 
     fn poll_listener(&self) -> AxResult<PollState> {
-        // SAFETY: `self.local_addr` should be initialized in a listening socket.
-        let local_addr = unsafe { self.local_addr.get().read() };
         Ok(PollState {
-            readable: LISTEN_TABLE.can_accept(local_addr.port)?,
+            readable: self.listener().is_ready(),
             writable: false,
         })
     }
@@ -481,14 +752,7 @@ impl TcpSocket {
         if self.is_nonblocking() {
             f()
         } else {
-            loop {
-                SOCKET_SET.poll_interfaces();
-                match f() {
-                    Ok(t) => return Ok(t),
-                    Err(AxError::WouldBlock) => axtask::yield_now(),
-                    Err(e) => return Err(e),
-                }
-            }
+            poller::block_on(f)
         }
     }
 }
@@ -11,7 +11,7 @@ use smoltcp::socket::udp::{self, BindError, SendError};
 use smoltcp::wire::{IpEndpoint, IpListenEndpoint};
 
 use super::addr::{UNSPECIFIED_ENDPOINT, from_core_sockaddr, into_core_sockaddr, is_unspecified};
-use super::{SOCKET_SET, SocketSetWrapper};
+use super::{BufferSizesCell, SOCKET_SET, SocketSetWrapper, UDP_BUF_SIZES, poller};
 
 /// A UDP socket that provides POSIX-like APIs.
 pub struct UdpSocket {
@@ -19,19 +19,21 @@ pub struct UdpSocket {
     local_addr: RwLock<Option<IpEndpoint>>,
     peer_addr: RwLock<Option<IpEndpoint>>,
     nonblock: AtomicBool,
+    buf_sizes: BufferSizesCell,
 }
 
 impl UdpSocket {
     /// Creates a new UDP socket.
     #[allow(clippy::new_without_default)]
     pub fn new() -> Self {
-        let socket = SocketSetWrapper::new_udp_socket();
+        let socket = SocketSetWrapper::new_udp_socket(UDP_BUF_SIZES);
         let handle = SOCKET_SET.add(socket);
         Self {
             handle,
             local_addr: RwLock::new(None),
             peer_addr: RwLock::new(None),
             nonblock: AtomicBool::new(false),
+            buf_sizes: BufferSizesCell::new(UDP_BUF_SIZES),
         }
     }
 
@@ -69,6 +71,48 @@ impl UdpSocket {
         self.nonblock.store(nonblocking, Ordering::Release);
     }
 
+    /// Returns the size of the receive buffer.
+    pub fn recv_buffer_size(&self) -> usize {
+        self.buf_sizes.get().rx
+    }
+
+    /// Returns the size of the send buffer.
+    pub fn send_buffer_size(&self) -> usize {
+        self.buf_sizes.get().tx
+    }
+
+    /// Sets the size of the receive buffer, within the system-wide limits.
+    ///
+    /// The buffers are reallocated, and the datagrams queued in them are
+    /// dropped.
+    pub fn set_recv_buffer_size(&self, size: usize) {
+        self.buf_sizes.set_rx(size);
+        self.realloc_buffers();
+    }
+
+    /// Sets the size of the send buffer, within the system-wide limits.
+    ///
+    /// The buffers are reallocated, and the datagrams queued in them are
+    /// dropped.
+    pub fn set_send_buffer_size(&self, size: usize) {
+        self.buf_sizes.set_tx(size);
+        self.realloc_buffers();
+    }
+
+    /// Replaces the socket with one of the requested buffer sizes, bound to
+    /// the same endpoint.
+    fn realloc_buffers(&self) {
+        let mut new_socket = SocketSetWrapper::new_udp_socket(self.buf_sizes.get());
+        SOCKET_SET.with_socket_mut::<udp::Socket, _, _>(self.handle, |socket| {
+            let endpoint = socket.endpoint();
+            if endpoint.is_specified() {
+                // The endpoint was valid for the old socket.
+                new_socket.bind(endpoint).unwrap();
+            }
+            *socket = new_socket;
+        });
+    }
+
     /// Binds an unbound socket to the given address and port.
     ///
     /// It's must be called before [`send_to`](Self::send_to) and
@@ -127,6 +171,74 @@ impl UdpSocket {
         })
     }
 
+    /// Sends a batch of datagrams, each to its own address, with the sockets
+    /// locked once. On success, returns the number of datagrams sent.
+    ///
+    /// It blocks until at least one datagram is sent, and sends as many of
+    /// the rest as fit in the send buffer. An error is only returned if the
+    /// first one cannot be sent.
+    pub fn send_to_batch(&self, msgs: &[(&[u8], SocketAddr)]) -> AxResult<usize> {
+        if msgs.is_empty() {
+            return Ok(0);
+        }
+        if self.local_addr.read().is_none() {
+            return ax_err!(NotConnected, "socket send() failed");
+        }
+        for (_, addr) in msgs {
+            if addr.port() == 0 || addr.ip().is_unspecified() {
+                return ax_err!(InvalidInput, "socket send_to() failed: invalid address");
+            }
+        }
+
+        self.block_on(|| {
+            SOCKET_SET.with_socket_mut::<udp::Socket, _, _>(self.handle, |socket| {
+                let mut sent = 0;
+                for &(buf, addr) in msgs {
+                    match socket.send_slice(buf, from_core_sockaddr(addr)) {
+                        Ok(()) => sent += 1,
+                        Err(SendError::BufferFull) => break,
+                        Err(SendError::Unaddressable) if sent == 0 => {
+                            return ax_err!(ConnectionRefused, "socket send() failed");
+                        }
+                        Err(SendError::Unaddressable) => break,
+                    }
+                }
+                if sent == 0 {
+                    // tx buffer is full
+                    Err(AxError::WouldBlock)
+                } else {
+                    Ok(sent)
+                }
+            })
+        })
+    }
+
+    /// Receives a batch of at most `max` datagrams, with the sockets locked
+    /// once. On success, returns the number of datagrams received.
+    ///
+    /// Each datagram is passed to `f` in order, with its index and origin.
+    /// It blocks until at least one datagram is received, and takes the rest
+    /// only if they are already queued.
+    pub fn recv_from_batch<F>(&self, max: usize, mut f: F) -> AxResult<usize>
+    where
+        F: FnMut(usize, &[u8], SocketAddr),
+    {
+        if max == 0 {
+            return Ok(0);
+        }
+        self.recv_impl(|socket| {
+            let mut received = 0;
+            while received < max {
+                let Ok((data, meta)) = socket.recv() else {
+                    break;
+                };
+                f(received, data, into_core_sockaddr(meta.endpoint));
+                received += 1;
+            }
+            Ok(received)
+        })
+    }
+
     /// Connects this UDP socket to a remote address, allowing the `send` and
     /// `recv` to be used to send data and also applies filters to only receive
     /// data from the specified address.
@@ -259,14 +371,7 @@ impl UdpSocket {
         if self.is_nonblocking() {
             f()
         } else {
-            loop {
-                SOCKET_SET.poll_interfaces();
-                match f() {
-                    Ok(t) => return Ok(t),
-                    Err(AxError::WouldBlock) => axtask::yield_now(),
-                    Err(e) => return Err(e),
-                }
-            }
+            poller::block_on(f)
         }
     }
 }
@@ -0,0 +1,53 @@
+//! Timestamps of the phases of boot, to see where the boot time goes.
+
+use core::fmt;
+
+use axhal::time::monotonic_time_nanos;
+use kspin::SpinNoIrq;
+
+/// The most phases that are recorded, the later ones are dropped.
+const MAX_PHASES: usize = 16;
+
+#[derive(Clone, Copy)]
+struct BootPhases {
+    /// The name of each phase and when it ended, since boot.
+    phases: [(&'static str, u64); MAX_PHASES],
+    len: usize,
+}
+
+static BOOT_PHASES: SpinNoIrq<BootPhases> = SpinNoIrq::new(BootPhases {
+    phases: [("", 0); MAX_PHASES],
+    len: 0,
+});
+
+/// Records that the boot phase `name` ended now. It started when the previous
+/// one ended, or at boot for the first one.
+pub fn record_boot_phase(name: &'static str) {
+    let now = monotonic_time_nanos();
+    let mut boot = BOOT_PHASES.lock();
+    if boot.len < MAX_PHASES {
+        let len = boot.len;
+        boot.phases[len] = (name, now);
+        boot.len += 1;
+    }
+}
+
+impl fmt::Display for BootPhases {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let mut start = 0;
+        f.write_str("Boot phases (us):")?;
+        for &(name, end) in &self.phases[..self.len] {
+            write!(f, " {}={}", name, (end - start) / 1000)?;
+            start = end;
+        }
+        write!(f, ", total={}", start / 1000)
+    }
+}
+
+/// Prints how long each of the recorded boot phases took, in microseconds, on
+/// one line.
+pub fn print_boot_phases() {
+    // Not printed with the lock held.
+    let boot = *BOOT_PHASES.lock();
+    ax_println!("{}", boot);
+}
@@ -2,6 +2,9 @@ use core::panic::PanicInfo;
 
 #[panic_handler]
 fn panic(info: &PanicInfo) -> ! {
+    if let Some(hook) = crate::panic_hook() {
+        hook();
+    }
     error!("{}", info);
     axhal::misc::terminate()
 }
@@ -15,6 +15,9 @@
 //! - `display`: Enable graphics support.
 //!
 //! All the features are optional and disabled by default.
+//!
+//! The time taken by each phase of the initialization is recorded, see
+//! [`record_boot_phase`] and [`print_boot_phases`].
 
 #![cfg_attr(not(test), no_std)]
 #![feature(doc_auto_cfg)]
@@ -22,12 +25,14 @@
 #[macro_use]
 extern crate axlog;
 
+mod boot_time;
 #[cfg(all(target_os = "none", not(test)))]
 mod lang_items;
 
 #[cfg(feature = "smp")]
 mod mp;
 
+pub use self::boot_time::{print_boot_phases, record_boot_phase};
 #[cfg(feature = "smp")]
 pub use self::mp::rust_main_secondary;
 
@@ -83,14 +88,55 @@ impl axlog::LogIf for LogIfImpl {
     }
 }
 
-use core::sync::atomic::{AtomicUsize, Ordering};
+use core::sync::atomic::{AtomicBool, AtomicPtr, AtomicUsize, Ordering};
 
 static INITED_CPUS: AtomicUsize = AtomicUsize::new(0);
+static PANIC_HOOK: AtomicPtr<()> = AtomicPtr::new(core::ptr::null_mut());
 
 fn is_init_ok() -> bool {
     INITED_CPUS.load(Ordering::Acquire) == axconfig::SMP
 }
 
+/// Sets a function to be called on panic before the system terminates, e.g.
+/// to flush buffered output.
+///
+/// It is called on the panicking CPU, which may hold any lock.
+pub fn set_panic_hook(hook: fn()) {
+    PANIC_HOOK.store(hook as *mut (), Ordering::Release);
+}
+
+/// Calls the destructors in `.fini_array` in reverse order, as the C runtime
+/// does when the program exits, e.g. to flush the buffers of C stdio.
+///
+/// It is called when `main` returns, and may be called by `exit` before. Only
+/// the first call runs the destructors.
+pub fn call_dtors() {
+    static CALLED: AtomicBool = AtomicBool::new(false);
+    if CALLED.swap(true, Ordering::AcqRel) {
+        return;
+    }
+    unsafe extern "C" {
+        static __fini_array_start: extern "C" fn();
+        static __fini_array_end: extern "C" fn();
+    }
+    // SAFETY: the linker script puts only function pointers between the two.
+    unsafe {
+        let start = &raw const __fini_array_start;
+        let end = &raw const __fini_array_end;
+        let dtors = core::slice::from_raw_parts(start, end.offset_from(start) as usize);
+        for dtor in dtors.iter().rev() {
+            dtor();
+        }
+    }
+}
+
+#[cfg(all(target_os = "none", not(test)))]
+fn panic_hook() -> Option<fn()> {
+    let hook = PANIC_HOOK.load(Ordering::Acquire);
+    // SAFETY: only function pointers are stored in `PANIC_HOOK`.
+    (!hook.is_null()).then(|| unsafe { core::mem::transmute::<*mut (), fn()>(hook) })
+}
+
 /// The main entry point of the ArceOS runtime.
 ///
 /// It is called from the bootstrapping code in [axhal]. `cpu_id` is the ID of
@@ -141,36 +187,51 @@ pub extern "C" fn rust_main(cpu_id: usize, dtb: usize) -> ! {
         );
     }
 
+    record_boot_phase("early");
+
     #[cfg(feature = "alloc")]
     init_allocator();
 
     #[cfg(feature = "paging")]
     axmm::init_memory_management();
+    record_boot_phase("memory");
 
     info!("Initialize platform devices...");
     axhal::platform_init();
 
     #[cfg(feature = "multitask")]
     axtask::init_scheduler();
+    record_boot_phase("platform");
+
+    // The secondary CPUs initialize themselves while the devices are probed.
+    #[cfg(feature = "smp")]
+    self::mp::start_secondary_cpus(cpu_id);
 
     #[cfg(any(feature = "fs", feature = "net", feature = "display"))]
     {
         #[allow(unused_variables)]
         let all_devices = axdriver::init_drivers();
+        record_boot_phase("drivers");
 
         #[cfg(feature = "fs")]
-        axfs::init_filesystems(all_devices.block);
+        {
+            axfs::init_filesystems(all_devices.block);
+            record_boot_phase("fs");
+        }
 
         #[cfg(feature = "net")]
-        axnet::init_network(all_devices.net);
+        {
+            axnet::init_network(all_devices.net);
+            record_boot_phase("net");
+        }
 
         #[cfg(feature = "display")]
-        axdisplay::init_display(all_devices.display);
+        {
+            axdisplay::init_display(all_devices.display);
+            record_boot_phase("display");
+        }
     }
 
-    #[cfg(feature = "smp")]
-    self::mp::start_secondary_cpus(cpu_id);
-
     #[cfg(feature = "irq")]
     {
         info!("Initialize interrupt handlers...");
@@ -191,8 +252,10 @@ pub extern "C" fn rust_main(cpu_id: usize, dtb: usize) -> ! {
     while !is_init_ok() {
         core::hint::spin_loop();
     }
+    record_boot_phase("cpus");
 
     unsafe { main() };
+    call_dtors();
 
     #[cfg(feature = "multitask")]
     axtask::exit(0);
@@ -236,13 +299,17 @@ fn init_allocator() {
 fn init_interrupt() {
     use axhal::time::TIMER_IRQ_NUM;
 
-    // Setup timer interrupt handler
+    // Setup timer interrupt handler. With multitasking, the task manager
+    // programs the timer itself, see `axtask::on_timer_irq`.
+    #[cfg(not(feature = "multitask"))]
     const PERIODIC_INTERVAL_NANOS: u64 =
         axhal::time::NANOS_PER_SEC / axconfig::TICKS_PER_SEC as u64;
 
+    #[cfg(not(feature = "multitask"))]
     #[percpu::def_percpu]
     static NEXT_DEADLINE: u64 = 0;
 
+    #[cfg(not(feature = "multitask"))]
     fn update_timer() {
         let now_ns = axhal::time::monotonic_time_nanos();
         // Safety: we have disabled preemption in IRQ handler.
@@ -255,15 +322,31 @@ fn init_interrupt() {
     }
 
     axhal::irq::register_handler(TIMER_IRQ_NUM, || {
-        update_timer();
         #[cfg(feature = "multitask")]
-        axtask::on_timer_tick();
+        axtask::on_timer_irq();
+        #[cfg(not(feature = "multitask"))]
+        update_timer();
     });
 
+    // Other CPUs interrupt this one when they wake up tasks to run on it, or
+    // when they change the page tables it has loaded.
+    #[cfg(feature = "smp")]
+    if let Some(ipi_irq_num) = axhal::irq::IPI_IRQ_NUM {
+        axhal::irq::register_handler(ipi_irq_num, on_ipi);
+    }
+
     // Enable IRQs before starting app
     axhal::arch::enable_irqs();
 }
 
+#[cfg(all(feature = "irq", feature = "smp"))]
+fn on_ipi() {
+    #[cfg(feature = "paging")]
+    axmm::handle_tlb_shootdown();
+    #[cfg(feature = "multitask")]
+    axtask::on_ipi();
+}
+
 #[cfg(all(feature = "tls", not(feature = "multitask")))]
 fn init_tls() {
     let main_tls = axhal::tls::TlsArea::alloc();
@@ -0,0 +1,221 @@
+//! Lock classes, which gather the contention statistics of a kind of lock.
+
+use core::ops::{Deref, DerefMut};
+use core::ptr;
+use core::sync::atomic::{AtomicBool, AtomicPtr, AtomicU64, Ordering};
+
+use axhal::time::monotonic_time_nanos;
+use kspin::{SpinNoIrq, SpinNoIrqGuard};
+
+/// A class of locks that share their contention statistics, e.g. all the
+/// locks of one kind of object.
+///
+/// A class shows up in [`lock_classes`] once one of its locks is contended,
+/// or with the `lockstat` feature, once one of them is acquired.
+pub struct LockClass {
+    name: &'static str,
+    contended: AtomicU64,
+    spun: AtomicU64,
+    slept: AtomicU64,
+    handoffs: AtomicU64,
+    wait_ns: AtomicU64,
+    #[cfg(feature = "lockstat")]
+    acquisitions: AtomicU64,
+    #[cfg(feature = "lockstat")]
+    max_hold_ns: AtomicU64,
+    registered: AtomicBool,
+    next: AtomicPtr<LockClass>,
+}
+
+/// The contention statistics of a [`LockClass`].
+#[derive(Debug, Clone, Copy, Default)]
+pub struct LockStats {
+    /// The number of times a lock was acquired, only counted with the
+    /// `lockstat` feature.
+    pub acquisitions: u64,
+    /// The number of times a lock was found locked.
+    pub contended: u64,
+    /// The number of those that got the lock without sleeping.
+    pub spun: u64,
+    /// The number of times a task went to sleep on a lock.
+    pub slept: u64,
+    /// The number of times a mutex was handed over to a sleeping task.
+    pub handoffs: u64,
+    /// The total time tasks waited for a contended lock.
+    pub wait_ns: u64,
+    /// The longest time a lock was held exclusively, only measured with the
+    /// `lockstat` feature.
+    pub max_hold_ns: u64,
+}
+
+/// The head of the list of the classes registered so far.
+static CLASSES: AtomicPtr<LockClass> = AtomicPtr::new(ptr::null_mut());
+
+impl LockClass {
+    /// Creates a [`LockClass`] named `name`.
+    pub const fn new(name: &'static str) -> Self {
+        Self {
+            name,
+            contended: AtomicU64::new(0),
+            spun: AtomicU64::new(0),
+            slept: AtomicU64::new(0),
+            handoffs: AtomicU64::new(0),
+            wait_ns: AtomicU64::new(0),
+            #[cfg(feature = "lockstat")]
+            acquisitions: AtomicU64::new(0),
+            #[cfg(feature = "lockstat")]
+            max_hold_ns: AtomicU64::new(0),
+            registered: AtomicBool::new(false),
+            next: AtomicPtr::new(ptr::null_mut()),
+        }
+    }
+
+    /// Returns the name of the class.
+    pub fn name(&self) -> &'static str {
+        self.name
+    }
+
+    /// Returns the contention statistics of the class.
+    pub fn stats(&self) -> LockStats {
+        #[cfg(feature = "lockstat")]
+        let (acquisitions, max_hold_ns) = (
+            self.acquisitions.load(Ordering::Relaxed),
+            self.max_hold_ns.load(Ordering::Relaxed),
+        );
+        #[cfg(not(feature = "lockstat"))]
+        let (acquisitions, max_hold_ns) = (0, 0);
+        LockStats {
+            acquisitions,
+            contended: self.contended.load(Ordering::Relaxed),
+            spun: self.spun.load(Ordering::Relaxed),
+            slept: self.slept.load(Ordering::Relaxed),
+            handoffs: self.handoffs.load(Ordering::Relaxed),
+            wait_ns: self.wait_ns.load(Ordering::Relaxed),
+            max_hold_ns,
+        }
+    }
+
+    /// Locks `lock` as one of the spinlocks of the class, counting whether it
+    /// was contended and for how long it's held.
+    pub fn lock_spin<'a, T>(&'static self, lock: &'a SpinNoIrq<T>) -> ClassSpinGuard<'a, T> {
+        let guard = match lock.try_lock() {
+            Some(guard) => guard,
+            None => {
+                let start = self.contended();
+                let guard = lock.lock();
+                self.spun();
+                self.waited_since(start);
+                guard
+            }
+        };
+        ClassSpinGuard {
+            guard,
+            class: self,
+            locked_at: self.acquired(),
+        }
+    }
+
+    fn register(&'static self) {
+        if self.registered.load(Ordering::Relaxed) || self.registered.swap(true, Ordering::Relaxed)
+        {
+            return;
+        }
+        let this = self as *const Self as *mut Self;
+        let mut head = CLASSES.load(Ordering::Relaxed);
+        loop {
+            self.next.store(head, Ordering::Relaxed);
+            match CLASSES.compare_exchange_weak(head, this, Ordering::Release, Ordering::Relaxed) {
+                Ok(_) => break,
+                Err(new_head) => head = new_head,
+            }
+        }
+    }
+
+    /// Records that a lock of the class was found locked, and returns when.
+    pub(crate) fn contended(&'static self) -> u64 {
+        self.register();
+        self.contended.fetch_add(1, Ordering::Relaxed);
+        monotonic_time_nanos()
+    }
+
+    /// Records that a task got a contended lock it waited for since `start`.
+    pub(crate) fn waited_since(&self, start: u64) {
+        let waited = monotonic_time_nanos().saturating_sub(start);
+        self.wait_ns.fetch_add(waited, Ordering::Relaxed);
+    }
+
+    pub(crate) fn spun(&self) {
+        self.spun.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn slept(&self) {
+        self.slept.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn handed_off(&self) {
+        self.handoffs.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Records that a lock of the class was acquired, and returns when, to be
+    /// passed to [`released`](Self::released) for an exclusive lock.
+    #[inline(always)]
+    pub(crate) fn acquired(&'static self) -> u64 {
+        #[cfg(feature = "lockstat")]
+        {
+            self.register();
+            self.acquisitions.fetch_add(1, Ordering::Relaxed);
+            monotonic_time_nanos()
+        }
+        #[cfg(not(feature = "lockstat"))]
+        0
+    }
+
+    /// Records that a lock of the class acquired at `locked_at` was released.
+    #[inline(always)]
+    pub(crate) fn released(&self, _locked_at: u64) {
+        #[cfg(feature = "lockstat")]
+        {
+            let held = monotonic_time_nanos().saturating_sub(_locked_at);
+            self.max_hold_ns.fetch_max(held, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Returns the classes of the locks that have been contended, or acquired
+/// with the `lockstat` feature, most recently registered first.
+pub fn lock_classes() -> impl Iterator<Item = &'static LockClass> {
+    let mut next = CLASSES.load(Ordering::Acquire);
+    core::iter::from_fn(move || {
+        // Classes are `'static` and never unregistered.
+        let class = unsafe { next.as_ref()? };
+        next = class.next.load(Ordering::Relaxed);
+        Some(class)
+    })
+}
+
+/// A guard of a spinlock locked by [`LockClass::lock_spin`].
+pub struct ClassSpinGuard<'a, T> {
+    guard: SpinNoIrqGuard<'a, T>,
+    class: &'static LockClass,
+    locked_at: u64,
+}
+
+impl<T> Deref for ClassSpinGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.guard
+    }
+}
+
+impl<T> DerefMut for ClassSpinGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut T {
+        &mut self.guard
+    }
+}
+
+impl<T> Drop for ClassSpinGuard<'_, T> {
+    fn drop(&mut self) {
+        self.class.released(self.locked_at);
+    }
+}
@@ -3,26 +3,43 @@
 //! Currently supported primitives:
 //!
 //! - [`Mutex`]: A mutual exclusion primitive.
+//! - [`RwLock`]: A readers-writer lock, only in multi-threaded environments.
 //! - mod [`spin`]: spinlocks imported from the [`kspin`] crate.
 //!
+//! The contention of the locks is counted per [`LockClass`], for the mutexes
+//! and readers-writer locks in multi-threaded environments, and for the
+//! spinlocks locked with [`LockClass::lock_spin`].
+//!
 //! # Cargo Features
 //!
 //! - `multitask`: For use in the multi-threaded environments. If the feature is
 //!   not enabled, [`Mutex`] will be an alias of [`spin::SpinNoIrq`]. This
 //!   feature is enabled by default.
+//! - `lockstat`: Also count every acquisition of the locks of each class, and
+//!   measure the longest time they are held exclusively. It costs a few more
+//!   atomic operations and clock reads per acquisition.
 
 #![cfg_attr(not(test), no_std)]
 #![feature(doc_cfg)]
 
 pub use kspin as spin;
 
+mod class;
 #[cfg(feature = "multitask")]
 mod mutex;
+#[cfg(feature = "multitask")]
+mod rwlock;
+
+pub use self::class::{ClassSpinGuard, LockClass, LockStats, lock_classes};
 
 #[cfg(feature = "multitask")]
 #[doc(cfg(feature = "multitask"))]
 pub use self::mutex::{Mutex, MutexGuard, RawMutex};
 
+#[cfg(feature = "multitask")]
+#[doc(cfg(feature = "multitask"))]
+pub use self::rwlock::{RawRwLock, RwLock, RwLockReadGuard, RwLockWriteGuard};
+
 #[cfg(not(feature = "multitask"))]
 #[doc(cfg(not(feature = "multitask")))]
 pub use kspin::{SpinNoIrq as Mutex, SpinNoIrqGuard as MutexGuard};
@@ -1,27 +1,102 @@
-//! A naïve sleeping mutex.
+//! An adaptive mutex, which spins while the owner is running and sleeps
+//! otherwise, with contention statistics per [`LockClass`].
 
-use core::sync::atomic::{AtomicU64, Ordering};
+use core::cell::Cell;
+use core::hint::spin_loop;
+use core::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
 
-use axtask::{WaitQueue, current};
+use axhal::cpu::this_cpu_id;
+use axtask::{WaitQueue, current, is_task_running_on};
+
+use crate::LockClass;
+
+/// The most times a task spins on a mutex whose owner is running on another
+/// CPU before it goes to sleep, so that a long critical section doesn't keep
+/// the CPU busy.
+const MAX_SPINS: usize = 1 << 12;
+
+/// The class of the mutexes created without one.
+static DEFAULT_CLASS: LockClass = LockClass::new("mutex");
 
 /// A [`lock_api::RawMutex`] implementation.
 ///
-/// When the mutex is locked, the current task will block and be put into the
-/// wait queue. When the mutex is unlocked, all tasks waiting on the queue
-/// will be woken up.
+/// When the mutex is locked, the current task spins as long as the owner is
+/// running on another CPU, as it's likely to unlock soon, up to [`MAX_SPINS`]
+/// times. Otherwise it blocks and is put into the wait queue, and one task of
+/// the queue is woken up when the mutex is unlocked.
+///
+/// A woken task competes with the running ones for the mutex. If it loses
+/// again, the next unlock hands the mutex over to the first task in the queue
+/// instead of releasing it, so that sleeping tasks aren't starved.
 pub struct RawMutex {
     wq: WaitQueue,
     owner_id: AtomicU64,
+    /// The CPU the owner was running on when it locked the mutex.
+    owner_cpu: AtomicUsize,
+    /// Set by a woken task that lost the mutex again.
+    handoff: AtomicBool,
+    class: &'static LockClass,
+    /// When the owner locked the mutex.
+    #[cfg(feature = "lockstat")]
+    locked_at: AtomicU64,
 }
 
 impl RawMutex {
     /// Creates a [`RawMutex`].
     #[inline(always)]
     pub const fn new() -> Self {
+        Self::with_class(&DEFAULT_CLASS)
+    }
+
+    /// Creates a [`RawMutex`] in the class `class`, e.g. for
+    /// [`Mutex::const_new`](lock_api::Mutex::const_new).
+    #[inline(always)]
+    pub const fn with_class(class: &'static LockClass) -> Self {
         Self {
             wq: WaitQueue::new(),
             owner_id: AtomicU64::new(0),
+            owner_cpu: AtomicUsize::new(0),
+            handoff: AtomicBool::new(false),
+            class,
+            #[cfg(feature = "lockstat")]
+            locked_at: AtomicU64::new(0),
+        }
+    }
+
+    /// Notes that the current task has just locked the mutex.
+    #[inline(always)]
+    fn locked(&self) {
+        self.owner_cpu.store(this_cpu_id(), Ordering::Relaxed);
+        let _locked_at = self.class.acquired();
+        #[cfg(feature = "lockstat")]
+        self.locked_at.store(_locked_at, Ordering::Relaxed);
+    }
+
+    fn try_lock_as(&self, current_id: u64) -> Result<(), u64> {
+        // Can fail to lock even if the mutex is not locked. May be more
+        // efficient than `try_lock` when called in a loop.
+        self.owner_id
+            .compare_exchange_weak(0, current_id, Ordering::Acquire, Ordering::Relaxed)
+            .map(|_| ())
+    }
+
+    /// Spins while the mutex is held by a task running on another CPU, up to
+    /// `budget` times in all. Returns whether the mutex looks unlocked.
+    fn spin_on_owner(&self, budget: &mut usize) -> bool {
+        while *budget > 0 {
+            let owner_id = self.owner_id.load(Ordering::Relaxed);
+            if owner_id == 0 {
+                return true;
+            }
+            if self.handoff.load(Ordering::Relaxed)
+                || !is_task_running_on(owner_id, self.owner_cpu.load(Ordering::Relaxed))
+            {
+                return false;
+            }
+            *budget -= 1;
+            spin_loop();
         }
+        false
     }
 }
 
@@ -32,47 +107,99 @@ unsafe impl lock_api::RawMutex for RawMutex {
 
     fn lock(&self) {
         let current_id = current().id().as_u64();
+        let Err(mut owner_id) = self.try_lock_as(current_id) else {
+            self.locked();
+            return;
+        };
+
+        let class = self.class;
+        let start = class.contended();
+        let mut budget = MAX_SPINS;
+        // Whether we have slept, after which losing the mutex again asks for it
+        // to be handed over.
+        let woken = Cell::new(false);
         loop {
-            // Can fail to lock even if the spinlock is not locked. May be more efficient than `try_lock`
-            // when called in a loop.
-            match self.owner_id.compare_exchange_weak(
-                0,
+            assert_ne!(
+                owner_id,
                 current_id,
-                Ordering::Acquire,
-                Ordering::Relaxed,
-            ) {
-                Ok(_) => break,
-                Err(owner_id) => {
-                    assert_ne!(
-                        owner_id,
-                        current_id,
-                        "{} tried to acquire mutex it already owns.",
-                        current().id_name()
-                    );
-                    // Wait until the lock looks unlocked before retrying
-                    self.wq.wait_until(|| !self.is_locked());
+                "{} tried to acquire mutex it already owns.",
+                current().id_name()
+            );
+            if owner_id == 0 || self.spin_on_owner(&mut budget) {
+                match self.try_lock_as(current_id) {
+                    Ok(()) => break,
+                    Err(owner) => {
+                        owner_id = owner;
+                        continue;
+                    }
                 }
             }
+
+            // Wait until the lock looks unlocked, or is handed over to us.
+            self.wq.wait_until(|| {
+                let owner = self.owner_id.load(Ordering::Acquire);
+                if owner == 0 || owner == current_id {
+                    return true;
+                }
+                if woken.replace(true) {
+                    self.handoff.store(true, Ordering::Relaxed);
+                }
+                class.slept();
+                false
+            });
+            if self.owner_id.load(Ordering::Acquire) == current_id {
+                break;
+            }
+            match self.try_lock_as(current_id) {
+                Ok(()) => break,
+                Err(owner) => {
+                    if woken.get() {
+                        self.handoff.store(true, Ordering::Relaxed);
+                    }
+                    owner_id = owner;
+                }
+            }
+        }
+        if !woken.get() {
+            class.spun();
         }
+        class.waited_since(start);
+        self.locked();
     }
 
     fn try_lock(&self) -> bool {
         let current_id = current().id().as_u64();
         // The reason for using a strong compare_exchange is explained here:
         // https://github.com/Amanieu/parking_lot/pull/207#issuecomment-575869107
-        self.owner_id
+        let locked = self
+            .owner_id
             .compare_exchange(0, current_id, Ordering::Acquire, Ordering::Relaxed)
-            .is_ok()
+            .is_ok();
+        if locked {
+            self.locked();
+        }
+        locked
     }
 
     unsafe fn unlock(&self) {
-        let owner_id = self.owner_id.swap(0, Ordering::Release);
+        let owner_id = self.owner_id.load(Ordering::Relaxed);
         assert_eq!(
             owner_id,
             current().id().as_u64(),
             "{} tried to release mutex it doesn't own",
             current().id_name()
         );
+        #[cfg(feature = "lockstat")]
+        self.class.released(self.locked_at.load(Ordering::Relaxed));
+        if self.handoff.swap(false, Ordering::Relaxed)
+            && self.wq.notify_one_with(true, |task| {
+                self.owner_id.store(task.id().as_u64(), Ordering::Release);
+            })
+        {
+            self.class.handed_off();
+            return;
+        }
+        self.owner_id.store(0, Ordering::Release);
         self.wq.notify_one(true);
     }
 
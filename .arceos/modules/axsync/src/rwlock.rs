@@ -0,0 +1,217 @@
+//! A naïve sleeping readers-writer lock.
+
+#[cfg(feature = "lockstat")]
+use core::sync::atomic::AtomicU64;
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use axtask::WaitQueue;
+
+use crate::LockClass;
+
+/// The bit of the lock state set while a writer holds the lock. The other bits
+/// count the readers.
+const WRITER: usize = 1 << (usize::BITS - 1);
+
+/// The class of the readers-writer locks created without one.
+static DEFAULT_CLASS: LockClass = LockClass::new("rwlock");
+
+/// A [`lock_api::RawRwLock`] implementation.
+///
+/// Any number of readers, or a single writer, can hold the lock at a time.
+/// Tasks that can't acquire the lock block and are put into the wait queue,
+/// which is notified when the last reader or the writer releases it. Writers
+/// are not favored, so they may wait as long as readers keep coming.
+pub struct RawRwLock {
+    wq: WaitQueue,
+    state: AtomicUsize,
+    class: &'static LockClass,
+    /// When the writer locked the lock.
+    #[cfg(feature = "lockstat")]
+    locked_at: AtomicU64,
+}
+
+impl RawRwLock {
+    /// Creates a [`RawRwLock`].
+    #[inline(always)]
+    pub const fn new() -> Self {
+        Self::with_class(&DEFAULT_CLASS)
+    }
+
+    /// Creates a [`RawRwLock`] in the class `class`, e.g. for
+    /// [`RwLock::const_new`](lock_api::RwLock::const_new).
+    #[inline(always)]
+    pub const fn with_class(class: &'static LockClass) -> Self {
+        Self {
+            wq: WaitQueue::new(),
+            state: AtomicUsize::new(0),
+            class,
+            #[cfg(feature = "lockstat")]
+            locked_at: AtomicU64::new(0),
+        }
+    }
+
+    fn is_locked_exclusive(&self) -> bool {
+        self.state.load(Ordering::Relaxed) & WRITER != 0
+    }
+
+    /// Waits until `condition` holds after failing to lock, counting each
+    /// time the task goes to sleep.
+    fn wait_until(&self, condition: impl Fn() -> bool) {
+        self.wq.wait_until(|| {
+            let ready = condition();
+            if !ready {
+                self.class.slept();
+            }
+            ready
+        });
+    }
+}
+
+unsafe impl lock_api::RawRwLock for RawRwLock {
+    const INIT: Self = RawRwLock::new();
+
+    type GuardMarker = lock_api::GuardSend;
+
+    fn lock_shared(&self) {
+        if self.try_lock_shared() {
+            return;
+        }
+        let start = self.class.contended();
+        loop {
+            // Wait until the writer is gone before retrying
+            self.wait_until(|| !self.is_locked_exclusive());
+            if self.try_lock_shared() {
+                break;
+            }
+        }
+        self.class.waited_since(start);
+    }
+
+    fn try_lock_shared(&self) -> bool {
+        let mut state = self.state.load(Ordering::Relaxed);
+        loop {
+            if state & WRITER != 0 {
+                return false;
+            }
+            match self.state.compare_exchange_weak(
+                state,
+                state + 1,
+                Ordering::Acquire,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => {
+                    self.class.acquired();
+                    return true;
+                }
+                Err(new_state) => state = new_state,
+            }
+        }
+    }
+
+    unsafe fn unlock_shared(&self) {
+        // Only writers can be waiting while readers hold the lock.
+        if self.state.fetch_sub(1, Ordering::Release) == 1 {
+            self.wq.notify_one(true);
+        }
+    }
+
+    fn lock_exclusive(&self) {
+        if self.try_lock_exclusive() {
+            return;
+        }
+        let start = self.class.contended();
+        loop {
+            // Wait until the lock looks unlocked before retrying
+            self.wait_until(|| !self.is_locked());
+            if self.try_lock_exclusive() {
+                break;
+            }
+        }
+        self.class.waited_since(start);
+    }
+
+    fn try_lock_exclusive(&self) -> bool {
+        let locked = self
+            .state
+            .compare_exchange(0, WRITER, Ordering::Acquire, Ordering::Relaxed)
+            .is_ok();
+        if locked {
+            let _locked_at = self.class.acquired();
+            #[cfg(feature = "lockstat")]
+            self.locked_at.store(_locked_at, Ordering::Relaxed);
+        }
+        locked
+    }
+
+    unsafe fn unlock_exclusive(&self) {
+        #[cfg(feature = "lockstat")]
+        self.class.released(self.locked_at.load(Ordering::Relaxed));
+        self.state.store(0, Ordering::Release);
+        // Wake up all waiting readers, or the next writer.
+        self.wq.notify_all(true);
+    }
+
+    fn is_locked(&self) -> bool {
+        self.state.load(Ordering::Relaxed) != 0
+    }
+}
+
+/// An alias of [`lock_api::RwLock`].
+pub type RwLock<T> = lock_api::RwLock<RawRwLock, T>;
+/// An alias of [`lock_api::RwLockReadGuard`].
+pub type RwLockReadGuard<'a, T> = lock_api::RwLockReadGuard<'a, RawRwLock, T>;
+/// An alias of [`lock_api::RwLockWriteGuard`].
+pub type RwLockWriteGuard<'a, T> = lock_api::RwLockWriteGuard<'a, RawRwLock, T>;
+
+#[cfg(test)]
+mod tests {
+    use crate::RwLock;
+    use axtask as thread;
+    use std::sync::Once;
+
+    static INIT: Once = Once::new();
+
+    #[test]
+    fn readers_and_writers() {
+        INIT.call_once(thread::init_scheduler);
+
+        const NUM_TASKS: u32 = 10;
+        const NUM_ITERS: u32 = 1_000;
+        static L: RwLock<(u32, u32)> = RwLock::new((0, 0));
+
+        fn write(delta: u32) {
+            for _ in 0..NUM_ITERS {
+                let mut val = L.write();
+                val.0 += delta;
+                thread::yield_now();
+                val.1 += delta;
+            }
+        }
+
+        fn read() {
+            for _ in 0..NUM_ITERS {
+                let val = L.read();
+                // Writers never leave the pair half updated.
+                assert_eq!(val.0, val.1);
+                thread::yield_now();
+            }
+        }
+
+        for _ in 0..NUM_TASKS {
+            thread::spawn(|| write(1));
+            thread::spawn(read);
+        }
+
+        loop {
+            let val = L.read();
+            if val.0 == NUM_ITERS * NUM_TASKS {
+                break;
+            }
+            drop(val);
+            thread::yield_now();
+        }
+
+        assert_eq!(*L.read(), (NUM_ITERS * NUM_TASKS, NUM_ITERS * NUM_TASKS));
+        println!("RwLock test OK");
+    }
+}
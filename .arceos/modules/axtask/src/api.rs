@@ -22,6 +22,7 @@ pub type AxTaskRef = Arc<AxTask>;
 /// The weak reference type of a task.
 pub type WeakAxTaskRef = Weak<AxTask>;
 
+pub use crate::sched_stat::SchedStat;
 pub use crate::task::TaskState;
 
 /// The wrapper type for [`cpumask::CpuMask`] with SMP configuration.
@@ -31,17 +32,27 @@ cfg_if::cfg_if! {
     if #[cfg(feature = "sched_rr")] {
         const MAX_TIME_SLICE: usize = 5;
         pub(crate) type AxTask = scheduler::RRTask<TaskInner, MAX_TIME_SLICE>;
-        pub(crate) type Scheduler = scheduler::RRScheduler<TaskInner, MAX_TIME_SLICE>;
+        type NormalScheduler = scheduler::RRScheduler<TaskInner, MAX_TIME_SLICE>;
     } else if #[cfg(feature = "sched_cfs")] {
-        pub(crate) type AxTask = scheduler::CFSTask<TaskInner>;
-        pub(crate) type Scheduler = scheduler::CFScheduler<TaskInner>;
+        pub(crate) type AxTask = crate::sched::fair::FairTask<TaskInner>;
+        type NormalScheduler = crate::sched::fair::FairScheduler<TaskInner>;
     } else {
         // If no scheduler features are set, use FIFO as the default.
         pub(crate) type AxTask = scheduler::FifoTask<TaskInner>;
-        pub(crate) type Scheduler = scheduler::FifoScheduler<TaskInner>;
+        type NormalScheduler = scheduler::FifoScheduler<TaskInner>;
     }
 }
 
+/// The scheduler of each run queue, which runs the real-time tasks before
+/// the ones of the scheduler selected by the cargo features.
+pub(crate) type Scheduler = crate::sched::rt::RtScheduler<NormalScheduler>;
+
+pub use crate::sched::rt::{MAX_RT_PRIO, SchedPolicy};
+
+#[cfg(feature = "irq")]
+#[doc(cfg(feature = "irq"))]
+pub use crate::idle::{IdlePolicy, idle_policy, set_idle_policy};
+
 #[cfg(feature = "preempt")]
 struct KernelGuardIfImpl;
 
@@ -82,7 +93,10 @@ pub fn init_scheduler() {
 
     crate::run_queue::init();
     #[cfg(feature = "irq")]
-    crate::timers::init();
+    {
+        crate::timers::init();
+        crate::idle::init();
+    }
 
     info!("  use {} scheduler.", Scheduler::scheduler_name());
 }
@@ -94,6 +108,34 @@ pub fn init_scheduler_secondary() {
     crate::timers::init();
 }
 
+/// Work to do on every timer tick, see [`set_tick_work`].
+#[cfg(feature = "irq")]
+static TICK_WORK: kspin::SpinNoIrq<Option<fn()>> = kspin::SpinNoIrq::new(None);
+
+/// Sets the work to run on every timer tick in the IRQ context, e.g. to do
+/// per-task accounting at tick granularity.
+#[cfg(feature = "irq")]
+#[doc(cfg(feature = "irq"))]
+pub fn set_tick_work(work: fn()) {
+    *TICK_WORK.lock() = Some(work);
+}
+
+/// Handles timer interrupts for the task manager.
+///
+/// The timer is programmed for the next scheduler tick or timer event,
+/// whichever comes first, so this fires the expired timer events, runs
+/// [`on_timer_tick`] if a tick is due, then programs the timer again.
+#[cfg(feature = "irq")]
+#[doc(cfg(feature = "irq"))]
+pub fn on_timer_irq() {
+    if crate::timers::tick_due(axhal::time::monotonic_time_nanos()) {
+        on_timer_tick();
+    } else {
+        crate::timers::check_events();
+    }
+    crate::timers::program_timer();
+}
+
 /// Handles periodic timer ticks for the task manager.
 ///
 /// For example, advance scheduler states, checks timed events, etc.
@@ -101,12 +143,67 @@ pub fn init_scheduler_secondary() {
 #[doc(cfg(feature = "irq"))]
 pub fn on_timer_tick() {
     use kernel_guard::NoOp;
+    crate::current().cpu_time_acct().tick(
+        axhal::time::monotonic_time_nanos(),
+        axhal::trap::irq_from_user(),
+    );
+    let work = *TICK_WORK.lock();
+    if let Some(work) = work {
+        work();
+    }
     crate::timers::check_events();
     // Since irq and preemption are both disabled here,
     // we can get current run queue with the default `kernel_guard::NoOp`.
     current_run_queue::<NoOp>().scheduler_timer_tick();
 }
 
+/// Handles the inter-processor interrupts sent by other CPUs that woke up
+/// tasks to run on this one or asked for a memory barrier (see [`membarrier`]),
+/// see [`axhal::irq::send_ipi`].
+#[cfg(all(feature = "irq", feature = "smp"))]
+#[doc(cfg(all(feature = "irq", feature = "smp")))]
+pub fn on_ipi() {
+    use kernel_guard::NoOp;
+    crate::run_queue::serve_barriers();
+    // Since irq and preemption are both disabled here,
+    // we can get current run queue with the default `kernel_guard::NoOp`.
+    current_run_queue::<NoOp>().take_wakeups();
+}
+
+/// Returns the number of tasks that are running or ready to run on all the
+/// CPUs, not counting the idle tasks, e.g. for the load average.
+pub fn nr_running() -> usize {
+    crate::run_queue::nr_running()
+}
+
+/// Returns the scheduling statistics of the CPU `cpu_id`, summed over the
+/// tasks that ran on it, not counting the idle task.
+pub fn cpu_sched_stat(cpu_id: usize) -> SchedStat {
+    crate::run_queue::cpu_sched_stat(cpu_id)
+}
+
+/// Returns whether the task with ID `task_id` is running on the CPU `cpu_id`
+/// right now, e.g. for a lock waiter to decide between spinning and sleeping.
+///
+/// It is only a hint, as the task may be switched out as soon as it returns.
+pub fn is_task_running_on(task_id: u64, cpu_id: usize) -> bool {
+    crate::run_queue::is_running_on(task_id, cpu_id)
+}
+
+/// Returns the CPU the task with ID `task_id` is running on right now, if
+/// any. Only a hint, like [`is_task_running_on`].
+pub fn task_running_cpu(task_id: u64) -> Option<usize> {
+    crate::run_queue::running_cpu(task_id)
+}
+
+/// Makes every CPU in `cpus` execute a full memory barrier, and returns once
+/// they all have, e.g. for the `membarrier` system call.
+///
+/// Must be called with IRQs enabled.
+pub fn membarrier(cpus: &AxCpuMask) {
+    crate::run_queue::membarrier(cpus)
+}
+
 /// Adds the given task to the run queue, returns the task reference.
 pub fn spawn_task(task: TaskInner) -> AxTaskRef {
     let task_ref = task.into_arc();
@@ -150,11 +247,54 @@ pub fn set_priority(prio: isize) -> bool {
     current_run_queue::<NoPreemptIrqSave>().set_current_priority(prio)
 }
 
+/// Set the priority for the given task, e.g. to boost the owner of a lock
+/// that a higher-priority task is waiting for.
+///
+/// See [`set_priority`] for the range of the priority. Returns `true` if the
+/// priority is set successfully.
+pub fn set_task_priority(task: &AxTaskRef, prio: isize) -> bool {
+    select_run_queue::<NoPreemptIrqSave>(task).set_task_priority(task, prio)
+}
+
+/// Sets the scheduling policy of the given task.
+///
+/// It takes effect the next time the task is put into a run queue, which is
+/// right after the current task is preempted, e.g. at the next timer tick.
+///
+/// Returns `false` if the real-time priority is out of range.
+pub fn set_task_policy(task: &AxTaskRef, policy: SchedPolicy) -> bool {
+    if !task.set_sched_policy(policy) {
+        return false;
+    }
+    #[cfg(feature = "preempt")]
+    if current().ptr_eq(task) {
+        task.set_preempt_pending(true);
+    }
+    true
+}
+
+/// Set the affinity for the given task.
+///
+/// If it is the current task, it is migrated right away if the current CPU
+/// is excluded. Otherwise, the task is moved the next time it is scheduled:
+/// when it is picked to run, preempted, or yields the CPU on an excluded
+/// CPU, or when it is woken up.
+///
+/// Returns `true` if the affinity is set successfully.
+pub fn set_task_affinity(task: &AxTaskRef, cpumask: AxCpuMask) -> bool {
+    if current().ptr_eq(task) {
+        set_current_affinity(cpumask)
+    } else if cpumask.is_empty() {
+        false
+    } else {
+        task.set_cpumask(cpumask);
+        true
+    }
+}
+
 /// Set the affinity for the current task.
 /// [`AxCpuMask`] is used to specify the CPU affinity.
 /// Returns `true` if the affinity is set successfully.
-///
-/// TODO: support set the affinity for other tasks.
 pub fn set_current_affinity(cpumask: AxCpuMask) -> bool {
     if cpumask.is_empty() {
         false
@@ -184,6 +324,18 @@ pub fn set_current_affinity(cpumask: AxCpuMask) -> bool {
     }
 }
 
+/// Modifies the context of the current task, e.g. to change its page table
+/// root after it switches to another address space.
+///
+/// Preemption and IRQs are disabled while `f` runs, so `f` must not block.
+pub fn with_current_ctx_mut<R>(f: impl FnOnce(&mut axhal::arch::TaskContext) -> R) -> R {
+    let _guard = NoPreemptIrqSave::new();
+    let curr = current();
+    // SAFETY: the context of a running task is only accessed when it is
+    // switched out, which cannot happen until the guard is dropped.
+    f(unsafe { &mut *curr.ctx_mut_ptr() })
+}
+
 /// Current task gives up the CPU time voluntarily, and switches to another
 /// ready task.
 pub fn yield_now() {
@@ -207,19 +359,50 @@ pub fn sleep_until(deadline: axhal::time::TimeValue) {
     axhal::time::busy_wait_until(deadline);
 }
 
+/// Registers `callback` to be invoked from the timer interrupt of the
+/// current CPU once the deadline has been reached.
+///
+/// The callback runs with IRQs disabled, so it must not block.
+#[cfg(feature = "irq")]
+pub fn set_alarm<F>(deadline: axhal::time::TimeValue, callback: F)
+where
+    F: FnOnce(axhal::time::TimeValue) + Send + 'static,
+{
+    crate::timers::set_alarm_callback(deadline, callback);
+}
+
 /// Exits the current task.
 pub fn exit(exit_code: i32) -> ! {
     current_run_queue::<NoPreemptIrqSave>().exit_current(exit_code)
 }
 
+/// Work for the idle task to do whenever there is nothing else to run, see
+/// [`set_idle_work`].
+static IDLE_WORK: kspin::SpinNoIrq<Option<fn()>> = kspin::SpinNoIrq::new(None);
+
+/// Sets the work that the idle tasks run before waiting for IRQs, e.g. to
+/// prepare resources in advance.
+///
+/// The work should be short, since tasks woken up meanwhile wait for it to
+/// finish. It is run again after every wake-up of the idle task.
+pub fn set_idle_work(work: fn()) {
+    *IDLE_WORK.lock() = Some(work);
+}
+
 /// The idle task routine.
 ///
-/// It runs an infinite loop that keeps calling [`yield_now()`].
+/// It runs an infinite loop that keeps calling [`yield_now()`], and the idle
+/// work set by [`set_idle_work`] if any, then waits for tasks to run as the
+/// idle policy says (see [`set_idle_policy`]).
 pub fn run_idle() -> ! {
     loop {
         yield_now();
-        debug!("idle task: waiting for IRQs...");
+        let work = *IDLE_WORK.lock();
+        if let Some(work) = work {
+            work();
+        }
+        debug!("idle task: waiting for tasks...");
         #[cfg(feature = "irq")]
-        axhal::arch::wait_for_irqs();
+        crate::idle::idle_wait();
     }
 }
@@ -0,0 +1,92 @@
+//! Accounting of the CPU time of tasks.
+
+use core::sync::atomic::{AtomicU64, Ordering};
+use core::time::Duration;
+
+use axhal::time::monotonic_time_nanos;
+
+/// The CPU time of a task.
+///
+/// The time the task runs is measured when it is switched in and out, and on
+/// timer ticks while it runs, so it is exact whether or not the task traps.
+/// It is split between user mode and the kernel in proportion to the timer
+/// ticks that interrupted either, as Linux does without
+/// `CONFIG_VIRT_CPU_ACCOUNTING`, since measuring every switch between the
+/// modes would slow down syscalls and interrupts.
+pub(crate) struct CpuTime {
+    /// The time the task ran until it was last switched in or charged.
+    runtime_nanos: AtomicU64,
+    /// When the task was last switched in or charged, or 0 if it is not
+    /// running.
+    since: AtomicU64,
+    user_ticks: AtomicU64,
+    system_ticks: AtomicU64,
+}
+
+impl CpuTime {
+    /// Creates the CPU time of a task that starts running at `since`, or 0 if
+    /// it does not run yet.
+    pub(crate) const fn new(since: u64) -> Self {
+        Self {
+            runtime_nanos: AtomicU64::new(0),
+            since: AtomicU64::new(since),
+            user_ticks: AtomicU64::new(0),
+            system_ticks: AtomicU64::new(0),
+        }
+    }
+
+    /// Starts counting when the task is switched in at `now`.
+    pub(crate) fn switch_in(&self, now: u64) {
+        self.since.store(now, Ordering::Relaxed);
+    }
+
+    /// Stops counting when the task is switched out at `now`.
+    pub(crate) fn switch_out(&self, now: u64) {
+        let since = self.since.swap(0, Ordering::Relaxed);
+        if since != 0 {
+            self.runtime_nanos
+                .fetch_add(now.saturating_sub(since), Ordering::Relaxed);
+        }
+    }
+
+    /// Charges a timer tick at `now`, which interrupted user mode if
+    /// `from_user`, to the running task.
+    pub(crate) fn tick(&self, now: u64, from_user: bool) {
+        let since = self.since.swap(now, Ordering::Relaxed);
+        if since != 0 {
+            self.runtime_nanos
+                .fetch_add(now.saturating_sub(since), Ordering::Relaxed);
+        }
+        let ticks = if from_user {
+            &self.user_ticks
+        } else {
+            &self.system_ticks
+        };
+        ticks.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Returns the user and system time of the task.
+    ///
+    /// The time of a task running on another CPU may lag by the time since it
+    /// was last charged.
+    pub(crate) fn get(&self) -> (Duration, Duration) {
+        let since = self.since.load(Ordering::Relaxed);
+        let mut runtime = self.runtime_nanos.load(Ordering::Relaxed);
+        if since != 0 {
+            runtime += monotonic_time_nanos().saturating_sub(since);
+        }
+        let user_ticks = self.user_ticks.load(Ordering::Relaxed);
+        let system_ticks = self.system_ticks.load(Ordering::Relaxed);
+        // Like Linux, a task that no tick has sampled in the kernel is
+        // considered to have run in user mode.
+        let user = if system_ticks == 0 {
+            runtime
+        } else {
+            (runtime as u128 * user_ticks as u128 / (user_ticks + system_ticks) as u128) as u64
+        };
+        (
+            Duration::from_nanos(user),
+            Duration::from_nanos(runtime - user),
+        )
+    }
+}
@@ -0,0 +1,154 @@
+//! Idle policies, which decide how the idle task of a CPU waits for tasks to
+//! run: by polling its run queue, which notices them at once but keeps the
+//! CPU busy, or by waiting for IRQs, which saves power but takes longer to
+//! wake up from.
+//!
+//! The default [`IdlePolicy::Adaptive`] polls for a while first, for a time
+//! that grows while tasks keep arriving shortly after the CPU went idle, and
+//! shrinks when they don't. It also predicts how long the CPU stays idle from
+//! the last times, and only skips timer ticks when that is long.
+
+use core::sync::atomic::{AtomicU8, Ordering};
+
+use axhal::time::monotonic_time_nanos;
+
+use crate::run_queue::{has_ready_tasks, set_polling};
+use crate::timers::TICK_NANOS;
+
+/// How idle CPUs wait for tasks to run, see [`set_idle_policy`].
+#[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum IdlePolicy {
+    /// Waits for IRQs at once, skipping timer ticks while idle. It uses the
+    /// least power.
+    Halt = 0,
+    /// Polls for up to 200 us before waiting for IRQs, adapting the time to
+    /// how soon tasks arrived the last times, and skips timer ticks only if
+    /// the CPU is likely to stay idle for long. The default.
+    Adaptive = 1,
+    /// Never waits for IRQs, for CPUs dedicated to latency-critical tasks.
+    Poll = 2,
+}
+
+/// The longest time an idle CPU polls before waiting for IRQs with
+/// [`IdlePolicy::Adaptive`].
+const MAX_POLL_NANOS: u64 = 200_000;
+
+/// The time an idle CPU starts polling for once a task arrived soon after it
+/// waited for IRQs, then doubled each time it happens again.
+const MIN_POLL_NANOS: u64 = 10_000;
+
+/// The predicted idle time above which an idle CPU skips timer ticks with
+/// [`IdlePolicy::Adaptive`].
+const SKIP_TICKS_NANOS: u64 = 2 * TICK_NANOS;
+
+static IDLE_POLICY: AtomicU8 = AtomicU8::new(IdlePolicy::Adaptive as u8);
+
+percpu_static! {
+    /// The time the idle task polls for before waiting for IRQs.
+    POLL_NANOS: u64 = 0,
+    /// The moving average of the times the CPU stayed idle.
+    PREDICTED_IDLE_NANOS: u64 = 0,
+}
+
+impl IdlePolicy {
+    /// Returns the policy named `name`, i.e. `halt`, `adaptive` or `poll`.
+    pub fn from_name(name: &str) -> Option<Self> {
+        match name {
+            "halt" => Some(Self::Halt),
+            "adaptive" => Some(Self::Adaptive),
+            "poll" => Some(Self::Poll),
+            _ => None,
+        }
+    }
+}
+
+/// Returns how idle CPUs wait for tasks to run.
+pub fn idle_policy() -> IdlePolicy {
+    match IDLE_POLICY.load(Ordering::Relaxed) {
+        0 => IdlePolicy::Halt,
+        1 => IdlePolicy::Adaptive,
+        _ => IdlePolicy::Poll,
+    }
+}
+
+/// Sets how idle CPUs wait for tasks to run, from the next time they do.
+///
+/// It is [`IdlePolicy::Adaptive`] by default, or the one named by the
+/// `AX_IDLE` environment variable at build time.
+pub fn set_idle_policy(policy: IdlePolicy) {
+    IDLE_POLICY.store(policy as u8, Ordering::Relaxed);
+}
+
+/// Sets the idle policy named by `AX_IDLE` at build time, if any.
+pub(crate) fn init() {
+    let Some(name) = option_env!("AX_IDLE").filter(|name| !name.is_empty()) else {
+        return;
+    };
+    match IdlePolicy::from_name(name) {
+        Some(policy) => set_idle_policy(policy),
+        None => warn!("unknown idle policy {:?}, use {:?}", name, idle_policy()),
+    }
+}
+
+/// Waits for tasks to run on this CPU as the idle policy says, once the idle
+/// task found none. It may also return early, e.g. after an IRQ.
+pub(crate) fn idle_wait() {
+    match idle_policy() {
+        IdlePolicy::Halt => halt(true),
+        // Stops polling at the next tick anyway, to go steal tasks from the
+        // other CPUs.
+        IdlePolicy::Poll => {
+            poll(TICK_NANOS);
+        }
+        IdlePolicy::Adaptive => adaptive_wait(),
+    }
+}
+
+/// Polls the run queue for up to `nanos`, returns whether there are tasks to
+/// run.
+fn poll(nanos: u64) -> bool {
+    let deadline = monotonic_time_nanos() + nanos;
+    set_polling(true);
+    while !has_ready_tasks() && monotonic_time_nanos() < deadline {
+        core::hint::spin_loop();
+    }
+    set_polling(false);
+    // Wakeups just before polling stopped sent no IPI.
+    has_ready_tasks()
+}
+
+/// Waits for IRQs, skipping timer ticks meanwhile if `skip_ticks`.
+fn halt(skip_ticks: bool) {
+    crate::timers::enter_idle(skip_ticks);
+    axhal::arch::wait_for_irqs();
+}
+
+fn adaptive_wait() {
+    // Safety: the idle task is pinned to its CPU.
+    let poll_nanos = unsafe { POLL_NANOS.read_current_raw() };
+    let predicted = unsafe { PREDICTED_IDLE_NANOS.read_current_raw() };
+    let start = monotonic_time_nanos();
+    if poll_nanos > 0 && poll(poll_nanos) {
+        update_prediction(predicted, monotonic_time_nanos() - start);
+        return;
+    }
+
+    halt(predicted > SKIP_TICKS_NANOS);
+    let idle = monotonic_time_nanos() - start;
+    update_prediction(predicted, idle);
+    // Polling longer would have caught a wakeup that came this soon.
+    let poll_nanos = if idle <= MAX_POLL_NANOS && has_ready_tasks() {
+        (poll_nanos * 2).clamp(MIN_POLL_NANOS, MAX_POLL_NANOS)
+    } else if poll_nanos / 2 < MIN_POLL_NANOS {
+        0
+    } else {
+        poll_nanos / 2
+    };
+    unsafe { POLL_NANOS.write_current_raw(poll_nanos) };
+}
+
+fn update_prediction(predicted: u64, idle: u64) {
+    let predicted = (predicted * 7 + idle) / 8;
+    unsafe { PREDICTED_IDLE_NANOS.write_current_raw(predicted) };
+}
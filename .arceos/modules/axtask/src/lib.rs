@@ -2,7 +2,8 @@
 //!
 //! This module provides primitives for task management, including task
 //! creation, scheduling, sleeping, termination, etc. The scheduler algorithm
-//! is configurable by cargo features.
+//! of normal tasks is configurable by cargo features, and real-time tasks
+//! (see [`SchedPolicy`]) always run before them.
 //!
 //! # Cargo Features
 //!
@@ -18,12 +19,13 @@
 //!   and it can be overriden by other scheduler features.
 //! - `sched_rr`: Use the [Round-robin preemptive scheduler][2]. It also enables
 //!   the `multitask` and `preempt` features if it is enabled.
-//! - `sched_cfs`: Use the [Completely Fair Scheduler][3]. It also enables the
-//!   the `multitask` and `preempt` features if it is enabled.
+//! - `sched_cfs`: Use the [weighted fair scheduler][3], in the spirit of the
+//!   Completely Fair Scheduler of Linux, whose priorities are nice values. It
+//!   also enables the `multitask` and `preempt` features if it is enabled.
 //!
 //! [1]: scheduler::FifoScheduler
 //! [2]: scheduler::RRScheduler
-//! [3]: scheduler::CFScheduler
+//! [3]: sched::fair::FairScheduler
 
 #![cfg_attr(not(test), no_std)]
 #![feature(doc_cfg)]
@@ -41,13 +43,20 @@ cfg_if::cfg_if! {
 
         #[macro_use]
         mod run_queue;
+        mod cpu_time;
+        mod sched_stat;
         mod task;
         mod task_ext;
         mod api;
+        mod sched;
         mod wait_queue;
 
+        #[cfg(feature = "irq")]
+        mod idle;
         #[cfg(feature = "irq")]
         mod timers;
+        #[cfg(any(feature = "irq", test))]
+        mod timer_wheel;
 
         #[doc(cfg(feature = "multitask"))]
         pub use self::api::*;
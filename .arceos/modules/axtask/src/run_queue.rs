@@ -1,6 +1,10 @@
 use alloc::collections::VecDeque;
 use alloc::sync::Arc;
 use core::mem::MaybeUninit;
+use core::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+
+#[cfg(all(feature = "smp", feature = "irq"))]
+use core::sync::atomic::AtomicPtr;
 
 #[cfg(feature = "smp")]
 use alloc::sync::Weak;
@@ -12,6 +16,8 @@ use scheduler::BaseScheduler;
 
 use axhal::cpu::this_cpu_id;
 
+use crate::sched::SchedulerExt;
+use crate::sched_stat::{SchedCounters, SchedStat};
 use crate::task::{CurrentTask, TaskState};
 use crate::wait_queue::WaitQueueGuard;
 use crate::{AxCpuMask, AxTaskRef, Scheduler, TaskInner, WaitQueue};
@@ -53,6 +59,16 @@ static mut RUN_QUEUES: [MaybeUninit<&'static mut AxRunQueue>; axconfig::SMP] =
 #[allow(clippy::declare_interior_mutable_const)] // It's ok because it's used only for initialization `RUN_QUEUES`.
 const ARRAY_REPEAT_VALUE: MaybeUninit<&'static mut AxRunQueue> = MaybeUninit::uninit();
 
+/// Whether the run queue of each CPU in [`RUN_QUEUES`] is initialized, so
+/// that the ones of the CPUs not booted yet are left out of load balancing.
+#[cfg(feature = "smp")]
+static RUN_QUEUE_READY: [AtomicBool; axconfig::SMP] =
+    [const { AtomicBool::new(false) }; axconfig::SMP];
+
+/// The number of timer ticks between two periodic load balancing passes.
+#[cfg(all(feature = "smp", feature = "irq"))]
+const BALANCE_INTERVAL_TICKS: usize = 4;
+
 /// Returns a reference to the current run queue in [`CurrentRunQueueRef`].
 ///
 /// ## Safety
@@ -79,7 +95,9 @@ pub(crate) fn current_run_queue<G: BaseGuard>() -> CurrentRunQueueRef<'static, G
 /// Selects the run queue index based on a CPU set bitmap and load balancing.
 ///
 /// This function filters the available run queues based on the provided `cpumask` and
-/// selects the run queue index for the next task. The selection is based on a round-robin algorithm.
+/// selects the least loaded one for the next task. Ties are broken in favor of the
+/// current CPU, whose caches are likely warm with the task, then of the next CPUs
+/// in a round-robin order.
 ///
 /// ## Arguments
 ///
@@ -98,18 +116,30 @@ pub(crate) fn current_run_queue<G: BaseGuard>() -> CurrentRunQueueRef<'static, G
 #[allow(clippy::modulo_one)]
 #[inline]
 fn select_run_queue_index(cpumask: AxCpuMask) -> usize {
-    use core::sync::atomic::{AtomicUsize, Ordering};
     static RUN_QUEUE_INDEX: AtomicUsize = AtomicUsize::new(0);
 
     assert!(!cpumask.is_empty(), "No available CPU for task execution");
 
-    // Round-robin selection of the run queue index.
-    loop {
-        let index = RUN_QUEUE_INDEX.fetch_add(1, Ordering::SeqCst) % axconfig::SMP;
-        if cpumask.get(index) {
-            return index;
+    let this_cpu = this_cpu_id();
+    let start = RUN_QUEUE_INDEX.fetch_add(1, Ordering::Relaxed);
+    let candidates = core::iter::once(this_cpu)
+        .chain((0..axconfig::SMP).map(|i| (start + i) % axconfig::SMP))
+        .filter(|&index| cpumask.get(index));
+    let mut fallback = None;
+    let mut selected: Option<(usize, usize)> = None;
+    for index in candidates {
+        fallback.get_or_insert(index);
+        if !RUN_QUEUE_READY[index].load(Ordering::Acquire) {
+            continue;
+        }
+        let load = get_run_queue(index).load();
+        if selected.is_none_or(|(_, min)| load < min) {
+            selected = Some((index, load));
         }
     }
+    // If none of the allowed CPUs has booted yet, queue the task on one of
+    // them anyway, as before.
+    selected.map_or_else(|| fallback.unwrap(), |(index, _)| index)
 }
 
 /// Retrieves a `'static` reference to the run queue corresponding to the given index.
@@ -135,6 +165,213 @@ fn get_run_queue(index: usize) -> &'static mut AxRunQueue {
     unsafe { RUN_QUEUES[index].assume_init_mut() }
 }
 
+/// The ID of the task running on each CPU, indexed by cpu_id, or 0 before the
+/// CPU first switches tasks.
+static RUNNING_TASK_IDS: [AtomicU64; axconfig::SMP] = [const { AtomicU64::new(0) }; axconfig::SMP];
+
+/// The scheduling statistics of each CPU, indexed by cpu_id.
+static CPU_SCHED_STATS: [SchedCounters; axconfig::SMP] =
+    [const { SchedCounters::new() }; axconfig::SMP];
+
+/// Returns the scheduling statistics of the CPU `cpu_id`.
+pub(crate) fn cpu_sched_stat(cpu_id: usize) -> SchedStat {
+    CPU_SCHED_STATS
+        .get(cpu_id)
+        .map_or_else(SchedStat::default, SchedCounters::get)
+}
+
+/// Returns whether the task with ID `task_id` is running on the CPU `cpu_id`.
+///
+/// Only a hint, as the task may be switched out right after.
+pub(crate) fn is_running_on(task_id: u64, cpu_id: usize) -> bool {
+    RUNNING_TASK_IDS
+        .get(cpu_id)
+        .is_some_and(|id| id.load(Ordering::Relaxed) == task_id)
+}
+
+/// Returns the CPU the task with ID `task_id` is running on, if any.
+///
+/// Only a hint, like [`is_running_on`].
+pub(crate) fn running_cpu(task_id: u64) -> Option<usize> {
+    RUNNING_TASK_IDS
+        .iter()
+        .position(|id| id.load(Ordering::Relaxed) == task_id)
+}
+
+/// The number of memory barriers requested from each CPU by [`membarrier`],
+/// and the number of them the CPU has executed, indexed by cpu_id.
+#[cfg(all(feature = "smp", feature = "irq"))]
+static BARRIERS: [(AtomicU64, AtomicU64); axconfig::SMP] =
+    [const { (AtomicU64::new(0), AtomicU64::new(0)) }; axconfig::SMP];
+
+/// Makes the CPUs in `cpus` execute a full memory barrier, and waits until
+/// they all did. The other CPUs are sent IPIs, the current one only needs a
+/// fence.
+pub(crate) fn membarrier(cpus: &AxCpuMask) {
+    core::sync::atomic::fence(Ordering::SeqCst);
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    if axhal::irq::IPI_IRQ_NUM.is_some() {
+        let this_cpu = this_cpu_id();
+        let mut tickets = [0; axconfig::SMP];
+        for cpu in (0..axconfig::SMP).filter(|&cpu| cpu != this_cpu && cpus.get(cpu)) {
+            tickets[cpu] = BARRIERS[cpu].0.fetch_add(1, Ordering::SeqCst) + 1;
+            axhal::irq::send_ipi(cpu);
+        }
+        // IRQs stay enabled meanwhile, so that CPUs waiting for each other
+        // serve each other's requests.
+        for (cpu, &ticket) in tickets.iter().enumerate() {
+            while BARRIERS[cpu].1.load(Ordering::Acquire) < ticket {
+                core::hint::spin_loop();
+            }
+        }
+    }
+    #[cfg(not(all(feature = "smp", feature = "irq")))]
+    let _ = cpus;
+    core::sync::atomic::fence(Ordering::SeqCst);
+}
+
+/// Executes the memory barriers requested from this CPU, on an IPI.
+#[cfg(all(feature = "smp", feature = "irq"))]
+pub(crate) fn serve_barriers() {
+    let (requested, done) = &BARRIERS[this_cpu_id()];
+    let requested = requested.load(Ordering::SeqCst);
+    core::sync::atomic::fence(Ordering::SeqCst);
+    done.fetch_max(requested, Ordering::Release);
+}
+
+/// The tasks woken up by other CPUs for each CPU, indexed by cpu_id, which
+/// the CPU puts into its run queue itself, see [`AxRunQueue::queue_wakeup`].
+#[cfg(all(feature = "smp", feature = "irq"))]
+static WAKE_LISTS: [WakeList; axconfig::SMP] = [const { WakeList::new() }; axconfig::SMP];
+
+/// The link of a task in a [`WakeList`].
+#[cfg(all(feature = "smp", feature = "irq"))]
+pub(crate) struct WakeEntry {
+    next: AtomicPtr<crate::AxTask>,
+    /// The `resched` argument of [`AxRunQueueRef::unblock_task`].
+    resched: AtomicBool,
+}
+
+#[cfg(all(feature = "smp", feature = "irq"))]
+impl WakeEntry {
+    pub(crate) const fn new() -> Self {
+        Self {
+            next: AtomicPtr::new(core::ptr::null_mut()),
+            resched: AtomicBool::new(false),
+        }
+    }
+}
+
+/// A lock-free list of woken tasks, linked through their [`WakeEntry`].
+///
+/// Any CPU may push to it, only the owning CPU takes from it. A task is in
+/// at most one list, as it is pushed only after going from `Blocked` to
+/// `Ready`.
+#[cfg(all(feature = "smp", feature = "irq"))]
+pub(crate) struct WakeList {
+    head: AtomicPtr<crate::AxTask>,
+}
+
+#[cfg(all(feature = "smp", feature = "irq"))]
+impl WakeList {
+    const fn new() -> Self {
+        Self {
+            head: AtomicPtr::new(core::ptr::null_mut()),
+        }
+    }
+
+    /// Pushes a task, returns whether the list was empty.
+    fn push(&self, task: AxTaskRef, resched: bool) -> bool {
+        task.wake_entry().resched.store(resched, Ordering::Relaxed);
+        let node = Arc::into_raw(task) as *mut crate::AxTask;
+        let entry = unsafe { (*node).wake_entry() };
+        let mut head = self.head.load(Ordering::Relaxed);
+        loop {
+            entry.next.store(head, Ordering::Relaxed);
+            match self
+                .head
+                .compare_exchange_weak(head, node, Ordering::Release, Ordering::Relaxed)
+            {
+                Ok(_) => return head.is_null(),
+                Err(new_head) => head = new_head,
+            }
+        }
+    }
+
+    /// Takes all the tasks with their `resched` flags, in the order they were
+    /// pushed.
+    fn take_all(&self) -> impl Iterator<Item = (AxTaskRef, bool)> {
+        let mut node = if self.head.load(Ordering::Relaxed).is_null() {
+            core::ptr::null_mut()
+        } else {
+            self.head.swap(core::ptr::null_mut(), Ordering::Acquire)
+        };
+        // The list is in LIFO order, reverse it.
+        let mut reversed = core::ptr::null_mut();
+        while let Some(task) = unsafe { node.as_ref() } {
+            let next = task.wake_entry().next.swap(reversed, Ordering::Relaxed);
+            reversed = node;
+            node = next;
+        }
+        core::iter::from_fn(move || {
+            if reversed.is_null() {
+                return None;
+            }
+            // Each node holds the reference given up in `push`.
+            let task = unsafe { Arc::from_raw(reversed) };
+            reversed = task.wake_entry().next.load(Ordering::Relaxed);
+            let resched = task.wake_entry().resched.load(Ordering::Relaxed);
+            Some((task, resched))
+        })
+    }
+}
+
+/// Returns whether the run queue of this CPU has tasks ready to run, including
+/// those woken up by other CPUs and not put into it yet, for the idle task to
+/// stop waiting.
+#[cfg(feature = "irq")]
+pub(crate) fn has_ready_tasks() -> bool {
+    // The idle task is pinned to its CPU.
+    unsafe { RUN_QUEUE.current_ref_raw() }
+        .nr_ready
+        .load(Ordering::Relaxed)
+        > 0
+}
+
+/// Sets whether the idle task of this CPU is polling with [`has_ready_tasks`],
+/// so that other CPUs waking up tasks on it don't interrupt it.
+///
+/// Once it stops polling, [`has_ready_tasks`] must be checked once more before
+/// it waits for IRQs, not to miss a wakeup that sent no IPI.
+#[cfg(feature = "irq")]
+pub(crate) fn set_polling(polling: bool) {
+    #[cfg(feature = "smp")]
+    {
+        let rq = unsafe { RUN_QUEUE.current_ref_raw() };
+        rq.polling.store(polling, Ordering::Relaxed);
+        // Pairs with the fence in `AxRunQueue::queue_wakeup`.
+        core::sync::atomic::fence(Ordering::SeqCst);
+    }
+    #[cfg(not(feature = "smp"))]
+    let _ = polling;
+}
+
+/// Returns the number of tasks that are running or ready to run on all the
+/// CPUs, not counting the idle tasks.
+pub(crate) fn nr_running() -> usize {
+    #[cfg(feature = "smp")]
+    {
+        (0..axconfig::SMP)
+            .filter(|&index| RUN_QUEUE_READY[index].load(Ordering::Acquire))
+            .map(|index| get_run_queue(index).load())
+            .sum()
+    }
+    #[cfg(not(feature = "smp"))]
+    {
+        unsafe { RUN_QUEUE.current_ref_raw() }.load()
+    }
+}
+
 /// Selects the appropriate run queue for the provided task.
 ///
 /// * In a single-core system, this function always returns a reference to the global run queue.
@@ -148,10 +385,8 @@ fn get_run_queue(index: usize) -> &'static mut AxRunQueue {
 ///
 /// * [`AxRunQueueRef`] - a static reference to the selected [`AxRunQueue`] (current or remote).
 ///
-/// ## TODO
-///
-/// 1. Implement better load balancing across CPUs for more efficient task distribution.
-/// 2. Use a more generic load balancing algorithm that can be customized or replaced.
+/// Tasks queued on a busy CPU are later stolen by idle CPUs, or pulled by the
+/// periodic balancing in [`CurrentRunQueueRef::scheduler_timer_tick`].
 ///
 #[inline]
 pub(crate) fn select_run_queue<G: BaseGuard>(task: &AxTaskRef) -> AxRunQueueRef<'static, G> {
@@ -186,6 +421,18 @@ pub(crate) struct AxRunQueue {
     /// Since irq and preempt are preserved by the kernel guard hold by `AxRunQueueRef`,
     /// we just use a simple raw spin lock here.
     scheduler: SpinRaw<Scheduler>,
+    /// The number of ready tasks in the scheduler, read by other CPUs
+    /// without taking the lock to balance the load.
+    nr_ready: AtomicUsize,
+    /// Whether this CPU is running its idle task.
+    idle: AtomicBool,
+    /// Whether the idle task of this CPU is polling for tasks, so that
+    /// waking one up needs no IPI.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    polling: AtomicBool,
+    /// The timer ticks until the next periodic load balancing.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    balance_ticks: usize,
 }
 
 /// A reference to the run queue with specific guard.
@@ -237,15 +484,25 @@ impl<G: BaseGuard> AxRunQueueRef<'_, G> {
             self.inner.cpu_id
         );
         assert!(task.is_ready());
-        self.inner.scheduler.lock().add_task(task);
+        self.inner.add_ready_task(task);
     }
 
     /// Unblock one task by inserting it into the run queue.
     ///
     /// This function does nothing if the task is not in [`TaskState::Blocked`],
     /// which means the task is already unblocked by other cores.
+    ///
+    /// If the run queue is another CPU's and that CPU can be interrupted, the
+    /// task is handed over to it with [`AxRunQueue::queue_wakeup`] instead,
+    /// not to take the lock of its run queue from here.
     pub fn unblock_task(&mut self, task: AxTaskRef, resched: bool) {
+        #[cfg(all(feature = "smp", feature = "irq"))]
+        if self.inner.cpu_id != this_cpu_id() && axhal::irq::IPI_IRQ_NUM.is_some() {
+            self.inner.queue_wakeup(task, resched);
+            return;
+        }
         let task_id_name = task.id_name();
+        let woken = task.clone();
         // Try to change the state of the task from `Blocked` to `Ready`,
         // if successful, the task will be put into this run queue,
         // otherwise, the task is already unblocked by other cores.
@@ -260,23 +517,96 @@ impl<G: BaseGuard> AxRunQueueRef<'_, G> {
             debug!("task unblock: {} on run_queue {}", task_id_name, cpu_id);
             // Note: when the task is unblocked on another CPU's run queue,
             // we just ingiore the `resched` flag.
-            if resched && cpu_id == this_cpu_id() {
+            if cpu_id == this_cpu_id() {
+                let curr = crate::current();
+                // Let the scheduler decide whether the woken task, e.g. an
+                // interactive one that mostly sleeps, should run right away.
+                let resched = resched
+                    || !curr.is_idle()
+                        && self
+                            .inner
+                            .scheduler
+                            .lock()
+                            .wakeup_preempt(curr.as_task_ref(), &woken);
                 #[cfg(feature = "preempt")]
-                crate::current().set_preempt_pending(true);
+                if resched {
+                    curr.set_preempt_pending(true);
+                }
+                #[cfg(not(feature = "preempt"))]
+                let _ = resched;
             }
         }
     }
+
+    /// Sets the priority of the given task, which may be running, ready or
+    /// blocked on any CPU.
+    ///
+    /// Schedulers keep the priority in the task itself, so it takes effect
+    /// the next time the task is picked or its time slice is accounted.
+    pub fn set_task_priority(&mut self, task: &AxTaskRef, prio: isize) -> bool {
+        self.inner.scheduler.lock().set_priority(task, prio)
+    }
 }
 
 /// Core functions of run queue.
 impl<G: BaseGuard> CurrentRunQueueRef<'_, G> {
     #[cfg(feature = "irq")]
     pub fn scheduler_timer_tick(&mut self) {
+        // In case the IPI of a wakeup was lost.
+        #[cfg(feature = "smp")]
+        self.take_wakeups();
         let curr = &self.current_task;
         if !curr.is_idle() && self.inner.scheduler.lock().task_tick(curr.as_task_ref()) {
             #[cfg(feature = "preempt")]
             curr.set_preempt_pending(true);
         }
+        #[cfg(feature = "smp")]
+        self.balance_tick();
+    }
+
+    /// Puts the tasks woken up by other CPUs into this run queue, and asks to
+    /// reschedule if one of them should preempt the current task.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    pub fn take_wakeups(&mut self) {
+        let curr = &self.current_task;
+        let mut resched = false;
+        self.inner.take_wakeups(|scheduler, woken, woken_resched| {
+            resched |= woken_resched
+                || curr.is_idle()
+                || scheduler.wakeup_preempt(curr.as_task_ref(), woken);
+        });
+        #[cfg(feature = "preempt")]
+        if resched {
+            curr.set_preempt_pending(true);
+        }
+        #[cfg(not(feature = "preempt"))]
+        let _ = resched;
+    }
+
+    /// Pulls a task from the busiest run queue every [`BALANCE_INTERVAL_TICKS`]
+    /// ticks, if it has at least two more tasks than this one.
+    ///
+    /// Idle CPUs steal tasks as soon as they run out of them (see
+    /// [`AxRunQueue::resched`]), this evens out the CPUs that all stay busy.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    fn balance_tick(&mut self) {
+        if self.inner.balance_ticks > 0 {
+            self.inner.balance_ticks -= 1;
+            return;
+        }
+        self.inner.balance_ticks = BALANCE_INTERVAL_TICKS - 1;
+        if let Some(task) = steal_task(self.inner.cpu_id, self.inner.load() + 2) {
+            debug!(
+                "task balance: {} to run_queue {}",
+                task.id_name(),
+                self.inner.cpu_id
+            );
+            self.inner.add_ready_task(task);
+            #[cfg(feature = "preempt")]
+            if self.current_task.is_idle() {
+                self.current_task.set_preempt_pending(true);
+            }
+        }
     }
 
     /// Yield the current task and reschedule.
@@ -416,7 +746,10 @@ impl<G: BaseGuard> CurrentRunQueueRef<'_, G> {
         // see `unblock_task()` for details.
 
         debug!("task block: {}", curr.id_name());
+        let id = curr.id().as_u64();
+        axhal::trace_event!(Block, id, 0);
         self.inner.resched();
+        axhal::trace_event!(Unblock, id, 0);
     }
 
     #[cfg(feature = "irq")]
@@ -455,6 +788,115 @@ impl AxRunQueue {
         Self {
             cpu_id,
             scheduler: SpinRaw::new(scheduler),
+            nr_ready: AtomicUsize::new(1),
+            idle: AtomicBool::new(false),
+            #[cfg(all(feature = "smp", feature = "irq"))]
+            polling: AtomicBool::new(false),
+            #[cfg(all(feature = "smp", feature = "irq"))]
+            balance_ticks: BALANCE_INTERVAL_TICKS,
+        }
+    }
+
+    /// Returns the number of tasks on this run queue, i.e. the ready ones
+    /// and the running one unless it is the idle task.
+    fn load(&self) -> usize {
+        self.nr_ready.load(Ordering::Relaxed) + !self.idle.load(Ordering::Relaxed) as usize
+    }
+
+    /// Adds a new or migrated ready task to the scheduler.
+    fn add_ready_task(&mut self, task: AxTaskRef) {
+        task.sched_stat_acct()
+            .mark_ready(axhal::time::monotonic_time_nanos());
+        self.scheduler.lock().add_task(task);
+        self.nr_ready.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Puts a ready task back to the scheduler.
+    fn put_ready_task(&mut self, task: AxTaskRef, preempt: bool) {
+        task.sched_stat_acct()
+            .mark_ready(axhal::time::monotonic_time_nanos());
+        self.scheduler.lock().put_prev_task(task, preempt);
+        self.nr_ready.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Hands a blocked task woken up by another CPU over to this run queue,
+    /// and interrupts its CPU if it has no other wakeups pending.
+    ///
+    /// Only atomics of this run queue are touched, the task is put into the
+    /// scheduler later by [`take_wakeups`](Self::take_wakeups) on its CPU.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    fn queue_wakeup(&self, task: AxTaskRef, resched: bool) {
+        if !task.transition_state(TaskState::Blocked, TaskState::Ready) || task.is_idle() {
+            return;
+        }
+        debug!(
+            "task unblock: {} on run_queue {} (queued)",
+            task.id_name(),
+            self.cpu_id
+        );
+        // Counted as ready already for the load balancing, and for the run
+        // delay of the task.
+        self.nr_ready.fetch_add(1, Ordering::Relaxed);
+        task.sched_stat_acct()
+            .mark_ready(axhal::time::monotonic_time_nanos());
+        if WAKE_LISTS[self.cpu_id].push(task, resched) {
+            // Pairs with the fence in `set_polling`.
+            core::sync::atomic::fence(Ordering::SeqCst);
+            if !self.polling.load(Ordering::Relaxed) {
+                axhal::irq::send_ipi(self.cpu_id);
+            }
+        }
+    }
+
+    /// Puts the tasks queued by [`queue_wakeup`](Self::queue_wakeup) into the
+    /// scheduler, calling `f` with the scheduler locked and each task before
+    /// it is put, with the `resched` flag of its wakeup.
+    ///
+    /// Must be called on the CPU of this run queue, with IRQs disabled.
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    fn take_wakeups(&mut self, mut f: impl FnMut(&Scheduler, &AxTaskRef, bool)) {
+        for (task, resched) in WAKE_LISTS[self.cpu_id].take_all() {
+            // Wait for the CPU that blocked the task to finish switching away
+            // from it, unless it's this CPU right now. Pairs with
+            // `clear_prev_task_on_cpu()`.
+            while task.on_cpu() && !crate::current().ptr_eq(&task) {
+                core::hint::spin_loop();
+            }
+            debug!(
+                "task unblock: {} on run_queue {}",
+                task.id_name(),
+                self.cpu_id
+            );
+            let mut scheduler = self.scheduler.lock();
+            f(&scheduler, &task, resched);
+            scheduler.put_prev_task(task, resched);
+        }
+    }
+
+    /// Picks the next task to run from the scheduler.
+    fn pick_next_task(&mut self) -> Option<AxTaskRef> {
+        let task = self.scheduler.lock().pick_next_task()?;
+        self.nr_ready.fetch_sub(1, Ordering::Relaxed);
+        Some(task)
+    }
+
+    /// Picks the next task to run that may run on this CPU, moving the ones
+    /// whose affinity was changed to exclude it to other run queues.
+    #[cfg(feature = "smp")]
+    fn pick_allowed_task(&mut self) -> Option<AxTaskRef> {
+        loop {
+            let task = self.pick_next_task()?;
+            if task.cpumask().get(self.cpu_id) || crate::current().ptr_eq(&task) {
+                return Some(task);
+            }
+            let index = select_run_queue_index(task.cpumask());
+            debug!(
+                "task move: {} from run_queue {} to {}",
+                task.id_name(),
+                self.cpu_id,
+                index
+            );
+            get_run_queue(index).add_ready_task(task);
         }
     }
 
@@ -493,8 +935,16 @@ impl AxRunQueue {
                     core::hint::spin_loop();
                 }
             }
+            // The affinity of the task may have been changed to exclude this
+            // CPU while it was running here.
+            #[cfg(feature = "smp")]
+            if current_state == TaskState::Running && !task.cpumask().get(self.cpu_id) {
+                let index = select_run_queue_index(task.cpumask());
+                get_run_queue(index).put_ready_task(task, preempt);
+                return true;
+            }
             // TODO: priority
-            self.scheduler.lock().put_prev_task(task, preempt);
+            self.put_ready_task(task, preempt);
             true
         } else {
             false
@@ -503,15 +953,29 @@ impl AxRunQueue {
 
     /// Core reschedule subroutine.
     /// Pick the next task to run and switch to it.
+    ///
+    /// If there is no task left, steal one from the busiest CPU before
+    /// falling back to the idle task.
     fn resched(&mut self) {
+        #[cfg(all(feature = "smp", feature = "irq"))]
+        self.take_wakeups(|_, _, _| {});
+        #[cfg(not(feature = "smp"))]
+        let next = self.pick_next_task();
+        #[cfg(feature = "smp")]
         let next = self
-            .scheduler
-            .lock()
-            .pick_next_task()
-            .unwrap_or_else(|| unsafe {
-                // Safety: IRQs must be disabled at this time.
-                IDLE_TASK.current_ref_raw().get_unchecked().clone()
-            });
+            .pick_allowed_task()
+            .or_else(|| steal_task(self.cpu_id, 1));
+        let next = next.unwrap_or_else(|| unsafe {
+            // Safety: IRQs must be disabled at this time.
+            IDLE_TASK.current_ref_raw().get_unchecked().clone()
+        });
+        // The task may have been put into this run queue by another CPU
+        // that is still switching away from it, e.g. if it was stolen or its
+        // affinity excluded that CPU. Pairs with `clear_prev_task_on_cpu()`.
+        #[cfg(feature = "smp")]
+        while next.on_cpu() && !crate::current().ptr_eq(&next) {
+            core::hint::spin_loop();
+        }
         assert!(
             next.is_ready(),
             "next {} is not ready: {:?}",
@@ -536,9 +1000,43 @@ impl AxRunQueue {
         #[cfg(feature = "preempt")]
         next_task.set_preempt_pending(false);
         next_task.set_state(TaskState::Running);
+        self.idle.store(next_task.is_idle(), Ordering::Relaxed);
         if prev_task.ptr_eq(&next_task) {
+            next_task.sched_stat_acct().clear_ready();
             return;
         }
+        axhal::trace_event!(
+            ContextSwitch,
+            prev_task.id().as_u64(),
+            next_task.id().as_u64()
+        );
+        #[cfg(feature = "irq")]
+        if prev_task.is_idle() {
+            crate::timers::exit_idle();
+            // Wakeups need IPIs again until the idle task resumes polling.
+            #[cfg(feature = "smp")]
+            self.polling.store(false, Ordering::Relaxed);
+        }
+        // Hand the performance counters of the CPU over to the next task.
+        prev_task.pmu().lock().save();
+        next_task.pmu().lock().restore();
+        let now = axhal::time::monotonic_time_nanos();
+        prev_task.cpu_time_acct().switch_out(now);
+        next_task.cpu_time_acct().switch_in(now);
+        let cpu_stat = &CPU_SCHED_STATS[self.cpu_id];
+        if !prev_task.is_idle() {
+            // A task that could go on running is put back as ready first.
+            let voluntary = !prev_task.is_ready();
+            prev_task.sched_stat_acct().switch_out(voluntary);
+            cpu_stat.switch_out(voluntary);
+        }
+        if !next_task.is_idle() {
+            let (delay, migrated) = next_task.sched_stat_acct().switch_in(now, self.cpu_id);
+            cpu_stat.switch_in(delay, migrated);
+            axhal::trace_event!(RunDelay, next_task.id().as_u64(), delay);
+        }
+        prev_task.set_switched_out();
+        RUNNING_TASK_IDS[self.cpu_id].store(next_task.id().as_u64(), Ordering::Relaxed);
 
         // Claim the task as running, we do this before switching to it
         // such that any running task will have this set.
@@ -605,9 +1103,47 @@ fn gc_entry() {
 pub(crate) fn migrate_entry(migrated_task: AxTaskRef) {
     select_run_queue::<kernel_guard::NoPreemptIrqSave>(&migrated_task)
         .inner
-        .scheduler
-        .lock()
-        .put_prev_task(migrated_task, false)
+        .put_ready_task(migrated_task, false)
+}
+
+/// Takes a ready task from the busiest run queue other than the one of
+/// `cpu_id`, if that one has at least `min_load` tasks and at least one of
+/// them ready.
+///
+/// Only the task about to be picked by that run queue is considered, and
+/// none is taken if its CPU affinity excludes `cpu_id`. The run queue of
+/// `cpu_id` must not be locked, since only one at a time may be.
+#[cfg(feature = "smp")]
+fn steal_task(cpu_id: usize, min_load: usize) -> Option<AxTaskRef> {
+    let (busiest, load) = (0..axconfig::SMP)
+        .filter(|&i| i != cpu_id && RUN_QUEUE_READY[i].load(Ordering::Acquire))
+        .map(|i| (i, get_run_queue(i)))
+        .filter(|(_, rq)| rq.nr_ready.load(Ordering::Relaxed) > 0)
+        .map(|(i, rq)| (i, rq.load()))
+        .max_by_key(|&(_, load)| load)?;
+    if load < min_load {
+        return None;
+    }
+    let rq = get_run_queue(busiest);
+    let task = {
+        // Do not spin on a run queue that is busy, there will be other
+        // chances to balance the load.
+        let mut scheduler = rq.scheduler.try_lock()?;
+        let task = scheduler.pick_next_task()?;
+        if !task.cpumask().get(cpu_id) {
+            scheduler.put_prev_task(task, false);
+            return None;
+        }
+        rq.nr_ready.fetch_sub(1, Ordering::Relaxed);
+        task
+    };
+    debug!(
+        "task steal: {} from run_queue {} to {}",
+        task.id_name(),
+        busiest,
+        cpu_id
+    );
+    Some(task)
 }
 
 /// Clear the `on_cpu` field of previous task running on this CPU.
@@ -644,6 +1180,8 @@ pub(crate) fn init() {
     unsafe {
         RUN_QUEUES[cpu_id].write(RUN_QUEUE.current_ref_mut_raw());
     }
+    #[cfg(feature = "smp")]
+    RUN_QUEUE_READY[cpu_id].store(true, Ordering::Release);
 }
 
 pub(crate) fn init_secondary() {
@@ -658,9 +1196,13 @@ pub(crate) fn init_secondary() {
     unsafe { CurrentTask::init_current(idle_task) }
 
     RUN_QUEUE.with_current(|rq| {
-        rq.init_once(AxRunQueue::new(cpu_id));
+        let mut run_queue = AxRunQueue::new(cpu_id);
+        *run_queue.idle.get_mut() = true;
+        rq.init_once(run_queue);
     });
     unsafe {
         RUN_QUEUES[cpu_id].write(RUN_QUEUE.current_ref_mut_raw());
     }
+    #[cfg(feature = "smp")]
+    RUN_QUEUE_READY[cpu_id].store(true, Ordering::Release);
 }
@@ -0,0 +1,194 @@
+//! A weighted fair scheduler.
+//!
+//! Every task accumulates a virtual runtime, which grows on each timer tick
+//! by an amount inversely proportional to the weight of its nice value, and
+//! the ready task with the smallest virtual runtime runs next. As in Linux, a
+//! task gets about 1.25 times the CPU time of a task one nice level above it.
+//!
+//! Tasks that slept are placed at most [`SLEEPER_CREDIT`] behind the smallest
+//! virtual runtime of the run queue, so that they run soon after waking up,
+//! possibly preempting the running task, but do not monopolize the CPU after
+//! a long sleep.
+
+use alloc::{collections::BTreeMap, sync::Arc};
+use core::ops::Deref;
+use core::sync::atomic::{AtomicIsize, AtomicU64, Ordering};
+
+use scheduler::BaseScheduler;
+
+use super::SchedulerExt;
+
+/// The weight of nice 0.
+const NICE_0_WEIGHT: u64 = 1024;
+
+/// The weights of the nice values from -20 to 19, as in Linux's
+/// `sched_prio_to_weight`.
+const NICE_TO_WEIGHT: [u64; 40] = [
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916, // -20
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277, // -10
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137, // 0
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15, // 10
+];
+
+/// The virtual runtime a task of nice 0 accumulates per timer tick.
+const TICK_VRUNTIME: u64 = 1 << 20;
+/// How far the running task may get ahead of the next one before it is
+/// preempted on a timer tick.
+const MIN_GRANULARITY: u64 = 2 * TICK_VRUNTIME;
+/// How far a woken up task must be behind the running task to preempt it.
+const WAKEUP_GRANULARITY: u64 = TICK_VRUNTIME;
+/// How far behind the smallest virtual runtime a task that slept is placed.
+const SLEEPER_CREDIT: u64 = 3 * TICK_VRUNTIME;
+
+/// A task of the [`FairScheduler`].
+pub struct FairTask<T> {
+    inner: T,
+    nice: AtomicIsize,
+    vruntime: AtomicU64,
+    /// The sequence number of the task in the ready queue, which orders
+    /// tasks of equal virtual runtime.
+    seq: AtomicU64,
+}
+
+impl<T> FairTask<T> {
+    /// Creates a task of nice 0.
+    pub const fn new(inner: T) -> Self {
+        Self {
+            inner,
+            nice: AtomicIsize::new(0),
+            vruntime: AtomicU64::new(0),
+            seq: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns a reference to the inner task struct.
+    pub const fn inner(&self) -> &T {
+        &self.inner
+    }
+
+    fn weight(&self) -> u64 {
+        NICE_TO_WEIGHT[(self.nice.load(Ordering::Relaxed) + 20) as usize]
+    }
+
+    fn vruntime(&self) -> u64 {
+        self.vruntime.load(Ordering::Relaxed)
+    }
+
+    fn key(&self) -> (u64, u64) {
+        (self.vruntime(), self.seq.load(Ordering::Relaxed))
+    }
+}
+
+impl<T> Deref for FairTask<T> {
+    type Target = T;
+
+    fn deref(&self) -> &Self::Target {
+        &self.inner
+    }
+}
+
+/// A weighted fair scheduler, see the [module documentation](self).
+pub struct FairScheduler<T> {
+    ready_queue: BTreeMap<(u64, u64), Arc<FairTask<T>>>,
+    /// The smallest virtual runtime of the tasks of this run queue, which
+    /// never decreases.
+    min_vruntime: u64,
+    next_seq: u64,
+}
+
+impl<T> FairScheduler<T> {
+    /// Creates an empty scheduler.
+    pub const fn new() -> Self {
+        Self {
+            ready_queue: BTreeMap::new(),
+            min_vruntime: 0,
+            next_seq: 0,
+        }
+    }
+
+    /// Returns the name of the scheduler.
+    pub fn scheduler_name() -> &'static str {
+        "Fair"
+    }
+
+    fn enqueue(&mut self, task: Arc<FairTask<T>>, vruntime: u64) {
+        task.vruntime.store(vruntime, Ordering::Relaxed);
+        task.seq.store(self.next_seq, Ordering::Relaxed);
+        self.next_seq += 1;
+        self.ready_queue.insert(task.key(), task);
+    }
+
+    fn update_min_vruntime(&mut self, curr: Option<u64>) {
+        let leftmost = self.ready_queue.first_key_value().map(|(key, _)| key.0);
+        if let Some(min) = curr.into_iter().chain(leftmost).min() {
+            self.min_vruntime = self.min_vruntime.max(min);
+        }
+    }
+}
+
+impl<T> Default for FairScheduler<T> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T> BaseScheduler for FairScheduler<T> {
+    type SchedItem = Arc<FairTask<T>>;
+
+    fn init(&mut self) {}
+
+    /// Adds a new task, or one migrated from another run queue, whose
+    /// virtual runtime is not comparable to the ones of this queue.
+    fn add_task(&mut self, task: Self::SchedItem) {
+        self.enqueue(task, self.min_vruntime);
+    }
+
+    fn remove_task(&mut self, task: &Self::SchedItem) -> Option<Self::SchedItem> {
+        self.ready_queue.remove(&task.key())
+    }
+
+    fn pick_next_task(&mut self) -> Option<Self::SchedItem> {
+        let (_, task) = self.ready_queue.pop_first()?;
+        self.min_vruntime = self.min_vruntime.max(task.vruntime());
+        Some(task)
+    }
+
+    fn put_prev_task(&mut self, prev: Self::SchedItem, _preempt: bool) {
+        let vruntime = prev
+            .vruntime()
+            .max(self.min_vruntime.saturating_sub(SLEEPER_CREDIT));
+        self.enqueue(prev, vruntime);
+    }
+
+    fn task_tick(&mut self, current: &Self::SchedItem) -> bool {
+        let delta = TICK_VRUNTIME * NICE_0_WEIGHT / current.weight();
+        let vruntime = current.vruntime.fetch_add(delta, Ordering::Relaxed) + delta;
+        self.update_min_vruntime(Some(vruntime));
+        self.ready_queue
+            .first_key_value()
+            .is_some_and(|(key, _)| vruntime > key.0 + MIN_GRANULARITY)
+    }
+
+    fn set_priority(&mut self, task: &Self::SchedItem, prio: isize) -> bool {
+        if (-20..=19).contains(&prio) {
+            task.nice.store(prio, Ordering::Relaxed);
+            true
+        } else {
+            false
+        }
+    }
+}
+
+impl<T> SchedulerExt for FairScheduler<T> {
+    fn create() -> Self {
+        Self::new()
+    }
+
+    fn name() -> &'static str {
+        Self::scheduler_name()
+    }
+
+    fn wakeup_preempt(&self, curr: &Self::SchedItem, woken: &Self::SchedItem) -> bool {
+        woken.vruntime() + WAKEUP_GRANULARITY < curr.vruntime()
+    }
+}
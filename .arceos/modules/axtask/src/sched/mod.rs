@@ -0,0 +1,44 @@
+//! Schedulers implemented in this crate, and the extensions of the
+//! [`scheduler`] crate's interface that the run queues rely on.
+
+#[cfg(any(feature = "sched_cfs", test))]
+pub(crate) mod fair;
+pub(crate) mod rt;
+
+use scheduler::BaseScheduler;
+
+/// Scheduling decisions beyond [`BaseScheduler`].
+pub(crate) trait SchedulerExt: BaseScheduler + Sized {
+    /// Creates an empty scheduler.
+    fn create() -> Self;
+
+    /// Returns the name of the scheduler.
+    fn name() -> &'static str;
+
+    /// Returns whether the task `woken` should preempt the running task
+    /// `curr` once it is woken up on the same CPU.
+    fn wakeup_preempt(&self, curr: &Self::SchedItem, woken: &Self::SchedItem) -> bool {
+        let _ = (curr, woken);
+        false
+    }
+}
+
+impl<T> SchedulerExt for scheduler::FifoScheduler<T> {
+    fn create() -> Self {
+        Self::new()
+    }
+
+    fn name() -> &'static str {
+        Self::scheduler_name()
+    }
+}
+
+impl<T, const S: usize> SchedulerExt for scheduler::RRScheduler<T, S> {
+    fn create() -> Self {
+        Self::new()
+    }
+
+    fn name() -> &'static str {
+        Self::scheduler_name()
+    }
+}
@@ -0,0 +1,288 @@
+//! Real-time scheduling classes.
+//!
+//! Tasks of the [`SchedPolicy::Fifo`] and [`SchedPolicy::RoundRobin`]
+//! policies have a static priority from 1 to [`MAX_RT_PRIO`], and always run
+//! before the normal tasks, which are left to the scheduler selected at build
+//! time. Among real-time tasks, the highest priority runs first, and tasks of
+//! equal priority run in FIFO order. A FIFO task runs until it blocks, yields
+//! or is preempted by a higher priority task, while a round-robin task also
+//! goes to the back of its priority after [`RR_TIME_SLICE`] ticks.
+//!
+//! As a safety valve against runaway real-time tasks, they may use at most
+//! [`RT_RUNTIME_TICKS`] of every [`RT_PERIOD_TICKS`] busy ticks of a CPU
+//! while normal tasks are waiting, like `sched_rt_runtime_us` in Linux.
+//! Unlike Linux, the throttled tasks still run if there is nothing else to.
+
+use alloc::collections::VecDeque;
+use core::sync::atomic::{AtomicBool, AtomicU8, AtomicUsize, Ordering};
+
+use scheduler::BaseScheduler;
+
+use super::SchedulerExt;
+use crate::AxTaskRef;
+
+/// The highest real-time priority.
+pub const MAX_RT_PRIO: u8 = 99;
+/// The time slice of round-robin tasks, in timer ticks.
+const RR_TIME_SLICE: usize = if axconfig::TICKS_PER_SEC >= 10 {
+    axconfig::TICKS_PER_SEC / 10
+} else {
+    1
+};
+/// The number of busy ticks over which the time of real-time tasks is
+/// limited.
+const RT_PERIOD_TICKS: usize = axconfig::TICKS_PER_SEC;
+/// The number of ticks of each period real-time tasks may use while normal
+/// tasks are waiting.
+const RT_RUNTIME_TICKS: usize = RT_PERIOD_TICKS * 95 / 100;
+
+/// The scheduling policy of a task.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SchedPolicy {
+    /// Scheduled by the scheduler selected at build time.
+    Normal,
+    /// Real-time first-in first-out, with a priority from 1 to
+    /// [`MAX_RT_PRIO`].
+    Fifo(u8),
+    /// Real-time round-robin, with a priority from 1 to [`MAX_RT_PRIO`].
+    RoundRobin(u8),
+}
+
+/// The real-time scheduling state of a task.
+pub(crate) struct RtParams {
+    /// The real-time priority, or 0 for normal tasks.
+    priority: AtomicU8,
+    round_robin: AtomicBool,
+    /// The ticks left in the time slice of a round-robin task.
+    slice: AtomicUsize,
+}
+
+impl RtParams {
+    pub const fn new() -> Self {
+        Self {
+            priority: AtomicU8::new(0),
+            round_robin: AtomicBool::new(false),
+            slice: AtomicUsize::new(RR_TIME_SLICE),
+        }
+    }
+
+    pub fn policy(&self) -> SchedPolicy {
+        match self.priority.load(Ordering::Acquire) {
+            0 => SchedPolicy::Normal,
+            prio if self.round_robin.load(Ordering::Relaxed) => SchedPolicy::RoundRobin(prio),
+            prio => SchedPolicy::Fifo(prio),
+        }
+    }
+
+    /// Sets the policy, returning `false` if its priority is out of range.
+    pub fn set_policy(&self, policy: SchedPolicy) -> bool {
+        let (priority, round_robin) = match policy {
+            SchedPolicy::Normal => (0, false),
+            SchedPolicy::Fifo(prio) => (prio, false),
+            SchedPolicy::RoundRobin(prio) => (prio, true),
+        };
+        if policy != SchedPolicy::Normal && !(1..=MAX_RT_PRIO).contains(&priority) {
+            return false;
+        }
+        self.round_robin.store(round_robin, Ordering::Relaxed);
+        self.priority.store(priority, Ordering::Release);
+        true
+    }
+
+    fn priority(&self) -> u8 {
+        self.priority.load(Ordering::Acquire)
+    }
+}
+
+/// A scheduler that runs real-time tasks before the ones of the scheduler
+/// `S`, see the [module documentation](self).
+///
+/// A task whose policy changes while it is ready stays in the queue it was
+/// put in until it is picked.
+pub(crate) struct RtScheduler<S> {
+    /// The ready real-time tasks of each priority, from 1.
+    queues: [VecDeque<AxTaskRef>; MAX_RT_PRIO as usize],
+    /// The priorities that have ready tasks.
+    bitmap: u128,
+    base: S,
+    /// The number of ready tasks in `base`.
+    nr_base: usize,
+    /// The busy ticks of the current period.
+    period_ticks: usize,
+    /// The ticks used by real-time tasks in the current period.
+    rt_ticks: usize,
+}
+
+impl<S: SchedulerExt<SchedItem = AxTaskRef>> RtScheduler<S> {
+    pub fn new() -> Self {
+        Self {
+            queues: [const { VecDeque::new() }; MAX_RT_PRIO as usize],
+            bitmap: 0,
+            base: S::create(),
+            nr_base: 0,
+            period_ticks: 0,
+            rt_ticks: 0,
+        }
+    }
+
+    pub fn scheduler_name() -> &'static str {
+        S::name()
+    }
+
+    /// Returns the highest priority of the ready real-time tasks, or 0.
+    fn highest_priority(&self) -> u8 {
+        (u128::BITS - self.bitmap.leading_zeros()) as u8
+    }
+
+    /// Whether real-time tasks used up their time of the period while
+    /// normal tasks are waiting.
+    fn throttled(&self) -> bool {
+        self.rt_ticks >= RT_RUNTIME_TICKS && self.nr_base > 0
+    }
+
+    fn push_rt(&mut self, task: AxTaskRef, prio: u8, front: bool) {
+        let queue = &mut self.queues[prio as usize - 1];
+        if front {
+            queue.push_front(task);
+        } else {
+            queue.push_back(task);
+        }
+        self.bitmap |= 1 << (prio - 1);
+    }
+
+    fn pop_rt(&mut self) -> Option<AxTaskRef> {
+        let prio = self.highest_priority();
+        if prio == 0 {
+            return None;
+        }
+        let queue = &mut self.queues[prio as usize - 1];
+        let task = queue.pop_front();
+        if queue.is_empty() {
+            self.bitmap &= !(1 << (prio - 1));
+        }
+        task
+    }
+
+    fn push_base(&mut self, task: AxTaskRef, preempt: Option<bool>) {
+        match preempt {
+            Some(preempt) => self.base.put_prev_task(task, preempt),
+            None => self.base.add_task(task),
+        }
+        self.nr_base += 1;
+    }
+}
+
+impl<S: SchedulerExt<SchedItem = AxTaskRef>> BaseScheduler for RtScheduler<S> {
+    type SchedItem = AxTaskRef;
+
+    fn init(&mut self) {
+        self.base.init();
+    }
+
+    fn add_task(&mut self, task: Self::SchedItem) {
+        match task.rt().priority() {
+            0 => self.push_base(task, None),
+            prio => {
+                task.rt().slice.store(RR_TIME_SLICE, Ordering::Relaxed);
+                self.push_rt(task, prio, false);
+            }
+        }
+    }
+
+    fn remove_task(&mut self, task: &Self::SchedItem) -> Option<Self::SchedItem> {
+        for prio in 1..=MAX_RT_PRIO {
+            let queue = &mut self.queues[prio as usize - 1];
+            if let Some(index) = queue.iter().position(|t| AxTaskRef::ptr_eq(t, task)) {
+                let task = queue.remove(index);
+                if queue.is_empty() {
+                    self.bitmap &= !(1 << (prio - 1));
+                }
+                return task;
+            }
+        }
+        let task = self.base.remove_task(task)?;
+        self.nr_base -= 1;
+        Some(task)
+    }
+
+    fn pick_next_task(&mut self) -> Option<Self::SchedItem> {
+        if !self.throttled() {
+            if let Some(task) = self.pop_rt() {
+                return Some(task);
+            }
+        }
+        match self.base.pick_next_task() {
+            Some(task) => {
+                self.nr_base -= 1;
+                Some(task)
+            }
+            None => self.pop_rt(),
+        }
+    }
+
+    fn put_prev_task(&mut self, prev: Self::SchedItem, preempt: bool) {
+        let prio = prev.rt().priority();
+        if prio == 0 {
+            return self.push_base(prev, Some(preempt));
+        }
+        // A preempted task resumes before the others of its priority,
+        // unless it is a round-robin task that used up its time slice.
+        let rt = prev.rt();
+        let expired =
+            rt.round_robin.load(Ordering::Relaxed) && rt.slice.load(Ordering::Relaxed) == 0;
+        if expired || !preempt {
+            rt.slice.store(RR_TIME_SLICE, Ordering::Relaxed);
+        }
+        self.push_rt(prev, prio, preempt && !expired);
+    }
+
+    fn task_tick(&mut self, current: &Self::SchedItem) -> bool {
+        self.period_ticks += 1;
+        if self.period_ticks >= RT_PERIOD_TICKS {
+            self.period_ticks = 0;
+            self.rt_ticks = 0;
+        }
+        let rt = current.rt();
+        let prio = rt.priority();
+        if prio == 0 {
+            let resched = self.base.task_tick(current);
+            return resched || (self.bitmap != 0 && !self.throttled());
+        }
+        self.rt_ticks += 1;
+        if self.throttled() || self.highest_priority() > prio {
+            return true;
+        }
+        if rt.round_robin.load(Ordering::Relaxed) {
+            let slice = rt.slice.load(Ordering::Relaxed).saturating_sub(1);
+            rt.slice.store(slice, Ordering::Relaxed);
+            if slice == 0 {
+                if self.highest_priority() == prio {
+                    return true;
+                }
+                rt.slice.store(RR_TIME_SLICE, Ordering::Relaxed);
+            }
+        }
+        false
+    }
+
+    fn set_priority(&mut self, task: &Self::SchedItem, prio: isize) -> bool {
+        self.base.set_priority(task, prio)
+    }
+}
+
+impl<S: SchedulerExt<SchedItem = AxTaskRef>> SchedulerExt for RtScheduler<S> {
+    fn create() -> Self {
+        Self::new()
+    }
+
+    fn name() -> &'static str {
+        S::name()
+    }
+
+    fn wakeup_preempt(&self, curr: &Self::SchedItem, woken: &Self::SchedItem) -> bool {
+        match (curr.rt().priority(), woken.rt().priority()) {
+            (0, 0) => self.base.wakeup_preempt(curr, woken),
+            (curr_prio, woken_prio) => woken_prio > curr_prio && !self.throttled(),
+        }
+    }
+}
@@ -0,0 +1,145 @@
+//! Scheduling statistics of tasks and CPUs, as in Linux `schedstat`.
+
+use core::ops::Add;
+use core::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+
+/// The scheduling statistics of a task or a CPU.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct SchedStat {
+    /// The time spent ready to run, waiting for a CPU, in nanoseconds.
+    pub run_delay_nanos: u64,
+    /// The number of times a task was switched in.
+    pub timeslices: u64,
+    /// The switches away from tasks that blocked, slept or exited.
+    pub voluntary_switches: u64,
+    /// The switches away from tasks that could go on running, i.e. that were
+    /// preempted, yielded or migrated.
+    pub involuntary_switches: u64,
+    /// The number of times a task was switched in on another CPU than the one
+    /// it last ran on.
+    pub migrations: u64,
+}
+
+impl Add for SchedStat {
+    type Output = Self;
+
+    fn add(self, other: Self) -> Self {
+        Self {
+            run_delay_nanos: self.run_delay_nanos + other.run_delay_nanos,
+            timeslices: self.timeslices + other.timeslices,
+            voluntary_switches: self.voluntary_switches + other.voluntary_switches,
+            involuntary_switches: self.involuntary_switches + other.involuntary_switches,
+            migrations: self.migrations + other.migrations,
+        }
+    }
+}
+
+/// The counters of a [`SchedStat`], updated on context switches and read
+/// from any CPU.
+pub(crate) struct SchedCounters {
+    run_delay_nanos: AtomicU64,
+    timeslices: AtomicU64,
+    voluntary_switches: AtomicU64,
+    involuntary_switches: AtomicU64,
+    migrations: AtomicU64,
+}
+
+impl SchedCounters {
+    pub(crate) const fn new() -> Self {
+        Self {
+            run_delay_nanos: AtomicU64::new(0),
+            timeslices: AtomicU64::new(0),
+            voluntary_switches: AtomicU64::new(0),
+            involuntary_switches: AtomicU64::new(0),
+            migrations: AtomicU64::new(0),
+        }
+    }
+
+    /// Counts a task switched in after waiting `delay` nanoseconds, on
+    /// another CPU than last time if `migrated`.
+    pub(crate) fn switch_in(&self, delay: u64, migrated: bool) {
+        self.run_delay_nanos.fetch_add(delay, Ordering::Relaxed);
+        self.timeslices.fetch_add(1, Ordering::Relaxed);
+        if migrated {
+            self.migrations.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Counts a task switched out, which could not go on running if
+    /// `voluntary`.
+    pub(crate) fn switch_out(&self, voluntary: bool) {
+        let switches = if voluntary {
+            &self.voluntary_switches
+        } else {
+            &self.involuntary_switches
+        };
+        switches.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn get(&self) -> SchedStat {
+        SchedStat {
+            run_delay_nanos: self.run_delay_nanos.load(Ordering::Relaxed),
+            timeslices: self.timeslices.load(Ordering::Relaxed),
+            voluntary_switches: self.voluntary_switches.load(Ordering::Relaxed),
+            involuntary_switches: self.involuntary_switches.load(Ordering::Relaxed),
+            migrations: self.migrations.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// The scheduling statistics of a task, with what is needed to measure them.
+pub(crate) struct TaskSchedStat {
+    counters: SchedCounters,
+    /// When the task was made ready, or 0 if it is not waiting for a CPU.
+    ready_since: AtomicU64,
+    /// The CPU the task last ran on, or `usize::MAX` if it never ran.
+    last_cpu: AtomicUsize,
+}
+
+impl TaskSchedStat {
+    pub(crate) const fn new() -> Self {
+        Self {
+            counters: SchedCounters::new(),
+            ready_since: AtomicU64::new(0),
+            last_cpu: AtomicUsize::new(usize::MAX),
+        }
+    }
+
+    /// Starts the run delay when the task is made ready at `now`, unless it
+    /// is already waiting, e.g. when it is moved to another run queue.
+    pub(crate) fn mark_ready(&self, now: u64) {
+        let _ =
+            self.ready_since
+                .compare_exchange(0, now.max(1), Ordering::Relaxed, Ordering::Relaxed);
+    }
+
+    /// Counts the task switched in at `now` on the CPU `cpu_id`, and returns
+    /// its run delay and whether it migrated.
+    pub(crate) fn switch_in(&self, now: u64, cpu_id: usize) -> (u64, bool) {
+        let since = self.ready_since.swap(0, Ordering::Relaxed);
+        let delay = if since == 0 {
+            0
+        } else {
+            now.saturating_sub(since)
+        };
+        let last_cpu = self.last_cpu.swap(cpu_id, Ordering::Relaxed);
+        let migrated = last_cpu != usize::MAX && last_cpu != cpu_id;
+        self.counters.switch_in(delay, migrated);
+        (delay, migrated)
+    }
+
+    /// Ends the run delay without counting a switch, when the task is picked
+    /// again right after being put back.
+    pub(crate) fn clear_ready(&self) {
+        self.ready_since.store(0, Ordering::Relaxed);
+    }
+
+    /// Counts the task switched out, see [`SchedCounters::switch_out`].
+    pub(crate) fn switch_out(&self, voluntary: bool) {
+        self.counters.switch_out(voluntary);
+    }
+
+    pub(crate) fn get(&self) -> SchedStat {
+        self.counters.get()
+    }
+}
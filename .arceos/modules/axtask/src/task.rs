@@ -1,7 +1,7 @@
 use alloc::{boxed::Box, string::String, sync::Arc};
 use core::ops::Deref;
 use core::sync::atomic::{AtomicBool, AtomicI32, AtomicU8, AtomicU64, Ordering};
-use core::{alloc::Layout, cell::UnsafeCell, fmt, ptr::NonNull};
+use core::{alloc::Layout, cell::UnsafeCell, fmt, ptr::NonNull, time::Duration};
 
 #[cfg(feature = "preempt")]
 use core::sync::atomic::AtomicUsize;
@@ -10,9 +10,13 @@ use kspin::SpinNoIrq;
 use memory_addr::{VirtAddr, align_up_4k};
 
 use axhal::arch::TaskContext;
+use axhal::pmu::PmuContext;
 #[cfg(feature = "tls")]
 use axhal::tls::TlsArea;
 
+use crate::cpu_time::CpuTime;
+use crate::sched::rt::{RtParams, SchedPolicy};
+use crate::sched_stat::{SchedStat, TaskSchedStat};
 use crate::task_ext::AxTaskExt;
 use crate::{AxCpuMask, AxTask, AxTaskRef, WaitQueue};
 
@@ -48,18 +52,32 @@ pub struct TaskInner {
     /// CPU affinity mask.
     cpumask: SpinNoIrq<AxCpuMask>,
 
+    /// The real-time scheduling state.
+    rt: RtParams,
+
     /// Mark whether the task is in the wait queue.
     in_wait_queue: AtomicBool,
+    /// Whether the task was switched out since
+    /// [`take_switched_out`](Self::take_switched_out) was last called.
+    switched_out: AtomicBool,
 
     /// Used to indicate whether the task is running on a CPU.
     #[cfg(feature = "smp")]
     on_cpu: AtomicBool,
 
+    /// The link of the task in the wake list of a CPU, see
+    /// [`WakeList`](crate::run_queue::WakeList).
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    wake_entry: crate::run_queue::WakeEntry,
+
     /// A ticket ID used to identify the timer event.
     /// Set by `set_timer_ticket()` when creating a timer event in `set_alarm_wakeup()`,
     /// expired by setting it as zero in `timer_ticket_expired()`, which is called by `cancel_events()`.
     #[cfg(feature = "irq")]
     timer_ticket_id: AtomicU64,
+    /// The CPU and the handle of the timer event of the ticket, to cancel it.
+    #[cfg(feature = "irq")]
+    timer_handle: AtomicU64,
 
     #[cfg(feature = "preempt")]
     need_resched: AtomicBool,
@@ -69,6 +87,13 @@ pub struct TaskInner {
     exit_code: AtomicI32,
     wait_for_exit: WaitQueue,
 
+    /// The performance counters of the task.
+    pmu: SpinNoIrq<PmuContext>,
+    /// The CPU time of the task.
+    cpu_time: CpuTime,
+    /// The scheduling statistics of the task.
+    sched_stat: TaskSchedStat,
+
     kstack: Option<TaskStack>,
     ctx: UnsafeCell<TaskContext>,
     task_ext: AxTaskExt,
@@ -200,6 +225,42 @@ impl TaskInner {
         }
     }
 
+    /// Returns the bottom address of the kernel stack.
+    #[inline]
+    pub const fn kernel_stack_bottom(&self) -> Option<VirtAddr> {
+        match &self.kstack {
+            Some(s) => Some(s.bottom()),
+            None => None,
+        }
+    }
+
+    /// Returns the performance counters of the task.
+    #[inline]
+    pub const fn pmu(&self) -> &SpinNoIrq<PmuContext> {
+        &self.pmu
+    }
+
+    /// Returns the time the task has spent running in user mode and in the
+    /// kernel, as `(user, system)`.
+    pub fn cpu_time(&self) -> (Duration, Duration) {
+        self.cpu_time.get()
+    }
+
+    #[inline]
+    pub(crate) const fn cpu_time_acct(&self) -> &CpuTime {
+        &self.cpu_time
+    }
+
+    /// Returns the scheduling statistics of the task.
+    pub fn sched_stat(&self) -> SchedStat {
+        self.sched_stat.get()
+    }
+
+    #[inline]
+    pub(crate) const fn sched_stat_acct(&self) -> &TaskSchedStat {
+        &self.sched_stat
+    }
+
     /// Gets the cpu affinity mask of the task.
     ///
     /// Returns the cpu affinity mask of the task in type [`AxCpuMask`].
@@ -217,6 +278,22 @@ impl TaskInner {
         *self.cpumask.lock() = cpumask
     }
 
+    /// Gets the scheduling policy of the task.
+    pub fn sched_policy(&self) -> SchedPolicy {
+        self.rt.policy()
+    }
+
+    /// Sets the scheduling policy of the task, see [`crate::set_task_policy`].
+    ///
+    /// Returns `false` if the real-time priority is out of range.
+    pub fn set_sched_policy(&self, policy: SchedPolicy) -> bool {
+        self.rt.set_policy(policy)
+    }
+
+    pub(crate) fn rt(&self) -> &RtParams {
+        &self.rt
+    }
+
     /// Read the top address of the kernel stack for the task.
     #[inline]
     pub fn get_kernel_stack_top(&self) -> Option<usize> {
@@ -244,17 +321,26 @@ impl TaskInner {
             state: AtomicU8::new(TaskState::Ready as u8),
             // By default, the task is allowed to run on all CPUs.
             cpumask: SpinNoIrq::new(AxCpuMask::full()),
+            rt: RtParams::new(),
             in_wait_queue: AtomicBool::new(false),
+            switched_out: AtomicBool::new(false),
             #[cfg(feature = "irq")]
             timer_ticket_id: AtomicU64::new(0),
+            #[cfg(feature = "irq")]
+            timer_handle: AtomicU64::new(0),
             #[cfg(feature = "smp")]
             on_cpu: AtomicBool::new(false),
+            #[cfg(all(feature = "smp", feature = "irq"))]
+            wake_entry: crate::run_queue::WakeEntry::new(),
             #[cfg(feature = "preempt")]
             need_resched: AtomicBool::new(false),
             #[cfg(feature = "preempt")]
             preempt_disable_count: AtomicUsize::new(0),
             exit_code: AtomicI32::new(0),
             wait_for_exit: WaitQueue::new(),
+            pmu: SpinNoIrq::new(PmuContext::new()),
+            cpu_time: CpuTime::new(0),
+            sched_stat: TaskSchedStat::new(),
             kstack: None,
             ctx: UnsafeCell::new(TaskContext::new()),
             task_ext: AxTaskExt::empty(),
@@ -274,6 +360,7 @@ impl TaskInner {
     pub(crate) fn new_init(name: String) -> Self {
         let mut t = Self::new_common(TaskId::new(), name);
         t.is_init = true;
+        t.cpu_time = CpuTime::new(axhal::time::monotonic_time_nanos());
         #[cfg(feature = "smp")]
         t.set_on_cpu(true);
         if t.name() == "idle" {
@@ -328,8 +415,9 @@ impl TaskInner {
         self.is_init
     }
 
+    /// Whether the task is the idle task of a CPU.
     #[inline]
-    pub(crate) const fn is_idle(&self) -> bool {
+    pub const fn is_idle(&self) -> bool {
         self.is_idle
     }
 
@@ -343,6 +431,21 @@ impl TaskInner {
         self.in_wait_queue.store(in_wait_queue, Ordering::Release);
     }
 
+    /// Returns whether the task was switched out since this was last called,
+    /// because it was preempted, blocked or migrated, e.g. to abort the
+    /// restartable sequence it was in.
+    #[inline]
+    pub fn take_switched_out(&self) -> bool {
+        self.switched_out.swap(false, Ordering::Relaxed)
+    }
+
+    /// Marks the task as switched out, as if it was preempted, e.g. to abort
+    /// its restartable sequence on the next return to user space.
+    #[inline]
+    pub fn set_switched_out(&self) {
+        self.switched_out.store(true, Ordering::Relaxed);
+    }
+
     /// Returns task's current timer ticket ID.
     #[inline]
     #[cfg(feature = "irq")]
@@ -361,6 +464,27 @@ impl TaskInner {
             .store(timer_ticket_id, Ordering::Release);
     }
 
+    /// Returns the CPU and the handle of the timer event set with the current
+    /// timer ticket ID.
+    #[inline]
+    #[cfg(feature = "irq")]
+    pub(crate) fn timer_handle(&self) -> (usize, crate::timer_wheel::TimerHandle) {
+        let handle = self.timer_handle.load(Ordering::Acquire);
+        (
+            (handle >> 32) as usize,
+            crate::timer_wheel::TimerHandle(handle as u32),
+        )
+    }
+
+    /// Sets the CPU and the handle of the timer event of the current timer
+    /// ticket ID.
+    #[inline]
+    #[cfg(feature = "irq")]
+    pub(crate) fn set_timer_handle(&self, cpu_id: usize, handle: crate::timer_wheel::TimerHandle) {
+        let handle = ((cpu_id as u64) << 32) | handle.0 as u64;
+        self.timer_handle.store(handle, Ordering::Release);
+    }
+
     /// Expire timer ticket ID by setting it to 0,
     /// it can be used to identify one timer event is triggered or expired.
     #[inline]
@@ -439,6 +563,12 @@ impl TaskInner {
     pub(crate) fn set_on_cpu(&self, on_cpu: bool) {
         self.on_cpu.store(on_cpu, Ordering::Release)
     }
+
+    #[cfg(all(feature = "smp", feature = "irq"))]
+    #[inline]
+    pub(crate) fn wake_entry(&self) -> &crate::run_queue::WakeEntry {
+        &self.wake_entry
+    }
 }
 
 impl fmt::Debug for TaskInner {
@@ -457,6 +587,52 @@ impl Drop for TaskInner {
     }
 }
 
+/// The maximum number of freed task stacks kept by each CPU for reuse.
+const STACK_CACHE_SIZE: usize = 8;
+
+/// Task stacks freed on a CPU, as addresses and sizes, which new tasks take
+/// instead of allocating, so that short-lived tasks do not go through the
+/// allocator for their stacks. The stacks are not zeroed either way.
+struct StackCache {
+    stacks: [(usize, usize); STACK_CACHE_SIZE],
+    len: usize,
+}
+
+#[percpu::def_percpu]
+static STACK_CACHE: StackCache = StackCache {
+    stacks: [(0, 0); STACK_CACHE_SIZE],
+    len: 0,
+};
+
+impl StackCache {
+    /// Runs `f` on the cache of the current CPU.
+    fn with<R>(f: impl FnOnce(&mut Self) -> R) -> R {
+        let _guard = kernel_guard::NoPreemptIrqSave::new();
+        f(unsafe { STACK_CACHE.current_ref_mut_raw() })
+    }
+
+    /// Takes a stack of `size` bytes.
+    fn take(&mut self, size: usize) -> Option<NonNull<u8>> {
+        let index = self.stacks[..self.len]
+            .iter()
+            .rposition(|&(_, stack_size)| stack_size == size)?;
+        let (ptr, _) = self.stacks[index];
+        self.len -= 1;
+        self.stacks[index] = self.stacks[self.len];
+        NonNull::new(ptr as *mut u8)
+    }
+
+    /// Keeps a stack, returning `false` if the cache is full.
+    fn put(&mut self, ptr: NonNull<u8>, size: usize) -> bool {
+        if self.len == STACK_CACHE_SIZE {
+            return false;
+        }
+        self.stacks[self.len] = (ptr.as_ptr() as usize, size);
+        self.len += 1;
+        true
+    }
+}
+
 struct TaskStack {
     ptr: NonNull<u8>,
     layout: Layout,
@@ -465,20 +641,25 @@ struct TaskStack {
 impl TaskStack {
     pub fn alloc(size: usize) -> Self {
         let layout = Layout::from_size_align(size, 16).unwrap();
-        Self {
-            ptr: NonNull::new(unsafe { alloc::alloc::alloc(layout) }).unwrap(),
-            layout,
-        }
+        let ptr = StackCache::with(|cache| cache.take(size))
+            .unwrap_or_else(|| NonNull::new(unsafe { alloc::alloc::alloc(layout) }).unwrap());
+        Self { ptr, layout }
     }
 
     pub const fn top(&self) -> VirtAddr {
         unsafe { core::mem::transmute(self.ptr.as_ptr().add(self.layout.size())) }
     }
+
+    pub const fn bottom(&self) -> VirtAddr {
+        unsafe { core::mem::transmute(self.ptr.as_ptr()) }
+    }
 }
 
 impl Drop for TaskStack {
     fn drop(&mut self) {
-        unsafe { alloc::alloc::dealloc(self.ptr.as_ptr(), self.layout) }
+        if !StackCache::with(|cache| cache.put(self.ptr, self.layout.size())) {
+            unsafe { alloc::alloc::dealloc(self.ptr.as_ptr(), self.layout) }
+        }
     }
 }
 
@@ -128,3 +128,127 @@ fn test_task_join() {
         assert_eq!(tasks[i].join(), Some(i as _));
     }
 }
+
+#[test]
+fn test_sched_fair_nice() {
+    use std::sync::Arc;
+
+    use scheduler::BaseScheduler;
+
+    use crate::sched::SchedulerExt;
+    use crate::sched::fair::{FairScheduler, FairTask};
+
+    let mut sched = FairScheduler::new();
+    let tasks = [Arc::new(FairTask::new(0)), Arc::new(FairTask::new(1))];
+    assert!(sched.set_priority(&tasks[1], 5));
+    assert!(!sched.set_priority(&tasks[1], 20));
+    for task in &tasks {
+        sched.add_task(task.clone());
+    }
+
+    let mut ticks = [0usize; 2];
+    let mut curr = sched.pick_next_task().unwrap();
+    for _ in 0..10000 {
+        ticks[**curr] += 1;
+        if sched.task_tick(&curr) {
+            sched.put_prev_task(curr, true);
+            curr = sched.pick_next_task().unwrap();
+        }
+    }
+    // Nice 0 weighs 1024 and nice 5 weighs 335.
+    let ratio = ticks[0] as f64 / ticks[1] as f64;
+    println!("sched_fair: ticks = {:?}, ratio = {}", ticks, ratio);
+    assert!((ratio - 1024.0 / 335.0).abs() < 0.1);
+
+    // A task that slept preempts the one that kept running.
+    let sleeper = if **curr == 0 {
+        sched.remove_task(&tasks[1]).unwrap()
+    } else {
+        sched.remove_task(&tasks[0]).unwrap()
+    };
+    for _ in 0..100 {
+        sched.task_tick(&curr);
+    }
+    sched.put_prev_task(sleeper.clone(), false);
+    assert!(sched.wakeup_preempt(&curr, &sleeper));
+    assert!(!sched.wakeup_preempt(&sleeper, &curr));
+}
+
+#[test]
+fn test_sched_rt_priority() {
+    let _lock = SERIAL.lock();
+    INIT.call_once(axtask::init_scheduler);
+
+    static ORDER: Mutex<Vec<usize>> = Mutex::new(Vec::new());
+    static FINISHED_TASKS: AtomicUsize = AtomicUsize::new(0);
+
+    let policies = [
+        axtask::SchedPolicy::Normal,
+        axtask::SchedPolicy::Fifo(10),
+        axtask::SchedPolicy::RoundRobin(50),
+        axtask::SchedPolicy::Fifo(50),
+    ];
+    assert!(
+        !crate::TaskInner::new(|| {}, "".into(), 0x1000)
+            .set_sched_policy(axtask::SchedPolicy::Fifo(100))
+    );
+    for (i, policy) in policies.into_iter().enumerate() {
+        let task = crate::TaskInner::new(
+            move || {
+                ORDER.lock().unwrap().push(i);
+                FINISHED_TASKS.fetch_add(1, Ordering::Relaxed);
+            },
+            format!("T{}", i),
+            0x1000,
+        );
+        assert!(task.set_sched_policy(policy));
+        axtask::spawn_task(task);
+    }
+
+    while FINISHED_TASKS.load(Ordering::Relaxed) < policies.len() {
+        axtask::yield_now();
+    }
+    // Real-time tasks run first, by priority, then in FIFO order.
+    assert_eq!(*ORDER.lock().unwrap(), [2, 3, 1, 0]);
+}
+
+#[test]
+fn test_timer_wheel() {
+    use rand::{Rng, SeedableRng, rngs::StdRng};
+
+    use crate::timer_wheel::TimerWheel;
+
+    let mut rng = StdRng::seed_from_u64(0);
+    let mut wheel = TimerWheel::new();
+    let mut now = 1 << 40;
+    wheel.start(now);
+
+    // Deadlines from microseconds to hours away, a third of them cancelled.
+    let mut pending = Vec::new();
+    for id in 0..10000u64 {
+        let range = [1 << 14, 1 << 22, 1 << 32, 1 << 42][rng.gen_range(0..4)];
+        let deadline = now + rng.gen_range(0..range);
+        let handle = wheel.set(deadline, id);
+        if id % 3 == 0 {
+            assert_eq!(wheel.cancel(handle, |&event| event == id), Some(id));
+            assert_eq!(wheel.cancel(handle, |&event| event == id), None);
+        } else {
+            pending.push((deadline, id));
+        }
+    }
+    pending.sort();
+
+    let mut expired = Vec::new();
+    while let Some(next) = wheel.next_deadline() {
+        assert!(next <= pending[expired.len()].0);
+        now = now.max(next);
+        while let Some((deadline, id)) = wheel.expire_one(now) {
+            assert!(deadline <= now);
+            expired.push((deadline, id));
+        }
+        // Nothing due is left behind.
+        assert!(expired.len() == pending.len() || pending[expired.len()].0 > now);
+    }
+    expired.sort();
+    assert_eq!(expired, pending);
+}
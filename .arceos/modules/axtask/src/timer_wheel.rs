@@ -0,0 +1,301 @@
+//! A hierarchical timing wheel.
+//!
+//! Time is divided in units of 2^[`UNIT_SHIFT`] nanoseconds. Level 0 has a
+//! slot per unit for the events due in the next [`SLOTS`] units, and each
+//! level above has slots [`SLOTS`] times wider for the events further away.
+//! When the time reaches the start of a slot of a higher level, its events
+//! are cascaded down to the lower levels, so that they are sorted into the
+//! slot of their own unit by the time they are due.
+//!
+//! Events are kept in a slab and linked into the list of their slot, so both
+//! inserting and cancelling an event are O(1), and the events of a slot that
+//! is entirely past expire as a batch. Their exact deadlines are kept, so
+//! that they do not fire before them.
+
+use alloc::vec::Vec;
+
+/// The log2 of the unit of time of the wheel, about 65 microseconds.
+const UNIT_SHIFT: u32 = 16;
+/// The log2 of the number of slots of each level.
+const SLOT_SHIFT: u32 = 6;
+const SLOTS: usize = 1 << SLOT_SHIFT;
+const SLOT_MASK: u64 = SLOTS as u64 - 1;
+/// The number of levels, which cover about 52 days. Events further away are
+/// kept in the last slot and cascaded until they come in range.
+const LEVELS: usize = 6;
+/// The list of the events that expired but were not taken yet.
+const EXPIRED: usize = LEVELS * SLOTS;
+const NIL: u32 = u32::MAX;
+
+/// The handle of an event in a [`TimerWheel`], to cancel it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct TimerHandle(pub(crate) u32);
+
+struct Entry<E> {
+    deadline: u64,
+    /// The event, or `None` if the entry is free.
+    event: Option<E>,
+    /// The list the entry is in, or the next free entry.
+    list: usize,
+    prev: u32,
+    next: u32,
+}
+
+/// A hierarchical timing wheel of events of type `E`, whose deadlines are in
+/// nanoseconds, see the [module documentation](self).
+pub struct TimerWheel<E> {
+    entries: Vec<Entry<E>>,
+    /// The first entry of each list, the slots of each level then
+    /// [`EXPIRED`].
+    heads: [u32; LEVELS * SLOTS + 1],
+    /// The slots of each level that are not empty.
+    occupied: [u64; LEVELS],
+    /// The first free entry.
+    free: u32,
+    /// The current time, in units.
+    now: u64,
+}
+
+impl<E> TimerWheel<E> {
+    /// Creates an empty timing wheel.
+    pub const fn new() -> Self {
+        Self {
+            entries: Vec::new(),
+            heads: [NIL; LEVELS * SLOTS + 1],
+            occupied: [0; LEVELS],
+            free: NIL,
+            now: 0,
+        }
+    }
+
+    /// Sets the current time of an empty wheel, so that it does not have to
+    /// catch up from 0 on the first expiry.
+    pub fn start(&mut self, now_ns: u64) {
+        debug_assert!(self.occupied.iter().all(|&bits| bits == 0));
+        self.now = now_ns >> UNIT_SHIFT;
+    }
+
+    /// Adds `event` to fire at `deadline_ns`.
+    pub fn set(&mut self, deadline_ns: u64, event: E) -> TimerHandle {
+        let index = match self.free {
+            NIL => {
+                self.entries.push(Entry {
+                    deadline: deadline_ns,
+                    event: Some(event),
+                    list: 0,
+                    prev: NIL,
+                    next: NIL,
+                });
+                self.entries.len() as u32 - 1
+            }
+            index => {
+                let entry = &mut self.entries[index as usize];
+                self.free = entry.list as u32;
+                entry.deadline = deadline_ns;
+                entry.event = Some(event);
+                index
+            }
+        };
+        self.link(index, self.slot_of(deadline_ns));
+        TimerHandle(index)
+    }
+
+    /// Cancels the event of `handle` if it is still pending and `condition`
+    /// holds for it, returning it.
+    pub fn cancel<F>(&mut self, handle: TimerHandle, condition: F) -> Option<E>
+    where
+        F: FnOnce(&E) -> bool,
+    {
+        let entry = self.entries.get(handle.0 as usize)?;
+        if !entry.event.as_ref().is_some_and(condition) {
+            return None;
+        }
+        Some(self.remove(handle.0).1)
+    }
+
+    /// Returns the earliest deadline the wheel needs to be expired at, which
+    /// is the one of the next event, or earlier if events have to be
+    /// cascaded before.
+    pub fn next_deadline(&self) -> Option<u64> {
+        if self.heads[EXPIRED] != NIL {
+            return Some(self.now << UNIT_SHIFT);
+        }
+        let cascade = self.next_cascade().map(|unit| unit << UNIT_SHIFT);
+        match next_occupied(self.occupied[0], self.now, true) {
+            Some(distance) => {
+                let slot = ((self.now + distance) & SLOT_MASK) as usize;
+                let list = self.list(slot);
+                let next = list
+                    .map(|index| self.entries[index as usize].deadline)
+                    .min();
+                next.min(cascade).or(next)
+            }
+            None => cascade,
+        }
+    }
+
+    /// Returns the earliest time, in units, at which an occupied slot above
+    /// level 0 has to be cascaded.
+    fn next_cascade(&self) -> Option<u64> {
+        (1..LEVELS)
+            .filter_map(|level| {
+                let shift = level as u32 * SLOT_SHIFT;
+                let distance = next_occupied(self.occupied[level], self.now >> shift, false)?;
+                Some(((self.now >> shift) + distance) << shift)
+            })
+            .min()
+    }
+
+    /// Takes an event whose deadline is not after `now_ns`, with its
+    /// deadline, advancing the wheel to `now_ns` first.
+    pub fn expire_one(&mut self, now_ns: u64) -> Option<(u64, E)> {
+        if self.heads[EXPIRED] == NIL {
+            self.advance(now_ns);
+        }
+        match self.heads[EXPIRED] {
+            NIL => None,
+            index => Some(self.remove(index)),
+        }
+    }
+
+    /// Advances the wheel to `now_ns`, moving the events due to the
+    /// [`EXPIRED`] list.
+    fn advance(&mut self, now_ns: u64) {
+        let target = now_ns >> UNIT_SHIFT;
+        while self.now < target {
+            // The current slot is entirely past.
+            self.splice_expired((self.now & SLOT_MASK) as usize);
+            // Skip to the next slot to expire or cascade.
+            let next_slot = next_occupied(self.occupied[0], self.now, false)
+                .map(|distance| self.now + distance);
+            let next = match (next_slot, self.next_cascade()) {
+                (Some(slot), Some(cascade)) => slot.min(cascade),
+                (next, cascade) => next.or(cascade).unwrap_or(target),
+            };
+            self.now = next.min(target);
+            if self.now & SLOT_MASK == 0 {
+                self.cascade();
+            }
+        }
+        // The current slot is partially past.
+        let slot = (self.now & SLOT_MASK) as usize;
+        let mut index = self.heads[slot];
+        while index != NIL {
+            let entry = &self.entries[index as usize];
+            let next = entry.next;
+            if entry.deadline <= now_ns {
+                self.unlink(index);
+                self.link(index, EXPIRED);
+            }
+            index = next;
+        }
+    }
+
+    /// Cascades the slots starting at the current time down to the lower
+    /// levels, from the highest one.
+    fn cascade(&mut self) {
+        for level in (1..LEVELS).rev() {
+            let shift = level as u32 * SLOT_SHIFT;
+            if self.now & ((1 << shift) - 1) != 0 {
+                continue;
+            }
+            let slot = level * SLOTS + ((self.now >> shift) & SLOT_MASK) as usize;
+            while self.heads[slot] != NIL {
+                let index = self.heads[slot];
+                self.unlink(index);
+                let deadline = self.entries[index as usize].deadline;
+                self.link(index, self.slot_of(deadline));
+            }
+        }
+    }
+
+    /// Returns the list of the slot for an event at `deadline_ns`.
+    fn slot_of(&self, deadline_ns: u64) -> usize {
+        let unit = (deadline_ns >> UNIT_SHIFT).max(self.now);
+        let mut delta = unit - self.now;
+        for level in 0..LEVELS {
+            let shift = level as u32 * SLOT_SHIFT;
+            if delta < (SLOTS as u64) << shift || level == LEVELS - 1 {
+                let max_delta = ((SLOTS as u64) << shift) - 1;
+                delta = delta.min(max_delta);
+                return level * SLOTS + (((self.now + delta) >> shift) & SLOT_MASK) as usize;
+            }
+        }
+        unreachable!()
+    }
+
+    fn list(&self, list: usize) -> impl Iterator<Item = u32> + '_ {
+        let mut index = self.heads[list];
+        core::iter::from_fn(move || {
+            let current = index;
+            if current == NIL {
+                return None;
+            }
+            index = self.entries[current as usize].next;
+            Some(current)
+        })
+    }
+
+    /// Moves all the events of a level 0 slot to the [`EXPIRED`] list.
+    fn splice_expired(&mut self, slot: usize) {
+        while self.heads[slot] != NIL {
+            let index = self.heads[slot];
+            self.unlink(index);
+            self.link(index, EXPIRED);
+        }
+    }
+
+    fn link(&mut self, index: u32, list: usize) {
+        let head = self.heads[list];
+        if head != NIL {
+            self.entries[head as usize].prev = index;
+        }
+        let entry = &mut self.entries[index as usize];
+        entry.list = list;
+        entry.prev = NIL;
+        entry.next = head;
+        self.heads[list] = index;
+        if list != EXPIRED {
+            self.occupied[list / SLOTS] |= 1 << (list % SLOTS);
+        }
+    }
+
+    fn unlink(&mut self, index: u32) {
+        let Entry {
+            list, prev, next, ..
+        } = self.entries[index as usize];
+        if prev == NIL {
+            self.heads[list] = next;
+        } else {
+            self.entries[prev as usize].next = next;
+        }
+        if next != NIL {
+            self.entries[next as usize].prev = prev;
+        }
+        if list != EXPIRED && self.heads[list] == NIL {
+            self.occupied[list / SLOTS] &= !(1 << (list % SLOTS));
+        }
+    }
+
+    /// Unlinks an entry and frees it, returning its deadline and event.
+    fn remove(&mut self, index: u32) -> (u64, E) {
+        self.unlink(index);
+        let entry = &mut self.entries[index as usize];
+        let event = entry.event.take().unwrap();
+        entry.list = self.free as usize;
+        self.free = index;
+        (entry.deadline, event)
+    }
+}
+
+/// Returns the distance from the slot of `now` to the next occupied slot in
+/// `occupied`, from 0 if `inclusive`, or else from 1 to [`SLOTS`] (the slot
+/// of `now` itself, one round later).
+fn next_occupied(occupied: u64, now: u64, inclusive: bool) -> Option<u64> {
+    if occupied == 0 {
+        return None;
+    }
+    let start = (now + !inclusive as u64) & SLOT_MASK;
+    let distance = occupied.rotate_right(start as u32).trailing_zeros() as u64;
+    Some(distance + !inclusive as u64)
+}
@@ -1,17 +1,65 @@
-use core::sync::atomic::{AtomicU64, Ordering};
+//! Timer events and the programming of the timer of each CPU.
+//!
+//! The timer of a CPU is not periodic, but programmed for the earliest of the
+//! next scheduler tick and the next timer event, so that events fire at the
+//! resolution of the hardware timer rather than of the tick. An idle CPU also
+//! skips ticks, more and more of them up to [`MAX_IDLE_TICKS`] as it stays
+//! idle, and resumes ticking as soon as it runs a task.
+//!
+//! The events of each CPU are kept in a [`TimerWheel`], so that the many
+//! timeouts that are set and cancelled before they expire cost O(1) each.
 
-use kernel_guard::NoOp;
-use lazyinit::LazyInit;
-use timer_list::{TimeValue, TimerEvent, TimerList};
+use alloc::boxed::Box;
+use core::sync::atomic::{AtomicU64, Ordering};
 
-use axhal::time::wall_time;
+use axhal::cpu::this_cpu_id;
+use axhal::time::{NANOS_PER_SEC, TimeValue, epochoffset_nanos, monotonic_time_nanos, wall_time};
+use kernel_guard::{IrqSave, NoOp};
+use kspin::SpinNoIrq;
 
+use crate::timer_wheel::{TimerHandle, TimerWheel};
 use crate::{AxTaskRef, select_run_queue};
 
+/// The interval between two scheduler ticks, in nanoseconds.
+pub(crate) const TICK_NANOS: u64 = NANOS_PER_SEC / axconfig::TICKS_PER_SEC as u64;
+/// The maximum number of tick intervals an idle CPU sleeps for.
+///
+/// On platforms without inter-processor interrupts, this also bounds how long
+/// a task queued on an idle CPU by another one waits until it runs.
+const MAX_IDLE_TICKS: u64 = 8;
+/// The minimum delay the timer is programmed for, so that the deadline is not
+/// already past once it is set.
+const MIN_DELAY_NANOS: u64 = 1_000;
+
 static TIMER_TICKET_ID: AtomicU64 = AtomicU64::new(1);
 
+/// The timer events of each CPU. Those of a task are cancelled by the task
+/// itself, which may have migrated to another CPU since.
+static TIMER_WHEELS: [SpinNoIrq<TimerWheel<AlarmEvent>>; axconfig::SMP] =
+    [const { SpinNoIrq::new(TimerWheel::new()) }; axconfig::SMP];
+
 percpu_static! {
-    TIMER_LIST: LazyInit<TimerList<TaskWakeupEvent>> = LazyInit::new(),
+    /// The monotonic time of the next scheduler tick, in nanoseconds.
+    NEXT_TICK: u64 = 0,
+    /// The monotonic time the timer is programmed for, in nanoseconds.
+    TIMER_DEADLINE: u64 = 0,
+    /// The number of tick intervals the CPU sleeps for while idle, or 0 if it
+    /// is not idle.
+    IDLE_TICKS: u64 = 0,
+}
+
+enum AlarmEvent {
+    Wakeup(TaskWakeupEvent),
+    Callback(Box<dyn FnOnce(TimeValue) + Send>),
+}
+
+impl AlarmEvent {
+    fn callback(self, now: TimeValue) {
+        match self {
+            Self::Wakeup(event) => event.callback(now),
+            Self::Callback(callback) => callback(now),
+        }
+    }
 }
 
 struct TaskWakeupEvent {
@@ -19,7 +67,7 @@ struct TaskWakeupEvent {
     task: AxTaskRef,
 }
 
-impl TimerEvent for TaskWakeupEvent {
+impl TaskWakeupEvent {
     fn callback(self, _now: TimeValue) {
         // Ignore the timer event if timeout was set but not triggered
         // (wake up by `WaitQueue::notify()`).
@@ -36,31 +84,150 @@ impl TimerEvent for TaskWakeupEvent {
 }
 
 pub fn set_alarm_wakeup(deadline: TimeValue, task: AxTaskRef) {
-    TIMER_LIST.with_current(|timer_list| {
-        let ticket_id = TIMER_TICKET_ID.fetch_add(1, Ordering::AcqRel);
-        task.set_timer_ticket(ticket_id);
-        timer_list.set(deadline, TaskWakeupEvent { ticket_id, task });
-    })
+    let _guard = IrqSave::new();
+    let cpu_id = this_cpu_id();
+    let ticket_id = TIMER_TICKET_ID.fetch_add(1, Ordering::AcqRel);
+    task.set_timer_ticket(ticket_id);
+    let event = AlarmEvent::Wakeup(TaskWakeupEvent {
+        ticket_id,
+        task: task.clone(),
+    });
+    let handle = TIMER_WHEELS[cpu_id]
+        .lock()
+        .set(to_monotonic_nanos(deadline), event);
+    task.set_timer_handle(cpu_id, handle);
+    advance_timer(deadline);
+}
+
+/// Cancels the wakeup event of `task` set by [`set_alarm_wakeup`], if it has
+/// not fired yet.
+pub fn cancel_alarm_wakeup(task: &AxTaskRef) {
+    let ticket_id = task.timer_ticket();
+    // Expire the ticket first, so that the event is ignored if it fires on
+    // its CPU meanwhile.
+    task.timer_ticket_expired();
+    if ticket_id == 0 {
+        return;
+    }
+    let (cpu_id, handle) = task.timer_handle();
+    let _event = TIMER_WHEELS[cpu_id].lock().cancel(
+        handle,
+        |event| matches!(event, AlarmEvent::Wakeup(wakeup) if wakeup.ticket_id == ticket_id),
+    );
+}
+
+pub fn set_alarm_callback<F>(deadline: TimeValue, callback: F)
+where
+    F: FnOnce(TimeValue) + Send + 'static,
+{
+    let _guard = IrqSave::new();
+    let event = AlarmEvent::Callback(Box::new(callback));
+    TIMER_WHEELS[this_cpu_id()]
+        .lock()
+        .set(to_monotonic_nanos(deadline), event);
+    advance_timer(deadline);
 }
 
 pub fn check_events() {
+    let wheel = &TIMER_WHEELS[this_cpu_id()];
     loop {
-        let now = wall_time();
-        let event = unsafe {
-            // Safety: IRQs are disabled at this time.
-            TIMER_LIST.current_ref_mut_raw()
-        }
-        .expire_one(now);
+        let now_ns = monotonic_time_nanos();
+        // Take the event out before firing it, which may set other ones.
+        let event = wheel.lock().expire_one(now_ns);
         if let Some((_deadline, event)) = event {
-            event.callback(now);
+            event.callback(wall_time());
         } else {
             break;
         }
     }
 }
 
+/// Converts the wall time `deadline` of a timer event to a monotonic time in
+/// nanoseconds.
+fn to_monotonic_nanos(deadline: TimeValue) -> u64 {
+    (deadline.as_nanos() as u64).saturating_sub(epochoffset_nanos())
+}
+
+/// Programs the timer for `deadline_ns`, or soon after if it is already past.
+///
+/// IRQs must be disabled.
+fn set_timer(deadline_ns: u64) {
+    let deadline_ns = deadline_ns.max(monotonic_time_nanos() + MIN_DELAY_NANOS);
+    unsafe { TIMER_DEADLINE.write_current_raw(deadline_ns) };
+    axhal::time::set_oneshot_timer(deadline_ns);
+}
+
+/// Reprograms the timer for a new event at `deadline` if it comes before the
+/// deadline the timer is programmed for.
+///
+/// IRQs must be disabled.
+fn advance_timer(deadline: TimeValue) {
+    let deadline_ns = to_monotonic_nanos(deadline);
+    if deadline_ns < unsafe { TIMER_DEADLINE.read_current_raw() } {
+        set_timer(deadline_ns);
+    }
+}
+
+/// Returns whether a scheduler tick is due at `now_ns`, and if so, schedules
+/// the next one. Ticks missed while idle are not made up for.
+///
+/// IRQs must be disabled.
+pub fn tick_due(now_ns: u64) -> bool {
+    let next_tick = unsafe { NEXT_TICK.read_current_raw() };
+    if now_ns < next_tick {
+        return false;
+    }
+    let mut next_tick = next_tick + TICK_NANOS;
+    if next_tick <= now_ns {
+        next_tick = now_ns + TICK_NANOS;
+    }
+    unsafe { NEXT_TICK.write_current_raw(next_tick) };
+    true
+}
+
+/// Programs the timer for the next tick, or the end of the idle sleep, or the
+/// next timer event, whichever comes first.
+///
+/// IRQs must be disabled.
+pub fn program_timer() {
+    let idle_ticks = unsafe { IDLE_TICKS.read_current_raw() };
+    let mut deadline_ns =
+        unsafe { NEXT_TICK.read_current_raw() } + idle_ticks.saturating_sub(1) * TICK_NANOS;
+    if let Some(event) = TIMER_WHEELS[this_cpu_id()].lock().next_deadline() {
+        deadline_ns = deadline_ns.min(event);
+    }
+    set_timer(deadline_ns);
+}
+
+/// Called by the idle task before it waits for IRQs. If `skip_ticks`, doubles
+/// the time the CPU sleeps for, up to [`MAX_IDLE_TICKS`] ticks, otherwise it
+/// keeps ticking.
+pub fn enter_idle(skip_ticks: bool) {
+    let _guard = IrqSave::new();
+    let idle_ticks = unsafe { IDLE_TICKS.read_current_raw() };
+    let idle_ticks = if skip_ticks {
+        (idle_ticks * 2).clamp(1, MAX_IDLE_TICKS)
+    } else {
+        1
+    };
+    unsafe { IDLE_TICKS.write_current_raw(idle_ticks) };
+    program_timer();
+}
+
+/// Called when the CPU switches from the idle task to another one, resumes
+/// the ticks.
+///
+/// IRQs must be disabled.
+pub fn exit_idle() {
+    if unsafe { IDLE_TICKS.read_current_raw() } == 0 {
+        return;
+    }
+    unsafe { IDLE_TICKS.write_current_raw(0) };
+    program_timer();
+}
+
 pub fn init() {
-    TIMER_LIST.with_current(|timer_list| {
-        timer_list.init_once(TimerList::new());
-    });
+    TIMER_WHEELS[this_cpu_id()]
+        .lock()
+        .start(monotonic_time_nanos());
 }
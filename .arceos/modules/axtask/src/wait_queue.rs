@@ -62,15 +62,11 @@ impl WaitQueue {
         }
 
         // Try to cancel a timer event from timer lists.
-        // Just mark task's current timer ticket ID as expired.
+        // The task's current timer ticket ID is also marked as expired, in
+        // case the event is firing on another CPU meanwhile.
         #[cfg(feature = "irq")]
         if _from_timer_list {
-            curr.timer_ticket_expired();
-            // Note:
-            //  this task is still not removed from timer list of target CPU,
-            //  which may cause some redundant timer events because it still needs to
-            //  go through the process of expiring an event from the timer list and invoking the callback.
-            //  (it can be considered a lazy-removal strategy, it will be ignored when it is about to take effect.)
+            crate::timers::cancel_alarm_wakeup(curr.as_task_ref());
         }
     }
 
@@ -179,6 +175,29 @@ impl WaitQueue {
         }
     }
 
+    /// Wakes up the first task in the wait queue like [`notify_one`], after
+    /// calling `f` with it while the queue is still locked.
+    ///
+    /// A task in [`wait_until`] checks its condition with the queue locked, so
+    /// it will see whatever `f` did when it wakes up, e.g. that a lock was
+    /// handed over to it.
+    ///
+    /// [`notify_one`]: WaitQueue::notify_one
+    /// [`wait_until`]: WaitQueue::wait_until
+    pub fn notify_one_with<F>(&self, resched: bool, f: F) -> bool
+    where
+        F: FnOnce(&AxTaskRef),
+    {
+        let mut wq = self.queue.lock();
+        if let Some(task) = wq.pop_front() {
+            f(&task);
+            unblock_one_task(task, resched);
+            true
+        } else {
+            false
+        }
+    }
+
     /// Wakes all tasks in the wait queue.
     ///
     /// If `resched` is true, the current task will be preempted when the
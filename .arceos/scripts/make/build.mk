@@ -32,6 +32,10 @@ else ifeq ($(filter $(MAKECMDGOALS),defconfig oldconfig clippy),)
     $(if $(V), $(info CFLAGS: "$(CFLAGS)") $(info LDFLAGS: "$(LDFLAGS)"))
   else ifeq ($(APP_TYPE), rust)
     RUSTFLAGS += $(RUSTFLAGS_LINK_ARGS)
+    # The sampling profiler walks kernel stacks by their frame pointers.
+    ifneq ($(filter profile,$(APP_FEAT)),)
+      RUSTFLAGS += -C force-frame-pointers=yes
+    endif
   endif
   $(if $(V), $(info RUSTFLAGS: "$(RUSTFLAGS)"))
   export RUSTFLAGS
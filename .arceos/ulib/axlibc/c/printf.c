@@ -79,6 +79,12 @@
 #define PRINTF_DECIMAL_BUFFER_SIZE 32
 #endif
 
+// size of the chunk in which output for a span function is collected, so that
+// it is called once per chunk rather than once per character
+#ifndef PRINTF_CHUNK_SIZE
+#define PRINTF_CHUNK_SIZE 128
+#endif
+
 // Support for the decimal notation floating point conversion specifiers (%f, %F)
 #ifndef PRINTF_SUPPORT_DECIMAL_SPECIFIERS
 #define PRINTF_SUPPORT_DECIMAL_SPECIFIERS 1
@@ -308,16 +314,29 @@ static inline int get_exp2(double_with_bit_access x)
 // 1. max_chars is 0
 // 2. buffer is non-null
 // 3. function is non-null
+// 4. span_function is non-null
 //
 // ... otherwise bad things will happen.
 typedef struct {
     void (*function)(char c, void *extra_arg);
+    void (*span_function)(const char *s, size_t len, void *extra_arg);
     void *extra_function_arg;
     char *buffer;
     printf_size_t pos;
     printf_size_t max_chars;
+    printf_size_t chunk_len;
+    char chunk[PRINTF_CHUNK_SIZE];
 } output_gadget_t;
 
+// Pass the characters collected for the span function on to it
+static inline void flush_chunk_of_gadget(output_gadget_t *gadget)
+{
+    if (gadget->span_function != NULL && gadget->chunk_len) {
+        gadget->span_function(gadget->chunk, gadget->chunk_len, gadget->extra_function_arg);
+        gadget->chunk_len = 0;
+    }
+}
+
 // Note: This function currently assumes it is not passed a '\0' c,
 // or alternatively, that '\0' can be passed to the function in the output
 // gadget. The former assumption holds within the printf library. It also
@@ -330,7 +349,12 @@ static inline void putchar_via_gadget(output_gadget_t *gadget, char c)
     if (write_pos >= gadget->max_chars) {
         return;
     }
-    if (gadget->function != NULL) {
+    if (gadget->span_function != NULL) {
+        gadget->chunk[gadget->chunk_len++] = c;
+        if (gadget->chunk_len == PRINTF_CHUNK_SIZE) {
+            flush_chunk_of_gadget(gadget);
+        }
+    } else if (gadget->function != NULL) {
         // No check for c == '\0' .
         gadget->function(c, gadget->extra_function_arg);
     } else {
@@ -343,7 +367,7 @@ static inline void putchar_via_gadget(output_gadget_t *gadget, char c)
 // Possibly-write the string-terminating '\0' character
 static inline void append_termination_with_gadget(output_gadget_t *gadget)
 {
-    if (gadget->function != NULL || gadget->max_chars == 0) {
+    if (gadget->function != NULL || gadget->span_function != NULL || gadget->max_chars == 0) {
         return;
     }
     if (gadget->buffer == NULL) {
@@ -366,10 +390,12 @@ static inline output_gadget_t discarding_gadget(void)
 {
     output_gadget_t gadget;
     gadget.function = NULL;
+    gadget.span_function = NULL;
     gadget.extra_function_arg = NULL;
     gadget.buffer = NULL;
     gadget.pos = 0;
     gadget.max_chars = 0;
+    gadget.chunk_len = 0;
     return gadget;
 }
 
@@ -395,6 +421,16 @@ static inline output_gadget_t function_gadget(void (*function)(char, void *), vo
     return result;
 }
 
+static inline output_gadget_t span_function_gadget(void (*function)(const char *, size_t, void *),
+                                                   void *extra_arg)
+{
+    output_gadget_t result = discarding_gadget();
+    result.span_function = function;
+    result.extra_function_arg = extra_arg;
+    result.max_chars = PRINTF_MAX_POSSIBLE_BUFFER_SIZE;
+    return result;
+}
+
 // static inline output_gadget_t extern_putchar_gadget(void)
 // {
 //     return function_gadget(putchar_wrapper, NULL);
@@ -525,6 +561,34 @@ static void print_integer_finalization(output_gadget_t *output, char *buf, print
     out_rev_(output, buf, len, width, flags);
 }
 
+// The two decimal digits of each number below 100
+static const char decimal_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Append the decimal digits of value to buf in reverse, two digits at a time to halve
+// the divisions, and return the new length. At least one digit is written.
+static printf_size_t put_decimal_reversed(char *buf, printf_size_t len, printf_size_t max_len,
+                                          printf_unsigned_value_t value)
+{
+    while (value >= 100U && len + 2U <= max_len) {
+        const char *pair = &decimal_digit_pairs[(value % 100U) * 2U];
+        value /= 100U;
+        buf[len++] = pair[1];
+        buf[len++] = pair[0];
+    }
+    if (len < max_len) {
+        buf[len++] = (char)('0' + value % 10U);
+    }
+    if (value >= 10U && len < max_len) {
+        buf[len++] = (char)('0' + value / 10U);
+    }
+    return len;
+}
+
 // An internal itoa-like function
 static void print_integer(output_gadget_t *output, printf_unsigned_value_t value, bool negative,
                           numeric_base_t base, printf_size_t precision, printf_size_t width,
@@ -545,12 +609,15 @@ static void print_integer(output_gadget_t *output, printf_unsigned_value_t value
             // We drop this flag this since either the alternative and regular modes of the
             // specifier don't differ on 0 values
         }
+    } else if (base == BASE_DECIMAL) {
+        len = put_decimal_reversed(buf, len, PRINTF_INTEGER_BUFFER_SIZE, value);
     } else {
+        // The other bases are powers of two, so shifts and masks do.
+        const unsigned int shift = base == BASE_HEX ? 4U : base == BASE_OCTAL ? 3U : 1U;
+        const char *digits = flags & FLAGS_UPPERCASE ? "0123456789ABCDEF" : "0123456789abcdef";
         do {
-            const char digit = (char)(value % base);
-            buf[len++] = (char)(digit < 10 ? '0' + digit
-                                           : (flags & FLAGS_UPPERCASE ? 'A' : 'a') + digit - 10);
-            value /= base;
+            buf[len++] = digits[value & (base - 1U)];
+            value >>= shift;
         } while (value && (len < PRINTF_INTEGER_BUFFER_SIZE));
     }
 
@@ -734,13 +801,10 @@ static void print_broken_up_decimal(struct double_components number_, output_gad
         }
 
         if (number_.fractional > 0 || !(flags & FLAGS_ADAPT_EXP) || (flags & FLAGS_HASH)) {
-            while (len < PRINTF_DECIMAL_BUFFER_SIZE) {
-                --count;
-                buf[len++] = (char)('0' + number_.fractional % 10U);
-                if (!(number_.fractional /= 10U)) {
-                    break;
-                }
-            }
+            const printf_size_t start = len;
+            len = put_decimal_reversed(buf, len, PRINTF_DECIMAL_BUFFER_SIZE,
+                                       (printf_unsigned_value_t)number_.fractional);
+            count -= len - start;
             // add extra 0s
             while ((len < PRINTF_DECIMAL_BUFFER_SIZE) && (count > 0U)) {
                 buf[len++] = '0';
@@ -758,11 +822,9 @@ static void print_broken_up_decimal(struct double_components number_, output_gad
 
     // Write the integer part of the number (it comes after the fractional
     // since the character order is reversed)
-    while (len < PRINTF_DECIMAL_BUFFER_SIZE) {
-        buf[len++] = (char)('0' + (number_.integral % 10));
-        if (!(number_.integral /= 10)) {
-            break;
-        }
+    if (len < PRINTF_DECIMAL_BUFFER_SIZE) {
+        len = put_decimal_reversed(buf, len, PRINTF_DECIMAL_BUFFER_SIZE,
+                                   (printf_unsigned_value_t)number_.integral);
     }
 
     // pad leading zeros
@@ -1411,6 +1473,7 @@ static int vsnprintf_impl(output_gadget_t *output, const char *format, va_list a
     // Note: The library only calls vsnprintf_impl() with output->pos being 0. However, it is
     // possible to call this function with a non-zero pos value for some "remedial printing".
     format_string_loop(output, format, args);
+    flush_chunk_of_gadget(output);
 
     // termination
     append_termination_with_gadget(output);
@@ -1445,6 +1508,13 @@ int vfctprintf(void (*out)(char c, void *extra_arg), void *extra_arg, const char
     return vsnprintf_impl(&gadget, format, arg);
 }
 
+int vspanprintf(void (*out)(const char *s, size_t len, void *extra_arg), void *extra_arg,
+                const char *format, va_list arg)
+{
+    output_gadget_t gadget = span_function_gadget(out, extra_arg);
+    return vsnprintf_impl(&gadget, format, arg);
+}
+
 // int printf_(const char *format, ...)
 // {
 //     va_list args;
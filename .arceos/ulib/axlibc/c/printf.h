@@ -190,6 +190,24 @@ PRINTF_VISIBILITY
 int vfctprintf(void (*out)(char c, void *extra_arg), void *extra_arg, const char *format,
                va_list arg) ATTR_VPRINTF(3);
 
+/**
+ * vfctprintf with an output function which takes spans of characters
+ *
+ * The output is collected in a small buffer, and the output function is called with each full
+ * buffer and with the rest at the end, rather than once per character.
+ *
+ * @param out An output function which takes a span of characters, its length and a type-erased
+ * additional parameter
+ * @param extra_arg The type-erased argument to pass to the output function @p out with each call
+ * @param format A string specifying the format of the output, with %-marked specifiers of how to
+ * interpret additional arguments.
+ * @param arg Additional arguments to the function, one for each specifier in @p format
+ * @return The number of characters passed to the output function
+ */
+PRINTF_VISIBILITY
+int vspanprintf(void (*out)(const char *s, size_t len, void *extra_arg), void *extra_arg,
+                const char *format, va_list arg) ATTR_VPRINTF(3);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
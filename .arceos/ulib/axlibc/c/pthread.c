@@ -32,13 +32,6 @@ int pthread_cancel(pthread_t t)
     return 0;
 }
 
-// TODO
-int pthread_mutex_trylock(pthread_mutex_t *m)
-{
-    unimplemented();
-    return 0;
-}
-
 // TODO
 int pthread_setname_np(pthread_t thread, const char *name)
 {
@@ -57,24 +50,113 @@ int pthread_cond_init(pthread_cond_t *restrict c, const pthread_condattr_t *rest
     return 0;
 }
 
-// TODO
-int pthread_cond_signal(pthread_cond_t *__cond)
+// Blocking paths of condition variables and rwlocks, whose fast paths stay in user code
+int ax_futex_wait(volatile int *addr, int val);
+int ax_futex_wake(volatile int *addr);
+
+int pthread_cond_destroy(pthread_cond_t *c)
 {
-    unimplemented();
     return 0;
 }
 
-// TODO
-int pthread_cond_wait(pthread_cond_t *__restrict__ __cond, pthread_mutex_t *__restrict__ __mutex)
+int pthread_cond_wait(pthread_cond_t *restrict c, pthread_mutex_t *restrict m)
 {
-    unimplemented();
+    // Any signal after the mutex is unlocked changes the sequence, so it is never missed.
+    int seq = __atomic_load_n(&c->_c_seq, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&c->_c_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(m);
+    ax_futex_wait(&c->_c_seq, seq);
+    __atomic_fetch_sub(&c->_c_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(m);
     return 0;
 }
 
-// TODO
 int pthread_cond_broadcast(pthread_cond_t *c)
 {
-    unimplemented();
+    // Without waiters, signaling is just a load.
+    if (__atomic_load_n(&c->_c_waiters, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&c->_c_seq, 1, __ATOMIC_SEQ_CST);
+        ax_futex_wake(&c->_c_seq);
+    }
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    // All the waiters are woken, as spurious wakeups are allowed.
+    return pthread_cond_broadcast(c);
+}
+
+// `_rw_lock` is the number of readers, or this while a writer holds the lock.
+#define RW_WRITER INT_MAX
+
+int pthread_rwlock_init(pthread_rwlock_t *restrict rw, const pthread_rwlockattr_t *restrict a)
+{
+    *rw = (pthread_rwlock_t){0};
+    return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rw)
+{
+    return 0;
+}
+
+// Waits for the lock to change from `state`, which the last try to take it saw.
+static void rwlock_wait(pthread_rwlock_t *rw, int state)
+{
+    __atomic_fetch_add(&rw->_rw_waiters, 1, __ATOMIC_SEQ_CST);
+    ax_futex_wait(&rw->_rw_lock, state);
+    __atomic_fetch_sub(&rw->_rw_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rw)
+{
+    int state = __atomic_load_n(&rw->_rw_lock, __ATOMIC_RELAXED);
+    while (state < RW_WRITER - 1) {
+        if (__atomic_compare_exchange_n(&rw->_rw_lock, &state, state + 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            return 0;
+    }
+    return EBUSY;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rw)
+{
+    while (pthread_rwlock_tryrdlock(rw)) rwlock_wait(rw, RW_WRITER);
+    return 0;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rw)
+{
+    int state = 0;
+    if (__atomic_compare_exchange_n(&rw->_rw_lock, &state, RW_WRITER, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED))
+        return 0;
+    return EBUSY;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rw)
+{
+    int state = 0;
+    while (!__atomic_compare_exchange_n(&rw->_rw_lock, &state, RW_WRITER, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        rwlock_wait(rw, state);
+        state = 0;
+    }
+    return 0;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rw)
+{
+    int state = __atomic_load_n(&rw->_rw_lock, __ATOMIC_RELAXED);
+    int next;
+    do {
+        next = state == RW_WRITER ? 0 : state - 1;
+    } while (!__atomic_compare_exchange_n(&rw->_rw_lock, &state, next, 0, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+    // Waiters only need waking once the lock is free.
+    if (!next && __atomic_load_n(&rw->_rw_waiters, __ATOMIC_SEQ_CST))
+        ax_futex_wake(&rw->_rw_lock);
     return 0;
 }
 
@@ -11,66 +11,105 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-// LOCK used by `puts()`
+// LOCK of all the streams
 #ifdef AX_CONFIG_MULTITASK
 #include <pthread.h>
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#define FLOCK()   pthread_mutex_lock(&lock)
+#define FUNLOCK() pthread_mutex_unlock(&lock)
+#else
+#define FLOCK()
+#define FUNLOCK()
 #endif
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-FILE __stdin_FILE = {.fd = 0, .buffer_len = 0};
+#define STD_FILE(name, fd_, mode_)                                                   \
+    FILE name = {.fd = fd_, .mode = mode_, .buf = name.inline_buf, .buf_size = BUFSIZ}
 
-FILE __stdout_FILE = {.fd = 1, .buffer_len = 0};
-
-FILE __stderr_FILE = {.fd = 2, .buffer_len = 0};
+STD_FILE(__stdin_FILE, 0, -1);
+STD_FILE(__stdout_FILE, 1, -1);
+STD_FILE(__stderr_FILE, 2, _IONBF);
 
 FILE *const stdin = &__stdin_FILE;
 FILE *const stdout = &__stdout_FILE;
 FILE *const stderr = &__stderr_FILE;
 
-// Returns: number of chars written, negative for failure
-// Warn: buffer_len[f] will not be changed
-static int __write_buffer(FILE *f)
+// Files opened by `fopen()`
+static FILE *open_files;
+
+// Stdio buffers fully, but line by line for terminals as they are read by
+// people. It is decided on first use, so that `setvbuf()` can come before.
+static int __mode(FILE *f)
 {
-    int r = 0;
-    if (f->buffer_len == 0)
-        return 0;
-    r = write(f->fd, f->buf, f->buffer_len);
-    return r;
+    if (f->mode < 0)
+        f->mode = isatty(f->fd) ? _IOLBF : _IOFBF;
+    return f->mode;
 }
 
-// Clear buffer_len[f]
-static void __clear_buffer(FILE *f)
+// Returns: number of chars written, less than `l` on failure
+static size_t __write_all(FILE *f, const char *s, size_t l)
 {
-    f->buffer_len = 0;
+    size_t done = 0;
+    while (done < l) {
+        ssize_t r = write(f->fd, s + done, l - done);
+        if (r <= 0) {
+            f->flags |= F_ERR;
+            break;
+        }
+        done += r;
+    }
+    return done;
 }
 
 static int __fflush(FILE *f)
 {
-    int r = __write_buffer(f);
-    __clear_buffer(f);
-    return r >= 0 ? 0 : r;
-}
-
-static int out(FILE *f, const char *s, size_t l)
-{
-    int ret = 0;
-    for (size_t i = 0; i < l; i++) {
-        char c = s[i];
-        f->buf[f->buffer_len++] = c;
-        if (f->buffer_len == FILE_BUF_SIZE || c == '\n') {
-            int r = __write_buffer(f);
-            __clear_buffer(f);
-            if (r < 0)
-                return r;
-            if (r < f->buffer_len)
-                return ret + r;
-            ret += r;
-        }
-    }
-    return ret;
+    size_t len = f->wlen;
+    f->wlen = 0;
+    return __write_all(f, f->buf, len) == len ? 0 : EOF;
+}
+
+#ifdef AX_CONFIG_FS
+// Drops the buffered input before writing, moving the file offset back to
+// the first byte that was not read.
+static void __drop_input(FILE *f)
+{
+    if (f->rpos < f->rlen)
+        lseek(f->fd, (off_t)f->rpos - (off_t)f->rlen, SEEK_CUR);
+    f->rpos = f->rlen = 0;
+}
+#else
+static void __drop_input(FILE *f) {}
+#endif
+
+// Returns: number of chars written, less than `l` on failure
+static size_t out(FILE *f, const char *s, size_t l)
+{
+    int mode = __mode(f);
+
+    __drop_input(f);
+    if (f->wlen + l > f->buf_size && __fflush(f))
+        return 0;
+    // Too big to be worth buffering
+    if (mode == _IONBF || l >= f->buf_size)
+        return __write_all(f, s, l);
+
+    memcpy(f->buf + f->wlen, s, l);
+    f->wlen += l;
+    if (f->wlen == f->buf_size || (mode == _IOLBF && memchr(s, '\n', l)))
+        __fflush(f);
+    return l;
+}
+
+// Flushes all the streams, when the program exits or returns from `main()`.
+__attribute__((destructor)) void __stdio_exit(void)
+{
+    FLOCK();
+    __fflush(stdout);
+    __fflush(stderr);
+    for (FILE *f = open_files; f; f = f->next) __fflush(f);
+    FUNLOCK();
 }
 
 int getchar(void)
@@ -81,13 +120,25 @@ int getchar(void)
 
 int fflush(FILE *f)
 {
-    return __fflush(f);
+    int r;
+    if (!f) {
+        __stdio_exit();
+        return 0;
+    }
+    FLOCK();
+    r = __fflush(f);
+    FUNLOCK();
+    return r;
 }
 
 static inline int do_putc(int c, FILE *f)
 {
     char byte = c;
-    return out(f, &byte, 1);
+    size_t r;
+    FLOCK();
+    r = out(f, &byte, 1);
+    FUNLOCK();
+    return r == 1 ? (unsigned char)c : EOF;
 }
 
 int fputc(int c, FILE *f)
@@ -107,17 +158,12 @@ int putchar(int c)
 
 int puts(const char *s)
 {
-#ifdef AX_CONFIG_MULTITASK
-    pthread_mutex_lock(&lock);
-#endif
-
-    int r = write(1, (const void *)s, strlen(s));
-    char brk[1] = {'\n'};
-    write(1, (const void *)brk, 1);
+    size_t l = strlen(s);
+    int r;
 
-#ifdef AX_CONFIG_MULTITASK
-    pthread_mutex_unlock(&lock);
-#endif
+    FLOCK();
+    r = -(out(stdout, s, l) < l || out(stdout, "\n", 1) < 1);
+    FUNLOCK();
 
     return r;
 }
@@ -127,17 +173,19 @@ void perror(const char *msg)
     FILE *f = stderr;
     char *errstr = strerror(errno);
 
+    FLOCK();
     if (msg && *msg) {
         out(f, msg, strlen(msg));
         out(f, ": ", 2);
     }
     out(f, errstr, strlen(errstr));
     out(f, "\n", 1);
+    FUNLOCK();
 }
 
-static void __out_wrapper(char c, void *arg)
+static void __out_wrapper(const char *s, size_t l, void *arg)
 {
-    out(arg, &c, 1);
+    out(arg, s, l);
 }
 
 int printf(const char *restrict fmt, ...)
@@ -162,7 +210,26 @@ int fprintf(FILE *restrict f, const char *restrict fmt, ...)
 
 int vfprintf(FILE *restrict f, const char *restrict fmt, va_list ap)
 {
-    return vfctprintf(__out_wrapper, f, fmt, ap);
+    int ret;
+    FLOCK();
+    ret = vspanprintf(__out_wrapper, f, fmt, ap);
+    FUNLOCK();
+    return ret;
+}
+
+int setvbuf(FILE *restrict f, char *restrict buf, int type, size_t size)
+{
+    if (type != _IOFBF && type != _IOLBF && type != _IONBF)
+        return -1;
+    FLOCK();
+    __fflush(f);
+    f->mode = type;
+    if (buf && size) {
+        f->buf = buf;
+        f->buf_size = size;
+    }
+    FUNLOCK();
+    return 0;
 }
 
 // TODO
@@ -206,18 +273,54 @@ FILE *fopen(const char *filename, const char *mode)
         return 0;
     }
 
-    f = (FILE *)malloc(sizeof(FILE));
-
     flags = __fmodeflags(mode);
     // TODO: currently mode is unused in ax_open
     int fd = open(filename, flags, 0666);
     if (fd < 0)
         return NULL;
+
+    f = (FILE *)calloc(1, sizeof(FILE));
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
     f->fd = fd;
+    f->mode = -1;
+    f->buf = f->inline_buf;
+    f->buf_size = BUFSIZ;
+
+    FLOCK();
+    f->next = open_files;
+    open_files = f;
+    FUNLOCK();
 
     return f;
 }
 
+// Reads into the empty input buffer, after writing the buffered output.
+static int __refill(FILE *f)
+{
+    ssize_t r;
+
+    if (__fflush(f))
+        return EOF;
+    r = read(f->fd, f->buf, f->buf_size);
+    if (r <= 0) {
+        f->flags |= r ? F_ERR : F_EOF;
+        return EOF;
+    }
+    f->rpos = 0;
+    f->rlen = r;
+    return 0;
+}
+
+static int __getc(FILE *f)
+{
+    if (f->rpos == f->rlen && __refill(f))
+        return EOF;
+    return (unsigned char)f->buf[f->rpos++];
+}
+
 char *fgets(char *restrict s, int n, FILE *restrict f)
 {
     if (n == 0)
@@ -228,46 +331,67 @@ char *fgets(char *restrict s, int n, FILE *restrict f)
     }
 
     int cnt = 0;
+    FLOCK();
     while (cnt < n - 1) {
-        char c;
-        if (read(f->fd, (void *)&c, 1) > 0) {
-            if (c != '\n')
-                s[cnt++] = c;
-            else
-                break;
-        } else
+        int c = __getc(f);
+        if (c == EOF || c == '\n')
             break;
+        s[cnt++] = c;
     }
+    FUNLOCK();
     s[cnt] = '\0';
     return s;
 }
 
 size_t fread(void *restrict destv, size_t size, size_t nmemb, FILE *restrict f)
 {
+    unsigned char *dest = destv;
     size_t total = size * nmemb;
-    size_t read_len = 0;
-    size_t len = 0;
-    do {
-        len = read(f->fd, destv + read_len, total - read_len);
-        if (len < 0)
+    size_t l = total;
+
+    if (!total)
+        return 0;
+
+    FLOCK();
+    while (l) {
+        // Small reads are served from the buffer, big ones go straight
+        // to the destination.
+        if (f->rpos == f->rlen && l >= f->buf_size) {
+            ssize_t r;
+            if (__fflush(f))
+                break;
+            r = read(f->fd, dest, l);
+            if (r <= 0) {
+                f->flags |= r ? F_ERR : F_EOF;
+                break;
+            }
+            dest += r;
+            l -= r;
+            continue;
+        }
+        if (f->rpos == f->rlen && __refill(f))
             break;
-        read_len += len;
-    } while (len > 0);
-    return read_len == size * nmemb ? nmemb : read_len / size;
+        size_t k = MIN(f->rlen - f->rpos, l);
+        memcpy(dest, f->buf + f->rpos, k);
+        f->rpos += k;
+        dest += k;
+        l -= k;
+    }
+    FUNLOCK();
+    return l == 0 ? nmemb : (total - l) / size;
 }
 
 size_t fwrite(const void *restrict src, size_t size, size_t nmemb, FILE *restrict f)
 {
     size_t total = size * nmemb;
-    size_t write_len = 0;
-    size_t len = 0;
-    do {
-        len = write(f->fd, src + write_len, total - write_len);
-        if (len < 0)
-            break;
-        write_len += len;
-    } while (len > 0);
-    return write_len == size * nmemb ? nmemb : write_len / size;
+    size_t write_len;
+
+    if (!total)
+        return 0;
+    FLOCK();
+    write_len = out(f, src, total);
+    FUNLOCK();
+    return write_len == total ? nmemb : write_len / size;
 }
 
 int fputs(const char *restrict s, FILE *restrict f)
@@ -278,7 +402,22 @@ int fputs(const char *restrict s, FILE *restrict f)
 
 int fclose(FILE *f)
 {
-    return close(f->fd);
+    int r;
+
+    FLOCK();
+    r = __fflush(f);
+    for (FILE **p = &open_files; *p; p = &(*p)->next) {
+        if (*p == f) {
+            *p = f->next;
+            break;
+        }
+    }
+    FUNLOCK();
+
+    r |= close(f->fd);
+    if (f != stdin && f != stdout && f != stderr)
+        free(f);
+    return r;
 }
 
 int fileno(FILE *f)
@@ -288,8 +427,7 @@ int fileno(FILE *f)
 
 int feof(FILE *f)
 {
-    unimplemented();
-    return 0;
+    return !!(f->flags & F_EOF);
 }
 
 // TODO
@@ -313,17 +451,14 @@ char *tmpnam(char *buf)
     return 0;
 }
 
-// TODO
 void clearerr(FILE *f)
 {
-    unimplemented();
+    f->flags &= ~(F_EOF | F_ERR);
 }
 
-// TODO
 int ferror(FILE *f)
 {
-    unimplemented();
-    return 0;
+    return !!(f->flags & F_ERR);
 }
 
 // TODO
@@ -349,8 +484,11 @@ long ftell(FILE *f)
 
 int getc(FILE *f)
 {
-    unimplemented();
-    return 0;
+    int c;
+    FLOCK();
+    c = __getc(f);
+    FUNLOCK();
+    return c;
 }
 
 // TODO
@@ -360,13 +498,6 @@ int remove(const char *path)
     return 0;
 }
 
-// TODO
-int setvbuf(FILE *restrict f, char *restrict buf, int type, size_t size)
-{
-    unimplemented();
-    return 0;
-}
-
 // TODO
 FILE *tmpfile(void)
 {
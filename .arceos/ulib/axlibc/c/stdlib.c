@@ -17,33 +17,6 @@ void srandom(unsigned int s)
     srand(s);
 }
 
-#ifdef AX_CONFIG_ALLOC
-
-void *calloc(size_t m, size_t n)
-{
-    void *mem = malloc(m * n);
-
-    return memset(mem, 0, n * m);
-}
-
-void *realloc(void *memblock, size_t size)
-{
-    if (!memblock)
-        return malloc(size);
-
-    size_t o_size = *(size_t *)(memblock - 8);
-
-    void *mem = malloc(size);
-
-    for (int i = 0; i < (o_size < size ? o_size : size); i++)
-        ((char *)mem)[i] = ((char *)memblock)[i];
-
-    free(memblock);
-    return mem;
-}
-
-#endif // AX_CONFIG_ALLOC
-
 long long llabs(long long a)
 {
     return a > 0 ? a : -a;
@@ -356,11 +329,157 @@ long double strtold(const char *restrict s, char **restrict p)
 
 typedef int (*cmpfun)(const void *, const void *);
 
-// TODO
+// `qsort` is an introsort: quicksort with a median-of-three pivot, falling back to heapsort
+// when the recursion gets too deep, and insertion sort for small partitions.
+
+// Partitions this small are left to insertion sort
+#define QSORT_INSERTION_THRESHOLD 16
+
+// How elements are swapped, decided once per sort from the element size and alignment
+enum { SWAP_BYTES, SWAP_WORDS, SWAP_INT, SWAP_LONG };
+
+struct sort_ctx {
+    size_t width;
+    cmpfun cmp;
+    int swap_kind;
+};
+
+typedef int __attribute__((__may_alias__)) swap_int_t;
+typedef long __attribute__((__may_alias__)) swap_long_t;
+
+static int swap_kind(const void *base, size_t width)
+{
+    if ((uintptr_t)base % sizeof(long) == 0 && width % sizeof(long) == 0)
+        return width == sizeof(long) ? SWAP_LONG : SWAP_WORDS;
+    if ((uintptr_t)base % sizeof(int) == 0 && width == sizeof(int))
+        return SWAP_INT;
+    return SWAP_BYTES;
+}
+
+static inline void swap(char *a, char *b, const struct sort_ctx *ctx)
+{
+    switch (ctx->swap_kind) {
+    case SWAP_LONG: {
+        long t = *(swap_long_t *)a;
+        *(swap_long_t *)a = *(swap_long_t *)b;
+        *(swap_long_t *)b = t;
+        break;
+    }
+    case SWAP_INT: {
+        int t = *(swap_int_t *)a;
+        *(swap_int_t *)a = *(swap_int_t *)b;
+        *(swap_int_t *)b = t;
+        break;
+    }
+    case SWAP_WORDS:
+        for (size_t i = 0; i < ctx->width; i += sizeof(long)) {
+            long t = *(swap_long_t *)(a + i);
+            *(swap_long_t *)(a + i) = *(swap_long_t *)(b + i);
+            *(swap_long_t *)(b + i) = t;
+        }
+        break;
+    default:
+        for (size_t i = 0; i < ctx->width; i++) {
+            char t = a[i];
+            a[i] = b[i];
+            b[i] = t;
+        }
+    }
+}
+
+static void insertion_sort(char *base, size_t nel, const struct sort_ctx *ctx)
+{
+    size_t width = ctx->width;
+    for (size_t i = 1; i < nel; i++)
+        for (char *p = base + i * width; p > base && ctx->cmp(p - width, p) > 0; p -= width)
+            swap(p - width, p, ctx);
+}
+
+static void sift_down(char *base, size_t root, size_t nel, const struct sort_ctx *ctx)
+{
+    size_t width = ctx->width;
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= nel)
+            return;
+        if (child + 1 < nel && ctx->cmp(base + child * width, base + (child + 1) * width) < 0)
+            child++;
+        if (ctx->cmp(base + root * width, base + child * width) >= 0)
+            return;
+        swap(base + root * width, base + child * width, ctx);
+        root = child;
+    }
+}
+
+static void heap_sort(char *base, size_t nel, const struct sort_ctx *ctx)
+{
+    for (size_t i = nel / 2; i-- > 0;) sift_down(base, i, nel, ctx);
+    for (size_t i = nel; i-- > 1;) {
+        swap(base, base + i * ctx->width, ctx);
+        sift_down(base, 0, i, ctx);
+    }
+}
+
+static void introsort(char *base, size_t nel, int depth, const struct sort_ctx *ctx)
+{
+    size_t width = ctx->width;
+    cmpfun cmp = ctx->cmp;
+
+    while (nel > QSORT_INSERTION_THRESHOLD) {
+        if (!depth--) {
+            heap_sort(base, nel, ctx);
+            return;
+        }
+
+        // Sort the first, middle and last elements, and move the median to the front as the
+        // pivot. The last one is then no less than the pivot, which stops the scans below.
+        char *mid = base + nel / 2 * width, *last = base + (nel - 1) * width;
+        if (cmp(mid, base) < 0)
+            swap(mid, base, ctx);
+        if (cmp(last, mid) < 0) {
+            swap(last, mid, ctx);
+            if (cmp(mid, base) < 0)
+                swap(mid, base, ctx);
+        }
+        swap(base, mid, ctx);
+
+        // Hoare partition, which stops on elements equal to the pivot to split runs of them
+        char *i = base, *j = base + nel * width;
+        for (;;) {
+            do i += width;
+            while (cmp(i, base) < 0);
+            do j -= width;
+            while (cmp(j, base) > 0);
+            if (i >= j)
+                break;
+            swap(i, j, ctx);
+        }
+        swap(base, j, ctx);
+
+        // Recurse into the smaller side and loop on the bigger one, to bound the stack
+        size_t left = (j - base) / width, right = nel - left - 1;
+        if (left < right) {
+            introsort(base, left, depth, ctx);
+            base = j + width;
+            nel = right;
+        } else {
+            introsort(j + width, right, depth, ctx);
+            nel = left;
+        }
+    }
+    insertion_sort(base, nel, ctx);
+}
+
 void qsort(void *base, size_t nel, size_t width, cmpfun cmp)
 {
-    unimplemented();
-    return;
+    struct sort_ctx ctx = {.width = width, .cmp = cmp, .swap_kind = swap_kind(base, width)};
+    int depth = 0;
+
+    if (nel < 2 || !width)
+        return;
+    // Heapsort takes over below 2 * log2(nel) levels of quicksort
+    for (size_t n = nel; n > 1; n >>= 1) depth += 2;
+    introsort(base, nel, depth, &ctx);
 }
 
 // TODO
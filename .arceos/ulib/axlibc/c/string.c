@@ -234,27 +234,57 @@ int strerror_r(int err, char *buf, size_t buflen)
     return 0;
 }
 
+/* Bulk copies move a block at a time: a 16-byte vector register when the
+ * FP/SIMD registers may be used (the `fp_simd` feature, which drops
+ * `-mno-sse` and `-mgeneral-regs-only`), or a machine word otherwise. Vector
+ * loads and stores may be unaligned, so only the destination is aligned; a
+ * word is only used when source and destination are aligned alike. */
+#if defined(__SSE2__) || defined(__ARM_NEON)
+typedef unsigned char __attribute__((__vector_size__(16), __may_alias__, __aligned__(1))) block_t;
+#define BLOCK_UNALIGNED 1
+#else
+typedef size_t __attribute__((__may_alias__)) block_t;
+#define BLOCK_UNALIGNED 0
+#endif
+#define BS sizeof(block_t)
+#define BLOCKS_OK(d, s) (BLOCK_UNALIGNED || !(((uintptr_t)(d) ^ (uintptr_t)(s)) & (BS - 1)))
+
 void *memcpy(void *restrict dest, const void *restrict src, size_t n)
 {
     unsigned char *d = dest;
     const unsigned char *s = src;
+
+    if (BLOCKS_OK(d, s)) {
+        for (; (uintptr_t)d & (BS - 1) && n; n--) *d++ = *s++;
+        for (; n >= BS; n -= BS, d += BS, s += BS) *(block_t *)d = *(const block_t *)s;
+    }
     for (; n; n--) *d++ = *s++;
     return dest;
 }
 
 void *memmove(void *dest, const void *src, size_t n)
 {
-    char *d = dest;
-    const char *s = src;
+    unsigned char *d = dest;
+    const unsigned char *s = src;
 
     if (d == s)
         return d;
     if ((uintptr_t)s - (uintptr_t)d - n <= -2 * n)
         return memcpy(d, s, n);
 
+    /* A whole block is loaded before it is stored, so copying blocks in the
+     * same direction as bytes is still safe for overlapping regions. */
     if (d < s) {
+        if (BLOCKS_OK(d, s)) {
+            for (; (uintptr_t)d & (BS - 1) && n; n--) *d++ = *s++;
+            for (; n >= BS; n -= BS, d += BS, s += BS) *(block_t *)d = *(const block_t *)s;
+        }
         for (; n; n--) *d++ = *s++;
     } else {
+        if (BLOCKS_OK(d, s)) {
+            while ((uintptr_t)(d + n) & (BS - 1) && n) n--, d[n] = s[n];
+            while (n >= BS) n -= BS, *(block_t *)(d + n) = *(const block_t *)(s + n);
+        }
         while (n) n--, d[n] = s[n];
     }
 
@@ -263,7 +293,18 @@ void *memmove(void *dest, const void *src, size_t n)
 
 int memcmp(const void *vl, const void *vr, size_t n)
 {
+    typedef size_t __attribute__((__may_alias__)) word;
     const unsigned char *l = vl, *r = vr;
+
+    /* Skip equal words, then find the differing byte one at a time. */
+    if (!(((uintptr_t)l ^ (uintptr_t)r) & (sizeof(word) - 1))) {
+        for (; (uintptr_t)l & (sizeof(word) - 1) && n; n--, l++, r++)
+            if (*l != *r)
+                return *l - *r;
+        for (; n >= sizeof(word) && *(const word *)l == *(const word *)r;
+             n -= sizeof(word), l += sizeof(word), r += sizeof(word))
+            ;
+    }
     for (; n && *l == *r; n--, l++, r++)
         ;
     return n ? *l - *r : 0;
@@ -27,11 +27,15 @@ pid_t setsid(void)
     return 0;
 }
 
-// TODO
 int isatty(int fd)
 {
-    unimplemented();
-    return 0;
+#ifdef AX_CONFIG_FS
+    // The console is the only character device.
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISCHR(st.st_mode);
+#else
+    return fd >= 0 && fd <= 2;
+#endif
 }
 
 unsigned int sleep(unsigned int seconds)
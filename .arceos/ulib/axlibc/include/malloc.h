@@ -0,0 +1,12 @@
+#ifndef __MALLOC_H__
+#define __MALLOC_H__
+
+#include <stddef.h>
+
+void *malloc(size_t);
+void *calloc(size_t, size_t);
+void *realloc(void *, size_t);
+void free(void *);
+size_t malloc_usable_size(void *);
+
+#endif // __MALLOC_H__
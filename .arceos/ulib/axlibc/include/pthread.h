@@ -39,8 +39,28 @@ typedef struct {
         void *__p[12 * sizeof(int) / sizeof(void *)];
     } __u;
 } pthread_cond_t;
-#define _c_clock  __u.__i[4]
-#define _c_shared __u.__p[0]
+#define _c_clock   __u.__i[4]
+#define _c_shared  __u.__p[0]
+#define _c_seq     __u.__vi[2]
+#define _c_waiters __u.__vi[3]
+
+#define PTHREAD_COND_INITIALIZER {{{0}}}
+
+typedef struct {
+    union {
+        int __i[sizeof(long) == 8 ? 14 : 8];
+        volatile int __vi[sizeof(long) == 8 ? 14 : 8];
+        void *__p[sizeof(long) == 8 ? 7 : 8];
+    } __u;
+} pthread_rwlock_t;
+#define _rw_lock    __u.__vi[0]
+#define _rw_waiters __u.__vi[1]
+
+#define PTHREAD_RWLOCK_INITIALIZER {{{0}}}
+
+typedef struct {
+    unsigned __attr[2];
+} pthread_rwlockattr_t;
 
 typedef void *pthread_t;
 
@@ -73,6 +93,15 @@ int pthread_cond_init(pthread_cond_t *__restrict__ __cond,
 int pthread_cond_signal(pthread_cond_t *__cond);
 int pthread_cond_wait(pthread_cond_t *__restrict__ __cond, pthread_mutex_t *__restrict__ __mutex);
 int pthread_cond_broadcast(pthread_cond_t *);
+int pthread_cond_destroy(pthread_cond_t *);
+
+int pthread_rwlock_init(pthread_rwlock_t *__restrict, const pthread_rwlockattr_t *__restrict);
+int pthread_rwlock_destroy(pthread_rwlock_t *);
+int pthread_rwlock_rdlock(pthread_rwlock_t *);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *);
+int pthread_rwlock_wrlock(pthread_rwlock_t *);
+int pthread_rwlock_trywrlock(pthread_rwlock_t *);
+int pthread_rwlock_unlock(pthread_rwlock_t *);
 
 int pthread_attr_init(pthread_attr_t *__attr);
 int pthread_attr_getstacksize(const pthread_attr_t *__restrict__ __attr,
@@ -8,12 +8,19 @@
 #define _IOLBF 1
 #define _IONBF 2
 
-#define FILE_BUF_SIZE 1024
+#define BUFSIZ 4096
+
 // TODO: complete this struct
 struct IO_FILE {
     int fd;
-    uint16_t buffer_len;
-    char buf[FILE_BUF_SIZE];
+    int flags; // F_EOF, F_ERR
+    int mode;  // _IOFBF, _IOLBF or _IONBF, or -1 until it is decided on first use
+    char *buf;
+    size_t buf_size;
+    size_t wlen;          // Buffered output not written yet
+    size_t rpos, rlen;    // Next and end of buffered input not read yet
+    struct IO_FILE *next; // In the list of opened files, flushed at exit
+    char inline_buf[BUFSIZ];
 };
 
 typedef struct IO_FILE FILE;
@@ -52,7 +59,6 @@ extern FILE *const stderr;
 #define UNGET  8
 
 #define FILENAME_MAX 4096
-#define BUFSIZ       1024
 #define L_tmpnam     20
 
 FILE *fopen(const char *filename, const char *mode);
@@ -92,7 +92,7 @@ pub use self::time::{clock_gettime, nanosleep};
 pub use self::unistd::{abort, exit, getpid};
 
 #[cfg(feature = "alloc")]
-pub use self::malloc::{free, malloc};
+pub use self::malloc::{calloc, free, malloc, malloc_usable_size, realloc};
 #[cfg(feature = "alloc")]
 pub use self::strftime::strftime;
 
@@ -108,10 +108,14 @@ pub use self::net::{
     recvfrom, send, sendto, shutdown, socket,
 };
 
+#[cfg(feature = "multitask")]
+pub use self::pthread::{ax_futex_wait, ax_futex_wake};
 #[cfg(feature = "multitask")]
 pub use self::pthread::{pthread_create, pthread_exit, pthread_join, pthread_self};
 #[cfg(feature = "multitask")]
-pub use self::pthread::{pthread_mutex_init, pthread_mutex_lock, pthread_mutex_unlock};
+pub use self::pthread::{
+    pthread_mutex_init, pthread_mutex_lock, pthread_mutex_trylock, pthread_mutex_unlock,
+};
 
 #[cfg(feature = "pipe")]
 pub use self::pipe::pipe;
@@ -5,34 +5,125 @@
 //! `ArceOS`, we noticed that the heap of the Rust user program is shared with the kernel. In
 //! order to maintain consistency, C user programs also choose to share the kernel heap,
 //! skipping the sys_brk step.
+//!
+//! Blocks are rounded up to the size classes of the kernel heap, whose per-CPU
+//! caches serve small blocks without locking. The rounded size is recorded in
+//! the block header, so that `realloc` can grow a block in place up to it.
 
-use alloc::alloc::{alloc, dealloc};
+use alloc::alloc::{alloc, alloc_zeroed, dealloc};
+use axerrno::LinuxError;
 use core::alloc::Layout;
 use core::ffi::c_void;
 
 use crate::ctypes;
+use crate::errno::set_errno;
 
 struct MemoryControlBlock {
+    /// The size of the whole block, header included.
     size: usize,
 }
 
 const CTRL_BLK_SIZE: usize = core::mem::size_of::<MemoryControlBlock>();
 
+/// The largest size class of the kernel heap. Larger blocks are rounded up to
+/// whole pages.
+const MAX_CLASS_SIZE: usize = 2048;
+const PAGE_SIZE: usize = 4096;
+
+/// Returns the size of the block that holds `size` bytes, or `None` on
+/// overflow.
+fn block_size(size: usize) -> Option<usize> {
+    let size = size.checked_add(CTRL_BLK_SIZE)?;
+    if size <= MAX_CLASS_SIZE {
+        Some(size.next_power_of_two().max(16))
+    } else {
+        size.checked_next_multiple_of(PAGE_SIZE)
+    }
+}
+
+fn block_layout(size: usize) -> Layout {
+    Layout::from_size_align(size, 8).unwrap()
+}
+
+/// Allocates a block holding `size` bytes, zeroed if `zeroed` is true.
+unsafe fn alloc_block(size: ctypes::size_t, zeroed: bool) -> *mut c_void {
+    let Some(size) = block_size(size as usize).filter(|&size| size <= isize::MAX as usize) else {
+        set_errno(LinuxError::ENOMEM.code());
+        return core::ptr::null_mut();
+    };
+    let layout = block_layout(size);
+    unsafe {
+        let ptr = if zeroed {
+            alloc_zeroed(layout)
+        } else {
+            alloc(layout)
+        }
+        .cast::<MemoryControlBlock>();
+        if ptr.is_null() {
+            set_errno(LinuxError::ENOMEM.code());
+            return core::ptr::null_mut();
+        }
+        ptr.write(MemoryControlBlock { size });
+        ptr.add(1).cast()
+    }
+}
+
+/// Returns the header of the block of `ptr`.
+unsafe fn control_block(ptr: *mut c_void) -> *mut MemoryControlBlock {
+    let ptr = ptr.cast::<MemoryControlBlock>();
+    assert!(ptr as usize > CTRL_BLK_SIZE, "free a null pointer");
+    unsafe { ptr.sub(1) }
+}
+
 /// Allocate memory and return the memory address.
 ///
-/// Returns 0 on failure (the current implementation does not trigger an exception)
+/// Returns 0 and sets `errno` to `ENOMEM` on failure.
 #[unsafe(no_mangle)]
 pub unsafe extern "C" fn malloc(size: ctypes::size_t) -> *mut c_void {
-    // Allocate `(actual length) + 8`. The lowest 8 Bytes are stored in the actual allocated space size.
-    // This is because free(uintptr_t) has only one parameter representing the address,
-    // So we need to save in advance to know the size of the memory space that needs to be released
-    let layout = Layout::from_size_align(size + CTRL_BLK_SIZE, 8).unwrap();
+    unsafe { alloc_block(size, false) }
+}
+
+/// Allocates zeroed memory for an array of `nmemb` elements of `size` bytes.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn calloc(nmemb: ctypes::size_t, size: ctypes::size_t) -> *mut c_void {
+    let Some(size) = nmemb.checked_mul(size) else {
+        set_errno(LinuxError::ENOMEM.code());
+        return core::ptr::null_mut();
+    };
+    unsafe { alloc_block(size, true) }
+}
+
+/// Changes the size of the memory block of `ptr` to `size` bytes.
+///
+/// The block is resized in place if `size` fits in it, and is otherwise moved
+/// to a new block. On failure, 0 is returned and the old block is left as is.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn realloc(ptr: *mut c_void, size: ctypes::size_t) -> *mut c_void {
+    if ptr.is_null() {
+        return unsafe { malloc(size) };
+    }
     unsafe {
-        let ptr = alloc(layout).cast::<MemoryControlBlock>();
-        assert!(!ptr.is_null(), "malloc failed");
-        ptr.write(MemoryControlBlock { size });
-        ptr.add(1).cast()
+        let old_size = control_block(ptr).read().size - CTRL_BLK_SIZE;
+        if size as usize <= old_size {
+            return ptr;
+        }
+        let new_ptr = malloc(size);
+        if !new_ptr.is_null() {
+            core::ptr::copy_nonoverlapping(ptr.cast::<u8>(), new_ptr.cast::<u8>(), old_size);
+            free(ptr);
+        }
+        new_ptr
+    }
+}
+
+/// Returns the number of usable bytes in the block of `ptr`, which may be
+/// more than requested.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn malloc_usable_size(ptr: *mut c_void) -> ctypes::size_t {
+    if ptr.is_null() {
+        return 0;
     }
+    unsafe { (control_block(ptr).read().size - CTRL_BLK_SIZE) as _ }
 }
 
 /// Deallocate memory.
@@ -45,12 +136,9 @@ pub unsafe extern "C" fn free(ptr: *mut c_void) {
     if ptr.is_null() {
         return;
     }
-    let ptr = ptr.cast::<MemoryControlBlock>();
-    assert!(ptr as usize > CTRL_BLK_SIZE, "free a null pointer");
     unsafe {
-        let ptr = ptr.sub(1);
+        let ptr = control_block(ptr);
         let size = ptr.read().size;
-        let layout = Layout::from_size_align(size + CTRL_BLK_SIZE, 8).unwrap();
-        dealloc(ptr.cast(), layout)
+        dealloc(ptr.cast(), block_layout(size))
     }
 }
@@ -57,3 +57,24 @@ pub unsafe extern "C" fn pthread_mutex_lock(mutex: *mut ctypes::pthread_mutex_t)
 pub unsafe extern "C" fn pthread_mutex_unlock(mutex: *mut ctypes::pthread_mutex_t) -> c_int {
     e(api::sys_pthread_mutex_unlock(mutex))
 }
+
+/// Lock the given mutex if it is not locked.
+///
+/// Returns `EBUSY` if it is, as the pthread functions return error numbers.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn pthread_mutex_trylock(mutex: *mut ctypes::pthread_mutex_t) -> c_int {
+    -api::sys_pthread_mutex_trylock(mutex)
+}
+
+/// Blocks while the word at `addr` holds `val`, until [`ax_futex_wake`] is
+/// called on it after it changed.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn ax_futex_wait(addr: *const c_int, val: c_int) -> c_int {
+    e(api::sys_futex_wait(addr, val))
+}
+
+/// Wakes the threads blocked on the word at `addr`.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn ax_futex_wake(addr: *const c_int) -> c_int {
+    e(api::sys_futex_wake(addr))
+}
@@ -0,0 +1,263 @@
+//! Buffered console output, and console input.
+//!
+//! Writing to the UART is slow, as it waits for the device byte by byte, and
+//! programs that print a lot would spend most of their time doing so with the
+//! console locked. Instead, output is appended to a ring buffer in memory,
+//! which only takes a copy, and a dedicated task writes it to the UART in the
+//! background. Writers only wait when the ring is full.
+//!
+//! Anything still in the ring is written out by [`flush_console`], which is
+//! called before the kernel reports or prints anything itself, and on panic.
+//!
+//! The same task prints the kernel logs that `axlog` defers, see
+//! [`defer_kernel_logs`].
+//!
+//! Input is read from the UART ahead of the readers into a queue. Not all
+//! platforms raise an interrupt on receiving, so while someone waits for
+//! input, an input task checks the UART periodically and wakes them up once
+//! something arrives. Nobody polls the UART while nobody waits.
+
+use alloc::{collections::VecDeque, string::String, sync::Arc};
+use core::sync::atomic::{AtomicUsize, Ordering};
+use core::time::Duration;
+
+use axsync::{Mutex, spin::SpinNoIrq};
+use axtask::WaitQueue;
+
+use super::{PollWakers, Wake};
+
+const RING_SIZE: usize = 0x10000;
+/// How much is written to the UART at a time, without the ring locked.
+const CHUNK_SIZE: usize = 256;
+const WRITER_STACK_SIZE: usize = 0x4000;
+/// How often the UART is checked for input while someone waits for it.
+const INPUT_POLL_INTERVAL: Duration = Duration::from_millis(10);
+const INPUT_STACK_SIZE: usize = 0x4000;
+
+struct Ring {
+    buf: [u8; RING_SIZE],
+    head: usize,
+    len: usize,
+}
+
+impl Ring {
+    const fn new() -> Self {
+        Self {
+            buf: [0; RING_SIZE],
+            head: 0,
+            len: 0,
+        }
+    }
+
+    fn push(&mut self, mut data: &[u8]) -> usize {
+        let mut pushed = 0;
+        while !data.is_empty() && self.len < RING_SIZE {
+            let tail = (self.head + self.len) % RING_SIZE;
+            let end = if tail < self.head {
+                self.head
+            } else {
+                RING_SIZE
+            };
+            let n = (end - tail).min(data.len());
+            self.buf[tail..tail + n].copy_from_slice(&data[..n]);
+            self.len += n;
+            data = &data[n..];
+            pushed += n;
+        }
+        pushed
+    }
+
+    fn pop(&mut self, buf: &mut [u8]) -> usize {
+        let n = (RING_SIZE - self.head).min(self.len).min(buf.len());
+        buf[..n].copy_from_slice(&self.buf[self.head..self.head + n]);
+        self.head = (self.head + n) % RING_SIZE;
+        self.len -= n;
+        n
+    }
+}
+
+static RING: SpinNoIrq<Ring> = SpinNoIrq::new(Ring::new());
+/// Serializes writing to the UART, so that chunks go out in order.
+static DRAIN_LOCK: Mutex<()> = Mutex::new(());
+/// The writer task, waiting for output.
+static WRITER_WQ: WaitQueue = WaitQueue::new();
+/// Writers waiting for room in the ring.
+static ROOM_WQ: WaitQueue = WaitQueue::new();
+static WRITER: spin::Once<()> = spin::Once::new();
+
+fn is_empty() -> bool {
+    RING.lock().len == 0
+}
+
+fn is_full() -> bool {
+    RING.lock().len == RING_SIZE
+}
+
+/// Writes everything in the ring to the UART.
+fn drain() {
+    let _guard = DRAIN_LOCK.lock();
+    let mut chunk = [0; CHUNK_SIZE];
+    loop {
+        let len = RING.lock().pop(&mut chunk);
+        if len == 0 {
+            break;
+        }
+        axhal::console::write_bytes(&chunk[..len]);
+        ROOM_WQ.notify_all(false);
+    }
+}
+
+fn writer_main() {
+    loop {
+        WRITER_WQ.wait_until(|| !is_empty() || axlog::has_deferred());
+        axlog::drain_deferred();
+        drain();
+    }
+}
+
+fn start_writer() {
+    WRITER.call_once(|| {
+        axtask::spawn_raw(writer_main, String::from("console"), WRITER_STACK_SIZE);
+    });
+}
+
+/// Makes kernel logs other than errors be printed by the writer task instead
+/// of by whoever logs, so that logging does not wait for the UART.
+pub fn defer_kernel_logs() {
+    start_writer();
+    axlog::set_deferred(true);
+}
+
+/// Wakes up the writer task if there are deferred kernel logs to print.
+///
+/// Logging cannot wake it up itself, as it may happen with any lock held, so
+/// this is called on timer ticks instead.
+pub fn kick_console_writer() {
+    if axlog::has_deferred() {
+        WRITER_WQ.notify_one(false);
+    }
+}
+
+/// Appends `buf` to the console output, waiting while the ring is full.
+pub fn console_write(mut buf: &[u8]) {
+    start_writer();
+    while !buf.is_empty() {
+        let pushed = RING.lock().push(buf);
+        buf = &buf[pushed..];
+        WRITER_WQ.notify_one(false);
+        if !buf.is_empty() {
+            ROOM_WQ.wait_until(|| !is_full());
+        }
+    }
+}
+
+/// Writes all the buffered console output and kernel logs to the UART before
+/// returning.
+pub fn flush_console() {
+    axlog::drain_deferred();
+    drain();
+}
+
+/// Writes out the buffered console output on panic.
+///
+/// The panicking CPU may hold the locks, so what cannot be locked is given
+/// up on rather than waited for.
+pub fn flush_console_on_panic() {
+    let Some(mut ring) = RING.try_lock() else {
+        return;
+    };
+    let mut chunk = [0; CHUNK_SIZE];
+    loop {
+        let len = ring.pop(&mut chunk);
+        if len == 0 {
+            break;
+        }
+        axhal::console::write_bytes(&chunk[..len]);
+    }
+}
+
+/// Input received from the UART, with `\r` turned into `\n`.
+static INPUT: SpinNoIrq<VecDeque<u8>> = SpinNoIrq::new(VecDeque::new());
+/// Readers blocked on input.
+static READER_WQ: WaitQueue = WaitQueue::new();
+static READERS: AtomicUsize = AtomicUsize::new(0);
+/// Everyone polling for input.
+static INPUT_WAKERS: PollWakers = PollWakers::new();
+/// The input task, waiting for someone to wait for input.
+static INPUT_WQ: WaitQueue = WaitQueue::new();
+static INPUT_TASK: spin::Once<()> = spin::Once::new();
+
+/// Moves what the UART has received to the input queue, and returns whether
+/// there was anything.
+fn fill_input() -> bool {
+    let mut buf = [0; 64];
+    let len = axhal::console::read_bytes(&mut buf);
+    if len == 0 {
+        return false;
+    }
+    INPUT.lock().extend(
+        buf[..len]
+            .iter()
+            .map(|&c| if c == b'\r' { b'\n' } else { c }),
+    );
+    READER_WQ.notify_all(false);
+    INPUT_WAKERS.wake_all();
+    true
+}
+
+fn is_input_awaited() -> bool {
+    READERS.load(Ordering::Acquire) > 0 || !INPUT_WAKERS.is_empty()
+}
+
+fn input_main() {
+    loop {
+        INPUT_WQ.wait_until(is_input_awaited);
+        if !fill_input() {
+            INPUT_WQ.wait_timeout(INPUT_POLL_INTERVAL);
+        }
+    }
+}
+
+/// Makes the input task check the UART until nobody waits for input.
+fn watch_input() {
+    INPUT_TASK.call_once(|| {
+        axtask::spawn_raw(input_main, String::from("console-input"), INPUT_STACK_SIZE);
+    });
+    INPUT_WQ.notify_one(false);
+}
+
+/// Reads the console input received so far into `buf`, without blocking.
+pub fn console_read(buf: &mut [u8]) -> usize {
+    if INPUT.lock().is_empty() {
+        fill_input();
+    }
+    let mut input = INPUT.lock();
+    let len = buf.len().min(input.len());
+    for (dst, src) in buf.iter_mut().zip(input.drain(..len)) {
+        *dst = src;
+    }
+    len
+}
+
+/// Whether there is console input to read.
+pub fn has_console_input() -> bool {
+    !INPUT.lock().is_empty() || fill_input()
+}
+
+/// Blocks until there is console input to read.
+pub fn wait_console_input() {
+    READERS.fetch_add(1, Ordering::AcqRel);
+    watch_input();
+    READER_WQ.wait_until(|| !INPUT.lock().is_empty());
+    READERS.fetch_sub(1, Ordering::AcqRel);
+}
+
+/// Registers `waker` to be woken when console input arrives.
+pub fn register_console_waker(waker: &Arc<dyn Wake>) {
+    INPUT_WAKERS.register(waker);
+    watch_input();
+}
+
+pub fn unregister_console_waker(waker: &Arc<dyn Wake>) {
+    INPUT_WAKERS.unregister(waker);
+}
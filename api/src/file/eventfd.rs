@@ -0,0 +1,145 @@
+use core::{
+    any::Any,
+    sync::atomic::{AtomicBool, AtomicU64, Ordering},
+};
+
+use alloc::sync::Arc;
+use axerrno::{LinuxError, LinuxResult};
+use axio::PollState;
+use axtask::WaitQueue;
+
+use super::{FileLike, Kstat, PollWakers, Wake};
+
+/// The largest value the counter can hold.
+const MAX_COUNT: u64 = u64::MAX - 1;
+
+/// An event counter created by `eventfd2`.
+pub struct EventFd {
+    count: AtomicU64,
+    semaphore: bool,
+    nonblocking: AtomicBool,
+    /// Readers waiting for the counter to become nonzero.
+    read_wq: WaitQueue,
+    /// Writers waiting for room in the counter.
+    write_wq: WaitQueue,
+    wakers: PollWakers,
+}
+
+impl EventFd {
+    pub fn new(initval: u64, semaphore: bool) -> Self {
+        Self {
+            count: AtomicU64::new(initval),
+            semaphore,
+            nonblocking: AtomicBool::new(false),
+            read_wq: WaitQueue::new(),
+            write_wq: WaitQueue::new(),
+            wakers: PollWakers::new(),
+        }
+    }
+
+    fn nonblocking(&self) -> bool {
+        self.nonblocking.load(Ordering::Relaxed)
+    }
+
+    /// Takes the value to be returned by `read` out of the counter.
+    fn try_take(&self) -> Option<u64> {
+        self.count
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |count| {
+                if count == 0 {
+                    None
+                } else if self.semaphore {
+                    Some(count - 1)
+                } else {
+                    Some(0)
+                }
+            })
+            .ok()
+            .map(|count| if self.semaphore { 1 } else { count })
+    }
+
+    /// Adds `value` to the counter if it does not overflow.
+    fn try_add(&self, value: u64) -> bool {
+        self.count
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |count| {
+                count.checked_add(value).filter(|&sum| sum <= MAX_COUNT)
+            })
+            .is_ok()
+    }
+}
+
+impl FileLike for EventFd {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        let Some(buf) = buf.first_chunk_mut::<8>() else {
+            return Err(LinuxError::EINVAL);
+        };
+        let value = loop {
+            if let Some(value) = self.try_take() {
+                break value;
+            }
+            if self.nonblocking() {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.read_wq
+                .wait_until(|| self.count.load(Ordering::Acquire) > 0);
+        };
+        *buf = value.to_ne_bytes();
+        self.write_wq.notify_all(false);
+        self.wakers.wake_all();
+        Ok(8)
+    }
+
+    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+        let Some(buf) = buf.first_chunk::<8>() else {
+            return Err(LinuxError::EINVAL);
+        };
+        let value = u64::from_ne_bytes(*buf);
+        if value == u64::MAX {
+            return Err(LinuxError::EINVAL);
+        }
+        while !self.try_add(value) {
+            if self.nonblocking() {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.write_wq
+                .wait_until(|| self.count.load(Ordering::Acquire) <= MAX_COUNT - value);
+        }
+        if value > 0 {
+            self.read_wq.notify_all(false);
+            self.wakers.wake_all();
+        }
+        Ok(8)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: 0o600u32, // rw-------
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        let count = self.count.load(Ordering::Acquire);
+        Ok(PollState {
+            readable: count > 0,
+            writable: count < MAX_COUNT,
+        })
+    }
+
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.wakers.unregister(waker);
+    }
+}
@@ -0,0 +1,378 @@
+//! The file descriptor table of a process.
+//!
+//! Looking up a file descriptor is on the path of every `read`, `write` or
+//! `poll`, while the table is only modified by `open`, `close`, `dup` and
+//! the like. Lookups therefore only register themselves in a reader count
+//! of the CPU they run on, so that the threads sharing a table on different
+//! CPUs do not write to a common cache line. Modifications wait for all the
+//! reader counts to drop to zero, while new lookups wait for the
+//! modification to finish.
+//!
+//! The table starts small and grows as files are opened, up to the
+//! `RLIMIT_NOFILE` limit of the process. The lowest free descriptor, which
+//! `open` must return, is found in a bitmap of the used ones. Another
+//! bitmap holds the close-on-exec flags, so that `execve` and `close_range`
+//! handle the descriptors a word at a time.
+//!
+//! The table copied for a child created without `CLONE_FILES` shares the
+//! files of its parent until either of them modifies its table, which then
+//! copies them. A child that calls `execve` right away, or that does not
+//! open any file, thus never copies them.
+
+use core::{
+    cell::UnsafeCell,
+    ops::{Deref, DerefMut},
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{sync::Arc, vec::Vec};
+use axsync::{LockClass, Mutex, MutexGuard, RawMutex};
+
+use super::FileLike;
+
+/// The number of descriptors tracked by a word of the bitmap, by which the
+/// table grows.
+const WORD_BITS: usize = u64::BITS as usize;
+
+/// Returns the mask of the descriptors of the word `i` of a bitmap that are
+/// in `first..=last`.
+fn range_mask(i: usize, first: usize, last: usize) -> u64 {
+    let start = i * WORD_BITS;
+    if last < start {
+        return 0;
+    }
+    let low = first.saturating_sub(start).min(WORD_BITS);
+    let high = (last - start).min(WORD_BITS - 1) + 1;
+    if high <= low {
+        return 0;
+    }
+    (u64::MAX >> (WORD_BITS - (high - low))) << low
+}
+
+/// The open files of a table, indexed by their descriptor.
+#[derive(Clone, Default)]
+pub struct OpenFiles {
+    files: Vec<Option<Arc<dyn FileLike>>>,
+    /// The bitmap of the used descriptors.
+    used: Vec<u64>,
+    /// The bitmap of the descriptors to close on `execve`.
+    cloexec: Vec<u64>,
+    /// The index of a word of `used` below which all the words are full.
+    first_free: usize,
+}
+
+impl OpenFiles {
+    /// Creates an empty table.
+    pub const fn new() -> Self {
+        Self {
+            files: Vec::new(),
+            used: Vec::new(),
+            cloexec: Vec::new(),
+            first_free: 0,
+        }
+    }
+
+    /// Returns the file at `fd`.
+    pub fn get(&self, fd: usize) -> Option<&Arc<dyn FileLike>> {
+        self.files.get(fd)?.as_ref()
+    }
+
+    /// Returns the used descriptors, in increasing order.
+    pub fn ids(&self) -> impl Iterator<Item = usize> + '_ {
+        self.used.iter().enumerate().flat_map(|(i, &word)| {
+            (0..WORD_BITS)
+                .filter(move |bit| word & (1 << bit) != 0)
+                .map(move |bit| i * WORD_BITS + bit)
+        })
+    }
+
+    /// Grows the table so that it can hold `fd`.
+    fn reserve(&mut self, fd: usize) {
+        if fd < self.files.len() {
+            return;
+        }
+        let words = (fd / WORD_BITS + 1).max(self.used.len() * 2);
+        self.used.resize(words, 0);
+        self.cloexec.resize(words, 0);
+        self.files.resize(words * WORD_BITS, None);
+    }
+
+    /// Adds `file` at the lowest free descriptor, which must be below
+    /// `limit`, with the close-on-exec flag `cloexec`.
+    ///
+    /// Returns the descriptor, or `None` if all the descriptors below
+    /// `limit` are used.
+    pub fn add(&mut self, file: Arc<dyn FileLike>, limit: usize, cloexec: bool) -> Option<usize> {
+        let free = self.used[self.first_free..]
+            .iter()
+            .position(|&word| word != u64::MAX)
+            .map(|i| self.first_free + i);
+        let fd = match free {
+            Some(i) => {
+                self.first_free = i;
+                i * WORD_BITS + self.used[i].trailing_ones() as usize
+            }
+            None => {
+                self.first_free = self.used.len();
+                self.files.len()
+            }
+        };
+        if fd >= limit {
+            return None;
+        }
+        self.add_at(fd, file, cloexec);
+        Some(fd)
+    }
+
+    /// Adds `file` at `fd` with the close-on-exec flag `cloexec`, returning
+    /// the file that was there.
+    pub fn add_at(
+        &mut self,
+        fd: usize,
+        file: Arc<dyn FileLike>,
+        cloexec: bool,
+    ) -> Option<Arc<dyn FileLike>> {
+        self.reserve(fd);
+        self.used[fd / WORD_BITS] |= 1 << (fd % WORD_BITS);
+        let old = self.files[fd].replace(file);
+        self.set_cloexec(fd, cloexec);
+        old
+    }
+
+    /// Removes the file at `fd`.
+    pub fn remove(&mut self, fd: usize) -> Option<Arc<dyn FileLike>> {
+        // The descriptor is used if it has a file.
+        self.files.get(fd)?.as_ref()?;
+        let mut removed = Vec::new();
+        self.remove_masked(fd / WORD_BITS, 1 << (fd % WORD_BITS), &mut removed);
+        removed.pop()
+    }
+
+    /// Removes the files of the word `i` of the bitmaps that are in `mask`,
+    /// pushing them to `removed`.
+    fn remove_masked(&mut self, i: usize, mask: u64, removed: &mut Vec<Arc<dyn FileLike>>) {
+        let mut bits = self.used[i] & mask;
+        self.used[i] &= !mask;
+        self.cloexec[i] &= !mask;
+        if bits != 0 {
+            self.first_free = self.first_free.min(i);
+        }
+        while bits != 0 {
+            let fd = i * WORD_BITS + bits.trailing_zeros() as usize;
+            removed.extend(self.files[fd].take());
+            bits &= bits - 1;
+        }
+    }
+
+    /// Returns the close-on-exec flag of `fd`, or `None` if it is not used.
+    pub fn cloexec(&self, fd: usize) -> Option<bool> {
+        self.get(fd)?;
+        Some(self.cloexec[fd / WORD_BITS] & (1 << (fd % WORD_BITS)) != 0)
+    }
+
+    /// Sets the close-on-exec flag of `fd`, returning `false` if it is not
+    /// used.
+    pub fn set_cloexec(&mut self, fd: usize, cloexec: bool) -> bool {
+        if self.get(fd).is_none() {
+            return false;
+        }
+        let word = &mut self.cloexec[fd / WORD_BITS];
+        if cloexec {
+            *word |= 1 << (fd % WORD_BITS);
+        } else {
+            *word &= !(1 << (fd % WORD_BITS));
+        }
+        true
+    }
+
+    /// Returns the indices of the words of the bitmaps that hold descriptors
+    /// in `first..=last`.
+    fn words(&self, first: usize, last: usize) -> core::ops::Range<usize> {
+        let end = last.min(self.files.len().saturating_sub(1)) / WORD_BITS + 1;
+        (first / WORD_BITS).min(end)..end.min(self.used.len())
+    }
+
+    /// Removes the files in `first..=last`, and returns them.
+    pub fn remove_range(&mut self, first: usize, last: usize) -> Vec<Arc<dyn FileLike>> {
+        let mut removed = Vec::new();
+        for i in self.words(first, last) {
+            self.remove_masked(i, range_mask(i, first, last), &mut removed);
+        }
+        removed
+    }
+
+    /// Sets the close-on-exec flag of the files in `first..=last`.
+    pub fn set_cloexec_range(&mut self, first: usize, last: usize) {
+        for i in self.words(first, last) {
+            self.cloexec[i] |= self.used[i] & range_mask(i, first, last);
+        }
+    }
+
+    /// Returns whether a descriptor has the close-on-exec flag.
+    pub fn has_cloexec(&self) -> bool {
+        self.cloexec.iter().any(|&word| word != 0)
+    }
+
+    /// Removes the files that have the close-on-exec flag, and returns
+    /// them.
+    pub fn remove_cloexec(&mut self) -> Vec<Arc<dyn FileLike>> {
+        let mut removed = Vec::new();
+        for i in 0..self.cloexec.len() {
+            self.remove_masked(i, self.cloexec[i], &mut removed);
+        }
+        removed
+    }
+}
+
+/// The class of the locks serializing the modifications of file descriptor
+/// tables, see `/proc/lock_stat`.
+static FD_TABLE_LOCKS: LockClass = LockClass::new("fd_table");
+
+/// A reader count, on its own cache line.
+#[repr(align(64))]
+struct ReaderCount(AtomicUsize);
+
+/// A file descriptor table.
+pub struct FdTable {
+    files: UnsafeCell<Arc<OpenFiles>>,
+    /// The number of lookups in progress, per CPU.
+    readers: [ReaderCount; axconfig::SMP],
+    /// Whether the table is being modified.
+    writing: AtomicBool,
+    /// Serializes the modifications.
+    writer: Mutex<()>,
+}
+
+// SAFETY: the files are only accessed as described in `read` and `write`.
+unsafe impl Send for FdTable {}
+unsafe impl Sync for FdTable {}
+
+impl FdTable {
+    /// Creates a table with the given files.
+    pub fn new(files: OpenFiles) -> Self {
+        Self::with_files(Arc::new(files))
+    }
+
+    fn with_files(files: Arc<OpenFiles>) -> Self {
+        Self {
+            files: UnsafeCell::new(files),
+            readers: [const { ReaderCount(AtomicUsize::new(0)) }; axconfig::SMP],
+            writing: AtomicBool::new(false),
+            writer: Mutex::const_new(RawMutex::with_class(&FD_TABLE_LOCKS), ()),
+        }
+    }
+
+    /// Returns the file at `fd`.
+    pub fn get(&self, fd: usize) -> Option<Arc<dyn FileLike>> {
+        self.read().get(fd).cloned()
+    }
+
+    /// Returns a copy of the table, which shares the files until either
+    /// table is modified.
+    pub fn fork(&self) -> Self {
+        Self::with_files(self.read().table_files().clone())
+    }
+
+    /// Locks the table for reading.
+    pub fn read(&self) -> FdTableReadGuard<'_> {
+        let count = &self.readers[axhal::cpu::this_cpu_id()].0;
+        loop {
+            // Pairs with the `SeqCst` operations in `write`: either the
+            // writer sees this count, or this reader sees the writer.
+            count.fetch_add(1, Ordering::SeqCst);
+            if !self.writing.load(Ordering::SeqCst) {
+                // The guard decrements the same count even if the task
+                // migrates to another CPU meanwhile.
+                return FdTableReadGuard { table: self, count };
+            }
+            count.fetch_sub(1, Ordering::Release);
+            while self.writing.load(Ordering::Acquire) {
+                axtask::yield_now();
+            }
+        }
+    }
+
+    /// Locks the table for modification, waiting for the lookups in progress
+    /// to finish.
+    pub fn write(&self) -> FdTableWriteGuard<'_> {
+        let writer = self.writer.lock();
+        self.writing.store(true, Ordering::SeqCst);
+        for count in &self.readers {
+            while count.0.load(Ordering::SeqCst) != 0 {
+                axtask::yield_now();
+            }
+        }
+        FdTableWriteGuard {
+            table: self,
+            _writer: writer,
+        }
+    }
+}
+
+/// A guard of a table locked for reading.
+pub struct FdTableReadGuard<'a> {
+    table: &'a FdTable,
+    count: &'a AtomicUsize,
+}
+
+impl FdTableReadGuard<'_> {
+    fn table_files(&self) -> &Arc<OpenFiles> {
+        // SAFETY: the table is not modified while a reader is counted.
+        unsafe { &*self.table.files.get() }
+    }
+}
+
+impl Deref for FdTableReadGuard<'_> {
+    type Target = OpenFiles;
+
+    fn deref(&self) -> &OpenFiles {
+        self.table_files()
+    }
+}
+
+impl Drop for FdTableReadGuard<'_> {
+    fn drop(&mut self) {
+        self.count.fetch_sub(1, Ordering::Release);
+    }
+}
+
+/// A guard of a table locked for modification.
+pub struct FdTableWriteGuard<'a> {
+    table: &'a FdTable,
+    _writer: MutexGuard<'a, ()>,
+}
+
+impl FdTableWriteGuard<'_> {
+    fn table_files(&mut self) -> &mut Arc<OpenFiles> {
+        // SAFETY: there is no reader and no other writer.
+        unsafe { &mut *self.table.files.get() }
+    }
+
+    /// Removes all the files, returning them so that they are closed once
+    /// the table is unlocked.
+    pub fn take(&mut self) -> Arc<OpenFiles> {
+        core::mem::take(self.table_files())
+    }
+}
+
+impl Deref for FdTableWriteGuard<'_> {
+    type Target = OpenFiles;
+
+    fn deref(&self) -> &OpenFiles {
+        // SAFETY: there is no reader and no other writer.
+        unsafe { &*self.table.files.get() }
+    }
+}
+
+impl DerefMut for FdTableWriteGuard<'_> {
+    fn deref_mut(&mut self) -> &mut OpenFiles {
+        // The files are copied if they are still shared with another table.
+        Arc::make_mut(self.table_files())
+    }
+}
+
+impl Drop for FdTableWriteGuard<'_> {
+    fn drop(&mut self) {
+        self.table.writing.store(false, Ordering::Release);
+    }
+}
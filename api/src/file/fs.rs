@@ -1,60 +1,388 @@
-use core::{any::Any, ffi::c_int};
+use core::{
+    any::Any,
+    ffi::c_int,
+    sync::atomic::{AtomicU32, AtomicU64, Ordering},
+};
 
-use alloc::{string::String, sync::Arc};
-use axerrno::{LinuxError, LinuxResult};
-use axfs::fops::DirEntry;
-use axio::PollState;
-use axsync::{Mutex, MutexGuard};
-use linux_raw_sys::general::S_IFDIR;
+use alloc::{string::String, sync::Arc, vec::Vec};
+use axerrno::{AxError, AxResult, LinuxError, LinuxResult};
+use axfs::fops::{DirEntry, FileAttr};
+use axio::{PollState, SeekFrom};
+use axmm::{MappedFile, SharedPages};
+use axsync::{LockClass, Mutex, MutexGuard, RawMutex};
+use linux_raw_sys::general::O_APPEND;
+use memory_addr::PAGE_SIZE_4K;
+use starry_core::mm::{FileKey, file_key, file_pages, mapped_file_pages};
 
-use super::{FileLike, Kstat, get_file_like};
+use super::{FileLike, Kstat, Wake, get_file_like};
 
-/// File wrapper for `axfs::fops::File`.
+/// The class of the locks of file cursors, see `/proc/lock_stat`.
+static CURSOR_LOCKS: LockClass = LockClass::new("file_cursor");
+
+/// File wrapper for `axfs::fops::File`, which is an open file description.
+///
+/// The cursor and the status flags belong to the description and are kept
+/// here, while the data and the metadata are accessed through the shared
+/// node. Only the reads, writes and seeks that use the cursor are
+/// serialized, so that positional I/O and `fstat` never wait for them.
 pub struct File {
-    inner: Mutex<axfs::fops::File>,
+    inner: axfs::fops::File,
+    /// The cursor.
+    offset: AtomicU64,
+    /// The status flags, of which only `O_APPEND` affects the file.
+    flags: AtomicU32,
+    /// Makes each use of the cursor atomic.
+    cursor: Mutex<()>,
     path: String,
 }
 
 impl File {
-    pub fn new(inner: axfs::fops::File, path: String) -> Self {
+    /// Creates an open file description of `inner`, with the status flags
+    /// `flags` of `open`.
+    pub fn new(inner: axfs::fops::File, path: String, flags: u32) -> Self {
         Self {
-            inner: Mutex::new(inner),
+            inner,
+            offset: AtomicU64::new(0),
+            flags: AtomicU32::new(flags),
+            cursor: Mutex::const_new(RawMutex::with_class(&CURSOR_LOCKS), ()),
             path,
         }
     }
 
+    /// Returns the status flags of the file.
+    pub fn flags(&self) -> u32 {
+        self.flags.load(Ordering::Relaxed)
+    }
+
+    /// Sets the status flags of the file in `mask` to `flags`.
+    pub fn set_flags(&self, mask: u32, flags: u32) {
+        let _ = self
+            .flags
+            .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |old| {
+                Some((old & !mask) | (flags & mask))
+            });
+    }
+
+    /// Returns the key of the file, see [`FileKey`].
+    fn key(&self) -> LinuxResult<FileKey> {
+        Ok(file_key(&self.inner, &self.path)?)
+    }
+
+    /// Returns the cached pages of the file if it is mapped shared, which
+    /// must be kept coherent with its content in the page cache.
+    fn mapped_pages(&self) -> Option<Arc<SharedPages>> {
+        self.key().ok().and_then(mapped_file_pages)
+    }
+
+    /// Reads the file at `offset`, including the changes made through its
+    /// shared mappings that are not written back yet.
+    fn read_coherent(
+        &self,
+        pages: Option<&SharedPages>,
+        offset: u64,
+        buf: &mut [u8],
+    ) -> AxResult<usize> {
+        let read = self.inner.read_at(offset, buf)?;
+        if let Some(pages) = pages {
+            pages.read_dirty(offset as usize, &mut buf[..read]);
+        }
+        Ok(read)
+    }
+
+    /// Runs `modify`, which changes the file range `[start, end)` other than
+    /// through the mappings of the file.
+    ///
+    /// The changes made through the shared mappings are written back first,
+    /// and the cached pages are read again after, so that both see the same
+    /// content.
+    fn modify<T>(
+        &self,
+        start: u64,
+        end: u64,
+        modify: impl FnOnce() -> LinuxResult<T>,
+    ) -> LinuxResult<T> {
+        let Some(pages) = self.mapped_pages() else {
+            return modify();
+        };
+        pages.sync(start as usize, end as usize)?;
+        let result = modify();
+        pages.reload(start as usize, end as usize);
+        result
+    }
+
+    /// Reads at the cursor into the buffers in order, and advances it.
+    fn read_cursor(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
+        let pages = self.mapped_pages();
+        let _cursor = self.cursor.lock();
+        let mut offset = self.offset.load(Ordering::Relaxed);
+        let mut total = 0;
+        for buf in bufs {
+            let read = match self.read_coherent(pages.as_deref(), offset, buf) {
+                Ok(read) => read,
+                Err(_) if total > 0 => break,
+                Err(e) => return Err(e.into()),
+            };
+            total += read;
+            offset += read as u64;
+            if read < buf.len() {
+                break;
+            }
+        }
+        self.offset.store(offset, Ordering::Relaxed);
+        Ok(total)
+    }
+
+    /// Writes the buffers in order at the cursor, or at the end of the file
+    /// with `O_APPEND`, and advances the cursor.
+    fn write_cursor(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
+        let _cursor = self.cursor.lock();
+        let start = if self.flags() & O_APPEND != 0 {
+            self.inner.get_attr()?.size()
+        } else {
+            self.offset.load(Ordering::Relaxed)
+        };
+        let len = bufs.iter().map(|buf| buf.len() as u64).sum::<u64>();
+        let total = self.modify(start, start + len, || {
+            let mut offset = start;
+            let mut total = 0;
+            for buf in bufs {
+                let written = match self.inner.write_at(offset, buf) {
+                    Ok(written) => written,
+                    Err(_) if total > 0 => break,
+                    Err(e) => return Err(e.into()),
+                };
+                total += written;
+                offset += written as u64;
+                if written < buf.len() {
+                    break;
+                }
+            }
+            Ok(total)
+        })?;
+        self.offset.store(start + total as u64, Ordering::Relaxed);
+        Ok(total)
+    }
+
+    /// Moves the cursor, returning its new position.
+    pub fn seek(&self, pos: SeekFrom) -> LinuxResult<u64> {
+        let offset = match pos {
+            SeekFrom::Start(offset) => Some(offset),
+            // Reading the cursor needs no lock.
+            SeekFrom::Current(0) => return Ok(self.offset.load(Ordering::Relaxed)),
+            SeekFrom::Current(off) => {
+                let _cursor = self.cursor.lock();
+                let offset = self
+                    .offset
+                    .load(Ordering::Relaxed)
+                    .checked_add_signed(off)
+                    .ok_or(LinuxError::EINVAL)?;
+                self.offset.store(offset, Ordering::Relaxed);
+                return Ok(offset);
+            }
+            SeekFrom::End(off) => self.inner.get_attr()?.size().checked_add_signed(off),
+        }
+        .ok_or(LinuxError::EINVAL)?;
+        let _cursor = self.cursor.lock();
+        self.offset.store(offset, Ordering::Relaxed);
+        Ok(offset)
+    }
+
+    /// Writes the data of the file to the device.
+    pub fn flush(&self) -> LinuxResult {
+        Ok(self.inner.flush()?)
+    }
+
+    /// Reads the file at `offset`, without using or moving the cursor.
+    ///
+    /// Positional reads and writes do not take the lock of the cursor, so
+    /// that threads can access the same file in parallel.
+    pub fn pread(&self, offset: u64, buf: &mut [u8]) -> LinuxResult<usize> {
+        Ok(self.read_coherent(self.mapped_pages().as_deref(), offset, buf)?)
+    }
+
+    /// Writes the file at `offset`, without using or moving the cursor.
+    pub fn pwrite(&self, offset: u64, buf: &[u8]) -> LinuxResult<usize> {
+        self.modify(offset, offset + buf.len() as u64, || {
+            Ok(self.inner.write_at(offset, buf)?)
+        })
+    }
+
+    /// Sets the size of the file to `size`.
+    pub fn truncate(&self, size: u64) -> LinuxResult {
+        let start = size.min(self.inner.get_attr()?.size());
+        self.modify(start, u64::MAX, || Ok(self.inner.truncate(size)?))
+    }
+
+    /// Makes the shared mappings of the file see that it has been truncated
+    /// when opened with `O_TRUNC`.
+    pub fn opened_truncated(&self) {
+        if let Some(pages) = self.mapped_pages() {
+            pages.reload(0, usize::MAX);
+        }
+    }
+
+    /// Passes the data of `len` bytes of the file at `offset`, or at the cursor
+    /// if it is `None`, to `send` straight from the page cache, and advances
+    /// the offset by the number of bytes `send` takes.
+    ///
+    /// Each page is pinned while it is sent, so that no lock of the file is
+    /// held across `send` except that of the cursor. Fails with `EOPNOTSUPP`
+    /// if the file is not cached.
+    pub fn send_pages(
+        &self,
+        offset: Option<&mut u64>,
+        len: usize,
+        mut send: impl FnMut(&[u8]) -> LinuxResult<usize>,
+    ) -> LinuxResult<usize> {
+        let pages = self.mapped_pages();
+        let _cursor = offset.is_none().then(|| self.cursor.lock());
+        let mut pos = match &offset {
+            Some(offset) => **offset,
+            None => self.offset.load(Ordering::Relaxed),
+        };
+        let mut total = 0;
+        let result: LinuxResult = (|| {
+            while total < len {
+                // The cache must hold what has been written through the
+                // mappings.
+                if let Some(pages) = &pages {
+                    let start = pos as usize / PAGE_SIZE_4K * PAGE_SIZE_4K;
+                    pages.sync(start, start + PAGE_SIZE_4K)?;
+                }
+                let page = self.inner.pin_page(pos).map_err(|e| match e {
+                    AxError::Unsupported => LinuxError::EOPNOTSUPP,
+                    e => e.into(),
+                })?;
+                let Some(page) = page else {
+                    break;
+                };
+                let data = &page[..page.len().min(len - total)];
+                let sent = send(data)?;
+                total += sent;
+                pos += sent as u64;
+                if sent < data.len() {
+                    break;
+                }
+            }
+            Ok(())
+        })();
+        match offset {
+            Some(offset) => *offset = pos,
+            None => self.offset.store(pos, Ordering::Relaxed),
+        }
+        match result {
+            Err(e) if total == 0 => Err(e),
+            _ => Ok(total),
+        }
+    }
+
+    /// Copies `len` bytes of the file at `offset` to `dst` at `dst_offset` in
+    /// the kernel, returning the number of bytes copied.
+    pub fn copy_range(
+        &self,
+        offset: u64,
+        dst: &File,
+        dst_offset: u64,
+        len: u64,
+    ) -> LinuxResult<u64> {
+        if let Some(pages) = self.mapped_pages() {
+            pages.sync(offset as usize, (offset + len) as usize)?;
+        }
+        dst.modify(dst_offset, dst_offset + len, || {
+            Ok(self.inner.copy_range(offset, &dst.inner, dst_offset, len)?)
+        })
+    }
+
+    /// Allocates the space of a range of the file, extending it if needed.
+    pub fn allocate(&self, offset: u64, len: u64) -> LinuxResult {
+        Ok(self.inner.allocate(offset, len)?)
+    }
+
+    /// Makes a range of the file read as zeros, without changing its size.
+    pub fn zero_range(&self, offset: u64, len: u64) -> LinuxResult {
+        self.modify(offset, offset + len, || {
+            Ok(self.inner.zero_range(offset, len)?)
+        })
+    }
+
+    /// Declares the expected access pattern of a range of the file, which
+    /// tunes its readahead.
+    pub fn advise(&self, offset: u64, len: u64, advice: axfs::fops::Advice) -> LinuxResult {
+        Ok(self.inner.advise(offset, len, advice)?)
+    }
+
+    /// Writes the cached data of the file to the device.
+    pub fn sync(&self) -> LinuxResult {
+        Ok(self.inner.sync()?)
+    }
+
+    /// Writes the cached data of `len` bytes at `offset` (to the end of the
+    /// file if `len` is 0) back to the filesystem.
+    pub fn sync_range(&self, offset: u64, len: u64) -> LinuxResult {
+        Ok(self.inner.sync_range(offset, len)?)
+    }
+
     /// Get the path of the file.
     pub fn path(&self) -> &str {
         &self.path
     }
 
-    /// Get the inner node of the file.
-    pub fn inner(&self) -> MutexGuard<axfs::fops::File> {
-        self.inner.lock()
+    /// Get the cached pages shared by all the mappings of the file.
+    ///
+    /// If `writable`, the pages are written back through this file, which
+    /// must then be opened for writing.
+    pub fn shared_pages(self: &Arc<Self>, writable: bool) -> LinuxResult<Arc<SharedPages>> {
+        if writable && !self.inner.is_writable() {
+            return Err(LinuxError::EACCES);
+        }
+        let pages = file_pages(self.key()?, &self.path, || self.clone());
+        if writable {
+            pages.set_writer(self.clone());
+        }
+        Ok(pages)
+    }
+}
+
+impl MappedFile for File {
+    fn read_at(&self, offset: u64, buf: &mut [u8]) -> AxResult<usize> {
+        self.inner.read_at(offset, buf)
+    }
+
+    fn write_at(&self, offset: u64, buf: &[u8]) -> AxResult<usize> {
+        self.inner.write_at(offset, buf)
+    }
+
+    fn size(&self) -> AxResult<u64> {
+        Ok(self.inner.get_attr()?.size())
     }
 }
 
 impl FileLike for File {
     fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
-        Ok(self.inner().read(buf)?)
+        self.read_cursor(&mut [buf])
     }
 
     fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
-        Ok(self.inner().write(buf)?)
+        self.write_cursor(&[buf])
+    }
+
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
+        self.read_cursor(bufs)
+    }
+
+    fn write_vectored(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
+        self.write_cursor(bufs)
     }
 
     fn stat(&self) -> LinuxResult<Kstat> {
-        let metadata = self.inner().get_attr()?;
-        let ty = metadata.file_type() as u8;
-        let perm = metadata.perm().bits() as u32;
-
-        Ok(Kstat {
-            mode: ((ty as u32) << 12) | perm,
-            size: metadata.size(),
-            blocks: metadata.blocks(),
-            blksize: 512,
-            ..Default::default()
-        })
+        // Cached files keep their attributes, which takes neither the cursor
+        // nor the filesystem.
+        let attr = self.inner.get_attr()?;
+        let info = match self.inner.info() {
+            Some(info) => info,
+            None => axfs::api::file_info(&self.path)?,
+        };
+        Ok(Kstat::from_attr(&attr, &info))
     }
 
     fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
@@ -69,15 +397,58 @@ impl FileLike for File {
     }
 
     fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        // Regular files never block, as on Linux.
         Ok(())
     }
+
+    fn register_waker(&self, _waker: &Arc<dyn Wake>) -> bool {
+        // Regular files are always ready.
+        true
+    }
+}
+
+/// Returns the status of the file at `path`, without opening it.
+pub fn stat_path(path: &str) -> LinuxResult<Kstat> {
+    let metadata = axfs::api::metadata(path)?;
+    let attr = FileAttr::new(
+        metadata.permissions(),
+        metadata.file_type(),
+        metadata.size(),
+        metadata.blocks(),
+    );
+    let info = axfs::api::file_info(path)?;
+    Ok(Kstat::from_attr(&attr, &info))
+}
+
+/// Returns the status of the symbolic link at `path`, or of the file there
+/// if it is not one.
+pub fn lstat_path(path: &str) -> LinuxResult<Kstat> {
+    match axfs::api::read_link(path) {
+        Ok(target) => Ok(Kstat::symlink(target.len())),
+        Err(_) => stat_path(path),
+    }
+}
+
+/// The number of directory entries read from the filesystem at once.
+const DIR_BATCH: usize = 64;
+
+/// Directory entries read from the filesystem but not returned yet.
+#[derive(Default)]
+struct DirBatch {
+    entries: Vec<DirEntry>,
+    /// The inode numbers of the entries.
+    inos: Vec<u64>,
+    /// The index of the next entry to return.
+    pos: usize,
+    /// The number of entries read.
+    len: usize,
 }
 
 /// Directory wrapper for `axfs::fops::Directory`.
 pub struct Directory {
     inner: Mutex<axfs::fops::Directory>,
     path: String,
-    last_dirent: Mutex<Option<DirEntry>>,
+    batch: Mutex<DirBatch>,
 }
 
 impl Directory {
@@ -85,7 +456,7 @@ impl Directory {
         Self {
             inner: Mutex::new(inner),
             path,
-            last_dirent: Mutex::new(None),
+            batch: Mutex::new(DirBatch::default()),
         }
     }
 
@@ -99,9 +470,52 @@ impl Directory {
         self.inner.lock()
     }
 
-    /// Get the last directory entry.
-    pub fn last_dirent(&self) -> MutexGuard<Option<DirEntry>> {
-        self.last_dirent.lock()
+    /// Calls `f` on the next entries of the directory, with their inode number
+    /// and the position of the entry after each, until `f` returns `false`
+    /// or all the entries have been read. The entry on which `f` returned
+    /// `false` is the next one.
+    pub fn read_entries(&self, mut f: impl FnMut(&DirEntry, u64, u64) -> bool) -> LinuxResult {
+        let mut inner = self.inner.lock();
+        let mut batch = self.batch.lock();
+        let batch = &mut *batch;
+        loop {
+            if batch.pos == batch.len {
+                if batch.entries.is_empty() {
+                    batch.entries.resize_with(DIR_BATCH, DirEntry::default);
+                    batch.inos.resize(DIR_BATCH, 0);
+                }
+                batch.len = inner.read_dir_ino(&mut batch.entries, &mut batch.inos)?;
+                batch.pos = 0;
+                if batch.len == 0 {
+                    return Ok(());
+                }
+            }
+            let next = inner.position() - (batch.len - batch.pos - 1);
+            if !f(
+                &batch.entries[batch.pos],
+                batch.inos[batch.pos],
+                next as u64,
+            ) {
+                return Ok(());
+            }
+            batch.pos += 1;
+        }
+    }
+
+    /// Returns the position of the next entry to read.
+    pub fn position(&self) -> u64 {
+        let inner = self.inner.lock();
+        let batch = self.batch.lock();
+        (inner.position() - (batch.len - batch.pos)) as u64
+    }
+
+    /// Moves to the entry at `pos`, as returned by [`Self::read_entries`].
+    pub fn seek(&self, pos: u64) {
+        let mut inner = self.inner.lock();
+        let mut batch = self.batch.lock();
+        inner.seek(pos as usize);
+        batch.pos = 0;
+        batch.len = 0;
     }
 }
 
@@ -115,10 +529,7 @@ impl FileLike for Directory {
     }
 
     fn stat(&self) -> LinuxResult<Kstat> {
-        Ok(Kstat {
-            mode: S_IFDIR | 0o755u32, // rwxr-xr-x
-            ..Default::default()
-        })
+        stat_path(&self.path)
     }
 
     fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
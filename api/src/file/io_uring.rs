@@ -0,0 +1,714 @@
+use core::{
+    any::Any,
+    ffi::c_int,
+    mem::size_of,
+    sync::atomic::{AtomicBool, AtomicU32, Ordering},
+    time::Duration,
+};
+
+use alloc::{collections::VecDeque, sync::Arc, vec::Vec};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{mem::phys_to_virt, paging::MappingFlags, time::monotonic_time};
+use axio::PollState;
+use axmm::{AddrSpace, SharedPages};
+use axsync::spin::SpinNoIrq;
+use axtask::{TaskExtRef, WaitQueue, current};
+use linux_raw_sys::{
+    general::iovec,
+    io_uring::{
+        IORING_FEAT_NODROP, IORING_FEAT_SINGLE_MMAP, IORING_FEAT_SUBMIT_STABLE, IORING_OFF_CQ_RING,
+        IORING_OFF_SQ_RING, IORING_OFF_SQES, IORING_SETUP_CQSIZE, IORING_SQ_NEED_WAKEUP,
+        io_uring_op, io_uring_params,
+    },
+};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, VirtAddr, VirtAddrRange};
+use starry_core::{
+    scratch::ScratchBuf,
+    task::{register_signal_waker, unregister_signal_waker},
+};
+
+use super::{FD_TABLE, FdTable, File, FileLike, Kstat, PollWaker, PollWakers, Wake};
+use crate::signal::have_signals;
+
+/// The maximum number of submission queue entries of a ring.
+const MAX_ENTRIES: u32 = 4096;
+
+/// Offsets of the ring indices in the shared rings mapping, which holds both
+/// the submission and the completion rings (`IORING_FEAT_SINGLE_MMAP`).
+const SQ_HEAD: usize = 0;
+const SQ_TAIL: usize = 4;
+const SQ_RING_MASK: usize = 8;
+const SQ_RING_ENTRIES: usize = 12;
+const SQ_FLAGS: usize = 16;
+const SQ_DROPPED: usize = 20;
+const CQ_HEAD: usize = 32;
+const CQ_TAIL: usize = 36;
+const CQ_RING_MASK: usize = 40;
+const CQ_RING_ENTRIES: usize = 44;
+const CQ_OVERFLOW: usize = 48;
+const CQ_FLAGS: usize = 52;
+/// The completion entries, followed by the submission queue array.
+const CQES: usize = 64;
+
+/// The size of the bounce buffer used to copy data from and to user memory.
+const CHUNK_SIZE: usize = 0x10000;
+
+const OP_NOP: u8 = io_uring_op::IORING_OP_NOP as u8;
+const OP_READV: u8 = io_uring_op::IORING_OP_READV as u8;
+const OP_WRITEV: u8 = io_uring_op::IORING_OP_WRITEV as u8;
+const OP_FSYNC: u8 = io_uring_op::IORING_OP_FSYNC as u8;
+const OP_READ: u8 = io_uring_op::IORING_OP_READ as u8;
+const OP_WRITE: u8 = io_uring_op::IORING_OP_WRITE as u8;
+
+/// A submission queue entry, as laid out by the user.
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct Sqe {
+    opcode: u8,
+    flags: u8,
+    _ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    _op_flags: u32,
+    user_data: u64,
+    _pad: [u64; 3],
+}
+
+/// A completion queue entry.
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct Cqe {
+    user_data: u64,
+    res: i32,
+    flags: u32,
+}
+
+/// Pages shared with the user, which the kernel accesses through their
+/// frames, so that rings can be used from any address space.
+struct RingPages {
+    pages: Arc<SharedPages>,
+    frames: Vec<VirtAddr>,
+}
+
+impl RingPages {
+    fn new(size: usize) -> LinuxResult<Self> {
+        let pages = Arc::new(SharedPages::new(None));
+        let frames = (0..memory_addr::align_up_4k(size))
+            .step_by(PAGE_SIZE_4K)
+            .map(|offset| pages.frame(offset).map(phys_to_virt))
+            .collect::<Option<Vec<_>>>()
+            .ok_or(LinuxError::ENOMEM)?;
+        Ok(Self { pages, frames })
+    }
+
+    fn size(&self) -> usize {
+        self.frames.len() * PAGE_SIZE_4K
+    }
+
+    /// Returns a pointer to a `T` at `offset`, which must not cross a page.
+    fn ptr<T>(&self, offset: usize) -> *mut T {
+        debug_assert!(offset % PAGE_SIZE_4K + size_of::<T>() <= PAGE_SIZE_4K);
+        (self.frames[offset / PAGE_SIZE_4K] + offset % PAGE_SIZE_4K).as_mut_ptr_of::<T>()
+    }
+
+    fn atomic(&self, offset: usize) -> &AtomicU32 {
+        // SAFETY: the frames are owned by `pages` and live as long as `self`.
+        unsafe { AtomicU32::from_ptr(self.ptr(offset)) }
+    }
+}
+
+/// Returns the file to access at `off`, unless `off` is `-1` or the file has
+/// no offsets, in which case the file offset is used.
+fn positional_file(file: &Arc<dyn FileLike>, off: u64) -> Option<Arc<File>> {
+    if off == u64::MAX {
+        return None;
+    }
+    file.clone().into_any().downcast::<File>().ok()
+}
+
+/// An operation submitted to a ring, with its file resolved.
+struct Request {
+    opcode: u8,
+    file: Option<Arc<dyn FileLike>>,
+    off: u64,
+    addr: usize,
+    len: usize,
+    user_data: u64,
+}
+
+struct RingInner {
+    rings: RingPages,
+    sqes: RingPages,
+    sq_entries: u32,
+    cq_entries: u32,
+    /// Whether the worker polls the submission queue (`IORING_SETUP_SQPOLL`).
+    sq_poll: bool,
+    /// How long the polling worker spins before going to sleep.
+    sq_idle: Duration,
+    /// Whether completions are waited for by spinning (`IORING_SETUP_IOPOLL`).
+    io_poll: bool,
+    /// The file descriptor table the submitted `fd`s refer to.
+    fd_table: Arc<FdTable>,
+    /// The address space of the buffers.
+    aspace: Arc<axsync::RwLock<AddrSpace>>,
+    /// Serializes the consumers of the submission queue.
+    submit_lock: SpinNoIrq<()>,
+    pending: SpinNoIrq<VecDeque<Request>>,
+    /// Completions that did not fit in the completion queue.
+    overflow: SpinNoIrq<VecDeque<Cqe>>,
+    closed: AtomicBool,
+    work_wq: WaitQueue,
+    wakers: PollWakers,
+}
+
+impl RingInner {
+    fn sq_array(&self) -> usize {
+        CQES + self.cq_entries as usize * size_of::<Cqe>()
+    }
+
+    fn sq_pending(&self) -> u32 {
+        let head = self.rings.atomic(SQ_HEAD).load(Ordering::Relaxed);
+        let tail = self.rings.atomic(SQ_TAIL).load(Ordering::Acquire);
+        tail.wrapping_sub(head)
+    }
+
+    fn cq_ready(&self) -> u32 {
+        let head = self.rings.atomic(CQ_HEAD).load(Ordering::Acquire);
+        let tail = self.rings.atomic(CQ_TAIL).load(Ordering::Relaxed);
+        tail.wrapping_sub(head)
+    }
+
+    /// Consumes up to `count` entries of the submission queue, returning the
+    /// number of entries consumed.
+    fn submit(&self, count: u32) -> u32 {
+        let _guard = self.submit_lock.lock();
+        let head = self.rings.atomic(SQ_HEAD).load(Ordering::Relaxed);
+        let count = count.min(self.sq_pending());
+        let mask = self.sq_entries - 1;
+        let array = self.sq_array();
+        let mut queued = 0;
+        for i in 0..count {
+            let slot = head.wrapping_add(i) & mask;
+            let index = self
+                .rings
+                .atomic(array + slot as usize * 4)
+                .load(Ordering::Relaxed);
+            if index >= self.sq_entries {
+                self.rings
+                    .atomic(SQ_DROPPED)
+                    .fetch_add(1, Ordering::Relaxed);
+                continue;
+            }
+            // SAFETY: the entry lies in `sqes` and is only read.
+            let sqe: Sqe = unsafe {
+                self.sqes
+                    .ptr::<Sqe>(index as usize * size_of::<Sqe>())
+                    .read_volatile()
+            };
+            match self.prepare(&sqe) {
+                Ok(request) => {
+                    self.pending.lock().push_back(request);
+                    queued += 1;
+                }
+                Err(e) => self.complete(sqe.user_data, Err(e)),
+            }
+        }
+        // The entries have been copied, so the user may reuse them.
+        self.rings
+            .atomic(SQ_HEAD)
+            .store(head.wrapping_add(count), Ordering::Release);
+        if queued > 0 {
+            self.work_wq.notify_one(true);
+        }
+        count
+    }
+
+    fn prepare(&self, sqe: &Sqe) -> LinuxResult<Request> {
+        if sqe.flags != 0 {
+            // Links, drains and fixed files are not supported.
+            return Err(LinuxError::EINVAL);
+        }
+        let file = match sqe.opcode {
+            OP_NOP => None,
+            OP_READV | OP_WRITEV | OP_FSYNC | OP_READ | OP_WRITE => Some(
+                self.fd_table
+                    .get(sqe.fd as usize)
+                    .ok_or(LinuxError::EBADF)?,
+            ),
+            _ => return Err(LinuxError::EINVAL),
+        };
+        Ok(Request {
+            opcode: sqe.opcode,
+            file,
+            off: sqe.off,
+            addr: sqe.addr as usize,
+            len: sqe.len as usize,
+            user_data: sqe.user_data,
+        })
+    }
+
+    /// Posts a completion, or queues it if the completion queue is full.
+    fn complete(&self, user_data: u64, res: LinuxResult<usize>) {
+        let res = match res {
+            Ok(n) => n as i32,
+            Err(e) => -e.code(),
+        };
+        let mut overflow = self.overflow.lock();
+        overflow.push_back(Cqe {
+            user_data,
+            res,
+            flags: 0,
+        });
+        self.flush_overflow(&mut overflow);
+        drop(overflow);
+        self.wakers.wake_all();
+    }
+
+    /// Moves completions from `overflow` to the completion queue while there
+    /// is room.
+    fn flush_overflow(&self, overflow: &mut VecDeque<Cqe>) {
+        let tail = self.rings.atomic(CQ_TAIL).load(Ordering::Relaxed);
+        let mut posted = 0;
+        while self.cq_ready() + posted < self.cq_entries {
+            let Some(cqe) = overflow.pop_front() else {
+                break;
+            };
+            let slot = tail.wrapping_add(posted) & (self.cq_entries - 1);
+            // SAFETY: the entry lies in `rings`, and the user does not read
+            // it before the tail is updated.
+            unsafe {
+                self.rings
+                    .ptr::<Cqe>(CQES + slot as usize * size_of::<Cqe>())
+                    .write_volatile(cqe)
+            };
+            posted += 1;
+        }
+        if posted > 0 {
+            self.rings
+                .atomic(CQ_TAIL)
+                .store(tail.wrapping_add(posted), Ordering::Release);
+        }
+    }
+
+    /// Copies `buf` to the user address `addr`, or the other way around if
+    /// `to_user` is not set.
+    ///
+    /// The pages are populated first and copied through their frames, since
+    /// the worker does not run in the address space of the user.
+    fn copy_user(&self, addr: usize, buf: &mut [u8], to_user: bool) -> LinuxResult {
+        if buf.is_empty() {
+            return Ok(());
+        }
+        let start = VirtAddr::from(addr);
+        let flags = if to_user {
+            MappingFlags::WRITE
+        } else {
+            MappingFlags::READ
+        };
+        let aspace = self.aspace.read();
+        if !aspace.check_region_access(VirtAddrRange::from_start_size(start, buf.len()), flags) {
+            return Err(LinuxError::EFAULT);
+        }
+        let page_start = start.align_down_4k();
+        let page_end = (start + buf.len()).align_up_4k();
+        aspace.populate_area(page_start, page_end - page_start, flags)?;
+        if to_user {
+            aspace.write(start, buf)?;
+        } else {
+            aspace.read(start, buf)?;
+        }
+        Ok(())
+    }
+
+    /// Reads `file` into the user buffer, at `off` unless it is `-1`.
+    ///
+    /// The address space is not locked while the file is read, which may
+    /// block.
+    fn read_to_user(
+        &self,
+        file: &Arc<dyn FileLike>,
+        addr: usize,
+        len: usize,
+        off: u64,
+    ) -> LinuxResult<usize> {
+        let positional = positional_file(file, off);
+        let mut buf = ScratchBuf::new(len.min(CHUNK_SIZE));
+        let mut total = 0;
+        while total < len {
+            let chunk = &mut buf[..(len - total).min(CHUNK_SIZE)];
+            let read = match &positional {
+                Some(file) => file.pread(off + total as u64, chunk)?,
+                None => file.read(chunk)?,
+            };
+            self.copy_user(addr + total, &mut chunk[..read], true)?;
+            total += read;
+            if read < chunk.len() {
+                break;
+            }
+        }
+        Ok(total)
+    }
+
+    /// Writes the user buffer to `file`, at `off` unless it is `-1`.
+    fn write_from_user(
+        &self,
+        file: &Arc<dyn FileLike>,
+        addr: usize,
+        len: usize,
+        off: u64,
+    ) -> LinuxResult<usize> {
+        let positional = positional_file(file, off);
+        let mut buf = ScratchBuf::new(len.min(CHUNK_SIZE));
+        let mut total = 0;
+        while total < len {
+            let chunk = &mut buf[..(len - total).min(CHUNK_SIZE)];
+            self.copy_user(addr + total, chunk, false)?;
+            let written = match &positional {
+                Some(file) => file.pwrite(off + total as u64, chunk)?,
+                None => file.write(chunk)?,
+            };
+            total += written;
+            if written < chunk.len() {
+                break;
+            }
+        }
+        Ok(total)
+    }
+
+    fn read_iovecs(&self, addr: usize, count: usize) -> LinuxResult<Vec<iovec>> {
+        if count > 1024 {
+            return Err(LinuxError::EINVAL);
+        }
+        let mut bytes = ScratchBuf::new(count * size_of::<iovec>());
+        self.copy_user(addr, &mut bytes, false)?;
+        Ok(bytes
+            .chunks_exact(size_of::<iovec>())
+            // SAFETY: `iovec` is plain old data.
+            .map(|chunk| unsafe { chunk.as_ptr().cast::<iovec>().read_unaligned() })
+            .collect())
+    }
+
+    fn execute(&self, request: &Request) -> LinuxResult<usize> {
+        let Some(file) = &request.file else {
+            return Ok(0);
+        };
+        let (addr, len, off) = (request.addr, request.len, request.off);
+        match request.opcode {
+            OP_READ => self.read_to_user(file, addr, len, off),
+            OP_WRITE => self.write_from_user(file, addr, len, off),
+            OP_READV => {
+                let mut total = 0;
+                for iov in self.read_iovecs(addr, len)? {
+                    let len = iov.iov_len as usize;
+                    let off = if off == u64::MAX {
+                        off
+                    } else {
+                        off + total as u64
+                    };
+                    let read = self.read_to_user(file, iov.iov_base as usize, len, off)?;
+                    total += read;
+                    if read < len {
+                        break;
+                    }
+                }
+                Ok(total)
+            }
+            OP_WRITEV => {
+                let mut total = 0;
+                for iov in self.read_iovecs(addr, len)? {
+                    let len = iov.iov_len as usize;
+                    let off = if off == u64::MAX {
+                        off
+                    } else {
+                        off + total as u64
+                    };
+                    let written = self.write_from_user(file, iov.iov_base as usize, len, off)?;
+                    total += written;
+                    if written < len {
+                        break;
+                    }
+                }
+                Ok(total)
+            }
+            _ => {
+                // OP_FSYNC
+                if let Ok(file) = file.clone().into_any().downcast::<File>() {
+                    file.flush()?;
+                }
+                Ok(0)
+            }
+        }
+    }
+
+    /// Whether the worker has something to do.
+    fn has_work(&self) -> bool {
+        self.closed.load(Ordering::Acquire)
+            || !self.pending.lock().is_empty()
+            || (self.sq_poll && self.sq_pending() > 0)
+    }
+
+    /// The worker task of the ring, which completes the submitted requests
+    /// one at a time and, with `IORING_SETUP_SQPOLL`, polls the submission
+    /// queue so that the user does not need to enter the kernel.
+    fn worker(self: Arc<Self>) {
+        let mut idle_since = monotonic_time();
+        while !self.closed.load(Ordering::Acquire) {
+            if self.sq_poll {
+                self.submit(u32::MAX);
+            }
+            let request = self.pending.lock().pop_front();
+            if let Some(request) = request {
+                let res = self.execute(&request);
+                self.complete(request.user_data, res);
+                idle_since = monotonic_time();
+                continue;
+            }
+            if self.sq_poll && monotonic_time() - idle_since < self.sq_idle {
+                axtask::yield_now();
+                continue;
+            }
+
+            // Ask for a wake-up, then check again for entries submitted in the
+            // meantime.
+            let flags = self.rings.atomic(SQ_FLAGS);
+            if self.sq_poll {
+                flags.fetch_or(IORING_SQ_NEED_WAKEUP, Ordering::SeqCst);
+            }
+            self.work_wq.wait_until(|| self.has_work());
+            if self.sq_poll {
+                flags.fetch_and(!IORING_SQ_NEED_WAKEUP, Ordering::SeqCst);
+            }
+            idle_since = monotonic_time();
+        }
+        debug!("io_uring worker exits");
+    }
+}
+
+/// An io_uring instance created by `io_uring_setup`.
+///
+/// The submission and completion rings are shared with the user, who maps
+/// them with `mmap`. Submitted requests are completed by a worker task of
+/// the ring, so that a single `io_uring_enter`, or none at all with
+/// `IORING_SETUP_SQPOLL`, moves many operations, and completions can be
+/// polled from the completion ring.
+pub struct IoUring {
+    inner: Arc<RingInner>,
+}
+
+impl IoUring {
+    /// Creates a ring with at least `entries` submission queue entries, and
+    /// fills in `params` for the user.
+    pub fn new(
+        entries: u32,
+        params: &mut io_uring_params,
+        sq_poll: bool,
+        io_poll: bool,
+    ) -> LinuxResult<Self> {
+        if entries == 0 || entries > MAX_ENTRIES {
+            return Err(LinuxError::EINVAL);
+        }
+        let sq_entries = entries.next_power_of_two();
+        let cq_entries = if params.flags & IORING_SETUP_CQSIZE != 0 {
+            if params.cq_entries < sq_entries || params.cq_entries > 2 * MAX_ENTRIES {
+                return Err(LinuxError::EINVAL);
+            }
+            params.cq_entries.next_power_of_two()
+        } else {
+            2 * sq_entries
+        };
+
+        let sq_array = CQES + cq_entries as usize * size_of::<Cqe>();
+        let rings = RingPages::new(sq_array + sq_entries as usize * 4)?;
+        let sqes = RingPages::new(sq_entries as usize * size_of::<Sqe>())?;
+        for (offset, value) in [
+            (SQ_RING_MASK, sq_entries - 1),
+            (SQ_RING_ENTRIES, sq_entries),
+            (CQ_RING_MASK, cq_entries - 1),
+            (CQ_RING_ENTRIES, cq_entries),
+        ] {
+            rings.atomic(offset).store(value, Ordering::Relaxed);
+        }
+
+        let sq_idle = match params.sq_thread_idle {
+            0 => Duration::from_secs(1),
+            ms => Duration::from_millis(ms as u64),
+        };
+        let inner = Arc::new(RingInner {
+            rings,
+            sqes,
+            sq_entries,
+            cq_entries,
+            sq_poll,
+            sq_idle,
+            io_poll,
+            fd_table: FD_TABLE.share(),
+            aspace: current().task_ext().process_data().aspace(),
+            submit_lock: SpinNoIrq::new(()),
+            pending: SpinNoIrq::new(VecDeque::new()),
+            overflow: SpinNoIrq::new(VecDeque::new()),
+            closed: AtomicBool::new(false),
+            work_wq: WaitQueue::new(),
+            wakers: PollWakers::new(),
+        });
+        let worker = inner.clone();
+        axtask::spawn_raw(
+            move || worker.worker(),
+            "io_uring".into(),
+            axconfig::TASK_STACK_SIZE,
+        );
+
+        params.sq_entries = sq_entries;
+        params.cq_entries = cq_entries;
+        params.features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE;
+        let sq_off = &mut params.sq_off;
+        sq_off.head = SQ_HEAD as _;
+        sq_off.tail = SQ_TAIL as _;
+        sq_off.ring_mask = SQ_RING_MASK as _;
+        sq_off.ring_entries = SQ_RING_ENTRIES as _;
+        sq_off.flags = SQ_FLAGS as _;
+        sq_off.dropped = SQ_DROPPED as _;
+        sq_off.array = sq_array as _;
+        let cq_off = &mut params.cq_off;
+        cq_off.head = CQ_HEAD as _;
+        cq_off.tail = CQ_TAIL as _;
+        cq_off.ring_mask = CQ_RING_MASK as _;
+        cq_off.ring_entries = CQ_RING_ENTRIES as _;
+        cq_off.overflow = CQ_OVERFLOW as _;
+        cq_off.cqes = CQES as _;
+        cq_off.flags = CQ_FLAGS as _;
+        Ok(Self { inner })
+    }
+
+    /// Returns the pages to map at the `mmap` offset `offset` of the ring.
+    pub fn mmap_pages(&self, offset: usize, length: usize) -> LinuxResult<Arc<SharedPages>> {
+        let pages = match offset as u32 {
+            IORING_OFF_SQ_RING | IORING_OFF_CQ_RING => &self.inner.rings,
+            IORING_OFF_SQES => &self.inner.sqes,
+            _ => return Err(LinuxError::EINVAL),
+        };
+        if length > pages.size() {
+            return Err(LinuxError::EINVAL);
+        }
+        Ok(pages.pages.clone())
+    }
+
+    /// Whether the submission queue is polled by the worker task.
+    pub fn sq_poll(&self) -> bool {
+        self.inner.sq_poll
+    }
+
+    /// Submits up to `count` entries from the submission queue, returning the
+    /// number of entries consumed.
+    pub fn submit(&self, count: u32) -> u32 {
+        self.inner.submit(count)
+    }
+
+    /// Wakes up the polling worker (`IORING_ENTER_SQ_WAKEUP`).
+    pub fn wake_worker(&self) {
+        self.inner.work_wq.notify_one(true);
+    }
+
+    /// Waits until the submission queue has free entries
+    /// (`IORING_ENTER_SQ_WAIT`).
+    pub fn wait_sq_space(&self) {
+        while self.inner.sq_pending() >= self.inner.sq_entries {
+            axtask::yield_now();
+        }
+    }
+
+    /// Waits until there are at least `min_complete` completions to reap.
+    ///
+    /// With `IORING_SETUP_IOPOLL` the caller spins instead of sleeping.
+    pub fn wait_completions(&self, min_complete: u32) -> LinuxResult {
+        let inner = &self.inner;
+        let min_complete = min_complete.min(inner.cq_entries);
+        let ready = || {
+            let mut overflow = inner.overflow.lock();
+            if !overflow.is_empty() {
+                inner.flush_overflow(&mut overflow);
+            }
+            inner.cq_ready() >= min_complete
+        };
+        if ready() {
+            return Ok(());
+        }
+
+        let waker = PollWaker::new();
+        let as_wake: Arc<dyn Wake> = waker.clone();
+        let signal_waker = waker.signal_waker();
+        inner.wakers.register(&as_wake);
+        register_signal_waker(&signal_waker);
+        let res = loop {
+            waker.reset();
+            if ready() {
+                break Ok(());
+            }
+            if have_signals() {
+                break Err(LinuxError::EINTR);
+            }
+            if inner.io_poll {
+                axtask::yield_now();
+            } else {
+                waker.wait(None);
+            }
+        };
+        unregister_signal_waker(&signal_waker);
+        inner.wakers.unregister(&as_wake);
+        res
+    }
+
+    /// Returns the ring of the file descriptor `fd`.
+    pub fn from_ring_fd(fd: c_int) -> LinuxResult<Arc<Self>> {
+        Self::from_fd(fd).map_err(|_| LinuxError::EOPNOTSUPP)
+    }
+}
+
+impl Drop for IoUring {
+    fn drop(&mut self) {
+        self.inner.closed.store(true, Ordering::Release);
+        self.inner.work_wq.notify_all(true);
+    }
+}
+
+impl FileLike for IoUring {
+    fn read(&self, _buf: &mut [u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: 0o600u32, // rw-------
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: self.inner.cq_ready() > 0,
+            writable: self.inner.sq_pending() < self.inner.sq_entries,
+        })
+    }
+
+    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.inner.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.inner.wakers.unregister(waker);
+    }
+}
@@ -0,0 +1,215 @@
+use core::{
+    any::Any,
+    sync::atomic::{AtomicU32, Ordering},
+};
+
+use alloc::{string::String, sync::Arc};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::mem::phys_to_virt;
+use axio::{PollState, SeekFrom};
+use axmm::SharedPages;
+use axsync::Mutex;
+use linux_raw_sys::general::{
+    F_SEAL_FUTURE_WRITE, F_SEAL_GROW, F_SEAL_SEAL, F_SEAL_SHRINK, F_SEAL_WRITE, S_IFREG,
+};
+use memory_addr::PAGE_SIZE_4K;
+
+use super::{FileLike, Kstat};
+
+/// The seals that can be added to a memfd.
+const ALL_SEALS: u32 =
+    F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_FUTURE_WRITE;
+
+/// An anonymous file in memory created by `memfd_create`.
+///
+/// Its content is kept in the frames of its [`SharedPages`], which are mapped
+/// as they are by all the `MAP_SHARED` mappings of the file, in any process,
+/// and which `read` and `write` access directly. Data written by a process is
+/// thus seen by the others without being copied or written back.
+pub struct MemFd {
+    name: String,
+    pages: Arc<SharedPages>,
+    /// The size of the file. Its lock also serializes the writes and the
+    /// changes of size.
+    size: Mutex<u64>,
+    /// The cursor.
+    offset: Mutex<u64>,
+    seals: AtomicU32,
+}
+
+impl MemFd {
+    /// Creates an empty file named `name`, which can only be sealed if
+    /// `allow_sealing`.
+    pub fn new(name: &str, allow_sealing: bool) -> Self {
+        Self {
+            name: String::from(name),
+            pages: Arc::new(SharedPages::new(None)),
+            size: Mutex::new(0),
+            offset: Mutex::new(0),
+            seals: AtomicU32::new(if allow_sealing { 0 } else { F_SEAL_SEAL }),
+        }
+    }
+
+    /// Returns the name given to `memfd_create`.
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    /// Returns the pages of the file, to be mapped.
+    pub fn shared_pages(&self) -> Arc<SharedPages> {
+        self.pages.clone()
+    }
+
+    /// Returns the seals of the file.
+    pub fn seals(&self) -> u32 {
+        self.seals.load(Ordering::Relaxed)
+    }
+
+    /// Adds `seals` to the seals of the file.
+    ///
+    /// The file cannot be sealed against writes while it is mapped, as the
+    /// mappings may be writable.
+    pub fn add_seals(&self, seals: u32) -> LinuxResult {
+        if seals & !ALL_SEALS != 0 {
+            return Err(LinuxError::EINVAL);
+        }
+        // Writes and mappings check the seals with the lock held.
+        let _size = self.size.lock();
+        let old = self.seals();
+        if old & F_SEAL_SEAL != 0 {
+            return Err(LinuxError::EPERM);
+        }
+        if seals & F_SEAL_WRITE != 0 && Arc::strong_count(&self.pages) > 1 {
+            return Err(LinuxError::EBUSY);
+        }
+        self.seals.store(old | seals, Ordering::Relaxed);
+        Ok(())
+    }
+
+    /// Checks that the file may be mapped, writable if `writable`.
+    pub fn check_map(&self, writable: bool) -> LinuxResult {
+        if writable && self.seals() & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE) != 0 {
+            return Err(LinuxError::EPERM);
+        }
+        Ok(())
+    }
+
+    /// Copies `len` bytes of the file at `offset` through `f`, one page at a
+    /// time, with the position of each piece from `offset`.
+    fn access(&self, offset: u64, len: usize, mut f: impl FnMut(&mut [u8], usize)) -> LinuxResult {
+        let mut done = 0;
+        while done < len {
+            let pos = offset as usize + done;
+            let (page_offset, start) = (pos & !(PAGE_SIZE_4K - 1), pos % PAGE_SIZE_4K);
+            let n = (PAGE_SIZE_4K - start).min(len - done);
+            let frame = self.pages.frame(page_offset).ok_or(LinuxError::ENOMEM)?;
+            // SAFETY: the frame is owned by the pages, which outlive the copy.
+            let page = unsafe {
+                core::slice::from_raw_parts_mut(phys_to_virt(frame).as_mut_ptr(), PAGE_SIZE_4K)
+            };
+            f(&mut page[start..start + n], done);
+            done += n;
+        }
+        Ok(())
+    }
+
+    /// Reads the file at `offset`, without using or moving the cursor.
+    pub fn pread(&self, offset: u64, buf: &mut [u8]) -> LinuxResult<usize> {
+        let size = *self.size.lock();
+        let len = size.saturating_sub(offset).min(buf.len() as u64) as usize;
+        self.access(offset, len, |page, pos| {
+            buf[pos..pos + page.len()].copy_from_slice(page)
+        })?;
+        Ok(len)
+    }
+
+    /// Writes the file at `offset`, without using or moving the cursor.
+    pub fn pwrite(&self, offset: u64, buf: &[u8]) -> LinuxResult<usize> {
+        let mut size = self.size.lock();
+        let seals = self.seals();
+        if seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE) != 0 {
+            return Err(LinuxError::EPERM);
+        }
+        let end = offset
+            .checked_add(buf.len() as u64)
+            .ok_or(LinuxError::EFBIG)?;
+        if end > *size && seals & F_SEAL_GROW != 0 {
+            return Err(LinuxError::EPERM);
+        }
+        self.access(offset, buf.len(), |page, pos| {
+            page.copy_from_slice(&buf[pos..pos + page.len()])
+        })?;
+        *size = (*size).max(end);
+        Ok(buf.len())
+    }
+
+    /// Sets the size of the file to `new_size`, the content past it reads as
+    /// zeros.
+    pub fn truncate(&self, new_size: u64) -> LinuxResult {
+        let mut size = self.size.lock();
+        let seals = self.seals();
+        if (new_size < *size && seals & F_SEAL_SHRINK != 0)
+            || (new_size > *size && seals & F_SEAL_GROW != 0)
+        {
+            return Err(LinuxError::EPERM);
+        }
+        if new_size < *size {
+            self.pages.zero_from(new_size as usize);
+        }
+        *size = new_size;
+        Ok(())
+    }
+
+    /// Moves the cursor, returning its new position.
+    pub fn seek(&self, pos: SeekFrom) -> LinuxResult<u64> {
+        let mut offset = self.offset.lock();
+        let new = match pos {
+            SeekFrom::Start(off) => Some(off),
+            SeekFrom::Current(off) => offset.checked_add_signed(off),
+            SeekFrom::End(off) => self.size.lock().checked_add_signed(off),
+        };
+        *offset = new.ok_or(LinuxError::EINVAL)?;
+        Ok(*offset)
+    }
+}
+
+impl FileLike for MemFd {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        let mut offset = self.offset.lock();
+        let read = self.pread(*offset, buf)?;
+        *offset += read as u64;
+        Ok(read)
+    }
+
+    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+        let mut offset = self.offset.lock();
+        let written = self.pwrite(*offset, buf)?;
+        *offset += written as u64;
+        Ok(written)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        let size = *self.size.lock();
+        Ok(Kstat {
+            mode: S_IFREG | 0o777u32, // rwxrwxrwx
+            size,
+            blocks: size.div_ceil(512),
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: true,
+            writable: true,
+        })
+    }
+
+    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        Ok(())
+    }
+}
@@ -1,28 +1,51 @@
+mod console;
+mod eventfd;
+mod fd_table;
 mod fs;
+mod io_uring;
+mod memfd;
 mod net;
+mod perf;
 mod pipe;
+mod signalfd;
 mod stdio;
+mod timerfd;
+mod unix;
+mod waker;
 
-use core::{any::Any, ffi::c_int};
+use core::{any::Any, ffi::c_int, time::Duration};
 
-use alloc::{sync::Arc, vec::Vec};
+use alloc::sync::Arc;
 use axerrno::{LinuxError, LinuxResult};
+use axfs::fops::{FileAttr, FileInfo};
 use axio::PollState;
 use axns::{ResArc, def_resource};
-use flatten_objects::FlattenObjects;
-use linux_raw_sys::general::{stat, statx};
-use spin::RwLock;
+use axtask::{TaskExtRef, current};
+use linux_raw_sys::general::{S_IFLNK, STATX_BASIC_STATS, stat, statx, statx_timestamp};
 
 pub use self::{
-    fs::{Directory, File},
+    console::{defer_kernel_logs, flush_console, flush_console_on_panic, kick_console_writer},
+    eventfd::EventFd,
+    fd_table::{FdTable, OpenFiles},
+    fs::{Directory, File, lstat_path, stat_path},
+    io_uring::IoUring,
+    memfd::MemFd,
     net::Socket,
+    perf::{
+        PERF_FORMAT_ID, PERF_FORMAT_TOTAL_TIME_ENABLED, PERF_FORMAT_TOTAL_TIME_RUNNING,
+        PERF_TYPE_HARDWARE, PerfEvent, hardware_event,
+    },
     pipe::Pipe,
+    signalfd::SignalFd,
+    stdio::{CapturedOutput, Stdin, Stdout},
+    timerfd::TimerFd,
+    unix::{Received, SCM_MAX_FD, UnixSocket, UnixSocketType},
+    waker::{PollWaker, PollWakers, Wake},
 };
 
-pub const AX_FILE_LIMIT: usize = 1024;
-
 #[derive(Debug, Clone, Copy)]
 pub struct Kstat {
+    dev: u64,
     ino: u64,
     nlink: u32,
     uid: u32,
@@ -31,11 +54,15 @@ pub struct Kstat {
     size: u64,
     blocks: u64,
     blksize: u32,
+    atime: Duration,
+    mtime: Duration,
+    ctime: Duration,
 }
 
 impl Default for Kstat {
     fn default() -> Self {
         Self {
+            dev: 0,
             ino: 1,
             nlink: 1,
             uid: 1,
@@ -44,14 +71,55 @@ impl Default for Kstat {
             size: 0,
             blocks: 0,
             blksize: 4096,
+            atime: Duration::ZERO,
+            mtime: Duration::ZERO,
+            ctime: Duration::ZERO,
+        }
+    }
+}
+
+impl Kstat {
+    /// Returns the status of a file of the filesystem from its attributes.
+    pub fn from_attr(attr: &FileAttr, info: &FileInfo) -> Self {
+        Self {
+            dev: info.dev,
+            ino: info.ino,
+            nlink: info.nlink as _,
+            uid: info.uid,
+            gid: info.gid,
+            mode: ((attr.file_type() as u32) << 12) | attr.perm().bits() as u32,
+            size: attr.size(),
+            blocks: attr.blocks(),
+            blksize: 512,
+            atime: info.atime,
+            mtime: info.mtime,
+            ctime: info.ctime,
+        }
+    }
+
+    /// Returns the status of a symbolic link to a target of `len` bytes.
+    pub fn symlink(len: usize) -> Self {
+        Self {
+            mode: S_IFLNK | 0o777,
+            size: len as _,
+            ..Default::default()
         }
     }
 }
 
+fn statx_time(time: Duration) -> statx_timestamp {
+    statx_timestamp {
+        tv_sec: time.as_secs() as _,
+        tv_nsec: time.subsec_nanos(),
+        __reserved: 0,
+    }
+}
+
 impl From<Kstat> for stat {
     fn from(value: Kstat) -> Self {
         // SAFETY: valid for stat
         let mut stat: stat = unsafe { core::mem::zeroed() };
+        stat.st_dev = value.dev as _;
         stat.st_ino = value.ino as _;
         stat.st_nlink = value.nlink as _;
         stat.st_mode = value.mode as _;
@@ -60,6 +128,12 @@ impl From<Kstat> for stat {
         stat.st_size = value.size as _;
         stat.st_blksize = value.blksize as _;
         stat.st_blocks = value.blocks as _;
+        stat.st_atime = value.atime.as_secs() as _;
+        stat.st_atime_nsec = value.atime.subsec_nanos() as _;
+        stat.st_mtime = value.mtime.as_secs() as _;
+        stat.st_mtime_nsec = value.mtime.subsec_nanos() as _;
+        stat.st_ctime = value.ctime.as_secs() as _;
+        stat.st_ctime_nsec = value.ctime.subsec_nanos() as _;
 
         stat
     }
@@ -69,8 +143,8 @@ impl From<Kstat> for statx {
     fn from(value: Kstat) -> Self {
         // SAFETY: valid for statx
         let mut statx: statx = unsafe { core::mem::zeroed() };
+        statx.stx_mask = STATX_BASIC_STATS;
         statx.stx_blksize = value.blksize as _;
-        statx.stx_attributes = value.mode as _;
         statx.stx_nlink = value.nlink as _;
         statx.stx_uid = value.uid as _;
         statx.stx_gid = value.gid as _;
@@ -78,6 +152,12 @@ impl From<Kstat> for statx {
         statx.stx_ino = value.ino as _;
         statx.stx_size = value.size as _;
         statx.stx_blocks = value.blocks as _;
+        statx.stx_atime = statx_time(value.atime);
+        statx.stx_mtime = statx_time(value.mtime);
+        statx.stx_ctime = statx_time(value.ctime);
+        // The identifiers of the filesystems are small minor numbers.
+        statx.stx_dev_major = (value.dev >> 20) as _;
+        statx.stx_dev_minor = (value.dev & 0xfffff) as _;
 
         statx
     }
@@ -87,11 +167,75 @@ impl From<Kstat> for statx {
 pub trait FileLike: Send + Sync {
     fn read(&self, buf: &mut [u8]) -> LinuxResult<usize>;
     fn write(&self, buf: &[u8]) -> LinuxResult<usize>;
+
+    /// Reads into the buffers in order, as a single operation.
+    ///
+    /// The default implementation reads them one by one, stopping at the
+    /// first short read.
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
+        let mut total = 0;
+        for buf in bufs {
+            let read = match self.read(buf) {
+                Ok(read) => read,
+                Err(_) if total > 0 => break,
+                Err(e) => return Err(e),
+            };
+            total += read;
+            if read < buf.len() {
+                break;
+            }
+        }
+        Ok(total)
+    }
+
+    /// Writes the buffers in order, as a single operation.
+    ///
+    /// The default implementation writes them one by one, stopping at the
+    /// first short write.
+    fn write_vectored(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
+        let mut total = 0;
+        for buf in bufs {
+            let written = match self.write(buf) {
+                Ok(written) => written,
+                Err(_) if total > 0 => break,
+                Err(e) => return Err(e),
+            };
+            total += written;
+            if written < buf.len() {
+                break;
+            }
+        }
+        Ok(total)
+    }
+
     fn stat(&self) -> LinuxResult<Kstat>;
     fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync>;
     fn poll(&self) -> LinuxResult<PollState>;
     fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult;
 
+    /// Registers `waker` to be woken whenever the readiness of the file may
+    /// have changed.
+    ///
+    /// Returns `false` if the file does not support readiness notifications,
+    /// in which case pollers must check it actively.
+    fn register_waker(&self, _waker: &Arc<dyn Wake>) -> bool {
+        false
+    }
+
+    /// Unregisters a waker previously registered by [`register_waker`].
+    ///
+    /// [`register_waker`]: FileLike::register_waker
+    fn unregister_waker(&self, _waker: &Arc<dyn Wake>) {}
+
+    /// Performs the device-specific operation `op` of `ioctl` with `arg`.
+    ///
+    /// The default implementation does nothing and succeeds, as programs
+    /// probe terminal settings on all kinds of files.
+    fn ioctl(&self, op: u32, _arg: usize) -> LinuxResult<isize> {
+        warn!("Unimplemented ioctl: {:#x}", op);
+        Ok(0)
+    }
+
     fn from_fd(fd: c_int) -> LinuxResult<Arc<Self>>
     where
         Self: Sized + 'static,
@@ -102,50 +246,65 @@ pub trait FileLike: Send + Sync {
             .map_err(|_| LinuxError::EINVAL)
     }
 
-    fn add_to_fd_table(self) -> LinuxResult<c_int>
+    /// Adds the file to the file descriptor table, with the close-on-exec
+    /// flag `cloexec`.
+    fn add_to_fd_table(self, cloexec: bool) -> LinuxResult<c_int>
     where
         Self: Sized + 'static,
     {
-        add_file_like(Arc::new(self))
+        add_file_like(Arc::new(self), cloexec)
     }
 }
 
 def_resource! {
-    pub static FD_TABLE: ResArc<RwLock<FlattenObjects<Arc<dyn FileLike>, AX_FILE_LIMIT>>> = ResArc::new();
+    pub static FD_TABLE: ResArc<FdTable> = ResArc::new();
 }
 
 impl FD_TABLE {
-    /// Return a copy of the inner table.
-    pub fn copy_inner(&self) -> RwLock<FlattenObjects<Arc<dyn FileLike>, AX_FILE_LIMIT>> {
-        let table = self.read();
-        let mut new_table = FlattenObjects::new();
-        for id in table.ids() {
-            let _ = new_table.add_at(id, table.get(id).unwrap().clone());
-        }
-        RwLock::new(new_table)
+    /// Return a copy of the inner table, which shares the files until it
+    /// is modified.
+    pub fn copy_inner(&self) -> FdTable {
+        self.fork()
     }
 
     pub fn clear(&self) {
-        let mut table = self.write();
-        let ids = table.ids().collect::<Vec<_>>();
-        for id in ids {
-            let _ = table.remove(id);
+        // The files are closed once the table is unlocked.
+        let files = self.write().take();
+        drop(files);
+    }
+
+    /// Closes the files that have the close-on-exec flag, on `execve`.
+    pub fn close_on_exec(&self) {
+        // A table still shared with the parent is not copied if there is
+        // nothing to close.
+        if !self.read().has_cloexec() {
+            return;
         }
+        let files = self.write().remove_cloexec();
+        drop(files);
     }
 }
 
 /// Get a file-like object by `fd`.
 pub fn get_file_like(fd: c_int) -> LinuxResult<Arc<dyn FileLike>> {
-    FD_TABLE
-        .read()
-        .get(fd as usize)
-        .cloned()
-        .ok_or(LinuxError::EBADF)
+    FD_TABLE.get(fd as usize).ok_or(LinuxError::EBADF)
 }
 
-/// Add a file to the file descriptor table.
-pub fn add_file_like(f: Arc<dyn FileLike>) -> LinuxResult<c_int> {
-    Ok(FD_TABLE.write().add(f).map_err(|_| LinuxError::EMFILE)? as c_int)
+/// Returns the `RLIMIT_NOFILE` limit of the current process, which bounds
+/// its file descriptors.
+pub fn file_limit() -> usize {
+    current().task_ext().process_data().rlimits.read().nofile()
+}
+
+/// Add a file to the file descriptor table, with the close-on-exec flag
+/// `cloexec`.
+pub fn add_file_like(f: Arc<dyn FileLike>, cloexec: bool) -> LinuxResult<c_int> {
+    let limit = file_limit();
+    let fd = FD_TABLE
+        .write()
+        .add(f, limit, cloexec)
+        .ok_or(LinuxError::EMFILE)?;
+    Ok(fd as c_int)
 }
 
 /// Close a file by `fd`.
@@ -160,15 +319,9 @@ pub fn close_file_like(fd: c_int) -> LinuxResult {
 
 #[ctor_bare::register_ctor]
 fn init_stdio() {
-    let mut fd_table = flatten_objects::FlattenObjects::new();
-    fd_table
-        .add_at(0, Arc::new(stdio::stdin()) as _)
-        .unwrap_or_else(|_| panic!()); // stdin
-    fd_table
-        .add_at(1, Arc::new(stdio::stdout()) as _)
-        .unwrap_or_else(|_| panic!()); // stdout
-    fd_table
-        .add_at(2, Arc::new(stdio::stdout()) as _)
-        .unwrap_or_else(|_| panic!()); // stderr
-    FD_TABLE.init_new(spin::RwLock::new(fd_table));
+    let mut fd_table = OpenFiles::new();
+    fd_table.add_at(0, Arc::new(stdio::stdin()) as _, false); // stdin
+    fd_table.add_at(1, Arc::new(stdio::stdout()) as _, false); // stdout
+    fd_table.add_at(2, Arc::new(stdio::stdout()) as _, false); // stderr
+    FD_TABLE.init_new(FdTable::new(fd_table));
 }
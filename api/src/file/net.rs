@@ -1,13 +1,17 @@
 use core::net::SocketAddr;
 
-use alloc::sync::Arc;
+use alloc::{sync::Arc, vec::Vec};
 use axerrno::{LinuxError, LinuxResult};
 use axio::PollState;
 use axnet::{TcpSocket, UdpSocket};
 use axsync::Mutex;
-use linux_raw_sys::general::S_IFSOCK;
+use linux_raw_sys::{
+    general::S_IFSOCK,
+    net::{TCP_CORK, TCP_NODELAY, TCP_QUICKACK},
+};
+use starry_core::scratch::ScratchBuf;
 
-use super::{FileLike, Kstat};
+use super::{FileLike, Kstat, PollWakers, Wake};
 
 pub enum Socket {
     Udp(Mutex<UdpSocket>),
@@ -52,6 +56,40 @@ impl Socket {
         }
     }
 
+    /// Sends a batch of datagrams with the socket locked once, each to its
+    /// address or to the connected peer. Returns the number sent, as
+    /// `sendmmsg` does.
+    pub fn send_batch(&self, msgs: &[(&[u8], Option<SocketAddr>)]) -> LinuxResult<usize> {
+        let Socket::Udp(udpsocket) = self else {
+            return Err(LinuxError::EOPNOTSUPP);
+        };
+        let udpsocket = udpsocket.lock();
+        let peer = udpsocket.peer_addr().ok();
+        let msgs = msgs
+            .iter()
+            .map(|&(buf, addr)| Ok((buf, addr.or(peer).ok_or(LinuxError::EDESTADDRREQ)?)))
+            .collect::<LinuxResult<Vec<_>>>()?;
+        Ok(udpsocket.send_to_batch(&msgs)?)
+    }
+
+    /// Receives a batch of datagrams with the socket locked once, one into
+    /// each buffer. Returns the length and origin of each datagram received,
+    /// as `recvmmsg` does. Datagrams longer than their buffers are truncated.
+    pub fn recv_batch(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<Vec<(usize, SocketAddr)>> {
+        let Socket::Udp(udpsocket) = self else {
+            return Err(LinuxError::EOPNOTSUPP);
+        };
+        let mut received = Vec::with_capacity(bufs.len());
+        udpsocket
+            .lock()
+            .recv_from_batch(bufs.len(), |i, data, addr| {
+                let len = data.len().min(bufs[i].len());
+                bufs[i][..len].copy_from_slice(&data[..len]);
+                received.push((len, addr));
+            })?;
+        Ok(received)
+    }
+
     pub fn listen(&self) -> LinuxResult {
         match self {
             Socket::Udp(_) => Err(LinuxError::EOPNOTSUPP),
@@ -66,6 +104,46 @@ impl Socket {
         }
     }
 
+    /// Sends data on a TCP socket with more to follow (`MSG_MORE`), which is
+    /// held back until a send without it.
+    pub fn send_more(&self, buf: &[u8]) -> LinuxResult<usize> {
+        let Socket::Tcp(tcpsocket) = self else {
+            return Err(LinuxError::EOPNOTSUPP);
+        };
+        Ok(tcpsocket.lock().send_more(buf)?)
+    }
+
+    /// Sets a boolean option at the `IPPROTO_TCP` level: `TCP_NODELAY`,
+    /// `TCP_CORK` or `TCP_QUICKACK`.
+    pub fn set_tcp_option(&self, name: u32, value: bool) -> LinuxResult {
+        let Socket::Tcp(tcpsocket) = self else {
+            return Err(LinuxError::EOPNOTSUPP);
+        };
+        let tcpsocket = tcpsocket.lock();
+        match name {
+            TCP_NODELAY => tcpsocket.set_nodelay(value),
+            TCP_CORK => tcpsocket.set_cork(value),
+            TCP_QUICKACK => tcpsocket.set_quickack(value),
+            _ => return Err(LinuxError::ENOPROTOOPT),
+        }
+        Ok(())
+    }
+
+    /// Returns a boolean option at the `IPPROTO_TCP` level. See
+    /// [`set_tcp_option`](Self::set_tcp_option).
+    pub fn tcp_option(&self, name: u32) -> LinuxResult<bool> {
+        let Socket::Tcp(tcpsocket) = self else {
+            return Err(LinuxError::EOPNOTSUPP);
+        };
+        let tcpsocket = tcpsocket.lock();
+        match name {
+            TCP_NODELAY => Ok(tcpsocket.nodelay()),
+            TCP_CORK => Ok(tcpsocket.cork()),
+            TCP_QUICKACK => Ok(tcpsocket.quickack()),
+            _ => Err(LinuxError::ENOPROTOOPT),
+        }
+    }
+
     impl_socket!(pub fn send(&self, buf: &[u8]) -> LinuxResult<usize>);
     impl_socket!(pub fn poll(&self) -> LinuxResult<PollState>);
     impl_socket!(pub fn local_addr(&self) -> LinuxResult<SocketAddr>);
@@ -75,6 +153,14 @@ impl Socket {
     impl_socket!(pub fn shutdown(&self) -> LinuxResult);
 }
 
+/// Everyone watching sockets. The network stack only reports that the states
+/// of sockets may have changed, not which ones, so they are all woken up.
+static SOCKET_WAKERS: PollWakers = PollWakers::new();
+
+fn wake_socket_pollers() {
+    SOCKET_WAKERS.wake_all();
+}
+
 impl FileLike for Socket {
     fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
         self.recv(buf)
@@ -84,6 +170,37 @@ impl FileLike for Socket {
         self.send(buf)
     }
 
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
+        if let [buf] = bufs {
+            return self.recv(buf);
+        }
+        // Receive a single segment (or datagram), then scatter it.
+        let mut data = ScratchBuf::new(bufs.iter().map(|buf| buf.len()).sum());
+        let len = self.recv(&mut data)?;
+        let mut data = &data[..len];
+        for buf in bufs {
+            let n = buf.len().min(data.len());
+            buf[..n].copy_from_slice(&data[..n]);
+            data = &data[n..];
+        }
+        Ok(len)
+    }
+
+    fn write_vectored(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
+        if let [buf] = bufs {
+            return self.send(buf);
+        }
+        // Gather the buffers, so that they are sent as a single segment (or
+        // datagram).
+        let mut data = ScratchBuf::new(bufs.iter().map(|buf| buf.len()).sum());
+        let mut off = 0;
+        for buf in bufs {
+            data[off..off + buf.len()].copy_from_slice(buf);
+            off += buf.len();
+        }
+        self.send(&data)
+    }
+
     fn stat(&self) -> LinuxResult<Kstat> {
         // not really implemented
         Ok(Kstat {
@@ -108,4 +225,14 @@ impl FileLike for Socket {
         }
         Ok(())
     }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        axnet::set_event_hook(wake_socket_pollers);
+        SOCKET_WAKERS.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        SOCKET_WAKERS.unregister(waker);
+    }
 }
@@ -0,0 +1,198 @@
+use core::{
+    any::Any,
+    sync::atomic::{AtomicU64, Ordering},
+};
+
+use alloc::sync::Arc;
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{
+    pmu::{PmuConfig, PmuEvent},
+    time::monotonic_time_nanos,
+};
+use axio::PollState;
+use axsync::Mutex;
+use axtask::{AxTaskRef, current};
+
+use super::{FileLike, Kstat};
+use crate::ptr::UserPtr;
+
+pub const PERF_TYPE_HARDWARE: u32 = 0;
+
+pub const PERF_COUNT_HW_CPU_CYCLES: u64 = 0;
+pub const PERF_COUNT_HW_INSTRUCTIONS: u64 = 1;
+pub const PERF_COUNT_HW_CACHE_REFERENCES: u64 = 2;
+pub const PERF_COUNT_HW_CACHE_MISSES: u64 = 3;
+pub const PERF_COUNT_HW_BRANCH_INSTRUCTIONS: u64 = 4;
+pub const PERF_COUNT_HW_BRANCH_MISSES: u64 = 5;
+
+pub const PERF_FORMAT_TOTAL_TIME_ENABLED: u64 = 1 << 0;
+pub const PERF_FORMAT_TOTAL_TIME_RUNNING: u64 = 1 << 1;
+pub const PERF_FORMAT_ID: u64 = 1 << 2;
+
+const PERF_EVENT_IOC_ENABLE: u32 = 0x2400;
+const PERF_EVENT_IOC_DISABLE: u32 = 0x2401;
+const PERF_EVENT_IOC_RESET: u32 = 0x2403;
+const PERF_EVENT_IOC_ID: u32 = 0x8008_2407;
+
+/// Converts a `PERF_TYPE_HARDWARE` event to the event of the counter.
+pub fn hardware_event(config: u64) -> Option<PmuEvent> {
+    Some(match config {
+        PERF_COUNT_HW_CPU_CYCLES => PmuEvent::Cycles,
+        PERF_COUNT_HW_INSTRUCTIONS => PmuEvent::Instructions,
+        PERF_COUNT_HW_CACHE_REFERENCES => PmuEvent::CacheReferences,
+        PERF_COUNT_HW_CACHE_MISSES => PmuEvent::CacheMisses,
+        PERF_COUNT_HW_BRANCH_INSTRUCTIONS => PmuEvent::BranchInstructions,
+        PERF_COUNT_HW_BRANCH_MISSES => PmuEvent::BranchMisses,
+        _ => return None,
+    })
+}
+
+/// How long the counter has been enabled.
+struct EnabledTime {
+    total_nanos: u64,
+    /// When it was enabled, if it is.
+    since: Option<u64>,
+}
+
+impl EnabledTime {
+    fn nanos(&self) -> u64 {
+        self.total_nanos + self.since.map_or(0, |since| monotonic_time_nanos() - since)
+    }
+}
+
+/// A hardware performance counter of a task, created by `perf_event_open`.
+///
+/// It counts while the task runs, in the [`PmuContext`] of the task. Only the
+/// task itself can read the live count, others get the count saved when it
+/// was last switched out.
+///
+/// [`PmuContext`]: axhal::pmu::PmuContext
+pub struct PerfEvent {
+    task: AxTaskRef,
+    counter: usize,
+    id: u64,
+    read_format: u64,
+    time: Mutex<EnabledTime>,
+}
+
+impl PerfEvent {
+    /// Opens a counter of `config` on `task`, disabled unless `enabled`.
+    pub fn new(
+        task: AxTaskRef,
+        config: PmuConfig,
+        read_format: u64,
+        enabled: bool,
+    ) -> LinuxResult<Self> {
+        static NEXT_ID: AtomicU64 = AtomicU64::new(1);
+
+        if axhal::pmu::num_counters() == 0 {
+            return Err(LinuxError::ENOENT);
+        }
+        let counter = task.pmu().lock().open(config).ok_or(LinuxError::EBUSY)?;
+        let event = Self {
+            task,
+            counter,
+            id: NEXT_ID.fetch_add(1, Ordering::Relaxed),
+            read_format,
+            time: Mutex::new(EnabledTime {
+                total_nanos: 0,
+                since: None,
+            }),
+        };
+        if enabled {
+            event.enable();
+        }
+        Ok(event)
+    }
+
+    fn enable(&self) {
+        let mut time = self.time.lock();
+        if time.since.is_none() {
+            time.since = Some(monotonic_time_nanos());
+        }
+        self.task.pmu().lock().enable(self.counter);
+    }
+
+    fn disable(&self) {
+        let mut time = self.time.lock();
+        if let Some(since) = time.since.take() {
+            time.total_nanos += monotonic_time_nanos() - since;
+        }
+        self.task.pmu().lock().disable(self.counter);
+    }
+}
+
+impl Drop for PerfEvent {
+    fn drop(&mut self) {
+        self.task.pmu().lock().close(self.counter);
+    }
+}
+
+impl FileLike for PerfEvent {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        let count = self.task.pmu().lock().read(self.counter);
+        let nanos = self.time.lock().nanos();
+        let mut values = [count, 0, 0, 0];
+        let mut len = 1;
+        // The counter is never multiplexed, so it runs whenever it is enabled.
+        for (flag, value) in [
+            (PERF_FORMAT_TOTAL_TIME_ENABLED, nanos),
+            (PERF_FORMAT_TOTAL_TIME_RUNNING, nanos),
+            (PERF_FORMAT_ID, self.id),
+        ] {
+            if self.read_format & flag != 0 {
+                values[len] = value;
+                len += 1;
+            }
+        }
+        let size = len * size_of::<u64>();
+        if buf.len() < size {
+            return Err(LinuxError::ENOSPC);
+        }
+        for (chunk, value) in buf.chunks_exact_mut(8).zip(&values[..len]) {
+            chunk.copy_from_slice(&value.to_ne_bytes());
+        }
+        Ok(size)
+    }
+
+    fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: 0o600u32, // rw-------
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: true,
+            writable: false,
+        })
+    }
+
+    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        Ok(())
+    }
+
+    fn ioctl(&self, op: u32, arg: usize) -> LinuxResult<isize> {
+        // Only the task itself can reprogram its counters.
+        if !current().ptr_eq(&self.task) {
+            return Err(LinuxError::EPERM);
+        }
+        match op {
+            PERF_EVENT_IOC_ENABLE => self.enable(),
+            PERF_EVENT_IOC_DISABLE => self.disable(),
+            PERF_EVENT_IOC_RESET => self.task.pmu().lock().reset(self.counter),
+            PERF_EVENT_IOC_ID => UserPtr::<u64>::from(arg).write(self.id)?,
+            _ => return Err(LinuxError::ENOTTY),
+        }
+        Ok(0)
+    }
+}
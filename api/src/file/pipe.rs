@@ -1,94 +1,275 @@
-use core::any::Any;
+use core::{
+    alloc::Layout,
+    any::Any,
+    ffi::c_int,
+    ops::{Deref, DerefMut},
+    ptr::NonNull,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
 
 use alloc::sync::Arc;
 use axerrno::{LinuxError, LinuxResult};
 use axio::PollState;
-use axsync::Mutex;
+use axsync::{LockClass, Mutex, MutexGuard, RawMutex};
+use axtask::WaitQueue;
 use linux_raw_sys::general::S_IFIFO;
+use memory_addr::PAGE_SIZE_4K;
 
-use super::{FileLike, Kstat};
+use super::{FileLike, Kstat, PollWakers, Wake, get_file_like};
 
-#[derive(Copy, Clone, PartialEq)]
-enum RingBufferStatus {
-    Full,
-    Empty,
-    Normal,
-}
+/// Default capacity of a pipe, which is the same as Linux.
+const RING_BUFFER_SIZE: usize = 16 * PAGE_SIZE_4K;
+
+/// The maximum capacity a pipe can be resized to by `F_SETPIPE_SZ`, which is
+/// the default value of `/proc/sys/fs/pipe-max-size` on Linux.
+pub const PIPE_MAX_SIZE: usize = 0x10_0000;
 
-const RING_BUFFER_SIZE: usize = 256;
+/// Writes of at most this many bytes are atomic: they are never interleaved
+/// with other writes, as POSIX requires. It is never above the capacity.
+const PIPE_BUF: usize = PAGE_SIZE_4K;
 
+/// A ring buffer backed by page-aligned memory.
+///
+/// Data is moved in and out with at most two bulk copies per call, one for
+/// each contiguous span of the ring.
+///
+/// The memory is only reached through the spans, never as a whole, so that a
+/// splice can keep using a span after the lock of the ring is released.
 struct PipeRingBuffer {
-    arr: [u8; RING_BUFFER_SIZE],
+    arr: NonNull<[u8]>,
     head: usize,
-    tail: usize,
-    status: RingBufferStatus,
+    len: usize,
 }
 
+// SAFETY: the ring owns its memory.
+unsafe impl Send for PipeRingBuffer {}
+
 impl PipeRingBuffer {
-    const fn new() -> Self {
+    fn new() -> Self {
+        Self::with_capacity(RING_BUFFER_SIZE)
+    }
+
+    fn with_capacity(capacity: usize) -> Self {
+        let layout = Layout::from_size_align(capacity, PAGE_SIZE_4K).unwrap();
+        // Zeroed, as the ring is read through `&[u8]` before it is filled.
+        let ptr = unsafe { alloc::alloc::alloc_zeroed(layout) };
+        let Some(ptr) = NonNull::new(ptr) else {
+            alloc::alloc::handle_alloc_error(layout);
+        };
+        let arr = NonNull::slice_from_raw_parts(ptr, capacity);
         Self {
-            arr: [0; RING_BUFFER_SIZE],
+            arr,
             head: 0,
-            tail: 0,
-            status: RingBufferStatus::Empty,
+            len: 0,
+        }
+    }
+
+    const fn capacity(&self) -> usize {
+        self.arr.len()
+    }
+
+    /// Moves the queued data into a new ring of `capacity` bytes.
+    fn resize(&mut self, capacity: usize) -> LinuxResult {
+        if capacity < self.len {
+            return Err(LinuxError::EBUSY);
+        }
+        if capacity != self.capacity() {
+            let mut new = Self::with_capacity(capacity);
+            let size = self.read(new.write_spans(self.len).0);
+            new.commit(size);
+            *self = new;
         }
+        Ok(())
     }
 
-    fn write_byte(&mut self, byte: u8) {
-        self.status = RingBufferStatus::Normal;
-        self.arr[self.tail] = byte;
-        self.tail = (self.tail + 1) % RING_BUFFER_SIZE;
-        if self.tail == self.head {
-            self.status = RingBufferStatus::Full;
+    /// Returns `len` bytes of the ring from `start`.
+    fn span(&self, start: usize, len: usize) -> *mut [u8] {
+        debug_assert!(start + len <= self.capacity());
+        // SAFETY: the span is within the ring.
+        let ptr = unsafe { self.arr.cast::<u8>().add(start) };
+        NonNull::slice_from_raw_parts(ptr, len).as_ptr()
+    }
+
+    /// Returns the queued data as at most two contiguous spans, limited to
+    /// `max` bytes in total.
+    fn read_spans(&self, max: usize) -> (&[u8], &[u8]) {
+        let size = max.min(self.available_read());
+        let first = size.min(self.capacity() - self.head);
+        // SAFETY: the queued data is initialized, and only written again
+        // once consumed, which needs `&mut self`.
+        unsafe { (&*self.span(self.head, first), &*self.span(0, size - first)) }
+    }
+
+    /// Drops `size` bytes from the front of the queued data.
+    fn consume(&mut self, size: usize) {
+        debug_assert!(size <= self.len);
+        self.head = (self.head + size) % self.capacity();
+        self.len -= size;
+        if self.len == 0 {
+            // Rewind so that the next transfer is a single contiguous copy.
+            self.head = 0;
         }
     }
 
-    fn read_byte(&mut self) -> u8 {
-        self.status = RingBufferStatus::Normal;
-        let c = self.arr[self.head];
-        self.head = (self.head + 1) % RING_BUFFER_SIZE;
-        if self.head == self.tail {
-            self.status = RingBufferStatus::Empty;
+    /// Returns the free space as at most two contiguous spans, limited to
+    /// `max` bytes in total.
+    fn write_spans(&mut self, max: usize) -> (&mut [u8], &mut [u8]) {
+        let size = max.min(self.available_write());
+        let cap = self.capacity();
+        let tail = (self.head + self.len) % cap;
+        let first = size.min(cap - tail);
+        // SAFETY: the free space is not part of any span handed out for
+        // reading, and the two spans do not overlap.
+        unsafe {
+            (
+                &mut *self.span(tail, first),
+                &mut *self.span(0, size - first),
+            )
         }
-        c
+    }
+
+    /// Appends `size` bytes that have been filled into the free space.
+    fn commit(&mut self, size: usize) {
+        debug_assert!(size <= self.available_write());
+        self.len += size;
+    }
+
+    /// Copies as many bytes as possible from `buf` into the ring, returning
+    /// the number of bytes written.
+    fn write(&mut self, buf: &[u8]) -> usize {
+        let (first, second) = self.write_spans(buf.len());
+        let (first_len, size) = (first.len(), first.len() + second.len());
+        first.copy_from_slice(&buf[..first_len]);
+        second.copy_from_slice(&buf[first_len..size]);
+        self.commit(size);
+        size
+    }
+
+    /// Copies as many bytes as possible from the ring into `buf`, returning
+    /// the number of bytes read.
+    fn read(&mut self, buf: &mut [u8]) -> usize {
+        let (first, second) = self.read_spans(buf.len());
+        let size = first.len() + second.len();
+        buf[..first.len()].copy_from_slice(first);
+        buf[first.len()..size].copy_from_slice(second);
+        self.consume(size);
+        size
     }
 
     /// Get the length of remaining data in the buffer
     const fn available_read(&self) -> usize {
-        if matches!(self.status, RingBufferStatus::Empty) {
-            0
-        } else if self.tail > self.head {
-            self.tail - self.head
-        } else {
-            self.tail + RING_BUFFER_SIZE - self.head
-        }
+        self.len
     }
 
     /// Get the length of remaining space in the buffer
     const fn available_write(&self) -> usize {
-        if matches!(self.status, RingBufferStatus::Full) {
-            0
-        } else {
-            RING_BUFFER_SIZE - self.available_read()
+        self.capacity() - self.len
+    }
+}
+
+impl Drop for PipeRingBuffer {
+    fn drop(&mut self) {
+        let layout = Layout::from_size_align(self.capacity(), PAGE_SIZE_4K).unwrap();
+        unsafe { alloc::alloc::dealloc(self.arr.cast::<u8>().as_ptr(), layout) };
+    }
+}
+
+/// The class of the locks of pipe buffers, see `/proc/lock_stat`.
+static PIPE_LOCKS: LockClass = LockClass::new("pipe");
+
+/// State shared by both ends of a pipe.
+struct PipeInner {
+    buffer: Mutex<PipeRingBuffer>,
+    /// Serializes the readers, so that a splice can hand the queued data to
+    /// its callback with `buffer` unlocked, see [`Pipe::splice_to`].
+    readers: Mutex<()>,
+    /// Serializes the writers, likewise for the free space.
+    writers: Mutex<()>,
+    /// Mirrors of the ring occupancy, readable without taking `buffer`, so
+    /// that they can be checked from wait queue conditions.
+    available_read: AtomicUsize,
+    available_write: AtomicUsize,
+    read_closed: AtomicBool,
+    write_closed: AtomicBool,
+    /// Readers waiting for data.
+    read_wq: WaitQueue,
+    /// Writers waiting for space.
+    write_wq: WaitQueue,
+    /// Pollers watching either end.
+    wakers: PollWakers,
+}
+
+impl PipeInner {
+    fn lock(&self) -> PipeGuard<'_> {
+        PipeGuard {
+            inner: self,
+            buffer: self.buffer.lock(),
         }
     }
 }
 
+/// Locked access to a pipe's ring buffer, which publishes the occupancy to
+/// the atomic mirrors on release.
+struct PipeGuard<'a> {
+    inner: &'a PipeInner,
+    buffer: MutexGuard<'a, PipeRingBuffer>,
+}
+
+impl Deref for PipeGuard<'_> {
+    type Target = PipeRingBuffer;
+
+    fn deref(&self) -> &Self::Target {
+        &self.buffer
+    }
+}
+
+impl DerefMut for PipeGuard<'_> {
+    fn deref_mut(&mut self) -> &mut Self::Target {
+        &mut self.buffer
+    }
+}
+
+impl Drop for PipeGuard<'_> {
+    fn drop(&mut self) {
+        self.inner
+            .available_read
+            .store(self.buffer.available_read(), Ordering::Release);
+        self.inner
+            .available_write
+            .store(self.buffer.available_write(), Ordering::Release);
+    }
+}
+
 pub struct Pipe {
     readable: bool,
-    buffer: Arc<Mutex<PipeRingBuffer>>,
+    nonblocking: AtomicBool,
+    inner: Arc<PipeInner>,
 }
 
 impl Pipe {
     pub fn new() -> (Pipe, Pipe) {
-        let buffer = Arc::new(Mutex::new(PipeRingBuffer::new()));
+        let buffer = PipeRingBuffer::new();
+        let inner = Arc::new(PipeInner {
+            available_read: AtomicUsize::new(buffer.available_read()),
+            available_write: AtomicUsize::new(buffer.available_write()),
+            buffer: Mutex::const_new(RawMutex::with_class(&PIPE_LOCKS), buffer),
+            readers: Mutex::new(()),
+            writers: Mutex::new(()),
+            read_closed: AtomicBool::new(false),
+            write_closed: AtomicBool::new(false),
+            read_wq: WaitQueue::new(),
+            write_wq: WaitQueue::new(),
+            wakers: PollWakers::new(),
+        });
         let read_end = Pipe {
             readable: true,
-            buffer: buffer.clone(),
+            nonblocking: AtomicBool::new(false),
+            inner: inner.clone(),
         };
         let write_end = Pipe {
             readable: false,
-            buffer,
+            nonblocking: AtomicBool::new(false),
+            inner,
         };
         (read_end, write_end)
     }
@@ -101,72 +282,363 @@ impl Pipe {
         !self.readable
     }
 
+    /// Returns the capacity of the pipe buffer in bytes.
+    pub fn capacity(&self) -> usize {
+        self.inner.lock().capacity()
+    }
+
+    /// Resizes the pipe buffer to at least `size` bytes without dropping any
+    /// queued data, returning the actual capacity.
+    ///
+    /// The size is rounded up to a power-of-two number of pages, as Linux
+    /// does.
+    pub fn resize(&self, size: usize) -> LinuxResult<usize> {
+        if size > PIPE_MAX_SIZE {
+            return Err(LinuxError::EPERM);
+        }
+        let capacity = size.max(PAGE_SIZE_4K).next_power_of_two();
+        let _readers = self.inner.readers.lock();
+        let _writers = self.inner.writers.lock();
+        self.inner.lock().resize(capacity)?;
+        // There may be more space for blocked writers now.
+        self.inner.write_wq.notify_all(false);
+        self.inner.wakers.wake_all();
+        Ok(capacity)
+    }
+
+    /// Whether this end of the pipe is in nonblocking mode.
+    pub fn nonblocking(&self) -> bool {
+        self.nonblocking.load(Ordering::Relaxed)
+    }
+
+    /// Whether the other end of the pipe has been closed.
     pub fn closed(&self) -> bool {
-        Arc::strong_count(&self.buffer) == 1
+        if self.readable {
+            self.inner.write_closed.load(Ordering::Acquire)
+        } else {
+            self.inner.read_closed.load(Ordering::Acquire)
+        }
+    }
+
+    /// Waits until there is data to read, returning `false` if the pipe is
+    /// empty and the write end has been closed.
+    fn wait_readable(&self, nonblocking: bool) -> LinuxResult<bool> {
+        let ready = || self.inner.available_read.load(Ordering::Acquire) > 0;
+        if !ready() && !self.closed() {
+            if nonblocking {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.inner.read_wq.wait_until(|| ready() || self.closed());
+        }
+        Ok(ready())
+    }
+
+    /// Waits until there is space to write `size` bytes, failing with `EPIPE`
+    /// if the read end has been closed.
+    fn wait_writable(&self, size: usize, nonblocking: bool) -> LinuxResult {
+        let ready = || self.inner.available_write.load(Ordering::Acquire) >= size;
+        if !ready() && !self.closed() {
+            if nonblocking {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.inner.write_wq.wait_until(|| ready() || self.closed());
+        }
+        if self.closed() {
+            Err(LinuxError::EPIPE)
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Moves up to `len` bytes out of the pipe by handing the queued spans
+    /// directly to `f`, which returns how many bytes it has taken.
+    ///
+    /// `f` runs with the ring unlocked, so that writers are not held up by
+    /// its I/O, but with the other readers shut out.
+    ///
+    /// Blocks until some data is available unless `nonblocking` is set.
+    /// Returns 0 if the write end has been closed and the pipe is empty.
+    pub fn splice_to<F>(&self, len: usize, nonblocking: bool, mut f: F) -> LinuxResult<usize>
+    where
+        F: FnMut(&[u8]) -> LinuxResult<usize>,
+    {
+        if !self.readable() {
+            return Err(LinuxError::EBADF);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        loop {
+            if !self.wait_readable(nonblocking)? {
+                return Ok(0);
+            }
+            let readers = self.inner.readers.lock();
+            let ring_buffer = self.inner.lock();
+            if ring_buffer.available_read() == 0 {
+                continue;
+            }
+            let (first, second) = ring_buffer.read_spans(len);
+            let spans = [first as *const [u8], second as *const [u8]];
+            drop(ring_buffer);
+            let mut size = 0;
+            for span in spans {
+                // SAFETY: the queued data stays in place until it is
+                // consumed, which only the holder of `readers` does.
+                let span = unsafe { &*span };
+                if span.is_empty() {
+                    break;
+                }
+                match f(span) {
+                    Ok(n) => {
+                        size += n;
+                        if n < span.len() {
+                            break;
+                        }
+                    }
+                    Err(err) if size == 0 => return Err(err),
+                    Err(_) => break,
+                }
+            }
+            self.inner.lock().consume(size);
+            drop(readers);
+            if size > 0 {
+                self.inner.write_wq.notify_all(true);
+                self.inner.wakers.wake_all();
+            }
+            return Ok(size);
+        }
+    }
+
+    /// Moves up to `len` bytes into the pipe by handing the free spans
+    /// directly to `f`, which fills them and returns how many bytes it has
+    /// produced.
+    ///
+    /// `f` runs with the ring unlocked, so that readers are not held up by
+    /// its I/O, but with the other writers shut out.
+    ///
+    /// Blocks until some space is available unless `nonblocking` is set.
+    pub fn splice_from<F>(&self, len: usize, nonblocking: bool, mut f: F) -> LinuxResult<usize>
+    where
+        F: FnMut(&mut [u8]) -> LinuxResult<usize>,
+    {
+        if !self.writable() {
+            return Err(LinuxError::EBADF);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        loop {
+            self.wait_writable(1, nonblocking)?;
+            let writers = self.inner.writers.lock();
+            let mut ring_buffer = self.inner.lock();
+            if ring_buffer.available_write() == 0 {
+                continue;
+            }
+            let (first, second) = ring_buffer.write_spans(len);
+            let spans = [first as *mut [u8], second as *mut [u8]];
+            drop(ring_buffer);
+            let mut size = 0;
+            for span in spans {
+                // SAFETY: the free space is only filled by the holder of
+                // `writers`, and not reused by readers until committed.
+                let span = unsafe { &mut *span };
+                if span.is_empty() {
+                    break;
+                }
+                let span_len = span.len();
+                match f(span) {
+                    Ok(n) => {
+                        size += n;
+                        if n < span_len {
+                            break;
+                        }
+                    }
+                    Err(err) if size == 0 => return Err(err),
+                    Err(_) => break,
+                }
+            }
+            self.inner.lock().commit(size);
+            drop(writers);
+            if size > 0 {
+                self.inner.read_wq.notify_all(true);
+                self.inner.wakers.wake_all();
+            }
+            return Ok(size);
+        }
+    }
+
+    /// Moves (or copies, if `consume` is false) up to `len` bytes from the
+    /// pipe `src` into the pipe `dst`, without any intermediate buffer.
+    pub fn transfer(
+        src: &Pipe,
+        dst: &Pipe,
+        len: usize,
+        nonblocking: bool,
+        consume: bool,
+    ) -> LinuxResult<usize> {
+        if !src.readable() || !dst.writable() {
+            return Err(LinuxError::EBADF);
+        }
+        if Arc::ptr_eq(&src.inner, &dst.inner) {
+            return Err(LinuxError::EINVAL);
+        }
+        if len == 0 {
+            return Ok(0);
+        }
+
+        loop {
+            if !src.wait_readable(nonblocking)? {
+                return Ok(0);
+            }
+            dst.wait_writable(1, nonblocking)?;
+
+            // Readers are always locked before writers, so transfers in
+            // opposite directions cannot deadlock on them.
+            let _readers = src.inner.readers.lock();
+            let _writers = dst.inner.writers.lock();
+            // Always lock the two pipes in the same order to avoid deadlocks
+            // between transfers in opposite directions.
+            let src_first = Arc::as_ptr(&src.inner) < Arc::as_ptr(&dst.inner);
+            let (mut src_buf, mut dst_buf) = if src_first {
+                let src_buf = src.inner.lock();
+                (src_buf, dst.inner.lock())
+            } else {
+                let dst_buf = dst.inner.lock();
+                (src.inner.lock(), dst_buf)
+            };
+            let (first, second) = src_buf.read_spans(len);
+            let mut size = dst_buf.write(first);
+            if size == first.len() {
+                size += dst_buf.write(second);
+            }
+            if consume {
+                src_buf.consume(size);
+            }
+            drop(src_buf);
+            drop(dst_buf);
+
+            if size > 0 {
+                dst.inner.read_wq.notify_all(true);
+                dst.inner.wakers.wake_all();
+                if consume {
+                    src.inner.write_wq.notify_all(true);
+                    src.inner.wakers.wake_all();
+                }
+                return Ok(size);
+            }
+        }
+    }
+}
+
+impl Drop for Pipe {
+    fn drop(&mut self) {
+        // Wake up the other end so that it can observe the closure.
+        if self.readable {
+            self.inner.read_closed.store(true, Ordering::Release);
+            self.inner.write_wq.notify_all(false);
+        } else {
+            self.inner.write_closed.store(true, Ordering::Release);
+            self.inner.read_wq.notify_all(false);
+        }
+        self.inner.wakers.wake_all();
     }
 }
 
 impl FileLike for Pipe {
     fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        self.read_vectored(&mut [buf])
+    }
+
+    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+        self.write_vectored(&[buf])
+    }
+
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
         if !self.readable() {
             return Err(LinuxError::EPERM);
         }
-        if buf.is_empty() {
+        if bufs.iter().all(|buf| buf.is_empty()) {
             return Ok(0);
         }
 
         loop {
-            let mut ring_buffer = self.buffer.lock();
-            let read_size = ring_buffer.available_read().min(buf.len());
-            if read_size == 0 {
-                if self.closed() {
-                    return Ok(0);
+            // Data not ready, wait for write end
+            if !self.wait_readable(self.nonblocking())? {
+                return Ok(0);
+            }
+            let readers = self.inner.readers.lock();
+            let mut ring_buffer = self.inner.lock();
+            let mut read_size = 0;
+            for buf in bufs.iter_mut() {
+                let size = ring_buffer.read(buf);
+                read_size += size;
+                if size < buf.len() {
+                    break;
                 }
-                drop(ring_buffer);
-                // Data not ready, wait for write end
-                axtask::yield_now(); // TODO: use synconize primitive
-                continue;
             }
-            for c in buf.iter_mut().take(read_size) {
-                *c = ring_buffer.read_byte();
+            drop(ring_buffer);
+            drop(readers);
+            if read_size > 0 {
+                self.inner.write_wq.notify_all(true);
+                self.inner.wakers.wake_all();
+                return Ok(read_size);
             }
-            return Ok(read_size);
         }
     }
 
-    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+    fn write_vectored(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
         if !self.writable() {
             return Err(LinuxError::EPERM);
         }
         if self.closed() {
             return Err(LinuxError::EPIPE);
         }
-        if buf.is_empty() {
+        let total_len = bufs.iter().map(|buf| buf.len()).sum::<usize>();
+        if total_len == 0 {
             return Ok(0);
         }
 
+        // Small writes wait for room for all their data, and are then copied
+        // under a single lock so that they are not interleaved.
+        let atomic_len = if total_len <= PIPE_BUF { total_len } else { 1 };
+        // The position in `bufs` of the next byte to write.
+        let (mut index, mut offset) = (0, 0);
         let mut write_size = 0usize;
-        let total_len = buf.len();
-        loop {
-            let mut ring_buffer = self.buffer.lock();
-            let loop_write = ring_buffer.available_write();
-            if loop_write == 0 {
-                if self.closed() {
-                    return Ok(write_size);
-                }
-                drop(ring_buffer);
-                // Buffer is full, wait for read end to consume
-                axtask::yield_now(); // TODO: use synconize primitive
+        while write_size < total_len {
+            // Buffer is full, wait for read end to consume
+            match self.wait_writable(atomic_len, self.nonblocking()) {
+                Ok(()) => {}
+                Err(LinuxError::EPIPE | LinuxError::EAGAIN) if write_size > 0 => break,
+                Err(err) => return Err(err),
+            }
+            let writers = self.inner.writers.lock();
+            let mut ring_buffer = self.inner.lock();
+            // Another writer may have taken the space meanwhile.
+            if ring_buffer.available_write() < atomic_len {
                 continue;
             }
-            for _ in 0..loop_write {
-                if write_size == total_len {
-                    return Ok(write_size);
+            let mut size = 0;
+            while index < bufs.len() {
+                let n = ring_buffer.write(&bufs[index][offset..]);
+                size += n;
+                offset += n;
+                if offset < bufs[index].len() {
+                    break;
                 }
-                ring_buffer.write_byte(buf[write_size]);
-                write_size += 1;
+                index += 1;
+                offset = 0;
+            }
+            drop(ring_buffer);
+            drop(writers);
+            if size > 0 {
+                write_size += size;
+                self.inner.read_wq.notify_all(true);
+                self.inner.wakers.wake_all();
             }
         }
+        Ok(write_size)
     }
 
     fn stat(&self) -> LinuxResult<Kstat> {
@@ -181,14 +653,33 @@ impl FileLike for Pipe {
     }
 
     fn poll(&self) -> LinuxResult<PollState> {
-        let buf = self.buffer.lock();
+        let buf = self.inner.lock();
+        // A closed peer makes the operation return immediately, so it counts
+        // as ready too.
         Ok(PollState {
-            readable: self.readable() && buf.available_read() > 0,
-            writable: self.writable() && buf.available_write() > 0,
+            readable: self.readable() && (buf.available_read() > 0 || self.closed()),
+            writable: self.writable() && (buf.available_write() > 0 || self.closed()),
         })
     }
 
-    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
         Ok(())
     }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.inner.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.inner.wakers.unregister(waker);
+    }
+
+    fn from_fd(fd: c_int) -> LinuxResult<Arc<Self>> {
+        get_file_like(fd)?
+            .into_any()
+            .downcast::<Self>()
+            .map_err(|_| LinuxError::EBADF)
+    }
 }
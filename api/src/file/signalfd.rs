@@ -0,0 +1,210 @@
+use core::{
+    any::Any,
+    mem,
+    sync::atomic::{AtomicBool, Ordering},
+    time::Duration,
+};
+
+use alloc::sync::Arc;
+use axerrno::{LinuxError, LinuxResult};
+use axio::PollState;
+use axsignal::{SignalInfo, SignalSet};
+use axtask::{TaskExtRef, current};
+use spin::Mutex;
+use starry_core::task::{SignalWaker, register_signal_waker, unregister_signal_waker};
+
+use super::{FileLike, Kstat, PollWaker, PollWakers, Wake};
+use crate::signal::have_signals;
+
+/// The record returned by `read` for each dequeued signal.
+#[repr(C)]
+#[derive(Default)]
+struct SignalFdSiginfo {
+    ssi_signo: u32,
+    ssi_errno: i32,
+    ssi_code: i32,
+    ssi_pid: u32,
+    ssi_uid: u32,
+    ssi_fd: i32,
+    ssi_tid: u32,
+    ssi_band: u32,
+    ssi_overrun: u32,
+    ssi_trapno: u32,
+    ssi_status: i32,
+    ssi_int: i32,
+    ssi_ptr: u64,
+    ssi_utime: u64,
+    ssi_stime: u64,
+    ssi_addr: u64,
+    ssi_addr_lsb: u16,
+    __pad2: u16,
+    ssi_syscall: i32,
+    ssi_call_addr: u64,
+    ssi_arch: u32,
+    __pad: [u8; 28],
+}
+
+const SIGINFO_SIZE: usize = mem::size_of::<SignalFdSiginfo>();
+const _: () = assert!(SIGINFO_SIZE == 128);
+
+impl From<SignalInfo> for SignalFdSiginfo {
+    fn from(sig: SignalInfo) -> Self {
+        // `siginfo` starts with signo, errno and code, followed (after
+        // padding to 8 bytes) by the union whose `kill`, `rt` and `sigchld`
+        // variants all start with the sender's pid and uid.
+        // SAFETY: `siginfo` is a plain C struct of 128 bytes.
+        let raw: [u32; 32] = unsafe { mem::transmute_copy(&sig.0) };
+        Self {
+            ssi_signo: raw[0],
+            ssi_errno: raw[1] as _,
+            ssi_code: raw[2] as _,
+            ssi_pid: raw[4],
+            ssi_uid: raw[5],
+            ssi_status: raw[6] as _,
+            ssi_int: raw[6] as _,
+            ssi_ptr: raw[6] as u64 | (raw[7] as u64) << 32,
+            ..Default::default()
+        }
+    }
+}
+
+/// A file created by `signalfd4` to accept the signals of the reading
+/// thread.
+pub struct SignalFd {
+    mask: Mutex<SignalSet>,
+    nonblocking: AtomicBool,
+    wakers: Arc<PollWakers>,
+    /// Wakes up [`Self::wakers`] whenever a signal is sent.
+    signal_waker: SignalWaker,
+}
+
+impl SignalFd {
+    pub fn new(mask: SignalSet) -> Self {
+        let wakers = Arc::new(PollWakers::new());
+        let signal_waker: SignalWaker = {
+            let wakers = wakers.clone();
+            Arc::new(move || wakers.wake_all())
+        };
+        register_signal_waker(&signal_waker);
+        Self {
+            mask: Mutex::new(mask),
+            nonblocking: AtomicBool::new(false),
+            wakers,
+            signal_waker,
+        }
+    }
+
+    pub fn set_mask(&self, mask: SignalSet) {
+        *self.mask.lock() = mask;
+        self.wakers.wake_all();
+    }
+
+    /// Dequeues a pending signal of the current thread that is in the mask.
+    fn try_dequeue(&self) -> Option<SignalInfo> {
+        let mask = *self.mask.lock();
+        let curr = current();
+        let signal = &curr.task_ext().thread_data().signal;
+        signal.pending().dequeue(&mask)?;
+        signal.wait_timeout(mask, Some(Duration::ZERO))
+    }
+
+    /// Waits until a signal in the mask is pending.
+    fn dequeue(&self) -> LinuxResult<SignalInfo> {
+        if let Some(sig) = self.try_dequeue() {
+            return Ok(sig);
+        }
+        if self.nonblocking.load(Ordering::Relaxed) {
+            return Err(LinuxError::EAGAIN);
+        }
+
+        let waker = PollWaker::new();
+        let signal_waker = waker.signal_waker();
+        register_signal_waker(&signal_waker);
+        let res = loop {
+            waker.reset();
+            if let Some(sig) = self.try_dequeue() {
+                break Ok(sig);
+            }
+            if have_signals() {
+                break Err(LinuxError::EINTR);
+            }
+            waker.wait(None);
+        };
+        unregister_signal_waker(&signal_waker);
+        res
+    }
+}
+
+impl Drop for SignalFd {
+    fn drop(&mut self) {
+        unregister_signal_waker(&self.signal_waker);
+    }
+}
+
+impl FileLike for SignalFd {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        if buf.len() < SIGINFO_SIZE {
+            return Err(LinuxError::EINVAL);
+        }
+        let mut read = 0;
+        for chunk in buf.chunks_exact_mut(SIGINFO_SIZE) {
+            let sig = if read == 0 {
+                self.dequeue()?
+            } else {
+                match self.try_dequeue() {
+                    Some(sig) => sig,
+                    None => break,
+                }
+            };
+            let info = SignalFdSiginfo::from(sig);
+            // SAFETY: `chunk` is exactly the size of `SignalFdSiginfo`.
+            unsafe { chunk.as_mut_ptr().cast::<SignalFdSiginfo>().write_unaligned(info) };
+            read += SIGINFO_SIZE;
+        }
+        Ok(read)
+    }
+
+    fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: 0o600u32, // rw-------
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        let mask = *self.mask.lock();
+        let readable = current()
+            .task_ext()
+            .thread_data()
+            .signal
+            .pending()
+            .dequeue(&mask)
+            .is_some();
+        Ok(PollState {
+            readable,
+            writable: false,
+        })
+    }
+
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.wakers.unregister(waker);
+    }
+}
@@ -1,46 +1,29 @@
-use core::any::Any;
+use core::{
+    any::Any,
+    sync::atomic::{AtomicBool, Ordering},
+};
 
-use alloc::sync::Arc;
+use alloc::{sync::Arc, vec::Vec};
 use axerrno::{AxResult, LinuxError, LinuxResult};
-use axio::{BufReader, PollState, prelude::*};
+use axio::{PollState, prelude::*};
 use axsync::Mutex;
 use linux_raw_sys::general::S_IFCHR;
 
-use super::Kstat;
-
-fn console_read_bytes(buf: &mut [u8]) -> AxResult<usize> {
-    let len = axhal::console::read_bytes(buf);
-    for c in &mut buf[..len] {
-        if *c == b'\r' {
-            *c = b'\n';
-        }
-    }
-    Ok(len)
-}
+use super::{
+    Kstat, Wake,
+    console::{
+        console_read, console_write, has_console_input, register_console_waker,
+        unregister_console_waker, wait_console_input,
+    },
+};
 
 fn console_write_bytes(buf: &[u8]) -> AxResult<usize> {
-    axhal::console::write_bytes(buf);
+    console_write(buf);
     Ok(buf.len())
 }
 
-struct StdinRaw;
 struct StdoutRaw;
 
-impl Read for StdinRaw {
-    // Non-blocking read, returns number of bytes read.
-    fn read(&mut self, buf: &mut [u8]) -> AxResult<usize> {
-        let mut read_len = 0;
-        while read_len < buf.len() {
-            let len = console_read_bytes(buf[read_len..].as_mut())?;
-            if len == 0 {
-                break;
-            }
-            read_len += len;
-        }
-        Ok(read_len)
-    }
-}
-
 impl Write for StdoutRaw {
     fn write(&mut self, buf: &[u8]) -> AxResult<usize> {
         console_write_bytes(buf)
@@ -52,23 +35,28 @@ impl Write for StdoutRaw {
 }
 
 pub struct Stdin {
-    inner: &'static Mutex<BufReader<StdinRaw>>,
+    nonblocking: AtomicBool,
 }
 
 impl Stdin {
-    // Block until at least one byte is read.
-    fn read_blocked(&self, buf: &mut [u8]) -> AxResult<usize> {
-        let read_len = self.inner.lock().read(buf)?;
+    // Return `EAGAIN` instead of blocking if nothing is available.
+    fn read_nonblocking(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        let read_len = console_read(buf);
         if buf.is_empty() || read_len > 0 {
-            return Ok(read_len);
+            Ok(read_len)
+        } else {
+            Err(LinuxError::EAGAIN)
         }
-        // try again until we get something
+    }
+
+    // Block until at least one byte is read.
+    fn read_blocked(&self, buf: &mut [u8]) -> AxResult<usize> {
         loop {
-            let read_len = self.inner.lock().read(buf)?;
-            if read_len > 0 {
+            let read_len = console_read(buf);
+            if buf.is_empty() || read_len > 0 {
                 return Ok(read_len);
             }
-            axtask::yield_now();
+            wait_console_input();
         }
     }
 }
@@ -95,8 +83,9 @@ impl Write for Stdout {
 
 /// Constructs a new handle to the standard input of the current process.
 pub fn stdin() -> Stdin {
-    static INSTANCE: Mutex<BufReader<StdinRaw>> = Mutex::new(BufReader::new(StdinRaw));
-    Stdin { inner: &INSTANCE }
+    Stdin {
+        nonblocking: AtomicBool::new(false),
+    }
 }
 
 /// Constructs a new handle to the standard output of the current process.
@@ -107,7 +96,11 @@ pub fn stdout() -> Stdout {
 
 impl super::FileLike for Stdin {
     fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
-        Ok(self.read_blocked(buf)?)
+        if self.nonblocking.load(Ordering::Relaxed) {
+            self.read_nonblocking(buf)
+        } else {
+            Ok(self.read_blocked(buf)?)
+        }
     }
 
     fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
@@ -127,14 +120,24 @@ impl super::FileLike for Stdin {
 
     fn poll(&self) -> LinuxResult<PollState> {
         Ok(PollState {
-            readable: true,
+            readable: has_console_input(),
             writable: true,
         })
     }
 
-    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
         Ok(())
     }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        register_console_waker(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        unregister_console_waker(waker);
+    }
 }
 
 impl super::FileLike for Stdout {
@@ -165,6 +168,71 @@ impl super::FileLike for Stdout {
     }
 
     fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        // Console output never blocks.
         Ok(())
     }
+
+    fn register_waker(&self, _waker: &Arc<dyn Wake>) -> bool {
+        // Console output is always ready.
+        true
+    }
+}
+
+/// A standard output that is captured in memory instead of written to the
+/// console, so that the output of programs running at the same time can be
+/// reported one after another.
+#[derive(Default)]
+pub struct CapturedOutput {
+    buf: Mutex<Vec<u8>>,
+}
+
+impl CapturedOutput {
+    /// Creates an empty captured output.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Takes the output captured so far.
+    pub fn take(&self) -> Vec<u8> {
+        core::mem::take(&mut *self.buf.lock())
+    }
+}
+
+impl super::FileLike for CapturedOutput {
+    fn read(&self, _buf: &mut [u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EPERM)
+    }
+
+    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+        self.buf.lock().extend_from_slice(buf);
+        Ok(buf.len())
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        // Looks like the console to the program.
+        Ok(Kstat {
+            mode: S_IFCHR | 0o220u32, // -w--w----
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: true,
+            writable: true,
+        })
+    }
+
+    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        Ok(())
+    }
+
+    fn register_waker(&self, _waker: &Arc<dyn Wake>) -> bool {
+        // Always ready, like the console.
+        true
+    }
 }
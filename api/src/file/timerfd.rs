@@ -0,0 +1,234 @@
+use core::{
+    any::Any,
+    sync::atomic::{AtomicBool, Ordering},
+    time::Duration,
+};
+
+use alloc::sync::{Arc, Weak};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::time::{TimeValue, wall_time};
+use axio::PollState;
+use axsync::spin::SpinNoIrq;
+use axtask::WaitQueue;
+
+use super::{FileLike, Kstat, PollWakers, Wake};
+
+/// The state of an armed timer, in terms of [`wall_time`], which is the
+/// time base of the `axtask` timer list.
+#[derive(Clone, Copy)]
+struct Arming {
+    deadline: TimeValue,
+    interval: Duration,
+}
+
+impl Arming {
+    /// Number of expirations up to `now`.
+    fn expirations(&self, now: TimeValue) -> u64 {
+        if now < self.deadline {
+            0
+        } else if self.interval.is_zero() {
+            1
+        } else {
+            1 + ((now - self.deadline).as_nanos() / self.interval.as_nanos()) as u64
+        }
+    }
+
+    /// The time of the first expiration after `now`, if any.
+    fn next_after(&self, now: TimeValue) -> Option<TimeValue> {
+        if now < self.deadline {
+            Some(self.deadline)
+        } else if self.interval.is_zero() {
+            None
+        } else {
+            let elapsed = self.interval.as_nanos() * self.expirations(now) as u128;
+            Some(self.deadline + Duration::from_nanos(elapsed as u64))
+        }
+    }
+}
+
+struct TimerState {
+    arming: Option<Arming>,
+    /// Expirations already consumed by `read`.
+    consumed: u64,
+    /// Incremented on every `settime`, so that stale alarms are ignored.
+    generation: u64,
+}
+
+impl TimerState {
+    fn available(&self, now: TimeValue) -> u64 {
+        self.arming
+            .map_or(0, |arming| arming.expirations(now) - self.consumed)
+    }
+}
+
+struct TimerInner {
+    state: SpinNoIrq<TimerState>,
+    read_wq: WaitQueue,
+    wakers: PollWakers,
+}
+
+impl TimerInner {
+    /// Sets an alarm on the `axtask` timer list for the next expiration.
+    fn schedule(self: &Arc<Self>, deadline: TimeValue, generation: u64) {
+        let timer = Arc::downgrade(self);
+        axtask::set_alarm(deadline, move |now| Self::fire(timer, generation, now));
+    }
+
+    /// Alarm callback, running in the timer interrupt.
+    ///
+    /// Every expiration wakes up the readers and the pollers, including
+    /// edge-triggered ones, so the alarm is set again for the next period.
+    /// The periods missed in between are not lost: the expirations are
+    /// counted from the interval.
+    fn fire(timer: Weak<Self>, generation: u64, now: TimeValue) {
+        let Some(timer) = timer.upgrade() else {
+            return;
+        };
+        let next = {
+            let state = timer.state.lock();
+            if state.generation != generation {
+                return;
+            }
+            state.arming.and_then(|arming| arming.next_after(now))
+        };
+        timer.read_wq.notify_all(false);
+        timer.wakers.wake_all();
+        if let Some(next) = next {
+            timer.schedule(next, generation);
+        }
+    }
+}
+
+/// A timer created by `timerfd_create`.
+pub struct TimerFd {
+    /// Offset from the clock of the timer to [`wall_time`].
+    clock_offset: fn() -> TimeValue,
+    nonblocking: AtomicBool,
+    inner: Arc<TimerInner>,
+}
+
+impl TimerFd {
+    /// Creates a timer on a clock, given by the offset from its time to
+    /// [`wall_time`].
+    pub fn new(clock_offset: fn() -> TimeValue) -> Self {
+        Self {
+            clock_offset,
+            nonblocking: AtomicBool::new(false),
+            inner: Arc::new(TimerInner {
+                state: SpinNoIrq::new(TimerState {
+                    arming: None,
+                    consumed: 0,
+                    generation: 0,
+                }),
+                read_wq: WaitQueue::new(),
+                wakers: PollWakers::new(),
+            }),
+        }
+    }
+
+    /// Returns the current value and interval of the timer.
+    pub fn get(&self) -> (Duration, Duration) {
+        let now = wall_time();
+        let state = self.inner.state.lock();
+        state.arming.map_or((Duration::ZERO, Duration::ZERO), |arming| {
+            let remaining = arming
+                .next_after(now)
+                .map_or(Duration::ZERO, |next| next - now);
+            (remaining, arming.interval)
+        })
+    }
+
+    /// Arms (or disarms, if `value` is zero) the timer, returning the old
+    /// value and interval.
+    ///
+    /// `value` is an absolute time on the clock of the timer if `absolute`
+    /// is set, or relative to now otherwise.
+    pub fn set(
+        &self,
+        value: Duration,
+        interval: Duration,
+        absolute: bool,
+    ) -> (Duration, Duration) {
+        let old = self.get();
+        let arming = (!value.is_zero()).then(|| Arming {
+            deadline: if absolute {
+                value + (self.clock_offset)()
+            } else {
+                wall_time() + value
+            },
+            interval,
+        });
+
+        let generation = {
+            let mut state = self.inner.state.lock();
+            state.arming = arming;
+            state.consumed = 0;
+            state.generation += 1;
+            state.generation
+        };
+        if let Some(arming) = arming {
+            self.inner.schedule(arming.deadline, generation);
+        }
+        old
+    }
+}
+
+impl FileLike for TimerFd {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        let Some(buf) = buf.first_chunk_mut::<8>() else {
+            return Err(LinuxError::EINVAL);
+        };
+        let available = || self.inner.state.lock().available(wall_time());
+        loop {
+            {
+                let mut state = self.inner.state.lock();
+                let count = state.available(wall_time());
+                if count > 0 {
+                    state.consumed += count;
+                    *buf = count.to_ne_bytes();
+                    return Ok(8);
+                }
+            }
+            if self.nonblocking.load(Ordering::Relaxed) {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.inner.read_wq.wait_until(|| available() > 0);
+        }
+    }
+
+    fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: 0o600u32, // rw-------
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: self.inner.state.lock().available(wall_time()) > 0,
+            writable: false,
+        })
+    }
+
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.inner.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.inner.wakers.unregister(waker);
+    }
+}
@@ -0,0 +1,502 @@
+//! Unix domain sockets, connected in pairs by `socketpair`.
+//!
+//! Each direction of a pair is a queue of messages owned by the receiving
+//! end. Sending copies the data once into a buffer, which is then handed over
+//! to the peer as is, instead of going through the network stack. Files passed
+//! with `SCM_RIGHTS` travel in the queue along with the data.
+
+use core::{
+    any::Any,
+    ffi::c_int,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use alloc::{collections::VecDeque, sync::Arc, vec::Vec};
+use axerrno::{LinuxError, LinuxResult};
+use axio::PollState;
+use axsync::Mutex;
+use axtask::WaitQueue;
+use linux_raw_sys::general::S_IFSOCK;
+
+use super::{FileLike, Kstat, PollWakers, Wake, get_file_like};
+
+/// The number of bytes that can be queued in each direction, which is the
+/// default `wmem_default` of Linux.
+const UNIX_BUF_SIZE: usize = 212992;
+
+/// The most files that can be passed in one message, as on Linux.
+pub const SCM_MAX_FD: usize = 253;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum UnixSocketType {
+    Stream,
+    Datagram,
+    SeqPacket,
+}
+
+impl UnixSocketType {
+    /// Whether message boundaries are preserved.
+    const fn is_message(self) -> bool {
+        !matches!(self, Self::Stream)
+    }
+}
+
+/// Data sent in one go, with the files passed along with it.
+struct Message {
+    data: Vec<u8>,
+    /// How much of `data` has been read, for stream sockets.
+    pos: usize,
+    files: Vec<Arc<dyn FileLike>>,
+}
+
+impl Message {
+    fn remaining(&self) -> &[u8] {
+        &self.data[self.pos..]
+    }
+}
+
+/// The messages sent in one direction of a pair.
+struct Channel {
+    queue: Mutex<VecDeque<Message>>,
+    /// The number of bytes and messages queued, readable without taking
+    /// `queue`, so that they can be checked from wait queue conditions.
+    bytes: AtomicUsize,
+    messages: AtomicUsize,
+    /// Whether the receiving end has been closed.
+    rx_closed: AtomicBool,
+    /// Whether the sending end has been closed.
+    tx_closed: AtomicBool,
+    /// Receivers waiting for messages.
+    read_wq: WaitQueue,
+    /// Senders waiting for space.
+    write_wq: WaitQueue,
+    /// Pollers watching either end.
+    wakers: PollWakers,
+}
+
+impl Channel {
+    fn new() -> Self {
+        Self {
+            queue: Mutex::new(VecDeque::new()),
+            bytes: AtomicUsize::new(0),
+            messages: AtomicUsize::new(0),
+            rx_closed: AtomicBool::new(false),
+            tx_closed: AtomicBool::new(false),
+            read_wq: WaitQueue::new(),
+            write_wq: WaitQueue::new(),
+            wakers: PollWakers::new(),
+        }
+    }
+
+    fn space(&self) -> usize {
+        UNIX_BUF_SIZE.saturating_sub(self.bytes.load(Ordering::Acquire))
+    }
+
+    fn is_empty(&self) -> bool {
+        self.messages.load(Ordering::Acquire) == 0
+    }
+
+    fn rx_closed(&self) -> bool {
+        self.rx_closed.load(Ordering::Acquire)
+    }
+
+    fn tx_closed(&self) -> bool {
+        self.tx_closed.load(Ordering::Acquire)
+    }
+
+    /// Publishes the occupancy of `queue` to the atomic mirrors.
+    fn publish(&self, queue: &VecDeque<Message>) {
+        let bytes = queue.iter().map(|msg| msg.remaining().len()).sum();
+        self.bytes.store(bytes, Ordering::Release);
+        self.messages.store(queue.len(), Ordering::Release);
+    }
+
+    fn notify_readers(&self) {
+        self.read_wq.notify_one(true);
+        self.wakers.wake_all();
+    }
+
+    fn notify_writers(&self) {
+        self.write_wq.notify_one(true);
+        self.wakers.wake_all();
+    }
+}
+
+/// A message taken out of a socket by [`UnixSocket::recv`].
+pub struct Received {
+    /// The number of bytes copied out.
+    pub len: usize,
+    /// Whether the rest of a datagram did not fit and was discarded.
+    pub truncated: bool,
+    /// The files passed along with the data.
+    pub files: Vec<Arc<dyn FileLike>>,
+}
+
+/// One end of a pair of Unix domain sockets.
+///
+/// Passing an end of a pair over the pair itself keeps both ends alive until
+/// the message is received, as there is no garbage collection of in-flight
+/// files.
+pub struct UnixSocket {
+    ty: UnixSocketType,
+    nonblocking: AtomicBool,
+    /// Messages sent to this end.
+    rx: Arc<Channel>,
+    /// Messages sent by this end.
+    tx: Arc<Channel>,
+}
+
+impl UnixSocket {
+    /// Creates a pair of connected sockets of type `ty`.
+    pub fn pair(ty: UnixSocketType) -> (UnixSocket, UnixSocket) {
+        let (a, b) = (Arc::new(Channel::new()), Arc::new(Channel::new()));
+        let end = |rx: &Arc<Channel>, tx: &Arc<Channel>| UnixSocket {
+            ty,
+            nonblocking: AtomicBool::new(false),
+            rx: rx.clone(),
+            tx: tx.clone(),
+        };
+        (end(&a, &b), end(&b, &a))
+    }
+
+    pub const fn socket_type(&self) -> UnixSocketType {
+        self.ty
+    }
+
+    /// Whether this end is in nonblocking mode.
+    pub fn nonblocking(&self) -> bool {
+        self.nonblocking.load(Ordering::Relaxed)
+    }
+
+    /// The error of sending to a peer that has been closed.
+    const fn peer_closed_error(&self) -> LinuxError {
+        match self.ty {
+            UnixSocketType::Datagram => LinuxError::ECONNREFUSED,
+            _ => LinuxError::EPIPE,
+        }
+    }
+
+    /// Waits until `size` bytes can be queued to the peer.
+    fn wait_writable(&self, size: usize, nonblocking: bool) -> LinuxResult {
+        let ready = || self.tx.space() >= size;
+        if !ready() && !self.tx.rx_closed() {
+            if nonblocking {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.tx
+                .write_wq
+                .wait_until(|| ready() || self.tx.rx_closed());
+        }
+        if self.tx.rx_closed() {
+            Err(self.peer_closed_error())
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Waits until there is a message to receive, returning `false` if there
+    /// is none and the peer has been closed.
+    fn wait_readable(&self, nonblocking: bool) -> LinuxResult<bool> {
+        let ready = || !self.rx.is_empty();
+        if !ready() && !self.rx.tx_closed() {
+            if nonblocking {
+                return Err(LinuxError::EAGAIN);
+            }
+            self.rx
+                .read_wq
+                .wait_until(|| ready() || self.rx.tx_closed());
+        }
+        Ok(ready())
+    }
+
+    /// Sends the data in `bufs` to the peer, along with `files`.
+    ///
+    /// A datagram is queued as a whole, or not at all. A stream may be sent
+    /// partially if the peer is closed or `nonblocking` is set, and the files
+    /// go with its first byte.
+    pub fn send(
+        &self,
+        bufs: &[&[u8]],
+        files: Vec<Arc<dyn FileLike>>,
+        nonblocking: bool,
+    ) -> LinuxResult<usize> {
+        if self.tx.rx_closed() {
+            return Err(self.peer_closed_error());
+        }
+        let total_len = bufs.iter().map(|buf| buf.len()).sum::<usize>();
+        if self.ty.is_message() {
+            self.send_message(bufs, total_len, files, nonblocking)
+        } else {
+            self.send_stream(bufs, total_len, files, nonblocking)
+        }
+    }
+
+    fn send_message(
+        &self,
+        bufs: &[&[u8]],
+        total_len: usize,
+        files: Vec<Arc<dyn FileLike>>,
+        nonblocking: bool,
+    ) -> LinuxResult<usize> {
+        if total_len > UNIX_BUF_SIZE {
+            return Err(LinuxError::EMSGSIZE);
+        }
+        // Gather the data before waiting, so that the queue is only locked to
+        // hand the buffer over.
+        let mut data = Vec::with_capacity(total_len);
+        for buf in bufs {
+            data.extend_from_slice(buf);
+        }
+        let mut queue = loop {
+            self.wait_writable(total_len, nonblocking)?;
+            let queue = self.tx.queue.lock();
+            // Checked again under the lock, as a closing peer drops whatever
+            // is queued.
+            if self.tx.rx_closed() {
+                return Err(self.peer_closed_error());
+            }
+            if self.tx.space() >= total_len {
+                break queue;
+            }
+        };
+        queue.push_back(Message {
+            data,
+            pos: 0,
+            files,
+        });
+        self.tx.publish(&queue);
+        drop(queue);
+        self.tx.notify_readers();
+        Ok(total_len)
+    }
+
+    fn send_stream(
+        &self,
+        bufs: &[&[u8]],
+        total_len: usize,
+        mut files: Vec<Arc<dyn FileLike>>,
+        nonblocking: bool,
+    ) -> LinuxResult<usize> {
+        if total_len == 0 && files.is_empty() {
+            return Ok(0);
+        }
+        // The position in `bufs` of the next byte to send.
+        let (mut index, mut offset) = (0, 0);
+        let mut sent = 0;
+        loop {
+            match self.wait_writable(1, nonblocking) {
+                Ok(()) => {}
+                Err(_) if sent > 0 => break,
+                Err(err) => return Err(err),
+            }
+            let mut queue = self.tx.queue.lock();
+            if self.tx.rx_closed() {
+                drop(queue);
+                if sent > 0 {
+                    break;
+                }
+                return Err(self.peer_closed_error());
+            }
+            let chunk = (total_len - sent).min(self.tx.space());
+            if chunk == 0 && total_len > 0 {
+                continue;
+            }
+            // Data without files is appended to the last message, so that a
+            // stream of small writes does not become a long queue.
+            let message = match queue.back_mut() {
+                Some(last) if files.is_empty() && last.files.is_empty() => last,
+                _ => {
+                    queue.push_back(Message {
+                        data: Vec::with_capacity(chunk),
+                        pos: 0,
+                        files: core::mem::take(&mut files),
+                    });
+                    queue.back_mut().unwrap()
+                }
+            };
+            let mut copied = 0;
+            while copied < chunk {
+                let buf = &bufs[index][offset..];
+                let n = buf.len().min(chunk - copied);
+                message.data.extend_from_slice(&buf[..n]);
+                copied += n;
+                offset += n;
+                if offset == bufs[index].len() {
+                    index += 1;
+                    offset = 0;
+                }
+            }
+            self.tx.publish(&queue);
+            drop(queue);
+            sent += copied;
+            self.tx.notify_readers();
+            if sent == total_len {
+                break;
+            }
+        }
+        Ok(sent)
+    }
+
+    /// Receives data into `bufs`, along with the files passed with it.
+    ///
+    /// A datagram is received as a whole, and the rest of it is discarded if
+    /// it does not fit. A stream is read up to the next message that carries
+    /// files, so that they are received with their own data. Returns an empty
+    /// message once the peer is closed and everything has been received.
+    pub fn recv(&self, bufs: &mut [&mut [u8]], nonblocking: bool) -> LinuxResult<Received> {
+        let mut received = Received {
+            len: 0,
+            truncated: false,
+            files: Vec::new(),
+        };
+        loop {
+            if !self.wait_readable(nonblocking)? {
+                return Ok(received);
+            }
+            let mut queue = self.rx.queue.lock();
+            if queue.is_empty() {
+                continue;
+            }
+            if self.ty.is_message() {
+                let message = queue.pop_front().unwrap();
+                received.len = copy_to_bufs(bufs, &message.data);
+                received.truncated = received.len < message.data.len();
+                received.files = message.files;
+            } else {
+                let mut first = true;
+                while let Some(message) = queue.front_mut() {
+                    if !first && !message.files.is_empty() {
+                        break;
+                    }
+                    first = false;
+                    received.files.append(&mut message.files);
+                    let (index, offset) = position(bufs, received.len);
+                    let n = copy_to_bufs_at(bufs, index, offset, message.remaining());
+                    message.pos += n;
+                    received.len += n;
+                    if message.pos < message.data.len() {
+                        break;
+                    }
+                    queue.pop_front();
+                }
+            }
+            self.rx.publish(&queue);
+            drop(queue);
+            self.rx.notify_writers();
+            return Ok(received);
+        }
+    }
+}
+
+/// Returns the position in `bufs` of the byte at `pos`.
+fn position(bufs: &[&mut [u8]], mut pos: usize) -> (usize, usize) {
+    for (index, buf) in bufs.iter().enumerate() {
+        if pos < buf.len() {
+            return (index, pos);
+        }
+        pos -= buf.len();
+    }
+    (bufs.len(), 0)
+}
+
+/// Copies `data` into `bufs` from their beginning, returning the number of
+/// bytes copied.
+fn copy_to_bufs(bufs: &mut [&mut [u8]], data: &[u8]) -> usize {
+    copy_to_bufs_at(bufs, 0, 0, data)
+}
+
+/// Copies `data` into `bufs` from `offset` in the buffer at `index`, returning
+/// the number of bytes copied.
+fn copy_to_bufs_at(bufs: &mut [&mut [u8]], index: usize, offset: usize, data: &[u8]) -> usize {
+    let mut copied = 0;
+    let mut offset = offset;
+    for buf in bufs.iter_mut().skip(index) {
+        let n = (buf.len() - offset).min(data.len() - copied);
+        buf[offset..offset + n].copy_from_slice(&data[copied..copied + n]);
+        copied += n;
+        offset = 0;
+        if copied == data.len() {
+            break;
+        }
+    }
+    copied
+}
+
+impl Drop for UnixSocket {
+    fn drop(&mut self) {
+        // Files still queued to this end can never be received now.
+        self.rx.rx_closed.store(true, Ordering::Release);
+        let queued = core::mem::take(&mut *self.rx.queue.lock());
+        self.rx.publish(&VecDeque::new());
+        drop(queued);
+        self.rx.write_wq.notify_all(false);
+        self.rx.wakers.wake_all();
+
+        // Wake up the peer so that it can observe the closure.
+        self.tx.tx_closed.store(true, Ordering::Release);
+        self.tx.read_wq.notify_all(false);
+        self.tx.wakers.wake_all();
+    }
+}
+
+impl FileLike for UnixSocket {
+    fn read(&self, buf: &mut [u8]) -> LinuxResult<usize> {
+        self.read_vectored(&mut [buf])
+    }
+
+    fn write(&self, buf: &[u8]) -> LinuxResult<usize> {
+        self.write_vectored(&[buf])
+    }
+
+    fn read_vectored(&self, bufs: &mut [&mut [u8]]) -> LinuxResult<usize> {
+        // Files can only be received by `recvmsg`, and are closed otherwise.
+        Ok(self.recv(bufs, self.nonblocking())?.len)
+    }
+
+    fn write_vectored(&self, bufs: &[&[u8]]) -> LinuxResult<usize> {
+        self.send(bufs, Vec::new(), self.nonblocking())
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat {
+            mode: S_IFSOCK | 0o777u32, // rwxrwxrwx
+            ..Default::default()
+        })
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        // A closed peer makes the operation return immediately, so it counts
+        // as ready too.
+        Ok(PollState {
+            readable: !self.rx.is_empty() || self.rx.tx_closed(),
+            writable: self.tx.space() > 0 || self.tx.rx_closed(),
+        })
+    }
+
+    fn set_nonblocking(&self, nonblocking: bool) -> LinuxResult {
+        self.nonblocking.store(nonblocking, Ordering::Relaxed);
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.rx.wakers.register(waker);
+        self.tx.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.rx.wakers.unregister(waker);
+        self.tx.wakers.unregister(waker);
+    }
+
+    fn from_fd(fd: c_int) -> LinuxResult<Arc<Self>> {
+        get_file_like(fd)?
+            .into_any()
+            .downcast::<Self>()
+            .map_err(|_| LinuxError::ENOTSOCK)
+    }
+}
@@ -0,0 +1,104 @@
+use core::{
+    sync::atomic::{AtomicBool, Ordering},
+    time::Duration,
+};
+
+use alloc::{sync::Arc, vec::Vec};
+use axtask::WaitQueue;
+use axsync::spin::SpinNoIrq;
+use starry_core::task::SignalWaker;
+
+/// Something to be notified whenever the readiness of a file may have
+/// changed.
+pub trait Wake: Send + Sync {
+    fn wake(&self);
+}
+
+/// A waker that a poller sleeps on, woken by any of the files it watches
+/// whenever their readiness may have changed.
+pub struct PollWaker {
+    woken: AtomicBool,
+    wq: WaitQueue,
+}
+
+impl PollWaker {
+    pub fn new() -> Arc<Self> {
+        Arc::new(Self {
+            woken: AtomicBool::new(false),
+            wq: WaitQueue::new(),
+        })
+    }
+
+    /// Clears any pending wake-up, which must be done before scanning the
+    /// watched files so that no change made during the scan is missed.
+    pub fn reset(&self) {
+        self.woken.store(false, Ordering::Release);
+    }
+
+    /// Returns a callback that wakes up the poller when a signal arrives.
+    pub fn signal_waker(self: &Arc<Self>) -> SignalWaker {
+        let waker = self.clone();
+        Arc::new(move || waker.wake())
+    }
+
+    /// Sleeps until woken up or until `timeout` has elapsed.
+    ///
+    /// Returns `true` if the timeout has elapsed.
+    pub fn wait(&self, timeout: Option<Duration>) -> bool {
+        let woken = || self.woken.load(Ordering::Acquire);
+        match timeout {
+            Some(timeout) => self.wq.wait_timeout_until(timeout, woken),
+            None => {
+                self.wq.wait_until(woken);
+                false
+            }
+        }
+    }
+}
+
+impl Wake for PollWaker {
+    fn wake(&self) {
+        self.woken.store(true, Ordering::Release);
+        self.wq.notify_one(true);
+    }
+}
+
+/// The set of wakers watching a file.
+///
+/// It may be woken up from interrupt context (e.g. by timers), hence the
+/// IRQ-safe lock.
+pub struct PollWakers(SpinNoIrq<Vec<Arc<dyn Wake>>>);
+
+impl PollWakers {
+    pub const fn new() -> Self {
+        Self(SpinNoIrq::new(Vec::new()))
+    }
+
+    pub fn register(&self, waker: &Arc<dyn Wake>) {
+        self.0.lock().push(waker.clone());
+    }
+
+    pub fn unregister(&self, waker: &Arc<dyn Wake>) {
+        // Compare the data pointers only, as vtables are not unique.
+        let ptr = Arc::as_ptr(waker) as *const ();
+        self.0.lock().retain(|w| Arc::as_ptr(w) as *const () != ptr);
+    }
+
+    /// Whether nobody is watching the file.
+    pub fn is_empty(&self) -> bool {
+        self.0.lock().is_empty()
+    }
+
+    /// Wakes up everyone watching the file.
+    pub fn wake_all(&self) {
+        for waker in self.0.lock().iter() {
+            waker.wake();
+        }
+    }
+}
+
+impl Default for PollWakers {
+    fn default() -> Self {
+        Self::new()
+    }
+}
@@ -4,16 +4,16 @@ use core::{
 };
 
 use alloc::ffi::CString;
-use axerrno::{LinuxError, LinuxResult};
-use axfs::fops::DirEntry;
+use axerrno::{AxError, LinuxError, LinuxResult};
 use linux_raw_sys::general::{
     AT_FDCWD, AT_REMOVEDIR, DT_BLK, DT_CHR, DT_DIR, DT_FIFO, DT_LNK, DT_REG, DT_SOCK, DT_UNKNOWN,
     linux_dirent64,
 };
+use starry_core::mm::{forget_file_pages, invalidate_exec_image};
 
 use crate::{
-    file::{Directory, FileLike},
-    path::{HARDLINK_MANAGER, handle_file_path},
+    file::{Directory, FileLike, get_file_like},
+    path::handle_file_path,
     ptr::{UserConstPtr, UserPtr, nullable},
 };
 
@@ -25,9 +25,8 @@ use crate::{
 /// * `op` - The request code. It is of type unsigned long in glibc and BSD,
 ///   and of type int in musl and other UNIX systems.
 /// * `argp` - The argument to the request. It is a pointer to a memory location
-pub fn sys_ioctl(_fd: i32, _op: usize, _argp: UserPtr<c_void>) -> LinuxResult<isize> {
-    warn!("Unimplemented syscall: SYS_IOCTL");
-    Ok(0)
+pub fn sys_ioctl(fd: i32, op: usize, argp: UserPtr<c_void>) -> LinuxResult<isize> {
+    get_file_like(fd)?.ioctl(op as u32, argp.address().as_usize())
 }
 
 pub fn sys_chdir(path: UserConstPtr<c_char>) -> LinuxResult<isize> {
@@ -71,10 +70,15 @@ pub enum FileType {
 
 impl From<axfs::api::FileType> for FileType {
     fn from(ft: axfs::api::FileType) -> Self {
+        use axfs::api::FileType as Ty;
         match ft {
-            ft if ft.is_dir() => FileType::Dir,
-            ft if ft.is_file() => FileType::Reg,
-            _ => FileType::Unknown,
+            Ty::Fifo => FileType::Fifo,
+            Ty::CharDevice => FileType::Chr,
+            Ty::Dir => FileType::Dir,
+            Ty::BlockDevice => FileType::Blk,
+            Ty::File => FileType::Reg,
+            Ty::SymLink => FileType::Lnk,
+            Ty::Socket => FileType::Socket,
         }
     }
 }
@@ -94,7 +98,7 @@ impl<'a> DirBuffer<'a> {
         self.buf.len().saturating_sub(self.offset)
     }
 
-    fn write_entry(&mut self, d_type: FileType, name: &[u8]) -> bool {
+    fn write_entry(&mut self, ino: u64, off: u64, d_type: FileType, name: &[u8]) -> bool {
         const NAME_OFFSET: usize = offset_of!(linux_dirent64, d_name);
 
         let len = NAME_OFFSET + name.len() + 1;
@@ -107,9 +111,8 @@ impl<'a> DirBuffer<'a> {
         unsafe {
             let entry_ptr = self.buf.as_mut_ptr().add(self.offset);
             entry_ptr.cast::<linux_dirent64>().write(linux_dirent64 {
-                // FIXME: real inode number
-                d_ino: 1,
-                d_off: 0,
+                d_ino: ino,
+                d_off: off as _,
                 d_reclen: len as _,
                 d_type: d_type as _,
                 d_name: Default::default(),
@@ -137,31 +140,14 @@ pub fn sys_getdents64(fd: i32, buf: UserPtr<u8>, len: usize) -> LinuxResult<isiz
     let mut buffer = DirBuffer::new(buf);
 
     let dir = Directory::from_fd(fd)?;
-
-    let mut last_dirent = dir.last_dirent();
-    if let Some(ent) = last_dirent.take() {
-        if !buffer.write_entry(ent.entry_type().into(), ent.name_as_bytes()) {
-            *last_dirent = Some(ent);
-            return Err(LinuxError::EINVAL);
-        }
-    }
-
-    let mut inner = dir.inner();
-    loop {
-        let mut dirents = [DirEntry::default()];
-        let cnt = inner.read_dir(&mut dirents)?;
-        if cnt == 0 {
-            break;
-        }
-
-        let [ent] = dirents;
-        if !buffer.write_entry(ent.entry_type().into(), ent.name_as_bytes()) {
-            *last_dirent = Some(ent);
-            break;
-        }
-    }
-
-    if last_dirent.is_some() && buffer.offset == 0 {
+    let mut full = false;
+    dir.read_entries(|entry, ino, next| {
+        let name = entry.name_as_bytes();
+        full = !buffer.write_entry(ino, next, entry.entry_type().into(), name);
+        !full
+    })?;
+
+    if full && buffer.offset == 0 {
         return Err(LinuxError::EINVAL);
     }
     Ok(buffer.offset as _)
@@ -195,7 +181,11 @@ pub fn sys_linkat(
     // handle new path
     let new_path = handle_file_path(new_dirfd, new_path)?;
 
-    HARDLINK_MANAGER.create_link(&new_path, &old_path)?;
+    axfs::api::hard_link(old_path.as_str(), new_path.as_str()).map_err(|e| match e {
+        // The filesystem does not support hard links.
+        AxError::Unsupported => LinuxError::EPERM,
+        e => e.into(),
+    })?;
 
     Ok(0)
 }
@@ -223,15 +213,25 @@ pub fn sys_unlinkat(dirfd: c_int, path: UserConstPtr<c_char>, flags: u32) -> Lin
 
     if flags == AT_REMOVEDIR {
         axfs::api::remove_dir(path.as_str())?;
+    } else if axfs::api::read_link(path.as_str()).is_ok() {
+        // The link is removed, not its target.
+        axfs::api::remove_file(path.as_str())?;
     } else {
         let metadata = axfs::api::metadata(path.as_str())?;
         if metadata.is_dir() {
             return Err(LinuxError::EISDIR);
         } else {
             debug!("unlink file: {:?}", path);
-            HARDLINK_MANAGER
-                .remove_link(&path)
-                .ok_or(LinuxError::ENOENT)?;
+            // The pages of a file mapped shared outlive its last link only for
+            // the existing mappings.
+            let last_link = axfs::api::file_info(path.as_str())
+                .ok()
+                .filter(|info| info.nlink <= 1);
+            axfs::api::remove_file(path.as_str())?;
+            if let Some(info) = last_link {
+                forget_file_pages((info.dev, info.ino));
+                invalidate_exec_image((info.dev, info.ino));
+            }
         }
     }
     Ok(0)
@@ -241,6 +241,71 @@ pub fn sys_unlink(path: UserConstPtr<c_char>) -> LinuxResult<isize> {
     sys_unlinkat(AT_FDCWD, path, 0)
 }
 
+/// Creates a symbolic link at `new_path`, relative to `new_dirfd`, to
+/// `target`, which need not exist.
+pub fn sys_symlinkat(
+    target: UserConstPtr<c_char>,
+    new_dirfd: c_int,
+    new_path: UserConstPtr<c_char>,
+) -> LinuxResult<isize> {
+    let target = target.get_as_str()?;
+    let new_path = new_path.get_as_str()?;
+    debug!(
+        "sys_symlinkat <= target: {}, new_dirfd: {}, new_path: {}",
+        target, new_dirfd, new_path
+    );
+
+    if target.is_empty() {
+        return Err(LinuxError::ENOENT);
+    }
+    let new_path = handle_file_path(new_dirfd, new_path)?;
+    if !axfs::api::metadata(new_path.parent()?)?.is_dir() {
+        return Err(LinuxError::ENOTDIR);
+    }
+    axfs::api::symlink(target, new_path.as_str())?;
+    Ok(0)
+}
+
+pub fn sys_symlink(
+    target: UserConstPtr<c_char>,
+    new_path: UserConstPtr<c_char>,
+) -> LinuxResult<isize> {
+    sys_symlinkat(target, AT_FDCWD, new_path)
+}
+
+/// Reads the target of the symbolic link at `path`, relative to `dirfd`,
+/// into `buf`, truncated to `size` bytes and without a terminating NUL.
+pub fn sys_readlinkat(
+    dirfd: c_int,
+    path: UserConstPtr<c_char>,
+    buf: UserPtr<u8>,
+    size: usize,
+) -> LinuxResult<isize> {
+    let path = path.get_as_str()?;
+    debug!(
+        "sys_readlinkat <= dirfd: {}, path: {}, size: {}",
+        dirfd, path, size
+    );
+
+    if size as isize <= 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let path = handle_file_path(dirfd, path)?;
+    let target = axfs::api::read_link(path.as_str())?;
+    let len = target.len().min(size);
+    buf.get_as_mut_slice(len)?
+        .copy_from_slice(&target.as_bytes()[..len]);
+    Ok(len as _)
+}
+
+pub fn sys_readlink(
+    path: UserConstPtr<c_char>,
+    buf: UserPtr<u8>,
+    size: usize,
+) -> LinuxResult<isize> {
+    sys_readlinkat(AT_FDCWD, path, buf, size)
+}
+
 pub fn sys_getcwd(buf: UserPtr<u8>, size: usize) -> LinuxResult<isize> {
     let buf = nullable!(buf.get_as_mut_slice(size))?;
 
@@ -0,0 +1,129 @@
+use core::ffi::c_int;
+
+use axerrno::{LinuxError, LinuxResult};
+use axhal::time::{TimeValue, epochoffset_nanos};
+use axsignal::{SignalSet, Signo};
+use linux_raw_sys::general::{
+    CLOCK_BOOTTIME, CLOCK_MONOTONIC, CLOCK_REALTIME, EFD_CLOEXEC, EFD_NONBLOCK, EFD_SEMAPHORE,
+    O_CLOEXEC, O_NONBLOCK, TFD_CLOEXEC, TFD_NONBLOCK, TFD_TIMER_ABSTIME, TFD_TIMER_CANCEL_ON_SET,
+    itimerspec, timespec,
+};
+
+use crate::{
+    file::{EventFd, FileLike, SignalFd, TimerFd},
+    ptr::{UserConstPtr, UserPtr, nullable},
+    time::TimeValueLike,
+};
+
+pub fn sys_eventfd2(initval: u32, flags: u32) -> LinuxResult<isize> {
+    debug!("sys_eventfd2 <= initval: {}, flags: {:#x}", initval, flags);
+    if flags & !(EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let eventfd = EventFd::new(initval as u64, flags & EFD_SEMAPHORE != 0);
+    if flags & EFD_NONBLOCK != 0 {
+        eventfd.set_nonblocking(true)?;
+    }
+    Ok(eventfd.add_to_fd_table(flags & EFD_CLOEXEC != 0)? as _)
+}
+
+#[cfg(target_arch = "x86_64")]
+pub fn sys_eventfd(initval: u32) -> LinuxResult<isize> {
+    sys_eventfd2(initval, 0)
+}
+
+pub fn sys_timerfd_create(clockid: u32, flags: u32) -> LinuxResult<isize> {
+    debug!("sys_timerfd_create <= clockid: {}, flags: {:#x}", clockid, flags);
+    if flags & !(TFD_CLOEXEC | TFD_NONBLOCK) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let clock_offset: fn() -> TimeValue = match clockid {
+        CLOCK_REALTIME => || TimeValue::ZERO,
+        CLOCK_MONOTONIC | CLOCK_BOOTTIME => || TimeValue::from_nanos(epochoffset_nanos()),
+        _ => return Err(LinuxError::EINVAL),
+    };
+    let timerfd = TimerFd::new(clock_offset);
+    if flags & TFD_NONBLOCK != 0 {
+        timerfd.set_nonblocking(true)?;
+    }
+    Ok(timerfd.add_to_fd_table(flags & TFD_CLOEXEC != 0)? as _)
+}
+
+fn to_itimerspec((value, interval): (TimeValue, TimeValue)) -> itimerspec {
+    itimerspec {
+        it_interval: timespec::from_time_value(interval),
+        it_value: timespec::from_time_value(value),
+    }
+}
+
+pub fn sys_timerfd_settime(
+    fd: c_int,
+    flags: u32,
+    new_value: UserConstPtr<itimerspec>,
+    old_value: UserPtr<itimerspec>,
+) -> LinuxResult<isize> {
+    debug!("sys_timerfd_settime <= fd: {}, flags: {:#x}", fd, flags);
+    if flags & !(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let timerfd = TimerFd::from_fd(fd)?;
+    let new_value = new_value.get_as_ref()?;
+    let value = new_value.it_value;
+    let interval = new_value.it_interval;
+    if value.tv_nsec as u64 >= 1_000_000_000 || interval.tv_nsec as u64 >= 1_000_000_000 {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let old = timerfd.set(
+        value.to_time_value(),
+        interval.to_time_value(),
+        flags & TFD_TIMER_ABSTIME != 0,
+    );
+    if let Some(old_value) = nullable!(old_value.get_as_mut())? {
+        *old_value = to_itimerspec(old);
+    }
+    Ok(0)
+}
+
+pub fn sys_timerfd_gettime(fd: c_int, curr_value: UserPtr<itimerspec>) -> LinuxResult<isize> {
+    *curr_value.get_as_mut()? = to_itimerspec(TimerFd::from_fd(fd)?.get());
+    Ok(0)
+}
+
+const SFD_CLOEXEC: u32 = O_CLOEXEC;
+const SFD_NONBLOCK: u32 = O_NONBLOCK;
+
+pub fn sys_signalfd4(
+    fd: c_int,
+    mask: UserConstPtr<SignalSet>,
+    sizemask: usize,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!("sys_signalfd4 <= fd: {}, flags: {:#x}", fd, flags);
+    if sizemask != size_of::<SignalSet>() || flags & !(SFD_CLOEXEC | SFD_NONBLOCK) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let mut mask = *mask.get_as_ref()?;
+    // SIGKILL and SIGSTOP cannot be accepted, and are silently ignored.
+    mask.remove(Signo::SIGKILL);
+    mask.remove(Signo::SIGSTOP);
+
+    if fd != -1 {
+        SignalFd::from_fd(fd)?.set_mask(mask);
+        return Ok(fd as _);
+    }
+    let signalfd = SignalFd::new(mask);
+    if flags & SFD_NONBLOCK != 0 {
+        signalfd.set_nonblocking(true)?;
+    }
+    Ok(signalfd.add_to_fd_table(flags & SFD_CLOEXEC != 0)? as _)
+}
+
+#[cfg(target_arch = "x86_64")]
+pub fn sys_signalfd(
+    fd: c_int,
+    mask: UserConstPtr<SignalSet>,
+    sizemask: usize,
+) -> LinuxResult<isize> {
+    sys_signalfd4(fd, mask, sizemask, 0)
+}
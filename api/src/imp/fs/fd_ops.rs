@@ -1,24 +1,31 @@
-use core::{
-    ffi::{c_char, c_int},
-    panic,
-};
+use core::ffi::{c_char, c_int};
 
-use alloc::string::ToString;
+use alloc::{string::ToString, sync::Arc};
 use axerrno::{AxError, LinuxError, LinuxResult};
 use axfs::fops::OpenOptions;
 use linux_raw_sys::general::{
-    __kernel_mode_t, AT_FDCWD, F_DUPFD, F_DUPFD_CLOEXEC, F_SETFL, O_APPEND, O_CREAT, O_DIRECTORY,
-    O_NONBLOCK, O_PATH, O_RDONLY, O_TRUNC, O_WRONLY,
+    __kernel_mode_t, AT_FDCWD, F_ADD_SEALS, F_DUPFD, F_DUPFD_CLOEXEC, F_GET_SEALS, F_GETFD,
+    F_GETFL, F_GETPIPE_SZ, F_SETFD, F_SETFL, F_SETPIPE_SZ, FD_CLOEXEC, MFD_ALLOW_SEALING,
+    MFD_CLOEXEC, O_APPEND, O_CLOEXEC, O_CREAT, O_DIRECT, O_DIRECTORY, O_EXCL, O_NOCTTY, O_NONBLOCK,
+    O_PATH, O_RDONLY, O_RDWR, O_TRUNC, O_WRONLY,
 };
 
 use crate::{
-    file::{Directory, FD_TABLE, File, FileLike, add_file_like, close_file_like, get_file_like},
+    file::{
+        Directory, FD_TABLE, File, FileLike, MemFd, Pipe, add_file_like, close_file_like,
+        file_limit, get_file_like,
+    },
     path::handle_file_path,
     ptr::UserConstPtr,
 };
 
 const O_EXEC: u32 = O_PATH;
 
+/// Flags of `close_range`, which the uapi headers define in
+/// `linux/close_range.h`.
+const CLOSE_RANGE_UNSHARE: u32 = 1 << 1;
+const CLOSE_RANGE_CLOEXEC: u32 = 1 << 2;
+
 /// Convert open flags to [`OpenOptions`].
 fn flags_to_options(flags: c_int, _mode: __kernel_mode_t) -> OpenOptions {
     let flags = flags as u32;
@@ -47,6 +54,9 @@ fn flags_to_options(flags: c_int, _mode: __kernel_mode_t) -> OpenOptions {
     if flags & O_DIRECTORY != 0 {
         options.directory(true);
     }
+    if flags & O_DIRECT != 0 {
+        options.direct(true);
+    }
     options
 }
 
@@ -66,6 +76,8 @@ pub fn sys_openat(
     let opts = flags_to_options(flags, mode);
     debug!("sys_openat <= {} {} {:?}", dirfd, path, opts);
 
+    let cloexec = flags as u32 & O_CLOEXEC != 0;
+
     let dir = if path.starts_with('/') || dirfd == AT_FDCWD {
         None
     } else {
@@ -80,7 +92,16 @@ pub fn sys_openat(
         ) {
             Err(AxError::IsADirectory) => {}
             r => {
-                let fd = File::new(r?, real_path.to_string()).add_to_fd_table()?;
+                // The creation flags only affect `open`.
+                let status = flags as u32 & !(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_CLOEXEC);
+                let file = File::new(r?, real_path.to_string(), status);
+                if flags as u32 & O_TRUNC != 0 {
+                    file.opened_truncated();
+                }
+                if flags as u32 & O_NONBLOCK != 0 {
+                    file.set_nonblocking(true)?;
+                }
+                let fd = file.add_to_fd_table(cloexec)?;
                 return Ok(fd as _);
             }
         }
@@ -93,7 +114,7 @@ pub fn sys_openat(
         )?,
         real_path.to_string(),
     )
-    .add_to_fd_table()?;
+    .add_to_fd_table(cloexec)?;
     Ok(fd as _)
 }
 
@@ -115,32 +136,52 @@ pub fn sys_close(fd: c_int) -> LinuxResult<isize> {
     Ok(0)
 }
 
-fn dup_fd(old_fd: c_int) -> LinuxResult<isize> {
+fn dup_fd(old_fd: c_int, cloexec: bool) -> LinuxResult<isize> {
     let f = get_file_like(old_fd)?;
-    let new_fd = add_file_like(f)?;
+    let new_fd = add_file_like(f, cloexec)?;
     Ok(new_fd as _)
 }
 
 pub fn sys_dup(old_fd: c_int) -> LinuxResult<isize> {
     debug!("sys_dup <= {}", old_fd);
-    dup_fd(old_fd)
+    dup_fd(old_fd, false)
 }
 
 pub fn sys_dup2(old_fd: c_int, new_fd: c_int) -> LinuxResult<isize> {
     debug!("sys_dup2 <= old_fd: {}, new_fd: {}", old_fd, new_fd);
-    let mut fd_table = FD_TABLE.write();
-    let f = fd_table
-        .get(old_fd as _)
-        .cloned()
-        .ok_or(LinuxError::EBADF)?;
-
-    if old_fd != new_fd {
-        fd_table.remove(new_fd as _);
-        fd_table
-            .add_at(new_fd as _, f)
-            .unwrap_or_else(|_| panic!("new_fd should be valid"));
+    if old_fd == new_fd {
+        get_file_like(old_fd)?;
+        return Ok(new_fd as _);
     }
+    dup_to(old_fd, new_fd, false)
+}
 
+pub fn sys_dup3(old_fd: c_int, new_fd: c_int, flags: c_int) -> LinuxResult<isize> {
+    debug!(
+        "sys_dup3 <= old_fd: {}, new_fd: {}, flags: {:#x}",
+        old_fd, new_fd, flags
+    );
+    let flags = flags as u32;
+    if old_fd == new_fd || flags & !O_CLOEXEC != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    dup_to(old_fd, new_fd, flags & O_CLOEXEC != 0)
+}
+
+/// Duplicates `old_fd` to `new_fd`, closing the file that was there.
+fn dup_to(old_fd: c_int, new_fd: c_int, cloexec: bool) -> LinuxResult<isize> {
+    if new_fd < 0 || new_fd as usize >= file_limit() {
+        return Err(LinuxError::EBADF);
+    }
+    // The file replaced is closed once the table is unlocked.
+    let _old = {
+        let mut fd_table = FD_TABLE.write();
+        let f = fd_table
+            .get(old_fd as _)
+            .cloned()
+            .ok_or(LinuxError::EBADF)?;
+        fd_table.add_at(new_fd as _, f, cloexec)
+    };
     Ok(new_fd as _)
 }
 
@@ -148,16 +189,36 @@ pub fn sys_fcntl(fd: c_int, cmd: c_int, arg: usize) -> LinuxResult<isize> {
     debug!("sys_fcntl <= fd: {} cmd: {} arg: {}", fd, cmd, arg);
 
     match cmd as u32 {
-        F_DUPFD => dup_fd(fd),
-        F_DUPFD_CLOEXEC => {
-            warn!("sys_fcntl: treat F_DUPFD_CLOEXEC as F_DUPFD");
-            dup_fd(fd)
+        F_DUPFD => dup_fd(fd, false),
+        F_DUPFD_CLOEXEC => dup_fd(fd, true),
+        F_GETFD => {
+            let cloexec = FD_TABLE.read().cloexec(fd as _).ok_or(LinuxError::EBADF)?;
+            Ok(if cloexec { FD_CLOEXEC as _ } else { 0 })
+        }
+        F_SETFD => {
+            let cloexec = arg & FD_CLOEXEC as usize != 0;
+            if !FD_TABLE.write().set_cloexec(fd as _, cloexec) {
+                return Err(LinuxError::EBADF);
+            }
+            Ok(0)
         }
+        F_GETFL => match get_file_like(fd)?.into_any().downcast::<File>() {
+            Ok(file) => Ok(file.flags() as _),
+            Err(_) => Ok(O_RDWR as _),
+        },
         F_SETFL => {
-            if fd == 0 || fd == 1 || fd == 2 {
-                return Ok(0);
+            let file = get_file_like(fd)?;
+            file.set_nonblocking(arg & (O_NONBLOCK as usize) > 0)?;
+            if let Ok(file) = file.into_any().downcast::<File>() {
+                file.set_flags(O_APPEND | O_NONBLOCK, arg as u32);
             }
-            get_file_like(fd)?.set_nonblocking(arg & (O_NONBLOCK as usize) > 0)?;
+            Ok(0)
+        }
+        F_GETPIPE_SZ => Ok(Pipe::from_fd(fd)?.capacity() as _),
+        F_SETPIPE_SZ => Ok(Pipe::from_fd(fd)?.resize(arg)? as _),
+        F_GET_SEALS => Ok(MemFd::from_fd(fd)?.seals() as _),
+        F_ADD_SEALS => {
+            MemFd::from_fd(fd)?.add_seals(arg as u32)?;
             Ok(0)
         }
         _ => {
@@ -166,3 +227,43 @@ pub fn sys_fcntl(fd: c_int, cmd: c_int, arg: usize) -> LinuxResult<isize> {
         }
     }
 }
+
+/// Creates an anonymous file in memory, which processes can share by mapping
+/// it with `MAP_SHARED`.
+pub fn sys_memfd_create(name: UserConstPtr<c_char>, flags: u32) -> LinuxResult<isize> {
+    let name = name.get_as_str()?;
+    debug!("sys_memfd_create <= name: {:?}, flags: {:#x}", name, flags);
+    // The name is shown as `memfd:<name>`, which is limited to 255 bytes.
+    if name.len() > 249 || flags & !(MFD_CLOEXEC | MFD_ALLOW_SEALING) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let memfd = MemFd::new(name, flags & MFD_ALLOW_SEALING != 0);
+    Ok(memfd.add_to_fd_table(flags & MFD_CLOEXEC != 0)? as _)
+}
+
+/// Closes the file descriptors in `first..=last`, or sets their
+/// close-on-exec flag with `CLOSE_RANGE_CLOEXEC`.
+pub fn sys_close_range(first: u32, last: u32, flags: u32) -> LinuxResult<isize> {
+    debug!(
+        "sys_close_range <= first: {}, last: {}, flags: {:#x}",
+        first, last, flags
+    );
+    if first > last || flags & !(CLOSE_RANGE_UNSHARE | CLOSE_RANGE_CLOEXEC) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    if flags & CLOSE_RANGE_UNSHARE != 0 && Arc::strong_count(&FD_TABLE.share()) > 2 {
+        // The table cannot be replaced, so the files would be closed for the
+        // processes sharing it as well.
+        warn!("sys_close_range: cannot unshare the fd table");
+        return Err(LinuxError::EINVAL);
+    }
+    let (first, last) = (first as usize, last as usize);
+    if flags & CLOSE_RANGE_CLOEXEC != 0 {
+        FD_TABLE.write().set_cloexec_range(first, last);
+    } else {
+        // The files are closed once the table is unlocked.
+        let files = FD_TABLE.write().remove_range(first, last);
+        drop(files);
+    }
+    Ok(0)
+}
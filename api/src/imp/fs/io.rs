@@ -1,15 +1,26 @@
 use core::ffi::c_int;
 
+use alloc::{sync::Arc, vec, vec::Vec};
 use axerrno::{LinuxError, LinuxResult};
+use axfs::fops::Advice;
 use axio::SeekFrom;
-use linux_raw_sys::general::{__kernel_off_t, iovec};
-use alloc::vec;
+use linux_raw_sys::general::{
+    __kernel_off_t, FALLOC_FL_KEEP_SIZE, FALLOC_FL_PUNCH_HOLE, FALLOC_FL_ZERO_RANGE, O_APPEND,
+    POSIX_FADV_DONTNEED, POSIX_FADV_NOREUSE, POSIX_FADV_NORMAL, POSIX_FADV_RANDOM,
+    POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED, SYNC_FILE_RANGE_WAIT_AFTER,
+    SYNC_FILE_RANGE_WAIT_BEFORE, SYNC_FILE_RANGE_WRITE, iovec,
+};
 
+use super::pipe::{SpliceTarget, as_pipe};
 use crate::{
-    file::{File, FileLike, get_file_like},
+    file::{Directory, File, FileLike, MemFd, Pipe, get_file_like},
     ptr::{UserConstPtr, UserPtr, nullable},
 };
 
+/// The size of the buffer of [`sys_sendfile`] from files that are neither
+/// pipes nor cached regular files, that of a pipe on Linux.
+const SPLICE_BUF_SIZE: usize = 0x10000;
+
 /// Read data from the file indicated by `fd`.
 ///
 /// Return the read size if success.
@@ -24,37 +35,102 @@ pub fn sys_read(fd: i32, buf: UserPtr<u8>, len: usize) -> LinuxResult<isize> {
     Ok(get_file_like(fd)?.read(buf)? as _)
 }
 
-///参照writev
-///用于从文件描述符读取数据到多个非连续的缓冲区
-pub fn sys_readv(fd: c_int, iov: UserPtr<iovec>, iocnt: usize) -> LinuxResult<isize> {
+/// Returns the non-empty buffers of the user iovec array `iov`.
+pub(crate) fn user_bufs_mut(iov: UserPtr<iovec>, iocnt: usize) -> LinuxResult<Vec<&'static mut [u8]>> {
     if !(0..=1024).contains(&iocnt) {
         return Err(LinuxError::EINVAL);
     }
 
     let iovs = iov.get_as_mut_slice(iocnt)?;
-    let mut ret = 0;
-    for iov in iovs {
+    let mut bufs = Vec::with_capacity(iovs.len());
+    for iov in iovs.iter() {
         if iov.iov_len == 0 {
             continue;
         }
         let buf = UserPtr::<u8>::from(iov.iov_base as usize);
-        let buf = buf.get_as_mut_slice(iov.iov_len as _)?;
-        debug!(
-            "sys_readv <= fd: {}, buf: {:p}, len: {}",
-            fd,
-            buf.as_ptr(),
-            buf.len()
-        );
+        bufs.push(buf.get_as_mut_slice(iov.iov_len as _)?);
+    }
+    Ok(bufs)
+}
 
-        let read = get_file_like(fd)?.read(buf)?;
-        ret += read as isize;
+/// Returns the non-empty buffers of the user iovec array `iov`.
+pub(crate) fn user_bufs(iov: UserConstPtr<iovec>, iocnt: usize) -> LinuxResult<Vec<&'static [u8]>> {
+    if !(0..=1024).contains(&iocnt) {
+        return Err(LinuxError::EINVAL);
+    }
 
-        if read < buf.len() {
-            break;
+    let iovs = iov.get_as_slice(iocnt)?;
+    let mut bufs = Vec::with_capacity(iovs.len());
+    for iov in iovs {
+        if iov.iov_len == 0 {
+            continue;
         }
+        let buf = UserConstPtr::<u8>::from(iov.iov_base as usize);
+        bufs.push(buf.get_as_slice(iov.iov_len as _)?);
+    }
+    Ok(bufs)
+}
+
+/// A file that can be read and written at any offset.
+trait Positional {
+    fn pread(&self, offset: u64, buf: &mut [u8]) -> LinuxResult<usize>;
+    fn pwrite(&self, offset: u64, buf: &[u8]) -> LinuxResult<usize>;
+}
+
+impl Positional for File {
+    fn pread(&self, offset: u64, buf: &mut [u8]) -> LinuxResult<usize> {
+        File::pread(self, offset, buf)
     }
 
-    Ok(ret)
+    fn pwrite(&self, offset: u64, buf: &[u8]) -> LinuxResult<usize> {
+        File::pwrite(self, offset, buf)
+    }
+}
+
+impl Positional for MemFd {
+    fn pread(&self, offset: u64, buf: &mut [u8]) -> LinuxResult<usize> {
+        MemFd::pread(self, offset, buf)
+    }
+
+    fn pwrite(&self, offset: u64, buf: &[u8]) -> LinuxResult<usize> {
+        MemFd::pwrite(self, offset, buf)
+    }
+}
+
+/// Returns the regular file `fd`, for positional I/O.
+fn positional_file(fd: c_int, offset: __kernel_off_t) -> LinuxResult<Arc<File>> {
+    if offset < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    get_file_like(fd)?
+        .into_any()
+        .downcast::<File>()
+        .map_err(|_| LinuxError::ESPIPE)
+}
+
+/// Returns the regular file or memfd `fd`, for positional reads and writes.
+fn positional(fd: c_int, offset: __kernel_off_t) -> LinuxResult<Arc<dyn Positional>> {
+    if offset < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let file = get_file_like(fd)?.into_any();
+    match file.downcast::<File>() {
+        Ok(file) => Ok(file),
+        Err(file) => match file.downcast::<MemFd>() {
+            Ok(memfd) => Ok(memfd),
+            Err(_) => Err(LinuxError::ESPIPE),
+        },
+    }
+}
+
+///参照writev
+///用于从文件描述符读取数据到多个非连续的缓冲区
+pub fn sys_readv(fd: c_int, iov: UserPtr<iovec>, iocnt: usize) -> LinuxResult<isize> {
+    let mut bufs = user_bufs_mut(iov, iocnt)?;
+    debug!("sys_readv <= fd: {}, iovs: {}", fd, bufs.len());
+
+    // Resolve the file once, and read all the buffers in one go.
+    Ok(get_file_like(fd)?.read_vectored(&mut bufs)? as _)
 }
 
 /// Write data to the file indicated by `fd`.
@@ -72,34 +148,101 @@ pub fn sys_write(fd: i32, buf: UserConstPtr<u8>, len: usize) -> LinuxResult<isiz
 }
 
 pub fn sys_writev(fd: i32, iov: UserConstPtr<iovec>, iocnt: usize) -> LinuxResult<isize> {
-    if !(0..=1024).contains(&iocnt) {
-        return Err(LinuxError::EINVAL);
-    }
+    let bufs = user_bufs(iov, iocnt)?;
+    debug!("sys_writev <= fd: {}, iovs: {}", fd, bufs.len());
 
-    let iovs = iov.get_as_slice(iocnt)?;
-    let mut ret = 0;
-    for iov in iovs {
-        if iov.iov_len == 0 {
-            continue;
-        }
-        let buf = UserConstPtr::<u8>::from(iov.iov_base as usize);
-        let buf = buf.get_as_slice(iov.iov_len as _)?;
-        debug!(
-            "sys_writev <= fd: {}, buf: {:p}, len: {}",
-            fd,
-            buf.as_ptr(),
-            buf.len()
-        );
+    Ok(get_file_like(fd)?.write_vectored(&bufs)? as _)
+}
 
-        let written = get_file_like(fd)?.write(buf)?;
-        ret += written as isize;
+/// Reads the file `fd` at `offset`, without moving its file offset.
+///
+/// Positional I/O does not take the lock of the file offset, so threads can
+/// read one file in parallel.
+pub fn sys_pread64(
+    fd: c_int,
+    buf: UserPtr<u8>,
+    len: usize,
+    offset: __kernel_off_t,
+) -> LinuxResult<isize> {
+    let buf = buf.get_as_mut_slice(len)?;
+    debug!(
+        "sys_pread64 <= fd: {}, len: {}, offset: {}",
+        fd, len, offset
+    );
+    Ok(positional(fd, offset)?.pread(offset as u64, buf)? as _)
+}
 
-        if written < buf.len() {
+/// Writes the file `fd` at `offset`, without moving its file offset.
+pub fn sys_pwrite64(
+    fd: c_int,
+    buf: UserConstPtr<u8>,
+    len: usize,
+    offset: __kernel_off_t,
+) -> LinuxResult<isize> {
+    let buf = buf.get_as_slice(len)?;
+    debug!(
+        "sys_pwrite64 <= fd: {}, len: {}, offset: {}",
+        fd, len, offset
+    );
+    Ok(positional(fd, offset)?.pwrite(offset as u64, buf)? as _)
+}
+
+pub fn sys_preadv(
+    fd: c_int,
+    iov: UserPtr<iovec>,
+    iocnt: usize,
+    offset: __kernel_off_t,
+) -> LinuxResult<isize> {
+    let bufs = user_bufs_mut(iov, iocnt)?;
+    debug!(
+        "sys_preadv <= fd: {}, iovs: {}, offset: {}",
+        fd,
+        bufs.len(),
+        offset
+    );
+    let file = positional(fd, offset)?;
+    let mut total = 0;
+    for buf in bufs {
+        let read = match file.pread(offset as u64 + total as u64, buf) {
+            Ok(read) => read,
+            Err(_) if total > 0 => break,
+            Err(e) => return Err(e),
+        };
+        total += read;
+        if read < buf.len() {
             break;
         }
     }
+    Ok(total as _)
+}
 
-    Ok(ret)
+pub fn sys_pwritev(
+    fd: c_int,
+    iov: UserConstPtr<iovec>,
+    iocnt: usize,
+    offset: __kernel_off_t,
+) -> LinuxResult<isize> {
+    let bufs = user_bufs(iov, iocnt)?;
+    debug!(
+        "sys_pwritev <= fd: {}, iovs: {}, offset: {}",
+        fd,
+        bufs.len(),
+        offset
+    );
+    let file = positional(fd, offset)?;
+    let mut total = 0;
+    for buf in bufs {
+        let written = match file.pwrite(offset as u64 + total as u64, buf) {
+            Ok(written) => written,
+            Err(_) if total > 0 => break,
+            Err(e) => return Err(e),
+        };
+        total += written;
+        if written < buf.len() {
+            break;
+        }
+    }
+    Ok(total as _)
 }
 
 pub fn sys_lseek(fd: c_int, offset: __kernel_off_t, whence: c_int) -> LinuxResult<isize> {
@@ -110,34 +253,268 @@ pub fn sys_lseek(fd: c_int, offset: __kernel_off_t, whence: c_int) -> LinuxResul
         2 => SeekFrom::End(offset as _),
         _ => return Err(LinuxError::EINVAL),
     };
-    let off = File::from_fd(fd)?.inner().seek(pos)?;
+    let file_like = get_file_like(fd)?;
+    // The offset of a directory is the position of its next entry.
+    if let Ok(dir) = file_like.clone().into_any().downcast::<Directory>() {
+        let off = match pos {
+            SeekFrom::Start(off) => off,
+            SeekFrom::Current(0) => dir.position(),
+            _ => return Err(LinuxError::EINVAL),
+        };
+        dir.seek(off);
+        return Ok(off as _);
+    }
+    if let Ok(memfd) = file_like.clone().into_any().downcast::<MemFd>() {
+        return Ok(memfd.seek(pos)? as _);
+    }
+    let off = File::from_fd(fd)?.seek(pos)?;
     Ok(off as _)
 }
 
-///简单明了 的文件拷贝通用框架
-///不支持真正的零拷贝，但适用于多数数据流任务
-///TODO: 需要实现真正的零拷贝
-fn do_sendfile<F, D>(mut read: F, dest: &D) -> LinuxResult<usize>
-where
-    F: FnMut(&mut [u8]) -> LinuxResult<usize>,
-    D: FileLike + ?Sized,
-{
-    let mut buf = vec![0; 0x4000];
-    let mut total_written = 0;
-    loop {
-        let bytes_read = read(&mut buf)?;
-        if bytes_read == 0 {
-            break;
+/// Sets the size of the regular file or memfd `fd` to `length`.
+pub fn sys_ftruncate(fd: c_int, length: __kernel_off_t) -> LinuxResult<isize> {
+    debug!("sys_ftruncate <= fd: {}, length: {}", fd, length);
+    if length < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let file = get_file_like(fd)?.into_any();
+    match file.downcast::<File>() {
+        Ok(file) => file.truncate(length as u64)?,
+        Err(file) => match file.downcast::<MemFd>() {
+            Ok(memfd) => memfd.truncate(length as u64)?,
+            Err(_) => return Err(LinuxError::EINVAL),
+        },
+    }
+    Ok(0)
+}
+
+/// Allocates the space of `len` bytes of the file `fd` at `offset`, or with
+/// `FALLOC_FL_PUNCH_HOLE` or `FALLOC_FL_ZERO_RANGE`, makes them read as zeros.
+///
+/// Punched holes keep their blocks, as the filesystems cannot free part of
+/// a file. Space past the end of the file cannot be allocated without
+/// extending it, so `FALLOC_FL_KEEP_SIZE` alone is not supported.
+pub fn sys_fallocate(
+    fd: c_int,
+    mode: u32,
+    offset: __kernel_off_t,
+    len: __kernel_off_t,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_fallocate <= fd: {}, mode: {:#x}, offset: {}, len: {}",
+        fd, mode, offset, len
+    );
+    if offset < 0 || len <= 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let (offset, len) = (offset as u64, len as u64);
+    let file = get_file_like(fd)?.into_any();
+    let file = match file.downcast::<File>() {
+        Ok(file) => file,
+        Err(file) => {
+            let memfd = file.downcast::<MemFd>().map_err(|_| LinuxError::ENODEV)?;
+            if mode != 0 {
+                return Err(LinuxError::EOPNOTSUPP);
+            }
+            // The pages of a memfd are allocated as they are touched.
+            let end = offset.checked_add(len).ok_or(LinuxError::EFBIG)?;
+            if end > memfd.stat()?.size {
+                memfd.truncate(end)?;
+            }
+            return Ok(0);
+        }
+    };
+    match mode {
+        0 => file.allocate(offset, len)?,
+        FALLOC_FL_ZERO_RANGE => {
+            file.allocate(offset, len)?;
+            file.zero_range(offset, len)?;
         }
+        m if m == FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+            || m == FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE =>
+        {
+            file.zero_range(offset, len)?
+        }
+        _ => return Err(LinuxError::EOPNOTSUPP),
+    }
+    Ok(0)
+}
 
-        let bytes_written = dest.write(&buf[..bytes_read])?;
-        if bytes_written < bytes_read {
-            break;
+/// Declares the expected access pattern of `len` bytes of the file `fd` at
+/// `offset` (to the end of the file if `len` is 0).
+pub fn sys_fadvise64(
+    fd: c_int,
+    offset: __kernel_off_t,
+    len: __kernel_off_t,
+    advice: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_fadvise64 <= fd: {}, offset: {}, len: {}, advice: {}",
+        fd, offset, len, advice
+    );
+    let advice = match advice {
+        POSIX_FADV_NORMAL => Advice::Normal,
+        POSIX_FADV_RANDOM => Advice::Random,
+        POSIX_FADV_SEQUENTIAL => Advice::Sequential,
+        POSIX_FADV_WILLNEED => Advice::WillNeed,
+        POSIX_FADV_DONTNEED => Advice::DontNeed,
+        POSIX_FADV_NOREUSE => Advice::NoReuse,
+        _ => return Err(LinuxError::EINVAL),
+    };
+    if len < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    positional_file(fd, offset)?.advise(offset as _, len as _, advice)?;
+    Ok(0)
+}
+
+/// Returns the file `fd` to synchronize, or `None` if it is a directory,
+/// whose entries are always written through.
+fn sync_target(fd: c_int) -> LinuxResult<Option<Arc<File>>> {
+    match get_file_like(fd)?.into_any().downcast::<File>() {
+        Ok(file) => Ok(Some(file)),
+        Err(any) if any.is::<Directory>() => Ok(None),
+        Err(_) => Err(LinuxError::EINVAL),
+    }
+}
+
+/// Writes the cached data of the file `fd` to the device.
+pub fn sys_fsync(fd: c_int) -> LinuxResult<isize> {
+    debug!("sys_fsync <= fd: {}", fd);
+    if let Some(file) = sync_target(fd)? {
+        file.sync()?;
+    }
+    Ok(0)
+}
+
+/// Writes the cached data of the file `fd` to the device.
+///
+/// The metadata is always written with the data, so this is the same as
+/// [`sys_fsync`].
+pub fn sys_fdatasync(fd: c_int) -> LinuxResult<isize> {
+    debug!("sys_fdatasync <= fd: {}", fd);
+    if let Some(file) = sync_target(fd)? {
+        file.sync()?;
+    }
+    Ok(0)
+}
+
+/// Starts the writeback of `nbytes` at `offset` of the file `fd` (to the end
+/// of the file if `nbytes` is 0).
+///
+/// The writeback is synchronous, so the `WAIT_*` flags are implied.
+pub fn sys_sync_file_range(
+    fd: c_int,
+    offset: __kernel_off_t,
+    nbytes: __kernel_off_t,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_sync_file_range <= fd: {}, offset: {}, nbytes: {}, flags: {:#x}",
+        fd, offset, nbytes, flags
+    );
+    let valid = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+    if flags & !valid != 0 || nbytes < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let file = positional_file(fd, offset)?;
+    if flags & SYNC_FILE_RANGE_WRITE != 0 {
+        file.sync_range(offset as _, nbytes as _)?;
+    }
+    Ok(0)
+}
+
+/// Writes all the cached data to the devices.
+pub fn sys_sync() -> LinuxResult<isize> {
+    debug!("sys_sync");
+    if let Err(e) = axfs::page_cache::sync_all() {
+        warn!("sync failed: {:?}", e);
+    }
+    Ok(0)
+}
+
+/// Writes all the cached data of the filesystem of `fd` to the device.
+///
+/// Only the main filesystem is cached, so this syncs it whatever `fd` is.
+pub fn sys_syncfs(fd: c_int) -> LinuxResult<isize> {
+    debug!("sys_syncfs <= fd: {}", fd);
+    get_file_like(fd)?;
+    axfs::page_cache::sync_all()?;
+    Ok(0)
+}
+
+/// Returns `file` if it is a regular file.
+fn as_regular_file(file: &Arc<dyn FileLike>) -> Option<Arc<File>> {
+    file.clone().into_any().downcast::<File>().ok()
+}
+
+/// Copies `len` bytes from `src` at `*off_in` to `dst` at `*off_out` in the
+/// kernel, using and advancing the cursor of a file whose offset is `None`.
+/// The ranges may not overlap if both are the same file.
+fn copy_range(
+    src: &File,
+    off_in: Option<&mut u64>,
+    dst: &File,
+    off_out: Option<&mut u64>,
+    len: usize,
+) -> LinuxResult<isize> {
+    let in_pos = match &off_in {
+        Some(offset) => **offset,
+        None => src.seek(SeekFrom::Current(0))?,
+    };
+    let out_pos = match &off_out {
+        Some(offset) => **offset,
+        None => dst.seek(SeekFrom::Current(0))?,
+    };
+    // A file cannot be copied over itself.
+    let len = len as u64;
+    if src.path() == dst.path()
+        && in_pos < out_pos.saturating_add(len)
+        && out_pos < in_pos.saturating_add(len)
+    {
+        return Err(LinuxError::EINVAL);
+    }
+    let copied = src.copy_range(in_pos, dst, out_pos, len)?;
+    match off_in {
+        Some(offset) => *offset = in_pos + copied,
+        None => {
+            src.seek(SeekFrom::Start(in_pos + copied))?;
         }
-        total_written += bytes_written;
     }
+    match off_out {
+        Some(offset) => *offset = out_pos + copied,
+        None => {
+            dst.seek(SeekFrom::Start(out_pos + copied))?;
+        }
+    }
+    Ok(copied as _)
+}
 
-    Ok(total_written)
+/// Copies `len` bytes between two regular files without going through user
+/// space, from page cache to page cache.
+pub fn sys_copy_file_range(
+    fd_in: c_int,
+    off_in: UserPtr<u64>,
+    fd_out: c_int,
+    off_out: UserPtr<u64>,
+    len: usize,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_copy_file_range <= fd_in: {}, fd_out: {}, len: {}, flags: {:#x}",
+        fd_in, fd_out, len, flags
+    );
+    if flags != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let src = as_regular_file(&get_file_like(fd_in)?).ok_or(LinuxError::EINVAL)?;
+    let dst = as_regular_file(&get_file_like(fd_out)?).ok_or(LinuxError::EINVAL)?;
+    if dst.flags() & O_APPEND != 0 {
+        return Err(LinuxError::EBADF);
+    }
+    let off_in = nullable!(off_in.get_as_mut())?;
+    let off_out = nullable!(off_out.get_as_mut())?;
+    copy_range(&src, off_in, &dst, off_out, len)
 }
 
 pub fn sys_sendfile(
@@ -156,24 +533,100 @@ pub fn sys_sendfile(
 
     let src = get_file_like(in_fd)?;
     let dest = get_file_like(out_fd)?;
-    let offset = nullable!(offset.get_as_mut())?;
-
-    if let Some(offset) = offset {
-        let src = src
-            .into_any()
-            .downcast::<File>()
-            .map_err(|_| LinuxError::ESPIPE)?;
-
-        do_sendfile(
-            |buf| {
-                let bytes_read = src.inner().read_at(*offset, buf)?;
-                *offset += bytes_read as u64;
-                Ok(bytes_read)
-            },
-            dest.as_ref(),
-        )
-    } else {
-        do_sendfile(|buf| src.read(buf), dest.as_ref())
-    }
-    .map(|n| n as _)
-}
\ No newline at end of file
+    let mut offset = nullable!(offset.get_as_mut())?;
+
+    // Copies between regular files stay in the kernel.
+    if let (Some(src), Some(dest)) = (as_regular_file(&src), as_regular_file(&dest)) {
+        if dest.flags() & O_APPEND == 0 {
+            return copy_range(&src, offset, &dest, None, len);
+        }
+    }
+
+    // Like Linux, `sendfile` is built on top of `splice`: data moves directly
+    // into or out of a pipe if either side is one, otherwise it goes through
+    // an internal pipe.
+    let mut total = 0;
+    match (as_pipe(&src), as_pipe(&dest)) {
+        (Some(src), Some(dest)) => {
+            if offset.is_some() {
+                return Err(LinuxError::ESPIPE);
+            }
+            while total < len {
+                let n = match Pipe::transfer(&src, &dest, len - total, false, true) {
+                    Ok(0) => break,
+                    Ok(n) => n,
+                    Err(err) if total == 0 => return Err(err),
+                    Err(_) => break,
+                };
+                total += n;
+            }
+        }
+        (Some(src), None) => {
+            if offset.is_some() {
+                return Err(LinuxError::ESPIPE);
+            }
+            while total < len {
+                let n = match src.splice_to(len - total, false, |buf| dest.write(buf)) {
+                    Ok(0) => break,
+                    Ok(n) => n,
+                    Err(err) if total == 0 => return Err(err),
+                    Err(_) => break,
+                };
+                total += n;
+            }
+        }
+        (None, Some(dest)) => {
+            let mut src = SpliceTarget::new(src, offset)?;
+            while total < len {
+                let n = match dest.splice_from(len - total, false, |buf| src.read(buf)) {
+                    Ok(0) => break,
+                    Ok(n) => n,
+                    Err(err) if total == 0 => return Err(err),
+                    Err(_) => break,
+                };
+                total += n;
+            }
+        }
+        (None, None) => {
+            // The data of a regular file is sent straight from its page
+            // cache, so that the file is never read while the socket is
+            // locked to copy the data into its send buffer.
+            if let Some(file) = as_regular_file(&src) {
+                match file.send_pages(offset.as_deref_mut(), len, |buf| dest.write(buf)) {
+                    Err(LinuxError::EOPNOTSUPP) => {}
+                    result => return result.map(|total| total as _),
+                }
+            }
+            // Other files have no pages to send from, and go through a
+            // buffer like the internal pipe of Linux.
+            let mut src = SpliceTarget::new(src, offset)?;
+            let mut buf = vec![0; SPLICE_BUF_SIZE.min(len)];
+            while total < len {
+                let n = match src.read(&mut buf[..SPLICE_BUF_SIZE.min(len - total)]) {
+                    Ok(0) => break,
+                    Ok(n) => n,
+                    Err(err) if total == 0 => return Err(err),
+                    Err(_) => break,
+                };
+                let mut sent = 0;
+                while sent < n {
+                    match dest.write(&buf[sent..n]) {
+                        Ok(0) => break,
+                        Ok(m) => sent += m,
+                        Err(err) if total + sent == 0 => return Err(err),
+                        Err(_) => break,
+                    }
+                }
+                total += sent;
+                if sent < n {
+                    // Give the unsent data back to the source if we can.
+                    if let SpliceTarget::Positioned(_, offset) = &mut src {
+                        **offset -= (n - sent) as u64;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    Ok(total as _)
+}
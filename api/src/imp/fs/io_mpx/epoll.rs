@@ -0,0 +1,392 @@
+use core::{
+    any::Any,
+    ffi::c_int,
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use alloc::{
+    collections::{BTreeMap, VecDeque, btree_map::Entry},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{
+    arch::TrapFrame,
+    time::{TimeValue, wall_time},
+};
+use axio::PollState;
+use axsignal::SignalSet;
+use axsync::spin::SpinNoIrq;
+use linux_raw_sys::general::{
+    EPOLL_CLOEXEC, EPOLL_CTL_ADD, EPOLL_CTL_DEL, EPOLL_CTL_MOD, EPOLLERR, EPOLLET, EPOLLIN,
+    EPOLLONESHOT, EPOLLOUT, epoll_event,
+};
+use spin::Mutex;
+use starry_core::task::{register_signal_waker, unregister_signal_waker};
+
+use crate::{
+    file::{FileLike, Kstat, PollWaker, PollWakers, Wake, get_file_like},
+    ptr::{UserConstPtr, UserPtr},
+    signal::{have_signals, with_sigmask},
+};
+
+use super::poll::read_sigmask;
+
+/// Events that are always reported, whether requested or not.
+const EPOLL_ALWAYS: u32 = EPOLLERR;
+
+/// The fd of an interest and the address of its file.
+///
+/// The fd may be closed and given to another file while the interest is
+/// alive, so the file is part of the key, as in Linux. The address of a
+/// closed file is not reused as long as the interest holds a weak reference
+/// to it.
+type InterestKey = (c_int, usize);
+
+fn interest_key(fd: c_int, file: &Arc<dyn FileLike>) -> InterestKey {
+    (fd, Arc::as_ptr(file) as *const () as usize)
+}
+
+/// A file registered on an epoll instance.
+struct EpollInterest {
+    key: InterestKey,
+    file: Weak<dyn FileLike>,
+    /// The requested events and the user data.
+    event: Mutex<epoll_event>,
+    /// Whether the file must be checked actively, as it does not notify us
+    /// on state changes.
+    polled: AtomicBool,
+    /// Whether the interest is on the ready list.
+    queued: AtomicBool,
+    instance: Weak<EpollInner>,
+}
+
+impl Wake for EpollInterest {
+    fn wake(&self) {
+        if let Some(instance) = self.instance.upgrade() {
+            instance.enqueue(self);
+        }
+    }
+}
+
+struct EpollInner {
+    interests: Mutex<BTreeMap<InterestKey, Arc<EpollInterest>>>,
+    /// Interests that may be ready, filled by the readiness callbacks of the
+    /// files and drained by `epoll_wait`.
+    ready: SpinNoIrq<VecDeque<InterestKey>>,
+    /// Tasks waiting in `epoll_wait`, and pollers watching the epoll fd.
+    wakers: PollWakers,
+}
+
+impl EpollInner {
+    fn enqueue(&self, interest: &EpollInterest) {
+        if !interest.queued.swap(true, Ordering::AcqRel) {
+            self.ready.lock().push_back(interest.key);
+            self.wakers.wake_all();
+        }
+    }
+}
+
+pub struct EpollInstance {
+    inner: Arc<EpollInner>,
+}
+
+impl EpollInstance {
+    fn new() -> Self {
+        Self {
+            inner: Arc::new(EpollInner {
+                interests: Mutex::new(BTreeMap::new()),
+                ready: SpinNoIrq::new(VecDeque::new()),
+                wakers: PollWakers::new(),
+            }),
+        }
+    }
+
+    fn add(&self, fd: c_int, file: Arc<dyn FileLike>, event: epoll_event) -> LinuxResult {
+        let key = interest_key(fd, &file);
+        let mut interests = self.inner.interests.lock();
+        // Forget the interests in closed files that had this fd.
+        let closed: Vec<_> = interests
+            .range((fd, 0)..=(fd, usize::MAX))
+            .filter(|(_, interest)| interest.file.strong_count() == 0)
+            .map(|(&key, _)| key)
+            .collect();
+        for key in closed {
+            interests.remove(&key);
+        }
+        let Entry::Vacant(entry) = interests.entry(key) else {
+            return Err(LinuxError::EEXIST);
+        };
+        let interest = Arc::new(EpollInterest {
+            key,
+            file: Arc::downgrade(&file),
+            event: Mutex::new(event),
+            polled: AtomicBool::new(false),
+            queued: AtomicBool::new(false),
+            instance: Arc::downgrade(&self.inner),
+        });
+        let waker: Arc<dyn Wake> = interest.clone();
+        if !file.register_waker(&waker) {
+            interest.polled.store(true, Ordering::Relaxed);
+        }
+        entry.insert(interest.clone());
+        drop(interests);
+        // Check the current state of the file once.
+        self.inner.enqueue(&interest);
+        Ok(())
+    }
+
+    fn modify(&self, fd: c_int, file: &Arc<dyn FileLike>, event: epoll_event) -> LinuxResult {
+        let interest = self
+            .inner
+            .interests
+            .lock()
+            .get(&interest_key(fd, file))
+            .cloned()
+            .ok_or(LinuxError::ENOENT)?;
+        *interest.event.lock() = event;
+        self.inner.enqueue(&interest);
+        Ok(())
+    }
+
+    fn delete(&self, fd: c_int, file: &Arc<dyn FileLike>) -> LinuxResult {
+        let interest = self
+            .inner
+            .interests
+            .lock()
+            .remove(&interest_key(fd, file))
+            .ok_or(LinuxError::ENOENT)?;
+        unregister(interest);
+        Ok(())
+    }
+
+    /// Drains the ready list into `events`, returning the number of events
+    /// reported and whether any interest needs to be checked actively.
+    fn collect(&self, events: &mut [epoll_event]) -> (usize, bool) {
+        let mut count = 0;
+        let mut requeue = Vec::new();
+        let pending = self.inner.ready.lock().len();
+        for _ in 0..pending {
+            if count == events.len() {
+                break;
+            }
+            let Some(key) = self.inner.ready.lock().pop_front() else {
+                break;
+            };
+            let Some(interest) = self.inner.interests.lock().get(&key).cloned() else {
+                continue;
+            };
+            interest.queued.store(false, Ordering::Release);
+            let Some(file) = interest.file.upgrade() else {
+                // The file was closed, which drops the interest as in Linux.
+                self.inner.interests.lock().remove(&key);
+                continue;
+            };
+
+            let event = *interest.event.lock();
+            let mask = event.events;
+            let revents = match file.poll() {
+                Ok(state) => {
+                    let mut revents = 0;
+                    if state.readable {
+                        revents |= EPOLLIN;
+                    }
+                    if state.writable {
+                        revents |= EPOLLOUT;
+                    }
+                    revents & (mask | EPOLL_ALWAYS)
+                }
+                Err(_) => EPOLLERR,
+            };
+            if revents != 0 && mask & !(EPOLLET | EPOLLONESHOT) != 0 {
+                events[count] = epoll_event {
+                    events: revents,
+                    data: event.data,
+                };
+                count += 1;
+                if mask & EPOLLONESHOT != 0 {
+                    // Disabled until re-armed by `EPOLL_CTL_MOD`.
+                    interest.event.lock().events = mask & (EPOLLET | EPOLLONESHOT);
+                } else if mask & EPOLLET == 0 {
+                    // Level-triggered interests stay on the ready list until
+                    // they are found not ready.
+                    requeue.push(interest.clone());
+                }
+            } else if interest.polled.load(Ordering::Relaxed) {
+                requeue.push(interest.clone());
+            }
+        }
+
+        let polled = requeue
+            .iter()
+            .any(|interest| interest.polled.load(Ordering::Relaxed));
+        for interest in requeue {
+            self.inner.enqueue(&interest);
+        }
+        (count, polled)
+    }
+
+    fn wait(&self, events: &mut [epoll_event], timeout: Option<TimeValue>) -> LinuxResult<usize> {
+        let deadline = timeout.map(|t| wall_time() + t);
+        let waker = PollWaker::new();
+        let dyn_waker: Arc<dyn Wake> = waker.clone();
+        self.inner.wakers.register(&dyn_waker);
+        let signal_waker = waker.signal_waker();
+        register_signal_waker(&signal_waker);
+
+        let res = loop {
+            waker.reset();
+            axnet::poll_interfaces();
+
+            let (count, polled) = self.collect(events);
+            if count > 0 {
+                break Ok(count);
+            }
+
+            let now = wall_time();
+            if deadline.is_some_and(|d| now >= d) {
+                break Ok(0);
+            }
+            if have_signals() {
+                break Err(LinuxError::EINTR);
+            }
+
+            if polled {
+                // Some files (e.g. sockets) can only be checked actively.
+                axtask::yield_now();
+            } else {
+                waker.wait(deadline.map(|d| d - now));
+            }
+        };
+
+        unregister_signal_waker(&signal_waker);
+        self.inner.wakers.unregister(&dyn_waker);
+        res
+    }
+}
+
+fn unregister(interest: Arc<EpollInterest>) {
+    if let Some(file) = interest.file.upgrade() {
+        let waker: Arc<dyn Wake> = interest;
+        file.unregister_waker(&waker);
+    }
+}
+
+impl Drop for EpollInstance {
+    fn drop(&mut self) {
+        let interests = core::mem::take(&mut *self.inner.interests.lock());
+        for (_, interest) in interests {
+            unregister(interest);
+        }
+    }
+}
+
+impl FileLike for EpollInstance {
+    fn read(&self, _buf: &mut [u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn write(&self, _buf: &[u8]) -> LinuxResult<usize> {
+        Err(LinuxError::EINVAL)
+    }
+
+    fn stat(&self) -> LinuxResult<Kstat> {
+        Ok(Kstat::default())
+    }
+
+    fn into_any(self: Arc<Self>) -> Arc<dyn Any + Send + Sync> {
+        self
+    }
+
+    fn poll(&self) -> LinuxResult<PollState> {
+        Ok(PollState {
+            readable: !self.inner.ready.lock().is_empty(),
+            writable: false,
+        })
+    }
+
+    fn set_nonblocking(&self, _nonblocking: bool) -> LinuxResult {
+        Ok(())
+    }
+
+    fn register_waker(&self, waker: &Arc<dyn Wake>) -> bool {
+        self.inner.wakers.register(waker);
+        true
+    }
+
+    fn unregister_waker(&self, waker: &Arc<dyn Wake>) {
+        self.inner.wakers.unregister(waker);
+    }
+}
+
+pub fn sys_epoll_create1(flags: u32) -> LinuxResult<isize> {
+    debug!("sys_epoll_create1 <= flags: {:#x}", flags);
+    if flags & !EPOLL_CLOEXEC != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    Ok(EpollInstance::new().add_to_fd_table(flags & EPOLL_CLOEXEC != 0)? as _)
+}
+
+#[cfg(target_arch = "x86_64")]
+pub fn sys_epoll_create(size: c_int) -> LinuxResult<isize> {
+    if size <= 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    sys_epoll_create1(0)
+}
+
+pub fn sys_epoll_ctl(
+    epfd: c_int,
+    op: u32,
+    fd: c_int,
+    event: UserConstPtr<epoll_event>,
+) -> LinuxResult<isize> {
+    debug!("sys_epoll_ctl <= epfd: {} op: {} fd: {}", epfd, op, fd);
+    let epoll = EpollInstance::from_fd(epfd)?;
+    let file = get_file_like(fd)?;
+    if epfd == fd {
+        return Err(LinuxError::EINVAL);
+    }
+
+    match op {
+        EPOLL_CTL_ADD => epoll.add(fd, file, *event.get_as_ref()?)?,
+        EPOLL_CTL_MOD => epoll.modify(fd, &file, *event.get_as_ref()?)?,
+        EPOLL_CTL_DEL => epoll.delete(fd, &file)?,
+        _ => return Err(LinuxError::EINVAL),
+    }
+    Ok(0)
+}
+
+pub fn sys_epoll_pwait(
+    tf: &mut TrapFrame,
+    epfd: c_int,
+    events: UserPtr<epoll_event>,
+    maxevents: c_int,
+    timeout: c_int,
+    sigmask: UserConstPtr<SignalSet>,
+    sigsetsize: usize,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_epoll_pwait <= epfd: {}, maxevents: {}, timeout: {}",
+        epfd, maxevents, timeout
+    );
+    if maxevents <= 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let events = events.get_as_mut_slice(maxevents as usize)?;
+    let epoll = EpollInstance::from_fd(epfd)?;
+    let timeout = (timeout >= 0).then(|| TimeValue::from_millis(timeout as u64));
+    let sigmask = read_sigmask(sigmask, sigsetsize)?;
+    with_sigmask(tf, sigmask, || Ok(epoll.wait(events, timeout)? as _))
+}
+
+#[cfg(target_arch = "x86_64")]
+pub fn sys_epoll_wait(
+    tf: &mut TrapFrame,
+    epfd: c_int,
+    events: UserPtr<epoll_event>,
+    maxevents: c_int,
+    timeout: c_int,
+) -> LinuxResult<isize> {
+    sys_epoll_pwait(tf, epfd, events, maxevents, timeout, 0.into(), 0)
+}
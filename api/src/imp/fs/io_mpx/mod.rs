@@ -1,3 +1,5 @@
+mod epoll;
 mod poll;
 
+pub use self::epoll::*;
 pub use self::poll::*;
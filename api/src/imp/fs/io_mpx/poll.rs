@@ -1,27 +1,54 @@
-use axerrno::LinuxResult;
-use axhal::time::{TimeValue, wall_time};
-use linux_raw_sys::general::{POLLERR, POLLIN, POLLNVAL, POLLOUT, pollfd, sigset_t, timespec};
+use core::ffi::{c_int, c_ulong};
+
+use alloc::{sync::Arc, vec::Vec};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{
+    arch::TrapFrame,
+    time::{TimeValue, wall_time},
+};
+use axsignal::SignalSet;
+use linux_raw_sys::general::{
+    __FD_SETSIZE, __kernel_fd_set, POLLERR, POLLIN, POLLNVAL, POLLOUT, POLLPRI, pollfd, timespec,
+};
+use starry_core::task::{register_signal_waker, unregister_signal_waker};
 
 use crate::{
-    file::get_file_like,
+    file::{PollWaker, Wake, get_file_like},
     ptr::{UserConstPtr, UserPtr, nullable},
+    signal::{have_signals, with_sigmask},
     time::timespec_to_timevalue,
 };
 
-fn do_poll(fds: &mut [pollfd], timeout: Option<TimeValue>) -> LinuxResult<isize> {
+pub(crate) fn do_poll(fds: &mut [pollfd], timeout: Option<TimeValue>) -> LinuxResult<isize> {
     debug!("do_poll fds={:?} timeout={:?}", fds, timeout);
 
     let deadline = timeout.map(|t| wall_time() + t);
 
-    loop {
+    // Resolve the files once, and ask each to wake us up on state changes.
+    let files = fds
+        .iter()
+        .map(|fd| get_file_like(fd.fd).ok())
+        .collect::<Vec<_>>();
+    let waker = PollWaker::new();
+    let dyn_waker: Arc<dyn Wake> = waker.clone();
+    let mut notifiable = true;
+    for file in files.iter().flatten() {
+        notifiable &= file.register_waker(&dyn_waker);
+    }
+    // Signals interrupt the sleep as well.
+    let signal_waker = waker.signal_waker();
+    register_signal_waker(&signal_waker);
+
+    let res = loop {
+        waker.reset();
         axnet::poll_interfaces();
 
         let mut res = 0;
 
-        for fd in &mut *fds {
+        for (fd, file) in fds.iter_mut().zip(&files) {
             let mut revents = 0;
-            match get_file_like(fd.fd) {
-                Ok(f) => match f.poll() {
+            match file {
+                Some(f) => match f.poll() {
                     Ok(state) => {
                         if (fd.events & POLLIN as i16) != 0 && state.readable {
                             revents |= POLLIN;
@@ -30,12 +57,12 @@ fn do_poll(fds: &mut [pollfd], timeout: Option<TimeValue>) -> LinuxResult<isize>
                             revents |= POLLOUT;
                         }
                     }
-                    Err(e)  => {
+                    Err(e) => {
                         warn!("poll fd={} error: {:?}", fd.fd, e);
                         revents = POLLERR;
                     }
                 },
-                Err(_) => {
+                None => {
                     revents = POLLNVAL;
                 }
             }
@@ -46,15 +73,31 @@ fn do_poll(fds: &mut [pollfd], timeout: Option<TimeValue>) -> LinuxResult<isize>
         }
 
         if res > 0 {
-            return Ok(res);
+            break Ok(res);
         }
 
-        if deadline.is_some_and(|d| wall_time() >= d) {
-            return Ok(0);
+        let now = wall_time();
+        if deadline.is_some_and(|d| now >= d) {
+            break Ok(0);
+        }
+        if have_signals() {
+            break Err(LinuxError::EINTR);
         }
 
-        axtask::yield_now();
+        if notifiable {
+            // Sleep until any of the files changes state, or the deadline.
+            waker.wait(deadline.map(|d| d - now));
+        } else {
+            // Some files (e.g. sockets) can only be checked actively.
+            axtask::yield_now();
+        }
+    };
+
+    unregister_signal_waker(&signal_waker);
+    for file in files.iter().flatten() {
+        file.unregister_waker(&dyn_waker);
     }
+    res
 }
 
 pub fn sys_poll(
@@ -72,20 +115,119 @@ pub fn sys_poll(
     do_poll(fds, timeout)
 }
 
-/// TODO
+/// Reads the signal mask argument of `ppoll` and `pselect6`.
+pub(super) fn read_sigmask(
+    sigmask: UserConstPtr<SignalSet>,
+    sigsetsize: usize,
+) -> LinuxResult<Option<SignalSet>> {
+    let Some(sigmask) = nullable!(sigmask.get_as_ref())? else {
+        return Ok(None);
+    };
+    if sigsetsize != size_of::<SignalSet>() {
+        return Err(LinuxError::EINVAL);
+    }
+    Ok(Some(*sigmask))
+}
+
 /// Poll with signal mask
 pub fn sys_ppoll(
+    tf: &mut TrapFrame,
     fds: UserPtr<pollfd>,
     nfds: u32,
     timeout: UserConstPtr<timespec>,
-    _sigmask: UserConstPtr<sigset_t>,
+    sigmask: UserConstPtr<SignalSet>,
+    sigsetsize: usize,
 ) -> LinuxResult<isize> {
     let fds = fds.get_as_mut_slice(nfds as usize)?;
-    // let timeout = if timeout.is_null() {
-    //     None
-    // } else {
-    //     Some(timespec_to_timevalue(&timeout.get()?))
-    // };
     let timeout = nullable!(timeout.get_as_ref())?.map(|ts| timespec_to_timevalue(*ts));
-    do_poll(fds, timeout)
+    let sigmask = read_sigmask(sigmask, sigsetsize)?;
+    with_sigmask(tf, sigmask, || do_poll(fds, timeout))
+}
+
+/// The sixth argument of `pselect6`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct Pselect6Sigmask {
+    ss: usize,
+    ss_len: usize,
+}
+
+const FD_SET_BITS: usize = 8 * size_of::<c_ulong>();
+
+fn fd_isset(set: &__kernel_fd_set, fd: usize) -> bool {
+    set.fds_bits[fd / FD_SET_BITS] & (1 << (fd % FD_SET_BITS)) != 0
+}
+
+fn fd_set(set: &mut __kernel_fd_set, fd: usize) {
+    set.fds_bits[fd / FD_SET_BITS] |= 1 << (fd % FD_SET_BITS);
+}
+
+/// Synchronous I/O multiplexing with signal mask, built on top of `poll`.
+pub fn sys_pselect6(
+    tf: &mut TrapFrame,
+    nfds: c_int,
+    readfds: UserPtr<__kernel_fd_set>,
+    writefds: UserPtr<__kernel_fd_set>,
+    exceptfds: UserPtr<__kernel_fd_set>,
+    timeout: UserConstPtr<timespec>,
+    sigmask: UserConstPtr<Pselect6Sigmask>,
+) -> LinuxResult<isize> {
+    debug!("sys_pselect6 <= nfds: {}", nfds);
+    if !(0..=__FD_SETSIZE as c_int).contains(&nfds) {
+        return Err(LinuxError::EINVAL);
+    }
+    let nfds = nfds as usize;
+    let mut sets = [
+        nullable!(readfds.get_as_mut())?,
+        nullable!(writefds.get_as_mut())?,
+        nullable!(exceptfds.get_as_mut())?,
+    ];
+    let timeout = nullable!(timeout.get_as_ref())?.map(|ts| timespec_to_timevalue(*ts));
+    let sigmask = match nullable!(sigmask.get_as_ref())? {
+        Some(arg) => read_sigmask(arg.ss.into(), arg.ss_len)?,
+        None => None,
+    };
+
+    let mut fds = Vec::new();
+    for fd in 0..nfds {
+        let mut events = 0;
+        for (set, event) in sets.iter().zip([POLLIN, POLLOUT, POLLPRI]) {
+            if set.as_ref().is_some_and(|set| fd_isset(set, fd)) {
+                events |= event;
+            }
+        }
+        if events != 0 {
+            fds.push(pollfd {
+                fd: fd as _,
+                events: events as _,
+                revents: 0,
+            });
+        }
+    }
+
+    with_sigmask(tf, sigmask, || {
+        do_poll(&mut fds, timeout)?;
+        if fds.iter().any(|fd| fd.revents as u32 & POLLNVAL != 0) {
+            return Err(LinuxError::EBADF);
+        }
+
+        for set in sets.iter_mut().flatten() {
+            **set = unsafe { core::mem::zeroed() };
+        }
+        let mut res = 0;
+        for fd in &fds {
+            let revents = fd.revents as u32;
+            for (set, event) in sets.iter_mut().zip([POLLIN, POLLOUT, POLLPRI]) {
+                // Errors are reported as both readable and writable.
+                let event = if event == POLLPRI { event } else { event | POLLERR };
+                if let Some(set) = set {
+                    if revents & event != 0 {
+                        fd_set(set, fd.fd as usize);
+                        res += 1;
+                    }
+                }
+            }
+        }
+        Ok(res)
+    })
 }
@@ -0,0 +1,61 @@
+use core::ffi::c_int;
+
+use axerrno::{LinuxError, LinuxResult};
+use linux_raw_sys::io_uring::{
+    IORING_ENTER_GETEVENTS, IORING_ENTER_SQ_WAIT, IORING_ENTER_SQ_WAKEUP, IORING_SETUP_CQSIZE,
+    IORING_SETUP_IOPOLL, IORING_SETUP_SQPOLL, io_uring_params,
+};
+
+use crate::{
+    file::{FileLike, IoUring},
+    ptr::UserPtr,
+};
+
+pub fn sys_io_uring_setup(entries: u32, params: UserPtr<io_uring_params>) -> LinuxResult<isize> {
+    let params = params.get_as_mut()?;
+    debug!(
+        "sys_io_uring_setup <= entries: {}, flags: {:#x}",
+        entries, params.flags
+    );
+    if params.flags & !(IORING_SETUP_SQPOLL | IORING_SETUP_IOPOLL | IORING_SETUP_CQSIZE) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let sq_poll = params.flags & IORING_SETUP_SQPOLL != 0;
+    let io_poll = params.flags & IORING_SETUP_IOPOLL != 0;
+    let ring = IoUring::new(entries, params, sq_poll, io_poll)?;
+    // Like on Linux, rings are not inherited across `execve`.
+    Ok(ring.add_to_fd_table(true)? as _)
+}
+
+pub fn sys_io_uring_enter(
+    fd: c_int,
+    to_submit: u32,
+    min_complete: u32,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_io_uring_enter <= fd: {}, to_submit: {}, min_complete: {}, flags: {:#x}",
+        fd, to_submit, min_complete, flags
+    );
+    if flags & !(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP | IORING_ENTER_SQ_WAIT) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let ring = IoUring::from_ring_fd(fd)?;
+
+    // With a polling worker, the entries are consumed by the worker.
+    let submitted = if ring.sq_poll() {
+        if flags & IORING_ENTER_SQ_WAKEUP != 0 {
+            ring.wake_worker();
+        }
+        if flags & IORING_ENTER_SQ_WAIT != 0 {
+            ring.wait_sq_space();
+        }
+        to_submit
+    } else {
+        ring.submit(to_submit)
+    };
+    if flags & IORING_ENTER_GETEVENTS != 0 {
+        ring.wait_completions(min_complete)?;
+    }
+    Ok(submitted as _)
+}
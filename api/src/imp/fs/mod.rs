@@ -1,14 +1,18 @@
 mod ctl;
+mod event;
 mod fd_ops;
 mod io;
+mod io_uring;
 mod mount;
 mod pipe;
 mod stat;
 mod io_mpx;
 
 pub use self::ctl::*;
+pub use self::event::*;
 pub use self::fd_ops::*;
 pub use self::io::*;
+pub use self::io_uring::*;
 pub use self::mount::*;
 pub use self::pipe::*;
 pub use self::stat::*;
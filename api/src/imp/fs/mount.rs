@@ -1,4 +1,4 @@
-use core::ffi::{c_char, c_void};
+use core::ffi::c_char;
 
 use alloc::vec::Vec;
 use axerrno::{LinuxError, LinuxResult};
@@ -15,11 +15,16 @@ pub fn sys_mount(
     target: UserConstPtr<c_char>,
     fs_type: UserConstPtr<c_char>,
     flags: i32,
-    _data: UserConstPtr<c_void>,
+    data: UserConstPtr<c_char>,
 ) -> LinuxResult<isize> {
     let source = source.get_as_str()?;
     let target = target.get_as_str()?;
     let fs_type = fs_type.get_as_str()?;
+    let data = if data.is_null() {
+        ""
+    } else {
+        data.get_as_str()?
+    };
     info!(
         "sys_mount <= source: {}, target: {}, fs_type: {}, flags: {}",
         source, target, fs_type, flags
@@ -32,8 +37,13 @@ pub fn sys_mount(
         device_path, mount_path, fs_type
     );
 
+    if fs_type == "tmpfs" {
+        axfs::api::mount_tmpfs(mount_path.as_str(), tmpfs_size(data)?)?;
+        return Ok(0);
+    }
+
     if fs_type != "vfat" {
-        debug!("fs_type can only be vfat.");
+        debug!("fs_type can only be vfat or tmpfs.");
         return Err(LinuxError::EPERM);
     }
 
@@ -70,12 +80,39 @@ pub fn sys_umount2(target: UserConstPtr<c_char>, flags: i32) -> LinuxResult<isiz
     }
 
     if !umount_fat_fs(&mount_path) {
-        debug!("umount error");
-        return Err(LinuxError::EPERM);
+        // Not a vfat mount, but maybe a tmpfs.
+        if axfs::api::umount(mount_path.as_str()).is_err() {
+            debug!("umount error");
+            return Err(LinuxError::EPERM);
+        }
     }
     Ok(0)
 }
 
+/// Returns the size limit in the `size=` option of a tmpfs mount, in bytes
+/// with an optional `k`, `m` or `g` suffix, or as a percentage of the memory
+/// with `%`. The other options are ignored.
+fn tmpfs_size(data: &str) -> LinuxResult<Option<u64>> {
+    let Some(size) = data.split(',').find_map(|opt| opt.strip_prefix("size=")) else {
+        return Ok(None);
+    };
+    let (digits, unit) = size.split_at(size.trim_end_matches(|c: char| !c.is_ascii_digit()).len());
+    let value = digits.parse::<u64>().map_err(|_| LinuxError::EINVAL)?;
+    let size = match unit {
+        "" => value,
+        "k" | "K" => value << 10,
+        "m" | "M" => value << 20,
+        "g" | "G" => value << 30,
+        "%" => {
+            let allocator = axalloc::global_allocator();
+            let memory = (allocator.used_bytes() + allocator.available_bytes()) as u64;
+            memory / 100 * value.min(100)
+        }
+        _ => return Err(LinuxError::EINVAL),
+    };
+    Ok(Some(size))
+}
+
 /// Mounted File System
 /// "Mount" means read&write a file as a file system now
 struct MountedFs {
@@ -1,23 +1,31 @@
 use core::ffi::c_int;
 
-use axerrno::LinuxResult;
+use alloc::sync::Arc;
+use axerrno::{LinuxError, LinuxResult};
+use linux_raw_sys::general::{O_CLOEXEC, O_NONBLOCK, SPLICE_F_NONBLOCK, iovec};
 
 use crate::{
-    file::{FileLike, Pipe, close_file_like},
-    ptr::UserPtr,
+    file::{File, FileLike, Pipe, close_file_like, get_file_like},
+    ptr::{UserConstPtr, UserPtr, nullable},
 };
 
 pub fn sys_pipe2(fds: UserPtr<[c_int; 2]>, flags: i32) -> LinuxResult<isize> {
-    if flags != 0 {
+    let flags = flags as u32;
+    if flags & !(O_NONBLOCK | O_CLOEXEC) != 0 {
         warn!("sys_pipe2: unsupported flags: {}", flags);
     }
 
     let fds = fds.get_as_mut()?;
 
     let (read_end, write_end) = Pipe::new();
-    let read_fd = read_end.add_to_fd_table()?;
+    if flags & O_NONBLOCK != 0 {
+        read_end.set_nonblocking(true)?;
+        write_end.set_nonblocking(true)?;
+    }
+    let cloexec = flags & O_CLOEXEC != 0;
+    let read_fd = read_end.add_to_fd_table(cloexec)?;
     let write_fd = write_end
-        .add_to_fd_table()
+        .add_to_fd_table(cloexec)
         .inspect_err(|_| close_file_like(read_fd).unwrap())?;
 
     fds[0] = read_fd;
@@ -26,3 +34,169 @@ pub fn sys_pipe2(fds: UserPtr<[c_int; 2]>, flags: i32) -> LinuxResult<isize> {
     info!("sys_pipe2 <= fds: {:?}", fds);
     Ok(0)
 }
+
+/// The non-pipe side of a splice.
+pub(crate) enum SpliceTarget<'a> {
+    /// A regular file accessed at an explicit offset, which is advanced
+    /// instead of the file position.
+    Positioned(Arc<File>, &'a mut u64),
+    /// Any file-like object accessed at its own position.
+    Stream(Arc<dyn FileLike>),
+}
+
+impl<'a> SpliceTarget<'a> {
+    pub(crate) fn new(file: Arc<dyn FileLike>, offset: Option<&'a mut u64>) -> LinuxResult<Self> {
+        Ok(match offset {
+            Some(offset) => {
+                let file = file
+                    .into_any()
+                    .downcast::<File>()
+                    .map_err(|_| LinuxError::ESPIPE)?;
+                Self::Positioned(file, offset)
+            }
+            None => Self::Stream(file),
+        })
+    }
+
+    pub(crate) fn read(&mut self, buf: &mut [u8]) -> LinuxResult<usize> {
+        match self {
+            Self::Positioned(file, offset) => {
+                let read = file.pread(**offset, buf)?;
+                **offset += read as u64;
+                Ok(read)
+            }
+            Self::Stream(file) => file.read(buf),
+        }
+    }
+
+    pub(crate) fn write(&mut self, buf: &[u8]) -> LinuxResult<usize> {
+        match self {
+            Self::Positioned(file, offset) => {
+                let written = file.pwrite(**offset, buf)?;
+                **offset += written as u64;
+                Ok(written)
+            }
+            Self::Stream(file) => file.write(buf),
+        }
+    }
+}
+
+pub(crate) fn as_pipe(file: &Arc<dyn FileLike>) -> Option<Arc<Pipe>> {
+    file.clone().into_any().downcast::<Pipe>().ok()
+}
+
+/// Move data between two file descriptors, at least one of which must be a
+/// pipe, without copying through user space.
+pub fn sys_splice(
+    fd_in: c_int,
+    off_in: UserPtr<u64>,
+    fd_out: c_int,
+    off_out: UserPtr<u64>,
+    len: usize,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_splice <= fd_in: {}, fd_out: {}, len: {}, flags: {:#x}",
+        fd_in, fd_out, len, flags
+    );
+    let nonblocking = flags & SPLICE_F_NONBLOCK != 0;
+
+    let src = get_file_like(fd_in)?;
+    let dst = get_file_like(fd_out)?;
+    let off_in = nullable!(off_in.get_as_mut())?;
+    let off_out = nullable!(off_out.get_as_mut())?;
+
+    let size = match (as_pipe(&src), as_pipe(&dst)) {
+        (Some(src), Some(dst)) => {
+            if off_in.is_some() || off_out.is_some() {
+                return Err(LinuxError::ESPIPE);
+            }
+            Pipe::transfer(&src, &dst, len, nonblocking, true)?
+        }
+        (Some(src), None) => {
+            if off_in.is_some() {
+                return Err(LinuxError::ESPIPE);
+            }
+            let mut dst = SpliceTarget::new(dst, off_out)?;
+            src.splice_to(len, nonblocking, |buf| dst.write(buf))?
+        }
+        (None, Some(dst)) => {
+            if off_out.is_some() {
+                return Err(LinuxError::ESPIPE);
+            }
+            let mut src = SpliceTarget::new(src, off_in)?;
+            dst.splice_from(len, nonblocking, |buf| src.read(buf))?
+        }
+        (None, None) => return Err(LinuxError::EINVAL),
+    };
+    Ok(size as _)
+}
+
+/// Duplicate data from one pipe to another without consuming it.
+pub fn sys_tee(fd_in: c_int, fd_out: c_int, len: usize, flags: u32) -> LinuxResult<isize> {
+    debug!(
+        "sys_tee <= fd_in: {}, fd_out: {}, len: {}, flags: {:#x}",
+        fd_in, fd_out, len, flags
+    );
+    let src = as_pipe(&get_file_like(fd_in)?).ok_or(LinuxError::EINVAL)?;
+    let dst = as_pipe(&get_file_like(fd_out)?).ok_or(LinuxError::EINVAL)?;
+    Ok(Pipe::transfer(&src, &dst, len, flags & SPLICE_F_NONBLOCK != 0, false)? as _)
+}
+
+/// Move data between user memory and a pipe.
+///
+/// User pages are not reference counted, so they cannot be gifted to the
+/// pipe; the data is copied directly between user memory and the pipe
+/// buffer instead.
+pub fn sys_vmsplice(
+    fd: c_int,
+    iov: UserConstPtr<iovec>,
+    nr_segs: usize,
+    flags: u32,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_vmsplice <= fd: {}, nr_segs: {}, flags: {:#x}",
+        fd, nr_segs, flags
+    );
+    if nr_segs > 1024 {
+        return Err(LinuxError::EINVAL);
+    }
+    let nonblocking = flags & SPLICE_F_NONBLOCK != 0;
+    let pipe = Pipe::from_fd(fd)?;
+
+    let mut total = 0;
+    for iov in iov.get_as_slice(nr_segs)? {
+        let len = iov.iov_len as usize;
+        let mut pos = 0;
+        while pos < len {
+            // Only block before anything has been transferred.
+            let nonblocking = nonblocking || total > 0;
+            let mut offset = pos;
+            let result = if pipe.readable() {
+                let buf = UserPtr::<u8>::from(iov.iov_base as usize).get_as_mut_slice(len)?;
+                pipe.splice_to(len - pos, nonblocking, |span| {
+                    buf[offset..offset + span.len()].copy_from_slice(span);
+                    offset += span.len();
+                    Ok(span.len())
+                })
+            } else {
+                let buf = UserConstPtr::<u8>::from(iov.iov_base as usize).get_as_slice(len)?;
+                pipe.splice_from(len - pos, nonblocking, |span| {
+                    span.copy_from_slice(&buf[offset..offset + span.len()]);
+                    offset += span.len();
+                    Ok(span.len())
+                })
+            };
+            match result {
+                Ok(0) => return Ok(total as _),
+                Ok(n) => {
+                    pos += n;
+                    total += n;
+                }
+                Err(_) if total > 0 => return Ok(total as _),
+                Err(err) => return Err(err),
+            }
+        }
+    }
+    Ok(total as _)
+}
@@ -1,27 +1,14 @@
 use core::ffi::{c_char, c_int};
 
-use axerrno::{AxError, LinuxError, LinuxResult};
-use axfs::fops::OpenOptions;
-use linux_raw_sys::general::{AT_EMPTY_PATH, stat, statx};
+use axerrno::{LinuxError, LinuxResult};
+use linux_raw_sys::general::{AT_EMPTY_PATH, AT_SYMLINK_NOFOLLOW, stat, statx};
 
 use crate::{
-    file::{Directory, File, FileLike, Kstat, get_file_like},
+    file::{FileLike, Kstat, get_file_like, lstat_path, stat_path},
     path::handle_file_path,
     ptr::{UserConstPtr, UserPtr, nullable},
 };
 
-fn stat_at_path(path: &str) -> LinuxResult<Kstat> {
-    let opts = OpenOptions::new().set_read(true);
-    match axfs::fops::File::open(path, &opts) {
-        Ok(file) => File::new(file, path.into()).stat(),
-        Err(AxError::IsADirectory) => {
-            let dir = axfs::fops::Directory::open_dir(path, &opts)?;
-            Directory::new(dir, path.into()).stat()
-        }
-        Err(e) => Err(e.into()),
-    }
-}
-
 /// Get the file metadata by `path` and write into `statbuf`.
 ///
 /// Return 0 if success.
@@ -29,7 +16,7 @@ pub fn sys_stat(path: UserConstPtr<c_char>, statbuf: UserPtr<stat>) -> LinuxResu
     let path = path.get_as_str()?;
     debug!("sys_stat <= path: {}", path);
 
-    *statbuf.get_as_mut()? = stat_at_path(path)?.into();
+    statbuf.write(stat_path(path)?.into())?;
 
     Ok(0)
 }
@@ -39,7 +26,7 @@ pub fn sys_stat(path: UserConstPtr<c_char>, statbuf: UserPtr<stat>) -> LinuxResu
 /// Return 0 if success.
 pub fn sys_fstat(fd: i32, statbuf: UserPtr<stat>) -> LinuxResult<isize> {
     debug!("sys_fstat <= fd: {}", fd);
-    *statbuf.get_as_mut()? = get_file_like(fd)?.stat()?.into();
+    statbuf.write(get_file_like(fd)?.stat()?.into())?;
     Ok(0)
 }
 
@@ -47,8 +34,22 @@ pub fn sys_fstat(fd: i32, statbuf: UserPtr<stat>) -> LinuxResult<isize> {
 ///
 /// Return 0 if success.
 pub fn sys_lstat(path: UserConstPtr<c_char>, statbuf: UserPtr<stat>) -> LinuxResult<isize> {
-    // TODO: symlink
-    sys_stat(path, statbuf)
+    let path = path.get_as_str()?;
+    debug!("sys_lstat <= path: {}", path);
+
+    statbuf.write(lstat_path(path)?.into())?;
+
+    Ok(0)
+}
+
+/// Returns the status of the file at `path`, or of the symbolic link there
+/// if `flags` has `AT_SYMLINK_NOFOLLOW`.
+fn stat_path_at(path: &str, flags: u32) -> LinuxResult<Kstat> {
+    if flags & AT_SYMLINK_NOFOLLOW != 0 {
+        lstat_path(path)
+    } else {
+        stat_path(path)
+    }
 }
 
 pub fn sys_fstatat(
@@ -63,7 +64,7 @@ pub fn sys_fstatat(
         dirfd, path, flags
     );
 
-    *statbuf.get_as_mut()? = if path.is_none_or(|s| s.is_empty()) {
+    statbuf.write(if path.is_none_or(|s| s.is_empty()) {
         if (flags & AT_EMPTY_PATH) == 0 {
             return Err(LinuxError::ENOENT);
         }
@@ -71,8 +72,8 @@ pub fn sys_fstatat(
         f.stat()?.into()
     } else {
         let path = handle_file_path(dirfd, path.unwrap_or_default())?;
-        stat_at_path(path.as_str())?.into()
-    };
+        stat_path_at(path.as_str(), flags)?.into()
+    })?;
 
     Ok(0)
 }
@@ -125,7 +126,7 @@ pub fn sys_statx(
         f.stat()?.into()
     } else {
         let path = handle_file_path(dirfd, path.unwrap_or_default())?;
-        stat_at_path(path.as_str())?.into()
+        stat_path_at(path.as_str(), flags)?.into()
     };
 
     Ok(0)
@@ -1,7 +1,24 @@
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use alloc::vec::Vec;
+
 use axerrno::{LinuxError, LinuxResult};
+use axhal::time::{TimeValue, monotonic_time, wall_time};
 use axtask::{TaskExtRef, current};
 use linux_raw_sys::general::{
-    FUTEX_CMD_MASK, FUTEX_CMP_REQUEUE, FUTEX_REQUEUE, FUTEX_WAIT, FUTEX_WAKE, timespec,
+    CLOCK_MONOTONIC, CLOCK_REALTIME, FUTEX_CLOCK_REALTIME, FUTEX_CMD_MASK, FUTEX_CMP_REQUEUE,
+    FUTEX_LOCK_PI, FUTEX_LOCK_PI2, FUTEX_PRIVATE_FLAG, FUTEX_REQUEUE, FUTEX_TRYLOCK_PI,
+    FUTEX_UNLOCK_PI, FUTEX_WAIT, FUTEX_WAIT_BITSET, FUTEX_WAITV_MAX, FUTEX_WAKE, FUTEX_WAKE_BITSET,
+    FUTEX_WAKE_OP, FUTEX2_PRIVATE, FUTEX2_SIZE_MASK, FUTEX2_SIZE_U32, futex_waitv, robust_list,
+    robust_list_head, timespec,
+};
+use memory_addr::VirtAddr;
+use starry_core::{
+    futex::{
+        FUTEX_BITSET_MATCH_ANY, FUTEX_OWNER_DIED, FUTEX_TID_MASK, FUTEX_WAITERS, FutexTable,
+        FutexWaitv, FutexWord, SHARED_FUTEX_TABLE, wait_multiple,
+    },
+    task::{ProcessData, ThreadData, get_thread},
 };
 
 use crate::{
@@ -9,6 +26,100 @@ use crate::{
     time::TimeValueLike,
 };
 
+const FUTEX_OP_SET: u32 = 0;
+const FUTEX_OP_ADD: u32 = 1;
+const FUTEX_OP_OR: u32 = 2;
+const FUTEX_OP_ANDN: u32 = 3;
+const FUTEX_OP_XOR: u32 = 4;
+/// Use `1 << oparg` as the operand.
+const FUTEX_OP_OPARG_SHIFT: u32 = 8;
+
+const FUTEX_OP_CMP_EQ: u32 = 0;
+const FUTEX_OP_CMP_NE: u32 = 1;
+const FUTEX_OP_CMP_LT: u32 = 2;
+const FUTEX_OP_CMP_LE: u32 = 3;
+const FUTEX_OP_CMP_GT: u32 = 4;
+const FUTEX_OP_CMP_GE: u32 = 5;
+
+/// Returns the futex word at `addr` in the address space of the process,
+/// which the futex operation modifies if `write` is set.
+pub(crate) fn futex_word(
+    proc_data: &ProcessData,
+    addr: usize,
+    write: bool,
+) -> LinuxResult<FutexWord> {
+    FutexWord::new(proc_data.aspace(), VirtAddr::from(addr), write)
+}
+
+/// Returns the table holding the futex of `word`, and its key in the table.
+///
+/// Private futexes are keyed by their virtual address in the table of the
+/// process. Shared ones are keyed by the physical address of the futex word,
+/// so that they are found from every process mapping it.
+pub(crate) fn futex_table_and_key<'a>(
+    proc_data: &'a ProcessData,
+    word: &FutexWord,
+    private: bool,
+) -> LinuxResult<(&'a FutexTable, usize)> {
+    if private {
+        return Ok((&proc_data.futex_table, word.vaddr().as_usize()));
+    }
+    Ok((&SHARED_FUTEX_TABLE, word.pin()?.paddr().as_usize()))
+}
+
+/// Converts an absolute timeout on CLOCK_REALTIME or CLOCK_MONOTONIC into a
+/// relative one.
+fn relative_timeout(deadline: &timespec, realtime: bool) -> TimeValue {
+    let now = if realtime {
+        wall_time()
+    } else {
+        monotonic_time()
+    };
+    deadline
+        .to_time_value()
+        .checked_sub(now)
+        .unwrap_or(TimeValue::ZERO)
+}
+
+/// Sign-extends the 12-bit field of `value3` at `shift`.
+fn futex_op_arg(value3: u32, shift: u32) -> i32 {
+    ((value3 >> shift << 20) as i32) >> 20
+}
+
+/// Performs the operation encoded in `value3` of `FUTEX_WAKE_OP` on `word`,
+/// and returns whether its old value satisfies the encoded comparison.
+fn futex_wake_op(word: &AtomicU32, value3: u32) -> LinuxResult<bool> {
+    let op = (value3 >> 28) & 0xf;
+    let cmp = (value3 >> 24) & 0xf;
+    let mut oparg = futex_op_arg(value3, 12) as u32;
+    let cmparg = futex_op_arg(value3, 0);
+    if op & FUTEX_OP_OPARG_SHIFT != 0 {
+        if oparg > 31 {
+            return Err(LinuxError::EINVAL);
+        }
+        oparg = 1 << oparg;
+    }
+
+    let old = match op & !FUTEX_OP_OPARG_SHIFT {
+        FUTEX_OP_SET => word.swap(oparg, Ordering::SeqCst),
+        FUTEX_OP_ADD => word.fetch_add(oparg, Ordering::SeqCst),
+        FUTEX_OP_OR => word.fetch_or(oparg, Ordering::SeqCst),
+        FUTEX_OP_ANDN => word.fetch_and(!oparg, Ordering::SeqCst),
+        FUTEX_OP_XOR => word.fetch_xor(oparg, Ordering::SeqCst),
+        _ => return Err(LinuxError::ENOSYS),
+    } as i32;
+
+    Ok(match cmp {
+        FUTEX_OP_CMP_EQ => old == cmparg,
+        FUTEX_OP_CMP_NE => old != cmparg,
+        FUTEX_OP_CMP_LT => old < cmparg,
+        FUTEX_OP_CMP_LE => old <= cmparg,
+        FUTEX_OP_CMP_GT => old > cmparg,
+        FUTEX_OP_CMP_GE => old >= cmparg,
+        _ => return Err(LinuxError::ENOSYS),
+    })
+}
+
 pub fn sys_futex(
     uaddr: UserConstPtr<u32>,
     futex_op: u32,
@@ -20,62 +131,254 @@ pub fn sys_futex(
     info!("futex {:?} {} {}", uaddr.address(), futex_op, value);
 
     let curr = current();
-    let futex_table = &curr.task_ext().process_data().futex_table;
+    let proc_data = curr.task_ext().process_data();
+    let private = futex_op & FUTEX_PRIVATE_FLAG != 0;
 
-    let addr = uaddr.address().as_usize();
     let command = futex_op & (FUTEX_CMD_MASK as u32);
+    let write = matches!(
+        command,
+        FUTEX_CMP_REQUEUE
+            | FUTEX_WAKE_OP
+            | FUTEX_LOCK_PI
+            | FUTEX_LOCK_PI2
+            | FUTEX_TRYLOCK_PI
+            | FUTEX_UNLOCK_PI
+    );
+    let word = futex_word(proc_data, uaddr.address().as_usize(), write)?;
+    let (futex_table, addr) = futex_table_and_key(proc_data, &word, private)?;
     match command {
-        FUTEX_WAIT => {
-            if *uaddr.get_as_ref()? != value {
-                return Err(LinuxError::EAGAIN);
-            }
-            let wq = futex_table.get_or_insert(addr);
-
-            if let Some(timeout) = nullable!(timeout.get_as_ref())? {
-                wq.wait_timeout(timeout.to_time_value());
+        FUTEX_WAIT | FUTEX_WAIT_BITSET => {
+            let bitset = if command == FUTEX_WAIT {
+                FUTEX_BITSET_MATCH_ANY
             } else {
-                wq.wait();
+                value3
+            };
+            if bitset == 0 {
+                return Err(LinuxError::EINVAL);
             }
-
+            // The timeout of `FUTEX_WAIT` is relative, while that of
+            // `FUTEX_WAIT_BITSET` is an absolute time on the chosen clock.
+            let timeout = nullable!(timeout.get_as_ref())?.map(|ts| {
+                if command == FUTEX_WAIT {
+                    ts.to_time_value()
+                } else {
+                    relative_timeout(ts, futex_op & FUTEX_CLOCK_REALTIME != 0)
+                }
+            });
+            futex_table.wait(addr, bitset, &word, value, timeout)?;
             Ok(0)
         }
-        FUTEX_WAKE => {
-            let wq = futex_table.get(addr);
-            let mut count = 0;
-            if let Some(wq) = wq {
-                for _ in 0..value {
-                    if !wq.notify_one(false) {
-                        break;
-                    }
-                    count += 1;
-                }
+        FUTEX_WAKE | FUTEX_WAKE_BITSET => {
+            let bitset = if command == FUTEX_WAKE {
+                FUTEX_BITSET_MATCH_ANY
+            } else {
+                value3
+            };
+            if bitset == 0 {
+                return Err(LinuxError::EINVAL);
             }
-            axtask::yield_now();
-            Ok(count)
+            Ok(futex_table.wake(addr, value as usize, bitset) as isize)
         }
         FUTEX_REQUEUE | FUTEX_CMP_REQUEUE => {
-            if command == FUTEX_CMP_REQUEUE && *uaddr.get_as_ref()? != value3 {
-                return Err(LinuxError::EAGAIN);
-            }
             let value2 = timeout.address().as_usize() as u32;
-
-            let wq = futex_table.get(addr);
-            let wq2 = futex_table.get_or_insert(uaddr2.address().as_usize());
-
-            let mut count = 0;
-            if let Some(wq) = wq {
-                for _ in 0..value {
-                    if !wq.notify_one(false) {
-                        break;
-                    }
-                    count += 1;
-                }
-                if count == value as isize {
-                    count += wq.requeue(value2 as usize, &wq2) as isize;
+            let word2 = futex_word(proc_data, uaddr2.address().as_usize(), write)?;
+            let (_, addr2) = futex_table_and_key(proc_data, &word2, private)?;
+            let expected = (command == FUTEX_CMP_REQUEUE).then_some((&word, value3));
+            let count =
+                futex_table.requeue(addr, value as usize, addr2, value2 as usize, expected)?;
+            Ok(count as isize)
+        }
+        FUTEX_WAKE_OP => {
+            let value2 = timeout.address().as_usize() as u32;
+            let word2 = futex_word(proc_data, uaddr2.address().as_usize(), true)?;
+            let (_, addr2) = futex_table_and_key(proc_data, &word2, private)?;
+            let count = futex_table.wake_op(
+                addr,
+                value as usize,
+                addr2,
+                value2 as usize,
+                &word2,
+                |word2| futex_wake_op(word2, value3),
+            )?;
+            Ok(count as isize)
+        }
+        FUTEX_LOCK_PI | FUTEX_LOCK_PI2 | FUTEX_TRYLOCK_PI | FUTEX_UNLOCK_PI => {
+            match command {
+                FUTEX_UNLOCK_PI => futex_table.unlock_pi(addr, &word)?,
+                FUTEX_TRYLOCK_PI => futex_table.lock_pi(addr, &word, None, true)?,
+                _ => {
+                    // The timeout is an absolute time, on CLOCK_REALTIME for
+                    // `FUTEX_LOCK_PI` and on the chosen clock for
+                    // `FUTEX_LOCK_PI2`.
+                    let realtime = command == FUTEX_LOCK_PI || futex_op & FUTEX_CLOCK_REALTIME != 0;
+                    let timeout =
+                        nullable!(timeout.get_as_ref())?.map(|ts| relative_timeout(ts, realtime));
+                    futex_table.lock_pi(addr, &word, timeout, false)?
                 }
             }
-            Ok(count)
+            Ok(0)
         }
         _ => Err(LinuxError::ENOSYS),
     }
 }
+
+pub fn sys_futex_waitv(
+    waiters: UserConstPtr<futex_waitv>,
+    nr_futexes: u32,
+    flags: u32,
+    timeout: UserConstPtr<timespec>,
+    clockid: u32,
+) -> LinuxResult<isize> {
+    if flags != 0 || nr_futexes == 0 || nr_futexes > FUTEX_WAITV_MAX {
+        return Err(LinuxError::EINVAL);
+    }
+    // The timeout is an absolute time on the given clock.
+    let timeout = match nullable!(timeout.get_as_ref())? {
+        Some(ts) => {
+            let realtime = match clockid {
+                CLOCK_REALTIME => true,
+                CLOCK_MONOTONIC => false,
+                _ => return Err(LinuxError::EINVAL),
+            };
+            Some(relative_timeout(ts, realtime))
+        }
+        None => None,
+    };
+
+    let curr = current();
+    let proc_data = curr.task_ext().process_data();
+    let waiters = waiters.get_as_slice(nr_futexes as usize)?;
+    let mut words = Vec::with_capacity(waiters.len());
+    for waiter in waiters {
+        if waiter.flags & !(FUTEX2_SIZE_MASK | FUTEX2_PRIVATE) != 0
+            || waiter.__reserved != 0
+            || waiter.flags & FUTEX2_SIZE_MASK != FUTEX2_SIZE_U32
+        {
+            return Err(LinuxError::EINVAL);
+        }
+        let value = u32::try_from(waiter.val).map_err(|_| LinuxError::EINVAL)?;
+        words.push((futex_word(proc_data, waiter.uaddr as usize, false)?, value));
+    }
+    let mut futexes = Vec::with_capacity(waiters.len());
+    for ((word, value), waiter) in words.iter().zip(waiters) {
+        let (table, key) =
+            futex_table_and_key(proc_data, word, waiter.flags & FUTEX2_PRIVATE != 0)?;
+        futexes.push(FutexWaitv {
+            table,
+            key,
+            word,
+            value: *value,
+        });
+    }
+    Ok(wait_multiple(&futexes, timeout)? as isize)
+}
+
+/// The maximum number of entries walked in a robust futex list, which keeps
+/// a corrupted or circular list from hanging the exiting thread.
+const ROBUST_LIST_LIMIT: usize = 2048;
+
+pub fn sys_set_robust_list(head: UserConstPtr<robust_list_head>, len: usize) -> LinuxResult<isize> {
+    if len != size_of::<robust_list_head>() {
+        return Err(LinuxError::EINVAL);
+    }
+    current()
+        .task_ext()
+        .thread_data()
+        .set_robust_list_head(head.address().as_usize());
+    Ok(0)
+}
+
+pub fn sys_get_robust_list(
+    tid: u32,
+    head: UserPtr<usize>,
+    len: UserPtr<usize>,
+) -> LinuxResult<isize> {
+    let robust_list_head = if tid == 0 {
+        current().task_ext().thread_data().robust_list_head()
+    } else {
+        let thread = get_thread(tid)?;
+        let thr_data = thread.data::<ThreadData>().ok_or(LinuxError::ESRCH)?;
+        thr_data.robust_list_head()
+    };
+    *head.get_as_mut()? = robust_list_head;
+    *len.get_as_mut()? = size_of::<robust_list_head>();
+    Ok(0)
+}
+
+/// Releases the robust futex of the list entry at `entry`, if it is still
+/// owned by the exiting thread `tid`: marks it with `FUTEX_OWNER_DIED` and
+/// wakes up a waiter, or hands it over if it is a PI futex.
+fn handle_futex_death(proc_data: &ProcessData, entry: usize, futex_offset: isize, tid: u32) {
+    // The lowest bit of an entry marks a PI futex.
+    let pi = entry & 1 != 0;
+    let addr = (entry & !1).wrapping_add_signed(futex_offset);
+    let Ok(word) = UserPtr::<u32>::from(addr).get_as_mut() else {
+        return;
+    };
+    // SAFETY: the user pointer has been checked to be valid and aligned.
+    let word = unsafe { AtomicU32::from_ptr(word) };
+    let Ok(old) = word.fetch_update(Ordering::SeqCst, Ordering::SeqCst, |val| {
+        (val & FUTEX_TID_MASK == tid).then_some((val & FUTEX_WAITERS) | FUTEX_OWNER_DIED)
+    }) else {
+        return;
+    };
+    if old & FUTEX_WAITERS == 0 {
+        return;
+    }
+
+    let Ok(word) = futex_word(proc_data, addr, true) else {
+        return;
+    };
+    // Waiters may use either a private or a shared futex.
+    for private in [true, false] {
+        let Ok((table, key)) = futex_table_and_key(proc_data, &word, private) else {
+            continue;
+        };
+        if pi {
+            if table.hand_over_dead_pi(key, &word) {
+                break;
+            }
+        } else {
+            table.wake(key, 1, FUTEX_BITSET_MATCH_ANY);
+        }
+    }
+}
+
+/// Walks the robust futex list of the exiting current thread, releasing every
+/// futex it still holds.
+pub(crate) fn exit_robust_list() {
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    let proc_data = curr.task_ext().process_data();
+    let tid = curr.task_ext().thread.tid();
+
+    let head_addr = thr_data.robust_list_head();
+    if head_addr == 0 {
+        return;
+    }
+    let Ok(head) = UserConstPtr::<robust_list_head>::from(head_addr).get_as_ref() else {
+        return;
+    };
+    let futex_offset = head.futex_offset as isize;
+    let pending = head.list_op_pending as usize;
+
+    let mut entry = head.list.next as usize;
+    for _ in 0..ROBUST_LIST_LIMIT {
+        if entry == head_addr {
+            break;
+        }
+        // Fetch the next entry first, as the futex may be freed once
+        // released.
+        let Ok(next) = UserConstPtr::<robust_list>::from(entry & !1).get_as_ref() else {
+            break;
+        };
+        let next = next.next as usize;
+        if entry != pending {
+            handle_futex_death(proc_data, entry, futex_offset, tid);
+        }
+        entry = next;
+    }
+    if pending != 0 {
+        handle_futex_death(proc_data, pending, futex_offset, tid);
+    }
+}
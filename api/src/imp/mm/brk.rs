@@ -1,14 +1,40 @@
 use axerrno::LinuxResult;
+use axhal::paging::MappingFlags;
 use axtask::{TaskExtRef, current};
+use memory_addr::{VirtAddr, align_up_4k};
 
+use super::check_as_limit;
+
+/// Moves the program break to `addr`, returning the new one, or the current
+/// one if `addr` is invalid or the heap can't be resized.
+///
+/// The heap is only mapped up to the break, and its pages are allocated on
+/// their first access.
 pub fn sys_brk(addr: usize) -> LinuxResult<isize> {
     let task = current();
     let process_data = task.task_ext().process_data();
-    let mut return_val: isize = process_data.get_heap_top() as isize;
-    let heap_bottom = process_data.get_heap_bottom() as usize;
-    if addr != 0 && addr >= heap_bottom && addr <= heap_bottom + axconfig::plat::USER_HEAP_SIZE {
-        process_data.set_heap_top(addr);
-        return_val = addr as isize;
+    let heap_top = process_data.get_heap_top();
+    let heap_bottom = process_data.get_heap_bottom();
+    if addr == 0 || addr < heap_bottom || addr > heap_bottom + axconfig::plat::USER_HEAP_SIZE {
+        return Ok(heap_top as isize);
+    }
+
+    let old_end = VirtAddr::from(align_up_4k(heap_top));
+    let new_end = VirtAddr::from(align_up_4k(addr));
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
+    if new_end > old_end {
+        if check_as_limit(process_data, &aspace, new_end - old_end).is_err() {
+            return Ok(heap_top as isize);
+        }
+        let flags = MappingFlags::READ | MappingFlags::WRITE | MappingFlags::USER;
+        if let Err(e) = aspace.map_alloc(old_end, new_end - old_end, flags, false) {
+            debug!("sys_brk: failed to grow the heap to {:#x}: {:?}", addr, e);
+            return Ok(heap_top as isize);
+        }
+    } else if new_end < old_end {
+        aspace.unmap(new_end, old_end - new_end)?;
     }
-    Ok(return_val)
+    process_data.set_heap_top(addr);
+    Ok(addr as isize)
 }
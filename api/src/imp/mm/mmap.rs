@@ -1,14 +1,18 @@
-use alloc::vec;
-use axerrno::{LinuxError, LinuxResult};
+use alloc::sync::Arc;
+use axerrno::{AxError, LinuxError, LinuxResult};
 use axhal::paging::MappingFlags;
+use axmm::{AddrSpace, PAGE_SIZE_2M, SharedPages};
 use axtask::{TaskExtRef, current};
 use linux_raw_sys::general::{
-    MAP_ANONYMOUS, MAP_FIXED, MAP_NORESERVE, MAP_PRIVATE, MAP_SHARED, MAP_STACK, PROT_EXEC,
-    PROT_GROWSDOWN, PROT_GROWSUP, PROT_READ, PROT_WRITE,
+    MADV_DONTNEED, MADV_FREE, MADV_HUGEPAGE, MADV_NOHUGEPAGE, MADV_SEQUENTIAL, MADV_WILLNEED,
+    MAP_ANONYMOUS, MAP_FIXED, MAP_NORESERVE, MAP_PRIVATE, MAP_SHARED, MAP_STACK, MREMAP_FIXED,
+    MREMAP_MAYMOVE, MS_ASYNC, MS_INVALIDATE, MS_SYNC, PROT_EXEC, PROT_GROWSDOWN, PROT_GROWSUP,
+    PROT_READ, PROT_WRITE,
 };
-use memory_addr::{VirtAddr, VirtAddrRange};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, VirtAddr, VirtAddrRange};
 
-use crate::file::{File, FileLike};
+use super::check_as_limit;
+use crate::file::{File, FileLike, IoUring, MemFd};
 
 bitflags::bitflags! {
     /// `PROT_*` flags for use with [`sys_mmap`].
@@ -76,7 +80,8 @@ pub fn sys_mmap(
 ) -> LinuxResult<isize> {
     let curr = current();
     let process_data = curr.task_ext().process_data();
-    let mut aspace = process_data.aspace.lock();
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
     let permission_flags = MmapProt::from_bits_truncate(prot);
     // TODO: check illegal flags for mmap
     // An example is the flags contained none of MAP_PRIVATE, MAP_SHARED, or MAP_SHARED_VALIDATE.
@@ -95,65 +100,147 @@ pub fn sys_mmap(
         start, end, aligned_length
     );
 
+    let shared = map_flags.contains(MmapFlags::SHARED);
+    let anonymous = fd == -1 || map_flags.contains(MmapFlags::ANONYMOUS);
+    // Everything that may fail is checked first, so that a fixed mapping
+    // only replaces the old one once it is known to succeed.
+    let backing = if anonymous {
+        None
+    } else {
+        Some(mmap_backing(
+            fd,
+            offset,
+            shared,
+            permission_flags.contains(MmapProt::WRITE),
+            aligned_length,
+        )?)
+    };
     let start_addr = if map_flags.contains(MmapFlags::FIXED) {
         if start == 0 {
             return Err(LinuxError::EINVAL);
         }
         let dst_addr = VirtAddr::from(start);
+        let replaced = mapped_size_in(
+            &aspace,
+            VirtAddrRange::from_start_size(dst_addr, aligned_length),
+        );
+        check_as_limit(process_data, &aspace, aligned_length - replaced)?;
         aspace.unmap(dst_addr, aligned_length)?;
         dst_addr
     } else {
-        aspace
+        check_as_limit(process_data, &aspace, aligned_length)?;
+        // Large private anonymous mappings without a hint are aligned, so that
+        // they can be backed by huge pages.
+        let huge_aligned = start == 0 && !shared && anonymous && aligned_length >= PAGE_SIZE_2M;
+        let search_length = if huge_aligned {
+            aligned_length + PAGE_SIZE_2M - PAGE_SIZE_4K
+        } else {
+            aligned_length
+        };
+        let start_addr = aspace
             .find_free_area(
                 VirtAddr::from(start),
-                aligned_length,
+                search_length,
                 VirtAddrRange::new(aspace.base(), aspace.end()),
             )
             .or(aspace.find_free_area(
                 aspace.base(),
-                aligned_length,
+                search_length,
                 VirtAddrRange::new(aspace.base(), aspace.end()),
             ))
-            .ok_or(LinuxError::ENOMEM)?
+            .ok_or(LinuxError::ENOMEM)?;
+        if huge_aligned {
+            start_addr.align_up(PAGE_SIZE_2M)
+        } else {
+            start_addr
+        }
     };
 
-    let populate = if fd == -1 {
-        false
-    } else {
-        !map_flags.contains(MmapFlags::ANONYMOUS)
-    };
+    let flags = permission_flags.into();
+    match backing {
+        None if shared => {
+            let pages = Arc::new(SharedPages::new(None));
+            aspace.map_shared(start_addr, aligned_length, flags, pages, 0)?;
+        }
+        None => aspace.map_alloc(start_addr, aligned_length, flags, false)?,
+        // Pages are read from the file on their first access.
+        Some((pages, offset)) if shared => {
+            aspace.map_shared(start_addr, aligned_length, flags, pages, offset)?
+        }
+        Some((pages, offset)) => {
+            aspace.map_file(start_addr, aligned_length, flags, pages, offset)?
+        }
+    }
+    Ok(start_addr.as_usize() as _)
+}
 
-    aspace.map_alloc(
-        start_addr,
-        aligned_length,
-        permission_flags.into(),
-        populate,
-    )?;
-
-    if populate {
-        let file = File::from_fd(fd)?;
-        let file = file.inner();
-        let file_size = file.get_attr()?.size() as usize;
-        if offset < 0 || offset as usize >= file_size {
+/// Returns the pages that a mapping of `length` bytes of the file `fd` at
+/// `offset` is backed by, and the offset of the mapping in them.
+fn mmap_backing(
+    fd: i32,
+    offset: isize,
+    shared: bool,
+    writable: bool,
+    length: usize,
+) -> LinuxResult<(Arc<SharedPages>, usize)> {
+    if offset < 0 || !memory_addr::is_aligned_4k(offset as usize) {
+        return Err(LinuxError::EINVAL);
+    }
+    // The rings of an io_uring, which are always shared.
+    if let Ok(ring) = IoUring::from_fd(fd) {
+        if !shared {
             return Err(LinuxError::EINVAL);
         }
-        let offset = offset as usize;
-        let length = core::cmp::min(length, file_size - offset);
-        let mut buf = vec![0u8; length];
-        file.read_at(offset as u64, &mut buf)?;
-        aspace.write(start_addr, &buf)?;
+        return Ok((ring.mmap_pages(offset as usize, length)?, 0));
     }
-    Ok(start_addr.as_usize() as _)
+    // The mappings of a memfd share its frames, which hold its content.
+    if let Ok(memfd) = MemFd::from_fd(fd) {
+        memfd.check_map(shared && writable)?;
+        return Ok((memfd.shared_pages(), offset as usize));
+    }
+    let pages = File::from_fd(fd)?.shared_pages(shared && writable)?;
+    Ok((pages, offset as usize))
+}
+
+/// Returns how many bytes of `range` are mapped in `aspace`.
+fn mapped_size_in(aspace: &AddrSpace, range: VirtAddrRange) -> usize {
+    aspace
+        .areas()
+        .filter_map(|(area, ..)| {
+            let start = area.start.max(range.start);
+            let end = area.end.min(range.end);
+            (start < end).then(|| end - start)
+        })
+        .sum()
 }
 
 pub fn sys_munmap(addr: usize, length: usize) -> LinuxResult<isize> {
     let curr = current();
     let process_data = curr.task_ext().process_data();
-    let mut aspace = process_data.aspace.lock();
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
     let length = memory_addr::align_up_4k(length);
     let start_addr = VirtAddr::from(addr);
     aspace.unmap(start_addr, length)?;
-    axhal::arch::flush_tlb(None);
+    Ok(0)
+}
+
+pub fn sys_msync(addr: usize, length: usize, flags: u32) -> LinuxResult<isize> {
+    if !memory_addr::is_aligned_4k(addr)
+        || flags & !(MS_ASYNC | MS_INVALIDATE | MS_SYNC) != 0
+        || flags & (MS_ASYNC | MS_SYNC) == MS_ASYNC | MS_SYNC
+    {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let curr = current();
+    let process_data = curr.task_ext().process_data();
+    let aspace = process_data.aspace();
+    let aspace = aspace.read();
+    let length = memory_addr::align_up_4k(length);
+    // Dirty pages are written back even with `MS_ASYNC`, since there is no
+    // background writeback.
+    aspace.sync(VirtAddr::from(addr), length)?;
     Ok(0)
 }
 
@@ -168,10 +255,106 @@ pub fn sys_mprotect(addr: usize, length: usize, prot: u32) -> LinuxResult<isize>
 
     let curr = current();
     let process_data = curr.task_ext().process_data();
-    let mut aspace = process_data.aspace.lock();
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
     let length = memory_addr::align_up_4k(length);
     let start_addr = VirtAddr::from(addr);
     aspace.protect(start_addr, length, permission_flags.into())?;
 
     Ok(0)
 }
+
+pub fn sys_mremap(
+    old_addr: usize,
+    old_size: usize,
+    new_size: usize,
+    flags: u32,
+    new_addr: usize,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_mremap <= old_addr: {:#x}, old_size: {:#x}, new_size: {:#x}, flags: {:#x}, new_addr: {:#x}",
+        old_addr, old_size, new_size, flags, new_addr
+    );
+    let may_move = flags & MREMAP_MAYMOVE != 0;
+    let fixed = flags & MREMAP_FIXED != 0;
+    if !memory_addr::is_aligned_4k(old_addr)
+        || new_size == 0
+        || flags & !(MREMAP_MAYMOVE | MREMAP_FIXED) != 0
+        || (fixed && (!may_move || !memory_addr::is_aligned_4k(new_addr)))
+    {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let curr = current();
+    let process_data = curr.task_ext().process_data();
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
+    let old_start = VirtAddr::from(old_addr);
+    let old_size = memory_addr::align_up_4k(old_size);
+    let new_size = memory_addr::align_up_4k(new_size);
+    if new_size > old_size {
+        check_as_limit(process_data, &aspace, new_size - old_size)?;
+    }
+
+    let new_start = if fixed {
+        let new_start = VirtAddr::from(new_addr);
+        if VirtAddrRange::from_start_size(new_start, new_size)
+            .overlaps(VirtAddrRange::from_start_size(old_start, old_size))
+        {
+            return Err(LinuxError::EINVAL);
+        }
+        // The destination is only replaced once the move is known to succeed.
+        aspace.check_movable(old_start, old_size)?;
+        aspace.unmap(new_start, new_size)?;
+        new_start
+    } else {
+        match aspace.resize(old_start, old_size, new_size) {
+            Ok(()) => return Ok(old_addr as _),
+            Err(AxError::AlreadyExists) if may_move => {}
+            Err(AxError::AlreadyExists) => return Err(LinuxError::ENOMEM),
+            Err(e) => return Err(e.into()),
+        }
+        // Keep the offset in huge pages, so that they can be moved as a whole.
+        let found = aspace
+            .find_free_area(
+                aspace.base(),
+                new_size + 2 * PAGE_SIZE_2M,
+                VirtAddrRange::new(aspace.base(), aspace.end()),
+            )
+            .ok_or(LinuxError::ENOMEM)?;
+        found.align_up(PAGE_SIZE_2M) + old_start.align_offset(PAGE_SIZE_2M)
+    };
+    aspace.move_area(old_start, old_size, new_start, new_size)?;
+    Ok(new_start.as_usize() as _)
+}
+
+/// The size read ahead for `madvise(MADV_SEQUENTIAL)`.
+const SEQUENTIAL_PREFETCH_SIZE: usize = 64 * PAGE_SIZE_4K;
+
+pub fn sys_madvise(addr: usize, length: usize, advice: u32) -> LinuxResult<isize> {
+    debug!(
+        "sys_madvise <= addr: {:#x}, length: {:#x}, advice: {}",
+        addr, length, advice
+    );
+    if !memory_addr::is_aligned_4k(addr) {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let curr = current();
+    let process_data = curr.task_ext().process_data();
+    let aspace = process_data.aspace();
+    let mut aspace = aspace.write();
+    let length = memory_addr::align_up_4k(length);
+    let start_addr = VirtAddr::from(addr);
+    match advice {
+        // Pages are freed right away, which is also valid for `MADV_FREE`.
+        MADV_DONTNEED | MADV_FREE => aspace.discard(start_addr, length)?,
+        MADV_WILLNEED => aspace.prefetch(start_addr, length)?,
+        MADV_SEQUENTIAL => aspace.prefetch(start_addr, length.min(SEQUENTIAL_PREFETCH_SIZE))?,
+        MADV_HUGEPAGE => aspace.set_huge_pages(start_addr, length, true)?,
+        MADV_NOHUGEPAGE => aspace.set_huge_pages(start_addr, length, false)?,
+        // Other advice is only a hint.
+        _ => {}
+    }
+    Ok(0)
+}
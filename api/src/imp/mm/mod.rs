@@ -1,5 +1,21 @@
 mod brk;
 mod mmap;
+mod process_vm;
+
+use axerrno::{LinuxError, LinuxResult};
+use axmm::AddrSpace;
+use starry_core::task::ProcessData;
 
 pub use self::brk::*;
 pub use self::mmap::*;
+pub use self::process_vm::*;
+
+/// Fails with `ENOMEM` if mapping `size` more bytes in `aspace` would take
+/// it over the `RLIMIT_AS` of the process.
+fn check_as_limit(proc_data: &ProcessData, aspace: &AddrSpace, size: usize) -> LinuxResult<()> {
+    let limit = proc_data.rlimits.read().address_space();
+    if aspace.mapped_size().saturating_add(size) > limit {
+        return Err(LinuxError::ENOMEM);
+    }
+    Ok(())
+}
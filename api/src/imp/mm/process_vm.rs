@@ -0,0 +1,163 @@
+//! `process_vm_readv` and `process_vm_writev`, which copy between the memory
+//! of the current process and that of another one.
+//!
+//! The remote pages are faulted in through the address space of the target
+//! and copied through their frames, so the data is not bounced through a
+//! kernel buffer nor through the target itself.
+
+use alloc::vec::Vec;
+
+use axerrno::{LinuxError, LinuxResult};
+use axhal::paging::MappingFlags;
+use axmm::AddrSpace;
+use axprocess::Pid;
+use linux_raw_sys::general::iovec;
+use memory_addr::{MemoryAddr, VirtAddr, VirtAddrRange};
+use starry_core::task::{ProcessData, get_process};
+
+use crate::{
+    imp::fs::{user_bufs, user_bufs_mut},
+    ptr::{UserConstPtr, UserPtr},
+};
+
+/// The maximum number of `iovec`s on either side.
+const IOV_MAX: usize = 1024;
+
+/// Faults in the pages of `[start, start + len)` in the address space of the
+/// remote process for `access`.
+fn populate_remote(
+    aspace: &AddrSpace,
+    start: VirtAddr,
+    len: usize,
+    access: MappingFlags,
+) -> LinuxResult {
+    let end = start
+        .as_usize()
+        .checked_add(len)
+        .ok_or(LinuxError::EFAULT)?;
+    if !aspace.check_region_access(VirtAddrRange::from_start_size(start, len), access) {
+        return Err(LinuxError::EFAULT);
+    }
+    let page_start = start.align_down_4k();
+    let page_end = VirtAddr::from(end).align_up_4k();
+    aspace.populate_area(page_start, page_end - page_start, access)?;
+    Ok(())
+}
+
+/// Copies between the local buffers, given by their addresses and lengths,
+/// and the ranges `remote` in the memory of the process `pid`, writing to the
+/// remote memory if `write`.
+///
+/// As on Linux, a remote range is either copied whole (or up to the end of
+/// the local buffers) or not at all, and the copy stops at the first one that
+/// fails.
+fn process_vm_copy(
+    pid: Pid,
+    local: Vec<(usize, usize)>,
+    remote: UserConstPtr<iovec>,
+    riovcnt: usize,
+    flags: usize,
+    write: bool,
+) -> LinuxResult<isize> {
+    if flags != 0 || riovcnt > IOV_MAX {
+        return Err(LinuxError::EINVAL);
+    }
+    let remote = remote.get_as_slice(riovcnt)?;
+    let process = get_process(pid)?;
+    // Exited processes have no memory left.
+    if process.is_zombie() {
+        return Err(LinuxError::ESRCH);
+    }
+    let proc_data = process.data::<ProcessData>().ok_or(LinuxError::ESRCH)?;
+    // The local buffers are populated already, so they can be accessed with
+    // the address space locked even if it is the same one.
+    let aspace = proc_data.aspace();
+    let aspace = aspace.read();
+    let access = if write {
+        MappingFlags::WRITE
+    } else {
+        MappingFlags::READ
+    };
+
+    let mut left: usize = local.iter().map(|&(_, len)| len).sum();
+    let mut local = local.into_iter();
+    let (mut buf, mut buf_len) = (0, 0);
+    let mut copied = 0;
+    for iov in remote {
+        let len = (iov.iov_len as usize).min(left);
+        if len == 0 {
+            continue;
+        }
+        let start = VirtAddr::from(iov.iov_base as usize);
+        if let Err(err) = populate_remote(&aspace, start, len, access) {
+            if copied > 0 {
+                break;
+            }
+            return Err(err);
+        }
+
+        let mut done = 0;
+        while done < len {
+            if buf_len == 0 {
+                (buf, buf_len) = local.next().ok_or(LinuxError::EFAULT)?;
+            }
+            let n = buf_len.min(len - done);
+            // SAFETY: the local buffers are populated user memory of the
+            // current process, checked for the access.
+            if write {
+                let src = unsafe { core::slice::from_raw_parts(buf as *const u8, n) };
+                aspace.write(start + done, src)?;
+            } else {
+                let dst = unsafe { core::slice::from_raw_parts_mut(buf as *mut u8, n) };
+                aspace.read(start + done, dst)?;
+            }
+            (buf, buf_len) = (buf + n, buf_len - n);
+            done += n;
+        }
+        copied += len;
+        left -= len;
+    }
+    Ok(copied as _)
+}
+
+/// Reads the memory of the process `pid` at the ranges `remote_iov` into the
+/// buffers `local_iov` of the current process.
+pub fn sys_process_vm_readv(
+    pid: Pid,
+    local_iov: UserPtr<iovec>,
+    liovcnt: usize,
+    remote_iov: UserConstPtr<iovec>,
+    riovcnt: usize,
+    flags: usize,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_process_vm_readv <= pid: {}, liovcnt: {}, riovcnt: {}, flags: {:#x}",
+        pid, liovcnt, riovcnt, flags
+    );
+    let local = user_bufs_mut(local_iov, liovcnt)?
+        .into_iter()
+        .map(|buf| (buf.as_mut_ptr() as usize, buf.len()))
+        .collect();
+    process_vm_copy(pid, local, remote_iov, riovcnt, flags, false)
+}
+
+/// Writes the buffers `local_iov` of the current process to the memory of
+/// the process `pid` at the ranges `remote_iov`.
+pub fn sys_process_vm_writev(
+    pid: Pid,
+    local_iov: UserConstPtr<iovec>,
+    liovcnt: usize,
+    remote_iov: UserConstPtr<iovec>,
+    riovcnt: usize,
+    flags: usize,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_process_vm_writev <= pid: {}, liovcnt: {}, riovcnt: {}, flags: {:#x}",
+        pid, liovcnt, riovcnt, flags
+    );
+    let local = user_bufs(local_iov, liovcnt)?
+        .into_iter()
+        .map(|buf| (buf.as_ptr() as usize, buf.len()))
+        .collect();
+    process_vm_copy(pid, local, remote_iov, riovcnt, flags, true)
+}
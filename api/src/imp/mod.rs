@@ -1,9 +1,11 @@
 mod fs;
 mod futex;
 mod mm;
+mod net;
+mod perf;
 mod signal;
 mod sys;
 mod task;
 mod time;
 
-pub use self::{fs::*, futex::*, mm::*, signal::*, sys::*, task::*, time::*};
+pub use self::{fs::*, futex::*, mm::*, net::*, perf::*, signal::*, sys::*, task::*, time::*};
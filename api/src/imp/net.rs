@@ -0,0 +1,203 @@
+use core::{ffi::c_int, mem::size_of};
+
+use alloc::{sync::Arc, vec::Vec};
+use axerrno::{LinuxError, LinuxResult};
+use linux_raw_sys::{
+    general::{O_CLOEXEC, O_NONBLOCK},
+    net::{
+        AF_UNIX, MSG_CMSG_CLOEXEC, MSG_CTRUNC, MSG_DONTWAIT, MSG_NOSIGNAL, MSG_TRUNC, SCM_RIGHTS,
+        SOCK_DGRAM, SOCK_SEQPACKET, SOCK_STREAM, SOL_SOCKET, cmsghdr, msghdr,
+    },
+};
+
+use crate::{
+    file::{
+        FileLike, SCM_MAX_FD, UnixSocket, UnixSocketType, add_file_like, close_file_like,
+        get_file_like,
+    },
+    ptr::{UserConstPtr, UserPtr},
+};
+
+use super::fs::{user_bufs, user_bufs_mut};
+
+/// The bits of the socket type that select the type, the rest being flags.
+const SOCK_TYPE_MASK: u32 = 0xf;
+/// `SOCK_NONBLOCK` and `SOCK_CLOEXEC` are defined as the matching open flags
+/// on all the supported architectures.
+const SOCK_NONBLOCK: u32 = O_NONBLOCK;
+const SOCK_CLOEXEC: u32 = O_CLOEXEC;
+
+const CMSG_HDR_LEN: usize = size_of::<cmsghdr>();
+
+/// Rounds `len` up to the alignment of control messages.
+const fn cmsg_align(len: usize) -> usize {
+    len.next_multiple_of(size_of::<usize>())
+}
+
+pub fn sys_socketpair(
+    domain: u32,
+    ty: u32,
+    protocol: u32,
+    fds: UserPtr<[c_int; 2]>,
+) -> LinuxResult<isize> {
+    debug!(
+        "sys_socketpair <= domain: {}, type: {:#x}, protocol: {}",
+        domain, ty, protocol
+    );
+    if domain != AF_UNIX {
+        return Err(LinuxError::EAFNOSUPPORT);
+    }
+    if protocol != 0 && protocol != AF_UNIX {
+        return Err(LinuxError::EPROTONOSUPPORT);
+    }
+    if ty & !(SOCK_TYPE_MASK | SOCK_NONBLOCK | SOCK_CLOEXEC) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let socket_type = match ty & SOCK_TYPE_MASK {
+        SOCK_STREAM => UnixSocketType::Stream,
+        SOCK_DGRAM => UnixSocketType::Datagram,
+        SOCK_SEQPACKET => UnixSocketType::SeqPacket,
+        _ => return Err(LinuxError::ESOCKTNOSUPPORT),
+    };
+
+    let fds = fds.get_as_mut()?;
+    let (a, b) = UnixSocket::pair(socket_type);
+    if ty & SOCK_NONBLOCK != 0 {
+        a.set_nonblocking(true)?;
+        b.set_nonblocking(true)?;
+    }
+    let cloexec = ty & SOCK_CLOEXEC != 0;
+    let fd_a = a.add_to_fd_table(cloexec)?;
+    let fd_b = b
+        .add_to_fd_table(cloexec)
+        .inspect_err(|_| close_file_like(fd_a).unwrap())?;
+
+    fds[0] = fd_a;
+    fds[1] = fd_b;
+    info!("sys_socketpair <= fds: {:?}", fds);
+    Ok(0)
+}
+
+/// Returns the files passed with `SCM_RIGHTS` in the control messages
+/// `control`.
+fn parse_rights(control: &[u8]) -> LinuxResult<Vec<Arc<dyn FileLike>>> {
+    let mut files = Vec::new();
+    let mut pos = 0;
+    while pos + CMSG_HDR_LEN <= control.len() {
+        let hdr = unsafe { core::ptr::read_unaligned(control[pos..].as_ptr().cast::<cmsghdr>()) };
+        if hdr.cmsg_len < CMSG_HDR_LEN || pos + hdr.cmsg_len > control.len() {
+            return Err(LinuxError::EINVAL);
+        }
+        if hdr.cmsg_level != SOL_SOCKET as c_int || hdr.cmsg_type != SCM_RIGHTS as c_int {
+            return Err(LinuxError::EINVAL);
+        }
+        let data = &control[pos + CMSG_HDR_LEN..pos + hdr.cmsg_len];
+        if files.len() + data.len() / size_of::<c_int>() > SCM_MAX_FD {
+            return Err(LinuxError::EINVAL);
+        }
+        for fd in data.chunks_exact(size_of::<c_int>()) {
+            let fd = c_int::from_ne_bytes(fd.try_into().unwrap());
+            files.push(get_file_like(fd)?);
+        }
+        pos += cmsg_align(hdr.cmsg_len);
+    }
+    Ok(files)
+}
+
+/// Installs the received `files` and writes their descriptors to `control`
+/// as an `SCM_RIGHTS` message, returning the length of the control data.
+///
+/// Files that do not fit in `control` or in the descriptor table are closed,
+/// and `MSG_CTRUNC` is added to `msg_flags`.
+fn put_rights(
+    control: &mut [u8],
+    files: Vec<Arc<dyn FileLike>>,
+    cloexec: bool,
+    msg_flags: &mut u32,
+) -> usize {
+    if files.is_empty() {
+        return 0;
+    }
+    let room = control.len().saturating_sub(CMSG_HDR_LEN) / size_of::<c_int>();
+    if room < files.len() {
+        *msg_flags |= MSG_CTRUNC;
+    }
+    let mut fds = Vec::with_capacity(room.min(files.len()));
+    for file in files.into_iter().take(room) {
+        match add_file_like(file, cloexec) {
+            Ok(fd) => fds.push(fd),
+            Err(_) => {
+                *msg_flags |= MSG_CTRUNC;
+                break;
+            }
+        }
+    }
+    if fds.is_empty() {
+        return 0;
+    }
+    let cmsg_len = CMSG_HDR_LEN + fds.len() * size_of::<c_int>();
+    let hdr = cmsghdr {
+        cmsg_len,
+        cmsg_level: SOL_SOCKET as _,
+        cmsg_type: SCM_RIGHTS as _,
+    };
+    unsafe { core::ptr::write_unaligned(control.as_mut_ptr().cast::<cmsghdr>(), hdr) };
+    for (i, fd) in fds.iter().enumerate() {
+        let pos = CMSG_HDR_LEN + i * size_of::<c_int>();
+        control[pos..pos + size_of::<c_int>()].copy_from_slice(&fd.to_ne_bytes());
+    }
+    cmsg_align(cmsg_len).min(control.len())
+}
+
+pub fn sys_sendmsg(fd: c_int, msg: UserConstPtr<msghdr>, flags: u32) -> LinuxResult<isize> {
+    let msg = msg.get_as_ref()?;
+    debug!("sys_sendmsg <= fd: {}, flags: {:#x}", fd, flags);
+    let socket = UnixSocket::from_fd(fd)?;
+    // Sockets made by `socketpair` are always connected.
+    if !msg.msg_name.is_null() && msg.msg_namelen != 0 {
+        return Err(LinuxError::EISCONN);
+    }
+    if flags & !(MSG_DONTWAIT | MSG_NOSIGNAL) != 0 {
+        return Err(LinuxError::EOPNOTSUPP);
+    }
+
+    let bufs = user_bufs(UserConstPtr::from(msg.msg_iov as usize), msg.msg_iovlen)?;
+    let files = if msg.msg_controllen == 0 {
+        Vec::new()
+    } else {
+        let control =
+            UserConstPtr::<u8>::from(msg.msg_control as usize).get_as_slice(msg.msg_controllen)?;
+        parse_rights(control)?
+    };
+    let nonblocking = socket.nonblocking() || flags & MSG_DONTWAIT != 0;
+    Ok(socket.send(&bufs, files, nonblocking)? as _)
+}
+
+pub fn sys_recvmsg(fd: c_int, msg: UserPtr<msghdr>, flags: u32) -> LinuxResult<isize> {
+    let msg = msg.get_as_mut()?;
+    debug!("sys_recvmsg <= fd: {}, flags: {:#x}", fd, flags);
+    let socket = UnixSocket::from_fd(fd)?;
+    if flags & !(MSG_DONTWAIT | MSG_CMSG_CLOEXEC) != 0 {
+        return Err(LinuxError::EOPNOTSUPP);
+    }
+
+    let mut bufs = user_bufs_mut(UserPtr::from(msg.msg_iov as usize), msg.msg_iovlen)?;
+    let control: &mut [u8] = if msg.msg_controllen == 0 {
+        &mut []
+    } else {
+        UserPtr::<u8>::from(msg.msg_control as usize).get_as_mut_slice(msg.msg_controllen)?
+    };
+    let nonblocking = socket.nonblocking() || flags & MSG_DONTWAIT != 0;
+    let received = socket.recv(&mut bufs, nonblocking)?;
+
+    let mut msg_flags = 0;
+    if received.truncated {
+        msg_flags |= MSG_TRUNC;
+    }
+    let cloexec = flags & MSG_CMSG_CLOEXEC != 0;
+    msg.msg_controllen = put_rights(control, received.files, cloexec, &mut msg_flags);
+    // The peer of a socket pair has no address.
+    msg.msg_namelen = 0;
+    msg.msg_flags = msg_flags;
+    Ok(received.len as _)
+}
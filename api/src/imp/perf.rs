@@ -0,0 +1,92 @@
+use core::ffi::c_int;
+
+use axerrno::{LinuxError, LinuxResult};
+use axhal::pmu::PmuConfig;
+use axtask::current;
+
+use crate::{
+    file::{
+        FileLike, PERF_FORMAT_ID, PERF_FORMAT_TOTAL_TIME_ENABLED, PERF_FORMAT_TOTAL_TIME_RUNNING,
+        PERF_TYPE_HARDWARE, PerfEvent, hardware_event,
+    },
+    ptr::UserConstPtr,
+};
+
+const PERF_FLAG_FD_CLOEXEC: u32 = 1 << 3;
+
+const PERF_ATTR_DISABLED: u64 = 1 << 0;
+const PERF_ATTR_EXCLUDE_USER: u64 = 1 << 4;
+const PERF_ATTR_EXCLUDE_KERNEL: u64 = 1 << 5;
+const PERF_ATTR_FREQ: u64 = 1 << 10;
+const PERF_ATTR_ENABLE_ON_EXEC: u64 = 1 << 12;
+
+/// The fields of `struct perf_event_attr` up to its flags, which are all that
+/// counting needs.
+#[allow(non_camel_case_types)]
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct perf_event_attr {
+    type_: u32,
+    size: u32,
+    config: u64,
+    sample_period: u64,
+    sample_type: u64,
+    read_format: u64,
+    flags: u64,
+}
+
+/// Opens a hardware performance counter of the calling thread.
+///
+/// Only counting `PERF_TYPE_HARDWARE` events on the calling thread on any
+/// CPU is supported, without sampling, groups or inheritance by children.
+pub fn sys_perf_event_open(
+    attr: UserConstPtr<perf_event_attr>,
+    pid: c_int,
+    cpu: c_int,
+    group_fd: c_int,
+    flags: u32,
+) -> LinuxResult<isize> {
+    let attr = attr.read()?;
+    debug!(
+        "sys_perf_event_open <= type: {}, config: {}, pid: {}, cpu: {}, group_fd: {}, flags: {:#x}",
+        attr.type_, attr.config, pid, cpu, group_fd, flags
+    );
+    if flags & !PERF_FLAG_FD_CLOEXEC != 0 || group_fd != -1 {
+        return Err(LinuxError::EINVAL);
+    }
+    let curr = current();
+    if pid != 0 && pid as u64 != curr.id().as_u64() {
+        return Err(LinuxError::EOPNOTSUPP);
+    }
+    if cpu != -1 {
+        return Err(LinuxError::EOPNOTSUPP);
+    }
+    if attr.type_ != PERF_TYPE_HARDWARE {
+        return Err(LinuxError::ENOENT);
+    }
+    let event = hardware_event(attr.config).ok_or(LinuxError::ENOENT)?;
+    if attr.sample_period != 0 || attr.flags & PERF_ATTR_FREQ != 0 {
+        return Err(LinuxError::EOPNOTSUPP);
+    }
+    if attr.flags & PERF_ATTR_ENABLE_ON_EXEC != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let read_format_mask =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_ID;
+    if attr.read_format & !read_format_mask != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let config = PmuConfig {
+        event,
+        exclude_user: attr.flags & PERF_ATTR_EXCLUDE_USER != 0,
+        exclude_kernel: attr.flags & PERF_ATTR_EXCLUDE_KERNEL != 0,
+    };
+    let perf = PerfEvent::new(
+        curr.as_task_ref().clone(),
+        config,
+        attr.read_format,
+        attr.flags & PERF_ATTR_DISABLED == 0,
+    )?;
+    Ok(perf.add_to_fd_table(flags & PERF_FLAG_FD_CLOEXEC != 0)? as _)
+}
@@ -1,4 +1,4 @@
-use core::{mem, time::Duration};
+use core::time::Duration;
 
 use alloc::sync::Arc;
 use axerrno::{LinuxError, LinuxResult};
@@ -37,25 +37,25 @@ pub fn sys_rt_sigprocmask(
 ) -> LinuxResult<isize> {
     check_sigset_size(sigsetsize)?;
 
-    current()
-        .task_ext()
-        .thread_data()
-        .signal
-        .with_blocked_mut::<LinuxResult<_>>(|blocked| {
-            if let Some(oldset) = nullable!(oldset.get_as_mut())? {
-                *oldset = *blocked;
-            }
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    // The mask belongs to the thread, and changing it does not take the lock
+    // of its signal manager.
+    let mut blocked = thr_data.blocked();
+    if let Some(oldset) = nullable!(oldset.get_as_mut())? {
+        *oldset = blocked;
+    }
 
-            if let Some(set) = nullable!(set.get_as_ref())? {
-                match how as u32 {
-                    SIG_BLOCK => *blocked |= *set,
-                    SIG_UNBLOCK => *blocked &= !*set,
-                    SIG_SETMASK => *blocked = *set,
-                    _ => return Err(LinuxError::EINVAL),
-                }
-            }
-            Ok(())
-        })?;
+    if let Some(set) = nullable!(set.get_as_ref())? {
+        match how as u32 {
+            SIG_BLOCK => blocked |= *set,
+            SIG_UNBLOCK => blocked &= !*set,
+            SIG_SETMASK => blocked = *set,
+            _ => return Err(LinuxError::EINVAL),
+        }
+        // Unblocking signals makes the thread look for them on its way out.
+        thr_data.set_blocked(blocked);
+    }
 
     Ok(0)
 }
@@ -208,7 +208,11 @@ pub fn sys_rt_tgsigqueueinfo(
 
 pub fn sys_rt_sigreturn(tf: &mut TrapFrame) -> LinuxResult<isize> {
     let curr = current();
-    curr.task_ext().thread_data().signal.restore(tf);
+    let thr_data = curr.task_ext().thread_data();
+    thr_data.signal.restore(tf);
+    thr_data.reload_blocked();
+    // The mask of before the handler is back.
+    thr_data.mark_signal_pending();
     Ok(tf.retval() as isize)
 }
 
@@ -223,12 +227,10 @@ pub fn sys_rt_sigtimedwait(
     let set = *set.get_as_ref()?;
     let timeout: Option<Duration> = nullable!(timeout.get_as_ref())?.map(|ts| ts.to_time_value());
 
-    let Some(sig) = current()
-        .task_ext()
-        .thread_data()
-        .signal
-        .wait_timeout(set, timeout)
-    else {
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    thr_data.sync_blocked();
+    let Some(sig) = thr_data.signal.wait_timeout(set, timeout) else {
         return Err(LinuxError::EAGAIN);
     };
 
@@ -253,9 +255,7 @@ pub fn sys_rt_sigsuspend(
     set.remove(Signo::SIGKILL);
     set.remove(Signo::SIGSTOP);
 
-    let old_blocked = thr_data
-        .signal
-        .with_blocked_mut(|blocked| mem::replace(blocked, set));
+    let old_blocked = thr_data.set_blocked(set);
 
     tf.set_retval(-LinuxError::EINTR.code() as usize);
 
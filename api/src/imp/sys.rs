@@ -1,9 +1,23 @@
 use core::ffi::c_char;
 
-use axerrno::LinuxResult;
-use linux_raw_sys::system::new_utsname;
+use axerrno::{LinuxError, LinuxResult};
+use axtask::{TaskExtRef, current};
+use linux_raw_sys::{
+    general::{
+        __kernel_old_timeval, RUSAGE_CHILDREN, RUSAGE_SELF, RUSAGE_THREAD, rlimit64, rusage,
+    },
+    system::new_utsname,
+};
+use memory_addr::PAGE_SIZE_4K;
+use starry_core::{
+    resource::Rlimit,
+    task::{ProcessData, get_process, process_cpu_time},
+};
 
-use crate::ptr::UserPtr;
+use crate::{
+    ptr::{UserConstPtr, UserPtr, nullable},
+    time::TimeValueLike,
+};
 
 pub fn sys_getuid() -> LinuxResult<isize> {
     Ok(0)
@@ -44,3 +58,69 @@ pub fn sys_uname(name: UserPtr<new_utsname>) -> LinuxResult<isize> {
     *name.get_as_mut()? = UTSNAME;
     Ok(0)
 }
+
+/// Gets and sets the resource limits of the process `pid`, or of the
+/// current one if it is 0.
+pub fn sys_prlimit64(
+    pid: i32,
+    resource: u32,
+    new_limit: UserConstPtr<rlimit64>,
+    old_limit: UserPtr<rlimit64>,
+) -> LinuxResult<isize> {
+    debug!("sys_prlimit64 <= pid: {}, resource: {}", pid, resource);
+    let process = if pid == 0 {
+        current().task_ext().thread.process().clone()
+    } else {
+        get_process(pid as _)?
+    };
+    let data = process.data::<ProcessData>().ok_or(LinuxError::ESRCH)?;
+    let new_limit = nullable!(new_limit.get_as_ref())?.map(|limit| Rlimit {
+        cur: limit.rlim_cur,
+        max: limit.rlim_max,
+    });
+
+    let mut rlimits = data.rlimits.write();
+    let old = rlimits.get(resource)?;
+    if let Some(limit) = new_limit {
+        rlimits.set(resource, limit)?;
+    }
+    if let Some(old_limit) = nullable!(old_limit.get_as_mut())? {
+        old_limit.rlim_cur = old.cur;
+        old_limit.rlim_max = old.max;
+    }
+    Ok(0)
+}
+
+pub fn sys_getrlimit(resource: u32, limit: UserPtr<rlimit64>) -> LinuxResult<isize> {
+    sys_prlimit64(0, resource, 0.into(), limit)
+}
+
+pub fn sys_setrlimit(resource: u32, limit: UserConstPtr<rlimit64>) -> LinuxResult<isize> {
+    sys_prlimit64(0, resource, limit, 0.into())
+}
+
+/// Gets the resource usage of the current process, thread, or of the
+/// children that have exited.
+///
+/// Only the CPU times and the peak resident set size are reported. The peak
+/// resident set size of a thread is that of its process.
+pub fn sys_getrusage(who: i32, usage: UserPtr<rusage>) -> LinuxResult<isize> {
+    let curr = current();
+    let proc_data = curr.task_ext().process_data();
+    let ((utime, stime), max_rss) = if who == RUSAGE_SELF as i32 {
+        let time = process_cpu_time(curr.task_ext().thread.process());
+        (time, proc_data.max_rss())
+    } else if who == RUSAGE_THREAD as i32 {
+        (curr.cpu_time(), proc_data.max_rss())
+    } else if who == RUSAGE_CHILDREN {
+        (proc_data.children_cpu_time(), proc_data.children_max_rss())
+    } else {
+        return Err(LinuxError::EINVAL);
+    };
+    let mut ru: rusage = unsafe { core::mem::zeroed() };
+    ru.ru_utime = __kernel_old_timeval::from_time_value(utime);
+    ru.ru_stime = __kernel_old_timeval::from_time_value(stime);
+    ru.ru_maxrss = (max_rss * PAGE_SIZE_4K / 1024) as _;
+    *usage.get_as_mut()? = ru;
+    Ok(0)
+}
@@ -4,12 +4,11 @@ use axfs::{CURRENT_DIR, CURRENT_DIR_PATH};
 use axhal::arch::{TrapFrame, UspaceContext};
 use axprocess::Pid;
 use axsignal::Signo;
-use axsync::Mutex;
 use axtask::{TaskExtRef, current};
 use bitflags::bitflags;
 use linux_raw_sys::general::*;
 use starry_core::{
-    mm::copy_from_kernel,
+    mm::{copy_from_kernel, share_aspace},
     task::{ProcessData, TaskExt, ThreadData, add_thread_to_table, new_user_task},
 };
 
@@ -121,6 +120,8 @@ pub fn sys_clone(
 
     let curr = current();
     let mut new_task = new_user_task(curr.name(), new_uctx, set_child_tid);
+    new_task.set_cpumask(curr.cpumask());
+    new_task.set_sched_policy(curr.sched_policy());
 
     let tid = new_task.id().as_u64() as Pid;
     if flags.contains(CloneFlags::PARENT_SETTID) {
@@ -131,8 +132,8 @@ pub fn sys_clone(
         new_task.ctx_mut().set_page_table_root(
             curr.task_ext()
                 .process_data()
-                .aspace
-                .lock()
+                .aspace()
+                .read()
                 .page_table_root(),
         );
 
@@ -150,16 +151,16 @@ pub fn sys_clone(
         let builder = parent.fork(tid);
 
         let aspace = if flags.contains(CloneFlags::VM) {
-            curr.task_ext().process_data().aspace.clone()
+            curr.task_ext().process_data().aspace()
         } else {
-            let mut aspace = curr.task_ext().process_data().aspace.lock();
-            let mut aspace = aspace.clone_or_err()?;
+            let aspace = curr.task_ext().process_data().aspace();
+            let mut aspace = aspace.write().clone_or_err()?;
             copy_from_kernel(&mut aspace)?;
-            Arc::new(Mutex::new(aspace))
+            share_aspace(aspace)
         };
         new_task
             .ctx_mut()
-            .set_page_table_root(aspace.lock().page_table_root());
+            .set_page_table_root(aspace.read().page_table_root());
 
         let signal_actions = if flags.contains(CloneFlags::SIGHAND) {
             parent
@@ -174,6 +175,9 @@ pub fn sys_clone(
             signal_actions,
             exit_signal,
         );
+        // The heap is mapped in the copied address space up to the break.
+        process_data.set_heap_top(curr.task_ext().process_data().get_heap_top());
+        *process_data.rlimits.write() = curr.task_ext().process_data().rlimits.read().clone();
 
         if flags.contains(CloneFlags::FILES) {
             FD_TABLE
@@ -204,14 +208,30 @@ pub fn sys_clone(
     };
 
     let thread_data = ThreadData::new(process.data().unwrap());
+    let curr_data = curr.task_ext().thread_data();
+    thread_data.set_priority(curr_data.priority());
+    thread_data.set_sched_policy(curr_data.sched_policy());
     if flags.contains(CloneFlags::CHILD_CLEARTID) {
         thread_data.set_clear_child_tid(child_tid);
     }
+    // A child with its own copy of the memory keeps the `rseq` area there.
+    if !flags.contains(CloneFlags::VM) {
+        thread_data.set_rseq(curr_data.rseq());
+    }
 
     let thread = process.new_thread(tid).data(thread_data).build();
     add_thread_to_table(&thread);
     new_task.init_task_ext(TaskExt::new(thread));
-    axtask::spawn_task(new_task);
+    let new_task = axtask::spawn_task(new_task);
+    new_task.task_ext().thread_data().set_task(&new_task);
+
+    if flags.contains(CloneFlags::VFORK) && !flags.contains(CloneFlags::THREAD) {
+        // The child may be running on our stack, so we must not return to
+        // user space until it calls `execve` or exits.
+        if let Some(data) = process.data::<ProcessData>() {
+            data.wait_vfork();
+        }
+    }
 
     Ok(tid as _)
 }
@@ -219,3 +239,7 @@ pub fn sys_clone(
 pub fn sys_fork(tf: &TrapFrame) -> LinuxResult<isize> {
     sys_clone(tf, SIGCHLD, 0, 0, 0, 0)
 }
+
+pub fn sys_vfork(tf: &TrapFrame) -> LinuxResult<isize> {
+    sys_clone(tf, CLONE_VM | CLONE_VFORK | SIGCHLD, 0, 0, 0, 0)
+}
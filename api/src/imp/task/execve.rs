@@ -1,12 +1,40 @@
 use core::ffi::c_char;
 
-use alloc::{string::ToString, vec::Vec};
+use alloc::{string::ToString, sync::Arc};
 use axerrno::{LinuxError, LinuxResult};
 use axhal::arch::UspaceContext;
+use axsignal::{SignalInfo, Signo};
 use axtask::{TaskExtRef, current};
-use starry_core::mm::{load_user_app, map_trampoline};
+use linux_raw_sys::general::SI_KERNEL;
+use starry_core::mm::{
+    ExecArgs, copy_from_kernel, load_user_app, map_trampoline, new_user_aspace_empty, share_aspace,
+    switch_user_aspace,
+};
 
-use crate::ptr::UserConstPtr;
+use crate::{file::FD_TABLE, ptr::UserConstPtr, signal::send_signal_thread};
+
+/// Kills the other threads of the current process and waits for them to
+/// exit, as Linux does on `execve`. Unlike Linux, the current thread keeps
+/// its ID instead of taking the one of the leader.
+fn kill_other_threads() -> LinuxResult {
+    let curr = current();
+    let thread = &curr.task_ext().thread;
+    let process = thread.process();
+    let proc_data = curr.task_ext().process_data();
+    // Another thread is calling `execve`, and is about to kill this one.
+    if !proc_data.begin_exec(thread.tid()) {
+        return Err(LinuxError::EAGAIN);
+    }
+    let sig = SignalInfo::new(Signo::SIGKILL, SI_KERNEL as _);
+    for thr in process.threads() {
+        if thr.tid() != thread.tid() {
+            let _ = send_signal_thread(&thr, sig.clone());
+        }
+    }
+    proc_data.wait_single_thread(process);
+    proc_data.end_exec();
+    Ok(())
+}
 
 pub fn sys_execve(
     path: UserConstPtr<c_char>,
@@ -15,50 +43,64 @@ pub fn sys_execve(
 ) -> LinuxResult<isize> {
     let path = path.get_as_str()?.to_string();
 
-    let args = argv
-        .get_as_null_terminated()?
-        .iter()
-        .map(|arg| arg.get_as_str().map(Into::into))
-        .collect::<Result<Vec<_>, _>>()?;
-    let envs = envp
-        .get_as_null_terminated()?
-        .iter()
-        .map(|env| env.get_as_str().map(Into::into))
-        .collect::<Result<Vec<_>, _>>()?;
+    // The strings are copied from user memory once, into the buffer that is
+    // written to the new stack.
+    let mut args = ExecArgs::new();
+    for arg in argv.get_as_null_terminated()?.iter() {
+        args.push_arg(arg.get_as_str()?);
+    }
+    for env in envp.get_as_null_terminated()?.iter() {
+        args.push_env(env.get_as_str()?);
+    }
 
-    info!(
-        "sys_execve: path: {:?}, args: {:?}, envs: {:?}",
-        path, args, envs
-    );
+    info!("sys_execve: path: {:?}, {:?}", path, args);
 
     let curr = current();
     let curr_ext = curr.task_ext();
 
     if curr_ext.thread.process().threads().len() > 1 {
-        // TODO: handle multi-thread case
-        error!("sys_execve: multi-thread not supported");
-        return Err(LinuxError::EAGAIN);
+        kill_other_threads()?;
     }
 
-    let mut aspace = curr_ext.process_data().aspace.lock();
+    let proc_data = curr_ext.process_data();
+    // The peak resident set size is kept across `execve`.
+    proc_data.max_rss();
+    let mut aspace = proc_data.aspace();
+    // If the address space is still shared with another process (e.g. the
+    // parent of `vfork`), leave it to that process and start from a new one.
+    if Arc::strong_count(&aspace) > 2 {
+        let mut new_aspace = new_user_aspace_empty()?;
+        copy_from_kernel(&mut new_aspace)?;
+        switch_user_aspace(&new_aspace);
+        aspace = share_aspace(new_aspace);
+        proc_data.replace_aspace(aspace.clone());
+    }
+    let mut aspace = aspace.write();
     aspace.unmap_user_areas()?;
     map_trampoline(&mut aspace)?;
-    axhal::arch::flush_tlb(None);
 
-    let (entry_point, user_stack_base) =
-        load_user_app(&mut aspace, &args, &envs).map_err(|_| {
-            error!("Failed to load app {}", path);
-            LinuxError::ENOENT
-        })?;
+    let (entry_point, user_stack_base) = load_user_app(&mut aspace, &mut args).map_err(|_| {
+        error!("Failed to load app {}", path);
+        LinuxError::ENOENT
+    })?;
     drop(aspace);
+    proc_data.set_heap_top(proc_data.get_heap_bottom());
+    proc_data.release_vfork();
 
     let name = path
         .rsplit_once('/')
         .map_or(path.as_str(), |(_, name)| name);
     curr.set_name(name);
+    #[cfg(feature = "profile")]
+    starry_core::profile::set_exe(curr_ext.thread.process().pid(), &path);
     *curr_ext.process_data().exe_path.write() = path;
 
-    // TODO: fd close-on-exec
+    FD_TABLE.close_on_exec();
+    // POSIX timers are not preserved, while the ones of `setitimer` are.
+    proc_data.timers.delete_all();
+    // The `rseq` area was in the old address space.
+    curr_ext.thread_data().set_rseq(None);
+    proc_data.clear_membarrier();
 
     let uctx = UspaceContext::new(entry_point.as_usize(), user_stack_base, 0);
     unsafe { uctx.enter_uspace(curr.kernel_stack_top().expect("No kernel stack top")) }
@@ -2,10 +2,14 @@ use axprocess::Pid;
 use axsignal::{SignalInfo, Signo};
 use axtask::{TaskExtRef, current};
 use linux_raw_sys::general::SI_KERNEL;
-use starry_core::task::ProcessData;
+use starry_core::{
+    futex::FUTEX_BITSET_MATCH_ANY,
+    task::{ChildEventKind, ProcessData, process_cpu_time},
+};
 
 use crate::{
     file::FD_TABLE,
+    imp::{exit_robust_list, futex_table_and_key, futex_word},
     ptr::UserPtr,
     signal::{send_signal_process, send_signal_thread},
 };
@@ -17,37 +21,66 @@ pub fn do_exit(exit_code: i32, group_exit: bool) -> ! {
     let thread = &curr_ext.thread;
     info!("{:?} exit with code: {}", thread, exit_code);
 
+    exit_robust_list();
+
     let clear_child_tid = UserPtr::<Pid>::from(curr_ext.thread_data().clear_child_tid());
     if let Ok(clear_tid) = clear_child_tid.get_as_mut() {
         *clear_tid = 0;
 
-        let guard = curr_ext
-            .process_data()
-            .futex_table
-            .get(clear_tid as *const _ as usize);
-        if let Some(futex) = guard {
-            futex.notify_one(false);
+        // Waiters may use either a private or a shared futex, both of which
+        // Linux wakes here since they have the same key in private memory.
+        let proc_data = curr_ext.process_data();
+        if let Ok(word) = futex_word(proc_data, clear_tid as *const _ as usize, true) {
+            for private in [true, false] {
+                if let Ok((table, key)) = futex_table_and_key(proc_data, &word, private) {
+                    table.wake(key, 1, FUTEX_BITSET_MATCH_ANY);
+                }
+            }
         }
         axtask::yield_now();
     }
 
     let process = thread.process();
-    if thread.exit(exit_code) {
+    let last_thread = thread.exit(exit_code);
+    // The thread is no longer among those of the process, so its CPU time is
+    // kept by the process.
+    curr_ext
+        .process_data()
+        .add_exited_thread_cpu_time(curr.cpu_time());
+    if last_thread {
+        curr_ext.process_data().release_vfork();
+        #[cfg(feature = "syscall-stats")]
+        axlog::ax_println!(
+            "[syscall-stats] pid={} exe={}{}",
+            process.pid(),
+            curr_ext.process_data().exe_path.read(),
+            curr_ext.process_data().syscall_stats.report()
+        );
+        let proc_data = curr_ext.process_data();
+        let max_rss = proc_data.max_rss().max(proc_data.children_max_rss());
+        let (utime, stime) = process_cpu_time(process);
+        let (children_utime, children_stime) = proc_data.children_cpu_time();
+        // TODO: clear namespace resources
+        // FIXME: axns should drop all the resources
+        // Files such as io_uring instances keep the address space, which is
+        // only torn down here once they are closed.
+        FD_TABLE.clear();
+        proc_data.detach_aspace();
         process.exit();
         if let Some(parent) = process.parent() {
             if let Some(signo) = process.data::<ProcessData>().and_then(|it| it.exit_signal) {
                 let _ = send_signal_process(&parent, SignalInfo::new(signo, SI_KERNEL as _));
             }
             if let Some(data) = parent.data::<ProcessData>() {
-                data.child_exit_wq.notify_all(false)
+                data.add_child_max_rss(max_rss);
+                data.add_child_cpu_time((utime + children_utime, stime + children_stime));
+                data.push_child_event(process, ChildEventKind::Exited);
             }
         }
 
         process.exit();
-        // TODO: clear namespace resources
-        // FIXME: axns should drop all the resources
-        FD_TABLE.clear();
     }
+    curr_ext.process_data().notify_exit();
     if group_exit && !process.is_group_exited() {
         process.group_exit();
         let sig = SignalInfo::new(Signo::SIGKILL, SI_KERNEL as _);
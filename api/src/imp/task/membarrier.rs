@@ -0,0 +1,122 @@
+//! The `membarrier` system call, which lets threads drop the memory barriers
+//! from their fast paths: a slow path makes the other threads execute one
+//! when it needs to, with IPIs to the CPUs running them.
+
+use alloc::{sync::Arc, vec::Vec};
+
+use axerrno::{LinuxError, LinuxResult};
+use axprocess::Thread;
+use axtask::{AxCpuMask, TaskExtRef, current};
+use linux_raw_sys::general::{membarrier_cmd, membarrier_cmd_flag};
+use starry_core::task::{ProcessData, ThreadData, processes};
+
+const QUERY: u32 = membarrier_cmd::MEMBARRIER_CMD_QUERY as u32;
+const GLOBAL: u32 = membarrier_cmd::MEMBARRIER_CMD_GLOBAL as u32;
+const GLOBAL_EXPEDITED: u32 = membarrier_cmd::MEMBARRIER_CMD_GLOBAL_EXPEDITED as u32;
+const REGISTER_GLOBAL_EXPEDITED: u32 =
+    membarrier_cmd::MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED as u32;
+const PRIVATE_EXPEDITED: u32 = membarrier_cmd::MEMBARRIER_CMD_PRIVATE_EXPEDITED as u32;
+const REGISTER_PRIVATE_EXPEDITED: u32 =
+    membarrier_cmd::MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED as u32;
+const PRIVATE_EXPEDITED_RSEQ: u32 = membarrier_cmd::MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ as u32;
+const REGISTER_PRIVATE_EXPEDITED_RSEQ: u32 =
+    membarrier_cmd::MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ as u32;
+const GET_REGISTRATIONS: u32 = membarrier_cmd::MEMBARRIER_CMD_GET_REGISTRATIONS as u32;
+const FLAG_CPU: u32 = membarrier_cmd_flag::MEMBARRIER_CMD_FLAG_CPU as u32;
+
+/// The commands returned by `MEMBARRIER_CMD_QUERY`.
+const SUPPORTED: u32 = GLOBAL
+    | GLOBAL_EXPEDITED
+    | REGISTER_GLOBAL_EXPEDITED
+    | PRIVATE_EXPEDITED
+    | REGISTER_PRIVATE_EXPEDITED
+    | PRIVATE_EXPEDITED_RSEQ
+    | REGISTER_PRIVATE_EXPEDITED_RSEQ
+    | GET_REGISTRATIONS;
+
+/// Returns the threads running right now of the processes whose data passes
+/// `filter`, with their CPUs.
+fn running_threads(filter: impl Fn(&ProcessData) -> bool) -> Vec<(usize, Arc<Thread>)> {
+    let mut running = Vec::new();
+    for process in processes() {
+        if !process.data::<ProcessData>().is_some_and(&filter) {
+            continue;
+        }
+        for thread in process.threads() {
+            // Threads are run by the tasks with their IDs.
+            if let Some(cpu) = axtask::task_running_cpu(thread.tid() as u64) {
+                running.push((cpu, thread));
+            }
+        }
+    }
+    running
+}
+
+/// Makes the threads of other processes, or of the current one, execute a
+/// memory barrier, depending on `cmd`.
+///
+/// The private commands only interrupt the CPUs running threads that share
+/// the address space of the caller, the others are switched in later with a
+/// barrier anyway.
+pub fn sys_membarrier(cmd: u32, flags: u32, cpu_id: i32) -> LinuxResult<isize> {
+    debug!(
+        "sys_membarrier <= cmd: {:#x}, flags: {:#x}, cpu_id: {}",
+        cmd, flags, cpu_id
+    );
+    if flags != 0 && (cmd != PRIVATE_EXPEDITED_RSEQ || flags != FLAG_CPU || cpu_id < 0) {
+        return Err(LinuxError::EINVAL);
+    }
+    let curr = current();
+    let proc_data = curr.task_ext().process_data();
+    let registrations = proc_data.membarrier_registrations();
+    match cmd {
+        QUERY => return Ok(SUPPORTED as _),
+        GET_REGISTRATIONS => return Ok(registrations as _),
+        REGISTER_GLOBAL_EXPEDITED
+        | REGISTER_PRIVATE_EXPEDITED
+        | REGISTER_PRIVATE_EXPEDITED_RSEQ => {
+            proc_data.register_membarrier(cmd);
+        }
+        GLOBAL => axtask::membarrier(&AxCpuMask::full()),
+        GLOBAL_EXPEDITED => {
+            let mut cpus = AxCpuMask::new();
+            let running = running_threads(|data| {
+                data.membarrier_registrations() & REGISTER_GLOBAL_EXPEDITED != 0
+            });
+            for (cpu, _) in running {
+                cpus.set(cpu, true);
+            }
+            axtask::membarrier(&cpus);
+        }
+        PRIVATE_EXPEDITED | PRIVATE_EXPEDITED_RSEQ => {
+            let rseq = cmd == PRIVATE_EXPEDITED_RSEQ;
+            let register = if rseq {
+                REGISTER_PRIVATE_EXPEDITED_RSEQ
+            } else {
+                REGISTER_PRIVATE_EXPEDITED
+            };
+            if registrations & register == 0 {
+                return Err(LinuxError::EPERM);
+            }
+            let only_cpu = (flags & FLAG_CPU != 0).then_some(cpu_id as usize);
+            let aspace = proc_data.aspace();
+            let mut cpus = AxCpuMask::new();
+            for (cpu, thread) in running_threads(|data| Arc::ptr_eq(&data.aspace(), &aspace)) {
+                if only_cpu.is_some_and(|only| only != cpu) {
+                    continue;
+                }
+                // The IPI aborts the restartable sequence the thread is in on
+                // its way back to user space.
+                if rseq {
+                    if let Some(task) = thread.data::<ThreadData>().and_then(ThreadData::task) {
+                        task.set_switched_out();
+                    }
+                }
+                cpus.set(cpu, true);
+            }
+            axtask::membarrier(&cpus);
+        }
+        _ => return Err(LinuxError::EINVAL),
+    }
+    Ok(0)
+}
@@ -1,6 +1,8 @@
 mod clone;
 mod execve;
 mod exit;
+mod membarrier;
+mod rseq;
 mod schedule;
 mod thread;
 mod wait;
@@ -8,6 +10,8 @@ mod wait;
 pub use self::clone::*;
 pub use self::execve::*;
 pub use self::exit::*;
+pub use self::membarrier::*;
+pub use self::rseq::*;
 pub use self::schedule::*;
 pub use self::thread::*;
 pub use self::wait::*;
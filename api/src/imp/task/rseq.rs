@@ -0,0 +1,171 @@
+//! Restartable sequences, which let threads run per-CPU critical sections
+//! without atomics.
+//!
+//! A thread registers a `struct rseq`, in which the kernel keeps the CPU the
+//! thread runs on. Before a critical section, the thread points the area to
+//! a `struct rseq_cs` describing it; if the thread is switched out or gets a
+//! signal while in the section, it resumes at the abort handler of the
+//! section instead.
+
+use core::mem::offset_of;
+
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{arch::TrapFrame, cpu::this_cpu_id};
+use axsignal::{SignalInfo, Signo};
+use axtask::{TaskExtRef, current};
+use linux_raw_sys::general::SI_KERNEL;
+use memory_addr::VirtAddr;
+use starry_core::task::RseqArea;
+
+use crate::ptr::{UserConstPtr, UserPtr, copy_from_user};
+
+/// The flag of `rseq` to unregister the area.
+const RSEQ_FLAG_UNREGISTER: i32 = 1;
+
+/// The CPU of an area that is not registered.
+const RSEQ_CPU_ID_UNINITIALIZED: u32 = u32::MAX;
+
+/// The `struct rseq` shared with user space, of which only the layout is
+/// used.
+#[allow(dead_code)]
+#[repr(C, align(32))]
+struct Rseq {
+    cpu_id_start: u32,
+    cpu_id: u32,
+    rseq_cs: u64,
+    flags: u32,
+    node_id: u32,
+    mm_cid: u32,
+}
+
+/// The `struct rseq_cs` describing a critical section.
+#[allow(dead_code)]
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct RseqCs {
+    version: u32,
+    flags: u32,
+    start_ip: u64,
+    post_commit_offset: u64,
+    abort_ip: u64,
+}
+
+/// Writes the CPU the thread runs on to its area at `addr`.
+fn update_cpu_id(addr: usize) -> LinuxResult {
+    let cpu = this_cpu_id() as u32;
+    UserPtr::<[u32; 2]>::from(addr + offset_of!(Rseq, cpu_id_start)).write([cpu, cpu])?;
+    // There is one node, and the CPUs serve as concurrency IDs.
+    UserPtr::<[u32; 2]>::from(addr + offset_of!(Rseq, node_id)).write([0, cpu])
+}
+
+/// Moves the thread to the abort handler of its critical section if `tf` is
+/// in one, and updates its CPU.
+fn fixup(tf: &mut TrapFrame, area: &RseqArea) -> LinuxResult {
+    let cs_ptr = area.addr + offset_of!(Rseq, rseq_cs);
+    let cs_addr = UserConstPtr::<u64>::from(cs_ptr).read()?;
+    if cs_addr != 0 {
+        let cs = UserConstPtr::<RseqCs>::from(cs_addr as usize).read()?;
+        if cs.version != 0 || cs.start_ip.checked_add(cs.post_commit_offset).is_none() {
+            return Err(LinuxError::EINVAL);
+        }
+        let in_cs = |ip: u64| ip.wrapping_sub(cs.start_ip) < cs.post_commit_offset;
+        if in_cs(tf.ip() as u64) {
+            if in_cs(cs.abort_ip) || cs.abort_ip < 4 {
+                return Err(LinuxError::EINVAL);
+            }
+            // The abort handler must be preceded by the signature.
+            let mut sig = [0; 4];
+            copy_from_user(&mut sig, VirtAddr::from(cs.abort_ip as usize - 4))?;
+            if u32::from_ne_bytes(sig) != area.sig {
+                return Err(LinuxError::EPERM);
+            }
+            tf.set_ip(cs.abort_ip as usize);
+        }
+        // The thread is out of the critical section either way.
+        UserPtr::<u64>::from(cs_ptr).write(0)?;
+    }
+    update_cpu_id(area.addr)
+}
+
+/// Brings the `rseq` area of the current thread up to date on its way back
+/// to user space, aborting its critical section if it was switched out or
+/// is about to handle a signal (`signal`).
+///
+/// Returns whether the area was broken, for which the thread is sent
+/// `SIGSEGV`.
+pub fn rseq_on_return(tf: &mut TrapFrame, signal: bool) -> bool {
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    let Some(area) = thr_data.rseq() else {
+        return false;
+    };
+    if !curr.take_switched_out() && !signal {
+        return false;
+    }
+    if let Err(err) = fixup(tf, &area) {
+        warn!("rseq area {:#x} is broken: {:?}", area.addr, err);
+        thr_data.send_signal(SignalInfo::new(Signo::SIGSEGV, SI_KERNEL as _));
+        return true;
+    }
+    false
+}
+
+/// Registers (or with `RSEQ_FLAG_UNREGISTER`, unregisters) the `struct rseq`
+/// of the current thread, whose abort handlers are preceded by `sig`.
+pub fn sys_rseq(rseq: usize, rseq_len: u32, flags: i32, sig: u32) -> LinuxResult<isize> {
+    debug!(
+        "sys_rseq <= rseq: {:#x}, len: {}, flags: {:#x}, sig: {:#x}",
+        rseq, rseq_len, flags, sig
+    );
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    let registered = thr_data.rseq();
+    if let Some(area) = registered {
+        if area.addr != rseq || area.len != rseq_len {
+            return Err(LinuxError::EINVAL);
+        }
+        if area.sig != sig {
+            return Err(LinuxError::EPERM);
+        }
+    }
+
+    if flags & RSEQ_FLAG_UNREGISTER != 0 {
+        if flags != RSEQ_FLAG_UNREGISTER || registered.is_none() {
+            return Err(LinuxError::EINVAL);
+        }
+        UserPtr::<u32>::from(rseq + offset_of!(Rseq, cpu_id)).write(RSEQ_CPU_ID_UNINITIALIZED)?;
+        thr_data.set_rseq(None);
+        return Ok(0);
+    }
+    if flags != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    if registered.is_some() {
+        return Err(LinuxError::EBUSY);
+    }
+    if (rseq_len as usize) < size_of::<Rseq>() || rseq % align_of::<Rseq>() != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    UserPtr::<u8>::from(rseq).get_as_mut_slice(rseq_len as usize)?;
+    update_cpu_id(rseq)?;
+    thr_data.set_rseq(Some(RseqArea {
+        addr: rseq,
+        len: rseq_len,
+        sig,
+    }));
+    Ok(0)
+}
+
+/// Gets the CPU and the NUMA node the current thread runs on.
+///
+/// Threads that registered an `rseq` area can read the CPU from it instead,
+/// without a system call, as glibc's `sched_getcpu` does.
+pub fn sys_getcpu(cpu: UserPtr<u32>, node: UserPtr<u32>) -> LinuxResult<isize> {
+    if !cpu.is_null() {
+        cpu.write(this_cpu_id() as u32)?;
+    }
+    if !node.is_null() {
+        node.write(0)?;
+    }
+    Ok(0)
+}
@@ -1,45 +1,395 @@
+use alloc::{sync::Arc, vec, vec::Vec};
+
 use axerrno::{LinuxError, LinuxResult};
-use linux_raw_sys::general::timespec;
+use axhal::time::{TimeValue, monotonic_time, wall_time};
+use axprocess::{Pid, Thread};
+use axtask::{AxCpuMask, MAX_RT_PRIO, SchedPolicy, TaskExtRef, current};
+use linux_raw_sys::general::{
+    __kernel_clockid_t, CLOCK_BOOTTIME, CLOCK_MONOTONIC, CLOCK_REALTIME, PRIO_PGRP, PRIO_PROCESS,
+    PRIO_USER, SCHED_BATCH, SCHED_FIFO, SCHED_FLAG_KEEP_PARAMS, SCHED_FLAG_KEEP_POLICY,
+    SCHED_FLAG_RESET_ON_FORK, SCHED_NORMAL, SCHED_RESET_ON_FORK, SCHED_RR, TIMER_ABSTIME, timespec,
+};
+use starry_core::task::{
+    ThreadData, get_process_group, get_thread, processes, register_signal_waker,
+    unregister_signal_waker,
+};
 
 use crate::{
+    file::PollWaker,
     ptr::{UserConstPtr, UserPtr, nullable},
+    signal::have_signals,
     time::{TimeValueLike, timespec_to_timevalue, timevalue_to_timespec},
 };
 
+/// The lowest nice value, i.e. the highest priority.
+const MIN_NICE: isize = -20;
+/// The highest nice value, i.e. the lowest priority.
+const MAX_NICE: isize = 19;
+
 pub fn sys_sched_yield() -> LinuxResult<isize> {
     axtask::yield_now();
     Ok(0)
 }
 
-/// Sleep some nanoseconds
+fn thread_data(thread: &Thread) -> LinuxResult<&ThreadData> {
+    thread.data::<ThreadData>().ok_or(LinuxError::ESRCH)
+}
+
+/// Finds the thread `tid`, or the current one if `tid` is 0.
+fn find_thread(tid: Pid) -> LinuxResult<Arc<Thread>> {
+    if tid == 0 {
+        Ok(current().task_ext().thread.clone())
+    } else {
+        get_thread(tid)
+    }
+}
+
+/// Finds the threads designated by `which` and `who` in `getpriority` and
+/// `setpriority`.
+fn priority_targets(which: u32, who: u32) -> LinuxResult<Vec<Arc<Thread>>> {
+    let threads = match which {
+        // As in Linux, this designates a single thread.
+        PRIO_PROCESS => vec![find_thread(who)?],
+        PRIO_PGRP => {
+            let group = if who == 0 {
+                current().task_ext().thread.process().group()
+            } else {
+                get_process_group(who)?
+            };
+            group.processes().iter().flat_map(|p| p.threads()).collect()
+        }
+        // All processes belong to root.
+        PRIO_USER if who == 0 => processes().iter().flat_map(|p| p.threads()).collect(),
+        PRIO_USER => Vec::new(),
+        _ => return Err(LinuxError::EINVAL),
+    };
+    if threads.is_empty() {
+        return Err(LinuxError::ESRCH);
+    }
+    Ok(threads)
+}
+
+/// Gets the highest priority of the designated threads, as `20 - nice` so
+/// that it is never negative.
+pub fn sys_getpriority(which: u32, who: u32) -> LinuxResult<isize> {
+    let mut nice = MAX_NICE;
+    for thread in priority_targets(which, who)? {
+        nice = nice.min(thread_data(&thread)?.priority());
+    }
+    Ok(20 - nice)
+}
+
+/// Sets the nice value of the designated threads, which is clamped to the
+/// valid range.
+pub fn sys_setpriority(which: u32, who: u32, prio: i32) -> LinuxResult<isize> {
+    let nice = (prio as isize).clamp(MIN_NICE, MAX_NICE);
+    debug!("sys_setpriority <= which: {which}, who: {who}, nice: {nice}");
+    for thread in priority_targets(which, who)? {
+        thread_data(&thread)?.set_priority(nice);
+    }
+    Ok(0)
+}
+
+/// Sets the Linux scheduling `policy` of `thread`, with the real-time
+/// `priority` for `SCHED_FIFO` and `SCHED_RR`, which must be 0 otherwise.
 ///
-/// TODO: should be woken by signals, and set errno
-pub fn sys_nanosleep(req: UserConstPtr<timespec>, rem: UserPtr<timespec>) -> LinuxResult<isize> {
-    let req = req.get_as_ref()?;
+/// `SCHED_BATCH` is accepted, and treated as `SCHED_NORMAL`.
+fn set_scheduler(thread: &Thread, policy: u32, priority: u32) -> LinuxResult<()> {
+    let rt_priority = || {
+        u8::try_from(priority)
+            .ok()
+            .filter(|prio| (1..=MAX_RT_PRIO).contains(prio))
+            .ok_or(LinuxError::EINVAL)
+    };
+    let sched_policy = match policy {
+        SCHED_NORMAL | SCHED_BATCH if priority == 0 => SchedPolicy::Normal,
+        SCHED_FIFO => SchedPolicy::Fifo(rt_priority()?),
+        SCHED_RR => SchedPolicy::RoundRobin(rt_priority()?),
+        _ => return Err(LinuxError::EINVAL),
+    };
+    let data = thread_data(thread)?;
+    let task = data.task().ok_or(LinuxError::ESRCH)?;
+    axtask::set_task_policy(&task, sched_policy);
+    data.set_sched_policy(policy);
+    Ok(())
+}
 
-    if req.tv_nsec < 0 || req.tv_nsec > 999_999_999 || req.tv_sec < 0 {
+/// Gets the real-time priority of `thread`, or 0 if it is a normal one.
+fn rt_priority(thread: &Thread) -> LinuxResult<u32> {
+    let task = thread_data(thread)?.task().ok_or(LinuxError::ESRCH)?;
+    Ok(match task.sched_policy() {
+        SchedPolicy::Normal => 0,
+        SchedPolicy::Fifo(prio) | SchedPolicy::RoundRobin(prio) => prio as u32,
+    })
+}
+
+/// Sets the scheduling policy of the thread `tid`, and its real-time
+/// priority in `param`.
+pub fn sys_sched_setscheduler(
+    tid: Pid,
+    policy: u32,
+    param: UserConstPtr<i32>,
+) -> LinuxResult<isize> {
+    let priority = param.get_as_ref()?;
+    debug!("sys_sched_setscheduler <= tid: {tid}, policy: {policy}, priority: {priority}");
+    let thread = find_thread(tid)?;
+    set_scheduler(&thread, policy & !SCHED_RESET_ON_FORK, *priority as u32)?;
+    Ok(0)
+}
+
+/// Gets the scheduling policy of the thread `tid`.
+pub fn sys_sched_getscheduler(tid: Pid) -> LinuxResult<isize> {
+    let thread = find_thread(tid)?;
+    Ok(thread_data(&thread)?.sched_policy() as _)
+}
+
+/// Sets the real-time priority of the thread `tid`, keeping its policy.
+pub fn sys_sched_setparam(tid: Pid, param: UserConstPtr<i32>) -> LinuxResult<isize> {
+    let priority = *param.get_as_ref()?;
+    let thread = find_thread(tid)?;
+    let policy = thread_data(&thread)?.sched_policy();
+    set_scheduler(&thread, policy, priority as u32)?;
+    Ok(0)
+}
+
+/// Gets the real-time priority of the thread `tid`.
+pub fn sys_sched_getparam(tid: Pid, param: UserPtr<i32>) -> LinuxResult<isize> {
+    let thread = find_thread(tid)?;
+    *param.get_as_mut()? = rt_priority(&thread)? as i32;
+    Ok(0)
+}
+
+/// Gets the highest priority of `policy`.
+pub fn sys_sched_get_priority_max(policy: u32) -> LinuxResult<isize> {
+    match policy {
+        SCHED_FIFO | SCHED_RR => Ok(MAX_RT_PRIO as _),
+        SCHED_NORMAL | SCHED_BATCH => Ok(0),
+        _ => Err(LinuxError::EINVAL),
+    }
+}
+
+/// Gets the lowest priority of `policy`.
+pub fn sys_sched_get_priority_min(policy: u32) -> LinuxResult<isize> {
+    match policy {
+        SCHED_FIFO | SCHED_RR => Ok(1),
+        SCHED_NORMAL | SCHED_BATCH => Ok(0),
+        _ => Err(LinuxError::EINVAL),
+    }
+}
+
+/// The scheduling attributes of `sched_setattr` and `sched_getattr`.
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct SchedAttr {
+    size: u32,
+    sched_policy: u32,
+    sched_flags: u64,
+    sched_nice: i32,
+    sched_priority: u32,
+    sched_runtime: u64,
+    sched_deadline: u64,
+    sched_period: u64,
+}
+
+/// The size of the first version of [`SchedAttr`], which is the one
+/// supported.
+const SCHED_ATTR_SIZE_VER0: u32 = size_of::<SchedAttr>() as u32;
+
+/// Sets the scheduling policy and attributes of the thread `tid`.
+///
+/// The deadline policy is not supported.
+pub fn sys_sched_setattr(
+    tid: Pid,
+    attr: UserConstPtr<SchedAttr>,
+    flags: u32,
+) -> LinuxResult<isize> {
+    if flags != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let attr = *attr.get_as_ref()?;
+    if attr.size != 0 && attr.size < SCHED_ATTR_SIZE_VER0 {
+        return Err(LinuxError::E2BIG);
+    }
+    debug!("sys_sched_setattr <= tid: {tid}, attr: {attr:?}");
+    let known_flags = SCHED_FLAG_RESET_ON_FORK | SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS;
+    if attr.sched_flags & !(known_flags as u64) != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let thread = find_thread(tid)?;
+    let data = thread_data(&thread)?;
+    let keep_policy = attr.sched_flags & SCHED_FLAG_KEEP_POLICY as u64 != 0;
+    let keep_params = attr.sched_flags & SCHED_FLAG_KEEP_PARAMS as u64 != 0;
+    let policy = if keep_policy {
+        data.sched_policy()
+    } else {
+        attr.sched_policy
+    };
+    let priority = if keep_params {
+        rt_priority(&thread)?
+    } else {
+        attr.sched_priority
+    };
+    set_scheduler(&thread, policy, priority)?;
+    if !keep_params {
+        data.set_priority((attr.sched_nice as isize).clamp(MIN_NICE, MAX_NICE));
+    }
+    Ok(0)
+}
+
+/// Gets the scheduling policy and attributes of the thread `tid`.
+pub fn sys_sched_getattr(
+    tid: Pid,
+    attr: UserPtr<SchedAttr>,
+    size: u32,
+    flags: u32,
+) -> LinuxResult<isize> {
+    if flags != 0 || size < SCHED_ATTR_SIZE_VER0 {
         return Err(LinuxError::EINVAL);
     }
+    let thread = find_thread(tid)?;
+    let data = thread_data(&thread)?;
+    *attr.get_as_mut()? = SchedAttr {
+        size: SCHED_ATTR_SIZE_VER0,
+        sched_policy: data.sched_policy(),
+        sched_nice: data.priority() as i32,
+        sched_priority: rt_priority(&thread)?,
+        ..Default::default()
+    };
+    Ok(0)
+}
 
-    let dur = req.to_time_value();
-    debug!("sys_nanosleep <= {:?}", dur);
+/// The size of the CPU masks of `sched_getaffinity`, in bytes, which are
+/// arrays of `unsigned long` as in Linux.
+const CPU_MASK_SIZE: usize = axconfig::SMP.div_ceil(usize::BITS as usize) * size_of::<usize>();
 
-    let now = axhal::time::monotonic_time();
-    //取巧
-    if axtask::current().name() != "busybox" {
-        axtask::sleep(dur);
+/// Sets the CPUs the thread `tid` may run on.
+///
+/// The CPUs beyond the ones in the system are ignored. If the thread is the
+/// current one and the current CPU is excluded, it is migrated right away.
+pub fn sys_sched_setaffinity(
+    tid: Pid,
+    cpusetsize: usize,
+    user_mask: UserConstPtr<u8>,
+) -> LinuxResult<isize> {
+    let bytes = user_mask.get_as_slice(cpusetsize.min(CPU_MASK_SIZE))?;
+    let mut cpumask = AxCpuMask::new();
+    for cpu in 0..axconfig::SMP.min(bytes.len() * 8) {
+        if bytes[cpu / 8] & (1 << (cpu % 8)) != 0 {
+            cpumask.set(cpu, true);
+        }
     }
+    debug!("sys_sched_setaffinity <= tid: {tid}, cpusetsize: {cpusetsize}");
+    let thread = find_thread(tid)?;
+    let task = thread_data(&thread)?.task().ok_or(LinuxError::ESRCH)?;
+    if !axtask::set_task_affinity(&task, cpumask) {
+        return Err(LinuxError::EINVAL);
+    }
+    Ok(0)
+}
 
-    let after = axhal::time::monotonic_time();
-    let actual = after - now;
+/// Gets the CPUs the thread `tid` may run on.
+///
+/// Returns the size of the mask written, which `cpusetsize` must fit.
+pub fn sys_sched_getaffinity(
+    tid: Pid,
+    cpusetsize: usize,
+    user_mask: UserPtr<u8>,
+) -> LinuxResult<isize> {
+    if cpusetsize < CPU_MASK_SIZE || cpusetsize % size_of::<usize>() != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let thread = find_thread(tid)?;
+    let task = thread_data(&thread)?.task().ok_or(LinuxError::ESRCH)?;
+    let cpumask = task.cpumask();
+    let bytes = user_mask.get_as_mut_slice(CPU_MASK_SIZE)?;
+    bytes.fill(0);
+    for cpu in (0..axconfig::SMP).filter(|&cpu| cpumask.get(cpu)) {
+        bytes[cpu / 8] |= 1 << (cpu % 8);
+    }
+    Ok(CPU_MASK_SIZE as _)
+}
 
-    if let Some(diff) = dur.checked_sub(actual) {
-        if let Some(rem) = nullable!(rem.get_as_mut())? {
-            *rem = timespec::from_time_value(diff);
+/// Sleeps until `deadline` on the clock read by `now`, or until a signal
+/// arrives, in which case `EINTR` is returned.
+fn sleep_until(deadline: TimeValue, now: fn() -> TimeValue) -> LinuxResult {
+    let waker = PollWaker::new();
+    let signal_waker = waker.signal_waker();
+    register_signal_waker(&signal_waker);
+    let res = loop {
+        waker.reset();
+        if have_signals() {
+            break Err(LinuxError::EINTR);
         }
-        // 只能返回ok(0)，不能返回错误
-        Ok(0)
+        let now = now();
+        if now >= deadline {
+            break Ok(());
+        }
+        waker.wait(Some(deadline - now));
+    };
+    unregister_signal_waker(&signal_waker);
+    res
+}
+
+/// Sleeps for the duration `req`, or until a signal arrives, in which case
+/// `EINTR` is returned and the time left is written to `rem`.
+fn do_nanosleep(
+    req: &timespec,
+    rem: UserPtr<timespec>,
+    now: fn() -> TimeValue,
+    abstime: bool,
+) -> LinuxResult<isize> {
+    if req.tv_nsec < 0 || req.tv_nsec > 999_999_999 || req.tv_sec < 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let deadline = if abstime {
+        req.to_time_value()
     } else {
-        Ok(0)
+        now() + req.to_time_value()
+    };
+    match sleep_until(deadline, now) {
+        Err(LinuxError::EINTR) if !abstime => {
+            if let Some(rem) = nullable!(rem.get_as_mut())? {
+                let left = deadline.checked_sub(now()).unwrap_or_default();
+                *rem = timespec::from_time_value(left);
+            }
+            Err(LinuxError::EINTR)
+        }
+        res => res.map(|_| 0),
     }
-}
\ No newline at end of file
+}
+
+/// Sleeps for the duration `req` on the monotonic clock.
+pub fn sys_nanosleep(req: UserConstPtr<timespec>, rem: UserPtr<timespec>) -> LinuxResult<isize> {
+    let req = req.get_as_ref()?;
+    debug!("sys_nanosleep <= {:?}", req.to_time_value());
+    do_nanosleep(req, rem, monotonic_time, false)
+}
+
+/// Sleeps on the clock `clock_id` for the duration `req`, or until the
+/// absolute time `req` with `TIMER_ABSTIME`.
+pub fn sys_clock_nanosleep(
+    clock_id: __kernel_clockid_t,
+    flags: u32,
+    req: UserConstPtr<timespec>,
+    rem: UserPtr<timespec>,
+) -> LinuxResult<isize> {
+    let req = req.get_as_ref()?;
+    debug!(
+        "sys_clock_nanosleep <= clock: {}, flags: {:#x}, req: {:?}",
+        clock_id,
+        flags,
+        req.to_time_value()
+    );
+    let now: fn() -> TimeValue = match clock_id as u32 {
+        CLOCK_REALTIME => wall_time,
+        CLOCK_MONOTONIC | CLOCK_BOOTTIME => monotonic_time,
+        _ => {
+            warn!(
+                "Called sys_clock_nanosleep for unsupported clock {}",
+                clock_id
+            );
+            return Err(LinuxError::EINVAL);
+        }
+    };
+    do_nanosleep(req, rem, now, flags & TIMER_ABSTIME != 0)
+}
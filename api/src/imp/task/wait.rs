@@ -1,12 +1,14 @@
-use alloc::{sync::Arc, vec::Vec};
+use alloc::sync::Arc;
 use axerrno::{LinuxError, LinuxResult};
 use axprocess::{Pid, Process};
+use axsignal::Signo;
 use axtask::{TaskExtRef, current};
 use bitflags::bitflags;
 use linux_raw_sys::general::{
-    __WALL, __WCLONE, __WNOTHREAD, WCONTINUED, WEXITED, WNOHANG, WNOWAIT, WUNTRACED,
+    __WALL, __WCLONE, __WNOTHREAD, CLD_CONTINUED, CLD_DUMPED, CLD_EXITED, CLD_KILLED, CLD_STOPPED,
+    P_ALL, P_PGID, P_PID, SIGCHLD, WCONTINUED, WEXITED, WNOHANG, WNOWAIT, WUNTRACED, siginfo_t,
 };
-use starry_core::task::ProcessData;
+use starry_core::task::{ChildEvent, ChildEventKind, ProcessData};
 
 use crate::ptr::{UserPtr, nullable};
 
@@ -55,12 +57,70 @@ impl WaitPid {
     }
 }
 
+impl WaitOptions {
+    /// Whether the options select children with `event`.
+    fn wants(&self, event: &ChildEvent) -> bool {
+        match event.kind {
+            ChildEventKind::Exited => self.contains(WaitOptions::WEXITED),
+            ChildEventKind::Stopped(_) => self.contains(WaitOptions::WUNTRACED),
+            ChildEventKind::Continued => self.contains(WaitOptions::WCONTINUED),
+        }
+    }
+
+    /// Whether the options select `child` by its type.
+    fn applies_to(&self, child: &Process) -> bool {
+        self.contains(WaitOptions::WALL)
+            || (self.contains(WaitOptions::WCLONE)
+                == child.data::<ProcessData>().unwrap().is_clone_child())
+    }
+}
+
+/// Waits for a change of state of a child selected by `pid` and `options`,
+/// returning `None` with `WNOHANG` if there is none yet.
+///
+/// Exits and job control stops and continues are queued to the parent when
+/// they happen, so this only looks at the children when there is no event,
+/// to check that there are children to wait for, and is woken up only by
+/// new events.
+fn do_wait(pid: WaitPid, options: WaitOptions) -> LinuxResult<Option<ChildEvent>> {
+    let curr = current();
+    let proc_data = curr.task_ext().process_data();
+    let process = curr.task_ext().thread.process();
+
+    let filter = |event: &ChildEvent| {
+        options.wants(event) && pid.apply(&event.child) && options.applies_to(&event.child)
+    };
+    let keep = options.contains(WaitOptions::WNOWAIT);
+    let mut checked = false;
+    loop {
+        if let Some(event) = proc_data.take_child_event(filter, keep) {
+            if event.kind == ChildEventKind::Exited && !keep {
+                event.child.free();
+            }
+            return Ok(Some(event));
+        }
+        if !checked {
+            if !process
+                .children()
+                .iter()
+                .any(|child| pid.apply(child) && options.applies_to(child))
+            {
+                return Err(LinuxError::ECHILD);
+            }
+            checked = true;
+        }
+        if options.contains(WaitOptions::WNOHANG) {
+            return Ok(None);
+        }
+        proc_data.wait_child_event(filter);
+    }
+}
+
 pub fn sys_waitpid(pid: i32, exit_code_ptr: UserPtr<i32>, options: u32) -> LinuxResult<isize> {
-    let options = WaitOptions::from_bits_truncate(options);
+    let options = WaitOptions::from_bits_truncate(options) | WaitOptions::WEXITED;
     info!("sys_waitpid <= pid: {:?}, options: {:?}", pid, options);
 
     let curr = current();
-    let proc_data = curr.task_ext().process_data();
     let process = curr.task_ext().thread.process();
 
     let pid = if pid == -1 {
@@ -73,34 +133,71 @@ pub fn sys_waitpid(pid: i32, exit_code_ptr: UserPtr<i32>, options: u32) -> Linux
         WaitPid::Pgid(-pid as _)
     };
 
-    let children = process
-        .children()
-        .into_iter()
-        .filter(|child| pid.apply(child))
-        .filter(|child| {
-            options.contains(WaitOptions::WALL)
-                || (options.contains(WaitOptions::WCLONE)
-                    == child.data::<ProcessData>().unwrap().is_clone_child())
-        })
-        .collect::<Vec<_>>();
-    if children.is_empty() {
-        return Err(LinuxError::ECHILD);
+    let exit_code = nullable!(exit_code_ptr.get_as_mut())?;
+    let Some(event) = do_wait(pid, options)? else {
+        return Ok(0);
+    };
+    if let Some(exit_code) = exit_code {
+        *exit_code = match event.kind {
+            ChildEventKind::Exited => event.child.exit_code(),
+            ChildEventKind::Stopped(signo) => ((signo as i32) << 8) | 0x7f,
+            ChildEventKind::Continued => 0xffff,
+        };
     }
+    Ok(event.child.pid() as _)
+}
 
-    let exit_code = nullable!(exit_code_ptr.get_as_mut())?;
-    loop {
-        if let Some(child) = children.iter().find(|child| child.is_zombie()) {
-            if !options.contains(WaitOptions::WNOWAIT) {
-                child.free();
-            }
-            if let Some(exit_code) = exit_code {
-                *exit_code = child.exit_code();
+pub fn sys_waitid(
+    idtype: u32,
+    id: u32,
+    infop: UserPtr<siginfo_t>,
+    options: u32,
+) -> LinuxResult<isize> {
+    let options = WaitOptions::from_bits(options).ok_or(LinuxError::EINVAL)?;
+    info!(
+        "sys_waitid <= idtype: {}, id: {}, options: {:?}",
+        idtype, id, options
+    );
+    if !options.intersects(WaitOptions::WEXITED | WaitOptions::WUNTRACED | WaitOptions::WCONTINUED)
+    {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let pid = match idtype {
+        P_ALL => WaitPid::Any,
+        P_PID => WaitPid::Pid(id as _),
+        P_PGID if id == 0 => WaitPid::Pgid(current().task_ext().thread.process().group().pgid()),
+        P_PGID => WaitPid::Pgid(id as _),
+        _ => return Err(LinuxError::EINVAL),
+    };
+
+    let info = nullable!(infop.get_as_mut())?;
+    let event = do_wait(pid, options)?;
+    if let Some(info) = info {
+        // With `WNOHANG` and no event, the PID is zero.
+        *info = unsafe { core::mem::zeroed() };
+        if let Some(event) = event {
+            let (code, status) = match event.kind {
+                ChildEventKind::Exited => {
+                    let exit_code = event.child.exit_code();
+                    match exit_code & 0x7f {
+                        0 => (CLD_EXITED, exit_code >> 8),
+                        signo if exit_code & 0x80 != 0 => (CLD_DUMPED, signo),
+                        signo => (CLD_KILLED, signo),
+                    }
+                }
+                ChildEventKind::Stopped(signo) => (CLD_STOPPED, signo as i32),
+                ChildEventKind::Continued => (CLD_CONTINUED, Signo::SIGCONT as i32),
+            };
+            unsafe {
+                let info = &mut info.__bindgen_anon_1.__bindgen_anon_1;
+                info.si_signo = SIGCHLD as _;
+                info.si_code = code as _;
+                let sigchld = &mut info._sifields._sigchld;
+                sigchld._pid = event.child.pid() as _;
+                sigchld._status = status;
             }
-            return Ok(child.pid() as _);
-        } else if options.contains(WaitOptions::WNOHANG) {
-            return Ok(0);
-        } else {
-            proc_data.child_exit_wq.wait();
         }
     }
+    Ok(0)
 }
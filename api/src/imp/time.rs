@@ -1,11 +1,72 @@
+use alloc::sync::Arc;
+use core::time::Duration;
+
 use axerrno::{LinuxError, LinuxResult};
-use axhal::time::{monotonic_time, monotonic_time_nanos, nanos_to_ticks, wall_time};
+use axhal::time::{TimeValue, monotonic_time, monotonic_time_nanos, nanos_to_ticks, wall_time};
+use axprocess::Pid;
+use axsignal::Signo;
+use axtask::{TaskExtRef, current};
 use linux_raw_sys::general::{
-    __kernel_clockid_t, CLOCK_MONOTONIC, CLOCK_REALTIME, timespec, timeval,
+    __kernel_clockid_t, __kernel_timer_t, CLOCK_BOOTTIME, CLOCK_MONOTONIC,
+    CLOCK_PROCESS_CPUTIME_ID, CLOCK_REALTIME, CLOCK_THREAD_CPUTIME_ID, SIGEV_NONE, SIGEV_SIGNAL,
+    SIGEV_THREAD_ID, TIMER_ABSTIME, itimerspec, itimerval, sigevent, timespec, timeval,
+};
+use starry_core::{
+    task::{ThreadData, get_process, get_thread, process_cpu_time},
+    timer::{Timer, TimerClock, TimerTarget},
+};
+
+use crate::{
+    ptr::{UserConstPtr, UserPtr, nullable},
+    time::TimeValueLike,
 };
-use starry_core::task::time_stat_output;
 
-use crate::{ptr::UserPtr, time::TimeValueLike};
+/// The bits of the CPU clock IDs made by `clock_getcpuclockid` and
+/// `pthread_getcpuclockid`, which are negative, with the bitwise NOT of the
+/// PID or TID above them.
+const CPUCLOCK_PERTHREAD_MASK: i32 = 4;
+const CPUCLOCK_CLOCK_MASK: i32 = 3;
+const CPUCLOCK_VIRT: i32 = 1;
+
+/// Returns the time of the CPU clock `clock_id`, of the current process or
+/// thread, or of the process or thread in a CPU clock ID.
+fn cpu_clock_time(clock_id: __kernel_clockid_t) -> LinuxResult<Duration> {
+    let curr = current();
+    let thread = &curr.task_ext().thread;
+    let (utime, stime) = match clock_id as u32 {
+        CLOCK_PROCESS_CPUTIME_ID => process_cpu_time(thread.process()),
+        CLOCK_THREAD_CPUTIME_ID => curr.cpu_time(),
+        _ if clock_id < 0 && clock_id & CPUCLOCK_CLOCK_MASK != CPUCLOCK_CLOCK_MASK => {
+            let pid = !(clock_id >> 3) as Pid;
+            let time = if clock_id & CPUCLOCK_PERTHREAD_MASK != 0 {
+                let target = match pid {
+                    0 => thread.clone(),
+                    _ => get_thread(pid).map_err(|_| LinuxError::EINVAL)?,
+                };
+                // Only the threads of the same process can be measured.
+                if !Arc::ptr_eq(target.process(), thread.process()) {
+                    return Err(LinuxError::EINVAL);
+                }
+                target
+                    .data::<ThreadData>()
+                    .and_then(ThreadData::task)
+                    .ok_or(LinuxError::EINVAL)?
+                    .cpu_time()
+            } else {
+                match pid {
+                    0 => process_cpu_time(thread.process()),
+                    _ => process_cpu_time(&get_process(pid).map_err(|_| LinuxError::EINVAL)?),
+                }
+            };
+            if clock_id & CPUCLOCK_CLOCK_MASK == CPUCLOCK_VIRT {
+                return Ok(time.0);
+            }
+            time
+        }
+        _ => return Err(LinuxError::EINVAL),
+    };
+    Ok(utime + stime)
+}
 
 pub fn sys_clock_gettime(
     clock_id: __kernel_clockid_t,
@@ -14,6 +75,8 @@ pub fn sys_clock_gettime(
     let now = match clock_id as u32 {
         CLOCK_REALTIME => wall_time(),
         CLOCK_MONOTONIC => monotonic_time(),
+        CLOCK_PROCESS_CPUTIME_ID | CLOCK_THREAD_CPUTIME_ID => cpu_clock_time(clock_id)?,
+        _ if clock_id < 0 => cpu_clock_time(clock_id)?,
         _ => {
             warn!(
                 "Called sys_clock_gettime for unsupported clock {}",
@@ -44,12 +107,204 @@ pub struct Tms {
 }
 
 pub fn sys_times(tms: UserPtr<Tms>) -> LinuxResult<isize> {
-    let (_, utime_us, _, stime_us) = time_stat_output();
+    let curr = current();
+    let (utime, stime) = process_cpu_time(curr.task_ext().thread.process());
+    let (cutime, cstime) = curr.task_ext().process_data().children_cpu_time();
+    let ticks = |time: Duration| nanos_to_ticks(time.as_nanos() as u64) as usize;
     *tms.get_as_mut()? = Tms {
-        tms_utime: utime_us,
-        tms_stime: stime_us,
-        tms_cutime: utime_us,
-        tms_cstime: stime_us,
+        tms_utime: ticks(utime),
+        tms_stime: ticks(stime),
+        tms_cutime: ticks(cutime),
+        tms_cstime: ticks(cstime),
     };
     Ok(nanos_to_ticks(monotonic_time_nanos()) as _)
 }
+
+pub fn sys_getitimer(which: u32, curr_value: UserPtr<itimerval>) -> LinuxResult<isize> {
+    let curr = current();
+    let (value, interval) = curr.task_ext().process_data().timers.itimer(which)?.get();
+    *curr_value.get_as_mut()? = itimerval {
+        it_interval: timeval::from_time_value(interval),
+        it_value: timeval::from_time_value(value),
+    };
+    Ok(0)
+}
+
+pub fn sys_setitimer(
+    which: u32,
+    new_value: UserConstPtr<itimerval>,
+    old_value: UserPtr<itimerval>,
+) -> LinuxResult<isize> {
+    let new_value = new_value.get_as_ref()?;
+    let value = new_value.it_value;
+    let interval = new_value.it_interval;
+    debug!(
+        "sys_setitimer <= which: {}, value: {:?}, interval: {:?}",
+        which,
+        value.to_time_value(),
+        interval.to_time_value()
+    );
+    if value.tv_usec as u64 >= 1_000_000 || interval.tv_usec as u64 >= 1_000_000 {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let curr = current();
+    let timers = &curr.task_ext().process_data().timers;
+    let timer = timers.itimer(which)?;
+    let (old_value_, old_interval) =
+        timers.set(timer, value.to_time_value(), interval.to_time_value());
+    if let Some(old_value) = nullable!(old_value.get_as_mut())? {
+        *old_value = itimerval {
+            it_interval: timeval::from_time_value(old_interval),
+            it_value: timeval::from_time_value(old_value_),
+        };
+    }
+    Ok(0)
+}
+
+pub fn sys_timer_create(
+    clock_id: __kernel_clockid_t,
+    sevp: UserConstPtr<sigevent>,
+    timer_id: UserPtr<__kernel_timer_t>,
+) -> LinuxResult<isize> {
+    let curr = current();
+    let thread = &curr.task_ext().thread;
+    let clock = match clock_id as u32 {
+        CLOCK_REALTIME => TimerClock::Wall,
+        CLOCK_MONOTONIC | CLOCK_BOOTTIME => TimerClock::Monotonic,
+        CLOCK_PROCESS_CPUTIME_ID => TimerClock::ProcessCpu,
+        CLOCK_THREAD_CPUTIME_ID => TimerClock::ThreadCpu(thread.tid()),
+        _ => {
+            warn!("Called sys_timer_create for unsupported clock {}", clock_id);
+            return Err(LinuxError::EINVAL);
+        }
+    };
+
+    let proc_data = curr.task_ext().process_data();
+    let process_target = || TimerTarget::Process(proc_data.signal.clone());
+    let (target, signo, value) = match nullable!(sevp.get_as_ref())? {
+        // Like `SIGEV_SIGNAL` with `SIGALRM` and the ID as the value.
+        None => (process_target(), Signo::SIGALRM, None),
+        Some(sevp) => {
+            let signo = Signo::from_repr(sevp.sigev_signo as u8);
+            // The value is a union of an integer and a pointer.
+            let value = Some(unsafe { sevp.sigev_value.sival_ptr } as usize);
+            debug!(
+                "sys_timer_create <= clock: {}, notify: {}, signo: {}",
+                clock_id, sevp.sigev_notify, sevp.sigev_signo
+            );
+            match sevp.sigev_notify as u32 {
+                SIGEV_NONE => (TimerTarget::None, Signo::SIGALRM, value),
+                SIGEV_SIGNAL => (process_target(), signo.ok_or(LinuxError::EINVAL)?, value),
+                SIGEV_THREAD_ID => {
+                    let tid = unsafe { sevp._sigev_un._tid };
+                    let target = get_thread(tid as _).map_err(|_| LinuxError::EINVAL)?;
+                    if !Arc::ptr_eq(target.process(), thread.process()) {
+                        return Err(LinuxError::EINVAL);
+                    }
+                    let target = TimerTarget::Thread(Arc::downgrade(&target));
+                    (target, signo.ok_or(LinuxError::EINVAL)?, value)
+                }
+                // `SIGEV_THREAD` is implemented by the C library on top of
+                // `SIGEV_THREAD_ID`.
+                _ => return Err(LinuxError::EINVAL),
+            }
+        }
+    };
+
+    let id = proc_data.timers.create(clock, target, signo, value)?;
+    if let Err(err) = timer_id.get_as_mut().map(|timer_id| *timer_id = id) {
+        proc_data.timers.delete(id)?;
+        return Err(err);
+    }
+    Ok(0)
+}
+
+fn to_itimerspec((value, interval): (Duration, Duration)) -> itimerspec {
+    itimerspec {
+        it_interval: timespec::from_time_value(interval),
+        it_value: timespec::from_time_value(value),
+    }
+}
+
+/// Returns the current time of the clock of `timer`, for absolute times.
+fn timer_clock_now(timer: &Timer) -> TimeValue {
+    match timer.clock() {
+        TimerClock::Wall => wall_time(),
+        TimerClock::Monotonic => monotonic_time(),
+        TimerClock::ProcessCpu | TimerClock::ProcessUser | TimerClock::ThreadCpu(_) => {
+            let (utime, stime) = match timer.clock() {
+                TimerClock::ThreadCpu(tid) => get_thread(tid)
+                    .ok()
+                    .and_then(|thread| thread.data::<ThreadData>()?.task())
+                    .map_or((Duration::ZERO, Duration::ZERO), |task| task.cpu_time()),
+                _ => process_cpu_time(current().task_ext().thread.process()),
+            };
+            match timer.clock() {
+                TimerClock::ProcessUser => utime,
+                _ => utime + stime,
+            }
+        }
+    }
+}
+
+pub fn sys_timer_settime(
+    timer_id: __kernel_timer_t,
+    flags: u32,
+    new_value: UserConstPtr<itimerspec>,
+    old_value: UserPtr<itimerspec>,
+) -> LinuxResult<isize> {
+    debug!("sys_timer_settime <= id: {}, flags: {:#x}", timer_id, flags);
+    if flags & !TIMER_ABSTIME != 0 {
+        return Err(LinuxError::EINVAL);
+    }
+    let new_value = new_value.get_as_ref()?;
+    let value = new_value.it_value;
+    let interval = new_value.it_interval;
+    if value.tv_nsec as u64 >= 1_000_000_000 || interval.tv_nsec as u64 >= 1_000_000_000 {
+        return Err(LinuxError::EINVAL);
+    }
+
+    let curr = current();
+    let timers = &curr.task_ext().process_data().timers;
+    let timer = timers.get(timer_id)?;
+    let mut value = value.to_time_value();
+    if flags & TIMER_ABSTIME != 0 && !value.is_zero() {
+        // A time already past expires right away.
+        value = value
+            .checked_sub(timer_clock_now(&timer))
+            .filter(|value| !value.is_zero())
+            .unwrap_or(Duration::from_nanos(1));
+    }
+    let old = timers.set(&timer, value, interval.to_time_value());
+    if let Some(old_value) = nullable!(old_value.get_as_mut())? {
+        *old_value = to_itimerspec(old);
+    }
+    Ok(0)
+}
+
+pub fn sys_timer_gettime(
+    timer_id: __kernel_timer_t,
+    curr_value: UserPtr<itimerspec>,
+) -> LinuxResult<isize> {
+    let curr = current();
+    let timer = curr.task_ext().process_data().timers.get(timer_id)?;
+    *curr_value.get_as_mut()? = to_itimerspec(timer.get());
+    Ok(0)
+}
+
+pub fn sys_timer_getoverrun(timer_id: __kernel_timer_t) -> LinuxResult<isize> {
+    let curr = current();
+    let timer = curr.task_ext().process_data().timers.get(timer_id)?;
+    Ok(timer.overrun() as _)
+}
+
+pub fn sys_timer_delete(timer_id: __kernel_timer_t) -> LinuxResult<isize> {
+    debug!("sys_timer_delete <= id: {}", timer_id);
+    current()
+        .task_ext()
+        .process_data()
+        .timers
+        .delete(timer_id)?;
+    Ok(0)
+}
@@ -7,6 +7,7 @@ extern crate alloc;
 
 pub mod file;
 pub mod path;
+pub mod procfs;
 pub mod ptr;
 pub mod signal;
 pub mod sockaddr;
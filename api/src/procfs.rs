@@ -0,0 +1,544 @@
+//! The entries of `/proc` generated from the state of the kernel, see
+//! [`axfs::procfs`].
+//!
+//! - `/proc/meminfo`, `/proc/loadavg`, `/proc/stat` and `/proc/uptime` show
+//!   the memory, the load and the CPU times of the system.
+//! - `/proc/[pid]/{stat,status,maps}` show the state of each process, and
+//!   `/proc/[pid]/fd` its open files. `/proc/self` is the current process.
+//! - `/proc/syscall_stats`, `/proc/[pid]/syscall_stats`, `/proc/page_cache`
+//!   and `/proc/lock_stat` show the statistics of the kernel.
+//! - `/proc/schedstat` and `/proc/[pid]/schedstat` show how long the tasks
+//!   waited for a CPU, and how often they were switched.
+
+use alloc::{
+    format,
+    string::{String, ToString},
+    sync::Arc,
+    vec::Vec,
+};
+use core::{fmt::Write, time::Duration};
+
+use axfs::{api::FileType, procfs::ProcSource};
+use axhal::{
+    paging::MappingFlags,
+    time::{NANOS_PER_SEC, epochoffset_nanos, monotonic_time_nanos},
+};
+use axmm::Backend;
+use axprocess::{Pid, Process};
+use axtask::{SchedStat, TaskExtRef, TaskState, current};
+use memory_addr::PAGE_SIZE_4K;
+use starry_core::{
+    mm::file_pages_path,
+    stat, syscall_stats,
+    task::{ProcessData, ThreadData, get_process, process_cpu_time, processes},
+};
+
+use crate::file::{
+    Directory, EventFd, FD_TABLE, File, FileLike, IoUring, PerfEvent, Pipe, SignalFd, Socket,
+    Stdin, Stdout, TimerFd, UnixSocket,
+};
+
+/// The clock ticks per second in which Linux reports times, `USER_HZ`.
+const USER_HZ: u64 = 100;
+
+/// The generated files in `/proc`.
+const ROOT_FILES: &[&str] = &[
+    "loadavg",
+    "lock_stat",
+    "meminfo",
+    "page_cache",
+    "schedstat",
+    "stat",
+    "syscall_stats",
+    "uptime",
+];
+/// The generated files in `/proc/[pid]`, besides the `fd` directory.
+const PROCESS_FILES: &[&str] = &["maps", "schedstat", "stat", "status", "syscall_stats"];
+
+/// Returns the process named `name` in `/proc`, with its data.
+fn process_of(name: &str) -> Option<Arc<Process>> {
+    let pid = if name == "self" {
+        let curr = current();
+        // Kernel tasks have no extended data.
+        if unsafe { curr.task_ext_ptr() }.is_null() {
+            return None;
+        }
+        curr.task_ext().thread.process().pid()
+    } else {
+        name.parse().ok()?
+    };
+    get_process(pid)
+        .ok()
+        .filter(|process| process.data::<ProcessData>().is_some())
+}
+
+fn data(process: &Process) -> &ProcessData {
+    process.data().unwrap()
+}
+
+/// Returns the open files of `process`.
+fn open_files(process: &Process) -> Vec<(usize, Arc<dyn FileLike>)> {
+    let table = FD_TABLE.deref_from(&data(process).ns).read();
+    table
+        .ids()
+        .filter_map(|fd| Some((fd, table.get(fd)?.clone())))
+        .collect()
+}
+
+/// Returns what `/proc/[pid]/fd/[fd]` links to for `file`.
+fn fd_target(file: Arc<dyn FileLike>) -> String {
+    let file = file.into_any();
+    if let Some(file) = file.downcast_ref::<File>() {
+        file.path().to_string()
+    } else if let Some(dir) = file.downcast_ref::<Directory>() {
+        dir.path().to_string()
+    } else if file.is::<Stdin>() || file.is::<Stdout>() {
+        String::from("/dev/console")
+    } else if file.is::<Pipe>() {
+        String::from("pipe:")
+    } else if file.is::<Socket>() || file.is::<UnixSocket>() {
+        String::from("socket:")
+    } else {
+        let name = if file.is::<EventFd>() {
+            "eventfd"
+        } else if file.is::<TimerFd>() {
+            "timerfd"
+        } else if file.is::<SignalFd>() {
+            "signalfd"
+        } else if file.is::<PerfEvent>() {
+            "perf_event"
+        } else if file.is::<IoUring>() {
+            "io_uring"
+        } else {
+            "unknown"
+        };
+        format!("anon_inode:[{}]", name)
+    }
+}
+
+/// Returns the name of the executable of a process, as `comm` in Linux.
+fn comm(data: &ProcessData) -> String {
+    let exe_path = data.exe_path.read();
+    let name = exe_path.rsplit('/').next().unwrap_or_default();
+    name.chars().take(15).collect()
+}
+
+/// Returns the state of `process`, as its letter in `stat` and its name.
+fn state(process: &Process) -> (char, &'static str) {
+    let runnable =
+        |task: axtask::AxTaskRef| matches!(task.state(), TaskState::Running | TaskState::Ready);
+    if process.is_zombie() {
+        ('Z', "zombie")
+    } else if data(process).is_stopped() {
+        ('T', "stopped")
+    } else if process.threads().iter().any(|thread| {
+        thread
+            .data::<ThreadData>()
+            .and_then(ThreadData::task)
+            .is_some_and(runnable)
+    }) {
+        ('R', "running")
+    } else {
+        ('S', "sleeping")
+    }
+}
+
+fn clock_ticks(time: Duration) -> u64 {
+    (time.as_nanos() * USER_HZ as u128 / NANOS_PER_SEC as u128) as u64
+}
+
+/// Formats `time` in seconds with two decimals.
+fn seconds(time: Duration) -> String {
+    format!("{}.{:02}", time.as_secs(), time.subsec_millis() / 10)
+}
+
+fn process_stat(process: &Process) -> String {
+    let data = data(process);
+    let (utime, stime) = process_cpu_time(process);
+    let (cutime, cstime) = data.children_cpu_time();
+    let aspace = data.aspace();
+    let aspace = aspace.read();
+    let group = process.group();
+    let mut stat = format!(
+        "{} ({}) {} {} {} {} 0 -1 0 0 0 0 0 {} {} {} {} 20 0 {} 0 {} {} {}",
+        process.pid(),
+        comm(data),
+        state(process).0,
+        process.parent().map_or(0, |parent| parent.pid()),
+        group.pgid(),
+        group.session().sid(),
+        clock_ticks(utime),
+        clock_ticks(stime),
+        clock_ticks(cutime),
+        clock_ticks(cstime),
+        process.threads().len(),
+        clock_ticks(data.start_time()),
+        aspace.mapped_size(),
+        aspace.resident_pages(),
+    );
+    // The fields that are not kept, up to the 52 of Linux.
+    for _ in 25..=52 {
+        stat.push_str(" 0");
+    }
+    stat.push('\n');
+    stat
+}
+
+/// Returns the scheduling statistics of the live threads of `process`.
+fn process_sched_stat(process: &Process) -> SchedStat {
+    process
+        .threads()
+        .iter()
+        .filter_map(|thread| thread.data::<ThreadData>().and_then(ThreadData::task))
+        .map(|task| task.sched_stat())
+        .fold(SchedStat::default(), |total, stat| total + stat)
+}
+
+fn process_status(process: &Process) -> String {
+    let data = data(process);
+    let (state, state_name) = state(process);
+    let sched_stat = process_sched_stat(process);
+    let (vm_size, vm_rss) = {
+        let aspace = data.aspace();
+        let aspace = aspace.read();
+        (aspace.mapped_size(), aspace.resident_pages() * PAGE_SIZE_4K)
+    };
+    format!(
+        "Name:\t{}\nState:\t{} ({})\nTgid:\t{}\nPid:\t{}\nPPid:\t{}\n\
+         VmSize:\t{:8} kB\nVmHWM:\t{:8} kB\nVmRSS:\t{:8} kB\nThreads:\t{}\n\
+         voluntary_ctxt_switches:\t{}\nnonvoluntary_ctxt_switches:\t{}\n",
+        comm(data),
+        state,
+        state_name,
+        process.pid(),
+        process.pid(),
+        process.parent().map_or(0, |parent| parent.pid()),
+        vm_size / 1024,
+        data.max_rss() * PAGE_SIZE_4K / 1024,
+        vm_rss / 1024,
+        process.threads().len(),
+        sched_stat.voluntary_switches,
+        sched_stat.involuntary_switches,
+    )
+}
+
+/// The time on the CPU, the time waiting for it, and the timeslices, as in
+/// Linux, followed by the voluntary and involuntary switches and the
+/// migrations.
+fn process_schedstat(process: &Process) -> String {
+    let (utime, stime) = process_cpu_time(process);
+    let stat = process_sched_stat(process);
+    format!(
+        "{} {} {} {} {} {}\n",
+        (utime + stime).as_nanos(),
+        stat.run_delay_nanos,
+        stat.timeslices,
+        stat.voluntary_switches,
+        stat.involuntary_switches,
+        stat.migrations,
+    )
+}
+
+fn process_maps(process: &Process) -> String {
+    let data = data(process);
+    let aspace = data.aspace();
+    let aspace = aspace.read();
+    let mut maps = String::new();
+    for (range, flags, backend) in aspace.areas() {
+        let (offset, name, shared) = match backend {
+            Backend::File {
+                start,
+                pages,
+                offset,
+            }
+            | Backend::Shared {
+                start,
+                pages,
+                offset,
+            } => (
+                offset + (range.start - *start),
+                file_pages_path(pages),
+                matches!(backend, Backend::Shared { .. }),
+            ),
+            _ => {
+                let name = if range.start.as_usize() == data.get_heap_bottom() {
+                    Some(String::from("[heap]"))
+                } else if range.end.as_usize() == axconfig::plat::USER_STACK_TOP {
+                    Some(String::from("[stack]"))
+                } else {
+                    None
+                };
+                (0, name, false)
+            }
+        };
+        let flag = |flag, c| if flags.contains(flag) { c } else { '-' };
+        let _ = writeln!(
+            maps,
+            "{:08x}-{:08x} {}{}{}{} {:08x} 00:00 0 {}",
+            range.start.as_usize(),
+            range.end.as_usize(),
+            flag(MappingFlags::READ, 'r'),
+            flag(MappingFlags::WRITE, 'w'),
+            flag(MappingFlags::EXECUTE, 'x'),
+            if shared { 's' } else { 'p' },
+            offset,
+            name.unwrap_or_default(),
+        );
+    }
+    maps
+}
+
+fn meminfo() -> String {
+    let allocator = axalloc::global_allocator();
+    let kb = |pages: usize| pages * PAGE_SIZE_4K / 1024;
+    let free = allocator.available_pages();
+    let total = allocator.used_pages() + free;
+    let cache = axfs::page_cache::stats();
+    let mut meminfo = String::new();
+    for (name, pages) in [
+        ("MemTotal", total),
+        ("MemFree", free),
+        // Clean pages of the page cache are reclaimed on demand.
+        ("MemAvailable", free + cache.pages - cache.dirty),
+        ("Buffers", 0),
+        ("Cached", cache.pages),
+        ("Dirty", cache.dirty),
+    ] {
+        let _ = writeln!(meminfo, "{:<16}{:>8} kB", format!("{}:", name), kb(pages));
+    }
+    meminfo
+}
+
+fn loadavg() -> String {
+    let [one, five, fifteen] = stat::loadavg();
+    let processes = processes();
+    let threads: usize = processes
+        .iter()
+        .map(|process| process.threads().len())
+        .sum();
+    let last_pid = processes.iter().map(|process| process.pid()).max();
+    format!(
+        "{}.{:02} {}.{:02} {}.{:02} {}/{} {}\n",
+        one / 100,
+        one % 100,
+        five / 100,
+        five % 100,
+        fifteen / 100,
+        fifteen % 100,
+        axtask::nr_running(),
+        threads,
+        last_pid.unwrap_or(0),
+    )
+}
+
+fn system_stat() -> String {
+    let cpus: Vec<_> = (0..axconfig::SMP).map(stat::cpu_times).collect();
+    let line = |name: &str, (user, system, idle): (Duration, Duration, Duration)| {
+        format!(
+            "{} {} 0 {} {} 0 0 0 0 0 0\n",
+            name,
+            clock_ticks(user),
+            clock_ticks(system),
+            clock_ticks(idle),
+        )
+    };
+    let total = cpus.iter().fold(
+        (Duration::ZERO, Duration::ZERO, Duration::ZERO),
+        |total, cpu| (total.0 + cpu.0, total.1 + cpu.1, total.2 + cpu.2),
+    );
+    let mut stat = line("cpu ", total);
+    for (i, &cpu) in cpus.iter().enumerate() {
+        stat += &line(&format!("cpu{}", i), cpu);
+    }
+    let _ = write!(
+        stat,
+        "btime {}\nprocs_running {}\nprocs_blocked 0\n",
+        epochoffset_nanos() / NANOS_PER_SEC,
+        axtask::nr_running(),
+    );
+    stat
+}
+
+/// One line for each CPU with the time tasks waited for it and the
+/// timeslices, voluntary and involuntary switches and migrations of the tasks
+/// that ran on it.
+fn system_schedstat() -> String {
+    let mut schedstat = String::new();
+    for cpu in 0..axconfig::SMP {
+        let stat = axtask::cpu_sched_stat(cpu);
+        let _ = writeln!(
+            schedstat,
+            "cpu{} {} {} {} {} {}",
+            cpu,
+            stat.run_delay_nanos,
+            stat.timeslices,
+            stat.voluntary_switches,
+            stat.involuntary_switches,
+            stat.migrations,
+        );
+    }
+    schedstat
+}
+
+fn uptime() -> String {
+    let idle: Duration = (0..axconfig::SMP).map(|cpu| stat::cpu_times(cpu).2).sum();
+    format!(
+        "{} {}\n",
+        seconds(Duration::from_nanos(monotonic_time_nanos())),
+        seconds(idle)
+    )
+}
+
+fn page_cache() -> String {
+    let stats = axfs::page_cache::stats();
+    let lookups = stats.hits + stats.misses;
+    let hit_rate = if lookups == 0 {
+        0
+    } else {
+        stats.hits * 100 / lookups
+    };
+    format!(
+        "hits {}\nmisses {}\nhit_rate {}%\nevictions {}\nwritebacks {}\nreadahead {}\npages {}\ndirty {}\n",
+        stats.hits,
+        stats.misses,
+        hit_rate,
+        stats.evictions,
+        stats.writebacks,
+        stats.readahead,
+        stats.pages,
+        stats.dirty
+    )
+}
+
+/// One line of the contention statistics of each class of locks, then of the
+/// locks of the allocator, which only have the first two counts.
+///
+/// The acquisitions and the hold times are only measured with the `lockstat`
+/// feature, and are 0 otherwise.
+fn lock_stat() -> String {
+    let mut out =
+        String::from("class acquisitions contended spun slept handoffs wait_us max_hold_us\n");
+    for class in axsync::lock_classes() {
+        let stats = class.stats();
+        let _ = writeln!(
+            out,
+            "{} {} {} {} {} {} {} {}",
+            class.name(),
+            stats.acquisitions,
+            stats.contended,
+            stats.spun,
+            stats.slept,
+            stats.handoffs,
+            stats.wait_ns / 1000,
+            stats.max_hold_ns / 1000
+        );
+    }
+    for (name, stats) in axalloc::lock_stats() {
+        let _ = writeln!(
+            out,
+            "{} {} {} - - - - -",
+            name, stats.acquisitions, stats.contended
+        );
+    }
+    out
+}
+
+struct Source;
+
+impl ProcSource for Source {
+    fn lookup(&self, path: &str) -> Option<FileType> {
+        let mut parts = path.split('/');
+        match (parts.next()?, parts.next(), parts.next(), parts.next()) {
+            (name, None, ..) if ROOT_FILES.contains(&name) => Some(FileType::File),
+            (name, None, ..) | (name, Some("fd"), None, _) => {
+                process_of(name).map(|_| FileType::Dir)
+            }
+            (name, Some(file), None, _) if PROCESS_FILES.contains(&file) => {
+                process_of(name).map(|_| FileType::File)
+            }
+            (name, Some("fd"), Some(fd), None) => {
+                let fd: usize = fd.parse().ok()?;
+                let process = process_of(name)?;
+                open_files(&process)
+                    .iter()
+                    .any(|&(other, _)| other == fd)
+                    .then_some(FileType::SymLink)
+            }
+            _ => None,
+        }
+    }
+
+    fn read_dir(&self, path: &str) -> Vec<(String, FileType)> {
+        let entries = |names: &[&str], ty| {
+            names
+                .iter()
+                .map(move |&name| (String::from(name), ty))
+                .collect::<Vec<_>>()
+        };
+        if path.is_empty() {
+            let mut pids: Vec<Pid> = processes().iter().map(|process| process.pid()).collect();
+            pids.sort_unstable();
+            let mut list = entries(ROOT_FILES, FileType::File);
+            list.push((String::from("self"), FileType::Dir));
+            list.extend(pids.into_iter().map(|pid| (pid.to_string(), FileType::Dir)));
+            return list;
+        }
+        match path.split_once('/') {
+            None => {
+                let mut list = entries(PROCESS_FILES, FileType::File);
+                list.push((String::from("fd"), FileType::Dir));
+                list
+            }
+            Some((name, "fd")) => process_of(name).map_or(Vec::new(), |process| {
+                open_files(&process)
+                    .into_iter()
+                    .map(|(fd, _)| (fd.to_string(), FileType::SymLink))
+                    .collect()
+            }),
+            Some(_) => Vec::new(),
+        }
+    }
+
+    fn read(&self, path: &str) -> Option<Vec<u8>> {
+        let content = match path.split_once('/') {
+            None => match path {
+                "loadavg" => loadavg(),
+                "lock_stat" => lock_stat(),
+                "meminfo" => meminfo(),
+                "page_cache" => page_cache(),
+                "schedstat" => system_schedstat(),
+                "stat" => system_stat(),
+                "syscall_stats" => syscall_stats::report(),
+                "uptime" => uptime(),
+                _ => return None,
+            },
+            Some((name, file)) => {
+                let process = process_of(name)?;
+                match file.split_once('/') {
+                    None => match file {
+                        "maps" => process_maps(&process),
+                        "schedstat" => process_schedstat(&process),
+                        "stat" => process_stat(&process),
+                        "status" => process_status(&process),
+                        "syscall_stats" => data(&process).syscall_stats.report(),
+                        _ => return None,
+                    },
+                    Some(("fd", fd)) => {
+                        let fd: usize = fd.parse().ok()?;
+                        let (_, file) = open_files(&process)
+                            .into_iter()
+                            .find(|&(other, _)| other == fd)?;
+                        fd_target(file)
+                    }
+                    Some(_) => return None,
+                }
+            }
+        };
+        Some(content.into_bytes())
+    }
+}
+
+/// Generates the entries of `/proc` from now on.
+pub fn init() {
+    axfs::procfs::set_source(&Source);
+}
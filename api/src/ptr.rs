@@ -1,4 +1,9 @@
-use core::{alloc::Layout, ffi::c_char, mem::transmute, ptr, slice, str};
+use core::{
+    alloc::Layout,
+    ffi::c_char,
+    mem::{MaybeUninit, transmute},
+    ptr, slice, str,
+};
 
 use axerrno::{LinuxError, LinuxResult};
 use axhal::paging::MappingFlags;
@@ -13,7 +18,8 @@ fn check_region(start: VirtAddr, layout: Layout, access_flags: MappingFlags) ->
     }
 
     let task = current();
-    let mut aspace = task.task_ext().process_data().aspace.lock();
+    let aspace = task.task_ext().process_data().aspace();
+    let aspace = aspace.read();
 
     if !aspace.check_region_access(
         VirtAddrRange::from_start_size(start, layout.size()),
@@ -24,7 +30,7 @@ fn check_region(start: VirtAddr, layout: Layout, access_flags: MappingFlags) ->
 
     let page_start = start.align_down_4k();
     let page_end = (start + layout.size()).align_up_4k();
-    aspace.populate_area(page_start, page_end - page_start)?;
+    aspace.populate_area(page_start, page_end - page_start, access_flags)?;
 
     Ok(())
 }
@@ -45,21 +51,20 @@ fn check_null_terminated<T: PartialEq + Default>(
     let start = start.as_ptr_of::<T>();
     let mut len = 0;
 
+    // The address space is only read here and on page faults, so it is
+    // locked once for the whole string, even if the loop faults.
+    let task = current();
+    let aspace = task.task_ext().process_data().aspace();
+    let aspace = aspace.read();
+
     access_user_memory(|| {
         loop {
             // SAFETY: This won't overflow the address space since we'll check
             // it below.
             let ptr = unsafe { start.add(len) };
             while ptr as usize >= page.as_ptr() as usize {
-                // We cannot prepare `aspace` outside of the loop, since holding
-                // aspace requires a mutex which would be required on page
-                // fault, and page faults can trigger inside the loop.
-
-                // TODO: this is inefficient, but we have to do this instead of
-                // querying the page table since the page might has not been
-                // allocated yet.
-                let task = current();
-                let aspace = task.task_ext().process_data().aspace.lock();
+                // The pages are checked one by one, since the string may end
+                // before an inaccessible page.
                 if !aspace.check_region_access(
                     VirtAddrRange::from_start_size(page, PAGE_SIZE_4K),
                     access_flags,
@@ -83,6 +88,85 @@ fn check_null_terminated<T: PartialEq + Default>(
     Ok(len)
 }
 
+/// Checks that the user memory region is mapped with `access_flags`, without
+/// populating it.
+fn check_access(start: VirtAddr, len: usize, access_flags: MappingFlags) -> LinuxResult<()> {
+    if len == 0 {
+        return Ok(());
+    }
+    if start.as_usize().checked_add(len).is_none() {
+        return Err(LinuxError::EFAULT);
+    }
+    let task = current();
+    let aspace = task.task_ext().process_data().aspace();
+    if !aspace
+        .read()
+        .check_region_access(VirtAddrRange::from_start_size(start, len), access_flags)
+    {
+        return Err(LinuxError::EFAULT);
+    }
+    Ok(())
+}
+
+/// Copies `dst.len()` bytes from the user memory at `src`.
+///
+/// Unlike [`UserConstPtr::get_as_slice`], the pages are not populated in
+/// advance: the memory is accessed directly, and the pages that are not mapped
+/// yet are mapped by page faults on the way.
+pub fn copy_from_user(dst: &mut [u8], src: VirtAddr) -> LinuxResult<()> {
+    check_access(src, dst.len(), MappingFlags::READ)?;
+    access_user_memory(|| unsafe {
+        ptr::copy_nonoverlapping(src.as_ptr(), dst.as_mut_ptr(), dst.len())
+    });
+    Ok(())
+}
+
+/// Copies `src` to the user memory at `dst`.
+///
+/// See [`copy_from_user`] for how the memory is accessed.
+pub fn copy_to_user(dst: VirtAddr, src: &[u8]) -> LinuxResult<()> {
+    check_access(dst, src.len(), MappingFlags::WRITE)?;
+    access_user_memory(|| unsafe {
+        ptr::copy_nonoverlapping(src.as_ptr(), dst.as_mut_ptr(), src.len())
+    });
+    Ok(())
+}
+
+/// Copies the null-terminated string at `src` in user memory into `dst`,
+/// including the terminating null byte if it fits.
+///
+/// Returns the length of the string, or `dst.len()` if it is not terminated
+/// within `dst`.
+pub fn strncpy_from_user(dst: &mut [u8], src: VirtAddr) -> LinuxResult<usize> {
+    let task = current();
+    let aspace = task.task_ext().process_data().aspace();
+    // See `check_null_terminated` for why the lock is held while faulting.
+    let aspace = aspace.read();
+
+    let mut page = src.align_down_4k();
+    access_user_memory(|| {
+        for len in 0..dst.len() {
+            let addr = src + len;
+            if addr >= page {
+                if !aspace.check_region_access(
+                    VirtAddrRange::from_start_size(page, PAGE_SIZE_4K),
+                    MappingFlags::READ,
+                ) {
+                    return Err(LinuxError::EFAULT);
+                }
+                page += PAGE_SIZE_4K;
+            }
+            // SAFETY: The page has been checked above.
+            let ch = unsafe { addr.as_ptr().read_volatile() };
+            dst[len] = ch;
+            if ch == 0 {
+                return Ok(len);
+            }
+        }
+        Ok(dst.len())
+    })
+}
+
 /// A pointer to user space memory.
 #[repr(transparent)]
 #[derive(PartialEq, Clone, Copy)]
@@ -132,6 +216,19 @@ impl<T> UserPtr<T> {
         let len = check_null_terminated::<T>(self.address(), Self::ACCESS_FLAGS)?;
         Ok(unsafe { slice::from_raw_parts_mut(self.0, len) })
     }
+
+    /// Writes `value` to the pointer with [`copy_to_user`].
+    pub fn write(self, value: T) -> LinuxResult<()>
+    where
+        T: Copy,
+    {
+        if !self.0.is_aligned() {
+            return Err(LinuxError::EFAULT);
+        }
+        let bytes =
+            unsafe { slice::from_raw_parts(&value as *const T as *const u8, size_of::<T>()) };
+        copy_to_user(self.address(), bytes)
+    }
 }
 
 /// An immutable pointer to user space memory.
@@ -183,6 +280,21 @@ impl<T> UserConstPtr<T> {
         let len = check_null_terminated::<T>(self.address(), Self::ACCESS_FLAGS)?;
         Ok(unsafe { slice::from_raw_parts(self.0, len) })
     }
+
+    /// Reads the value at the pointer with [`copy_from_user`].
+    pub fn read(self) -> LinuxResult<T>
+    where
+        T: Copy,
+    {
+        if !self.0.is_aligned() {
+            return Err(LinuxError::EFAULT);
+        }
+        let mut value = MaybeUninit::<T>::uninit();
+        let bytes =
+            unsafe { slice::from_raw_parts_mut(value.as_mut_ptr() as *mut u8, size_of::<T>()) };
+        copy_from_user(bytes, self.address())?;
+        Ok(unsafe { value.assume_init() })
+    }
 }
 
 impl UserConstPtr<c_char> {
@@ -1,40 +1,58 @@
+use alloc::sync::Arc;
+
 use axerrno::{LinuxError, LinuxResult};
 use axhal::{
     arch::TrapFrame,
     trap::{POST_TRAP, register_trap_handler},
 };
 use axprocess::{Process, ProcessGroup, Thread};
-use axsignal::{SignalInfo, SignalOSAction, SignalSet};
+use axsignal::{SignalInfo, SignalOSAction, SignalSet, Signo};
 use axtask::{TaskExtRef, current};
-use starry_core::task::{ProcessData, ThreadData};
+use linux_raw_sys::general::{CLD_CONTINUED, CLD_STOPPED};
+use starry_core::task::{
+    ChildEventKind, ProcessData, ThreadData, get_process, notify_process_signal,
+};
 
 use crate::do_exit;
 
 pub fn check_signals(tf: &mut TrapFrame, restore_blocked: Option<SignalSet>) -> bool {
-    let Some((sig, os_action)) = current()
-        .task_ext()
-        .thread_data()
-        .signal
-        .check_signals(tf, restore_blocked)
-    else {
+    let Some((sig, os_action)) = ({
+        let curr = current();
+        let thr_data = curr.task_ext().thread_data();
+        thr_data.sync_blocked();
+        let res = thr_data.signal.check_signals(tf, restore_blocked);
+        if res.is_some() {
+            // The handler runs with its own mask.
+            thr_data.reload_blocked();
+        }
+        res
+    }) else {
         return false;
     };
 
     let signo = sig.signo();
+    // A thread killed by `execve` in another thread exits alone.
+    let group_exit = {
+        let curr = current();
+        let tid = curr.task_ext().thread.tid();
+        !curr.task_ext().process_data().is_exec_by_other(tid)
+    };
     match os_action {
         SignalOSAction::Terminate => {
-            do_exit(128 + signo as i32, true);
+            do_exit(128 + signo as i32, group_exit);
         }
         SignalOSAction::CoreDump => {
             // TODO: implement core dump
-            do_exit(128 + signo as i32, true);
+            do_exit(128 + signo as i32, group_exit);
         }
         SignalOSAction::Stop => {
-            // TODO: implement stop
-            do_exit(1, true);
+            let process = curr_process();
+            if process.data::<ProcessData>().unwrap().stop() {
+                notify_parent(&process, ChildEventKind::Stopped(signo), CLD_STOPPED);
+            }
         }
         SignalOSAction::Continue => {
-            // TODO: implement continue
+            // The process is resumed when the signal is sent.
         }
         SignalOSAction::Handler => {
             // do nothing
@@ -43,30 +61,125 @@ pub fn check_signals(tf: &mut TrapFrame, restore_blocked: Option<SignalSet>) ->
     true
 }
 
+fn curr_process() -> Arc<Process> {
+    current().task_ext().thread.process().clone()
+}
+
+/// Records a job control stop or continue of `process` for its parent, and
+/// sends it `SIGCHLD`.
+fn notify_parent(process: &Arc<Process>, kind: ChildEventKind, code: u32) {
+    let Some(parent) = process.parent() else {
+        return;
+    };
+    if let Some(data) = parent.data::<ProcessData>() {
+        data.push_child_event(process, kind);
+    }
+    let _ = send_signal_process(&parent, SignalInfo::new(Signo::SIGCHLD, code as _));
+}
+
+/// Resumes `proc` if it is stopped, when it is sent `signo`. `SIGCONT`
+/// continues it, while `SIGKILL` only wakes its threads up to be killed.
+fn resume_process(proc: &Process, signo: Signo) {
+    if !matches!(signo, Signo::SIGCONT | Signo::SIGKILL) {
+        return;
+    }
+    let Some(data) = proc.data::<ProcessData>() else {
+        return;
+    };
+    if data.resume() && signo == Signo::SIGCONT {
+        if let Ok(proc) = get_process(proc.pid()) {
+            notify_parent(&proc, ChildEventKind::Continued, CLD_CONTINUED);
+        }
+    }
+}
+
+/// Whether the current thread has a pending signal that is not blocked.
+pub fn have_signals() -> bool {
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    thr_data.signal.pending().dequeue(&!thr_data.blocked()).is_some()
+}
+
+/// Runs `f` with the signal mask of the current thread temporarily replaced
+/// by `mask`, as `ppoll`, `pselect6` and `epoll_pwait` do.
+///
+/// If `f` is interrupted by a signal, the signal is delivered while `mask` is
+/// still in effect, and the original mask is restored on return from the
+/// handler.
+pub fn with_sigmask(
+    tf: &mut TrapFrame,
+    mask: Option<SignalSet>,
+    f: impl FnOnce() -> LinuxResult<isize>,
+) -> LinuxResult<isize> {
+    let Some(mut mask) = mask else {
+        return f();
+    };
+    mask.remove(Signo::SIGKILL);
+    mask.remove(Signo::SIGSTOP);
+
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    let old_blocked = thr_data.set_blocked(mask);
+    // Senders may look at the mask while `f` sleeps.
+    thr_data.sync_blocked();
+
+    let res = f();
+    if matches!(res, Err(LinuxError::EINTR)) {
+        tf.set_retval(-LinuxError::EINTR.code() as usize);
+        if check_signals(tf, Some(old_blocked)) {
+            // Keep the registers set up for the handler.
+            return Ok(tf.retval() as isize);
+        }
+    }
+    thr_data.set_blocked(old_blocked);
+    res
+}
+
 #[register_trap_handler(POST_TRAP)]
 fn post_trap_callback(tf: &mut TrapFrame, from_user: bool) {
     if !from_user {
         return;
     }
 
-    check_signals(tf, None);
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    // Most returns have no signal to handle, and skip the signal managers.
+    let mut signal_hint = thr_data.take_signal_hint();
+    // Critical sections are aborted before a signal handler runs, too.
+    signal_hint |= crate::rseq_on_return(tf, signal_hint);
+    if signal_hint && check_signals(tf, None) {
+        // There may be more.
+        thr_data.mark_signal_pending();
+    }
+    // All the threads of a stopped process stop on their way back to user
+    // space, and then handle the signal that resumed them, if any.
+    let proc_data = curr.task_ext().process_data();
+    if proc_data.is_stopped() {
+        proc_data.wait_while_stopped();
+        check_signals(tf, None);
+    }
 }
 
 pub fn send_signal_thread(thr: &Thread, sig: SignalInfo) -> LinuxResult<()> {
     info!("Send signal {:?} to thread {}", sig.signo(), thr.tid());
-    let Some(thr) = thr.data::<ThreadData>() else {
+    let Some(data) = thr.data::<ThreadData>() else {
         return Err(LinuxError::EPERM);
     };
-    thr.signal.send_signal(sig);
+    let signo = sig.signo();
+    data.send_signal(sig);
+    resume_process(thr.process(), signo);
     Ok(())
 }
 
 pub fn send_signal_process(proc: &Process, sig: SignalInfo) -> LinuxResult<()> {
     info!("Send signal {:?} to process {}", sig.signo(), proc.pid());
-    let Some(proc) = proc.data::<ProcessData>() else {
+    let Some(data) = proc.data::<ProcessData>() else {
         return Err(LinuxError::EPERM);
     };
-    proc.signal.send_signal(sig);
+    let signo = sig.signo();
+    data.signal.send_signal(sig);
+    notify_process_signal();
+    resume_process(proc, signo);
     Ok(())
 }
 
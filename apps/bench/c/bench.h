@@ -0,0 +1,60 @@
+// Helpers shared by the benchmarks.
+//
+// Every result is printed on its own line as
+//
+//   bench: <name> <value> <unit>
+//
+// so that the results of different commits can be compared by a script.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ROUNDS 5
+
+static inline long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static inline void report(const char *name, long value, const char *unit) {
+  printf("bench: %s %ld %s\n", name, value, unit);
+  fflush(stdout);
+}
+
+static inline void die(const char *what) {
+  perror(what);
+  exit(1);
+}
+
+// Returns the best average latency of `iters` calls to `f` over a few rounds,
+// in nanoseconds.
+static inline long measure(void (*f)(void), int iters) {
+  long best = -1;
+  for (int round = 0; round < ROUNDS; round++) {
+    long start = now_ns();
+    for (int i = 0; i < iters; i++)
+      f();
+    long avg = (now_ns() - start) / iters;
+    if (best < 0 || avg < best)
+      best = avg;
+  }
+  return best;
+}
+
+// Returns the best bandwidth of `f`, which moves `bytes` bytes each call, over
+// a few rounds, in MB/s.
+static inline long measure_bandwidth(void (*f)(void), long bytes) {
+  long best = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    long start = now_ns();
+    f();
+    long elapsed = now_ns() - start;
+    // Bytes per microsecond are MB/s.
+    long bandwidth = bytes * 1000 / (elapsed > 0 ? elapsed : 1);
+    if (bandwidth > best)
+      best = bandwidth;
+  }
+  return best;
+}
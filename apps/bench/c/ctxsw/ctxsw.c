@@ -0,0 +1,91 @@
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define ITERS 1000
+
+// Pipes to the child and back to the parent.
+static int to_child[2], to_parent[2];
+
+static void pipe_round_trip(void) {
+  char c = 0;
+  if (write(to_child[1], &c, 1) != 1 || read(to_parent[0], &c, 1) != 1)
+    die("pipe");
+}
+
+// Each round trip switches to the child and back.
+static long pipe_ctxsw(void) {
+  if (pipe(to_child) < 0 || pipe(to_parent) < 0)
+    die("pipe");
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    char c;
+    close(to_child[1]);
+    while (read(to_child[0], &c, 1) == 1)
+      write(to_parent[1], &c, 1);
+    _exit(0);
+  }
+  long ns = measure(pipe_round_trip, ITERS) / 2;
+  close(to_child[1]);
+  waitpid(pid, NULL, 0);
+  close(to_child[0]);
+  close(to_parent[0]);
+  close(to_parent[1]);
+  return ns;
+}
+
+// Whose turn it is, 0 for the main thread and 1 for the other, or 2 to stop.
+static atomic_int turn;
+
+static void futex_wait(atomic_int *addr, int val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void *futex_partner(void *arg) {
+  (void)arg;
+  for (;;) {
+    int val;
+    while ((val = atomic_load(&turn)) == 0)
+      futex_wait(&turn, 0);
+    if (val == 2)
+      return NULL;
+    atomic_store(&turn, 0);
+    futex_wake(&turn);
+  }
+}
+
+static void futex_round_trip(void) {
+  atomic_store(&turn, 1);
+  futex_wake(&turn);
+  while (atomic_load(&turn) == 1)
+    futex_wait(&turn, 1);
+}
+
+static long futex_ctxsw(void) {
+  pthread_t thread;
+  atomic_store(&turn, 0);
+  if (pthread_create(&thread, NULL, futex_partner, NULL) != 0)
+    die("pthread_create");
+  long ns = measure(futex_round_trip, ITERS) / 2;
+  atomic_store(&turn, 2);
+  futex_wake(&turn);
+  pthread_join(thread, NULL);
+  return ns;
+}
+
+int main(void) {
+  report("ctxsw_pipe", pipe_ctxsw(), "ns");
+  report("ctxsw_futex", futex_ctxsw(), "ns");
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define CHUNK (64 * 1024)
+#define PIPE_TOTAL (8 * 1024 * 1024)
+#define FILE_SIZE (4 * 1024 * 1024)
+#define FILE_PATH "bench_io.tmp"
+
+static char buf[CHUNK];
+
+// The pipe to ask the writer for data, and the one it writes to.
+static int request[2], data[2];
+
+static void pipe_transfer(void) {
+  char c = 0;
+  if (write(request[1], &c, 1) != 1)
+    die("write");
+  long total = 0;
+  while (total < PIPE_TOTAL) {
+    long n = read(data[0], buf, CHUNK);
+    if (n <= 0)
+      die("read");
+    total += n;
+  }
+}
+
+static long pipe_bandwidth(void) {
+  if (pipe(request) < 0 || pipe(data) < 0)
+    die("pipe");
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    char c;
+    close(request[1]);
+    close(data[0]);
+    while (read(request[0], &c, 1) == 1) {
+      for (long total = 0; total < PIPE_TOTAL; total += CHUNK)
+        write(data[1], buf, CHUNK);
+    }
+    _exit(0);
+  }
+  close(request[0]);
+  close(data[1]);
+  long bandwidth = measure_bandwidth(pipe_transfer, PIPE_TOTAL);
+  close(request[1]);
+  waitpid(pid, NULL, 0);
+  close(data[0]);
+  return bandwidth;
+}
+
+static int file_fd;
+
+static void file_read(void) {
+  if (lseek(file_fd, 0, SEEK_SET) < 0)
+    die("lseek");
+  while (read(file_fd, buf, CHUNK) > 0)
+    ;
+}
+
+// Reads a file that is in the page cache, since it was just written.
+static long file_read_bandwidth(void) {
+  file_fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (file_fd < 0)
+    die("open");
+  for (long total = 0; total < FILE_SIZE; total += CHUNK) {
+    if (write(file_fd, buf, CHUNK) != CHUNK)
+      die("write");
+  }
+  long bandwidth = measure_bandwidth(file_read, FILE_SIZE);
+  close(file_fd);
+  unlink(FILE_PATH);
+  return bandwidth;
+}
+
+int main(void) {
+  report("pipe_bandwidth", pipe_bandwidth(), "MB/s");
+  report("file_read_bandwidth", file_read_bandwidth(), "MB/s");
+  return 0;
+}
@@ -0,0 +1,45 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define ITERS 1000
+// The size of the mappings that are faulted in.
+#define FAULT_PAGES 256
+
+static long page_size;
+
+static void map_unmap(void) {
+  void *p = mmap(NULL, 16 * page_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    die("mmap");
+  munmap(p, 16 * page_size);
+}
+
+// Touches every page of a fresh anonymous mapping.
+static long page_faults(void) {
+  long best = -1;
+  for (int round = 0; round < ROUNDS; round++) {
+    long size = FAULT_PAGES * page_size;
+    char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      die("mmap");
+    long start = now_ns();
+    for (long off = 0; off < size; off += page_size)
+      p[off] = 1;
+    long avg = (now_ns() - start) / FAULT_PAGES;
+    munmap(p, size);
+    if (best < 0 || avg < best)
+      best = avg;
+  }
+  return best;
+}
+
+int main(void) {
+  page_size = sysconf(_SC_PAGESIZE);
+  report("mmap_munmap", measure(map_unmap, ITERS), "ns");
+  report("page_fault", page_faults(), "ns");
+  return 0;
+}
@@ -0,0 +1,40 @@
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define ITERS 100
+
+static char *self;
+
+static void fork_exit(void) {
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0)
+    _exit(0);
+  waitpid(pid, NULL, 0);
+}
+
+static void fork_exec(void) {
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    char *args[] = {self, "exit", NULL};
+    execv(self, args);
+    _exit(1);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[]) {
+  // Run by `fork_exec`.
+  if (argc > 1 && strcmp(argv[1], "exit") == 0)
+    return 0;
+  self = argv[0];
+  report("fork_exit", measure(fork_exit, ITERS), "ns");
+  report("fork_exec", measure(fork_exec, ITERS), "ns");
+  return 0;
+}
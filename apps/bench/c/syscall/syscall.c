@@ -0,0 +1,25 @@
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define ITERS 10000
+
+// The cheapest syscall, as in lmbench.
+static void null_syscall(void) { syscall(SYS_getppid); }
+
+static void getpid_syscall(void) { syscall(SYS_getpid); }
+
+// A cheap syscall that also copies its result to user memory.
+static void gettime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+int main(void) {
+  report("null_syscall", measure(null_syscall, ITERS), "ns");
+  report("getpid", measure(getpid_syscall, ITERS), "ns");
+  report("clock_gettime", measure(gettime, ITERS), "ns");
+  return 0;
+}
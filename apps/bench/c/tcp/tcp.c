@@ -0,0 +1,65 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+#define ITERS 500
+#define PORT 8765
+
+static int sock;
+
+static void round_trip(void) {
+  char c = 0;
+  if (write(sock, &c, 1) != 1 || read(sock, &c, 1) != 1)
+    die("tcp");
+}
+
+// The latency of a one-byte request and its reply over the loopback.
+static long tcp_latency(void) {
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(PORT),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  int one = 1;
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0)
+    die("socket");
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, 1) < 0)
+    die("bind");
+
+  pid_t pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    char c;
+    int conn = accept(listener, NULL, NULL);
+    if (conn < 0)
+      die("accept");
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    while (read(conn, &c, 1) == 1)
+      write(conn, &c, 1);
+    _exit(0);
+  }
+  close(listener);
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    die("connect");
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  long ns = measure(round_trip, ITERS);
+  close(sock);
+  waitpid(pid, NULL, 0);
+  return ns;
+}
+
+int main(void) {
+  report("tcp_latency", tcp_latency(), "ns");
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NR_THREADS 3
+
+static void *sleeper(void *arg)
+{
+    (void)arg;
+    for (;;)
+        sleep(1);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "exec") == 0) {
+        printf("test_exec_threads ok\n");
+        return 0;
+    }
+    pthread_t threads[NR_THREADS];
+    for (int i = 0; i < NR_THREADS; i++)
+        pthread_create(&threads[i], NULL, sleeper, NULL);
+    // The other threads are killed, and the process goes on with the new
+    // program.
+    char *args[] = {argv[0], "exec", NULL};
+    execv(argv[0], args);
+    perror("test_exec_threads failed: execv");
+    return 1;
+}
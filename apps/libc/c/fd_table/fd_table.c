@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NR_FILES 3000
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC 4
+#endif
+
+static void test_grow() {
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  int ok = limit.rlim_cur == 1024;
+  limit.rlim_cur = 4096;
+  ok &= setrlimit(RLIMIT_NOFILE, &limit) == 0;
+
+  // The table grows past its initial size, handing out the lowest free fd.
+  for (int fd = 3; fd < NR_FILES; fd++)
+    ok &= dup(0) == fd;
+  close(1000);
+  ok &= dup(0) == 1000;
+  for (int fd = 3; fd < NR_FILES; fd++)
+    close(fd);
+  ok &= dup(0) == 3;
+  close(3);
+  if (ok)
+    puts("test_grow ok");
+}
+
+static void test_limit() {
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = 8;
+  int ok = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+
+  for (int fd = 3; fd < 8; fd++)
+    ok &= dup(0) == fd;
+  ok &= dup(0) == -1 && errno == EMFILE;
+  ok &= dup2(0, 8) == -1 && errno == EBADF;
+  limit.rlim_cur = limit.rlim_max + 1;
+  ok &= setrlimit(RLIMIT_NOFILE, &limit) == -1 && errno == EINVAL;
+  for (int fd = 3; fd < 8; fd++)
+    close(fd);
+  limit.rlim_cur = 1024;
+  ok &= setrlimit(RLIMIT_NOFILE, &limit) == 0;
+  if (ok)
+    puts("test_limit ok");
+}
+
+// The child shares the table of its parent until either modifies it, which
+// must not be visible to the other.
+static void test_fork() {
+  int ok = dup(0) == 3;
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(3);
+    dup2(0, 5);
+    _exit(dup(0) == 3 ? 0 : 1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  ok &= dup(0) == 4;
+  ok &= close(5) == -1 && errno == EBADF;
+  close(3);
+  close(4);
+  if (ok)
+    puts("test_fork ok");
+}
+
+static int cloexec(int fd) { return fcntl(fd, F_GETFD) == FD_CLOEXEC; }
+
+static void test_cloexec() {
+  int fds[2];
+  int ok = pipe2(fds, O_CLOEXEC) == 0;
+  ok &= cloexec(fds[0]) && cloexec(fds[1]);
+  ok &= fcntl(fds[0], F_SETFD, 0) == 0 && !cloexec(fds[0]);
+  // The flag belongs to the descriptor, not to the file.
+  ok &= dup3(fds[1], 10, O_CLOEXEC) == 10 && cloexec(10);
+  ok &= dup2(fds[1], 10) == 10 && !cloexec(10);
+  ok &= dup3(10, 10, 0) == -1 && errno == EINVAL;
+  ok &= fcntl(fds[0], F_DUPFD_CLOEXEC, 0) == 5 && cloexec(5);
+  ok &= fcntl(20, F_GETFD) == -1 && errno == EBADF;
+
+  ok &= syscall(SYS_close_range, 3, 10, CLOSE_RANGE_CLOEXEC) == 0;
+  ok &= cloexec(fds[0]) && cloexec(10);
+  ok &= syscall(SYS_close_range, 3, ~0U, 0) == 0;
+  ok &= close(fds[0]) == -1 && close(10) == -1 && close(5) == -1;
+  ok &= fcntl(0, F_GETFD) == 0;
+  if (ok)
+    puts("test_cloexec ok");
+}
+
+// Duplicated descriptors share the cursor and the status flags of their
+// open file description.
+static void test_description() {
+  int fd = open("fd_table.tmp", O_CREAT | O_RDWR | O_TRUNC, 0644);
+  int ok = fd >= 0 && write(fd, "abc", 3) == 3;
+  int dup_fd = dup(fd);
+  ok &= lseek(dup_fd, 0, SEEK_CUR) == 3;
+  ok &= fcntl(fd, F_SETFL, O_APPEND) == 0;
+  ok &= (fcntl(dup_fd, F_GETFL) & (O_APPEND | O_ACCMODE)) == (O_APPEND | O_RDWR);
+  ok &= lseek(fd, 0, SEEK_SET) == 0;
+  ok &= write(dup_fd, "de", 2) == 2 && lseek(fd, 0, SEEK_CUR) == 5;
+  char buf[8] = {0};
+  ok &= pread(fd, buf, sizeof(buf), 0) == 5 && strcmp(buf, "abcde") == 0;
+  close(fd);
+  close(dup_fd);
+  unlink("fd_table.tmp");
+  if (ok)
+    puts("test_description ok");
+}
+
+int main() {
+  test_grow();
+  test_limit();
+  test_fork();
+  test_cloexec();
+  test_description();
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The uapi definitions are spelled out, as the toolchain headers may predate
+// the opcodes used here.
+#define IORING_SETUP_SQPOLL 2
+#define IORING_ENTER_GETEVENTS 1
+#define IORING_ENTER_SQ_WAKEUP 2
+#define IORING_SQ_NEED_WAKEUP 1
+#define IORING_OFF_SQ_RING 0ULL
+#define IORING_OFF_SQES 0x10000000ULL
+#define IORING_OP_NOP 0
+#define IORING_OP_READ 22
+#define IORING_OP_WRITE 23
+
+struct sqe {
+  uint8_t opcode;
+  uint8_t flags;
+  uint16_t ioprio;
+  int32_t fd;
+  uint64_t off;
+  uint64_t addr;
+  uint32_t len;
+  uint32_t op_flags;
+  uint64_t user_data;
+  uint64_t pad[3];
+};
+
+struct cqe {
+  uint64_t user_data;
+  int32_t res;
+  uint32_t flags;
+};
+
+struct params {
+  uint32_t sq_entries, cq_entries, flags, sq_thread_cpu, sq_thread_idle;
+  uint32_t features, wq_fd, resv[3];
+  uint32_t sq_off[10];
+  uint32_t cq_off[10];
+};
+
+struct ring {
+  int fd;
+  volatile uint32_t *sq_tail, *sq_flags, *sq_array, *cq_head, *cq_tail;
+  uint32_t sq_mask, cq_mask;
+  struct sqe *sqes;
+  struct cqe *cqes;
+};
+
+static int setup(struct ring *ring, unsigned flags) {
+  struct params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = flags;
+  ring->fd = syscall(SYS_io_uring_setup, 8, &p);
+  if (ring->fd < 0)
+    return -1;
+  size_t size = p.sq_off[6] + p.sq_entries * 4;
+  size_t cq_size = p.cq_off[5] + p.cq_entries * sizeof(struct cqe);
+  if (cq_size > size)
+    size = cq_size;
+  char *rings = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd,
+                     IORING_OFF_SQ_RING);
+  ring->sqes = mmap(0, p.sq_entries * sizeof(struct sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, ring->fd, IORING_OFF_SQES);
+  if (rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+    return -1;
+  ring->sq_tail = (uint32_t *)(rings + p.sq_off[1]);
+  ring->sq_mask = *(uint32_t *)(rings + p.sq_off[2]);
+  ring->sq_flags = (uint32_t *)(rings + p.sq_off[4]);
+  ring->sq_array = (uint32_t *)(rings + p.sq_off[6]);
+  ring->cq_head = (uint32_t *)(rings + p.cq_off[0]);
+  ring->cq_tail = (uint32_t *)(rings + p.cq_off[1]);
+  ring->cq_mask = *(uint32_t *)(rings + p.cq_off[2]);
+  ring->cqes = (struct cqe *)(rings + p.cq_off[5]);
+  return 0;
+}
+
+static void push(struct ring *ring, int opcode, int fd, void *buf, unsigned len,
+                 uint64_t user_data) {
+  uint32_t tail = *ring->sq_tail;
+  uint32_t index = tail & ring->sq_mask;
+  struct sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = (uint64_t)-1;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Reaps one completion, spinning on the completion ring.
+static struct cqe reap(struct ring *ring) {
+  uint32_t head = *ring->cq_head;
+  while (__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == head)
+    sched_yield();
+  struct cqe cqe = ring->cqes[head & ring->cq_mask];
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+  return cqe;
+}
+
+void test_batch() {
+  struct ring ring;
+  int fds[2];
+  char out[] = "hello", in[8] = {0};
+  if (setup(&ring, 0) < 0 || pipe(fds) < 0) {
+    puts("test_batch failed");
+    return;
+  }
+  push(&ring, IORING_OP_WRITE, fds[1], out, 5, 1);
+  push(&ring, IORING_OP_READ, fds[0], in, 5, 2);
+  push(&ring, IORING_OP_NOP, -1, NULL, 0, 3);
+  int submitted = syscall(SYS_io_uring_enter, ring.fd, 3, 3,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+  int ok = submitted == 3;
+  for (int i = 0; i < 3; i++) {
+    struct cqe cqe = reap(&ring);
+    ok &= cqe.res == (cqe.user_data == 3 ? 0 : 5);
+  }
+  if (ok && strcmp(in, "hello") == 0)
+    puts("test_batch ok");
+  close(ring.fd);
+}
+
+void test_bad_fd() {
+  struct ring ring;
+  if (setup(&ring, 0) < 0) {
+    puts("test_bad_fd failed");
+    return;
+  }
+  push(&ring, IORING_OP_READ, 1000, NULL, 0, 7);
+  syscall(SYS_io_uring_enter, ring.fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  struct cqe cqe = reap(&ring);
+  if (cqe.user_data == 7 && cqe.res < 0)
+    puts("test_bad_fd ok");
+  close(ring.fd);
+}
+
+// Submits and reaps without entering the kernel, unless the polling worker
+// has gone to sleep.
+void test_sqpoll() {
+  struct ring ring;
+  if (setup(&ring, IORING_SETUP_SQPOLL) < 0) {
+    puts("test_sqpoll failed");
+    return;
+  }
+  int ok = 1;
+  for (int i = 0; i < 16; i++) {
+    push(&ring, IORING_OP_NOP, -1, NULL, 0, i);
+    if (__atomic_load_n(ring.sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+      syscall(SYS_io_uring_enter, ring.fd, 0, 0, IORING_ENTER_SQ_WAKEUP, NULL,
+              0);
+    struct cqe cqe = reap(&ring);
+    ok &= cqe.user_data == (uint64_t)i && cqe.res == 0;
+  }
+  if (ok)
+    puts("test_sqpoll ok");
+  close(ring.fd);
+}
+
+int main() {
+  test_batch();
+  test_bad_fd();
+  test_sqpoll();
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static long elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+static void test_abstime(void)
+{
+    struct timespec start, deadline, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    deadline.tv_nsec += 50000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    int ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret != 0 || elapsed_ns(&deadline, &end) < 0) {
+        printf("test_abstime failed: ret=%d\n", ret);
+        exit(1);
+    }
+    // A deadline in the past returns at once.
+    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start, NULL);
+    if (ret != 0) {
+        printf("test_abstime failed: past deadline ret=%d\n", ret);
+        exit(1);
+    }
+    printf("test_abstime ok\n");
+}
+
+static void handler(int sig) { (void)sig; }
+
+static void test_eintr(void)
+{
+    struct sigaction sa = {.sa_handler = handler};
+    sigaction(SIGUSR1, &sa, NULL);
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid == 0) {
+        usleep(100000);
+        kill(parent, SIGUSR1);
+        _exit(0);
+    }
+    struct timespec req = {.tv_sec = 5}, rem = {0};
+    int ret = nanosleep(&req, &rem);
+    waitpid(pid, NULL, 0);
+    if (ret != -1 || errno != EINTR || rem.tv_sec <= 0 || rem.tv_sec >= 5) {
+        printf("test_eintr failed: ret=%d errno=%d rem=%ld\n", ret, errno, (long)rem.tv_sec);
+        exit(1);
+    }
+    printf("test_eintr ok\n");
+}
+
+int main(void)
+{
+    test_abstime();
+    test_eintr();
+    return 0;
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct sched_attr_v0 {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+static void test_nice() {
+  int ok = getpriority(PRIO_PROCESS, 0) == 0;
+  ok &= setpriority(PRIO_PROCESS, 0, 5) == 0;
+  ok &= getpriority(PRIO_PROCESS, 0) == 5;
+  ok &= getpriority(PRIO_PROCESS, gettid()) == 5;
+
+  // Children inherit the nice value.
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(getpriority(PRIO_PROCESS, 0) == 5 ? 0 : 1);
+  int status;
+  ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0;
+
+  // Out of range values are clamped.
+  ok &= setpriority(PRIO_PROCESS, 0, 100) == 0;
+  ok &= getpriority(PRIO_PROCESS, 0) == 19;
+  ok &= setpriority(PRIO_PROCESS, 0, 0) == 0;
+  ok &= setpriority(3, 0, 0) == -1;
+  if (ok)
+    puts("test_nice ok");
+}
+
+static void test_sched_attr() {
+  struct sched_attr_v0 attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_policy = SCHED_BATCH;
+  attr.sched_nice = 3;
+  int ok = syscall(SYS_sched_setattr, 0, &attr, 0) == 0;
+
+  memset(&attr, 0, sizeof(attr));
+  ok &= syscall(SYS_sched_getattr, 0, &attr, sizeof(attr), 0) == 0;
+  ok &= attr.size == sizeof(attr) && attr.sched_policy == SCHED_BATCH &&
+        attr.sched_nice == 3;
+  ok &= getpriority(PRIO_PROCESS, 0) == 3;
+
+  attr.sched_policy = SCHED_OTHER;
+  attr.sched_nice = 0;
+  ok &= syscall(SYS_sched_setattr, 0, &attr, 0) == 0;
+  ok &= getpriority(PRIO_PROCESS, 0) == 0;
+  ok &= syscall(SYS_sched_getattr, 0, &attr, 8, 0) == -1;
+  if (ok)
+    puts("test_sched_attr ok");
+}
+
+static void test_affinity() {
+  cpu_set_t orig, set;
+  int ok = sched_getaffinity(0, sizeof(orig), &orig) == 0;
+  ok &= CPU_ISSET(0, &orig);
+
+  CPU_ZERO(&set);
+  CPU_SET(0, &set);
+  ok &= sched_setaffinity(0, sizeof(set), &set) == 0;
+  CPU_ZERO(&set);
+  ok &= sched_getaffinity(0, sizeof(set), &set) == 0;
+  ok &= CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set);
+
+  // Children inherit the affinity.
+  pid_t pid = fork();
+  if (pid == 0) {
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    _exit(CPU_COUNT(&set) == 1 ? 0 : 1);
+  }
+  int status;
+  ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0;
+
+  CPU_ZERO(&set);
+  ok &= sched_setaffinity(0, sizeof(set), &set) == -1;
+  ok &= sched_setaffinity(0, sizeof(orig), &orig) == 0;
+  if (ok)
+    puts("test_affinity ok");
+}
+
+// musl does not implement these, leaving them to the threads library.
+static int setscheduler(int policy, int priority) {
+  struct sched_param param = {.sched_priority = priority};
+  return syscall(SYS_sched_setscheduler, 0, policy, &param);
+}
+
+static int getscheduler() { return syscall(SYS_sched_getscheduler, 0); }
+
+static void test_rt() {
+  int ok = sched_get_priority_max(SCHED_FIFO) == 99;
+  ok &= sched_get_priority_min(SCHED_RR) == 1;
+  ok &= sched_get_priority_max(SCHED_OTHER) == 0;
+
+  ok &= setscheduler(SCHED_FIFO, 50) == 0;
+  ok &= getscheduler() == SCHED_FIFO;
+  struct sched_param param = {.sched_priority = 0};
+  ok &= syscall(SYS_sched_getparam, 0, &param) == 0 &&
+        param.sched_priority == 50;
+
+  // Children inherit the policy.
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(getscheduler() == SCHED_FIFO ? 0 : 1);
+  int status;
+  ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0;
+
+  param.sched_priority = 20;
+  ok &= syscall(SYS_sched_setparam, 0, &param) == 0;
+  ok &= setscheduler(SCHED_RR, 20) == 0;
+  ok &= getscheduler() == SCHED_RR;
+  ok &= setscheduler(SCHED_FIFO, 100) == -1;
+  ok &= setscheduler(SCHED_OTHER, 1) == -1;
+
+  ok &= setscheduler(SCHED_OTHER, 0) == 0;
+  ok &= getscheduler() == SCHED_OTHER;
+  if (ok)
+    puts("test_rt ok");
+}
+
+int main() {
+  test_nice();
+  test_sched_attr();
+  test_affinity();
+  test_rt();
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t alarms;
+static volatile sig_atomic_t last_value;
+
+static void alarm_handler(int sig) { (void)sig; alarms++; }
+
+static void timer_handler(int sig, siginfo_t *info, void *ctx)
+{
+    (void)sig;
+    (void)ctx;
+    if (info->si_code == SI_TIMER)
+        last_value = info->si_value.sival_int;
+    alarms++;
+}
+
+static void wait_alarms(int count)
+{
+    // Bounded, so that a lost signal fails the test instead of hanging.
+    for (int i = 0; i < 200 && alarms < count; i++)
+        usleep(10000);
+}
+
+static void test_setitimer(void)
+{
+    struct sigaction sa = {.sa_handler = alarm_handler};
+    sigaction(SIGALRM, &sa, NULL);
+    alarms = 0;
+    struct itimerval value = {
+        .it_interval = {.tv_usec = 20000},
+        .it_value = {.tv_usec = 20000},
+    };
+    if (setitimer(ITIMER_REAL, &value, NULL) != 0) {
+        perror("setitimer");
+        exit(1);
+    }
+    wait_alarms(3);
+    struct itimerval old;
+    memset(&value, 0, sizeof(value));
+    setitimer(ITIMER_REAL, &value, &old);
+    if (alarms < 3 || old.it_interval.tv_usec != 20000) {
+        printf("test_setitimer failed: alarms=%d\n", (int)alarms);
+        exit(1);
+    }
+    getitimer(ITIMER_REAL, &old);
+    if (old.it_value.tv_sec != 0 || old.it_value.tv_usec != 0) {
+        printf("test_setitimer failed: not disarmed\n");
+        exit(1);
+    }
+    printf("test_setitimer ok\n");
+}
+
+static void test_posix_timer(void)
+{
+    struct sigaction sa = {.sa_sigaction = timer_handler, .sa_flags = SA_SIGINFO};
+    sigaction(SIGUSR1, &sa, NULL);
+    alarms = 0;
+    struct sigevent sev = {
+        .sigev_notify = SIGEV_SIGNAL,
+        .sigev_signo = SIGUSR1,
+        .sigev_value.sival_int = 42,
+    };
+    timer_t timer;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) != 0) {
+        perror("timer_create");
+        exit(1);
+    }
+    struct itimerspec its = {.it_value = {.tv_nsec = 30000000}};
+    timer_settime(timer, 0, &its, NULL);
+    struct itimerspec curr;
+    timer_gettime(timer, &curr);
+    if (curr.it_value.tv_sec != 0 || curr.it_value.tv_nsec == 0) {
+        printf("test_posix_timer failed: not armed\n");
+        exit(1);
+    }
+    wait_alarms(1);
+    if (alarms != 1 || last_value != 42) {
+        printf("test_posix_timer failed: alarms=%d value=%d\n", (int)alarms, (int)last_value);
+        exit(1);
+    }
+    timer_gettime(timer, &curr);
+    if (curr.it_value.tv_sec != 0 || curr.it_value.tv_nsec != 0) {
+        printf("test_posix_timer failed: still armed\n");
+        exit(1);
+    }
+    if (timer_delete(timer) != 0 || timer_delete(timer) == 0) {
+        printf("test_posix_timer failed: timer_delete\n");
+        exit(1);
+    }
+    printf("test_posix_timer ok\n");
+}
+
+static void test_cpu_timer(void)
+{
+    struct sigaction sa = {.sa_handler = alarm_handler};
+    sigaction(SIGVTALRM, &sa, NULL);
+    alarms = 0;
+    struct itimerval value = {.it_value = {.tv_usec = 50000}};
+    setitimer(ITIMER_VIRTUAL, &value, NULL);
+    // Only counts down while running.
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (alarms == 0 && now.tv_sec - start.tv_sec < 5);
+    if (alarms != 1) {
+        printf("test_cpu_timer failed\n");
+        exit(1);
+    }
+    printf("test_cpu_timer ok\n");
+}
+
+int main(void)
+{
+    test_setitimer();
+    test_posix_timer();
+    test_cpu_timer();
+    return 0;
+}
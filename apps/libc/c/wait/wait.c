@@ -0,0 +1,100 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define NR_CHILDREN 32
+
+static void test_many(void)
+{
+    for (int i = 0; i < NR_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(i);
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+    }
+    int sum = 0, status;
+    for (int i = 0; i < NR_CHILDREN; i++) {
+        if (wait(&status) < 0 || !WIFEXITED(status)) {
+            printf("test_many failed: wait %d\n", i);
+            exit(1);
+        }
+        sum += WEXITSTATUS(status);
+    }
+    if (sum != NR_CHILDREN * (NR_CHILDREN - 1) / 2 || wait(&status) != -1) {
+        printf("test_many failed: sum=%d\n", sum);
+        exit(1);
+    }
+    printf("test_many ok\n");
+}
+
+static void test_stop_continue(void)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (;;)
+            usleep(1000);
+    }
+    int status;
+    kill(pid, SIGSTOP);
+    if (waitpid(pid, &status, WUNTRACED) != pid || !WIFSTOPPED(status) ||
+        WSTOPSIG(status) != SIGSTOP) {
+        printf("test_stop_continue failed: stop status=%#x\n", status);
+        exit(1);
+    }
+    kill(pid, SIGCONT);
+    if (waitpid(pid, &status, WCONTINUED) != pid || !WIFCONTINUED(status)) {
+        printf("test_stop_continue failed: continue status=%#x\n", status);
+        exit(1);
+    }
+    // Nothing else to report.
+    if (waitpid(pid, &status, WNOHANG | WUNTRACED | WCONTINUED) != 0) {
+        printf("test_stop_continue failed: spurious event\n");
+        exit(1);
+    }
+    kill(pid, SIGKILL);
+    siginfo_t info;
+    if (waitid(P_PID, pid, &info, WEXITED) != 0 || info.si_pid != pid ||
+        info.si_code != CLD_KILLED || info.si_status != SIGKILL) {
+        printf("test_stop_continue failed: waitid code=%d\n", info.si_code);
+        exit(1);
+    }
+    printf("test_stop_continue ok\n");
+}
+
+static void test_waitid_nowait(void)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(7);
+    siginfo_t info;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0 || info.si_pid != pid ||
+        info.si_code != CLD_EXITED || info.si_status != 7) {
+        printf("test_waitid_nowait failed: peek\n");
+        exit(1);
+    }
+    // Still a zombie, so it can be waited for again.
+    int status;
+    if (waitpid(pid, &status, 0) != pid || WEXITSTATUS(status) != 7) {
+        printf("test_waitid_nowait failed: reap\n");
+        exit(1);
+    }
+    info.si_pid = -1;
+    if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) != -1) {
+        printf("test_waitid_nowait failed: no children\n");
+        exit(1);
+    }
+    printf("test_waitid_nowait ok\n");
+}
+
+int main(void)
+{
+    test_many();
+    test_stop_continue();
+    test_waitid_nowait();
+    return 0;
+}
@@ -5,4 +5,41 @@ typedef unsigned long pthread_t;
 
 int pthread_create(pthread_t *res, const void *attrp, void *(*entry)(void *), void *arg);
 
+/* Mutexes are always priority-inheriting (PTHREAD_PRIO_INHERIT). */
+typedef struct {
+    volatile int __lock; // TID of the owner, or 0
+} pthread_mutex_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+
+int pthread_mutex_init(pthread_mutex_t *m, const void *attrp);
+int pthread_mutex_lock(pthread_mutex_t *m);
+int pthread_mutex_unlock(pthread_mutex_t *m);
+
+typedef struct {
+    volatile int __seq;     // Changed by every signal
+    volatile int __waiters; // Number of waiting threads
+} pthread_cond_t;
+
+#define PTHREAD_COND_INITIALIZER {0, 0}
+
+int pthread_cond_init(pthread_cond_t *c, const void *attrp);
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+int pthread_cond_signal(pthread_cond_t *c);
+int pthread_cond_broadcast(pthread_cond_t *c);
+
+typedef struct {
+    volatile int __lock;    // Number of readers, or INT_MAX while a writer holds it
+    volatile int __waiters; // Number of waiting threads
+} pthread_rwlock_t;
+
+#define PTHREAD_RWLOCK_INITIALIZER {0, 0}
+
+int pthread_rwlock_init(pthread_rwlock_t *rw, const void *attrp);
+int pthread_rwlock_rdlock(pthread_rwlock_t *rw);
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rw);
+int pthread_rwlock_wrlock(pthread_rwlock_t *rw);
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rw);
+int pthread_rwlock_unlock(pthread_rwlock_t *rw);
+
 #endif // __PTHREAD_H__
@@ -0,0 +1,34 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define SCHED_OTHER 0
+#define SCHED_FIFO  1
+#define SCHED_RR    2
+
+struct sched_param {
+    int sched_priority;
+};
+
+#define CPU_SETSIZE 1024
+
+typedef struct {
+    unsigned long __bits[CPU_SETSIZE / (8 * sizeof(long))];
+} cpu_set_t;
+
+#define __CPU_WORD(cpu) ((cpu) / (8 * sizeof(long)))
+#define __CPU_BIT(cpu)  (1UL << ((cpu) % (8 * sizeof(long))))
+
+#define CPU_ZERO(set)       memset((set), 0, sizeof(cpu_set_t))
+#define CPU_SET(cpu, set)   ((set)->__bits[__CPU_WORD(cpu)] |= __CPU_BIT(cpu))
+#define CPU_CLR(cpu, set)   ((set)->__bits[__CPU_WORD(cpu)] &= ~__CPU_BIT(cpu))
+#define CPU_ISSET(cpu, set) (((set)->__bits[__CPU_WORD(cpu)] & __CPU_BIT(cpu)) != 0)
+
+int sched_yield(void);
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+int sched_setaffinity(pid_t pid, size_t size, const cpu_set_t *set);
+int sched_getaffinity(pid_t pid, size_t size, cpu_set_t *set);
+
+#endif // __SCHED_H__
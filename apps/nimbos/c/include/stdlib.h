@@ -1,6 +1,13 @@
 #ifndef __STDLIB_H__
 #define __STDLIB_H__
 
+#include <stdint.h>
+
+void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
+void free(void *ptr);
+
 int rand(void);
 void srand(unsigned);
 
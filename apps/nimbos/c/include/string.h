@@ -7,6 +7,7 @@ int isspace(int c);
 int isdigit(int c);
 int atoi(const char *s);
 
+void *memcpy(void *restrict dest, const void *restrict src, size_t n);
 void *memset(void *dest, int c, size_t n);
 void *memchr(const void *src, int c, size_t n);
 
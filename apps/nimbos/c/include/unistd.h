@@ -7,6 +7,7 @@ ssize_t read(int, void *, size_t);
 ssize_t write(int, const void *, size_t);
 
 pid_t getpid(void);
+pid_t gettid(void);
 int sched_yield(void);
 
 pid_t fork(void);
@@ -0,0 +1,250 @@
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "syscall.h"
+
+// Objects of up to MAX_SMALL bytes are rounded up to a size class, and carved from runs of
+// RUN_SIZE bytes, taken from the heap with `brk` and then, once it is full, with `mmap`.
+// Larger objects are mapped on their own. Freed objects go to the free list of their class in
+// the arena of the freeing thread, from which the thread allocates without contention, and
+// the lists that grow too long are given back to shared lists.
+
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+#define PAGE_SIZE  4096
+#define RUN_SIZE   (PAGE_SIZE * 4)
+#define MAX_SMALL  4096
+// The stack size of the threads, as in `pthread_create`.
+#define STACK_SIZE (PAGE_SIZE * 4)
+
+#define NUM_CLASSES 16
+#define NUM_ARENAS  16
+// The objects a thread keeps in the free list of a class, beyond which BATCH are given back.
+#define MAX_CACHED 64
+#define BATCH      32
+
+// Classes of 16 bytes up to 64, then of 2^k and 1.5 * 2^k bytes, see `class_of`.
+static const size_t class_size[NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+
+// The header at the start of each run, or of each large object mapping, so that the header
+// of any object is found by aligning its address down to RUN_SIZE.
+struct chunk {
+    size_t cls; // The class of the objects, or NUM_CLASSES for a large object
+    size_t size; // The size of the mapping of a large object
+};
+
+#define LARGE NUM_CLASSES
+
+struct object {
+    struct object *next;
+};
+
+struct arena {
+    volatile int lock;
+    unsigned count[NUM_CLASSES];
+    struct object *free[NUM_CLASSES];
+} __attribute__((aligned(64)));
+
+static struct arena arenas[NUM_ARENAS];
+
+// Protects the shared free lists and the heap.
+static volatile int shared_lock;
+static struct object *shared_free[NUM_CLASSES];
+static uintptr_t heap_top;
+static int heap_full;
+
+static void lock(volatile int *l)
+{
+    while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static void unlock(volatile int *l)
+{
+    __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+static int class_of(size_t size)
+{
+    if (size <= 64)
+        return size ? (size - 1) / 16 : 0;
+    int b = 63 - __builtin_clzll(size - 1);
+    return 4 + 2 * (b - 6) + (((size - 1) >> (b - 1)) & 1);
+}
+
+// Threads run on their own stacks (see `pthread_create`), so the stack address picks the arena
+// of a thread without a system call. Threads sharing an arena are still correct, as it is
+// locked.
+static struct arena *my_arena(void)
+{
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    return &arenas[sp / STACK_SIZE % NUM_ARENAS];
+}
+
+static struct chunk *chunk_of(void *ptr)
+{
+    return (struct chunk *)((uintptr_t)ptr & ~(uintptr_t)(RUN_SIZE - 1));
+}
+
+// Maps `size` bytes aligned to RUN_SIZE, by mapping more and unmapping the excess.
+static void *map_aligned(size_t size)
+{
+    long map = syscall(SYS_mmap, 0, size + RUN_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map < 0 && map > -4096)
+        return NULL;
+    uintptr_t start = ((uintptr_t)map + RUN_SIZE - 1) & ~(uintptr_t)(RUN_SIZE - 1);
+    if (start > (uintptr_t)map)
+        syscall(SYS_munmap, map, start - map);
+    syscall(SYS_munmap, start + size, map + RUN_SIZE - start);
+    return (void *)start;
+}
+
+// Takes a new run, with the shared lock held.
+static struct chunk *alloc_run(void)
+{
+    if (!heap_full) {
+        if (!heap_top) {
+            heap_top = syscall(SYS_brk, 0);
+            heap_top = (heap_top + RUN_SIZE - 1) & ~(uintptr_t)(RUN_SIZE - 1);
+        }
+        if ((uintptr_t)syscall(SYS_brk, heap_top + RUN_SIZE) >= heap_top + RUN_SIZE) {
+            heap_top += RUN_SIZE;
+            return (struct chunk *)(heap_top - RUN_SIZE);
+        }
+        // The kernel keeps the heap small, the rest is mapped.
+        heap_full = 1;
+    }
+    return map_aligned(RUN_SIZE);
+}
+
+// Fills the empty free list of `cls` in `a`, from the shared list or a new run.
+static int refill(struct arena *a, int cls)
+{
+    lock(&shared_lock);
+    struct object *list = shared_free[cls];
+    if (list) {
+        struct object *last = list;
+        unsigned n = 1;
+        for (; n < BATCH && last->next; n++) last = last->next;
+        shared_free[cls] = last->next;
+        unlock(&shared_lock);
+        last->next = NULL;
+        a->free[cls] = list;
+        a->count[cls] = n;
+        return 1;
+    }
+    struct chunk *run = alloc_run();
+    unlock(&shared_lock);
+    if (!run)
+        return 0;
+    run->cls = cls;
+    // The objects at the start of the run are handed out first.
+    size_t size = class_size[cls];
+    unsigned n = (RUN_SIZE - sizeof(struct chunk)) / size;
+    char *first = (char *)(run + 1);
+    for (unsigned i = 0; i < n; i++)
+        ((struct object *)(first + i * size))->next =
+            i + 1 < n ? (struct object *)(first + (i + 1) * size) : NULL;
+    a->free[cls] = (struct object *)first;
+    a->count[cls] = n;
+    return 1;
+}
+
+// Gives BATCH objects of the free list of `cls` in `a` back to the shared list.
+static void drain(struct arena *a, int cls)
+{
+    struct object *list = a->free[cls], *last = list;
+    for (unsigned n = 1; n < BATCH; n++) last = last->next;
+    a->free[cls] = last->next;
+    a->count[cls] -= BATCH;
+    lock(&shared_lock);
+    last->next = shared_free[cls];
+    shared_free[cls] = list;
+    unlock(&shared_lock);
+}
+
+static void *alloc_large(size_t size)
+{
+    if (size > (size_t)-1 / 2)
+        return NULL;
+    size = (size + sizeof(struct chunk) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    struct chunk *c = map_aligned(size);
+    if (!c)
+        return NULL;
+    c->cls = LARGE;
+    c->size = size;
+    return c + 1;
+}
+
+void *malloc(size_t size)
+{
+    if (size > MAX_SMALL)
+        return alloc_large(size);
+    int cls = class_of(size);
+    struct arena *a = my_arena();
+    lock(&a->lock);
+    if (!a->free[cls] && !refill(a, cls)) {
+        unlock(&a->lock);
+        return NULL;
+    }
+    struct object *obj = a->free[cls];
+    a->free[cls] = obj->next;
+    a->count[cls]--;
+    unlock(&a->lock);
+    return obj;
+}
+
+void free(void *ptr)
+{
+    if (!ptr)
+        return;
+    struct chunk *c = chunk_of(ptr);
+    if (c->cls == LARGE) {
+        syscall(SYS_munmap, c, c->size);
+        return;
+    }
+    int cls = c->cls;
+    struct arena *a = my_arena();
+    struct object *obj = ptr;
+    lock(&a->lock);
+    obj->next = a->free[cls];
+    a->free[cls] = obj;
+    if (++a->count[cls] > MAX_CACHED)
+        drain(a, cls);
+    unlock(&a->lock);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t)-1 / size)
+        return NULL;
+    size *= nmemb;
+    void *ptr = malloc(size);
+    // Large objects are fresh mappings, already zeroed.
+    if (ptr && size <= MAX_SMALL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+        return malloc(size);
+    struct chunk *c = chunk_of(ptr);
+    size_t old = c->cls == LARGE ? c->size - sizeof(struct chunk) : class_size[c->cls];
+    if (size <= old && (c->cls == LARGE ? size > MAX_SMALL : class_of(size) == c->cls))
+        return ptr;
+    void *new = malloc(size);
+    if (new) {
+        memcpy(new, ptr, size < old ? size : old);
+        free(ptr);
+    }
+    return new;
+}
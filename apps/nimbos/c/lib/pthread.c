@@ -1,24 +1,202 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#include "syscall.h"
 
-#define __MAX_THREADS       16
 #define __THREAD_STACK_SIZE (4096 * 4)
 
-static char THREAD_STACKS[__MAX_THREADS][__THREAD_STACK_SIZE] __attribute__((__aligned__(16)));
-static int THREAD_COUNT = 0;
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
 
 extern int __clone(void *(*entry)(void *), void *stack, void *arg);
 
 int pthread_create(pthread_t *restrict res, const void *restrict attrp, void *(*entry)(void *),
                    void *restrict arg)
 {
-    int thread_id = THREAD_COUNT++;
-    void *newsp = THREAD_STACKS[thread_id] + __THREAD_STACK_SIZE;
+    // Stacks are mapped for each thread, so there is no limit on the number of threads. They
+    // are not freed, as threads can't be joined.
+    long stack = syscall(SYS_mmap, 0, __THREAD_STACK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack < 0 && stack > -4096) {
+        return stack;
+    }
+    void *newsp = (char *)stack + __THREAD_STACK_SIZE;
     int tid = __clone(entry, arg, newsp);
     if (tid < 0) {
+        syscall(SYS_munmap, stack, __THREAD_STACK_SIZE);
         return tid;
     }
     *res = tid;
     return 0;
 }
+
+#define EINTR 4
+#define EBUSY 16
+
+#define FUTEX_WAIT_PRIVATE      128
+#define FUTEX_WAKE_PRIVATE      129
+#define FUTEX_LOCK_PI_PRIVATE   134
+#define FUTEX_UNLOCK_PI_PRIVATE 135
+
+#define INT_MAX 0x7fffffff
+
+// Blocks while `*addr` is `val`, until woken. Callers check their condition again afterwards.
+static void futex_wait(volatile int *addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, 0);
+}
+
+static void futex_wake(volatile int *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count);
+}
+
+int pthread_mutex_init(pthread_mutex_t *m, const void *attrp)
+{
+    m->__lock = 0;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m)
+{
+    int expected = 0;
+    int tid = gettid();
+    if (__atomic_compare_exchange_n(&m->__lock, &expected, tid, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    // Contended: let the kernel queue us and boost the owner.
+    long ret;
+    do {
+        ret = syscall(SYS_futex, &m->__lock, FUTEX_LOCK_PI_PRIVATE, 0, 0);
+    } while (ret == -EINTR);
+    // Errors are returned as positive numbers, as in POSIX.
+    return -ret;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m)
+{
+    int expected = gettid();
+    if (__atomic_compare_exchange_n(&m->__lock, &expected, 0, 0, __ATOMIC_RELEASE,
+                                    __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    // There are waiters in the kernel: hand the mutex over to one of them.
+    return -syscall(SYS_futex, &m->__lock, FUTEX_UNLOCK_PI_PRIVATE);
+}
+
+int pthread_cond_init(pthread_cond_t *c, const void *attrp)
+{
+    c->__seq = 0;
+    c->__waiters = 0;
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+    // Any signal after the mutex is unlocked changes the sequence, so it is never missed.
+    int seq = __atomic_load_n(&c->__seq, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&c->__waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(m);
+    futex_wait(&c->__seq, seq);
+    __atomic_fetch_sub(&c->__waiters, 1, __ATOMIC_SEQ_CST);
+    return pthread_mutex_lock(m);
+}
+
+static int cond_wake(pthread_cond_t *c, int count)
+{
+    // Without waiters, signaling stays in user space.
+    if (__atomic_load_n(&c->__waiters, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&c->__seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&c->__seq, count);
+    }
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *c)
+{
+    return cond_wake(c, 1);
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c)
+{
+    return cond_wake(c, INT_MAX);
+}
+
+// `__lock` of a rwlock is the number of readers, or this while a writer holds it.
+#define RW_WRITER INT_MAX
+
+int pthread_rwlock_init(pthread_rwlock_t *rw, const void *attrp)
+{
+    rw->__lock = 0;
+    rw->__waiters = 0;
+    return 0;
+}
+
+// Waits for the lock to change from `state`, which the last try to take it saw.
+static void rwlock_wait(pthread_rwlock_t *rw, int state)
+{
+    __atomic_fetch_add(&rw->__waiters, 1, __ATOMIC_SEQ_CST);
+    futex_wait(&rw->__lock, state);
+    __atomic_fetch_sub(&rw->__waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rw)
+{
+    int state = __atomic_load_n(&rw->__lock, __ATOMIC_RELAXED);
+    while (state < RW_WRITER - 1) {
+        if (__atomic_compare_exchange_n(&rw->__lock, &state, state + 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+    return EBUSY;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rw)
+{
+    while (pthread_rwlock_tryrdlock(rw)) {
+        rwlock_wait(rw, RW_WRITER);
+    }
+    return 0;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rw)
+{
+    int state = 0;
+    if (__atomic_compare_exchange_n(&rw->__lock, &state, RW_WRITER, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return EBUSY;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rw)
+{
+    int state = 0;
+    while (!__atomic_compare_exchange_n(&rw->__lock, &state, RW_WRITER, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        rwlock_wait(rw, state);
+        state = 0;
+    }
+    return 0;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rw)
+{
+    int state = __atomic_load_n(&rw->__lock, __ATOMIC_RELAXED);
+    int next;
+    do {
+        next = state == RW_WRITER ? 0 : state - 1;
+    } while (!__atomic_compare_exchange_n(&rw->__lock, &state, next, 0, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+    // Waiters only need waking once the lock is free.
+    if (!next && __atomic_load_n(&rw->__waiters, __ATOMIC_SEQ_CST)) {
+        futex_wake(&rw->__lock, INT_MAX);
+    }
+    return 0;
+}
@@ -8,7 +8,8 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-#define __LINE_WIDTH 256
+// Stdout is always the console, so it is flushed line by line, and at exit.
+#define __LINE_WIDTH 4096
 
 static char buffer[__LINE_WIDTH];
 static int buffer_len;
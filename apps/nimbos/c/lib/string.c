@@ -1,10 +1,22 @@
 #include <stdint.h>
 #include <string.h>
 
+/* Scan a word at a time: HASZERO(x) is nonzero iff some byte of x is zero. */
+#define ALIGN (sizeof(size_t))
+#define ONES ((size_t)-1 / 0xff)
+#define HIGHS (ONES * (0xff / 2 + 1))
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+typedef size_t __attribute__((__may_alias__)) word;
+
 size_t strlen(const char *s)
 {
     const char *a = s;
-    for (; *s; s++);
+    const word *w;
+    for (; (uintptr_t)s % ALIGN; s++)
+        if (!*s) return s - a;
+    for (w = (const void *)s; !HASZERO(*w); w++);
+    for (s = (const void *)w; *s; s++);
     return s - a;
 }
 
@@ -42,11 +54,35 @@ int atoi(const char *s)
 void *memchr(const void *src, int c, size_t n)
 {
     const unsigned char *s = src;
+    const word *w;
     c = (unsigned char)c;
+    for (; ((uintptr_t)s & (ALIGN - 1)) && n && *s != c; s++, n--);
+    if (n && *s != c) {
+        size_t k = ONES * c;
+        for (w = (const void *)s; n >= ALIGN && !HASZERO(*w ^ k); w++, n -= ALIGN);
+        s = (const void *)w;
+    }
     for (; n && *s != c; s++, n--);
     return n ? (void *)s : 0;
 }
 
+void *memcpy(void *restrict dest, const void *restrict src, size_t n)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    /* Copy a word at a time if both can be aligned together. */
+    if ((uintptr_t)d % ALIGN == (uintptr_t)s % ALIGN) {
+        word *wd;
+        const word *ws;
+        for (; (uintptr_t)s % ALIGN && n; n--) *d++ = *s++;
+        for (wd = (void *)d, ws = (const void *)s; n >= ALIGN; n -= ALIGN) *wd++ = *ws++;
+        d = (void *)wd;
+        s = (const void *)ws;
+    }
+    for (; n; n--) *d++ = *s++;
+    return dest;
+}
+
 void *memset(void *dest, int c, size_t n)
 {
     unsigned char *s = dest;
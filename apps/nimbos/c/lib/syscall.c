@@ -1,4 +1,7 @@
+#include <sched.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "syscall.h"
@@ -18,13 +21,39 @@ pid_t getpid(void)
     return syscall(SYS_getpid);
 }
 
+pid_t gettid(void)
+{
+    return syscall(SYS_gettid);
+}
+
 int sched_yield(void)
 {
     return syscall(SYS_yield);
 }
 
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param)
+{
+    return syscall(SYS_sched_setscheduler, pid, policy, param);
+}
+
+int sched_setaffinity(pid_t pid, size_t size, const cpu_set_t *set)
+{
+    return syscall(SYS_sched_setaffinity, pid, size, set);
+}
+
+int sched_getaffinity(pid_t pid, size_t size, cpu_set_t *set)
+{
+    // The kernel returns the size of the mask it wrote.
+    long ret = syscall(SYS_sched_getaffinity, pid, size, set);
+    if (ret < 0)
+        return ret;
+    memset((char *)set + ret, 0, size - ret);
+    return 0;
+}
+
 _Noreturn void exit(int code)
 {
+    fflush(stdout);
     for (;;) syscall(SYS_exit, code);
 }
 
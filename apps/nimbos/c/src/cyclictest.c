@@ -11,11 +11,28 @@ musl-gcc cyclictest.c -lpthread -DUSE_MUSL
  * NOTE THAT FOR ACCURATE RESULTS    /dev/cpu_dma_latency    NEEDS TO BE SET TO 0.
  * See Documentation/power/pm_qos_interface.txt .
  *
- * DEFINES: USE_MUSL    MINIMAL
+ * DEFINES: USE_MUSL    MINIMAL    PI_MUTEX    LOAD    MAX_CYCLES    HIST_BUCKETS
+ *
+ * One timer thread is run on each CPU the process may run on, up to MAX_CPUS,
+ * pinned to it. Each thread stops after MAX_CYCLES wakeups, and the latencies
+ * are then printed as a histogram with 1us buckets, followed by the minimum,
+ * average, maximum, 99th and 99.9th percentile latencies of each thread.
+ * Latencies of HIST_BUCKETS usecs or more are only counted as overflows.
+ *
+ * With LOAD, a busy thread at normal priority is run next to each timer
+ * thread, which keeps computing and entering the kernel to yield the CPU.
+ *
+ * With PI_MUTEX, the timer thread takes a priority-inheriting mutex after
+ * every wakeup, while NUM_HOLDERS background threads keep taking it and
+ * holding it for HOLD_USECS. The reported latency then includes the time
+ * spent waiting for a holder, which priority inheritance bounds by boosting
+ * the holder until it unlocks.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,22 +42,24 @@ musl-gcc cyclictest.c -lpthread -DUSE_MUSL
 #define TIMER_RELTIME 0
 #define TIMER_ABSTIME 1
 
-/*
- * number of timerthreads
- */
-#define NUM_THREADS         1
 #define MAX_CPUS            12
 #define DEFAULT_INTERVAL    1000 // in usecs
-#define DEFAULT_DISTANCE    500
-// #define DEFAULT_PRIORITY 0
-// #define DEFAULT_POLICY SCHED_OTHER // SCHED_FIFO
+#define DEFAULT_DISTANCE    0    // all the threads wake up at the same interval
+#define DEFAULT_PRIORITY    80
+#define DEFAULT_POLICY      SCHED_FIFO
 #define USEC_PER_SEC        1000000
 #define NSEC_PER_SEC        1000000000
 #define DEFAULT_CLOCK       CLOCK_MONOTONIC
 #define DEFAULT_TIMER_MODE  TIMER_ABSTIME
-#define MAX_CYCLES          30000
 #define PRINT_FREQ          500 // 500ms
 
+#ifndef MAX_CYCLES
+#define MAX_CYCLES          30000
+#endif
+#ifndef HIST_BUCKETS
+#define HIST_BUCKETS        1000 // in usecs
+#endif
+
 struct thread_param {
     int id;
     pthread_t thread;
@@ -56,15 +75,33 @@ struct thread_stat {
     long min;
     long act;
     long sum; // not using `double avg`
-    int cycles;
+    long cycles;
+    unsigned long hist[HIST_BUCKETS]; // by latency in usecs
+    unsigned long overflows;
 };
 
 static int interval = DEFAULT_INTERVAL;
-// static int priority = DEFAULT_PRIORITY;
-static struct thread_param thrpar[NUM_THREADS];
-static struct thread_stat thrstat[NUM_THREADS];
+static int priority = DEFAULT_PRIORITY;
+static int num_threads;
+static int cpus[MAX_CPUS]; // the CPU of each timer thread
+static struct thread_param thrpar[MAX_CPUS];
+static struct thread_stat thrstat[MAX_CPUS];
 static int shutdown = 0;
 
+#ifdef PI_MUTEX
+#define NUM_HOLDERS 2
+#define HOLD_USECS  200
+
+static pthread_mutex_t pi_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t holders[NUM_HOLDERS];
+#endif
+
+#ifdef LOAD
+#define LOAD_SPINS 100000 // between two yields
+
+static pthread_t loaders[MAX_CPUS];
+#endif
+
 static inline void tsnorm(struct timespec* ts)
 {
     while (ts->tv_nsec >= NSEC_PER_SEC) {
@@ -93,6 +130,69 @@ static inline int tsgreater(struct timespec* a, struct timespec* b)
     return ((a->tv_sec > b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec));
 }
 
+// Finds the CPUs the process may run on, returning how many there are.
+static int get_cpus(void)
+{
+    cpu_set_t mask;
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        cpus[0] = 0;
+        return 1;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &mask))
+            cpus[n++] = cpu;
+    }
+    return n;
+}
+
+static int pin_to_cpu(int cpu)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    return sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+#ifdef PI_MUTEX
+static void busy_wait_usecs(long usecs)
+{
+    struct timespec start, now;
+    clock_gettime(DEFAULT_CLOCK, &start);
+    do {
+        clock_gettime(DEFAULT_CLOCK, &now);
+    } while (tsdelta(&now, &start) < usecs);
+}
+
+static void *holderthread(void* param)
+{
+    while (!shutdown) {
+        pthread_mutex_lock(&pi_mutex);
+        busy_wait_usecs(HOLD_USECS);
+        pthread_mutex_unlock(&pi_mutex);
+        busy_wait_usecs(HOLD_USECS);
+    }
+    return NULL;
+}
+#endif
+
+#ifdef LOAD
+static void *loadthread(void* param)
+{
+    int cpu = *(int*)param;
+
+    if (pin_to_cpu(cpu) != 0)
+        printf("L:%d cannot run on CPU %d, running unpinned\n", cpu, cpu);
+    while (!shutdown) {
+        for (volatile int i = 0; i < LOAD_SPINS; i++)
+            ;
+        sched_yield();
+    }
+    return NULL;
+}
+#endif
+
 static void *timerthread(void* param)
 {
     int err;
@@ -101,6 +201,15 @@ static void *timerthread(void* param)
     struct timespec now, next, interval;
 
     stat->tid = getpid();
+
+    if (pin_to_cpu(par->cpu) != 0)
+        printf("T:%d cannot run on CPU %d, running unpinned\n", par->id, par->cpu);
+
+    // Run above the load, so that the latency does not depend on it.
+    struct sched_param schedp = {.sched_priority = par->prio};
+    if (sched_setscheduler(0, par->policy, &schedp) != 0)
+        printf("T:%d cannot set the real-time priority %d\n", par->id, par->prio);
+
     interval.tv_sec = par->interval / USEC_PER_SEC;
     interval.tv_nsec = (par->interval % USEC_PER_SEC) * 1000;
 
@@ -109,7 +218,7 @@ static void *timerthread(void* param)
     next = now;
     tsinc(&next, &interval);
 
-    while (!shutdown) {
+    while (!shutdown && stat->cycles < MAX_CYCLES) {
         switch (DEFAULT_TIMER_MODE) {
         case TIMER_ABSTIME:
             err = clock_nanosleep(DEFAULT_CLOCK, TIMER_ABSTIME, &next, NULL);
@@ -125,6 +234,10 @@ static void *timerthread(void* param)
             tsnorm(&next);
             break;
         }
+#ifdef PI_MUTEX
+        pthread_mutex_lock(&pi_mutex);
+        pthread_mutex_unlock(&pi_mutex);
+#endif
         err = clock_gettime(DEFAULT_CLOCK, &now);
         assert(!err && "clock_gettime() failed");
 
@@ -137,29 +250,90 @@ static void *timerthread(void* param)
             stat->max = diff;
         stat->act = diff;
         stat->sum += diff;
+        if (diff < 0)
+            stat->hist[0]++;
+        else if (diff < HIST_BUCKETS)
+            stat->hist[diff]++;
+        else
+            stat->overflows++;
         stat->cycles++;
 
-		tsinc(&next, &interval);
-		while (tsgreater(&now, &next))
-			tsinc(&next, &interval);
+        tsinc(&next, &interval);
+        while (tsgreater(&now, &next))
+            tsinc(&next, &interval);
     }
 
     return NULL;
 }
 
+// Returns the latency below which `per_10000` ten-thousandths of the wakeups
+// are, or -1 if it is past the histogram.
+static long percentile(struct thread_stat* stat, long per_10000)
+{
+    unsigned long rank = (stat->cycles * per_10000 + 9999) / 10000;
+    unsigned long seen = 0;
+
+    for (long i = 0; i < HIST_BUCKETS; i++) {
+        seen += stat->hist[i];
+        if (seen >= rank)
+            return i;
+    }
+    return -1;
+}
+
+static long avg(struct thread_stat* stat)
+{
+    return stat->cycles ? (long)(stat->sum / stat->cycles) : 0;
+}
+
 static void print_stat(struct thread_param* par, struct thread_stat* stat)
 {
     int index = par->id;
 
-    char* fmt = "T:%d (%d) P:%d I:%ld C:%ld "
-                "Min:%ld Act:%ld Avg:%ld Max:%ld";
+    char* fmt = "T:%d (%d) CPU:%d P:%d I:%ld C:%ld "
+                "Min:%ld Act:%ld Avg:%ld Max:%ld P99:%ld P99.9:%ld";
 
-    printf(fmt, index, stat->tid, par->prio, par->interval, stat->cycles, stat->min, stat->act,
-           stat->cycles ? (long)(stat->sum / stat->cycles) : 0, stat->max);
+    printf(fmt, index, stat->tid, par->cpu, par->prio, par->interval, stat->cycles, stat->min,
+           stat->act, avg(stat), stat->max, percentile(stat, 9900), percentile(stat, 9990));
 
     printf("\n"); // reuse the same line
 }
 
+// Prints the histogram, with a column per thread and the empty rows left
+// out, then the statistics of the threads.
+static void print_histogram(void)
+{
+    printf("# Histogram\n");
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        unsigned long any = 0;
+        for (int t = 0; t < num_threads; t++)
+            any |= thrstat[t].hist[i];
+        if (!any)
+            continue;
+        printf("%d", i);
+        for (int t = 0; t < num_threads; t++)
+            printf(" %lu", thrstat[t].hist[i]);
+        printf("\n");
+    }
+
+#define PRINT_ROW(title, fmt, expr)                     \
+    do {                                                \
+        printf("# " title ":");                         \
+        for (int t = 0; t < num_threads; t++)           \
+            printf(" " fmt, (expr));                    \
+        printf("\n");                                   \
+    } while (0)
+
+    PRINT_ROW("Total", "%ld", thrstat[t].cycles);
+    PRINT_ROW("Min Latencies", "%ld", thrstat[t].min);
+    PRINT_ROW("Avg Latencies", "%ld", avg(&thrstat[t]));
+    PRINT_ROW("Max Latencies", "%ld", thrstat[t].max);
+    PRINT_ROW("P99 Latencies", "%ld", percentile(&thrstat[t], 9900));
+    PRINT_ROW("P99.9 Latencies", "%ld", percentile(&thrstat[t], 9990));
+    PRINT_ROW("Histogram Overflows", "%lu", thrstat[t].overflows);
+#undef PRINT_ROW
+}
+
 int main()
 {
     int err;
@@ -170,13 +344,14 @@ int main()
     // err = write(fd, &latency_target_value, 4);
     // assert(err == 4);
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    num_threads = get_cpus();
+    for (int i = 0; i < num_threads; i++) {
         struct thread_param* par = &thrpar[i];
         struct thread_stat* stat = &thrstat[i];
         par->id = i;
-        par->cpu = i % MAX_CPUS;
-        // par->prio = priority;
-        // par->policy = DEFAULT_POLICY;
+        par->cpu = cpus[i];
+        par->prio = priority;
+        par->policy = DEFAULT_POLICY;
         par->interval = interval;
         interval += DEFAULT_DISTANCE;
 
@@ -189,25 +364,40 @@ int main()
         assert(!err && "cannot pthread_create");
     }
 
+#ifdef PI_MUTEX
+    for (int i = 0; i < NUM_HOLDERS; i++) {
+        err = pthread_create(&holders[i], NULL, holderthread, NULL);
+        assert(!err && "cannot pthread_create");
+    }
+#endif
+
+#ifdef LOAD
+    for (int i = 0; i < num_threads; i++) {
+        err = pthread_create(&loaders[i], NULL, loadthread, &cpus[i]);
+        assert(!err && "cannot pthread_create");
+    }
+#endif
+
     while (!shutdown) {
         int allstopped = 0;
-        for (int i = 0; i < NUM_THREADS; i++) {
+        for (int i = 0; i < num_threads; i++) {
             print_stat(&thrpar[i], &thrstat[i]);
             if (thrstat[i].cycles >= MAX_CYCLES)
                 allstopped++;
         }
-        printf("\033[%dA\033[2K", NUM_THREADS);
+        printf("\033[%dA\033[2K", num_threads);
 
         usleep(PRINT_FREQ * 1000);
-        if (shutdown || allstopped)
+        if (shutdown || allstopped == num_threads)
             break;
     }
     shutdown = 1;
-    for (int i = 0; i < NUM_THREADS; i++) {
+    for (int i = 0; i < num_threads; i++) {
         print_stat(&thrpar[i], &thrstat[i]);
     }
+    print_histogram();
 
-    // for (int i = 0; i < NUM_THREADS; i++) {
+    // for (int i = 0; i < num_threads; i++) {
     //  pthread_join(thrpar[i].thread, NULL);
     // }
 }
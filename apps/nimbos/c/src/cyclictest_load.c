@@ -0,0 +1,7 @@
+/*
+ * cyclictest with a busy thread at normal priority next to each timer
+ * thread, which keeps the CPUs loaded. See cyclictest.c.
+ */
+
+#define LOAD
+#include "cyclictest.c"
@@ -0,0 +1,7 @@
+/*
+ * cyclictest with the timer thread contending for a priority-inheriting
+ * mutex with background lock holders. See cyclictest.c.
+ */
+
+#define PI_MUTEX
+#include "cyclictest.c"
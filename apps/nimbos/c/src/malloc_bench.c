@@ -0,0 +1,82 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Measures the throughput of `malloc` and `free`, on batches of objects of
+ * each size, first in one thread and then in THREADS threads at once, which
+ * allocate from their own free lists. */
+
+#define BATCH   64
+#define ITERS   2000
+#define THREADS 4
+
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 65536};
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Allocates and frees `iters` batches of objects of `size` bytes, touching
+ * each object. Returns 0 if out of memory. */
+static int churn(size_t size, int iters)
+{
+    void *objs[BATCH];
+    for (int i = 0; i < iters; i++) {
+        for (int j = 0; j < BATCH; j++) {
+            objs[j] = malloc(size);
+            if (!objs[j])
+                return 0;
+            *(volatile char *)objs[j] = j;
+        }
+        for (int j = BATCH - 1; j >= 0; j--) free(objs[j]);
+    }
+    return 1;
+}
+
+static volatile int done;
+static volatile int failed;
+
+static void *churn_thread(void *arg)
+{
+    if (!churn(64, ITERS))
+        failed = 1;
+    __atomic_fetch_add(&done, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+int main()
+{
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // Large objects are mapped each time, so they take fewer rounds.
+        int iters = sizes[i] > 4096 ? ITERS / 20 : ITERS;
+        long start = now_ns();
+        if (!churn(sizes[i], iters)) {
+            printf("malloc_bench: out of memory\n");
+            return 1;
+        }
+        printf("malloc/free %ld bytes: %ld ns per pair\n", (long)sizes[i],
+               (now_ns() - start) / ((long)iters * BATCH));
+    }
+
+    long start = now_ns();
+    for (int i = 0; i < THREADS; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, churn_thread, NULL)) {
+            printf("malloc_bench: cannot create threads\n");
+            return 1;
+        }
+    }
+    while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < THREADS) sched_yield();
+    if (failed) {
+        printf("malloc_bench: out of memory\n");
+        return 1;
+    }
+    printf("malloc/free 64 bytes in %d threads: %ld ns per pair\n", THREADS,
+           (now_ns() - start) / ((long)THREADS * ITERS * BATCH));
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Compares the word-at-a-time `strlen` and `memchr` of the library with the
+ * byte loops they replaced, on a page-sized buffer. */
+
+#define LEN   4096
+#define ITERS 2000
+
+static char buf[LEN + 1];
+
+static __attribute__((noinline)) size_t byte_strlen(const char *s)
+{
+    const char *a = s;
+    for (; *s; s++);
+    return s - a;
+}
+
+static __attribute__((noinline)) void *byte_memchr(const void *src, int c, size_t n)
+{
+    const unsigned char *s = src;
+    c = (unsigned char)c;
+    for (; n && *s != c; s++, n--);
+    return n ? (void *)s : 0;
+}
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static volatile size_t sink;
+
+#define BENCH(name, expr)                                     \
+    do {                                                      \
+        long start = now_ns();                                \
+        for (int i = 0; i < ITERS; i++) sink = (size_t)(expr); \
+        printf("%s: %ld ns per %d bytes\n", name,             \
+               (now_ns() - start) / ITERS, LEN);              \
+    } while (0)
+
+int main()
+{
+    memset(buf, 'a', LEN);
+    buf[LEN] = 0;
+
+    BENCH("strlen (bytes)", byte_strlen(buf));
+    BENCH("strlen (words)", strlen(buf));
+    BENCH("memchr (bytes)", byte_memchr(buf, 0, LEN + 1));
+    BENCH("memchr (words)", memchr(buf, 0, LEN + 1));
+    return 0;
+}
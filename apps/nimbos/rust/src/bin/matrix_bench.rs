@@ -0,0 +1,189 @@
+//! A benchmark of dense matrix multiplication, swept over thread counts and
+//! matrix sizes.
+//!
+//! The matrices are multiplied in square blocks that fit in the L1 cache, with
+//! the innermost loop over contiguous rows so that it can be vectorized, and
+//! the rows of the product are split evenly over the threads. For each size,
+//! it reports GFLOP/s and the scaling efficiency over one thread, to judge the
+//! load balancing of the scheduler, FP context switching and huge pages.
+
+#![no_std]
+#![no_main]
+#![allow(clippy::needless_range_loop)]
+
+#[macro_use]
+extern crate user_lib;
+
+use core::{
+    cell::UnsafeCell,
+    ops::Range,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+use user_lib::{get_time_us, sched_yield, thread_spawn, waitpid};
+
+/// The largest matrix size.
+const MAX_N: usize = 128;
+/// The matrix sizes to run, multiples of [`BLOCK`].
+const SIZES: [usize; 3] = [32, 64, 128];
+/// The thread counts to run, which take 15 of the 16 threads `thread_spawn`
+/// can create.
+const THREADS: [usize; 4] = [1, 2, 4, MAX_THREADS];
+const MAX_THREADS: usize = 8;
+/// The side of the blocks, so that a block of each matrix fits in the L1
+/// cache.
+const BLOCK: usize = 32;
+/// The runs of each size, of which the fastest is reported.
+const REPS: usize = 3;
+
+type Matrix = [[f64; MAX_N]; MAX_N];
+
+/// The matrices, shared by the threads. `c = a * b`.
+struct Matrices {
+    a: UnsafeCell<Matrix>,
+    b: UnsafeCell<Matrix>,
+    c: UnsafeCell<Matrix>,
+}
+
+// SAFETY: `a` and `b` are only written by the main thread while the workers
+// wait, and the workers write disjoint rows of `c`.
+unsafe impl Sync for Matrices {}
+
+static MATRICES: Matrices = Matrices {
+    a: UnsafeCell::new([[0.0; MAX_N]; MAX_N]),
+    b: UnsafeCell::new([[0.0; MAX_N]; MAX_N]),
+    c: UnsafeCell::new([[0.0; MAX_N]; MAX_N]),
+};
+
+/// Bumped to start a multiplication of size [`SIZE`], or to make the workers
+/// exit if it is 0.
+static GENERATION: AtomicUsize = AtomicUsize::new(0);
+/// The generation when the current workers were spawned.
+static FIRST_GENERATION: AtomicUsize = AtomicUsize::new(0);
+static SIZE: AtomicUsize = AtomicUsize::new(0);
+static NUM_THREADS: AtomicUsize = AtomicUsize::new(0);
+/// The workers that are done with the current multiplication.
+static DONE: AtomicUsize = AtomicUsize::new(0);
+
+/// Adds the product of the rows `rows` of `a` by `b` to `c`, block by block.
+fn multiply(rows: Range<usize>, n: usize) {
+    // SAFETY: see `Matrices`.
+    let (a, b) = unsafe { (&*MATRICES.a.get(), &*MATRICES.b.get()) };
+    let c = MATRICES.c.get();
+    for kk in (0..n).step_by(BLOCK) {
+        for jj in (0..n).step_by(BLOCK) {
+            for i in rows.clone() {
+                // SAFETY: the row is only accessed by this thread.
+                let c_row = unsafe { &mut (*c)[i][jj..jj + BLOCK] };
+                for k in kk..kk + BLOCK {
+                    let a_ik = a[i][k];
+                    let b_row = &b[k][jj..jj + BLOCK];
+                    for j in 0..BLOCK {
+                        c_row[j] += a_ik * b_row[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+fn worker(id: usize) -> i32 {
+    let mut seen = FIRST_GENERATION.load(Ordering::Acquire);
+    loop {
+        while GENERATION.load(Ordering::Acquire) == seen {
+            sched_yield();
+        }
+        seen = GENERATION.load(Ordering::Acquire);
+        let n = SIZE.load(Ordering::Relaxed);
+        if n == 0 {
+            return 0;
+        }
+        let threads = NUM_THREADS.load(Ordering::Relaxed);
+        multiply(n * id / threads..n * (id + 1) / threads, n);
+        DONE.fetch_add(1, Ordering::AcqRel);
+    }
+}
+
+/// Starts the workers on the current generation and waits for them.
+fn run_workers(n: usize, threads: usize) {
+    SIZE.store(n, Ordering::Relaxed);
+    DONE.store(0, Ordering::Relaxed);
+    GENERATION.fetch_add(1, Ordering::AcqRel);
+    if n == 0 {
+        return;
+    }
+    while DONE.load(Ordering::Acquire) < threads {
+        sched_yield();
+    }
+}
+
+/// Fills `a` and `b` with small integers, so that the products are exact.
+fn init(n: usize) {
+    // SAFETY: the workers are waiting.
+    let (a, b) = unsafe { (&mut *MATRICES.a.get(), &mut *MATRICES.b.get()) };
+    for i in 0..n {
+        for j in 0..n {
+            a[i][j] = ((i + j) % 7) as f64;
+            b[i][j] = ((i * j) % 5) as f64;
+        }
+    }
+}
+
+/// Checks some elements of `c` against naive dot products.
+fn check(n: usize) {
+    // SAFETY: the workers are waiting.
+    let (a, b, c) = unsafe { (&*MATRICES.a.get(), &*MATRICES.b.get(), &*MATRICES.c.get()) };
+    for (i, j) in [(0, 0), (n / 3, n / 2), (n - 1, n - 1)] {
+        let expected: f64 = (0..n).map(|k| a[i][k] * b[k][j]).sum();
+        assert!(c[i][j] == expected, "wrong product at ({}, {})", i, j);
+    }
+}
+
+#[unsafe(no_mangle)]
+pub fn main() -> i32 {
+    // The time of one thread for each size.
+    let mut single_us = [0; SIZES.len()];
+    println!("matrix_bench: threads size GFLOP/s efficiency");
+    for threads in THREADS {
+        NUM_THREADS.store(threads, Ordering::Relaxed);
+        FIRST_GENERATION.store(GENERATION.load(Ordering::Relaxed), Ordering::Release);
+        let mut tids = [0; MAX_THREADS];
+        for id in 0..threads {
+            tids[id] = thread_spawn(worker, id);
+        }
+        for (s, n) in SIZES.into_iter().enumerate() {
+            init(n);
+            let mut best_us = isize::MAX;
+            for _ in 0..REPS {
+                // SAFETY: the workers are waiting.
+                let c = unsafe { &mut *MATRICES.c.get() };
+                for row in &mut c[..n] {
+                    row[..n].fill(0.0);
+                }
+                let start = get_time_us();
+                run_workers(n, threads);
+                best_us = best_us.min((get_time_us() - start).max(1));
+            }
+            check(n);
+            if threads == 1 {
+                single_us[s] = best_us;
+            }
+            // Floating-point operations per microsecond are MFLOP/s.
+            let mflops = 2 * (n * n * n) as isize / best_us;
+            let efficiency = single_us[s] * 100 / (threads as isize * best_us);
+            println!(
+                "matrix_bench: {} {} {}.{:03} {}%",
+                threads,
+                n,
+                mflops / 1000,
+                mflops % 1000,
+                efficiency
+            );
+        }
+        run_workers(0, threads);
+        for &tid in &tids[..threads] {
+            waitpid(tid, None, 0);
+        }
+    }
+    println!("matrix_bench passed!");
+    0
+}
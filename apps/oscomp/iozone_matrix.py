@@ -0,0 +1,56 @@
+import csv
+import re
+import sys
+
+# Turns the output of the iozone runs of `scripts/iozone_bench.sh` into a CSV
+# with a row per filesystem, file size, record size and test, in kB/s, which
+# `judge_perf.py` compares against a baseline.
+#
+# Usage: iozone_matrix.py < output.log > results.csv
+#
+# Each run is announced by a `#### IOZONE MATRIX <fs> ####` line, and is an
+# iozone auto mode run (`-a`) of the tests 0, 1 and 2, whose table has a row
+# per file and record size with the throughput of the tests below, in order.
+
+marker = re.compile(r"#### IOZONE MATRIX (\S+) ####")
+row = re.compile(r"^\s*(\d+(?:\s+\d+)+)\s*$")
+
+TESTS = ["write", "rewrite", "read", "reread", "random_read", "random_write"]
+
+
+def parse(lines):
+    results = []
+    fs = None
+    for line in lines:
+        m = marker.search(line)
+        if m is not None:
+            fs = m.group(1)
+            continue
+        m = row.match(line)
+        if fs is None or m is None:
+            continue
+        values = [int(v) for v in m.group(1).split()]
+        if len(values) != 2 + len(TESTS):
+            continue
+        file_kb, record_kb = values[:2]
+        for test, value in zip(TESTS, values[2:]):
+            results.append({
+                "name": f"iozone.{fs}.{file_kb}k.{record_kb}k.{test}",
+                "fs": fs,
+                "file_kb": file_kb,
+                "record_kb": record_kb,
+                "test": test,
+                "value": value,
+                "unit": "kB/s",
+            })
+    return results
+
+
+if __name__ == '__main__':
+    results = parse(sys.stdin)
+    if not results:
+        print("No iozone results found!", file=sys.stderr)
+        exit(255)
+    writer = csv.DictWriter(sys.stdout, fieldnames=list(results[0].keys()))
+    writer.writeheader()
+    writer.writerows(results)
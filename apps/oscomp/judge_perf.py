@@ -0,0 +1,100 @@
+import csv
+import json
+import re
+import sys
+
+# Judges the results of the benchmarks of `apps/bench`, printed as
+# `bench: <name> <value> <unit>` lines, against a baseline from a previous run.
+# The results can also be a CSV with `name`, `value` and `unit` columns, such
+# as the one of `iozone_matrix.py`.
+#
+# Usage: judge_perf.py baseline.json [max_ratio] < output.log
+#        judge_perf.py --update baseline.json < output.log
+#
+# Prints a report of every result against its baseline. A latency that grew,
+# or a bandwidth that shrank, by more than the noise threshold of the result
+# is a regression, and so is a result that is missing, and fails the judge.
+# The threshold is `max_ratio` (1.15 by default), unless the baseline has its
+# own `max_ratio` for the result, e.g. for the noisier ones. With `--update`,
+# the baseline is replaced by the results instead, keeping the thresholds.
+
+pat = re.compile(r"bench: (\S+) (\d+) (\S+)")
+
+# The units in which more is better, the others are latencies.
+BANDWIDTH_UNITS = {"MB/s", "kB/s"}
+
+
+def parse(lines):
+    lines = list(lines)
+    if lines and lines[0].strip().split(",")[0] == "name":
+        return {
+            row["name"]: {"value": int(row["value"]), "unit": row["unit"]}
+            for row in csv.DictReader(lines)
+        }
+    results = {}
+    for line in lines:
+        m = pat.search(line)
+        if m is not None:
+            results[m.group(1)] = {"value": int(m.group(2)), "unit": m.group(3)}
+    return results
+
+
+def slowdown(old, new, unit):
+    """Returns how many times worse `new` is than `old`."""
+    if unit in BANDWIDTH_UNITS:
+        old, new = new, old
+    return new / old if old > 0 else 1.0
+
+
+def judge(results, baseline, max_ratio):
+    regressed = False
+    w = max([24] + [len(name) + 2 for name in baseline.keys() | results.keys()])
+    print(f"{'benchmark':<{w}}{'baseline':>12}{'result':>12}  {'slower':>8}")
+    for name, base in baseline.items():
+        unit = base["unit"]
+        result = results.get(name)
+        if result is None:
+            print(f"{name:<{w}}{base['value']:>12}{'-':>12}  {'missing':>8}")
+            regressed = True
+            continue
+        ratio = slowdown(base["value"], result["value"], unit)
+        status = ""
+        if ratio > base.get("max_ratio", max_ratio):
+            status = "  REGRESSED"
+            regressed = True
+        elif ratio < 1 / base.get("max_ratio", max_ratio):
+            status = "  improved"
+        change = f"{(ratio - 1) * 100:+.1f}%"
+        print(f"{name:<{w}}{base['value']:>12}{result['value']:>12}  {change:>8} {unit}{status}")
+    for name in results.keys() - baseline.keys():
+        print(f"{name:<{w}}{'-':>12}{results[name]['value']:>12}  {'new':>8} {results[name]['unit']}")
+    return regressed
+
+
+if __name__ == '__main__':
+    results = parse(sys.stdin)
+    if len(sys.argv) > 2 and sys.argv[1] == "--update":
+        try:
+            with open(sys.argv[2]) as f:
+                old = json.load(f)
+        except FileNotFoundError:
+            old = {}
+        for name, result in results.items():
+            if "max_ratio" in old.get(name, {}):
+                result["max_ratio"] = old[name]["max_ratio"]
+        with open(sys.argv[2], "w") as f:
+            json.dump(results, f, indent=4, sort_keys=True)
+            f.write("\n")
+        print(f"Updated {sys.argv[2]} with {len(results)} results")
+        exit(0)
+
+    if len(sys.argv) < 2:
+        print("Usage: judge_perf.py baseline.json [max_ratio] < output.log", file=sys.stderr)
+        exit(1)
+    with open(sys.argv[1]) as f:
+        baseline = json.load(f)
+    max_ratio = float(sys.argv[2]) if len(sys.argv) > 2 else 1.15
+    if judge(results, baseline, max_ratio):
+        print("Performance test failed!")
+        exit(255)
+    print("Performance test passed!")
@@ -0,0 +1,106 @@
+import os
+import re
+import subprocess
+import sys
+
+# Symbolizes the `[profile]` lines that the kernel prints when built with the
+# `profile` feature, e.g. `make APP_FEATURES=profile AX_PROFILE_HZ=50 ...`,
+# into folded stacks for flamegraph.pl or inferno.
+#
+# Usage: profile.py kernel.elf [rootfs [user_base]] < output.log > out.folded
+#
+# `kernel.elf` is the `$(OUT_ELF)` of the build. User PCs are looked up in the
+# executables under `rootfs`, e.g. the directory the disk image was built from,
+# with position independent ones loaded at `user_base` (`user-space-base` in
+# `configs/$(ARCH).toml`). PCs in shared libraries are left as addresses.
+# Kernel frames end with `_[k]`. Set `ADDR2LINE` to use another addr2line,
+# e.g. `llvm-addr2line` for other architectures than the host.
+
+pat = re.compile(r"\[profile\] pid=(\d+) exe=(\S*) (user|kernel) (\d+) (\S+)")
+addr2line = os.environ.get("ADDR2LINE", "addr2line")
+
+
+def parse(lines):
+    samples = []
+    for line in lines:
+        m = pat.search(line)
+        if m is None:
+            continue
+        pcs = [int(pc, 16) for pc in m.group(5).split(",")]
+        samples.append((m.group(2), m.group(3) == "user", int(m.group(4)), pcs))
+    return samples
+
+
+def is_pie(path):
+    with open(path, "rb") as f:
+        header = f.read(18)
+    # `e_type` is `ET_DYN`.
+    return len(header) == 18 and header[16] == 3
+
+
+def symbolize(path, addrs):
+    """Maps each address to the function containing it in the ELF at `path`."""
+    addrs = sorted(addrs)
+    if not addrs:
+        return {}
+    out = subprocess.run(
+        [addr2line, "-f", "-C", "-e", path],
+        input="\n".join(hex(addr) for addr in addrs),
+        capture_output=True,
+        text=True,
+    ).stdout.splitlines()
+    # One line with the function and one with the location per address.
+    return {addr: func for addr, func in zip(addrs, out[::2]) if func != "??"}
+
+
+def frame_addr(pcs, i):
+    # Return addresses point after the call.
+    return pcs[i] if i == 0 else pcs[i] - 1
+
+
+def main():
+    kernel_elf = sys.argv[1]
+    rootfs = sys.argv[2] if len(sys.argv) > 2 else None
+    user_base = int(sys.argv[3], 0) if len(sys.argv) > 3 else 0x1000
+    samples = parse(sys.stdin)
+
+    kernel_addrs = set()
+    user_addrs = {}
+    for exe, from_user, _, pcs in samples:
+        if from_user:
+            user_addrs.setdefault(exe, set()).add(pcs[0])
+        else:
+            kernel_addrs.update(frame_addr(pcs, i) for i in range(len(pcs)))
+
+    kernel_syms = symbolize(kernel_elf, kernel_addrs)
+    user_syms = {}
+    for exe, addrs in user_addrs.items():
+        path = os.path.join(rootfs, exe.lstrip("/")) if rootfs else None
+        if path is None or not os.path.isfile(path):
+            continue
+        bias = user_base if is_pie(path) else 0
+        syms = symbolize(path, {addr - bias for addr in addrs if addr >= bias})
+        user_syms[exe] = {addr + bias: func for addr, func in syms.items()}
+
+    folded = {}
+    for exe, from_user, count, pcs in samples:
+        root = os.path.basename(exe) if exe != "-" else "kernel"
+        if from_user:
+            frames = [user_syms.get(exe, {}).get(pcs[0], hex(pcs[0]))]
+        else:
+            frames = []
+            for i in reversed(range(len(pcs))):
+                addr = frame_addr(pcs, i)
+                frames.append(kernel_syms.get(addr, hex(addr)) + "_[k]")
+        stack = ";".join([root] + frames)
+        folded[stack] = folded.get(stack, 0) + count
+
+    for stack, count in sorted(folded.items()):
+        print(f"{stack} {count}")
+    if not samples:
+        print("No [profile] lines found", file=sys.stderr)
+        exit(255)
+
+
+if __name__ == '__main__':
+    main()
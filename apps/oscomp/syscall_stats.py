@@ -0,0 +1,54 @@
+import json
+import re
+import sys
+
+# Summarizes the `[syscall-stats]` lines that the kernel prints when built with
+# the `syscall-stats` feature, e.g. `make APP_FEATURES=syscall-stats ...`.
+#
+# Usage: syscall_stats.py < output.log [baseline.json [max_ratio]]
+#
+# Prints the calls and the nanoseconds of every syscall aggregated by
+# executable, as JSON. With a baseline produced by a previous run, fails if
+# the total syscall time of an executable grew by more than `max_ratio`.
+
+pat = re.compile(r"\[syscall-stats\] pid=(\d+) exe=(\S*)(.*)")
+
+
+def parse(lines):
+    stats = {}
+    for line in lines:
+        m = pat.search(line)
+        if m is None:
+            continue
+        exe = stats.setdefault(m.group(2), {})
+        for item in m.group(3).split():
+            name, value = item.split("=")
+            count, nanos = value.split(":")
+            entry = exe.setdefault(name, [0, 0])
+            entry[0] += int(count)
+            entry[1] += int(nanos)
+    return stats
+
+
+def total_nanos(syscalls):
+    return sum(nanos for _, nanos in syscalls.values())
+
+
+if __name__ == '__main__':
+    stats = parse(sys.stdin)
+    print(json.dumps(stats))
+    if len(sys.argv) < 2:
+        exit(0)
+    with open(sys.argv[1]) as f:
+        baseline = json.load(f)
+    max_ratio = float(sys.argv[2]) if len(sys.argv) > 2 else 1.2
+    regressed = False
+    for exe, syscalls in stats.items():
+        if exe not in baseline:
+            continue
+        old, new = total_nanos(baseline[exe]), total_nanos(syscalls)
+        if old > 0 and new > old * max_ratio:
+            print(f"{exe}: syscall time {old} -> {new} ns", file=sys.stderr)
+            regressed = True
+    if regressed:
+        exit(255)
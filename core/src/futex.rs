@@ -1,60 +1,720 @@
 //! Futex implementation.
+//!
+//! Waiters are kept in a fixed array of buckets hashed by the futex address,
+//! each with its own lock, so that operations on unrelated futexes never
+//! contend with each other.
+//!
+//! Private futexes live in the table of their process and are keyed by
+//! virtual address, while futexes that may be shared between processes live
+//! in [`SHARED_FUTEX_TABLE`] and are keyed by physical address.
+//!
+//! The buckets are locked with IRQs disabled, where a page fault could not be
+//! served, so futex words are only accessed there through [`FutexWord::pin`].
 
-use core::ops::Deref;
+use core::{
+    ops::Deref,
+    sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering},
+    time::Duration,
+};
 
-use alloc::{collections::btree_map::BTreeMap, sync::Arc};
-use axsync::Mutex;
-use axtask::{TaskExtRef, WaitQueue, current};
+use alloc::{collections::vec_deque::VecDeque, sync::Arc, vec::Vec};
+use axerrno::{LinuxError, LinuxResult};
+use axhal::{mem::phys_to_virt, paging::MappingFlags};
+use axmm::AddrSpace;
+use axprocess::Pid;
+use axsync::{
+    RwLock, RwLockReadGuard,
+    spin::{SpinNoIrq, SpinNoIrqGuard},
+};
+use axtask::{TaskExtRef, TaskState, WaitQueue, current};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, PhysAddr, VirtAddr};
 
-/// A table mapping memory addresses to futex wait queues.
-pub struct FutexTable(Mutex<BTreeMap<usize, Arc<WaitQueue>>>);
-impl FutexTable {
-    /// Creates a new `FutexTable`.
-    pub fn new() -> Self {
-        Self(Mutex::new(BTreeMap::new()))
-    }
+use crate::task::{ThreadData, get_thread};
+
+/// The number of buckets in a [`FutexTable`], which must be a power of two.
+const FUTEX_BUCKETS: usize = 64;
+
+/// The bitset that matches every waiter.
+pub const FUTEX_BITSET_MATCH_ANY: u32 = u32::MAX;
+
+/// Set in a PI futex word when there are tasks waiting in the kernel.
+pub const FUTEX_WAITERS: u32 = 0x8000_0000;
+/// Set in a PI futex word when its owner died without unlocking it.
+pub const FUTEX_OWNER_DIED: u32 = 0x4000_0000;
+/// The bits of a PI futex word holding the TID of its owner.
+pub const FUTEX_TID_MASK: u32 = 0x3fff_ffff;
+
+/// A futex word in user memory.
+pub struct FutexWord {
+    aspace: Arc<RwLock<AddrSpace>>,
+    vaddr: VirtAddr,
+    /// Whether the futex operation modifies the word.
+    write: bool,
+}
 
-    /// Gets the wait queue associated with the given address.
-    pub fn get(&self, addr: usize) -> Option<WaitQueueGuard> {
-        let wq = self.0.lock().get(&addr).cloned()?;
-        Some(WaitQueueGuard {
-            key: addr,
-            inner: wq,
+impl FutexWord {
+    /// Creates the futex word at `vaddr` in `aspace`, which the futex
+    /// operation modifies if `write` is set.
+    ///
+    /// Fails with `EINVAL` if `vaddr` is not aligned.
+    pub fn new(aspace: Arc<RwLock<AddrSpace>>, vaddr: VirtAddr, write: bool) -> LinuxResult<Self> {
+        if !vaddr.is_aligned(align_of::<u32>()) {
+            return Err(LinuxError::EINVAL);
+        }
+        Ok(Self {
+            aspace,
+            vaddr,
+            write,
         })
     }
 
-    /// Gets the wait queue associated with the given address, or inserts a a
-    /// new one if it doesn't exist.
-    pub fn get_or_insert(&self, addr: usize) -> WaitQueueGuard {
-        let mut table = self.0.lock();
-        let wq = table
-            .entry(addr)
-            .or_insert_with(|| Arc::new(WaitQueue::new()));
-        WaitQueueGuard {
-            key: addr,
-            inner: wq.clone(),
+    /// Returns the virtual address of the word.
+    pub fn vaddr(&self) -> VirtAddr {
+        self.vaddr
+    }
+
+    /// Faults the word in, and returns it accessed through the kernel mapping
+    /// of its frame, which cannot fault.
+    ///
+    /// The frame stays mapped until the returned guard is dropped, since the
+    /// address space is held for reading until then: it must be pinned before
+    /// locking a bucket, and dropped before sleeping. Fails with `EFAULT` if
+    /// the word is not mapped, or not writable for an operation modifying it.
+    pub fn pin(&self) -> LinuxResult<PinnedFutexWord<'_>> {
+        let aspace = self.aspace.read();
+        let area_flags = aspace.area_flags(self.vaddr).ok_or(LinuxError::EFAULT)?;
+        if self.write && !area_flags.contains(MappingFlags::WRITE) {
+            return Err(LinuxError::EFAULT);
         }
+        // Break copy-on-write sharing of writable pages first, or the first
+        // write to the page would move the futex to another frame. Read-only
+        // pages can be waited on, as in Linux.
+        let access = if area_flags.contains(MappingFlags::WRITE) {
+            MappingFlags::WRITE
+        } else {
+            MappingFlags::READ
+        };
+        let page = self.vaddr.align_down_4k();
+        aspace.populate_area(page, PAGE_SIZE_4K, access)?;
+        let (paddr, ..) = aspace
+            .page_table()
+            .query(page)
+            .map_err(|_| LinuxError::EFAULT)?;
+        Ok(PinnedFutexWord {
+            _aspace: aspace,
+            paddr: paddr + self.vaddr.align_offset_4k(),
+        })
     }
 }
 
-#[doc(hidden)]
-pub struct WaitQueueGuard {
-    key: usize,
-    inner: Arc<WaitQueue>,
+/// A futex word faulted in by [`FutexWord::pin`].
+pub struct PinnedFutexWord<'a> {
+    _aspace: RwLockReadGuard<'a, AddrSpace>,
+    paddr: PhysAddr,
+}
+
+impl PinnedFutexWord<'_> {
+    /// Returns the physical address of the word.
+    pub fn paddr(&self) -> PhysAddr {
+        self.paddr
+    }
 }
-impl Deref for WaitQueueGuard {
-    type Target = Arc<WaitQueue>;
 
-    fn deref(&self) -> &Self::Target {
-        &self.inner
+impl Deref for PinnedFutexWord<'_> {
+    type Target = AtomicU32;
+
+    fn deref(&self) -> &AtomicU32 {
+        // SAFETY: the frame stays mapped while the address space is held, and
+        // the word is aligned.
+        unsafe { AtomicU32::from_ptr(phys_to_virt(self.paddr).as_mut_ptr_of()) }
     }
 }
-impl Drop for WaitQueueGuard {
-    fn drop(&mut self) {
+
+/// A task sleeping on a futex.
+struct FutexWaiter {
+    /// The futex address, which may change when the waiter is requeued.
+    key: AtomicUsize,
+    /// Only wakers whose bitset intersects with this one wake the waiter.
+    bitset: u32,
+    /// The TID of the waiting thread, to hand PI futexes over to it.
+    tid: Pid,
+    /// The priority of the waiting thread, by which PI futexes are handed
+    /// over.
+    priority: isize,
+    /// Set, with the bucket locked, once the waiter is dequeued by a waker.
+    woken: AtomicBool,
+    /// The queue the waiting task actually sleeps on, shared by all the
+    /// waiters of a `futex_waitv`.
+    wq: Arc<WaitQueue>,
+}
+
+impl FutexWaiter {
+    fn new(addr: usize, bitset: u32, wq: Arc<WaitQueue>) -> Arc<Self> {
         let curr = current();
-        let mut table = curr.task_ext().process_data().futex_table.0.lock();
-        if Arc::strong_count(&self.inner) == 1 && self.inner.is_empty() {
-            table.remove(&self.key);
+        let thr_data = curr.task_ext().thread_data();
+        Arc::new(Self {
+            key: AtomicUsize::new(addr),
+            bitset,
+            tid: curr.task_ext().thread.tid(),
+            priority: thr_data.pi_priority.load(Ordering::Relaxed),
+            woken: AtomicBool::new(false),
+            wq,
+        })
+    }
+
+    fn key(&self) -> usize {
+        self.key.load(Ordering::Relaxed)
+    }
+
+    fn woken(&self) -> bool {
+        self.woken.load(Ordering::Acquire)
+    }
+
+    fn wake(&self) {
+        self.woken.store(true, Ordering::Release);
+        // The waker keeps running: the woken task is put on the run queue of
+        // its own CPU and scheduled from there, without forcing a switch.
+        self.wq.notify_one(false);
+    }
+}
+
+/// The table of futexes that may be shared between processes, keyed by the
+/// physical address of the futex word.
+pub static SHARED_FUTEX_TABLE: FutexTable = FutexTable::new();
+
+type Bucket = SpinNoIrq<VecDeque<Arc<FutexWaiter>>>;
+
+/// A table mapping memory addresses to futex waiters.
+pub struct FutexTable {
+    buckets: [Bucket; FUTEX_BUCKETS],
+}
+
+impl FutexTable {
+    /// Creates a new `FutexTable`.
+    pub const fn new() -> Self {
+        Self {
+            buckets: [const { SpinNoIrq::new(VecDeque::new()) }; FUTEX_BUCKETS],
+        }
+    }
+
+    fn bucket_index(addr: usize) -> usize {
+        // Fibonacci hashing of the word index.
+        let hash = (addr >> 2).wrapping_mul(0x9e37_79b9_7f4a_7c15_u64 as usize);
+        hash >> (usize::BITS - FUTEX_BUCKETS.trailing_zeros())
+    }
+
+    fn bucket(&self, addr: usize) -> &Bucket {
+        &self.buckets[Self::bucket_index(addr)]
+    }
+
+    /// Locks the buckets of two addresses in a consistent order.
+    ///
+    /// The second guard is `None` if both addresses hash to the same bucket.
+    fn lock_two(
+        &self,
+        addr: usize,
+        addr2: usize,
+    ) -> (
+        SpinNoIrqGuard<'_, VecDeque<Arc<FutexWaiter>>>,
+        Option<SpinNoIrqGuard<'_, VecDeque<Arc<FutexWaiter>>>>,
+    ) {
+        let (i, j) = (Self::bucket_index(addr), Self::bucket_index(addr2));
+        if i == j {
+            (self.buckets[i].lock(), None)
+        } else if i < j {
+            let first = self.buckets[i].lock();
+            (first, Some(self.buckets[j].lock()))
+        } else {
+            let second = self.buckets[j].lock();
+            (self.buckets[i].lock(), Some(second))
+        }
+    }
+
+    /// Sleeps on the futex at `addr` until woken up by a waker whose bitset
+    /// intersects with `bitset`, or until `timeout` has elapsed.
+    ///
+    /// Fails with `EAGAIN` without sleeping if `word` does not hold `value`
+    /// once the bucket is locked, and with `ETIMEDOUT` on timeout.
+    pub fn wait(
+        &self,
+        addr: usize,
+        bitset: u32,
+        word: &FutexWord,
+        value: u32,
+        timeout: Option<Duration>,
+    ) -> LinuxResult {
+        let waiter = FutexWaiter::new(addr, bitset, Arc::new(WaitQueue::new()));
+        {
+            let word = word.pin()?;
+            let mut bucket = self.bucket(addr).lock();
+            if word.load(Ordering::SeqCst) != value {
+                return Err(LinuxError::EAGAIN);
+            }
+            bucket.push_back(waiter.clone());
+        }
+        self.sleep(&waiter, timeout)
+    }
+
+    /// Sleeps until `waiter`, which has been queued, is woken up or until
+    /// `timeout` has elapsed.
+    fn sleep(&self, waiter: &Arc<FutexWaiter>, timeout: Option<Duration>) -> LinuxResult {
+        let woken = || waiter.woken();
+        match timeout {
+            Some(timeout) => {
+                waiter.wq.wait_timeout_until(timeout, woken);
+            }
+            None => waiter.wq.wait_until(woken),
+        }
+        // Timed out, unless woken up in the meantime.
+        if self.dequeue(waiter) {
+            Ok(())
+        } else {
+            Err(LinuxError::ETIMEDOUT)
+        }
+    }
+
+    /// Removes `waiter` from its bucket if it is still queued.
+    ///
+    /// Returns whether it has been woken up instead.
+    fn dequeue(&self, waiter: &Arc<FutexWaiter>) -> bool {
+        if waiter.woken() {
+            return true;
+        }
+        // The waiter may have been requeued, so look it up by its current
+        // key.
+        loop {
+            let key = waiter.key();
+            let mut bucket = self.bucket(key).lock();
+            if waiter.woken() {
+                return true;
+            }
+            if waiter.key() != key {
+                continue;
+            }
+            bucket.retain(|w| !Arc::ptr_eq(w, waiter));
+            return false;
+        }
+    }
+
+    /// Wakes up at most `count` tasks waiting on the futex at `addr` whose
+    /// bitset intersects with `bitset`.
+    ///
+    /// Returns the number of tasks woken up.
+    pub fn wake(&self, addr: usize, count: usize, bitset: u32) -> usize {
+        let mut bucket = self.bucket(addr).lock();
+        Self::wake_locked(&mut bucket, addr, count, bitset)
+    }
+
+    fn wake_locked(
+        bucket: &mut VecDeque<Arc<FutexWaiter>>,
+        addr: usize,
+        count: usize,
+        bitset: u32,
+    ) -> usize {
+        let mut woken = 0;
+        bucket.retain(|waiter| {
+            if woken == count || waiter.key() != addr || waiter.bitset & bitset == 0 {
+                return true;
+            }
+            waiter.wake();
+            woken += 1;
+            false
+        });
+        woken
+    }
+
+    /// Wakes up at most `count` tasks waiting on the futex at `addr`, and
+    /// moves at most `count2` of the remaining ones to the futex at `addr2`.
+    ///
+    /// If `expected` is given, fails with `EAGAIN` unless its futex word
+    /// holds its value once the buckets are locked, as in [`Self::wait`].
+    ///
+    /// Returns the total number of tasks woken up or requeued.
+    pub fn requeue(
+        &self,
+        addr: usize,
+        count: usize,
+        addr2: usize,
+        count2: usize,
+        expected: Option<(&FutexWord, u32)>,
+    ) -> LinuxResult<usize> {
+        let expected = match expected {
+            Some((word, value)) => Some((word.pin()?, value)),
+            None => None,
+        };
+        let (mut bucket, mut bucket2) = self.lock_two(addr, addr2);
+        if expected
+            .as_ref()
+            .is_some_and(|(word, value)| word.load(Ordering::SeqCst) != *value)
+        {
+            return Err(LinuxError::EAGAIN);
+        }
+        let woken = Self::wake_locked(&mut bucket, addr, count, FUTEX_BITSET_MATCH_ANY);
+        if addr == addr2 {
+            return Ok(woken);
+        }
+
+        let mut requeued = 0;
+        let mut moved = VecDeque::new();
+        bucket.retain(|waiter| {
+            if requeued == count2 || waiter.key() != addr {
+                return true;
+            }
+            waiter.key.store(addr2, Ordering::Relaxed);
+            requeued += 1;
+            if bucket2.is_some() {
+                moved.push_back(waiter.clone());
+                false
+            } else {
+                true
+            }
+        });
+        if let Some(bucket2) = bucket2.as_mut() {
+            bucket2.append(&mut moved);
+        }
+        Ok(woken + requeued)
+    }
+
+    /// Implements `FUTEX_WAKE_OP`: with both buckets locked, runs `op`, which
+    /// atomically updates `word2`, the futex word at `addr2`, and returns
+    /// whether the comparison against its old value holds. Then wakes up at
+    /// most `count` tasks waiting at `addr` and, if the comparison holds, at
+    /// most `count2` tasks waiting at `addr2`.
+    ///
+    /// Returns the total number of tasks woken up.
+    pub fn wake_op(
+        &self,
+        addr: usize,
+        count: usize,
+        addr2: usize,
+        count2: usize,
+        word2: &FutexWord,
+        op: impl FnOnce(&AtomicU32) -> LinuxResult<bool>,
+    ) -> LinuxResult<usize> {
+        let word2 = word2.pin()?;
+        let (mut bucket, mut bucket2) = self.lock_two(addr, addr2);
+        let cmp = op(&word2)?;
+        let mut woken = Self::wake_locked(&mut bucket, addr, count, FUTEX_BITSET_MATCH_ANY);
+        if cmp {
+            let bucket2 = bucket2.as_deref_mut().unwrap_or(&mut *bucket);
+            woken += Self::wake_locked(bucket2, addr2, count2, FUTEX_BITSET_MATCH_ANY);
+        }
+        Ok(woken)
+    }
+
+    /// Implements `FUTEX_LOCK_PI` and `FUTEX_TRYLOCK_PI`: takes the PI futex
+    /// at `addr` whose word is `word` for the current thread, sleeping until
+    /// it is handed over if it is owned by another thread, unless `try_only`
+    /// is set.
+    ///
+    /// While sleeping, the owner is boosted to the priority of the current
+    /// thread. Fails with `ETIMEDOUT` on timeout, and with `ESRCH` if the
+    /// owner does not exist anymore.
+    pub fn lock_pi(
+        &self,
+        addr: usize,
+        word: &FutexWord,
+        timeout: Option<Duration>,
+        try_only: bool,
+    ) -> LinuxResult {
+        let waiter = FutexWaiter::new(addr, FUTEX_BITSET_MATCH_ANY, Arc::new(WaitQueue::new()));
+        let tid = waiter.tid as u32;
+        let owner = {
+            let word = word.pin()?;
+            let mut bucket = self.bucket(addr).lock();
+            let owner = loop {
+                let old = word.load(Ordering::SeqCst);
+                let owner = old & FUTEX_TID_MASK;
+                if owner == tid {
+                    return Err(LinuxError::EDEADLK);
+                }
+                if owner == 0 {
+                    // Free (possibly because its owner died): take it over,
+                    // keeping waiters that are still queued in the kernel.
+                    let waiters = if bucket.iter().any(|w| w.key() == addr) {
+                        FUTEX_WAITERS
+                    } else {
+                        0
+                    };
+                    let new = tid | waiters | (old & FUTEX_OWNER_DIED);
+                    if word
+                        .compare_exchange(old, new, Ordering::SeqCst, Ordering::SeqCst)
+                        .is_ok()
+                    {
+                        return Ok(());
+                    }
+                    continue;
+                }
+                if try_only {
+                    return Err(LinuxError::EAGAIN);
+                }
+                // Nobody would ever hand the futex over.
+                if !thread_alive(owner as Pid) {
+                    return Err(LinuxError::ESRCH);
+                }
+                if old & FUTEX_WAITERS != 0
+                    || word
+                        .compare_exchange(
+                            old,
+                            old | FUTEX_WAITERS,
+                            Ordering::SeqCst,
+                            Ordering::SeqCst,
+                        )
+                        .is_ok()
+                {
+                    break owner;
+                }
+            };
+            bucket.push_back(waiter.clone());
+            owner
+        };
+
+        pi_boost(owner as Pid, waiter.priority);
+        let res = self.sleep(&waiter, timeout);
+        if res.is_err() {
+            self.leave_pi(addr, word, waiter.priority);
+        }
+        res
+    }
+
+    /// Cleans up after a waiter of priority `prio` gave up on the PI futex at
+    /// `addr`: clears `FUTEX_WAITERS` if it was the last one, and lowers the
+    /// boost it gave to the owner.
+    fn leave_pi(&self, addr: usize, word: &FutexWord, prio: isize) {
+        let (owner, rest) = {
+            // The word may have been unmapped while sleeping, leaving no owner
+            // to unboost.
+            let word = word.pin().ok();
+            let bucket = self.bucket(addr).lock();
+            let rest = bucket
+                .iter()
+                .filter(|w| w.key() == addr)
+                .map(|w| w.priority)
+                .min();
+            let owner = word.as_ref().map_or(0, |word| {
+                if rest.is_none() {
+                    word.fetch_and(!FUTEX_WAITERS, Ordering::SeqCst);
+                }
+                word.load(Ordering::SeqCst) & FUTEX_TID_MASK
+            });
+            (owner, rest)
+        };
+        if owner != 0 {
+            pi_unboost(owner as Pid, prio, rest);
+        }
+    }
+
+    /// Implements `FUTEX_UNLOCK_PI`: releases the PI futex at `addr` whose
+    /// word is `word`, which must be owned by the current thread, handing it
+    /// over to its highest-priority waiter.
+    ///
+    /// The current thread gives up the priority it was boosted to.
+    pub fn unlock_pi(&self, addr: usize, word: &FutexWord) -> LinuxResult {
+        let tid = current().task_ext().thread.tid() as u32;
+        let next = {
+            let word = word.pin()?;
+            let mut bucket = self.bucket(addr).lock();
+            if word.load(Ordering::SeqCst) & FUTEX_TID_MASK != tid {
+                return Err(LinuxError::EPERM);
+            }
+            let next = Self::hand_over_locked(&mut bucket, addr, &word, 0);
+            if next.is_none() {
+                word.store(0, Ordering::SeqCst);
+            }
+            next
+        };
+
+        pi_restore();
+        if let Some((tid, Some(prio))) = next {
+            pi_boost(tid, prio);
+        }
+        Ok(())
+    }
+
+    /// Hands the PI futex at `addr`, whose owner died without unlocking it,
+    /// over to its highest-priority waiter, with `FUTEX_OWNER_DIED` set.
+    ///
+    /// Returns `false` if nobody in this table is waiting for it.
+    pub fn hand_over_dead_pi(&self, addr: usize, word: &FutexWord) -> bool {
+        let next = {
+            let Ok(word) = word.pin() else {
+                return false;
+            };
+            let mut bucket = self.bucket(addr).lock();
+            if word.load(Ordering::SeqCst) & FUTEX_TID_MASK != 0 {
+                return false;
+            }
+            Self::hand_over_locked(&mut bucket, addr, &word, FUTEX_OWNER_DIED)
+        };
+        match next {
+            Some((tid, prio)) => {
+                if let Some(prio) = prio {
+                    pi_boost(tid, prio);
+                }
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Makes the first of the highest-priority waiters of the PI futex at
+    /// `addr` its owner, and wakes it up.
+    ///
+    /// Returns the TID of the new owner and the highest priority among the
+    /// waiters left, if there is any.
+    fn hand_over_locked(
+        bucket: &mut VecDeque<Arc<FutexWaiter>>,
+        addr: usize,
+        word: &AtomicU32,
+        flags: u32,
+    ) -> Option<(Pid, Option<isize>)> {
+        let mut next: Option<(usize, &Arc<FutexWaiter>)> = None;
+        for (i, w) in bucket.iter().enumerate() {
+            if w.key() == addr && next.is_none_or(|(_, n)| w.priority < n.priority) {
+                next = Some((i, w));
+            }
+        }
+        let i = next?.0;
+        let next = bucket.remove(i).unwrap();
+        let rest = bucket
+            .iter()
+            .filter(|w| w.key() == addr)
+            .map(|w| w.priority)
+            .min();
+        let waiters = if rest.is_some() { FUTEX_WAITERS } else { 0 };
+        word.store(next.tid as u32 | waiters | flags, Ordering::SeqCst);
+        next.wake();
+        Some((next.tid, rest))
+    }
+}
+
+/// One of the futexes that [`wait_multiple`] waits for.
+pub struct FutexWaitv<'a> {
+    /// The table holding the futex.
+    pub table: &'a FutexTable,
+    /// The key of the futex in the table.
+    pub key: usize,
+    /// The futex word.
+    pub word: &'a FutexWord,
+    /// The value the futex word is expected to hold.
+    pub value: u32,
+}
+
+/// Implements `futex_waitv`: sleeps on all the given futexes at once, until
+/// any of them is woken up or until `timeout` has elapsed.
+///
+/// Returns the index of a futex that was woken up. Fails with `EAGAIN` if a
+/// futex word does not hold its expected value, or `ETIMEDOUT` on timeout.
+pub fn wait_multiple(futexes: &[FutexWaitv], timeout: Option<Duration>) -> LinuxResult<usize> {
+    let wq = Arc::new(WaitQueue::new());
+    let mut waiters = Vec::with_capacity(futexes.len());
+    let mut error = None;
+    for futex in futexes {
+        let waiter = FutexWaiter::new(futex.key, FUTEX_BITSET_MATCH_ANY, wq.clone());
+        let word = match futex.word.pin() {
+            Ok(word) => word,
+            Err(err) => {
+                error = Some(err);
+                break;
+            }
+        };
+        let mut bucket = futex.table.bucket(futex.key).lock();
+        if word.load(Ordering::SeqCst) != futex.value {
+            error = Some(LinuxError::EAGAIN);
+            break;
+        }
+        bucket.push_back(waiter.clone());
+        drop(bucket);
+        waiters.push(waiter);
+    }
+
+    if error.is_none() {
+        let woken = || waiters.iter().any(|w| w.woken());
+        match timeout {
+            Some(timeout) => {
+                wq.wait_timeout_until(timeout, woken);
+            }
+            None => wq.wait_until(woken),
+        }
+    }
+
+    let mut woken = None;
+    for (i, (waiter, futex)) in waiters.iter().zip(futexes).enumerate() {
+        if futex.table.dequeue(waiter) && woken.is_none() {
+            woken = Some(i);
         }
     }
+    match woken {
+        Some(i) => Ok(i),
+        None => Err(error.unwrap_or(LinuxError::ETIMEDOUT)),
+    }
+}
+
+/// Boosts the thread `tid` to priority `prio`, if it runs at a lower one.
+fn pi_boost(tid: Pid, prio: isize) {
+    let Ok(thread) = get_thread(tid) else {
+        return;
+    };
+    let Some(thr_data) = thread.data::<ThreadData>() else {
+        return;
+    };
+    if thr_data.pi_priority.fetch_min(prio, Ordering::SeqCst) <= prio {
+        return;
+    }
+    if let Some(task) = thr_data.task() {
+        axtask::set_task_priority(&task, prio);
+    }
+}
+
+/// Lowers the boost of the thread `tid` from `prio`, given by a waiter that
+/// left, to the highest priority `rest` among the waiters left, if any.
+///
+/// The boost is kept if it does not come from `prio`, i.e. if a waiter of a
+/// higher priority boosted the thread since.
+fn pi_unboost(tid: Pid, prio: isize, rest: Option<isize>) {
+    let Ok(thread) = get_thread(tid) else {
+        return;
+    };
+    let Some(thr_data) = thread.data::<ThreadData>() else {
+        return;
+    };
+    let base = thr_data.priority.load(Ordering::SeqCst);
+    let new = rest.map_or(base, |rest| rest.min(base));
+    if new <= prio
+        || thr_data
+            .pi_priority
+            .compare_exchange(prio, new, Ordering::SeqCst, Ordering::SeqCst)
+            .is_err()
+    {
+        return;
+    }
+    if let Some(task) = thr_data.task() {
+        axtask::set_task_priority(&task, new);
+    }
+}
+
+/// Returns whether the thread `tid` exists and has not exited.
+fn thread_alive(tid: Pid) -> bool {
+    get_thread(tid).is_ok_and(|thread| {
+        thread
+            .data::<ThreadData>()
+            .and_then(ThreadData::task)
+            .is_some_and(|task| task.state() != TaskState::Exited)
+    })
+}
+
+/// Drops the priority boost of the current thread, if any.
+fn pi_restore() {
+    let curr = current();
+    let thr_data = curr.task_ext().thread_data();
+    let prio = thr_data.priority.load(Ordering::SeqCst);
+    if thr_data.pi_priority.swap(prio, Ordering::SeqCst) != prio {
+        axtask::set_priority(prio);
+    }
+}
+
+impl Default for FutexTable {
+    fn default() -> Self {
+        Self::new()
+    }
 }
@@ -10,5 +10,13 @@ extern crate alloc;
 
 pub mod futex;
 pub mod mm;
+mod pid_table;
+#[cfg(feature = "profile")]
+pub mod profile;
+pub mod resource;
+pub mod scratch;
+pub mod stat;
+pub mod syscall_stats;
 pub mod task;
-mod time;
+pub mod timer;
+pub mod vdso;
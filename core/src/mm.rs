@@ -1,15 +1,43 @@
 //! User address space management.
 
-use core::ffi::CStr;
+use core::{
+    ffi::CStr,
+    fmt,
+    mem::size_of,
+    sync::atomic::{AtomicU64, Ordering},
+    time::Duration,
+};
 
-use alloc::{borrow::ToOwned, string::String, vec, vec::Vec};
+use alloc::{
+    borrow::ToOwned,
+    collections::BTreeMap,
+    string::String,
+    sync::{Arc, Weak},
+    vec,
+    vec::Vec,
+};
 use axerrno::{AxError, AxResult};
+use axfs::fops::{File, OpenOptions};
 use axhal::{mem::virt_to_phys, paging::MappingFlags};
-use axmm::{AddrSpace, kernel_aspace};
-use kernel_elf_parser::{AuxvEntry, ELFParser, app_stack_region};
-use memory_addr::{MemoryAddr, PAGE_SIZE_4K, VirtAddr};
+use axmm::{AddrSpace, MappedFile, SharedPages};
+use axsync::{LockClass, RawRwLock, RwLock};
+use axtask::WaitQueue;
+use kernel_elf_parser::{AuxvEntry, AuxvType, ELFParser};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, PhysAddr, VirtAddr};
+use spin::Once;
 use xmas_elf::{ElfFile, program::SegmentData};
 
+/// The class of the locks of user address spaces, see `/proc/lock_stat`.
+static ASPACE_LOCKS: LockClass = LockClass::new("aspace");
+
+/// Puts `aspace` behind a lock, to be shared by the threads of a process.
+pub fn share_aspace(aspace: AddrSpace) -> Arc<RwLock<AddrSpace>> {
+    Arc::new(RwLock::const_new(
+        RawRwLock::with_class(&ASPACE_LOCKS),
+        aspace,
+    ))
+}
+
 /// Creates a new empty user address space.
 pub fn new_user_aspace_empty() -> AxResult<AddrSpace> {
     AddrSpace::new_empty(
@@ -19,18 +47,96 @@ pub fn new_user_aspace_empty() -> AxResult<AddrSpace> {
 }
 
 /// If the target architecture requires it, the kernel portion of the address
-/// space will be copied to the user address space.
+/// space will be shared with the user address space.
+///
+/// The root entries of the kernel page table are taken once at boot, so this
+/// does not lock the kernel address space.
 pub fn copy_from_kernel(aspace: &mut AddrSpace) -> AxResult {
-    if !cfg!(target_arch = "aarch64") && !cfg!(target_arch = "loongarch64") {
-        // ARMv8 (aarch64) and LoongArch64 use separate page tables for user space
-        // (aarch64: TTBR0_EL1, LoongArch64: PGDL), so there is no need to copy the
-        // kernel portion to the user page table.
-        aspace.copy_mappings_from(&kernel_aspace().lock())?;
-    }
+    // ARMv8 (aarch64) and LoongArch64 use separate page tables for user space
+    // (aarch64: TTBR0_EL1, LoongArch64: PGDL), so there is no need to copy the
+    // kernel portion to the user page table.
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    aspace.share_kernel_mappings();
+    #[cfg(any(target_arch = "aarch64", target_arch = "loongarch64"))]
+    let _ = aspace;
     Ok(())
 }
 
-/// Map the signal trampoline to the user address space.
+/// Switches the current task to another user address space.
+pub fn switch_user_aspace(aspace: &AddrSpace) {
+    switch_page_table_root(aspace.page_table_root());
+}
+
+/// Switches the current task off its user address space, to the page table
+/// that kernel tasks run on.
+pub fn switch_kernel_aspace() {
+    #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+    switch_page_table_root(axhal::paging::kernel_page_table_root());
+    // The user half has no page table, as for kernel tasks.
+    #[cfg(any(target_arch = "aarch64", target_arch = "loongarch64"))]
+    switch_page_table_root(PhysAddr::from(0));
+}
+
+fn switch_page_table_root(root: PhysAddr) {
+    axtask::with_current_ctx_mut(|ctx| {
+        ctx.set_page_table_root(root);
+        axhal::paging::set_user_root(root);
+        // SAFETY: the kernel portion of the address space is the same for all
+        // user address spaces.
+        unsafe {
+            #[cfg(any(target_arch = "aarch64", target_arch = "loongarch64"))]
+            axhal::arch::write_page_table_root0(root);
+            #[cfg(not(any(target_arch = "aarch64", target_arch = "loongarch64")))]
+            axhal::arch::write_page_table_root(root);
+        }
+    });
+}
+
+/// The empty address space that exited processes are left with, which is
+/// never switched to.
+static EXITED_ASPACE: Once<Arc<RwLock<AddrSpace>>> = Once::new();
+
+/// Returns the address space to leave to an exited process, so that its own
+/// can be torn down before the process is reaped.
+pub fn exited_aspace() -> AxResult<Arc<RwLock<AddrSpace>>> {
+    EXITED_ASPACE
+        .try_call_once(|| new_user_aspace_empty().map(share_aspace))
+        .cloned()
+}
+
+/// The address spaces of exited processes, to be torn down by the reclaim
+/// task.
+static DETACHED_ASPACES: spin::Mutex<Vec<AddrSpace>> = spin::Mutex::new(Vec::new());
+static RECLAIM_WQ: WaitQueue = WaitQueue::new();
+static RECLAIM_TASK: Once = Once::new();
+
+/// Hands `aspace`, which no CPU uses any more, to a kernel task that tears it
+/// down, so that the caller does not wait for all of its frames to be freed.
+///
+/// The frames go back to the allocator through the page cache of the CPU of
+/// the task, which returns them in batches.
+pub fn reclaim_aspace(aspace: AddrSpace) {
+    RECLAIM_TASK.call_once(|| {
+        axtask::spawn_raw(
+            || loop {
+                RECLAIM_WQ.wait_until(|| !DETACHED_ASPACES.lock().is_empty());
+                loop {
+                    let aspace = DETACHED_ASPACES.lock().pop();
+                    let Some(aspace) = aspace else {
+                        break;
+                    };
+                    drop(aspace);
+                }
+            },
+            "aspace_reclaim".into(),
+            axconfig::TASK_STACK_SIZE,
+        );
+    });
+    DETACHED_ASPACES.lock().push(aspace);
+    RECLAIM_WQ.notify_one(false);
+}
+
+/// Map the signal trampoline and the vDSO to the user address space.
 pub fn map_trampoline(aspace: &mut AddrSpace) -> AxResult {
     let signal_trampoline_paddr = virt_to_phys(axsignal::arch::signal_trampoline_address().into());
     aspace.map_linear(
@@ -39,78 +145,262 @@ pub fn map_trampoline(aspace: &mut AddrSpace) -> AxResult {
         PAGE_SIZE_4K,
         MappingFlags::READ | MappingFlags::EXECUTE | MappingFlags::USER,
     )?;
-    Ok(())
+    crate::vdso::map_vdso(aspace)
 }
 
-/// Map the elf file to the user address space.
-///
-/// # Arguments
-/// - `uspace`: The address space of the user app.
-/// - `elf`: The elf file.
+/// Identifies a file by its filesystem and inode number, which unlike its
+/// path stays the same when the file is renamed, and changes when it is
+/// removed and created again.
+pub type FileKey = (u64, u64);
+
+/// Returns the [`FileKey`] of `file`, which is open at `path`.
+pub fn file_key(file: &File, path: &str) -> AxResult<FileKey> {
+    let info = match file.info() {
+        Some(info) => info,
+        None => axfs::api::file_info(path)?,
+    };
+    Ok((info.dev, info.ino))
+}
+
+/// The cached pages of each mapped file, with the path it was first mapped
+/// at.
+static FILE_PAGES: spin::Mutex<BTreeMap<FileKey, (String, Weak<SharedPages>)>> =
+    spin::Mutex::new(BTreeMap::new());
+
+/// Gets the cached pages of the file `key` at `path`, which are shared by all
+/// the mappings of the file, including the segments of running executables.
 ///
-/// # Returns
-/// - The entry point of the user app.
-fn map_elf(uspace: &mut AddrSpace, elf: &ElfFile) -> AxResult<(VirtAddr, [AuxvEntry; 16])> {
-    let uspace_base = uspace.base().as_usize();
-    let elf_parser = ELFParser::new(
-        elf,
-        axconfig::plat::USER_INTERP_BASE,
-        Some(uspace_base as isize),
-        uspace_base,
-    )
-    .map_err(|_| AxError::InvalidData)?;
+/// `file` is called to open the file if its pages are not cached.
+pub fn file_pages(
+    key: FileKey,
+    path: &str,
+    file: impl FnOnce() -> Arc<dyn MappedFile>,
+) -> Arc<SharedPages> {
+    let mut table = FILE_PAGES.lock();
+    if let Some(pages) = table.get(&key).and_then(|(_, pages)| pages.upgrade()) {
+        return pages;
+    }
+    table.retain(|_, (_, pages)| pages.strong_count() > 0);
+    let pages = Arc::new(SharedPages::new(Some(file())));
+    table.insert(key, (path.to_owned(), Arc::downgrade(&pages)));
+    pages
+}
 
-    for segement in elf_parser.ph_load() {
-        debug!(
-            "Mapping ELF segment: [{:#x?}, {:#x?}) flags: {:#x?}",
-            segement.vaddr,
-            segement.vaddr + segement.memsz as usize,
-            segement.flags
-        );
-        let seg_pad = segement.vaddr.align_offset_4k();
-        assert_eq!(seg_pad, segement.offset % PAGE_SIZE_4K);
+/// Returns the cached pages of the file `key` if it is mapped, which must be
+/// kept coherent when the file is accessed other than through its mappings.
+pub fn mapped_file_pages(key: FileKey) -> Option<Arc<SharedPages>> {
+    FILE_PAGES
+        .lock()
+        .get(&key)
+        .and_then(|(_, pages)| pages.upgrade())
+}
 
-        let seg_align_size =
-            (segement.memsz as usize + seg_pad + PAGE_SIZE_4K - 1) & !(PAGE_SIZE_4K - 1);
-        uspace.map_alloc(
-            segement.vaddr.align_down_4k(),
-            seg_align_size,
-            segement.flags,
-            true,
-        )?;
-        let seg_data = elf
-            .input
-            .get(segement.offset..segement.offset + segement.filesz as usize)
-            .ok_or(AxError::InvalidData)?;
-        uspace.write(segement.vaddr, seg_data)?;
-        // TDOO: flush the I-cache
+/// Forgets the cached pages of the file `key` when its last link is removed,
+/// so that a new file reusing its inode number does not map them. The
+/// existing mappings keep them.
+pub fn forget_file_pages(key: FileKey) {
+    FILE_PAGES.lock().remove(&key);
+}
+
+/// Returns the path of the file whose cached pages are `pages`, if it is
+/// mapped, e.g. to name the mappings of a process.
+pub fn file_pages_path(pages: &Arc<SharedPages>) -> Option<String> {
+    FILE_PAGES
+        .lock()
+        .values()
+        .find(|(_, other)| core::ptr::eq(other.as_ptr(), Arc::as_ptr(pages)))
+        .map(|(path, _)| path.clone())
+}
+
+/// An executable file whose segments are mapped by [`map_elf`].
+struct ExecFile(File);
+
+impl MappedFile for ExecFile {
+    fn read_at(&self, offset: u64, buf: &mut [u8]) -> AxResult<usize> {
+        self.0.read_at(offset, buf)
     }
 
-    Ok((
-        elf_parser.entry().into(),
-        elf_parser.auxv_vector(PAGE_SIZE_4K),
-    ))
+    fn write_at(&self, offset: u64, buf: &[u8]) -> AxResult<usize> {
+        self.0.write_at(offset, buf)
+    }
+
+    fn size(&self) -> AxResult<u64> {
+        Ok(self.0.get_attr()?.size())
+    }
 }
 
-/// Load the user app to the user address space.
+/// Reads the file at `offset` into `buf`, until it is full or the end of the
+/// file is reached.
+fn read_at_most(file: &File, offset: u64, buf: &mut [u8]) -> AxResult<usize> {
+    let mut read = 0;
+    while read < buf.len() {
+        let n = file.read_at(offset + read as u64, &mut buf[read..])?;
+        if n == 0 {
+            break;
+        }
+        read += n;
+    }
+    Ok(read)
+}
+
+/// Reads up to `len` bytes from the beginning of the file.
+fn read_head(file: &File, len: usize) -> AxResult<Vec<u8>> {
+    let mut buf = vec![0; len];
+    let read = read_at_most(file, 0, &mut buf)?;
+    buf.truncate(read);
+    Ok(buf)
+}
+
+/// Reads the part of the elf file that contains its headers and the
+/// interpreter path, which is usually within the first page.
+fn read_elf_head(file: &File, head: Vec<u8>) -> AxResult<Vec<u8>> {
+    let needed = {
+        let elf = ElfFile::new(&head).map_err(|_| AxError::InvalidData)?;
+        let ph_end = elf.header.pt2.ph_offset() as usize
+            + elf.header.pt2.ph_count() as usize * elf.header.pt2.ph_entry_size() as usize;
+        if ph_end > head.len() {
+            ph_end
+        } else {
+            elf.program_iter()
+                .filter(|ph| ph.get_type() == Ok(xmas_elf::program::Type::Interp))
+                .map(|ph| (ph.offset() + ph.file_size()) as usize)
+                .max()
+                .unwrap_or(0)
+        }
+    };
+    if needed <= head.len() {
+        return Ok(head);
+    }
+    // Read again, and check the interpreter path if the program headers were
+    // not read before.
+    read_elf_head(file, read_head(file, needed)?)
+}
+
+/// A `PT_LOAD` segment of a cached [`ElfImage`].
+struct ElfSegment {
+    vaddr: VirtAddr,
+    offset: usize,
+    filesz: usize,
+    memsz: usize,
+    flags: MappingFlags,
+}
+
+/// A parsed elf file that can be mapped without reading its headers again.
+struct ElfImage {
+    segments: Vec<ElfSegment>,
+    entry: VirtAddr,
+    /// The auxiliary vector, before the stack related entries are added.
+    auxv: [AuxvEntry; 16],
+    file: Arc<ExecFile>,
+    pages: Arc<SharedPages>,
+}
+
+/// A parsed executable, cached by [`load_user_app`].
+enum ExecImage {
+    /// A script or a dynamically linked elf file, which is run by prepending
+    /// these arguments, starting with the interpreter path.
+    Interp(Vec<String>),
+    /// A statically linked elf file, or an interpreter.
+    Elf(ElfImage),
+}
+
+/// The maximum number of executables in [`EXEC_IMAGES`].
+const EXEC_IMAGE_CACHE_SIZE: usize = 16;
+
+/// An executable in [`EXEC_IMAGES`].
+struct CachedExecImage {
+    /// The last time it was used, in [`EXEC_IMAGE_TICK`] units.
+    last_used: u64,
+    /// The modification time and the size of the file when it was parsed,
+    /// which must not have changed for the image to be used.
+    mtime: Duration,
+    size: u64,
+    image: Arc<ExecImage>,
+}
+
+/// The recently executed files by [`FileKey`], so that the image is shared by
+/// all the links to the file, and is not used for another file moved to its
+/// path.
+static EXEC_IMAGES: spin::Mutex<BTreeMap<FileKey, CachedExecImage>> =
+    spin::Mutex::new(BTreeMap::new());
+static EXEC_IMAGE_TICK: AtomicU64 = AtomicU64::new(0);
+
+/// The dynamic linkers that the testcases are linked against, which are
+/// served by the one of musl.
+const INTERP_LINKS: [&str; 4] = [
+    "/lib/ld-linux-riscv64-lp64.so.1",
+    "/lib64/ld-linux-loongarch-lp64d.so.1",
+    "/lib64/ld-linux-x86-64.so.2",
+    "/lib/ld-linux-aarch64.so.1",
+];
+const MUSL_INTERP: &str = "/musl/lib/libc.so";
+
+/// Links the dynamic linkers that the testcases ask for to the one of musl,
+/// unless they exist.
+pub fn link_interpreters() {
+    for path in INTERP_LINKS {
+        if let Err(e) = axfs::api::symlink(MUSL_INTERP, path) {
+            debug!("Not linking {} to {}: {:?}", path, MUSL_INTERP, e);
+        }
+    }
+}
+
+/// Drops the cached executable `key`, which must be called when its last link
+/// is removed, so that a new file reusing its inode number does not get it.
 ///
-/// # Arguments
-/// - `uspace`: The address space of the user app.
-/// - `args`: The arguments of the user app. The first argument is the path of the user app.
-/// - `envs`: The environment variables of the user app.
+/// Running processes keep using the pages they have mapped.
+pub fn invalidate_exec_image(key: FileKey) {
+    EXEC_IMAGES.lock().remove(&key);
+}
+
+/// Gets the parsed executable at the canonical `path`, from the cache if
+/// possible.
 ///
-/// # Returns
-/// - The entry point of the user app.
-/// - The stack pointer of the user app.
-pub fn load_user_app(
-    uspace: &mut AddrSpace,
-    args: &[String],
-    envs: &[String],
-) -> AxResult<(VirtAddr, VirtAddr)> {
-    if args.is_empty() {
-        return Err(AxError::InvalidInput);
+/// A cached image is only used if the file has not been modified or resized
+/// since it was parsed, through whichever file descriptor or path.
+fn exec_image(path: &str) -> AxResult<Arc<ExecImage>> {
+    let info = axfs::api::file_info(path)?;
+    let key = (info.dev, info.ino);
+    let size = axfs::api::metadata(path)?.size();
+    let tick = EXEC_IMAGE_TICK.fetch_add(1, Ordering::Relaxed);
+    if let Some(cached) = EXEC_IMAGES.lock().get_mut(&key) {
+        if cached.mtime == info.mtime && cached.size == size {
+            cached.last_used = tick;
+            return Ok(cached.image.clone());
+        }
+    }
+
+    // The file is checked before it is read, so that a change while it is
+    // parsed makes the next lookup miss.
+    let image = Arc::new(parse_exec_image(path)?);
+    let mut images = EXEC_IMAGES.lock();
+    if images.len() >= EXEC_IMAGE_CACHE_SIZE && !images.contains_key(&key) {
+        let lru = images
+            .iter()
+            .min_by_key(|(_, cached)| cached.last_used)
+            .map(|(key, _)| *key);
+        if let Some(lru) = lru {
+            images.remove(&lru);
+        }
     }
-    let file_data = axfs::api::read(args[0].as_str())?;
+    images.insert(
+        key,
+        CachedExecImage {
+            last_used: tick,
+            mtime: info.mtime,
+            size,
+            image: image.clone(),
+        },
+    );
+    Ok(image)
+}
+
+/// Reads and parses the executable at the canonical `path`.
+fn parse_exec_image(path: &str) -> AxResult<ExecImage> {
+    let mut opts = OpenOptions::new();
+    opts.read(true);
+    let file = Arc::new(ExecFile(File::open(path, &opts)?));
+    let file_data = read_head(&file.0, PAGE_SIZE_4K)?;
     //检测到文件数据的前两个字节是#!，则表示是脚本文件
     // 需要解析脚本文件的头部，获取解释器路径
     if file_data.starts_with(b"#!") {
@@ -118,16 +408,15 @@ pub fn load_user_app(
         let pos = head.iter().position(|c| *c == b'\n').unwrap_or(head.len());
         let line = core::str::from_utf8(&head[..pos]).map_err(|_| AxError::InvalidData)?;
 
-        let new_args: Vec<String> = line
+        let interp_args: Vec<String> = line
             .trim()
             .splitn(2, |c: char| c.is_ascii_whitespace())
             .map(|s| s.trim_ascii().to_owned())
-            .chain(args.iter().cloned())
             .collect();
-
-        return load_user_app(uspace, &new_args, envs);
+        return Ok(ExecImage::Interp(interp_args));
     }
 
+    let file_data = read_elf_head(&file.0, file_data)?;
     let elf = ElfFile::new(&file_data).map_err(|_| AxError::InvalidData)?;
 
     if let Some(interp) = elf
@@ -139,29 +428,326 @@ pub fn load_user_app(
             _ => panic!("Invalid data in Interp Elf Program Header"),
         };
 
-        let mut interp_path = axfs::api::canonicalize(
+        // The links to the interpreter, see `link_interpreters`, are resolved
+        // once here, as the image is cached.
+        let interp_path = axfs::api::real_path(
             CStr::from_bytes_with_nul(interp)
                 .map_err(|_| AxError::InvalidData)?
                 .to_str()
                 .map_err(|_| AxError::InvalidData)?,
         )?;
 
-        if interp_path == "/lib/ld-linux-riscv64-lp64.so.1"
-            || interp_path == "/lib64/ld-linux-loongarch-lp64d.so.1"
-            || interp_path == "/lib64/ld-linux-x86-64.so.2"
-            || interp_path == "/lib/ld-linux-aarch64.so.1"
-        {
-            // TODO: Use soft link
-            interp_path = String::from("/musl/lib/libc.so");
+        // The interpreter is run with the path of the user app.
+        return Ok(ExecImage::Interp(vec![interp_path]));
+    }
+
+    let uspace_base = axconfig::plat::USER_SPACE_BASE;
+    let elf_parser = ELFParser::new(
+        &elf,
+        axconfig::plat::USER_INTERP_BASE,
+        Some(uspace_base as isize),
+        uspace_base,
+    )
+    .map_err(|_| AxError::InvalidData)?;
+    let segments = elf_parser
+        .ph_load()
+        .into_iter()
+        .map(|ph| ElfSegment {
+            vaddr: ph.vaddr,
+            offset: ph.offset,
+            filesz: ph.filesz as usize,
+            memsz: ph.memsz as usize,
+            flags: ph.flags,
+        })
+        .collect();
+    let pages = file_pages(file_key(&file.0, path)?, path, || file.clone());
+    Ok(ExecImage::Elf(ElfImage {
+        segments,
+        entry: elf_parser.entry().into(),
+        auxv: elf_parser.auxv_vector(PAGE_SIZE_4K),
+        file,
+        pages,
+    }))
+}
+
+/// Map the elf file to the user address space.
+///
+/// The segments are mapped privately from the cached pages of the file, so
+/// the frames of unmodified pages are shared by all processes running it. The
+/// last file page of a segment followed by bss is copied here, to zero the rest
+/// of the page.
+///
+/// # Arguments
+/// - `uspace`: The address space of the user app.
+/// - `image`: The parsed elf file.
+fn map_elf(uspace: &mut AddrSpace, image: &ElfImage) -> AxResult {
+    for segement in &image.segments {
+        debug!(
+            "Mapping ELF segment: [{:#x?}, {:#x?}) flags: {:#x?}",
+            segement.vaddr,
+            segement.vaddr + segement.memsz,
+            segement.flags
+        );
+        let seg_pad = segement.vaddr.align_offset_4k();
+        assert_eq!(seg_pad, segement.offset % PAGE_SIZE_4K);
+
+        let seg_start = segement.vaddr.align_down_4k();
+        let file_offset = segement.offset - seg_pad;
+        let data_end = segement.vaddr + segement.filesz;
+        let mem_end = (segement.vaddr + segement.memsz).align_up_4k();
+        // The rest of the last file page is the start of the bss, so the page
+        // can't be shared.
+        let has_bss_page = segement.memsz > segement.filesz && !data_end.is_aligned_4k();
+        let file_end = if has_bss_page {
+            data_end.align_down_4k()
+        } else {
+            data_end.align_up_4k()
+        };
+        if file_end > seg_start {
+            uspace.map_file(
+                seg_start,
+                file_end - seg_start,
+                segement.flags,
+                image.pages.clone(),
+                file_offset,
+            )?;
+        }
+        let mut anon_start = file_end;
+        if has_bss_page {
+            let mut buf = [0; PAGE_SIZE_4K];
+            let len = data_end - file_end;
+            let read = read_at_most(
+                &image.file.0,
+                (file_offset + (file_end - seg_start)) as u64,
+                &mut buf[..len],
+            )?;
+            if read < len {
+                return Err(AxError::InvalidData);
+            }
+            uspace.map_alloc(file_end, PAGE_SIZE_4K, segement.flags, true)?;
+            uspace.write(file_end, &buf)?;
+            anon_start += PAGE_SIZE_4K;
+        }
+        if mem_end > anon_start {
+            uspace.map_alloc(anon_start, mem_end - anon_start, segement.flags, false)?;
+        }
+        // TDOO: flush the I-cache
+    }
+    Ok(())
+}
+
+/// The arguments and environment variables of a new program.
+///
+/// They are kept as NUL-terminated strings in one buffer, in the order they
+/// are laid out at the top of the stack of the program, so that they are
+/// copied from the caller once and written to the new stack as is.
+#[derive(Default)]
+pub struct ExecArgs {
+    strings: Vec<u8>,
+    argc: usize,
+    envc: usize,
+}
+
+impl ExecArgs {
+    /// Creates an empty argument list.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Appends an argument. All arguments must be pushed before the
+    /// environment variables.
+    pub fn push_arg(&mut self, arg: &str) {
+        debug_assert_eq!(self.envc, 0);
+        self.push(arg);
+        self.argc += 1;
+    }
+
+    /// Appends an environment variable.
+    pub fn push_env(&mut self, env: &str) {
+        self.push(env);
+        self.envc += 1;
+    }
+
+    fn push(&mut self, s: &str) {
+        self.strings.reserve(s.len() + 1);
+        self.strings.extend_from_slice(s.as_bytes());
+        self.strings.push(0);
+    }
+
+    /// Inserts `args` before the existing arguments.
+    fn prepend_args(&mut self, args: &[String]) {
+        let len = args.iter().map(|arg| arg.len() + 1).sum();
+        let mut strings = Vec::with_capacity(len + self.strings.len());
+        for arg in args {
+            strings.extend_from_slice(arg.as_bytes());
+            strings.push(0);
         }
+        strings.extend_from_slice(&self.strings);
+        self.strings = strings;
+        self.argc += args.len();
+    }
+
+    /// Returns the strings with their offsets in the buffer, arguments first.
+    fn strings(&self) -> impl Iterator<Item = (usize, &str)> {
+        self.strings
+            .split_inclusive(|&b| b == 0)
+            .scan(0, |offset, s| {
+                let start = *offset;
+                *offset += s.len();
+                // Only valid strings are pushed.
+                Some((
+                    start,
+                    core::str::from_utf8(&s[..s.len() - 1]).unwrap_or_default(),
+                ))
+            })
+    }
+
+    /// Returns the first argument, which is the path of the program.
+    pub fn arg0(&self) -> Option<&str> {
+        self.strings().take(self.argc).next().map(|(_, s)| s)
+    }
+}
+
+impl fmt::Debug for ExecArgs {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let strs = || self.strings().map(|(_, s)| s);
+        f.debug_struct("ExecArgs")
+            .field("args", &DebugIter(|| strs().take(self.argc)))
+            .field("envs", &DebugIter(|| strs().skip(self.argc)))
+            .finish()
+    }
+}
+
+struct DebugIter<F>(F);
+
+impl<F: Fn() -> I, I: Iterator<Item: fmt::Debug>> fmt::Debug for DebugIter<F> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_list().entries((self.0)()).finish()
+    }
+}
+
+/// Returns 16 bytes for `AT_RANDOM`, which the C library seeds its stack
+/// protector and pointer guard with.
+///
+/// There is no entropy source in the kernel, so they are only made to differ
+/// between runs.
+fn at_random_bytes() -> [usize; 16 / size_of::<usize>()] {
+    static COUNTER: AtomicU64 = AtomicU64::new(0);
+    let mut seed = axhal::time::monotonic_time_nanos()
+        ^ COUNTER
+            .fetch_add(0x9e37_79b9_7f4a_7c15, Ordering::Relaxed)
+            .rotate_left(17);
+    // splitmix64
+    let mut next = || {
+        seed = seed.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = seed;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        (z ^ (z >> 31)) as usize
+    };
+    core::array::from_fn(|_| next())
+}
+
+/// Writes the initial stack of a program, ending at `ustack_end`, and returns
+/// the stack pointer.
+///
+/// From the top down, the stack holds the strings of `args`, 16 random bytes,
+/// the auxiliary vector and the `envp` and `argv` arrays, and `argc` at the
+/// stack pointer. The strings are written straight from `args`, and the rest
+/// is built in one buffer, so the stack takes two writes.
+fn write_user_stack(
+    uspace: &mut AddrSpace,
+    args: &ExecArgs,
+    auxv: &[AuxvEntry],
+    ustack_end: VirtAddr,
+) -> AxResult<VirtAddr> {
+    const WORD: usize = size_of::<usize>();
+    const AT_NULL: usize = 0;
+    const AT_RANDOM: usize = 25;
+    const AT_EXECFN: usize = 31;
+    // `AuxvEntry` is a pair of words, the type and the value.
+    const _: () = assert!(size_of::<AuxvEntry>() == 2 * WORD);
+    let auxv =
+        unsafe { core::slice::from_raw_parts(auxv.as_ptr().cast::<[usize; 2]>(), auxv.len()) };
+    let auxv = auxv
+        .iter()
+        .filter(|[ty, _]| ![AT_NULL, AT_RANDOM, AT_EXECFN].contains(ty));
 
-        // Set the first argument to the path of the user app.
-        let mut new_args = vec![interp_path];
-        new_args.extend_from_slice(args);
-        return load_user_app(uspace, &new_args, envs);
+    let strings_start = ustack_end - args.strings.len();
+    let random_start = strings_start.align_down(16usize) - 16;
+    let header_words = 1 + args.argc + 1 + args.envc + 1 + 2 * (auxv.clone().count() + 3);
+    let user_sp = (random_start - header_words * WORD).align_down(16usize);
+    if user_sp < ustack_end - axconfig::plat::USER_STACK_SIZE + PAGE_SIZE_4K {
+        return Err(AxError::NoMemory);
     }
 
-    let (entry, mut auxv) = map_elf(uspace, &elf)?;
+    let mut header = vec![0usize; (strings_start.align_down(16usize) - user_sp) / WORD];
+    let mut words = header.iter_mut();
+    let mut push = |word| *words.next().unwrap() = word;
+    push(args.argc);
+    let mut strings = args
+        .strings()
+        .map(|(offset, _)| strings_start.as_usize() + offset);
+    strings.by_ref().take(args.argc).for_each(&mut push);
+    push(0);
+    strings.for_each(&mut push);
+    push(0);
+    for &[ty, value] in auxv {
+        push(ty);
+        push(value);
+    }
+    push(AT_RANDOM);
+    push(random_start.as_usize());
+    push(AT_EXECFN);
+    push(strings_start.as_usize());
+    push(AT_NULL);
+    push(0);
+    drop(push);
+    let len = header.len();
+    header[len - 2..].copy_from_slice(&at_random_bytes());
+
+    let data_start = user_sp.align_down_4k();
+    uspace.populate_area(data_start, ustack_end - data_start, MappingFlags::WRITE)?;
+    let header = unsafe { core::slice::from_raw_parts(header.as_ptr().cast::<u8>(), len * WORD) };
+    uspace.write(user_sp, header)?;
+    uspace.write(strings_start, &args.strings)?;
+    Ok(user_sp)
+}
+
+/// Load the user app to the user address space.
+///
+/// Parsed executables are cached by their canonical paths, so running the same
+/// program again reads nothing but the bss pages from the file system.
+///
+/// # Arguments
+/// - `uspace`: The address space of the user app.
+/// - `args`: The arguments and environment variables of the user app. The
+///   first argument is the path of the user app. The arguments of an
+///   interpreter are prepended to them.
+///
+/// # Returns
+/// - The entry point of the user app.
+/// - The stack pointer of the user app.
+pub fn load_user_app(
+    uspace: &mut AddrSpace,
+    args: &mut ExecArgs,
+) -> AxResult<(VirtAddr, VirtAddr)> {
+    let path = axfs::api::real_path(args.arg0().ok_or(AxError::InvalidInput)?)?;
+    let image = match &*exec_image(&path)? {
+        ExecImage::Interp(interp_args) => {
+            args.prepend_args(interp_args);
+            return load_user_app(uspace, args);
+        }
+        ExecImage::Elf(image) => image,
+    };
+
+    map_elf(uspace, image)?;
+    let entry = image.entry;
+    let mut auxv = image.auxv.to_vec();
+    auxv.insert(
+        0,
+        AuxvEntry::new(AuxvType::SYSINFO_EHDR, crate::vdso::VDSO_ADDR),
+    );
     // The user stack is divided into two parts:
     // `ustack_start` -> `ustack_pointer`: It is the stack space that users actually read and write.
     // `ustack_pointer` -> `ustack_end`: It is the space that contains the arguments, environment variables and auxv passed to the app.
@@ -174,26 +760,19 @@ pub fn load_user_app(
         ustack_start, ustack_end
     );
 
-    let stack_data = app_stack_region(args, envs, &mut auxv, ustack_start, ustack_size);
-    uspace.map_alloc(
-        ustack_start,
-        ustack_size,
-        MappingFlags::READ | MappingFlags::WRITE | MappingFlags::USER,
-        true,
-    )?;
-
-    let heap_start = VirtAddr::from_usize(axconfig::plat::USER_HEAP_BASE);
-    let heap_size = axconfig::plat::USER_HEAP_SIZE;
+    // The lowest page is a guard that turns stack overflows into segmentation
+    // faults, and the rest is allocated as the stack grows down.
+    uspace.map_alloc(ustack_start, PAGE_SIZE_4K, MappingFlags::USER, false)?;
     uspace.map_alloc(
-        heap_start,
-        heap_size,
+        ustack_start + PAGE_SIZE_4K,
+        ustack_size - PAGE_SIZE_4K,
         MappingFlags::READ | MappingFlags::WRITE | MappingFlags::USER,
-        true,
+        false,
     )?;
 
-    let user_sp = ustack_end - stack_data.len();
+    // The heap is mapped by `brk` as it grows.
 
-    uspace.write(user_sp, stack_data.as_slice())?;
+    let user_sp = write_user_stack(uspace, args, &auxv, ustack_end)?;
 
     Ok((entry, user_sp))
 }
@@ -0,0 +1,66 @@
+//! Global tables of threads, processes, process groups and sessions by ID.
+
+use alloc::{
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+
+use axprocess::Pid;
+use spin::RwLock;
+use weak_map::WeakMap;
+
+/// The number of shards of a table, a power of two.
+const SHARDS: usize = 16;
+
+/// A table of weak references by ID, split in shards behind their own locks
+/// so that tasks created or looked up at the same time rarely contend. IDs
+/// are allocated in sequence, so consecutive ones go to different shards.
+pub(crate) struct PidTable<T> {
+    shards: [RwLock<WeakMap<Pid, Weak<T>>>; SHARDS],
+}
+
+impl<T> PidTable<T> {
+    /// Creates an empty table.
+    pub const fn new() -> Self {
+        Self {
+            shards: [const { RwLock::new(WeakMap::new()) }; SHARDS],
+        }
+    }
+
+    fn shard(&self, id: Pid) -> &RwLock<WeakMap<Pid, Weak<T>>> {
+        &self.shards[id as usize % SHARDS]
+    }
+
+    /// Inserts `value` with `id`, replacing the previous one.
+    pub fn insert(&self, id: Pid, value: &Arc<T>) {
+        self.shard(id).write().insert(id, value);
+    }
+
+    /// Inserts `value` with `id` unless there already is a value, returning
+    /// whether it was inserted. Only a read lock is taken if there is one.
+    pub fn insert_new(&self, id: Pid, value: &Arc<T>) -> bool {
+        let shard = self.shard(id);
+        if shard.read().contains_key(&id) {
+            return false;
+        }
+        let mut shard = shard.write();
+        if shard.contains_key(&id) {
+            return false;
+        }
+        shard.insert(id, value);
+        true
+    }
+
+    /// Returns the value with `id`.
+    pub fn get(&self, id: Pid) -> Option<Arc<T>> {
+        self.shard(id).read().get(&id)
+    }
+
+    /// Returns all the values, in no particular order.
+    pub fn values(&self) -> Vec<Arc<T>> {
+        self.shards
+            .iter()
+            .flat_map(|shard| shard.read().values().collect::<Vec<_>>())
+            .collect()
+    }
+}
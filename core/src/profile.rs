@@ -0,0 +1,249 @@
+//! A sampling CPU profiler driven by the timer interrupt.
+//!
+//! Every few timer ticks, [`sample_on_tick`] records where the current CPU
+//! was interrupted: the process, whether it was in user mode, and the stack.
+//! The stack of kernel code is walked by its frame pointers, within the
+//! kernel stack of the current task, so the kernel must be built with frame
+//! pointers to get more than the interrupted PC. User stacks are not walked,
+//! as user memory must not be touched in an IRQ handler, so samples in user
+//! mode only have the PC.
+//!
+//! Identical samples are counted together in a table of the sampling CPU.
+//! A full table drops new stacks, and the number dropped is reported.
+//!
+//! [`report`] prints the samples with raw addresses, for
+//! `apps/oscomp/profile.py` to symbolize into folded stacks for flamegraphs.
+
+use alloc::{collections::BTreeMap, string::String};
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use axprocess::Pid;
+use axsync::spin::SpinNoIrq;
+use axtask::{TaskExtRef, current};
+
+/// Deeper kernel stacks are truncated.
+const MAX_DEPTH: usize = 16;
+/// The number of distinct stacks kept for each CPU, a power of 2.
+const TABLE_LEN: usize = 1024;
+
+/// The offsets from a frame pointer of the caller's frame pointer and of the
+/// return address.
+#[cfg(any(target_arch = "riscv64", target_arch = "loongarch64"))]
+const FRAME_OFFSETS: (isize, isize) = (-16, -8);
+#[cfg(not(any(target_arch = "riscv64", target_arch = "loongarch64")))]
+const FRAME_OFFSETS: (isize, isize) = (0, 8);
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+struct Stack {
+    /// The process, or 0 for kernel tasks.
+    pid: Pid,
+    from_user: bool,
+    depth: usize,
+    /// The interrupted PC, followed by the return addresses of the callers.
+    pcs: [usize; MAX_DEPTH],
+}
+
+impl Stack {
+    fn hash(&self) -> usize {
+        // FNV-1a over the words of the stack.
+        let mut hash = 0xcbf2_9ce4_8422_2325_u64;
+        let words = [self.pid as usize, self.from_user as usize];
+        for &word in words.iter().chain(&self.pcs[..self.depth]) {
+            hash = (hash ^ word as u64).wrapping_mul(0x100_0000_01b3);
+        }
+        hash as usize
+    }
+}
+
+#[derive(Clone, Copy)]
+struct Entry {
+    stack: Stack,
+    /// The number of samples, or 0 if the entry is free.
+    count: u64,
+}
+
+struct Table {
+    entries: [Entry; TABLE_LEN],
+    dropped: u64,
+}
+
+impl Table {
+    const fn new() -> Self {
+        const EMPTY: Entry = Entry {
+            stack: Stack {
+                pid: 0,
+                from_user: false,
+                depth: 0,
+                pcs: [0; MAX_DEPTH],
+            },
+            count: 0,
+        };
+        Self {
+            entries: [EMPTY; TABLE_LEN],
+            dropped: 0,
+        }
+    }
+
+    fn add(&mut self, stack: &Stack) {
+        let hash = stack.hash();
+        for i in 0..TABLE_LEN {
+            let entry = &mut self.entries[(hash + i) % TABLE_LEN];
+            if entry.count == 0 {
+                entry.stack = *stack;
+            } else if entry.stack != *stack {
+                continue;
+            }
+            entry.count += 1;
+            return;
+        }
+        self.dropped += 1;
+    }
+}
+
+static TABLES: [SpinNoIrq<Table>; axconfig::SMP] =
+    [const { SpinNoIrq::new(Table::new()) }; axconfig::SMP];
+/// The number of timer ticks between samples, or 0 if not profiling.
+static INTERVAL_TICKS: AtomicUsize = AtomicUsize::new(0);
+/// The timer ticks of each CPU until its next sample.
+static TICKS_LEFT: [AtomicUsize; axconfig::SMP] = [const { AtomicUsize::new(0) }; axconfig::SMP];
+/// The executable of each process that has been profiled.
+static EXES: spin::Mutex<BTreeMap<Pid, String>> = spin::Mutex::new(BTreeMap::new());
+
+/// Starts sampling at `AX_PROFILE_HZ` times per second, or on every timer
+/// tick by default.
+///
+/// Samples are only taken on timer ticks, so higher frequencies are reduced
+/// to [`axconfig::TICKS_PER_SEC`].
+pub fn start() {
+    let hz = option_env!("AX_PROFILE_HZ")
+        .and_then(|hz| hz.parse().ok())
+        .unwrap_or(axconfig::TICKS_PER_SEC)
+        .max(1);
+    if hz > axconfig::TICKS_PER_SEC {
+        warn!(
+            "Profiling at {} Hz instead of {} Hz, the timer frequency",
+            axconfig::TICKS_PER_SEC,
+            hz
+        );
+    }
+    let interval = (axconfig::TICKS_PER_SEC / hz).max(1);
+    INTERVAL_TICKS.store(interval, Ordering::Release);
+}
+
+/// Records the executable of the process `pid`, to which its user PCs are
+/// relative. Called whenever a process starts running a new executable.
+pub fn set_exe(pid: Pid, path: &str) {
+    EXES.lock().insert(pid, String::from(path));
+}
+
+/// Reads the caller's frame pointer and the return address from the frame at
+/// `fp`, if the frame lies within `[bottom, top)`.
+fn read_frame(fp: usize, bottom: usize, top: usize) -> Option<(usize, usize)> {
+    let (fp_offset, ra_offset) = FRAME_OFFSETS;
+    let low = fp.checked_add_signed(fp_offset.min(ra_offset))?;
+    let high = fp.checked_add_signed(fp_offset.max(ra_offset))? + size_of::<usize>();
+    if low < bottom || high > top || fp % align_of::<usize>() != 0 {
+        return None;
+    }
+    // SAFETY: the frame lies within the kernel stack of the current task.
+    unsafe {
+        Some((
+            *(fp.wrapping_add_signed(fp_offset) as *const usize),
+            *(fp.wrapping_add_signed(ra_offset) as *const usize),
+        ))
+    }
+}
+
+/// Takes a sample of the current CPU every few timer ticks. Must be called
+/// from the timer IRQ handler.
+pub fn sample_on_tick() {
+    let interval = INTERVAL_TICKS.load(Ordering::Acquire);
+    if interval == 0 {
+        return;
+    }
+    let cpu_id = axhal::cpu::this_cpu_id();
+    // Only the current CPU counts its ticks, with IRQs disabled.
+    let left = TICKS_LEFT[cpu_id].load(Ordering::Relaxed);
+    if left > 1 {
+        TICKS_LEFT[cpu_id].store(left - 1, Ordering::Relaxed);
+        return;
+    }
+    TICKS_LEFT[cpu_id].store(interval, Ordering::Relaxed);
+
+    let curr = current();
+    let (pc, mut fp) = axhal::trap::irq_interrupted_at();
+    let mut stack = Stack {
+        // Kernel tasks have no extended data.
+        pid: if unsafe { curr.task_ext_ptr() }.is_null() {
+            0
+        } else {
+            curr.task_ext().thread.process().pid()
+        },
+        from_user: axhal::trap::irq_from_user(),
+        depth: 1,
+        pcs: [0; MAX_DEPTH],
+    };
+    stack.pcs[0] = pc;
+    if !stack.from_user {
+        if let (Some(bottom), Some(top)) = (curr.kernel_stack_bottom(), curr.kernel_stack_top()) {
+            while stack.depth < MAX_DEPTH {
+                let Some((next_fp, ra)) = read_frame(fp, bottom.as_usize(), top.as_usize()) else {
+                    break;
+                };
+                if ra == 0 {
+                    break;
+                }
+                stack.pcs[stack.depth] = ra;
+                stack.depth += 1;
+                // Frames of callers are higher up the stack.
+                if next_fp <= fp {
+                    break;
+                }
+                fp = next_fp;
+            }
+        }
+    }
+
+    // The table may be being reported.
+    if let Some(mut table) = TABLES[cpu_id].try_lock() {
+        table.add(&stack);
+    }
+}
+
+/// Stops sampling and prints the samples, one `[profile]` line per distinct
+/// stack, as `pid=<pid> exe=<path> <user|kernel> <count> <pc>,<pc>,...` with
+/// the interrupted PC first.
+pub fn report() {
+    INTERVAL_TICKS.store(0, Ordering::Release);
+    let exes = EXES.lock();
+    let mut dropped = 0;
+    for table in &TABLES {
+        let table = table.lock();
+        dropped += table.dropped;
+        for entry in table.entries.iter().filter(|entry| entry.count > 0) {
+            let stack = &entry.stack;
+            let exe = exes.get(&stack.pid).map_or("-", String::as_str);
+            let mut pcs = String::new();
+            for pc in &stack.pcs[..stack.depth] {
+                if !pcs.is_empty() {
+                    pcs.push(',');
+                }
+                let _ = write!(pcs, "{:#x}", pc);
+            }
+            axlog::ax_println!(
+                "[profile] pid={} exe={} {} {} {}",
+                stack.pid,
+                exe,
+                if stack.from_user { "user" } else { "kernel" },
+                entry.count,
+                pcs
+            );
+        }
+    }
+    if dropped > 0 {
+        axlog::ax_println!("[profile] dropped={}", dropped);
+    }
+}
@@ -0,0 +1,79 @@
+//! Resource limits of processes.
+
+use axerrno::{LinuxError, LinuxResult};
+use linux_raw_sys::general::{RLIM_NLIMITS, RLIMIT_AS, RLIMIT_NOFILE, RLIMIT_STACK};
+
+/// The value of an unlimited resource.
+pub const RLIM_INFINITY: u64 = u64::MAX;
+/// The default soft limit of the number of open files.
+pub const DEFAULT_NOFILE: u64 = 1024;
+/// The maximum number of files a process can have open, which the hard
+/// limit cannot exceed.
+pub const NR_OPEN: u64 = 1 << 20;
+
+/// A soft and a hard limit of a resource.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Rlimit {
+    /// The soft limit, which is enforced.
+    pub cur: u64,
+    /// The hard limit, up to which the soft limit can be raised.
+    pub max: u64,
+}
+
+impl Rlimit {
+    /// Creates a limit.
+    pub const fn new(cur: u64, max: u64) -> Self {
+        Self { cur, max }
+    }
+}
+
+/// The resource limits of a process, as set by `setrlimit`. They are
+/// inherited on `fork` and kept across `execve`.
+#[derive(Debug, Clone)]
+pub struct Rlimits([Rlimit; RLIM_NLIMITS as usize]);
+
+impl Default for Rlimits {
+    fn default() -> Self {
+        let mut limits = [Rlimit::new(RLIM_INFINITY, RLIM_INFINITY); RLIM_NLIMITS as usize];
+        limits[RLIMIT_NOFILE as usize] = Rlimit::new(DEFAULT_NOFILE, NR_OPEN);
+        limits[RLIMIT_STACK as usize] =
+            Rlimit::new(axconfig::plat::USER_STACK_SIZE as u64, RLIM_INFINITY);
+        Self(limits)
+    }
+}
+
+impl Rlimits {
+    /// Returns the limit of `resource`.
+    pub fn get(&self, resource: u32) -> LinuxResult<Rlimit> {
+        self.0
+            .get(resource as usize)
+            .copied()
+            .ok_or(LinuxError::EINVAL)
+    }
+
+    /// Sets the limit of `resource`.
+    pub fn set(&mut self, resource: u32, limit: Rlimit) -> LinuxResult {
+        let slot = self
+            .0
+            .get_mut(resource as usize)
+            .ok_or(LinuxError::EINVAL)?;
+        if limit.cur > limit.max {
+            return Err(LinuxError::EINVAL);
+        }
+        if resource == RLIMIT_NOFILE && limit.max > NR_OPEN {
+            return Err(LinuxError::EPERM);
+        }
+        *slot = limit;
+        Ok(())
+    }
+
+    /// Returns the soft limit of the number of open files.
+    pub fn nofile(&self) -> usize {
+        self.0[RLIMIT_NOFILE as usize].cur as usize
+    }
+
+    /// Returns the soft limit of the size of the address space, in bytes.
+    pub fn address_space(&self) -> usize {
+        self.0[RLIMIT_AS as usize].cur.try_into().unwrap_or(usize::MAX)
+    }
+}
@@ -0,0 +1,76 @@
+//! Temporary buffers of syscalls, kept by each task for its next syscalls.
+
+use core::{
+    mem,
+    ops::{Deref, DerefMut},
+};
+
+use alloc::vec::Vec;
+use axtask::{TaskExtRef, current};
+
+/// The largest buffer kept by a task, so that a single large request does not
+/// pin memory for the lifetime of the task.
+const MAX_SCRATCH_SIZE: usize = 0x10000;
+
+/// A temporary byte buffer taken from the current task, and given back to it
+/// when dropped, so that syscalls moving data through a kernel buffer do not
+/// allocate one each time.
+///
+/// Kernel tasks, and nested uses within a syscall, get a newly allocated
+/// buffer instead.
+pub struct ScratchBuf {
+    buf: Vec<u8>,
+}
+
+impl ScratchBuf {
+    /// Takes a buffer of `len` bytes.
+    ///
+    /// The content is unspecified: it may be left over from an earlier
+    /// syscall of the same task.
+    pub fn new(len: usize) -> Self {
+        let mut buf = with_scratch(mem::take).unwrap_or_default();
+        if buf.len() < len {
+            buf.resize(len, 0);
+        } else {
+            buf.truncate(len);
+        }
+        Self { buf }
+    }
+}
+
+impl Drop for ScratchBuf {
+    fn drop(&mut self) {
+        if self.buf.capacity() > MAX_SCRATCH_SIZE {
+            return;
+        }
+        let buf = mem::take(&mut self.buf);
+        with_scratch(|scratch| {
+            if scratch.capacity() < buf.capacity() {
+                *scratch = buf;
+            }
+        });
+    }
+}
+
+impl Deref for ScratchBuf {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        &self.buf
+    }
+}
+
+impl DerefMut for ScratchBuf {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        &mut self.buf
+    }
+}
+
+fn with_scratch<R>(f: impl FnOnce(&mut Vec<u8>) -> R) -> Option<R> {
+    let curr = current();
+    // Kernel tasks have no extended data.
+    if unsafe { curr.task_ext_ptr() }.is_null() {
+        return None;
+    }
+    Some(f(&mut curr.task_ext().scratch.borrow_mut()))
+}
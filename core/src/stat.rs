@@ -0,0 +1,102 @@
+//! System-wide statistics: the time each CPU spent in user mode, in the
+//! kernel and idle, and the load average, both sampled on timer ticks.
+
+use core::{
+    sync::atomic::{AtomicU64, Ordering},
+    time::Duration,
+};
+
+use axhal::time::{NANOS_PER_SEC, monotonic_time_nanos};
+
+/// The fixed-point shift of the load averages, as in Linux.
+const FSHIFT: u32 = 11;
+const FIXED_1: u64 = 1 << FSHIFT;
+/// The decay of the 1, 5 and 15 minute load averages over each
+/// [`LOAD_INTERVAL_NANOS`], i.e. `FIXED_1 / exp(5s / 1min)` and so on.
+const LOAD_EXP: [u64; 3] = [1884, 2014, 2037];
+/// How often the load average is sampled.
+const LOAD_INTERVAL_NANOS: u64 = 5 * NANOS_PER_SEC;
+/// The load averages have decayed to the sampled load after this many
+/// intervals, so longer gaps need no more updates.
+const MAX_MISSED_INTERVALS: u64 = 64;
+
+struct CpuTimes {
+    user_nanos: AtomicU64,
+    system_nanos: AtomicU64,
+}
+
+static CPU_TIMES: [CpuTimes; axconfig::SMP] = [const {
+    CpuTimes {
+        user_nanos: AtomicU64::new(0),
+        system_nanos: AtomicU64::new(0),
+    }
+}; axconfig::SMP];
+/// The 1, 5 and 15 minute load averages, in fixed point.
+static LOAD_AVG: [AtomicU64; 3] = [const { AtomicU64::new(0) }; 3];
+/// When the load average is sampled next.
+static NEXT_LOAD_SAMPLE: AtomicU64 = AtomicU64::new(LOAD_INTERVAL_NANOS);
+
+/// Charges the current timer tick to the current CPU, and samples the load
+/// average when it is due. Must be called from the timer IRQ handler.
+pub fn on_tick() {
+    let times = &CPU_TIMES[axhal::cpu::this_cpu_id()];
+    if !axtask::current().is_idle() {
+        let tick = NANOS_PER_SEC / axconfig::TICKS_PER_SEC as u64;
+        if axhal::trap::irq_from_user() {
+            times.user_nanos.fetch_add(tick, Ordering::Relaxed);
+        } else {
+            times.system_nanos.fetch_add(tick, Ordering::Relaxed);
+        }
+    }
+
+    let now = monotonic_time_nanos();
+    let next = NEXT_LOAD_SAMPLE.load(Ordering::Relaxed);
+    if now < next {
+        return;
+    }
+    // Idle CPUs skip ticks, so several intervals may have passed.
+    let intervals = (now - next) / LOAD_INTERVAL_NANOS + 1;
+    let later = next + intervals * LOAD_INTERVAL_NANOS;
+    if NEXT_LOAD_SAMPLE
+        .compare_exchange(next, later, Ordering::Relaxed, Ordering::Relaxed)
+        .is_err()
+    {
+        // Another CPU samples it.
+        return;
+    }
+    let active = axtask::nr_running() as u64 * FIXED_1;
+    for (avg, exp) in LOAD_AVG.iter().zip(LOAD_EXP) {
+        let mut load = avg.load(Ordering::Relaxed);
+        for _ in 0..intervals.min(MAX_MISSED_INTERVALS) {
+            let mut new_load = load * exp + active * (FIXED_1 - exp);
+            // Round up when rising, so that a constant load is reached.
+            if active >= load {
+                new_load += FIXED_1 - 1;
+            }
+            load = new_load / FIXED_1;
+        }
+        avg.store(load, Ordering::Relaxed);
+    }
+}
+
+/// Returns the time the CPU `cpu_id` spent in user mode, in the kernel and
+/// idle since boot, as `(user, system, idle)`.
+///
+/// The user and system times are counted in timer ticks, and the idle time
+/// is the rest.
+pub fn cpu_times(cpu_id: usize) -> (Duration, Duration, Duration) {
+    let times = &CPU_TIMES[cpu_id];
+    let user = times.user_nanos.load(Ordering::Relaxed);
+    let system = times.system_nanos.load(Ordering::Relaxed);
+    let idle = monotonic_time_nanos().saturating_sub(user + system);
+    (
+        Duration::from_nanos(user),
+        Duration::from_nanos(system),
+        Duration::from_nanos(idle),
+    )
+}
+
+/// Returns the 1, 5 and 15 minute load averages, in hundredths of a task.
+pub fn loadavg() -> [u64; 3] {
+    LOAD_AVG.map(|avg| (avg.load(Ordering::Relaxed) * 100 + FIXED_1 / 2) / FIXED_1)
+}
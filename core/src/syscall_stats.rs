@@ -0,0 +1,128 @@
+//! Syscall statistics: call counts, time spent and latency histograms.
+//!
+//! The statistics are recorded without locks in per-CPU tables, which are
+//! summed up when read, and in a smaller per-process table without the
+//! histograms.
+
+use alloc::{boxed::Box, string::String};
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicU32, AtomicU64, Ordering},
+};
+
+use syscalls::Sysno;
+
+/// The number of syscall numbers that have statistics, above the highest
+/// syscall number of all the supported architectures.
+pub const NR_SYSCALLS: usize = 512;
+
+/// The number of buckets of the latency histograms. Bucket `i` counts the
+/// calls that took `[2^(i-1), 2^i)` nanoseconds, and the last bucket all the
+/// longer ones.
+pub const NR_BUCKETS: usize = 32;
+
+struct CpuStats {
+    counts: [AtomicU64; NR_SYSCALLS],
+    nanos: [AtomicU64; NR_SYSCALLS],
+    buckets: [[AtomicU32; NR_BUCKETS]; NR_SYSCALLS],
+}
+
+impl CpuStats {
+    const fn new() -> Self {
+        Self {
+            counts: [const { AtomicU64::new(0) }; NR_SYSCALLS],
+            nanos: [const { AtomicU64::new(0) }; NR_SYSCALLS],
+            buckets: [const { [const { AtomicU32::new(0) }; NR_BUCKETS] }; NR_SYSCALLS],
+        }
+    }
+}
+
+static CPU_STATS: [CpuStats; axconfig::SMP] = [const { CpuStats::new() }; axconfig::SMP];
+
+/// The syscall statistics of a process.
+pub struct ProcessSyscallStats {
+    counts: Box<[AtomicU64]>,
+    nanos: Box<[AtomicU64]>,
+}
+
+impl ProcessSyscallStats {
+    /// Creates empty statistics.
+    pub fn new() -> Self {
+        Self {
+            counts: (0..NR_SYSCALLS).map(|_| AtomicU64::new(0)).collect(),
+            nanos: (0..NR_SYSCALLS).map(|_| AtomicU64::new(0)).collect(),
+        }
+    }
+
+    /// Formats the statistics in a single line, as `name=count:nanos` pairs
+    /// of the syscalls that have been called.
+    pub fn report(&self) -> String {
+        let mut report = String::new();
+        for sysno in 0..NR_SYSCALLS {
+            let count = self.counts[sysno].load(Ordering::Relaxed);
+            if count > 0 {
+                let nanos = self.nanos[sysno].load(Ordering::Relaxed);
+                let _ = write!(report, " {}={}:{}", Sysno::from(sysno as u32), count, nanos);
+            }
+        }
+        report
+    }
+}
+
+impl Default for ProcessSyscallStats {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+fn bucket(nanos: u64) -> usize {
+    ((u64::BITS - nanos.leading_zeros()) as usize).min(NR_BUCKETS - 1)
+}
+
+/// Records a call to the syscall `sysno` which took `nanos`, made by the
+/// process with the statistics `process`.
+///
+/// `sysno` must be less than [`NR_SYSCALLS`].
+pub fn record(sysno: usize, nanos: u64, process: &ProcessSyscallStats) {
+    let cpu = &CPU_STATS[axhal::cpu::this_cpu_id()];
+    cpu.counts[sysno].fetch_add(1, Ordering::Relaxed);
+    cpu.nanos[sysno].fetch_add(nanos, Ordering::Relaxed);
+    cpu.buckets[sysno][bucket(nanos)].fetch_add(1, Ordering::Relaxed);
+    process.counts[sysno].fetch_add(1, Ordering::Relaxed);
+    process.nanos[sysno].fetch_add(nanos, Ordering::Relaxed);
+}
+
+/// Returns the number of calls to the syscall `sysno` on all the CPUs.
+pub fn count(sysno: usize) -> u64 {
+    CPU_STATS
+        .iter()
+        .map(|cpu| cpu.counts[sysno].load(Ordering::Relaxed))
+        .sum()
+}
+
+/// Formats the statistics of all the CPUs, with one line per syscall that has
+/// been called: the name, the number of calls, the total nanoseconds and the
+/// [`NR_BUCKETS`] histogram buckets.
+pub fn report() -> String {
+    let mut report = String::from("# syscall count nanos buckets\n");
+    for sysno in 0..NR_SYSCALLS {
+        let count = count(sysno);
+        if count == 0 {
+            continue;
+        }
+        let nanos: u64 = CPU_STATS
+            .iter()
+            .map(|cpu| cpu.nanos[sysno].load(Ordering::Relaxed))
+            .sum();
+        let _ = write!(report, "{} {} {}", Sysno::from(sysno as u32), count, nanos);
+        for i in 0..NR_BUCKETS {
+            let calls: u32 = CPU_STATS
+                .iter()
+                .map(|cpu| cpu.buckets[sysno][i].load(Ordering::Relaxed))
+                .sum();
+            let _ = write!(report, " {}", calls);
+        }
+        report.push('\n');
+    }
+    report
+}
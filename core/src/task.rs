@@ -3,11 +3,13 @@
 use core::{
     alloc::Layout,
     cell::RefCell,
-    sync::atomic::{AtomicUsize, Ordering},
+    mem,
+    sync::atomic::{AtomicBool, AtomicIsize, AtomicU32, AtomicU64, AtomicUsize, Ordering},
     time::Duration,
 };
 
 use alloc::{
+    collections::VecDeque,
     string::String,
     sync::{Arc, Weak},
     vec::Vec,
@@ -15,22 +17,27 @@ use alloc::{
 use axerrno::{LinuxError, LinuxResult};
 use axhal::{
     arch::UspaceContext,
-    time::{NANOS_PER_MICROS, NANOS_PER_SEC, monotonic_time_nanos},
+    time::{NANOS_PER_SEC, monotonic_time_nanos},
 };
-use axmm::{AddrSpace, kernel_aspace};
+use axmm::AddrSpace;
 use axns::{AxNamespace, AxNamespaceIf};
 use axprocess::{Pid, Process, ProcessGroup, Session, Thread};
 use axsignal::{
-    Signo,
+    SignalInfo, SignalSet, Signo,
     api::{ProcessSignalManager, SignalActions, ThreadSignalManager},
 };
-use axsync::{Mutex, RawMutex};
-use axtask::{TaskExtRef, TaskInner, WaitQueue, current};
-use memory_addr::VirtAddrRange;
+use axsync::{Mutex, RawMutex, spin::SpinNoIrq};
+use axtask::{AxTaskRef, TaskExtRef, TaskInner, WaitQueue, WeakAxTaskRef, current};
 use spin::{Once, RwLock};
-use weak_map::WeakMap;
 
-use crate::{futex::FutexTable, time::TimeStat};
+use crate::{
+    futex::FutexTable,
+    mm::{exited_aspace, reclaim_aspace, switch_kernel_aspace},
+    pid_table::PidTable,
+    resource::Rlimits,
+    syscall_stats::ProcessSyscallStats,
+    timer::ProcessTimers,
+};
 
 /// Create a new user task.
 pub fn new_user_task(
@@ -61,33 +68,21 @@ pub fn new_user_task(
 
 /// Task extended data for the monolithic kernel.
 pub struct TaskExt {
-    /// The time statistics
-    pub time: RefCell<TimeStat>,
     /// The thread
     pub thread: Arc<Thread>,
+    /// The buffer kept for [`ScratchBuf`](crate::scratch::ScratchBuf).
+    pub(crate) scratch: RefCell<Vec<u8>>,
 }
 
 impl TaskExt {
     /// Create a new [`TaskExt`].
     pub fn new(thread: Arc<Thread>) -> Self {
         Self {
-            time: RefCell::new(TimeStat::new()),
             thread,
+            scratch: RefCell::new(Vec::new()),
         }
     }
 
-    pub(crate) fn time_stat_from_kernel_to_user(&self, current_tick: usize) {
-        self.time.borrow_mut().switch_into_user_mode(current_tick);
-    }
-
-    pub(crate) fn time_stat_from_user_to_kernel(&self, current_tick: usize) {
-        self.time.borrow_mut().switch_into_kernel_mode(current_tick);
-    }
-
-    pub(crate) fn time_stat_output(&self) -> (usize, usize) {
-        self.time.borrow().output()
-    }
-
     /// Get the [`ThreadData`] associated with this task.
     pub fn thread_data(&self) -> &ThreadData {
         self.thread.data().unwrap()
@@ -101,32 +96,38 @@ impl TaskExt {
 
 axtask::def_task_ext!(TaskExt);
 
-/// Update the time statistics to reflect a switch from kernel mode to user mode.
-pub fn time_stat_from_kernel_to_user() {
-    let curr_task = current();
-    curr_task
-        .task_ext()
-        .time_stat_from_kernel_to_user(monotonic_time_nanos() as usize);
-}
-
-/// Update the time statistics to reflect a switch from user mode to kernel mode.
-pub fn time_stat_from_user_to_kernel() {
+/// Charges the current timer tick to the interval timers on CPU clocks of the
+/// current process.
+pub fn cpu_timers_on_tick() {
     let curr_task = current();
-    curr_task
-        .task_ext()
-        .time_stat_from_user_to_kernel(monotonic_time_nanos() as usize);
+    // Kernel tasks have no extended data.
+    if unsafe { curr_task.task_ext_ptr() }.is_null() {
+        return;
+    }
+    let ext = curr_task.task_ext();
+    let tick = Duration::from_nanos(NANOS_PER_SEC / axconfig::TICKS_PER_SEC as u64);
+    let from_user = axhal::trap::irq_from_user();
+    ext.process_data()
+        .timers
+        .charge_tick(tick, from_user, ext.thread.tid());
 }
 
-/// Get the time statistics for the current task.
-pub fn time_stat_output() -> (usize, usize, usize, usize) {
-    let curr_task = current();
-    let (utime_ns, stime_ns) = curr_task.task_ext().time_stat_output();
-    (
-        utime_ns / NANOS_PER_SEC as usize,
-        utime_ns / NANOS_PER_MICROS as usize,
-        stime_ns / NANOS_PER_SEC as usize,
-        stime_ns / NANOS_PER_MICROS as usize,
-    )
+/// Returns the user and system time of `process`, the sum of those of its
+/// threads, including the ones that have exited.
+pub fn process_cpu_time(process: &Process) -> (Duration, Duration) {
+    let mut time = process
+        .data::<ProcessData>()
+        .map_or((Duration::ZERO, Duration::ZERO), |data| {
+            data.exited_threads_cpu_time()
+        });
+    for thread in process.threads() {
+        if let Some(task) = thread.data::<ThreadData>().and_then(ThreadData::task) {
+            let (utime, stime) = task.cpu_time();
+            time.0 += utime;
+            time.1 += stime;
+        }
+    }
+    time
 }
 
 #[doc(hidden)]
@@ -147,10 +148,41 @@ impl axsignal::api::WaitQueue for WaitQueueWrapper {
     }
 
     fn notify_one(&self) -> bool {
+        for waker in SIGNAL_WAKERS.lock().iter() {
+            waker();
+        }
         self.0.notify_one(false)
     }
 }
 
+/// A callback that interrupts a sleep when a signal arrives.
+pub type SignalWaker = Arc<dyn Fn() + Send + Sync>;
+
+/// Wakers of sleeps that do not wait on a signal wait queue (e.g. `poll`),
+/// which are all invoked whenever a signal is sent so that the sleepers can
+/// check for pending signals.
+static SIGNAL_WAKERS: SpinNoIrq<Vec<SignalWaker>> = SpinNoIrq::new(Vec::new());
+
+/// Registers a waker to be invoked whenever a signal is sent.
+pub fn register_signal_waker(waker: &SignalWaker) {
+    SIGNAL_WAKERS.lock().push(waker.clone());
+}
+
+/// Unregisters a waker registered by [`register_signal_waker`].
+pub fn unregister_signal_waker(waker: &SignalWaker) {
+    SIGNAL_WAKERS.lock().retain(|w| !Arc::ptr_eq(w, waker));
+}
+
+/// Bumped whenever a signal is sent to a process, so that the threads of
+/// every process look for it on their next return to user space.
+static PROCESS_SIGNAL_GEN: AtomicU64 = AtomicU64::new(0);
+
+/// Tells the threads that a signal was sent to their process, after it is
+/// queued to the [`ProcessSignalManager`].
+pub fn notify_process_signal() {
+    PROCESS_SIGNAL_GEN.fetch_add(1, Ordering::Release);
+}
+
 /// Extended data for [`Thread`].
 pub struct ThreadData {
     /// The clear thread tid field
@@ -160,8 +192,56 @@ pub struct ThreadData {
     /// When the thread exits, the kernel clears the word at this address if it is not NULL.
     pub clear_child_tid: AtomicUsize,
 
+    /// The head of the robust futex list of the thread, set by
+    /// `set_robust_list`.
+    pub robust_list_head: AtomicUsize,
+
     /// The thread-level signal manager
     pub signal: ThreadSignalManager<RawMutex, WaitQueueWrapper>,
+
+    /// The task running the thread, set once it is spawned.
+    task: Once<WeakAxTaskRef>,
+    /// The scheduling priority of the thread, as passed to
+    /// [`axtask::set_priority`].
+    pub priority: AtomicIsize,
+    /// The priority the thread actually runs at, which is higher
+    /// (numerically lower) than [`Self::priority`] while the thread owns a
+    /// PI futex that a higher-priority thread is waiting for.
+    pub pi_priority: AtomicIsize,
+    /// The scheduling policy of the thread, as set by `sched_setattr`.
+    sched_policy: AtomicU32,
+
+    /// Whether the thread may have a signal to handle, because one was sent
+    /// to it or its signal mask changed since it last checked.
+    signal_hint: AtomicBool,
+    /// The value of `PROCESS_SIGNAL_GEN` when the thread last checked.
+    signal_gen: AtomicU64,
+    /// The signal mask of the thread, only changed by the thread itself.
+    ///
+    /// The copy in [`Self::signal`] is only brought up to date before the
+    /// manager looks at it, so that `sigprocmask` does not take its lock.
+    blocked: AtomicU64,
+    /// Whether [`Self::blocked`] changed since it was copied into the
+    /// manager.
+    blocked_dirty: AtomicBool,
+
+    /// The address of the area registered by `rseq`, or 0.
+    rseq_addr: AtomicUsize,
+    /// The size of the area registered by `rseq` in the high half, and the
+    /// signature of its abort handlers in the low half.
+    rseq_len_sig: AtomicU64,
+}
+
+/// The area registered by a thread with `rseq`, which the kernel keeps up to
+/// date with the CPU the thread runs on.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RseqArea {
+    /// The user address of the `struct rseq`.
+    pub addr: usize,
+    /// The size of the `struct rseq`.
+    pub len: u32,
+    /// The signature that must precede the abort handlers.
+    pub sig: u32,
 }
 
 impl ThreadData {
@@ -170,11 +250,172 @@ impl ThreadData {
     pub fn new(proc: &ProcessData) -> Self {
         Self {
             clear_child_tid: AtomicUsize::new(0),
+            robust_list_head: AtomicUsize::new(0),
 
             signal: ThreadSignalManager::new(proc.signal.clone()),
+
+            task: Once::new(),
+            priority: AtomicIsize::new(0),
+            pi_priority: AtomicIsize::new(0),
+            sched_policy: AtomicU32::new(0),
+
+            signal_hint: AtomicBool::new(true),
+            signal_gen: AtomicU64::new(0),
+            blocked: AtomicU64::new(0),
+            blocked_dirty: AtomicBool::new(false),
+
+            rseq_addr: AtomicUsize::new(0),
+            rseq_len_sig: AtomicU64::new(0),
+        }
+    }
+
+    /// Sends a signal to the thread.
+    pub fn send_signal(&self, sig: SignalInfo) {
+        self.signal.send_signal(sig);
+        self.mark_signal_pending();
+    }
+
+    /// Makes the thread look for signals on its next return to user space,
+    /// e.g. after its signal mask changed.
+    pub fn mark_signal_pending(&self) {
+        self.signal_hint.store(true, Ordering::Release);
+    }
+
+    /// Returns whether the thread may have a signal to handle since it last
+    /// called this, so that returns to user space only go through the
+    /// signal managers when they may find something. A signal sent meanwhile
+    /// is seen by the next call.
+    pub fn take_signal_hint(&self) -> bool {
+        let generation = PROCESS_SIGNAL_GEN.load(Ordering::Acquire);
+        let hint = self.signal_hint.swap(false, Ordering::AcqRel);
+        hint || self.signal_gen.swap(generation, Ordering::Relaxed) != generation
+    }
+
+    /// Gets the signal mask of the thread.
+    pub fn blocked(&self) -> SignalSet {
+        // SAFETY: `SignalSet` is a 64-bit mask.
+        unsafe { mem::transmute(self.blocked.load(Ordering::Relaxed)) }
+    }
+
+    /// Sets the signal mask of the thread without taking the lock of its
+    /// signal manager, and returns the old one. Only the thread itself may
+    /// call this.
+    ///
+    /// If signals get unblocked, the thread looks for them on its next
+    /// return to user space.
+    pub fn set_blocked(&self, set: SignalSet) -> SignalSet {
+        // SAFETY: `SignalSet` is a 64-bit mask.
+        let bits: u64 = unsafe { mem::transmute(set) };
+        let old = self.blocked.swap(bits, Ordering::Relaxed);
+        self.blocked_dirty.store(true, Ordering::Relaxed);
+        if old & !bits != 0 {
+            self.mark_signal_pending();
+        }
+        // SAFETY: `SignalSet` is a 64-bit mask.
+        unsafe { mem::transmute(old) }
+    }
+
+    /// Copies the signal mask into [`Self::signal`] if it changed since,
+    /// which must be done before the manager looks at it.
+    pub fn sync_blocked(&self) {
+        if self.blocked_dirty.swap(false, Ordering::Relaxed) {
+            let set = self.blocked();
+            self.signal.with_blocked_mut(|blocked| *blocked = set);
+        }
+    }
+
+    /// Picks up the signal mask that [`Self::signal`] set, after it
+    /// delivered a signal or restored the mask of before a handler.
+    pub fn reload_blocked(&self) {
+        let set = self.signal.with_blocked_mut(|blocked| *blocked);
+        // SAFETY: `SignalSet` is a 64-bit mask.
+        let bits: u64 = unsafe { mem::transmute(set) };
+        self.blocked.store(bits, Ordering::Relaxed);
+        self.blocked_dirty.store(false, Ordering::Relaxed);
+    }
+
+    /// Get the head of the robust futex list.
+    pub fn robust_list_head(&self) -> usize {
+        self.robust_list_head.load(Ordering::Relaxed)
+    }
+
+    /// Set the head of the robust futex list.
+    pub fn set_robust_list_head(&self, head: usize) {
+        self.robust_list_head.store(head, Ordering::Relaxed);
+    }
+
+    /// Gets the area registered by `rseq`, if any.
+    pub fn rseq(&self) -> Option<RseqArea> {
+        let addr = self.rseq_addr.load(Ordering::Relaxed);
+        let len_sig = self.rseq_len_sig.load(Ordering::Relaxed);
+        (addr != 0).then_some(RseqArea {
+            addr,
+            len: (len_sig >> 32) as u32,
+            sig: len_sig as u32,
+        })
+    }
+
+    /// Sets the area registered by `rseq`. Only the thread itself may call
+    /// this, or its creator before it runs.
+    pub fn set_rseq(&self, area: Option<RseqArea>) {
+        let (addr, len_sig) = area.map_or((0, 0), |area| {
+            (area.addr, (area.len as u64) << 32 | area.sig as u64)
+        });
+        self.rseq_len_sig.store(len_sig, Ordering::Relaxed);
+        self.rseq_addr.store(addr, Ordering::Relaxed);
+    }
+
+    /// Records the task running the thread, once it is spawned, and makes
+    /// it run at the priority of the thread.
+    pub fn set_task(&self, task: &AxTaskRef) {
+        self.task.call_once(|| Arc::downgrade(task));
+        let prio = self.pi_priority.load(Ordering::SeqCst);
+        if prio != 0 {
+            axtask::set_task_priority(task, prio);
+        }
+    }
+
+    /// Gets the scheduling priority (the nice value) of the thread.
+    pub fn priority(&self) -> isize {
+        self.priority.load(Ordering::SeqCst)
+    }
+
+    /// Gets the scheduling policy of the thread.
+    pub fn sched_policy(&self) -> u32 {
+        self.sched_policy.load(Ordering::Relaxed)
+    }
+
+    /// Sets the scheduling policy of the thread.
+    pub fn set_sched_policy(&self, policy: u32) {
+        self.sched_policy.store(policy, Ordering::Relaxed);
+    }
+
+    /// Sets the scheduling priority (the nice value) of the thread.
+    ///
+    /// While the thread is boosted by a PI futex to a higher priority, it
+    /// keeps running at that one.
+    pub fn set_priority(&self, prio: isize) {
+        let old = self.priority.swap(prio, Ordering::SeqCst);
+        let Ok(prev) = self
+            .pi_priority
+            .fetch_update(Ordering::SeqCst, Ordering::SeqCst, |pi| {
+                (pi == old || prio < pi).then_some(prio)
+            })
+        else {
+            return;
+        };
+        if prev != prio {
+            if let Some(task) = self.task() {
+                axtask::set_task_priority(&task, prio);
+            }
         }
     }
 
+    /// Gets the task running the thread, if it is still alive.
+    pub fn task(&self) -> Option<AxTaskRef> {
+        self.task.get().and_then(Weak::upgrade)
+    }
+
     /// Get the clear child tid field.
     pub fn clear_child_tid(&self) -> usize {
         self.clear_child_tid.load(Ordering::Relaxed)
@@ -187,12 +428,34 @@ impl ThreadData {
     }
 }
 
+/// The kind of a change of state of a child process.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ChildEventKind {
+    /// The child exited, and is a zombie until it is waited for.
+    Exited,
+    /// The child was stopped by the signal.
+    Stopped(Signo),
+    /// The child was continued by `SIGCONT`.
+    Continued,
+}
+
+/// A change of state of a child process, to be reported by `wait4` or
+/// `waitid`.
+#[derive(Clone)]
+pub struct ChildEvent {
+    /// The child process.
+    pub child: Arc<Process>,
+    /// What happened to it.
+    pub kind: ChildEventKind,
+}
+
 /// Extended data for [`Process`].
 pub struct ProcessData {
     /// The executable path
     pub exe_path: RwLock<String>,
-    /// The virtual memory address space.
-    pub aspace: Arc<Mutex<AddrSpace>>,
+    /// The virtual memory address space, which may be shared with other
+    /// processes created with `CLONE_VM` until they call `execve`.
+    aspace: RwLock<Arc<axsync::RwLock<AddrSpace>>>,
     /// The resource namespace
     pub ns: AxNamespace,
     /// The user heap bottom
@@ -202,6 +465,19 @@ pub struct ProcessData {
 
     /// The child exit wait queue
     pub child_exit_wq: WaitQueue,
+    /// The changes of state of the children that were not waited for yet,
+    /// in the order they happened, so that waiting does not have to scan
+    /// all the children.
+    child_events: SpinNoIrq<VecDeque<ChildEvent>>,
+    /// Whether the process is stopped by a job control signal.
+    stopped: AtomicBool,
+    /// The wait queue of the threads of a stopped process.
+    stop_wq: WaitQueue,
+    /// The wait queue of the tasks waiting for threads of the process to
+    /// exit.
+    exit_wq: WaitQueue,
+    /// The thread that is killing the others to call `execve`, or 0.
+    exec_tid: AtomicU32,
     /// The exit signal of the thread
     pub exit_signal: Option<Signo>,
 
@@ -210,35 +486,322 @@ pub struct ProcessData {
 
     /// The futex table.
     pub futex_table: FutexTable,
+
+    /// The resource limits.
+    pub rlimits: RwLock<Rlimits>,
+
+    /// Whether the process has released the address space borrowed from its
+    /// `CLONE_VFORK` parent, by calling `execve` or exiting.
+    vfork_released: AtomicBool,
+    /// The wait queue of the `CLONE_VFORK` parent.
+    vfork_wq: WaitQueue,
+
+    /// The syscall statistics
+    pub syscall_stats: ProcessSyscallStats,
+
+    /// The interval timers.
+    pub timers: ProcessTimers,
+
+    /// The `membarrier` commands the process registered for.
+    membarrier: AtomicU32,
+
+    /// The largest resident set size seen, in pages.
+    max_rss: AtomicUsize,
+    /// The largest resident set size of the children that have exited, in
+    /// pages.
+    children_max_rss: AtomicUsize,
+
+    /// When the process was created, since boot.
+    start_time: Duration,
+    /// The user time of the threads that have exited.
+    utime_nanos: AtomicU64,
+    /// The system time of the threads that have exited.
+    stime_nanos: AtomicU64,
+    /// The user time of the children that have exited.
+    children_utime_nanos: AtomicU64,
+    /// The system time of the children that have exited.
+    children_stime_nanos: AtomicU64,
 }
 
 impl ProcessData {
     /// Create a new [`ProcessData`].
     pub fn new(
         exe_path: String,
-        aspace: Arc<Mutex<AddrSpace>>,
+        aspace: Arc<axsync::RwLock<AddrSpace>>,
         signal_actions: Arc<Mutex<SignalActions>>,
         exit_signal: Option<Signo>,
     ) -> Self {
+        let signal = Arc::new(ProcessSignalManager::new(
+            signal_actions,
+            axconfig::plat::SIGNAL_TRAMPOLINE,
+        ));
         Self {
             exe_path: RwLock::new(exe_path),
-            aspace,
+            aspace: RwLock::new(aspace),
             ns: AxNamespace::new_thread_local(),
             heap_bottom: AtomicUsize::new(axconfig::plat::USER_HEAP_BASE),
             heap_top: AtomicUsize::new(axconfig::plat::USER_HEAP_BASE),
 
             child_exit_wq: WaitQueue::new(),
+            child_events: SpinNoIrq::new(VecDeque::new()),
+            stopped: AtomicBool::new(false),
+            stop_wq: WaitQueue::new(),
+            exit_wq: WaitQueue::new(),
+            exec_tid: AtomicU32::new(0),
             exit_signal,
 
-            signal: Arc::new(ProcessSignalManager::new(
-                signal_actions,
-                axconfig::plat::SIGNAL_TRAMPOLINE,
-            )),
+            timers: ProcessTimers::new(&signal),
+            signal,
 
             futex_table: FutexTable::new(),
+
+            rlimits: RwLock::new(Rlimits::default()),
+
+            vfork_released: AtomicBool::new(false),
+            vfork_wq: WaitQueue::new(),
+
+            syscall_stats: ProcessSyscallStats::new(),
+
+            membarrier: AtomicU32::new(0),
+
+            max_rss: AtomicUsize::new(0),
+            children_max_rss: AtomicUsize::new(0),
+
+            start_time: Duration::from_nanos(monotonic_time_nanos()),
+            utime_nanos: AtomicU64::new(0),
+            stime_nanos: AtomicU64::new(0),
+            children_utime_nanos: AtomicU64::new(0),
+            children_stime_nanos: AtomicU64::new(0),
+        }
+    }
+
+    /// Get the virtual memory address space.
+    ///
+    /// Page faults and accesses to user memory only need to read it, while
+    /// changing the mappings needs to write it.
+    pub fn aspace(&self) -> Arc<axsync::RwLock<AddrSpace>> {
+        self.aspace.read().clone()
+    }
+
+    /// Returns the `membarrier` commands the process registered for.
+    pub fn membarrier_registrations(&self) -> u32 {
+        self.membarrier.load(Ordering::Relaxed)
+    }
+
+    /// Registers the process for the `membarrier` commands `cmds`.
+    pub fn register_membarrier(&self, cmds: u32) {
+        self.membarrier.fetch_or(cmds, Ordering::Relaxed);
+    }
+
+    /// Unregisters the process from all the `membarrier` commands, as the
+    /// program it ran is gone after `execve`.
+    pub fn clear_membarrier(&self) {
+        self.membarrier.store(0, Ordering::Relaxed);
+    }
+
+    /// Returns the largest resident set size of the process, in pages.
+    ///
+    /// The resident set is sampled when this is called, and when the process
+    /// exits or calls `execve`, which is when it is largest in most cases.
+    pub fn max_rss(&self) -> usize {
+        let rss = self.aspace().read().resident_pages();
+        self.max_rss.fetch_max(rss, Ordering::Relaxed).max(rss)
+    }
+
+    /// Returns the largest resident set size of the children that have
+    /// exited, in pages.
+    pub fn children_max_rss(&self) -> usize {
+        self.children_max_rss.load(Ordering::Relaxed)
+    }
+
+    /// Records the largest resident set size of an exited child.
+    pub fn add_child_max_rss(&self, pages: usize) {
+        self.children_max_rss.fetch_max(pages, Ordering::Relaxed);
+    }
+
+    /// Returns when the process was created, since boot.
+    pub fn start_time(&self) -> Duration {
+        self.start_time
+    }
+
+    /// Returns the user and system time of the threads that have exited.
+    ///
+    /// See [`process_cpu_time`] for the time of the whole process.
+    pub fn exited_threads_cpu_time(&self) -> (Duration, Duration) {
+        (
+            Duration::from_nanos(self.utime_nanos.load(Ordering::Relaxed)),
+            Duration::from_nanos(self.stime_nanos.load(Ordering::Relaxed)),
+        )
+    }
+
+    /// Records the user and system time of an exited thread.
+    pub fn add_exited_thread_cpu_time(&self, (utime, stime): (Duration, Duration)) {
+        self.utime_nanos
+            .fetch_add(utime.as_nanos() as u64, Ordering::Relaxed);
+        self.stime_nanos
+            .fetch_add(stime.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    /// Returns the user and system time of the children that have exited,
+    /// including that of their own children.
+    pub fn children_cpu_time(&self) -> (Duration, Duration) {
+        (
+            Duration::from_nanos(self.children_utime_nanos.load(Ordering::Relaxed)),
+            Duration::from_nanos(self.children_stime_nanos.load(Ordering::Relaxed)),
+        )
+    }
+
+    /// Records the user and system time of an exited child.
+    pub fn add_child_cpu_time(&self, (utime, stime): (Duration, Duration)) {
+        self.children_utime_nanos
+            .fetch_add(utime.as_nanos() as u64, Ordering::Relaxed);
+        self.children_stime_nanos
+            .fetch_add(stime.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    /// Replace the virtual memory address space, returning the old one.
+    pub fn replace_aspace(
+        &self,
+        aspace: Arc<axsync::RwLock<AddrSpace>>,
+    ) -> Arc<axsync::RwLock<AddrSpace>> {
+        core::mem::replace(&mut *self.aspace.write(), aspace)
+    }
+
+    /// Detaches the address space from the process, whose last thread, the
+    /// current task, is exiting, and which is left with an empty one.
+    ///
+    /// Unless another process shares it, the address space is torn down in
+    /// the background, so that the parent can be notified of the exit without
+    /// waiting for the memory to be freed.
+    pub fn detach_aspace(&self) {
+        let Ok(exited) = exited_aspace() else {
+            // It is then torn down when the process is reaped.
+            return;
+        };
+        switch_kernel_aspace();
+        let aspace = self.replace_aspace(exited);
+        if let Ok(aspace) = Arc::try_unwrap(aspace) {
+            reclaim_aspace(aspace.into_inner());
         }
     }
 
+    /// Wakes up the `CLONE_VFORK` parent, if any, once the process no longer
+    /// uses its address space.
+    pub fn release_vfork(&self) {
+        if !self.vfork_released.swap(true, Ordering::AcqRel) {
+            self.vfork_wq.notify_all(false);
+        }
+    }
+
+    /// Waits until the process calls [`Self::release_vfork`].
+    pub fn wait_vfork(&self) {
+        self.vfork_wq
+            .wait_until(|| self.vfork_released.load(Ordering::Acquire));
+    }
+
+    /// Records a change of state of a child and wakes up the threads
+    /// waiting for children. It replaces the stop or continue events of the
+    /// child that were not waited for, as only the last one is reported.
+    pub fn push_child_event(&self, child: &Arc<Process>, kind: ChildEventKind) {
+        let mut events = self.child_events.lock();
+        events.retain(|event| !Arc::ptr_eq(&event.child, child));
+        events.push_back(ChildEvent {
+            child: child.clone(),
+            kind,
+        });
+        drop(events);
+        self.child_exit_wq.notify_all(false);
+    }
+
+    /// Returns the first change of state of a child for which `filter`
+    /// holds, taking it out unless `keep` is set.
+    pub fn take_child_event<F>(&self, filter: F, keep: bool) -> Option<ChildEvent>
+    where
+        F: Fn(&ChildEvent) -> bool,
+    {
+        let mut events = self.child_events.lock();
+        let index = events.iter().position(filter)?;
+        if keep {
+            Some(events[index].clone())
+        } else {
+            events.remove(index)
+        }
+    }
+
+    /// Blocks until there is a change of state of a child for which `filter`
+    /// holds.
+    pub fn wait_child_event<F>(&self, filter: F)
+    where
+        F: Fn(&ChildEvent) -> bool,
+    {
+        self.child_exit_wq
+            .wait_until(|| self.child_events.lock().iter().any(&filter));
+    }
+
+    /// Wakes up the tasks waiting in [`Self::wait_exit`] or
+    /// [`Self::wait_single_thread`], when a thread of the process exited.
+    pub fn notify_exit(&self) {
+        self.exit_wq.notify_all(false);
+    }
+
+    /// Blocks until the current thread is the only one left in `process`,
+    /// whose data this is.
+    pub fn wait_single_thread(&self, process: &Process) {
+        self.exit_wq.wait_until(|| process.threads().len() <= 1);
+    }
+
+    /// Marks the thread `tid` as killing the other threads of the process to
+    /// call `execve`, returning `false` if another thread already is.
+    pub fn begin_exec(&self, tid: Pid) -> bool {
+        self.exec_tid
+            .compare_exchange(0, tid, Ordering::AcqRel, Ordering::Acquire)
+            .is_ok()
+    }
+
+    /// Ends [`Self::begin_exec`], once the other threads exited.
+    pub fn end_exec(&self) {
+        self.exec_tid.store(0, Ordering::Release);
+    }
+
+    /// Whether another thread than `tid` is killing the others to call
+    /// `execve`, in which case `tid` must exit alone instead of taking the
+    /// whole process with it.
+    pub fn is_exec_by_other(&self, tid: Pid) -> bool {
+        let exec_tid = self.exec_tid.load(Ordering::Acquire);
+        exec_tid != 0 && exec_tid != tid
+    }
+
+    /// Blocks until the last thread of `process`, whose data this is, exited,
+    /// whichever thread it is.
+    pub fn wait_exit(&self, process: &Process) {
+        self.exit_wq.wait_until(|| process.is_zombie());
+    }
+
+    /// Whether the process is stopped by a job control signal.
+    pub fn is_stopped(&self) -> bool {
+        self.stopped.load(Ordering::Acquire)
+    }
+
+    /// Stops the process, returning `false` if it already was.
+    pub fn stop(&self) -> bool {
+        !self.stopped.swap(true, Ordering::AcqRel)
+    }
+
+    /// Resumes the threads of the process if it is stopped, returning
+    /// `false` if it was not.
+    pub fn resume(&self) -> bool {
+        let stopped = self.stopped.swap(false, Ordering::AcqRel);
+        if stopped {
+            self.stop_wq.notify_all(false);
+        }
+        stopped
+    }
+
+    /// Blocks the current thread while the process is stopped.
+    pub fn wait_while_stopped(&self) {
+        self.stop_wq.wait_until(|| !self.is_stopped());
+    }
+
     /// Get the bottom address of the user heap.
     pub fn get_heap_bottom(&self) -> usize {
         self.heap_bottom.load(Ordering::Acquire)
@@ -266,18 +829,6 @@ impl ProcessData {
     }
 }
 
-impl Drop for ProcessData {
-    fn drop(&mut self) {
-        if !cfg!(target_arch = "aarch64") && !cfg!(target_arch = "loongarch64") {
-            // See [`crate::new_user_aspace`]
-            let kernel = kernel_aspace().lock();
-            self.aspace
-                .lock()
-                .clear_mappings(VirtAddrRange::from_start_size(kernel.base(), kernel.size()));
-        }
-    }
-}
-
 struct AxNamespaceImpl;
 #[crate_interface::impl_interface]
 impl AxNamespaceIf for AxNamespaceImpl {
@@ -301,60 +852,51 @@ impl AxNamespaceIf for AxNamespaceImpl {
     }
 }
 
-static THREAD_TABLE: RwLock<WeakMap<Pid, Weak<Thread>>> = RwLock::new(WeakMap::new());
-static PROCESS_TABLE: RwLock<WeakMap<Pid, Weak<Process>>> = RwLock::new(WeakMap::new());
-static PROCESS_GROUP_TABLE: RwLock<WeakMap<Pid, Weak<ProcessGroup>>> = RwLock::new(WeakMap::new());
-static SESSION_TABLE: RwLock<WeakMap<Pid, Weak<Session>>> = RwLock::new(WeakMap::new());
+static THREAD_TABLE: PidTable<Thread> = PidTable::new();
+static PROCESS_TABLE: PidTable<Process> = PidTable::new();
+static PROCESS_GROUP_TABLE: PidTable<ProcessGroup> = PidTable::new();
+static SESSION_TABLE: PidTable<Session> = PidTable::new();
 
 /// Add the thread and possibly its process, process group and session to the
 /// corresponding tables.
+///
+/// A new thread of a process already in the tables only takes the lock of its
+/// own shard of the thread table, and a read lock on the process table.
 pub fn add_thread_to_table(thread: &Arc<Thread>) {
-    let mut thread_table = THREAD_TABLE.write();
-    thread_table.insert(thread.tid(), thread);
+    THREAD_TABLE.insert(thread.tid(), thread);
 
-    let mut process_table = PROCESS_TABLE.write();
     let process = thread.process();
-    if process_table.contains_key(&process.pid()) {
+    if !PROCESS_TABLE.insert_new(process.pid(), process) {
         return;
     }
-    process_table.insert(process.pid(), process);
 
-    let mut process_group_table = PROCESS_GROUP_TABLE.write();
     let process_group = process.group();
-    if process_group_table.contains_key(&process_group.pgid()) {
+    if !PROCESS_GROUP_TABLE.insert_new(process_group.pgid(), &process_group) {
         return;
     }
-    process_group_table.insert(process_group.pgid(), &process_group);
 
-    let mut session_table = SESSION_TABLE.write();
     let session = process_group.session();
-    if session_table.contains_key(&session.sid()) {
-        return;
-    }
-    session_table.insert(session.sid(), &session);
+    SESSION_TABLE.insert_new(session.sid(), &session);
 }
 
 /// Lists all processes.
 pub fn processes() -> Vec<Arc<Process>> {
-    PROCESS_TABLE.read().values().collect()
+    PROCESS_TABLE.values()
 }
 
 /// Finds the thread with the given TID.
 pub fn get_thread(tid: Pid) -> LinuxResult<Arc<Thread>> {
-    THREAD_TABLE.read().get(&tid).ok_or(LinuxError::ESRCH)
+    THREAD_TABLE.get(tid).ok_or(LinuxError::ESRCH)
 }
 /// Finds the process with the given PID.
 pub fn get_process(pid: Pid) -> LinuxResult<Arc<Process>> {
-    PROCESS_TABLE.read().get(&pid).ok_or(LinuxError::ESRCH)
+    PROCESS_TABLE.get(pid).ok_or(LinuxError::ESRCH)
 }
 /// Finds the process group with the given PGID.
 pub fn get_process_group(pgid: Pid) -> LinuxResult<Arc<ProcessGroup>> {
-    PROCESS_GROUP_TABLE
-        .read()
-        .get(&pgid)
-        .ok_or(LinuxError::ESRCH)
+    PROCESS_GROUP_TABLE.get(pgid).ok_or(LinuxError::ESRCH)
 }
 /// Finds the session with the given SID.
 pub fn get_session(sid: Pid) -> LinuxResult<Arc<Session>> {
-    SESSION_TABLE.read().get(&sid).ok_or(LinuxError::ESRCH)
+    SESSION_TABLE.get(sid).ok_or(LinuxError::ESRCH)
 }
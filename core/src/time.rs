@@ -1,125 +0,0 @@
-numeric_enum_macro::numeric_enum! {
-    #[repr(i32)]
-    #[allow(non_camel_case_types)]
-    #[derive(Eq, PartialEq, Debug, Clone, Copy)]
-    pub enum TimerType {
-    /// 表示目前没有任何计时器(不在linux规范中，是os自己规定的)
-    NONE = -1,
-    /// 统计系统实际运行时间
-    REAL = 0,
-    /// 统计用户态运行时间
-    VIRTUAL = 1,
-    /// 统计进程的所有用户态/内核态运行时间
-    PROF = 2,
-    }
-}
-
-impl From<usize> for TimerType {
-    fn from(num: usize) -> Self {
-        match Self::try_from(num as i32) {
-            Ok(val) => val,
-            Err(_) => Self::NONE,
-        }
-    }
-}
-
-pub struct TimeStat {
-    utime_ns: usize,
-    stime_ns: usize,
-    user_timestamp: usize,
-    kernel_timestamp: usize,
-    timer_type: TimerType,
-    timer_interval_ns: usize,
-    timer_remained_ns: usize,
-}
-
-impl Default for TimeStat {
-    fn default() -> Self {
-        Self::new()
-    }
-}
-
-impl TimeStat {
-    pub fn new() -> Self {
-        Self {
-            utime_ns: 0,
-            stime_ns: 0,
-            user_timestamp: 0,
-            kernel_timestamp: 0,
-            timer_type: TimerType::NONE,
-            timer_interval_ns: 0,
-            timer_remained_ns: 0,
-        }
-    }
-
-    pub fn output(&self) -> (usize, usize) {
-        (self.utime_ns, self.stime_ns)
-    }
-
-    pub fn reset(&mut self, current_timestamp: usize) {
-        self.utime_ns = 0;
-        self.stime_ns = 0;
-        self.user_timestamp = 0;
-        self.kernel_timestamp = current_timestamp;
-    }
-
-    pub fn switch_into_kernel_mode(&mut self, current_timestamp: usize) {
-        let now_time_ns = current_timestamp;
-        let delta = now_time_ns - self.kernel_timestamp;
-        self.utime_ns += delta;
-        self.kernel_timestamp = now_time_ns;
-        if self.timer_type != TimerType::NONE {
-            self.update_timer(delta);
-        };
-    }
-
-    pub fn switch_into_user_mode(&mut self, current_timestamp: usize) {
-        let now_time_ns = current_timestamp;
-        let delta = now_time_ns - self.kernel_timestamp;
-        self.stime_ns += delta;
-        self.user_timestamp = now_time_ns;
-        if self.timer_type == TimerType::REAL || self.timer_type == TimerType::PROF {
-            self.update_timer(delta);
-        }
-    }
-
-    pub fn switch_from_old_task(&mut self, current_timestamp: usize) {
-        let now_time_ns = current_timestamp;
-        let delta = now_time_ns - self.kernel_timestamp;
-        self.stime_ns += delta;
-        self.kernel_timestamp = now_time_ns;
-        if self.timer_type == TimerType::REAL || self.timer_type == TimerType::PROF {
-            self.update_timer(delta);
-        }
-    }
-
-    pub fn switch_to_new_task(&mut self, current_timestamp: usize) {
-        let now_time_ns = current_timestamp;
-        let delta = now_time_ns - self.kernel_timestamp;
-        self.kernel_timestamp = now_time_ns;
-        if self.timer_type == TimerType::REAL {
-            self.update_timer(delta);
-        }
-    }
-
-    pub fn set_timer(
-        &mut self,
-        timer_interval_ns: usize,
-        timer_remained_ns: usize,
-        timer_type: usize,
-    ) -> bool {
-        self.timer_type = timer_type.into();
-        self.timer_interval_ns = timer_interval_ns;
-        self.timer_remained_ns = timer_remained_ns;
-        self.timer_type != TimerType::NONE
-    }
-
-    pub fn update_timer(&mut self, delta: usize) {
-        if self.timer_remained_ns == 0 {
-            return;
-        }
-        if self.timer_remained_ns > delta {
-            self.timer_remained_ns -= delta;
-        }
-    }
-}
@@ -0,0 +1,429 @@
+//! Interval timers of processes, set by `setitimer` or created by
+//! `timer_create`.
+//!
+//! Timers on the wall clock are set on the `axtask` timer list, and timers on
+//! CPU clocks count down on the timer ticks charged to the process. Both
+//! expire in the IRQ context, where signals cannot be sent as their managers
+//! take sleeping locks, so expired timers are queued to a kernel task that
+//! sends their signals. Expirations that happen before the signal of a
+//! previous one is sent are counted as overruns.
+
+use alloc::{
+    collections::{BTreeMap, VecDeque},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use core::time::Duration;
+
+use axerrno::{LinuxError, LinuxResult};
+use axhal::time::{TimeValue, wall_time};
+use axprocess::{Pid, Thread};
+use axsignal::{SignalInfo, Signo, api::ProcessSignalManager};
+use axsync::{RawMutex, spin::SpinNoIrq};
+use axtask::{MAX_RT_PRIO, SchedPolicy, WaitQueue};
+use linux_raw_sys::general::{SI_KERNEL, SI_TIMER, siginfo_t};
+use spin::Once;
+
+use crate::task::{ThreadData, WaitQueueWrapper, notify_process_signal};
+
+/// The maximum number of POSIX timers of a process.
+const MAX_POSIX_TIMERS: usize = 4096;
+
+/// The clock a timer counts down.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum TimerClock {
+    /// The wall clock, in terms of [`wall_time`].
+    Wall,
+    /// The monotonic clock, which timers count down like the wall clock.
+    Monotonic,
+    /// The user and system CPU time of the process.
+    ProcessCpu,
+    /// The user CPU time of the process.
+    ProcessUser,
+    /// The CPU time of the thread of the given ID.
+    ThreadCpu(Pid),
+}
+
+impl TimerClock {
+    /// Whether the clock is the CPU time of the process or a thread, which
+    /// is charged on timer ticks instead of set as alarms.
+    pub fn is_cpu_time(self) -> bool {
+        !matches!(self, Self::Wall | Self::Monotonic)
+    }
+}
+
+/// Where the signal of a timer is sent.
+pub enum TimerTarget {
+    /// Nowhere (`SIGEV_NONE`).
+    None,
+    /// To the process.
+    Process(Arc<ProcessSignalManager<RawMutex, WaitQueueWrapper>>),
+    /// To a thread (`SIGEV_THREAD_ID`).
+    Thread(Weak<Thread>),
+}
+
+/// The signal a timer sends on expiry.
+pub struct TimerSignal {
+    /// Where the signal is sent.
+    pub target: TimerTarget,
+    /// The signal number.
+    pub signo: Signo,
+    /// The value passed with the signal of a POSIX timer.
+    pub value: usize,
+}
+
+#[derive(Default)]
+struct TimerState {
+    /// The time of the next expiration on the wall clock, or the CPU time
+    /// left until it, or zero if the timer is disarmed.
+    value: Duration,
+    interval: Duration,
+    /// Incremented whenever the timer is set, so that the alarms set before
+    /// are ignored.
+    generation: u64,
+    /// Whether the timer is queued for its signal to be sent.
+    queued: bool,
+    /// The expirations since the signal was queued, besides the first one.
+    overrun: u64,
+    /// The overrun of the last signal sent.
+    last_overrun: i32,
+}
+
+impl TimerState {
+    /// Accounts `expirations`, returning whether the signal has to be queued.
+    fn expire(&mut self, expirations: u64) -> bool {
+        if self.queued {
+            self.overrun += expirations;
+            return false;
+        }
+        self.overrun += expirations - 1;
+        self.queued = true;
+        true
+    }
+}
+
+/// An interval timer.
+pub struct Timer {
+    /// The ID of a POSIX timer, or `None` for the ones of `setitimer`.
+    id: Option<i32>,
+    clock: TimerClock,
+    signal: TimerSignal,
+    state: SpinNoIrq<TimerState>,
+}
+
+impl Timer {
+    fn new(id: Option<i32>, clock: TimerClock, signal: TimerSignal) -> Arc<Self> {
+        Arc::new(Self {
+            id,
+            clock,
+            signal,
+            state: SpinNoIrq::new(TimerState::default()),
+        })
+    }
+
+    /// Returns the clock of the timer.
+    pub fn clock(&self) -> TimerClock {
+        self.clock
+    }
+
+    /// Returns the time left until the next expiration, which is zero if the
+    /// timer is disarmed, and the interval.
+    pub fn get(&self) -> (Duration, Duration) {
+        let state = self.state.lock();
+        let value = match self.clock {
+            clock if !clock.is_cpu_time() && !state.value.is_zero() => state
+                .value
+                .checked_sub(wall_time())
+                // Due, but not fired yet.
+                .unwrap_or(Duration::from_nanos(1)),
+            _ => state.value,
+        };
+        (value, state.interval)
+    }
+
+    /// Returns the overrun count of the last signal sent.
+    pub fn overrun(&self) -> i32 {
+        self.state.lock().last_overrun
+    }
+
+    /// Arms the timer to expire after `value` then every `interval`, or
+    /// disarms it if `value` is zero. Returns the old value and interval.
+    fn set(self: &Arc<Self>, value: Duration, interval: Duration) -> (Duration, Duration) {
+        let old = self.get();
+        let mut state = self.state.lock();
+        state.generation += 1;
+        state.interval = interval;
+        state.value = value;
+        if !value.is_zero() && !self.clock.is_cpu_time() {
+            state.value = wall_time() + value;
+            self.schedule(state.value, state.generation);
+        }
+        old
+    }
+
+    /// Sets an alarm on the `axtask` timer list for the next expiration.
+    fn schedule(self: &Arc<Self>, deadline: TimeValue, generation: u64) {
+        let timer = Arc::downgrade(self);
+        axtask::set_alarm(deadline, move |now| Self::fire(timer, generation, now));
+    }
+
+    /// Alarm callback of timers on the wall clock, running in the timer
+    /// interrupt.
+    fn fire(timer: Weak<Self>, generation: u64, now: TimeValue) {
+        let Some(timer) = timer.upgrade() else {
+            return;
+        };
+        let mut state = timer.state.lock();
+        if state.generation != generation || state.value.is_zero() {
+            return;
+        }
+        let mut expirations = 1;
+        if state.interval.is_zero() {
+            state.value = Duration::ZERO;
+        } else {
+            // Periods missed, e.g. while IRQs were disabled, are overruns.
+            let late =
+                (now.saturating_sub(state.value).as_nanos() / state.interval.as_nanos()) as u64;
+            expirations += late;
+            let elapsed = state.interval.as_nanos() * (late as u128 + 1);
+            state.value += Duration::from_nanos(elapsed as u64);
+            timer.schedule(state.value, generation);
+        }
+        if state.expire(expirations) {
+            drop(state);
+            queue_expired(timer);
+        }
+    }
+
+    /// Charges `time` to a timer on a CPU clock, returning whether it is
+    /// still armed.
+    fn charge(self: &Arc<Self>, time: Duration) -> bool {
+        let mut state = self.state.lock();
+        if state.value.is_zero() {
+            return false;
+        }
+        if state.value > time {
+            state.value -= time;
+            return true;
+        }
+        let mut expirations = 1;
+        let past = time - state.value;
+        if state.interval.is_zero() {
+            state.value = Duration::ZERO;
+        } else {
+            let interval = state.interval.as_nanos();
+            expirations += (past.as_nanos() / interval) as u64;
+            let left = interval - past.as_nanos() % interval;
+            state.value = Duration::from_nanos(left as u64);
+        }
+        let armed = !state.value.is_zero();
+        if state.expire(expirations) {
+            drop(state);
+            queue_expired(self.clone());
+        }
+        armed
+    }
+
+    /// Sends the signal of an expired timer, from the kernel task.
+    fn send_signal(&self) {
+        let overrun = {
+            let mut state = self.state.lock();
+            state.queued = false;
+            let overrun = core::mem::take(&mut state.overrun).min(i32::MAX as u64) as i32;
+            state.last_overrun = overrun;
+            overrun
+        };
+        let sig = match self.id {
+            Some(id) => {
+                let sig = SignalInfo::new(self.signal.signo, SI_TIMER as _);
+                // SAFETY: `SignalInfo` is a transparent wrapper of
+                // `siginfo_t`, as it is read from the user by
+                // `rt_sigqueueinfo`.
+                let mut info: siginfo_t = unsafe { core::mem::transmute(sig) };
+                unsafe {
+                    let timer = &mut info.__bindgen_anon_1.__bindgen_anon_1._sifields._timer;
+                    timer._tid = id;
+                    timer._overrun = overrun;
+                    timer._sigval.sival_ptr = self.signal.value as _;
+                    core::mem::transmute::<siginfo_t, SignalInfo>(info)
+                }
+            }
+            None => SignalInfo::new(self.signal.signo, SI_KERNEL as _),
+        };
+        match &self.signal.target {
+            TimerTarget::None => {}
+            TimerTarget::Process(signal) => {
+                signal.send_signal(sig);
+                notify_process_signal();
+            }
+            TimerTarget::Thread(thread) => {
+                let thread = thread.upgrade();
+                if let Some(thr) = thread.as_ref().and_then(|t| t.data::<ThreadData>()) {
+                    thr.send_signal(sig);
+                }
+            }
+        }
+    }
+}
+
+/// The timers expired in the IRQ context, whose signals are to be sent.
+static EXPIRED_TIMERS: SpinNoIrq<VecDeque<Arc<Timer>>> = SpinNoIrq::new(VecDeque::new());
+static EXPIRED_WQ: WaitQueue = WaitQueue::new();
+static SIGNAL_TASK: Once = Once::new();
+
+fn queue_expired(timer: Arc<Timer>) {
+    if matches!(timer.signal.target, TimerTarget::None) {
+        timer.state.lock().queued = false;
+        return;
+    }
+    EXPIRED_TIMERS.lock().push_back(timer);
+    EXPIRED_WQ.notify_one(false);
+}
+
+/// Spawns the kernel task that sends the signals of expired timers, at the
+/// highest real-time priority so that they are sent as soon as possible.
+fn start_signal_task() {
+    SIGNAL_TASK.call_once(|| {
+        let task = axtask::spawn_raw(
+            || loop {
+                EXPIRED_WQ.wait_until(|| !EXPIRED_TIMERS.lock().is_empty());
+                loop {
+                    let timer = EXPIRED_TIMERS.lock().pop_front();
+                    let Some(timer) = timer else {
+                        break;
+                    };
+                    timer.send_signal();
+                }
+            },
+            "timer_signal".into(),
+            axconfig::TASK_STACK_SIZE,
+        );
+        axtask::set_task_policy(&task, SchedPolicy::Fifo(MAX_RT_PRIO));
+    });
+}
+
+/// The interval timers of a process.
+pub struct ProcessTimers {
+    /// The timers of `setitimer`, by `ITIMER_*` type.
+    itimers: [Arc<Timer>; 3],
+    /// The POSIX timers, by ID.
+    posix: SpinNoIrq<BTreeMap<i32, Arc<Timer>>>,
+    /// The armed timers on CPU clocks.
+    cpu_timers: SpinNoIrq<Vec<Arc<Timer>>>,
+}
+
+impl ProcessTimers {
+    /// Creates the timers of a process whose signals are managed by
+    /// `signal`.
+    pub fn new(signal: &Arc<ProcessSignalManager<RawMutex, WaitQueueWrapper>>) -> Self {
+        let itimer = |clock, signo| {
+            let target = TimerTarget::Process(signal.clone());
+            Timer::new(
+                None,
+                clock,
+                TimerSignal {
+                    target,
+                    signo,
+                    value: 0,
+                },
+            )
+        };
+        Self {
+            itimers: [
+                itimer(TimerClock::Wall, Signo::SIGALRM),
+                itimer(TimerClock::ProcessUser, Signo::SIGVTALRM),
+                itimer(TimerClock::ProcessCpu, Signo::SIGPROF),
+            ],
+            posix: SpinNoIrq::new(BTreeMap::new()),
+            cpu_timers: SpinNoIrq::new(Vec::new()),
+        }
+    }
+
+    /// Returns the timer of `setitimer` of type `which`.
+    pub fn itimer(&self, which: u32) -> LinuxResult<&Arc<Timer>> {
+        self.itimers.get(which as usize).ok_or(LinuxError::EINVAL)
+    }
+
+    /// Creates a disarmed POSIX timer, returning its ID. The value sent with
+    /// its signal is the ID if `value` is `None`.
+    pub fn create(
+        &self,
+        clock: TimerClock,
+        target: TimerTarget,
+        signo: Signo,
+        value: Option<usize>,
+    ) -> LinuxResult<i32> {
+        let mut posix = self.posix.lock();
+        if posix.len() >= MAX_POSIX_TIMERS {
+            return Err(LinuxError::EAGAIN);
+        }
+        let id = (0..).find(|id| !posix.contains_key(id)).unwrap();
+        let signal = TimerSignal {
+            target,
+            signo,
+            value: value.unwrap_or(id as usize),
+        };
+        posix.insert(id, Timer::new(Some(id), clock, signal));
+        Ok(id)
+    }
+
+    /// Returns the POSIX timer `id`.
+    pub fn get(&self, id: i32) -> LinuxResult<Arc<Timer>> {
+        self.posix
+            .lock()
+            .get(&id)
+            .cloned()
+            .ok_or(LinuxError::EINVAL)
+    }
+
+    /// Deletes the POSIX timer `id`.
+    pub fn delete(&self, id: i32) -> LinuxResult {
+        let timer = self.posix.lock().remove(&id).ok_or(LinuxError::EINVAL)?;
+        self.set(&timer, Duration::ZERO, Duration::ZERO);
+        Ok(())
+    }
+
+    /// Deletes all the POSIX timers, as `execve` does.
+    pub fn delete_all(&self) {
+        let posix = core::mem::take(&mut *self.posix.lock());
+        for timer in posix.values() {
+            self.set(timer, Duration::ZERO, Duration::ZERO);
+        }
+    }
+
+    /// Arms `timer` to expire after `value` then every `interval`, or disarms
+    /// it if `value` is zero. Returns the old value and interval.
+    pub fn set(
+        &self,
+        timer: &Arc<Timer>,
+        value: Duration,
+        interval: Duration,
+    ) -> (Duration, Duration) {
+        if !value.is_zero() {
+            start_signal_task();
+        }
+        let old = timer.set(value, interval);
+        if timer.clock.is_cpu_time() {
+            let mut cpu_timers = self.cpu_timers.lock();
+            cpu_timers.retain(|t| !Arc::ptr_eq(t, timer));
+            if !value.is_zero() {
+                cpu_timers.push(timer.clone());
+            }
+        }
+        old
+    }
+
+    /// Charges a timer tick of `tick` to the timers on CPU clocks, in the
+    /// timer interrupt of the thread `tid`.
+    pub fn charge_tick(&self, tick: Duration, from_user: bool, tid: Pid) {
+        let mut cpu_timers = self.cpu_timers.lock();
+        if cpu_timers.is_empty() {
+            return;
+        }
+        cpu_timers.retain(|timer| match timer.clock {
+            TimerClock::ProcessUser if !from_user => true,
+            TimerClock::ThreadCpu(thread) if thread != tid => true,
+            _ => timer.charge(tick),
+        });
+    }
+}
@@ -0,0 +1,668 @@
+//! The virtual dynamic shared object (vDSO) mapped into user address spaces.
+//!
+//! `clock_gettime` and `gettimeofday` are answered in user mode by reading the
+//! hardware counter directly and converting it with the data that the kernel
+//! publishes in a read-only time page (vvar). The vDSO is a minimal ELF
+//! shared object built at boot, which only has the dynamic symbol table that
+//! libc needs to find the functions. Clocks other than `CLOCK_REALTIME` and
+//! `CLOCK_MONOTONIC` fall back to the system call.
+//!
+//! The time page is mapped right after the signal trampoline, followed by the
+//! vDSO, whose address is passed to the app as `AT_SYSINFO_EHDR`.
+
+use core::{
+    cell::UnsafeCell,
+    sync::atomic::{AtomicU64, Ordering, fence},
+};
+
+use axerrno::AxResult;
+use axhal::{mem::virt_to_phys, paging::MappingFlags};
+use axmm::AddrSpace;
+use memory_addr::PAGE_SIZE_4K;
+
+/// The address of the time page in user address spaces.
+pub const VVAR_ADDR: usize = axconfig::plat::SIGNAL_TRAMPOLINE + PAGE_SIZE_4K;
+/// The address of the vDSO in user address spaces.
+pub const VDSO_ADDR: usize = VVAR_ADDR + PAGE_SIZE_4K;
+
+/// The offset of the code in the vDSO. The code locates the time page relative
+/// to its own address, `CODE_OFFSET + PAGE_SIZE_4K` (0x1800) below it.
+const CODE_OFFSET: usize = 0x800;
+
+/// The data shared with the vDSO, which reads it with a sequence lock.
+///
+/// The layout is known to the assembly below.
+#[repr(C, align(4096))]
+struct VdsoData {
+    /// Odd while the data is being updated.
+    seq: AtomicU64,
+    /// The counter value at `base_nanos`.
+    base_counter: AtomicU64,
+    /// The monotonic time in nanoseconds at `base_counter`.
+    base_nanos: AtomicU64,
+    /// Nanoseconds per counter tick, as a 32.32 fixed-point number.
+    mult: AtomicU64,
+    /// The offset of the wall time to the monotonic time in nanoseconds.
+    realtime_offset: AtomicU64,
+}
+
+static VDSO_DATA: VdsoData = VdsoData {
+    seq: AtomicU64::new(0),
+    base_counter: AtomicU64::new(0),
+    base_nanos: AtomicU64::new(0),
+    mult: AtomicU64::new(0),
+    realtime_offset: AtomicU64::new(0),
+};
+
+#[repr(C, align(4096))]
+struct VdsoImage(UnsafeCell<[u8; PAGE_SIZE_4K]>);
+
+// The image is only written once, before it is mapped.
+unsafe impl Sync for VdsoImage {}
+
+static VDSO_IMAGE: VdsoImage = VdsoImage(UnsafeCell::new([0; PAGE_SIZE_4K]));
+static VDSO_INIT: spin::Once = spin::Once::new();
+
+/// Reads the raw hardware counter, as the vDSO does.
+fn read_counter() -> u64 {
+    let counter: u64;
+    #[cfg(target_arch = "x86_64")]
+    {
+        counter = unsafe { core::arch::x86_64::_rdtsc() };
+    }
+    #[cfg(target_arch = "riscv64")]
+    unsafe {
+        core::arch::asm!("rdtime {}", out(reg) counter);
+    }
+    #[cfg(target_arch = "aarch64")]
+    unsafe {
+        core::arch::asm!("mrs {}, cntpct_el0", out(reg) counter);
+    }
+    #[cfg(target_arch = "loongarch64")]
+    unsafe {
+        core::arch::asm!("rdtime.d {}, $zero", out(reg) counter);
+    }
+    counter
+}
+
+/// Publishes the current time base to the time page.
+///
+/// The counter runs at a fixed rate and the wall clock can't be set, so this
+/// is only needed once.
+fn update_vdso_data() {
+    let data = &VDSO_DATA;
+    let counter = read_counter();
+    let nanos = axhal::time::monotonic_time_nanos();
+
+    let seq = data.seq.load(Ordering::Relaxed);
+    data.seq.store(seq + 1, Ordering::Relaxed);
+    fence(Ordering::Release);
+    data.base_counter.store(counter, Ordering::Relaxed);
+    data.base_nanos.store(nanos, Ordering::Relaxed);
+    data.mult
+        .store(axhal::time::ticks_to_nanos(1 << 32), Ordering::Relaxed);
+    data.realtime_offset
+        .store(axhal::time::epochoffset_nanos(), Ordering::Relaxed);
+    data.seq.store(seq + 2, Ordering::Release);
+}
+
+#[cfg(target_arch = "x86_64")]
+const ELF_MACHINE: u16 = 62;
+#[cfg(target_arch = "riscv64")]
+const ELF_MACHINE: u16 = 243;
+#[cfg(target_arch = "aarch64")]
+const ELF_MACHINE: u16 = 183;
+#[cfg(target_arch = "loongarch64")]
+const ELF_MACHINE: u16 = 258;
+
+#[cfg(target_arch = "riscv64")]
+const ELF_FLAGS: u32 = 0x5; // RVC, double-float ABI
+#[cfg(target_arch = "loongarch64")]
+const ELF_FLAGS: u32 = 0x43; // LP64D, object ABI v1
+#[cfg(not(any(target_arch = "riscv64", target_arch = "loongarch64")))]
+const ELF_FLAGS: u32 = 0;
+
+/// The names of `clock_gettime` and `gettimeofday`, which libc looks up.
+#[cfg(target_arch = "aarch64")]
+const SYMBOL_NAMES: [&str; 2] = ["__kernel_clock_gettime", "__kernel_gettimeofday"];
+#[cfg(not(target_arch = "aarch64"))]
+const SYMBOL_NAMES: [&str; 2] = ["__vdso_clock_gettime", "__vdso_gettimeofday"];
+
+const SONAME: &str = "linux-vdso.so.1";
+
+const PHDR_OFFSET: usize = 64;
+const DYNAMIC_OFFSET: usize = PHDR_OFFSET + 2 * 56;
+const DYNAMIC_LEN: usize = 7;
+const HASH_OFFSET: usize = DYNAMIC_OFFSET + DYNAMIC_LEN * 16;
+const SYMTAB_OFFSET: usize = HASH_OFFSET + 6 * 4;
+const STRTAB_OFFSET: usize = SYMTAB_OFFSET + 3 * 24;
+
+/// Writes little-endian values into the image.
+struct ImageWriter<'a> {
+    image: &'a mut [u8],
+    offset: usize,
+}
+
+impl<'a> ImageWriter<'a> {
+    fn at(image: &'a mut [u8], offset: usize) -> Self {
+        Self { image, offset }
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) -> &mut Self {
+        self.image[self.offset..self.offset + bytes.len()].copy_from_slice(bytes);
+        self.offset += bytes.len();
+        self
+    }
+
+    fn u16(&mut self, value: u16) -> &mut Self {
+        self.bytes(&value.to_le_bytes())
+    }
+
+    fn u32(&mut self, value: u32) -> &mut Self {
+        self.bytes(&value.to_le_bytes())
+    }
+
+    fn u64(&mut self, value: u64) -> &mut Self {
+        self.bytes(&value.to_le_bytes())
+    }
+}
+
+unsafe extern "C" {
+    fn vdso_text_start();
+    fn vdso_clock_gettime();
+    fn vdso_gettimeofday();
+    fn vdso_text_end();
+}
+
+/// Builds the vDSO: an ELF header, a `PT_LOAD` segment covering the whole
+/// page, a `PT_DYNAMIC` segment, the hash, symbol and string tables, and the
+/// code.
+fn build_image(image: &mut [u8; PAGE_SIZE_4K]) {
+    let text_start = vdso_text_start as *const () as usize;
+    let text_end = vdso_text_end as *const () as usize;
+    let text =
+        unsafe { core::slice::from_raw_parts(text_start as *const u8, text_end - text_start) };
+    assert!(CODE_OFFSET + text.len() <= PAGE_SIZE_4K);
+    image[CODE_OFFSET..CODE_OFFSET + text.len()].copy_from_slice(text);
+
+    // Symbols as (name offset, value, size).
+    let clock_gettime = vdso_clock_gettime as *const () as usize;
+    let gettimeofday = vdso_gettimeofday as *const () as usize;
+    let soname = 1;
+    let cgt_name = soname + SONAME.len() + 1;
+    let gtod_name = cgt_name + SYMBOL_NAMES[0].len() + 1;
+    let strtab_size = gtod_name + SYMBOL_NAMES[1].len() + 1;
+    let symbols = [
+        (
+            cgt_name,
+            CODE_OFFSET + clock_gettime - text_start,
+            gettimeofday - clock_gettime,
+        ),
+        (
+            gtod_name,
+            CODE_OFFSET + gettimeofday - text_start,
+            text_end - gettimeofday,
+        ),
+    ];
+
+    // ELF header
+    ImageWriter::at(image, 0)
+        .bytes(&[0x7f, b'E', b'L', b'F', 2, 1, 1, 0])
+        .u64(0)
+        .u16(3) // ET_DYN
+        .u16(ELF_MACHINE)
+        .u32(1)
+        .u64(0) // e_entry
+        .u64(PHDR_OFFSET as u64)
+        .u64(0) // e_shoff
+        .u32(ELF_FLAGS)
+        .u16(64)
+        .u16(56)
+        .u16(2)
+        .u16(64)
+        .u16(0)
+        .u16(0);
+
+    // Program headers
+    let dynamic_size = (DYNAMIC_LEN * 16) as u64;
+    ImageWriter::at(image, PHDR_OFFSET)
+        .u32(1) // PT_LOAD
+        .u32(0b101) // PF_R | PF_X
+        .u64(0)
+        .u64(0)
+        .u64(0)
+        .u64(PAGE_SIZE_4K as u64)
+        .u64(PAGE_SIZE_4K as u64)
+        .u64(PAGE_SIZE_4K as u64)
+        .u32(2) // PT_DYNAMIC
+        .u32(0b100) // PF_R
+        .u64(DYNAMIC_OFFSET as u64)
+        .u64(DYNAMIC_OFFSET as u64)
+        .u64(DYNAMIC_OFFSET as u64)
+        .u64(dynamic_size)
+        .u64(dynamic_size)
+        .u64(8);
+
+    // Dynamic section
+    ImageWriter::at(image, DYNAMIC_OFFSET)
+        .u64(4) // DT_HASH
+        .u64(HASH_OFFSET as u64)
+        .u64(5) // DT_STRTAB
+        .u64(STRTAB_OFFSET as u64)
+        .u64(6) // DT_SYMTAB
+        .u64(SYMTAB_OFFSET as u64)
+        .u64(10) // DT_STRSZ
+        .u64(strtab_size as u64)
+        .u64(11) // DT_SYMENT
+        .u64(24)
+        .u64(14) // DT_SONAME
+        .u64(soname as u64)
+        .u64(0) // DT_NULL
+        .u64(0);
+
+    // A hash table with a single bucket chaining both symbols, which also
+    // tells the number of symbols.
+    ImageWriter::at(image, HASH_OFFSET)
+        .u32(1)
+        .u32(3)
+        .u32(1)
+        .u32(0)
+        .u32(2)
+        .u32(0);
+
+    // Symbol table, starting with the null symbol
+    let mut writer = ImageWriter::at(image, SYMTAB_OFFSET + 24);
+    for (name, value, size) in symbols {
+        writer
+            .u32(name as u32)
+            .bytes(&[0x12, 0]) // STB_GLOBAL, STT_FUNC
+            .u16(1) // any defined section
+            .u64(value as u64)
+            .u64(size as u64);
+    }
+
+    // String table
+    ImageWriter::at(image, STRTAB_OFFSET + soname)
+        .bytes(SONAME.as_bytes())
+        .bytes(&[0])
+        .bytes(SYMBOL_NAMES[0].as_bytes())
+        .bytes(&[0])
+        .bytes(SYMBOL_NAMES[1].as_bytes())
+        .bytes(&[0]);
+    assert!(STRTAB_OFFSET + strtab_size <= CODE_OFFSET);
+}
+
+/// Maps the time page and the vDSO to the user address space.
+pub fn map_vdso(aspace: &mut AddrSpace) -> AxResult {
+    VDSO_INIT.call_once(|| {
+        update_vdso_data();
+        build_image(unsafe { &mut *VDSO_IMAGE.0.get() });
+    });
+    aspace.map_linear(
+        VVAR_ADDR.into(),
+        virt_to_phys((&VDSO_DATA as *const VdsoData as usize).into()),
+        PAGE_SIZE_4K,
+        MappingFlags::READ | MappingFlags::USER,
+    )?;
+    aspace.map_linear(
+        VDSO_ADDR.into(),
+        virt_to_phys((VDSO_IMAGE.0.get() as usize).into()),
+        PAGE_SIZE_4K,
+        MappingFlags::READ | MappingFlags::EXECUTE | MappingFlags::USER,
+    )?;
+    Ok(())
+}
+
+// The code of the vDSO, which is copied into the image and never run in the
+// kernel. It must be position independent and only refer to itself.
+//
+// `.Lread_ns` comes first so that it can find the time page from its own
+// address. It returns the nanoseconds of `CLOCK_REALTIME` if the clock id
+// argument is 0, or of `CLOCK_MONOTONIC` otherwise.
+
+#[cfg(target_arch = "x86_64")]
+core::arch::global_asm!(
+    "
+    .pushsection .text.vdso, \"ax\"
+    .balign 16
+    .globl vdso_text_start
+vdso_text_start:
+.Lvdso_start:
+.Lread_ns:
+    lea r8, [rip + .Lvdso_start]
+    sub r8, 0x1800
+.Lread_retry:
+    mov r9, [r8]
+    test r9, 1
+    jnz .Lread_wait
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, [r8 + 8]
+    jae .Lread_scale
+    xor eax, eax
+.Lread_scale:
+    mul qword ptr [r8 + 24]
+    shrd rax, rdx, 32
+    add rax, [r8 + 16]
+    test edi, edi
+    jnz .Lread_check
+    add rax, [r8 + 32]
+.Lread_check:
+    cmp r9, [r8]
+    jne .Lread_retry
+    ret
+.Lread_wait:
+    pause
+    jmp .Lread_retry
+
+    .globl vdso_clock_gettime
+vdso_clock_gettime:
+    cmp edi, 1
+    ja .Lcgt_syscall
+    call .Lread_ns
+    xor edx, edx
+    mov ecx, 1000000000
+    div rcx
+    mov [rsi], rax
+    mov [rsi + 8], rdx
+    xor eax, eax
+    ret
+.Lcgt_syscall:
+    mov eax, 228
+    syscall
+    ret
+
+    .globl vdso_gettimeofday
+vdso_gettimeofday:
+    test rsi, rsi
+    jz .Lgtod_tv
+    mov qword ptr [rsi], 0
+.Lgtod_tv:
+    test rdi, rdi
+    jz .Lgtod_done
+    mov r11, rdi
+    xor edi, edi
+    call .Lread_ns
+    xor edx, edx
+    mov ecx, 1000000000
+    div rcx
+    mov [r11], rax
+    mov rax, rdx
+    xor edx, edx
+    mov ecx, 1000
+    div rcx
+    mov [r11 + 8], rax
+.Lgtod_done:
+    xor eax, eax
+    ret
+
+    .globl vdso_text_end
+vdso_text_end:
+    .popsection
+    "
+);
+
+#[cfg(target_arch = "riscv64")]
+core::arch::global_asm!(
+    "
+    .pushsection .text.vdso, \"ax\"
+    .balign 16
+    .globl vdso_text_start
+vdso_text_start:
+.Lread_ns:
+    // Returns with `jr t6`, clobbering t0-t5.
+    auipc t0, 0
+    li t1, 0x1800
+    sub t0, t0, t1
+1:
+    ld t1, 0(t0)
+    andi t2, t1, 1
+    bnez t2, 1b
+    fence r, r
+    rdtime t2
+    ld t3, 8(t0)
+    li t4, 0
+    bltu t2, t3, 2f
+    sub t2, t2, t3
+    ld t3, 24(t0)
+    mul t4, t2, t3
+    mulhu t5, t2, t3
+    srli t4, t4, 32
+    slli t5, t5, 32
+    or t4, t4, t5
+2:
+    ld t3, 16(t0)
+    add t4, t4, t3
+    bnez a0, 3f
+    ld t3, 32(t0)
+    add t4, t4, t3
+3:
+    fence r, r
+    ld t3, 0(t0)
+    bne t1, t3, 1b
+    mv a0, t4
+    jr t6
+
+    .globl vdso_clock_gettime
+vdso_clock_gettime:
+    li t0, 1
+    bgtu a0, t0, 1f
+    jal t6, .Lread_ns
+    li t0, 1000000000
+    divu t1, a0, t0
+    remu t2, a0, t0
+    sd t1, 0(a1)
+    sd t2, 8(a1)
+    li a0, 0
+    ret
+1:
+    li a7, 113
+    ecall
+    ret
+
+    .globl vdso_gettimeofday
+vdso_gettimeofday:
+    beqz a1, 1f
+    sd zero, 0(a1)
+1:
+    beqz a0, 2f
+    mv a2, a0
+    li a0, 0
+    jal t6, .Lread_ns
+    li t0, 1000000000
+    divu t1, a0, t0
+    remu t2, a0, t0
+    li t0, 1000
+    divu t2, t2, t0
+    sd t1, 0(a2)
+    sd t2, 8(a2)
+2:
+    li a0, 0
+    ret
+
+    .globl vdso_text_end
+vdso_text_end:
+    .popsection
+    "
+);
+
+#[cfg(target_arch = "aarch64")]
+core::arch::global_asm!(
+    "
+    .pushsection .text.vdso, \"ax\"
+    .balign 16
+    .globl vdso_text_start
+vdso_text_start:
+.Lvdso_start:
+.Lread_ns:
+    // Clobbers x9-x14.
+    adr x9, .Lvdso_start
+    sub x9, x9, #0x1000
+    sub x9, x9, #0x800
+1:
+    ldar x10, [x9]
+    tbnz x10, #0, 1b
+    isb
+    mrs x11, cntpct_el0
+    ldr x12, [x9, #8]
+    mov x13, #0
+    cmp x11, x12
+    b.lo 2f
+    sub x11, x11, x12
+    ldr x12, [x9, #24]
+    mul x13, x11, x12
+    umulh x14, x11, x12
+    extr x13, x14, x13, #32
+2:
+    ldr x12, [x9, #16]
+    add x13, x13, x12
+    cbnz w0, 3f
+    ldr x12, [x9, #32]
+    add x13, x13, x12
+3:
+    dmb ishld
+    ldr x12, [x9]
+    cmp x10, x12
+    b.ne 1b
+    mov x0, x13
+    ret
+
+    .globl vdso_clock_gettime
+vdso_clock_gettime:
+    cmp w0, #1
+    b.hi 1f
+    mov x15, x30
+    bl .Lread_ns
+    mov x30, x15
+    movz x9, #0xca00
+    movk x9, #0x3b9a, lsl #16
+    udiv x10, x0, x9
+    msub x11, x10, x9, x0
+    stp x10, x11, [x1]
+    mov x0, #0
+    ret
+1:
+    mov x8, #113
+    svc #0
+    ret
+
+    .globl vdso_gettimeofday
+vdso_gettimeofday:
+    cbz x1, 1f
+    str xzr, [x1]
+1:
+    cbz x0, 2f
+    mov x2, x0
+    mov x0, #0
+    mov x15, x30
+    bl .Lread_ns
+    mov x30, x15
+    movz x9, #0xca00
+    movk x9, #0x3b9a, lsl #16
+    udiv x10, x0, x9
+    msub x11, x10, x9, x0
+    mov x9, #1000
+    udiv x11, x11, x9
+    stp x10, x11, [x2]
+2:
+    mov x0, #0
+    ret
+
+    .globl vdso_text_end
+vdso_text_end:
+    .popsection
+    "
+);
+
+#[cfg(target_arch = "loongarch64")]
+core::arch::global_asm!(
+    "
+    .pushsection .text.vdso, \"ax\"
+    .balign 16
+    .globl vdso_text_start
+vdso_text_start:
+.Lread_ns:
+    // Clobbers t0-t5.
+    pcaddi $t0, 0
+    lu12i.w $t1, 1
+    ori $t1, $t1, 0x800
+    sub.d $t0, $t0, $t1
+1:
+    ld.d $t1, $t0, 0
+    andi $t2, $t1, 1
+    bnez $t2, 1b
+    dbar 0
+    rdtime.d $t2, $zero
+    ld.d $t3, $t0, 8
+    move $t4, $zero
+    bltu $t2, $t3, 2f
+    sub.d $t2, $t2, $t3
+    ld.d $t3, $t0, 24
+    mul.d $t4, $t2, $t3
+    mulh.du $t5, $t2, $t3
+    srli.d $t4, $t4, 32
+    slli.d $t5, $t5, 32
+    or $t4, $t4, $t5
+2:
+    ld.d $t3, $t0, 16
+    add.d $t4, $t4, $t3
+    bnez $a0, 3f
+    ld.d $t3, $t0, 32
+    add.d $t4, $t4, $t3
+3:
+    dbar 0
+    ld.d $t3, $t0, 0
+    bne $t1, $t3, 1b
+    move $a0, $t4
+    jr $ra
+
+    .globl vdso_clock_gettime
+vdso_clock_gettime:
+    ori $t0, $zero, 1
+    bltu $t0, $a0, 1f
+    move $t8, $ra
+    bl .Lread_ns
+    move $ra, $t8
+    lu12i.w $t0, 0x3b9ac
+    ori $t0, $t0, 0xa00
+    div.du $t1, $a0, $t0
+    mod.du $t2, $a0, $t0
+    st.d $t1, $a1, 0
+    st.d $t2, $a1, 8
+    move $a0, $zero
+    jr $ra
+1:
+    ori $a7, $zero, 113
+    syscall 0
+    jr $ra
+
+    .globl vdso_gettimeofday
+vdso_gettimeofday:
+    beqz $a1, 1f
+    st.d $zero, $a1, 0
+1:
+    beqz $a0, 2f
+    move $a2, $a0
+    move $a0, $zero
+    move $t8, $ra
+    bl .Lread_ns
+    move $ra, $t8
+    lu12i.w $t0, 0x3b9ac
+    ori $t0, $t0, 0xa00
+    div.du $t1, $a0, $t0
+    mod.du $t2, $a0, $t0
+    ori $t0, $zero, 1000
+    div.du $t2, $t2, $t0
+    st.d $t1, $a2, 0
+    st.d $t2, $a2, 8
+2:
+    move $a0, $zero
+    jr $ra
+
+    .globl vdso_text_end
+vdso_text_end:
+    .popsection
+    "
+);
@@ -111,6 +111,7 @@ function test_one() {
 test_list=(
     "nimbos"
     "libc"
+    "bench"
 )
 
 for t in ${test_list[@]}; do
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Runs the benchmarks of `apps/bench` in QEMU on every architecture, and judges
+# the results against the baselines in `apps/bench/baseline` with
+# `apps/oscomp/judge_perf.py`. The output and the report of each architecture
+# are kept in `bench_results`.
+#
+# Set `ARCHS` to run only some architectures, and `BENCH_UPDATE=y` to replace
+# the baselines with the results instead, e.g. on the commit to compare with.
+
+TIMEOUT=300s
+EXIT_STATUS=0
+ROOT=$(realpath $(dirname $0))/../
+AX_ROOT=$ROOT/.arceos
+OUT_DIR=$ROOT/bench_results
+BASELINE_DIR=$ROOT/apps/bench/baseline
+JUDGE=$ROOT/apps/oscomp/judge_perf.py
+
+RED_C="\x1b[31;1m"
+GREEN_C="\x1b[32;1m"
+YELLOW_C="\x1b[33;1m"
+CYAN_C="\x1b[36;1m"
+END_C="\x1b[0m"
+
+if [ -z "$ARCHS" ]; then
+    ARCHS="x86_64 riscv64 aarch64 loongarch64"
+fi
+
+mkdir -p "$OUT_DIR" "$BASELINE_DIR"
+
+for arch in $ARCHS; do
+    echo -e "${CYAN_C}Benchmarking${END_C} $arch:"
+    actual="$OUT_DIR/$arch.out"
+    report="$OUT_DIR/$arch.report"
+    baseline="$BASELINE_DIR/$arch.json"
+    config_file=$(realpath --relative-to=$AX_ROOT "$ROOT/configs/$arch.toml")
+    args="AX_TESTCASE=bench LOG=off FEATURES=fp_simd BLK=y NET=y ARCH=$arch ACCEL=n EXTRA_CONFIG=$config_file"
+
+    if ! make -C "$ROOT" user_apps AX_TESTCASE=bench ARCH=$arch > "$actual" 2>&1 ||
+        ! make -C "$ROOT" $args defconfig build > "$actual" 2>&1; then
+        echo -e "    ${RED_C}build failed!${END_C}"
+        cat "$actual"
+        EXIT_STATUS=1
+        continue
+    fi
+    timeout --foreground $TIMEOUT make -C "$ROOT" $args justrun > "$actual" 2>&1
+    res=$?
+    if [ $res == 124 ]; then
+        echo -e "    ${YELLOW_C}timeout!${END_C}"
+        EXIT_STATUS=2
+        continue
+    elif [ $res -ne 0 ]; then
+        echo -e "    ${RED_C}run failed!${END_C}"
+        EXIT_STATUS=1
+        continue
+    fi
+
+    if [ "$BENCH_UPDATE" == "y" ] || [ ! -f "$baseline" ]; then
+        python3 $JUDGE --update "$baseline" < "$actual" | tee "$report"
+    elif python3 $JUDGE "$baseline" < "$actual" > "$report"; then
+        echo -e "    ${GREEN_C}passed!${END_C}"
+        sed 's/^/    /' "$report"
+    else
+        echo -e "    ${RED_C}regressed!${END_C}"
+        sed 's/^/    /' "$report"
+        EXIT_STATUS=255
+    fi
+done
+
+echo -e "bench script exited with: $EXIT_STATUS"
+exit $EXIT_STATUS
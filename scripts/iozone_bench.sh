@@ -0,0 +1,159 @@
+#!/bin/bash
+
+# Runs iozone in QEMU on vfat, ext4 (with the `lwext4_rs` feature) and tmpfs,
+# over a matrix of file and record sizes, and judges the throughput of each
+# test against the baselines in `apps/oscomp/baseline` with
+# `apps/oscomp/judge_perf.py`. The output, the CSV of the results (see
+# `apps/oscomp/iozone_matrix.py`) and the report of each architecture are kept
+# in `bench_results`.
+#
+# iozone and busybox are taken from the OSCOMP sdcard image of the
+# architecture, downloaded as by `make oscomp_run`, and copied to the vfat and
+# ext4 images the kernel runs on. tmpfs is tested on `/tmp` with the vfat
+# image. This needs `debugfs`, `mkfs.ext4`, `mkfs.vfat` and `mcopy`.
+#
+# Set `ARCHS` to run only some architectures, `FSES` to test only some
+# filesystems, `IOZONE_ARGS` to change the sizes, and `BENCH_UPDATE=y` to
+# replace the baselines with the results instead, e.g. on the commit to
+# compare with. iozone is noisy in QEMU, so a result only regresses past
+# `IOZONE_MAX_RATIO` (1.3 by default).
+
+TIMEOUT=900s
+EXIT_STATUS=0
+ROOT=$(realpath $(dirname $0))/../
+AX_ROOT=$ROOT/.arceos
+OUT_DIR=$ROOT/bench_results
+BASELINE_DIR=$ROOT/apps/oscomp/baseline
+MATRIX=$ROOT/apps/oscomp/iozone_matrix.py
+JUDGE=$ROOT/apps/oscomp/judge_perf.py
+
+RED_C="\x1b[31;1m"
+GREEN_C="\x1b[32;1m"
+YELLOW_C="\x1b[33;1m"
+CYAN_C="\x1b[36;1m"
+END_C="\x1b[0m"
+
+if [ -z "$ARCHS" ]; then
+    ARCHS="x86_64 riscv64 aarch64 loongarch64"
+fi
+if [ -z "$FSES" ]; then
+    FSES="vfat ext4 tmpfs"
+fi
+if [ -z "$IOZONE_ARGS" ]; then
+    # Auto mode on files of 64 kB to 4 MB, with records of 4 kB to 1 MB, of
+    # write/rewrite, read/reread and random read/write, including the time
+    # to flush the file in the writes.
+    IOZONE_ARGS="-a -e -i 0 -i 1 -i 2 -n 64k -g 4m -y 4k -q 1m"
+fi
+if [ -z "$IOZONE_MAX_RATIO" ]; then
+    IOZONE_MAX_RATIO=1.3
+fi
+
+# Builds the vfat and ext4 images with iozone and busybox in `/musl`, as on
+# the sdcard image.
+function build_images() {
+    local arch=$1
+    local work=$2
+    local sdcard=$ROOT/sdcard-$arch.img
+
+    if [ ! -f "$sdcard" ]; then
+        wget -q -O "$sdcard.gz" \
+            https://github.com/Azure-stars/testsuits-for-oskernel/releases/download/v0.1/sdcard-$arch.img.gz &&
+            gunzip "$sdcard.gz" || return 1
+    fi
+    mkdir -p "$work/root/musl"
+    for bin in iozone busybox; do
+        debugfs -R "dump /musl/$bin $work/root/musl/$bin" "$sdcard" > /dev/null 2>&1 &&
+            [ -s "$work/root/musl/$bin" ] || return 1
+        chmod +x "$work/root/musl/$bin"
+    done
+
+    rm -f "$work/vfat.img" "$work/ext4.img"
+    dd if=/dev/zero of="$work/vfat.img" bs=4M count=32 status=none &&
+        mkfs.vfat -F 32 "$work/vfat.img" > /dev/null &&
+        mcopy -s -i "$work/vfat.img" "$work/root/musl" ::/ || return 1
+    dd if=/dev/zero of="$work/ext4.img" bs=4M count=32 status=none &&
+        mkfs.ext4 -q -d "$work/root" "$work/ext4.img" || return 1
+}
+
+mkdir -p "$OUT_DIR" "$BASELINE_DIR"
+
+for arch in $ARCHS; do
+    echo -e "${CYAN_C}Benchmarking iozone${END_C} on $arch:"
+    work="$OUT_DIR/iozone-$arch"
+    actual="$OUT_DIR/iozone-$arch.out"
+    results="$OUT_DIR/iozone-$arch.csv"
+    report="$OUT_DIR/iozone-$arch.report"
+    baseline="$BASELINE_DIR/iozone-$arch.json"
+    config_file=$(realpath --relative-to=$AX_ROOT "$ROOT/configs/$arch.toml")
+
+    if ! build_images $arch "$work" > "$actual" 2>&1; then
+        echo -e "    ${RED_C}cannot build the images!${END_C}"
+        cat "$actual"
+        EXIT_STATUS=1
+        continue
+    fi
+
+    : > "$actual"
+    failed=0
+    for fs in $FSES; do
+        case $fs in
+            vfat) img=vfat.img; features=fp_simd; file=/iozone.tmp ;;
+            ext4) img=ext4.img; features=fp_simd,lwext4_rs; file=/iozone.tmp ;;
+            tmpfs) img=vfat.img; features=fp_simd; file=/tmp/iozone.tmp ;;
+            *)
+                echo -e "    ${RED_C}unknown filesystem $fs!${END_C}"
+                failed=1
+                break
+                ;;
+        esac
+        echo -e "    $fs..."
+        # The testcases are separated by commas, so there must be none in them.
+        list="/musl/busybox echo '#### IOZONE MATRIX $fs ####',/musl/iozone $IOZONE_ARGS -f $file"
+        args="AX_TESTCASE=oscomp LOG=off FEATURES=$features BLK=y ARCH=$arch ACCEL=n EXTRA_CONFIG=$config_file"
+        log="$work/$fs.out"
+
+        if ! make -C "$ROOT" $args AX_TESTCASES_LIST="$list" defconfig build > "$log" 2>&1; then
+            echo -e "    ${RED_C}build failed!${END_C}"
+            cat "$log"
+            failed=1
+            break
+        fi
+        cp "$work/$img" "$AX_ROOT/disk.img"
+        timeout --foreground $TIMEOUT make -C "$ROOT" $args AX_TESTCASES_LIST="$list" justrun > "$log" 2>&1
+        res=$?
+        cat "$log" >> "$actual"
+        if [ $res == 124 ]; then
+            echo -e "    ${YELLOW_C}timeout!${END_C}"
+            failed=2
+            break
+        elif [ $res -ne 0 ]; then
+            echo -e "    ${RED_C}run failed!${END_C}"
+            failed=1
+            break
+        fi
+    done
+    if [ $failed -ne 0 ]; then
+        EXIT_STATUS=$failed
+        continue
+    fi
+
+    if ! python3 $MATRIX < "$actual" > "$results"; then
+        echo -e "    ${RED_C}no results!${END_C}"
+        EXIT_STATUS=1
+        continue
+    fi
+    if [ "$BENCH_UPDATE" == "y" ] || [ ! -f "$baseline" ]; then
+        python3 $JUDGE --update "$baseline" < "$results" | tee "$report"
+    elif python3 $JUDGE "$baseline" $IOZONE_MAX_RATIO < "$results" > "$report"; then
+        echo -e "    ${GREEN_C}passed!${END_C}"
+        sed 's/^/    /' "$report"
+    else
+        echo -e "    ${RED_C}regressed!${END_C}"
+        sed 's/^/    /' "$report"
+        EXIT_STATUS=255
+    fi
+done
+
+echo -e "iozone bench script exited with: $EXIT_STATUS"
+exit $EXIT_STATUS
@@ -1,16 +1,25 @@
 use alloc::{string::String, sync::Arc};
 use axfs::{CURRENT_DIR, CURRENT_DIR_PATH, api::set_current_dir};
 use axhal::arch::UspaceContext;
-use axprocess::{Pid, init_proc};
+use axprocess::{Pid, Process, init_proc};
 use axsignal::Signo;
-use axsync::Mutex;
-use starry_api::file::FD_TABLE;
+use axtask::TaskExtRef;
+use starry_api::file::{CapturedOutput, FD_TABLE};
 use starry_core::{
-    mm::{copy_from_kernel, load_user_app, map_trampoline, new_user_aspace_empty},
+    mm::{
+        ExecArgs, copy_from_kernel, load_user_app, map_trampoline, new_user_aspace_empty,
+        share_aspace,
+    },
     task::{ProcessData, TaskExt, ThreadData, add_thread_to_table, new_user_task},
 };
 
-pub fn run_user_app(args: &[String], envs: &[String]) -> Option<i32> {
+/// Starts a user app as a child of the init process, with its standard
+/// output and error captured in `output` if given, and returns its process.
+pub fn spawn_user_app(
+    args: &[String],
+    envs: &[String],
+    output: Option<Arc<CapturedOutput>>,
+) -> Arc<Process> {
     let mut uspace = new_user_aspace_empty()
         .and_then(|mut it| {
             copy_from_kernel(&mut it)?;
@@ -23,7 +32,10 @@ pub fn run_user_app(args: &[String], envs: &[String]) -> Option<i32> {
     let (dir, name) = exe_path.rsplit_once('/').unwrap_or(("", &exe_path));
     set_current_dir(dir).expect("Failed to set current dir");
 
-    let (entry_vaddr, ustack_top) = load_user_app(&mut uspace, args, envs)
+    let mut exec_args = ExecArgs::new();
+    args.iter().for_each(|arg| exec_args.push_arg(arg));
+    envs.iter().for_each(|env| exec_args.push_env(env));
+    let (entry_vaddr, ustack_top) = load_user_app(&mut uspace, &mut exec_args)
         .unwrap_or_else(|e| panic!("Failed to load user app: {}", e));
 
     let uctx = UspaceContext::new(entry_vaddr.into(), ustack_top, 2333);
@@ -33,7 +45,7 @@ pub fn run_user_app(args: &[String], envs: &[String]) -> Option<i32> {
 
     let process_data = ProcessData::new(
         exe_path,
-        Arc::new(Mutex::new(uspace)),
+        share_aspace(uspace),
         Arc::default(),
         Some(Signo::SIGCHLD),
     );
@@ -41,6 +53,11 @@ pub fn run_user_app(args: &[String], envs: &[String]) -> Option<i32> {
     FD_TABLE
         .deref_from(&process_data.ns)
         .init_new(FD_TABLE.copy_inner());
+    if let Some(output) = output {
+        let mut fd_table = FD_TABLE.deref_from(&process_data.ns).write();
+        fd_table.add_at(1, output.clone(), false);
+        fd_table.add_at(2, output, false);
+    }
     CURRENT_DIR
         .deref_from(&process_data.ns)
         .init_new(CURRENT_DIR.copy_inner());
@@ -56,11 +73,22 @@ pub fn run_user_app(args: &[String], envs: &[String]) -> Option<i32> {
         .data(ThreadData::new(process.data().unwrap()))
         .build();
     add_thread_to_table(&thread);
+    #[cfg(feature = "profile")]
+    starry_core::profile::set_exe(process.pid(), &args[0]);
 
     task.init_task_ext(TaskExt::new(thread));
 
     let task = axtask::spawn_task(task);
+    task.task_ext().thread_data().set_task(&task);
+    process
+}
 
-    // TODO: we need a way to wait on the process but not only the main task
-    task.join()
+/// Waits for all the threads of a process started by [`spawn_user_app`] to
+/// exit, reaps it, and returns its exit status.
+pub fn wait_user_app(process: &Arc<Process>) -> i32 {
+    let data = process.data::<ProcessData>().unwrap();
+    data.wait_exit(process);
+    let exit_code = process.exit_code();
+    process.free();
+    exit_code
 }
@@ -10,17 +10,57 @@ extern crate axruntime;
 mod entry;
 mod mm;
 mod syscall;
+#[cfg(feature = "trace")]
+mod trace;
 
-#[unsafe(no_mangle)]
-fn main() {
-    // Create a init process
-    axprocess::Process::new_init(axtask::current().id().as_u64() as _).build();
+use alloc::{collections::VecDeque, string::String, sync::Arc, vec::Vec};
 
-    let testcases = option_env!("AX_TESTCASES_LIST")
-        .unwrap_or_else(|| "Please specify the testcases list by making user_apps")
-        .split(',')
-        .filter(|&x| !x.is_empty());
+use axprocess::Process;
+use starry_api::file::{
+    CapturedOutput, defer_kernel_logs, flush_console, flush_console_on_panic, kick_console_writer,
+};
+
+/// The number of testcases to run at the same time, from `AX_TESTCASES_JOBS`.
+fn testcase_jobs() -> usize {
+    option_env!("AX_TESTCASES_JOBS")
+        .and_then(|jobs| jobs.parse().ok())
+        .unwrap_or(1)
+        .max(1)
+}
+
+/// A testcase that was started.
+struct Running {
+    args: Vec<String>,
+    process: Arc<Process>,
+    output: Option<Arc<CapturedOutput>>,
+}
+
+impl Running {
+    /// Waits for all the threads of the testcase to exit and prints its
+    /// captured output.
+    fn finish(self) {
+        let exit_code = entry::wait_user_app(&self.process);
+        // Keep the output of the testcase ahead of what the kernel prints.
+        flush_console();
+        if let Some(output) = self.output {
+            axhal::console::write_bytes(&output.take());
+        }
+        info!(
+            "User task {:?} exited with code: {:?}",
+            self.args, exit_code
+        );
+    }
+}
 
+/// Runs the testcases in order, up to `jobs` of them at the same time.
+///
+/// With more than one job, the testcases must not depend on each other. Their
+/// output is captured and printed in the order of the list once each one
+/// exits, so that the log is the same as when they run one after another.
+/// A testcase that takes long holds up the ones after it from being reported,
+/// and from being replaced by new ones, until it exits.
+fn run_testcases<'a>(testcases: impl Iterator<Item = &'a str>, jobs: usize) {
+    let mut running = VecDeque::with_capacity(jobs);
     for testcase in testcases {
         let Some(args) = shlex::split(testcase) else {
             error!("Failed to parse testcase: {:?}", testcase);
@@ -29,8 +69,58 @@ fn main() {
         if args.is_empty() {
             continue;
         }
+        if running.len() == jobs {
+            if let Some(first) = running.pop_front() {
+                first.finish();
+            }
+        }
         info!("Running user task: {:?}", args);
-        let exit_code = entry::run_user_app(&args, &[]);
-        info!("User task {:?} exited with code: {:?}", args, exit_code);
+        let output = (jobs > 1).then(|| Arc::new(CapturedOutput::new()));
+        let process = entry::spawn_user_app(&args, &[], output.clone());
+        running.push_back(Running {
+            args,
+            process,
+            output,
+        });
+    }
+    running.into_iter().for_each(Running::finish);
+}
+
+#[unsafe(no_mangle)]
+fn main() {
+    axruntime::set_panic_hook(flush_console_on_panic);
+    defer_kernel_logs();
+    starry_api::procfs::init();
+    starry_core::mm::link_interpreters();
+    #[cfg(feature = "profile")]
+    starry_core::profile::start();
+    // Zero frames for page faults while the CPUs are idle.
+    axtask::set_idle_work(axmm::refill_zeroed_frames);
+    axtask::set_tick_work(|| {
+        starry_core::task::cpu_timers_on_tick();
+        starry_core::stat::on_tick();
+        kick_console_writer();
+        #[cfg(feature = "profile")]
+        starry_core::profile::sample_on_tick();
+    });
+
+    // Create a init process
+    axprocess::Process::new_init(axtask::current().id().as_u64() as _).build();
+    axruntime::record_boot_phase("kernel");
+    axruntime::print_boot_phases();
+
+    let testcases = option_env!("AX_TESTCASES_LIST")
+        .unwrap_or_else(|| "Please specify the testcases list by making user_apps")
+        .split(',')
+        .filter(|&x| !x.is_empty());
+    run_testcases(testcases, testcase_jobs());
+    flush_console();
+    syscall::log_syscall_counts();
+    #[cfg(feature = "trace")]
+    trace::export();
+    #[cfg(feature = "profile")]
+    starry_core::profile::report();
+    if let Err(e) = axfs::page_cache::sync_all() {
+        error!("Failed to write back the page cache: {:?}", e);
     }
 }
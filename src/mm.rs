@@ -3,13 +3,29 @@ use axhal::{
     paging::MappingFlags,
     trap::{PAGE_FAULT, register_trap_handler},
 };
+use axsignal::{SignalInfo, Signo};
 use axtask::{TaskExtRef, current};
-use linux_raw_sys::general::SIGSEGV;
-use starry_api::do_exit;
-use starry_core::mm::is_accessing_user_memory;
+use linux_raw_sys::general::{SI_KERNEL, SIGKILL, SIGSEGV};
+use memory_addr::{MemoryAddr, PAGE_SIZE_4K, VirtAddrRange};
+use starry_api::{do_exit, signal::send_signal_process};
+use starry_core::{
+    mm::is_accessing_user_memory,
+    task::{ProcessData, processes},
+};
+
+/// Below this number of free pages, a fault that fails on an accessible page
+/// is taken as the kernel being out of memory.
+const OOM_FREE_PAGES: usize = 64;
 
 #[register_trap_handler(PAGE_FAULT)]
 fn handle_page_fault(vaddr: VirtAddr, access_flags: MappingFlags, is_user: bool) -> bool {
+    axhal::trace_event!(PageFault, vaddr.as_usize(), access_flags.bits());
+    let handled = resolve_page_fault(vaddr, access_flags, is_user);
+    axhal::trace_event!(PageFaultDone, vaddr.as_usize(), handled);
+    handled
+}
+
+fn resolve_page_fault(vaddr: VirtAddr, access_flags: MappingFlags, is_user: bool) -> bool {
     warn!(
         "Page fault at {:#x}, access_flags: {:#x?}",
         vaddr, access_flags
@@ -19,20 +35,73 @@ fn handle_page_fault(vaddr: VirtAddr, access_flags: MappingFlags, is_user: bool)
     }
 
     let curr = current();
-    if !curr
-        .task_ext()
-        .process_data()
-        .aspace
-        .lock()
-        .handle_page_fault(vaddr, access_flags)
+    let aspace = curr.task_ext().process_data().aspace();
+    if aspace.read().handle_page_fault(vaddr, access_flags) {
+        return true;
+    }
+
+    let range = VirtAddrRange::from_start_size(vaddr.align_down_4k(), PAGE_SIZE_4K);
+    if aspace.read().check_region_access(range, access_flags)
+        && axalloc::global_allocator().available_pages() < OOM_FREE_PAGES
     {
+        if oom_kill() {
+            return true;
+        }
         warn!(
-            "{} ({:?}): segmentation fault at {:#x}, exit!",
+            "{} ({:?}): out of memory at {:#x}, killed!",
             curr.id_name(),
             curr.task_ext().thread,
             vaddr
         );
-        do_exit(SIGSEGV as _, true);
+        do_exit(128 + SIGKILL as i32, true);
+    }
+    warn!(
+        "{} ({:?}): segmentation fault at {:#x}, exit!",
+        curr.id_name(),
+        curr.task_ext().thread,
+        vaddr
+    );
+    do_exit(SIGSEGV as _, true);
+}
+
+/// Frees memory after a fault failed for lack of it, by killing the process
+/// with the largest resident set, other than `init`.
+///
+/// Returns whether the fault should be retried, or `false` if the faulting
+/// process is the one to kill.
+fn oom_kill() -> bool {
+    let curr = current();
+    let curr_pid = curr.task_ext().thread.process().pid();
+    // Address spaces being changed are skipped, as their owners may be
+    // waiting for memory too.
+    let victim = processes()
+        .into_iter()
+        .filter(|proc| !proc.is_init())
+        .filter_map(|proc| {
+            let rss = proc
+                .data::<ProcessData>()?
+                .aspace()
+                .try_read()?
+                .resident_pages();
+            Some((rss, proc))
+        })
+        .max_by_key(|(rss, _)| *rss);
+    let Some((rss, victim)) = victim else {
+        return false;
+    };
+    if victim.pid() == curr_pid {
+        return false;
+    }
+    // The victim may be exiting already, in which case its memory is about to
+    // be freed.
+    if !victim.is_group_exited() {
+        warn!(
+            "out of memory: killing process {} ({} pages resident)",
+            victim.pid(),
+            rss
+        );
+        let _ = send_signal_process(&victim, SignalInfo::new(Signo::SIGKILL, SI_KERNEL as _));
     }
+    axtask::yield_now();
     true
 }
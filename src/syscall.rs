@@ -1,233 +1,542 @@
-use axerrno::LinuxError;
+use axerrno::{LinuxError, LinuxResult};
 use axhal::{
     arch::TrapFrame,
+    time::monotonic_time_nanos,
     trap::{SYSCALL, register_trap_handler},
 };
+use axtask::{TaskExtRef, current};
 use starry_api::*;
-use starry_core::task::{time_stat_from_kernel_to_user, time_stat_from_user_to_kernel};
+use starry_core::syscall_stats::{self, NR_SYSCALLS};
 use syscalls::Sysno;
 
-#[register_trap_handler(SYSCALL)]
-fn handle_syscall(tf: &mut TrapFrame, syscall_num: usize) -> isize {
-    let sysno = Sysno::from(syscall_num as u32);
-    info!("Syscall {}", sysno);
-    time_stat_from_user_to_kernel();
-    let result = match sysno {
-        // fs ctl
-        Sysno::ioctl => sys_ioctl(tf.arg0() as _, tf.arg1() as _, tf.arg2().into()),
-        Sysno::chdir => sys_chdir(tf.arg0().into()),
-        Sysno::mkdirat => sys_mkdirat(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::getdents64 => sys_getdents64(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::linkat => sys_linkat(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2() as _,
-            tf.arg3().into(),
-            tf.arg4() as _,
-        ),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::link => sys_link(tf.arg0().into(), tf.arg1().into()),
-        Sysno::unlinkat => sys_unlinkat(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::unlink => sys_unlink(tf.arg0().into()),
-        Sysno::getcwd => sys_getcwd(tf.arg0().into(), tf.arg1() as _),
-
-        // fd ops
-        Sysno::openat => sys_openat(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2() as _,
-            tf.arg3() as _,
-        ),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::open => sys_open(tf.arg0().into(), tf.arg1() as _, tf.arg2() as _),
-        Sysno::close => sys_close(tf.arg0() as _),
-        Sysno::dup => sys_dup(tf.arg0() as _),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::dup2 => sys_dup2(tf.arg0() as _, tf.arg1() as _),
-        Sysno::dup3 => sys_dup2(tf.arg0() as _, tf.arg1() as _),
-        Sysno::fcntl => sys_fcntl(tf.arg0() as _, tf.arg1() as _, tf.arg2() as _),
-        // Sysno::access => sys_access(tf.arg0().into(), tf.arg1() as _),
-
-        // io
-        Sysno::read => sys_read(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::readv => sys_readv(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::write => sys_write(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::writev => sys_writev(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
-        Sysno::lseek => sys_lseek(tf.arg0() as _, tf.arg1() as _, tf.arg2() as _),
-        Sysno::sendfile => sys_sendfile(
-            tf.arg0() as _,
-            tf.arg1() as _,
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::poll => sys_poll(
-            tf.arg0().into(),
-            tf.arg1() as _,
-            tf.arg2() as _,
-        ),
-        // Sysno::ppoll => sys_ppoll(
-        //     tf.arg0().into(),
-        //     tf.arg1() as _,
-        //     tf.arg2().into(),
-        //     tf.arg3() as _,
-        // ),
-
-        // fs mount
-        Sysno::mount => sys_mount(
-            tf.arg0().into(),
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-            tf.arg4().into(),
-        ) as _,
-        Sysno::umount2 => sys_umount2(tf.arg0().into(), tf.arg1() as _) as _,
-
-        // pipe
-        Sysno::pipe2 => sys_pipe2(tf.arg0().into(), tf.arg1() as _),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::pipe => sys_pipe2(tf.arg0().into(), 0),
-
-        // fs stat
-        #[cfg(target_arch = "x86_64")]
-        Sysno::stat => sys_stat(tf.arg0().into(), tf.arg1().into()),
-        Sysno::fstat => sys_fstat(tf.arg0() as _, tf.arg1().into()),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::lstat => sys_lstat(tf.arg0().into(), tf.arg1().into()),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::newfstatat => sys_fstatat(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        #[cfg(not(target_arch = "x86_64"))]
-        Sysno::fstatat => sys_fstatat(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        Sysno::statx => sys_statx(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2() as _,
-            tf.arg3() as _,
-            tf.arg4().into(),
-        ),
-
-        // mm
-        Sysno::brk => sys_brk(tf.arg0() as _),
-        Sysno::mmap => sys_mmap(
-            tf.arg0(),
-            tf.arg1() as _,
-            tf.arg2() as _,
-            tf.arg3() as _,
-            tf.arg4() as _,
-            tf.arg5() as _,
-        ),
-        Sysno::munmap => sys_munmap(tf.arg0(), tf.arg1() as _),
-        Sysno::mprotect => sys_mprotect(tf.arg0(), tf.arg1() as _, tf.arg2() as _),
-
-        // task info
-        Sysno::getpid => sys_getpid(),
-        Sysno::getppid => sys_getppid(),
-        Sysno::gettid => sys_gettid(),
+/// A syscall handler, which takes the trap frame and the syscall arguments.
+type SyscallHandler = fn(&mut TrapFrame, [usize; 6]) -> LinuxResult<isize>;
 
-        // task sched
-        Sysno::sched_yield => sys_sched_yield(),
-        Sysno::nanosleep => sys_nanosleep(tf.arg0().into(), tf.arg1().into()),
+/// The syscalls implemented on the target architecture.
+const SYSCALLS: &[(Sysno, SyscallHandler)] = &[
+    // fs ctl
+    (Sysno::ioctl, |_, a| {
+        sys_ioctl(a[0] as _, a[1] as _, a[2].into())
+    }),
+    (Sysno::chdir, |_, a| sys_chdir(a[0].into())),
+    (Sysno::mkdirat, |_, a| {
+        sys_mkdirat(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::getdents64, |_, a| {
+        sys_getdents64(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::linkat, |_, a| {
+        sys_linkat(a[0] as _, a[1].into(), a[2] as _, a[3].into(), a[4] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::link, |_, a| sys_link(a[0].into(), a[1].into())),
+    (Sysno::unlinkat, |_, a| {
+        sys_unlinkat(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::unlink, |_, a| sys_unlink(a[0].into())),
+    (Sysno::symlinkat, |_, a| {
+        sys_symlinkat(a[0].into(), a[1] as _, a[2].into())
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::symlink, |_, a| sys_symlink(a[0].into(), a[1].into())),
+    (Sysno::readlinkat, |_, a| {
+        sys_readlinkat(a[0] as _, a[1].into(), a[2].into(), a[3] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::readlink, |_, a| {
+        sys_readlink(a[0].into(), a[1].into(), a[2] as _)
+    }),
+    (Sysno::getcwd, |_, a| sys_getcwd(a[0].into(), a[1] as _)),
+    // fd ops
+    (Sysno::openat, |_, a| {
+        sys_openat(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::open, |_, a| {
+        sys_open(a[0].into(), a[1] as _, a[2] as _)
+    }),
+    (Sysno::close, |_, a| sys_close(a[0] as _)),
+    (Sysno::dup, |_, a| sys_dup(a[0] as _)),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::dup2, |_, a| sys_dup2(a[0] as _, a[1] as _)),
+    (Sysno::dup3, |_, a| {
+        sys_dup3(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::close_range, |_, a| {
+        sys_close_range(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::fcntl, |_, a| {
+        sys_fcntl(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::memfd_create, |_, a| sys_memfd_create(a[0].into(), a[1] as _)),
+    // Sysno::access => sys_access(tf.arg0().into(), tf.arg1()),
 
-        // task ops
-        Sysno::execve => sys_execve(tf.arg0().into(), tf.arg1().into(), tf.arg2().into()),
-        Sysno::set_tid_address => sys_set_tid_address(tf.arg0()),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::arch_prctl => sys_arch_prctl(tf, tf.arg0() as _, tf.arg1() as _),
-
-        // task management
-        Sysno::clone => sys_clone(
+    // io
+    (Sysno::read, |_, a| {
+        sys_read(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::readv, |_, a| {
+        sys_readv(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::write, |_, a| {
+        sys_write(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::pread64, |_, a| {
+        sys_pread64(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    (Sysno::pwrite64, |_, a| {
+        sys_pwrite64(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    // The high half of the offset is always 0 on 64-bit architectures.
+    (Sysno::preadv, |_, a| {
+        sys_preadv(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    (Sysno::pwritev, |_, a| {
+        sys_pwritev(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    (Sysno::writev, |_, a| {
+        sys_writev(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::lseek, |_, a| {
+        sys_lseek(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::fadvise64, |_, a| {
+        sys_fadvise64(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    (Sysno::ftruncate, |_, a| sys_ftruncate(a[0] as _, a[1] as _)),
+    (Sysno::fallocate, |_, a| {
+        sys_fallocate(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    (Sysno::fsync, |_, a| sys_fsync(a[0] as _)),
+    (Sysno::fdatasync, |_, a| sys_fdatasync(a[0] as _)),
+    (Sysno::sync_file_range, |_, a| {
+        sys_sync_file_range(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    (Sysno::sync, |_, _| sys_sync()),
+    (Sysno::syncfs, |_, a| sys_syncfs(a[0] as _)),
+    (Sysno::sendfile, |_, a| {
+        sys_sendfile(a[0] as _, a[1] as _, a[2].into(), a[3] as _)
+    }),
+    (Sysno::copy_file_range, |_, a| {
+        sys_copy_file_range(
+            a[0] as _,
+            a[1].into(),
+            a[2] as _,
+            a[3].into(),
+            a[4] as _,
+            a[5] as _,
+        )
+    }),
+    (Sysno::splice, |_, a| {
+        sys_splice(
+            a[0] as _,
+            a[1].into(),
+            a[2] as _,
+            a[3].into(),
+            a[4] as _,
+            a[5] as _,
+        )
+    }),
+    (Sysno::tee, |_, a| {
+        sys_tee(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    (Sysno::vmsplice, |_, a| {
+        sys_vmsplice(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::poll, |_, a| {
+        sys_poll(a[0].into(), a[1] as _, a[2] as _)
+    }),
+    (Sysno::epoll_create1, |_, a| sys_epoll_create1(a[0] as _)),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::epoll_create, |_, a| sys_epoll_create(a[0] as _)),
+    (Sysno::epoll_ctl, |_, a| {
+        sys_epoll_ctl(a[0] as _, a[1] as _, a[2] as _, a[3].into())
+    }),
+    (Sysno::epoll_pwait, |tf, a| {
+        sys_epoll_pwait(
+            tf,
+            a[0] as _,
+            a[1].into(),
+            a[2] as _,
+            a[3] as _,
+            a[4].into(),
+            a[5] as _,
+        )
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::epoll_wait, |tf, a| {
+        sys_epoll_wait(tf, a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    (Sysno::ppoll, |tf, a| {
+        sys_ppoll(
+            tf,
+            a[0].into(),
+            a[1] as _,
+            a[2].into(),
+            a[3].into(),
+            a[4] as _,
+        )
+    }),
+    (Sysno::pselect6, |tf, a| {
+        sys_pselect6(
             tf,
-            tf.arg0() as _,
-            tf.arg1() as _,
-            tf.arg2(),
-            tf.arg3(),
-            tf.arg4(),
-        ),
-        #[cfg(target_arch = "x86_64")]
-        Sysno::fork => sys_fork(tf),
-        Sysno::exit => sys_exit(tf.arg0() as _),
-        Sysno::exit_group => sys_exit_group(tf.arg0() as _),
-        Sysno::wait4 => sys_waitpid(tf.arg0() as _, tf.arg1().into(), tf.arg2() as _),
+            a[0] as _,
+            a[1].into(),
+            a[2].into(),
+            a[3].into(),
+            a[4].into(),
+            a[5].into(),
+        )
+    }),
+    // event
+    (Sysno::eventfd2, |_, a| sys_eventfd2(a[0] as _, a[1] as _)),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::eventfd, |_, a| sys_eventfd(a[0] as _)),
+    (Sysno::timerfd_create, |_, a| {
+        sys_timerfd_create(a[0] as _, a[1] as _)
+    }),
+    (Sysno::timerfd_settime, |_, a| {
+        sys_timerfd_settime(a[0] as _, a[1] as _, a[2].into(), a[3].into())
+    }),
+    (Sysno::timerfd_gettime, |_, a| {
+        sys_timerfd_gettime(a[0] as _, a[1].into())
+    }),
+    (Sysno::signalfd4, |_, a| {
+        sys_signalfd4(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::signalfd, |_, a| {
+        sys_signalfd(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::perf_event_open, |_, a| {
+        sys_perf_event_open(a[0].into(), a[1] as _, a[2] as _, a[3] as _, a[4] as _)
+    }),
+    (Sysno::io_uring_setup, |_, a| {
+        sys_io_uring_setup(a[0] as _, a[1].into())
+    }),
+    (Sysno::io_uring_enter, |_, a| {
+        sys_io_uring_enter(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    // fs mount
+    (Sysno::mount, |_, a| {
+        sys_mount(
+            a[0].into(),
+            a[1].into(),
+            a[2].into(),
+            a[3] as _,
+            a[4].into(),
+        )
+    }),
+    (Sysno::umount2, |_, a| sys_umount2(a[0].into(), a[1] as _)),
+    // pipe
+    (Sysno::pipe2, |_, a| sys_pipe2(a[0].into(), a[1] as _)),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::pipe, |_, a| sys_pipe2(a[0].into(), 0)),
+    // net
+    (Sysno::socketpair, |_, a| {
+        sys_socketpair(a[0] as _, a[1] as _, a[2] as _, a[3].into())
+    }),
+    (Sysno::sendmsg, |_, a| {
+        sys_sendmsg(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::recvmsg, |_, a| {
+        sys_recvmsg(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    // fs stat
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::stat, |_, a| sys_stat(a[0].into(), a[1].into())),
+    (Sysno::fstat, |_, a| sys_fstat(a[0] as _, a[1].into())),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::lstat, |_, a| sys_lstat(a[0].into(), a[1].into())),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::newfstatat, |_, a| {
+        sys_fstatat(a[0] as _, a[1].into(), a[2].into(), a[3] as _)
+    }),
+    #[cfg(not(target_arch = "x86_64"))]
+    (Sysno::fstatat, |_, a| {
+        sys_fstatat(a[0] as _, a[1].into(), a[2].into(), a[3] as _)
+    }),
+    (Sysno::statx, |_, a| {
+        sys_statx(a[0] as _, a[1].into(), a[2] as _, a[3] as _, a[4].into())
+    }),
+    // mm
+    (Sysno::brk, |_, a| sys_brk(a[0] as _)),
+    (Sysno::mmap, |_, a| {
+        sys_mmap(a[0], a[1] as _, a[2] as _, a[3] as _, a[4] as _, a[5] as _)
+    }),
+    (Sysno::munmap, |_, a| sys_munmap(a[0], a[1] as _)),
+    (Sysno::msync, |_, a| sys_msync(a[0], a[1] as _, a[2] as _)),
+    (Sysno::mprotect, |_, a| {
+        sys_mprotect(a[0], a[1] as _, a[2] as _)
+    }),
+    (Sysno::madvise, |_, a| {
+        sys_madvise(a[0], a[1] as _, a[2] as _)
+    }),
+    (Sysno::mremap, |_, a| {
+        sys_mremap(a[0], a[1] as _, a[2] as _, a[3] as _, a[4] as _)
+    }),
+    (Sysno::process_vm_readv, |_, a| {
+        sys_process_vm_readv(
+            a[0] as _,
+            a[1].into(),
+            a[2] as _,
+            a[3].into(),
+            a[4] as _,
+            a[5] as _,
+        )
+    }),
+    (Sysno::process_vm_writev, |_, a| {
+        sys_process_vm_writev(
+            a[0] as _,
+            a[1].into(),
+            a[2] as _,
+            a[3].into(),
+            a[4] as _,
+            a[5] as _,
+        )
+    }),
+    // task info
+    (Sysno::getpid, |_, _| sys_getpid()),
+    (Sysno::getppid, |_, _| sys_getppid()),
+    (Sysno::gettid, |_, _| sys_gettid()),
+    // task sched
+    (Sysno::sched_yield, |_, _| sys_sched_yield()),
+    (Sysno::getpriority, |_, a| {
+        sys_getpriority(a[0] as _, a[1] as _)
+    }),
+    (Sysno::setpriority, |_, a| {
+        sys_setpriority(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::sched_setattr, |_, a| {
+        sys_sched_setattr(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::sched_getattr, |_, a| {
+        sys_sched_getattr(a[0] as _, a[1].into(), a[2] as _, a[3] as _)
+    }),
+    (Sysno::sched_setscheduler, |_, a| {
+        sys_sched_setscheduler(a[0] as _, a[1] as _, a[2].into())
+    }),
+    (Sysno::sched_getscheduler, |_, a| {
+        sys_sched_getscheduler(a[0] as _)
+    }),
+    (Sysno::sched_setparam, |_, a| {
+        sys_sched_setparam(a[0] as _, a[1].into())
+    }),
+    (Sysno::sched_getparam, |_, a| {
+        sys_sched_getparam(a[0] as _, a[1].into())
+    }),
+    (Sysno::sched_get_priority_max, |_, a| {
+        sys_sched_get_priority_max(a[0] as _)
+    }),
+    (Sysno::sched_get_priority_min, |_, a| {
+        sys_sched_get_priority_min(a[0] as _)
+    }),
+    (Sysno::sched_setaffinity, |_, a| {
+        sys_sched_setaffinity(a[0] as _, a[1] as _, a[2].into())
+    }),
+    (Sysno::sched_getaffinity, |_, a| {
+        sys_sched_getaffinity(a[0] as _, a[1] as _, a[2].into())
+    }),
+    (Sysno::getcpu, |_, a| sys_getcpu(a[0].into(), a[1].into())),
+    (Sysno::rseq, |_, a| {
+        sys_rseq(a[0] as _, a[1] as _, a[2] as _, a[3] as _)
+    }),
+    (Sysno::membarrier, |_, a| {
+        sys_membarrier(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::nanosleep, |_, a| {
+        sys_nanosleep(a[0].into(), a[1].into())
+    }),
+    (Sysno::clock_nanosleep, |_, a| {
+        sys_clock_nanosleep(a[0] as _, a[1] as _, a[2].into(), a[3].into())
+    }),
+    // task ops
+    (Sysno::execve, |_, a| {
+        sys_execve(a[0].into(), a[1].into(), a[2].into())
+    }),
+    (Sysno::set_tid_address, |_, a| sys_set_tid_address(a[0])),
+    (Sysno::set_robust_list, |_, a| {
+        sys_set_robust_list(a[0].into(), a[1] as _)
+    }),
+    (Sysno::get_robust_list, |_, a| {
+        sys_get_robust_list(a[0] as _, a[1].into(), a[2].into())
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::arch_prctl, |tf, a| {
+        sys_arch_prctl(tf, a[0] as _, a[1] as _)
+    }),
+    // task management
+    (Sysno::clone, |tf, a| {
+        sys_clone(tf, a[0] as _, a[1] as _, a[2], a[3], a[4])
+    }),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::fork, |tf, _| sys_fork(tf)),
+    #[cfg(target_arch = "x86_64")]
+    (Sysno::vfork, |tf, _| sys_vfork(tf)),
+    (Sysno::exit, |_, a| sys_exit(a[0] as _)),
+    (Sysno::exit_group, |_, a| sys_exit_group(a[0] as _)),
+    (Sysno::wait4, |_, a| {
+        sys_waitpid(a[0] as _, a[1].into(), a[2] as _)
+    }),
+    (Sysno::waitid, |_, a| {
+        sys_waitid(a[0] as _, a[1] as _, a[2].into(), a[3] as _)
+    }),
+    // signal
+    (Sysno::rt_sigprocmask, |_, a| {
+        sys_rt_sigprocmask(a[0] as _, a[1].into(), a[2].into(), a[3] as _)
+    }),
+    (Sysno::rt_sigaction, |_, a| {
+        sys_rt_sigaction(a[0] as _, a[1].into(), a[2].into(), a[3] as _)
+    }),
+    (Sysno::rt_sigpending, |_, a| {
+        sys_rt_sigpending(a[0].into(), a[1] as _)
+    }),
+    (Sysno::rt_sigreturn, |tf, _| sys_rt_sigreturn(tf)),
+    (Sysno::rt_sigtimedwait, |_, a| {
+        sys_rt_sigtimedwait(a[0].into(), a[1].into(), a[2].into(), a[3] as _)
+    }),
+    (Sysno::rt_sigsuspend, |tf, a| {
+        sys_rt_sigsuspend(tf, a[0].into(), a[1] as _)
+    }),
+    (Sysno::kill, |_, a| sys_kill(a[0] as _, a[1] as _)),
+    (Sysno::tkill, |_, a| sys_tkill(a[0] as _, a[1] as _)),
+    (Sysno::tgkill, |_, a| {
+        sys_tgkill(a[0] as _, a[1] as _, a[2] as _)
+    }),
+    (Sysno::rt_sigqueueinfo, |_, a| {
+        sys_rt_sigqueueinfo(a[0] as _, a[1] as _, a[2].into(), a[3] as _)
+    }),
+    (Sysno::rt_tgsigqueueinfo, |_, a| {
+        sys_rt_tgsigqueueinfo(a[0] as _, a[1] as _, a[2] as _, a[3].into(), a[4] as _)
+    }),
+    (Sysno::sigaltstack, |_, a| {
+        sys_sigaltstack(a[0].into(), a[1].into())
+    }),
+    (Sysno::futex, |_, a| {
+        sys_futex(
+            a[0].into(),
+            a[1] as _,
+            a[2] as _,
+            a[3].into(),
+            a[4].into(),
+            a[5] as _,
+        )
+    }),
+    (Sysno::futex_waitv, |_, a| {
+        sys_futex_waitv(a[0].into(), a[1] as _, a[2] as _, a[3].into(), a[4] as _)
+    }),
+    // sys
+    (Sysno::getuid, |_, _| sys_getuid()),
+    (Sysno::geteuid, |_, _| sys_geteuid()),
+    (Sysno::getgid, |_, _| sys_getgid()),
+    (Sysno::getegid, |_, _| sys_getegid()),
+    (Sysno::uname, |_, a| sys_uname(a[0].into())),
+    (Sysno::getrusage, |_, a| sys_getrusage(a[0] as _, a[1].into())),
+    (Sysno::prlimit64, |_, a| {
+        sys_prlimit64(a[0] as _, a[1] as _, a[2].into(), a[3].into())
+    }),
+    #[cfg(not(target_arch = "loongarch64"))]
+    (Sysno::getrlimit, |_, a| {
+        sys_getrlimit(a[0] as _, a[1].into())
+    }),
+    #[cfg(not(target_arch = "loongarch64"))]
+    (Sysno::setrlimit, |_, a| {
+        sys_setrlimit(a[0] as _, a[1].into())
+    }),
+    (Sysno::syslog, |_, _| Ok(0)),
+    // time
+    (Sysno::gettimeofday, |_, a| sys_gettimeofday(a[0].into())),
+    (Sysno::times, |_, a| sys_times(a[0].into())),
+    (Sysno::getitimer, |_, a| {
+        sys_getitimer(a[0] as _, a[1].into())
+    }),
+    (Sysno::setitimer, |_, a| {
+        sys_setitimer(a[0] as _, a[1].into(), a[2].into())
+    }),
+    (Sysno::timer_create, |_, a| {
+        sys_timer_create(a[0] as _, a[1].into(), a[2].into())
+    }),
+    (Sysno::timer_settime, |_, a| {
+        sys_timer_settime(a[0] as _, a[1] as _, a[2].into(), a[3].into())
+    }),
+    (Sysno::timer_gettime, |_, a| {
+        sys_timer_gettime(a[0] as _, a[1].into())
+    }),
+    (Sysno::timer_getoverrun, |_, a| {
+        sys_timer_getoverrun(a[0] as _)
+    }),
+    (Sysno::timer_delete, |_, a| sys_timer_delete(a[0] as _)),
+    (Sysno::clock_gettime, |_, a| {
+        sys_clock_gettime(a[0] as _, a[1].into())
+    }),
+];
 
-        // signal
-        Sysno::rt_sigprocmask => sys_rt_sigprocmask(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        Sysno::rt_sigaction => sys_rt_sigaction(
-            tf.arg0() as _,
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        Sysno::rt_sigpending => sys_rt_sigpending(tf.arg0().into(), tf.arg1() as _),
-        Sysno::rt_sigreturn => sys_rt_sigreturn(tf),
-        Sysno::rt_sigtimedwait => sys_rt_sigtimedwait(
-            tf.arg0().into(),
-            tf.arg1().into(),
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        Sysno::rt_sigsuspend => sys_rt_sigsuspend(tf, tf.arg0().into(), tf.arg1() as _),
-        Sysno::kill => sys_kill(tf.arg0() as _, tf.arg1() as _),
-        Sysno::tkill => sys_tkill(tf.arg0() as _, tf.arg1() as _),
-        Sysno::tgkill => sys_tgkill(tf.arg0() as _, tf.arg1() as _, tf.arg2() as _),
-        Sysno::rt_sigqueueinfo => sys_rt_sigqueueinfo(
-            tf.arg0() as _,
-            tf.arg1() as _,
-            tf.arg2().into(),
-            tf.arg3() as _,
-        ),
-        Sysno::rt_tgsigqueueinfo => sys_rt_tgsigqueueinfo(
-            tf.arg0() as _,
-            tf.arg1() as _,
-            tf.arg2() as _,
-            tf.arg3().into(),
-            tf.arg4() as _,
-        ),
-        Sysno::sigaltstack => sys_sigaltstack(tf.arg0().into(), tf.arg1().into()),
-        Sysno::futex => sys_futex(
-            tf.arg0().into(),
-            tf.arg1() as _,
-            tf.arg2() as _,
-            tf.arg3().into(),
-            tf.arg4().into(),
-            tf.arg5() as _,
-        ),
+/// The syscall handlers, indexed by syscall number.
+static SYSCALL_TABLE: [Option<SyscallHandler>; NR_SYSCALLS] = build_syscall_table(SYSCALLS);
 
-        // sys
-        Sysno::getuid => sys_getuid(),
-        Sysno::geteuid => sys_geteuid(),
-        Sysno::getgid => sys_getgid(),
-        Sysno::getegid => sys_getegid(),
-        Sysno::uname => sys_uname(tf.arg0().into()),
-        Sysno::syslog => Ok(0),
+const fn build_syscall_table(
+    syscalls: &[(Sysno, SyscallHandler)],
+) -> [Option<SyscallHandler>; NR_SYSCALLS] {
+    let mut table = [None; NR_SYSCALLS];
+    let mut i = 0;
+    while i < syscalls.len() {
+        let (sysno, handler) = syscalls[i];
+        assert!(table[sysno as usize].is_none(), "duplicate syscall handler");
+        table[sysno as usize] = Some(handler);
+        i += 1;
+    }
+    table
+}
 
-        // time
-        Sysno::gettimeofday => sys_gettimeofday(tf.arg0().into()),
-        Sysno::times => sys_times(tf.arg0().into()),
-        Sysno::clock_gettime => sys_clock_gettime(tf.arg0() as _, tf.arg1().into()),
+/// Logs the number of calls to each syscall that has been called.
+pub fn log_syscall_counts() {
+    for sysno in 0..NR_SYSCALLS {
+        let count = syscall_stats::count(sysno);
+        if count > 0 {
+            info!(
+                "Syscall {} called {} times",
+                Sysno::from(sysno as u32),
+                count
+            );
+        }
+    }
+}
 
-        _ => {
-            warn!("Unimplemented syscall: {}", sysno);
+#[register_trap_handler(SYSCALL)]
+fn handle_syscall(tf: &mut TrapFrame, syscall_num: usize) -> isize {
+    // With `fast-syscall`, nothing is logged here.
+    #[cfg(not(feature = "fast-syscall"))]
+    info!("Syscall {}", Sysno::from(syscall_num as u32));
+    axhal::trace_event!(SyscallEnter, syscall_num, current().id().as_u64());
+    let args = [
+        tf.arg0(),
+        tf.arg1(),
+        tf.arg2(),
+        tf.arg3(),
+        tf.arg4(),
+        tf.arg5(),
+    ];
+    let result = match SYSCALL_TABLE.get(syscall_num).copied().flatten() {
+        Some(handler) => {
+            let start = monotonic_time_nanos();
+            let result = handler(tf, args);
+            syscall_stats::record(
+                syscall_num,
+                monotonic_time_nanos() - start,
+                &current().task_ext().process_data().syscall_stats,
+            );
+            result
+        }
+        None => {
+            warn!("Unimplemented syscall: {}", Sysno::from(syscall_num as u32));
             Err(LinuxError::ENOSYS)
         }
     };
     let ans = result.unwrap_or_else(|err| -err.code() as _);
-    time_stat_from_kernel_to_user();
-    info!("Syscall {:?} return {}", sysno, ans);
+    axhal::trace_event!(SyscallExit, syscall_num, ans);
+    #[cfg(not(feature = "fast-syscall"))]
+    info!("Syscall {} return {}", Sysno::from(syscall_num as u32), ans);
     ans
 }
@@ -0,0 +1,113 @@
+//! Exporting the events of tracepoints, see [`axhal::trace`].
+
+use alloc::{format, string::String};
+use core::fmt::{self, Display, Write};
+
+use axhal::trace::{self, Event, Record};
+use syscalls::Sysno;
+
+/// Where the trace is written, in the Chrome trace event format that
+/// Perfetto and `chrome://tracing` open as a timeline.
+const TRACE_PATH: &str = "/trace.json";
+
+/// Formats nanoseconds as the microseconds of the trace format.
+struct Micros(u64);
+
+impl Display for Micros {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{}.{:03}", self.0 / 1000, self.0 % 1000)
+    }
+}
+
+/// Appends a trace event of phase `ph` for the record `r`.
+fn push_event(json: &mut String, ph: &str, name: &dyn Display, pid: u32, tid: u64, r: &Record) {
+    let _ = write!(
+        json,
+        ",\n{{\"ph\":\"{}\",\"name\":\"{}\",\"pid\":{},\"tid\":{},\"ts\":{},\
+         \"args\":{{\"a0\":\"{:#x}\",\"a1\":\"{:#x}\"}}}}",
+        ph,
+        name,
+        pid,
+        tid,
+        Micros(r.time_nanos),
+        r.args[0],
+        r.args[1],
+    );
+}
+
+/// Converts the events kept in the trace rings to the Chrome trace event
+/// format.
+///
+/// The tasks running on each CPU are shown under the "CPUs" process, and the
+/// syscalls, page faults and sleeps of each task under the "tasks" process.
+fn to_json() -> String {
+    const CPUS: u32 = 0;
+    const TASKS: u32 = 1;
+
+    let mut json = format!(
+        "{{\"traceEvents\":[\n\
+         {{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":{CPUS},\"args\":{{\"name\":\"CPUs\"}}}},\n\
+         {{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":{TASKS},\"args\":{{\"name\":\"tasks\"}}}}"
+    );
+
+    let mut last_cpu = usize::MAX;
+    // The task running on the CPU, and since when, as far as the events go.
+    let mut running: Option<(u64, u64)> = None;
+    trace::for_each_record(|cpu_id, r| {
+        if cpu_id != last_cpu {
+            last_cpu = cpu_id;
+            running = None;
+        }
+        let task = running.map_or(0, |(task, _)| task);
+        match r.event {
+            Event::ContextSwitch => {
+                if let Some((prev, since)) = running {
+                    let _ = write!(
+                        json,
+                        ",\n{{\"ph\":\"X\",\"name\":\"task {}\",\"pid\":{},\"tid\":{},\"ts\":{},\"dur\":{}}}",
+                        prev,
+                        CPUS,
+                        cpu_id,
+                        Micros(since),
+                        Micros(r.time_nanos - since),
+                    );
+                }
+                running = Some((r.args[1], r.time_nanos));
+            }
+            Event::Block => push_event(&mut json, "B", &"blocked", TASKS, r.args[0], r),
+            Event::Unblock => push_event(&mut json, "E", &"blocked", TASKS, r.args[0], r),
+            Event::SyscallEnter => {
+                let name = Sysno::from(r.args[0] as u32);
+                push_event(&mut json, "B", &name, TASKS, r.args[1], r);
+            }
+            Event::SyscallExit => {
+                let name = Sysno::from(r.args[0] as u32);
+                push_event(&mut json, "E", &name, TASKS, task, r);
+            }
+            Event::PageFault => push_event(&mut json, "B", &"page fault", TASKS, task, r),
+            Event::PageFaultDone => push_event(&mut json, "E", &"page fault", TASKS, task, r),
+            Event::RunDelay => {
+                let delay = r.args[1].min(r.time_nanos);
+                let _ = write!(
+                    json,
+                    ",\n{{\"ph\":\"X\",\"name\":\"runnable\",\"pid\":{},\"tid\":{},\"ts\":{},\"dur\":{}}}",
+                    TASKS,
+                    r.args[0],
+                    Micros(r.time_nanos - delay),
+                    Micros(delay),
+                );
+            }
+        }
+    });
+    json.push_str("\n]}\n");
+    json
+}
+
+/// Stops recording and writes the trace to [`TRACE_PATH`].
+pub fn export() {
+    trace::set_enabled(false);
+    match axfs::api::write(TRACE_PATH, to_json()) {
+        Ok(()) => info!("Trace written to {}", TRACE_PATH),
+        Err(e) => error!("Failed to write the trace: {:?}", e),
+    }
+}